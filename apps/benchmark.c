@@ -0,0 +1,308 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ * This file is part of ToaruOS and is released under the terms
+ * of the NCSA / University of Illinois License - see LICENSE.md
+ * Copyright (C) 2018 K. Lange
+ *
+ * benchmark - Time the hot library paths
+ *
+ * Microbenchmarks for the things that show up in profiles: sprite
+ * blits and blurs from libtoaru_graphics, malloc patterns, hashmap
+ * lookups, pex round trips, and file reads through the VFS. Each
+ * test warms up first, then reports nanoseconds per operation so
+ * regressions in these paths are visible before they ship.
+ *
+ * Run inside the OS: `benchmark`, or `make benchmarks` to build it.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include <toaru/graphics.h>
+#include <toaru/hashmap.h>
+#include <toaru/pex.h>
+
+#define WARMUP_OPS 16
+
+static uint64_t now_ns(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t)t.tv_sec * 1000000000ULL + (uint64_t)t.tv_nsec;
+}
+
+static void report(const char * name, uint64_t total_ns, uint32_t ops) {
+	printf("%-32s %10u ns/op  (%u ops)\n", name, (unsigned int)(total_ns / ops), ops);
+}
+
+/*
+ * Graphics: blits into an offscreen sprite-backed context, so this
+ * runs headless and measures the library rather than the display.
+ */
+static void bench_graphics(void) {
+	sprite_t * target = create_sprite(512, 512, ALPHA_OPAQUE);
+	gfx_context_t * ctx = init_graphics_sprite(target);
+	draw_fill(ctx, rgb(40, 40, 40));
+
+	sprite_t * opaque = create_sprite(128, 128, ALPHA_OPAQUE);
+	sprite_t * translucent = create_sprite(128, 128, ALPHA_EMBEDDED);
+	gfx_context_t * tmp = init_graphics_sprite(opaque);
+	draw_fill(tmp, rgb(120, 88, 20));
+	free(tmp);
+	tmp = init_graphics_sprite(translucent);
+	draw_fill(tmp, premultiply(rgba(120, 88, 20, 127)));
+	free(tmp);
+
+	uint32_t ops = 500;
+	for (uint32_t i = 0; i < WARMUP_OPS; ++i) draw_sprite(ctx, opaque, 64, 64);
+	uint64_t start = now_ns();
+	for (uint32_t i = 0; i < ops; ++i) draw_sprite(ctx, opaque, (i % 64), (i % 64));
+	report("draw_sprite (opaque 128x128)", now_ns() - start, ops);
+
+	for (uint32_t i = 0; i < WARMUP_OPS; ++i) draw_sprite(ctx, translucent, 64, 64);
+	start = now_ns();
+	for (uint32_t i = 0; i < ops; ++i) draw_sprite(ctx, translucent, (i % 64), (i % 64));
+	report("draw_sprite (alpha 128x128)", now_ns() - start, ops);
+
+	ops = 200;
+	for (uint32_t i = 0; i < WARMUP_OPS; ++i) draw_sprite_scaled(ctx, opaque, 0, 0, 256, 256);
+	start = now_ns();
+	for (uint32_t i = 0; i < ops; ++i) draw_sprite_scaled(ctx, opaque, 0, 0, 256, 256);
+	report("draw_sprite_scaled (to 256x256)", now_ns() - start, ops);
+
+	sprite_t * blurred = create_sprite(256, 256, ALPHA_EMBEDDED);
+	gfx_context_t * blur_ctx = init_graphics_sprite(blurred);
+	draw_fill(blur_ctx, premultiply(rgba(90, 120, 140, 200)));
+
+	ops = 50;
+	for (uint32_t i = 0; i < WARMUP_OPS; ++i) blur_context_box(blur_ctx, 2);
+	start = now_ns();
+	for (uint32_t i = 0; i < ops; ++i) blur_context_box(blur_ctx, 2);
+	report("blur_context_box (r=2 256x256)", now_ns() - start, ops);
+
+	for (uint32_t i = 0; i < WARMUP_OPS; ++i) blur_context_box(blur_ctx, 8);
+	start = now_ns();
+	for (uint32_t i = 0; i < ops; ++i) blur_context_box(blur_ctx, 8);
+	report("blur_context_box (r=8 256x256)", now_ns() - start, ops);
+
+	free(blur_ctx);
+	sprite_free(blurred);
+	free(ctx);
+	sprite_free(target);
+	sprite_free(opaque);
+	sprite_free(translucent);
+}
+
+static void bench_malloc(void) {
+	uint32_t ops = 100000;
+
+	for (uint32_t i = 0; i < WARMUP_OPS; ++i) free(malloc(64));
+	uint64_t start = now_ns();
+	for (uint32_t i = 0; i < ops; ++i) free(malloc(64));
+	report("malloc/free (64 bytes)", now_ns() - start, ops);
+
+	/* Mixed sizes with many objects live at once. */
+	#define LIVE_OBJECTS 1024
+	void * live[LIVE_OBJECTS] = {NULL};
+	srand(1234);
+	ops = 100000;
+	start = now_ns();
+	for (uint32_t i = 0; i < ops; ++i) {
+		int slot = rand() % LIVE_OBJECTS;
+		if (live[slot]) free(live[slot]);
+		live[slot] = malloc(16 << (rand() % 7)); /* 16B .. 1KB */
+	}
+	report("malloc mixed (1024 live)", now_ns() - start, ops);
+	for (int i = 0; i < LIVE_OBJECTS; ++i) {
+		if (live[i]) free(live[i]);
+	}
+
+	ops = 10000;
+	for (uint32_t i = 0; i < WARMUP_OPS; ++i) free(malloc(64 * 1024));
+	start = now_ns();
+	for (uint32_t i = 0; i < ops; ++i) free(malloc(64 * 1024));
+	report("malloc/free (64KB)", now_ns() - start, ops);
+}
+
+static void bench_hashmap(void) {
+	#define HASH_KEYS 10000
+	hashmap_t * map = hashmap_create(1024);
+	char key[32];
+	for (int i = 0; i < HASH_KEYS; ++i) {
+		sprintf(key, "key-%d", i);
+		hashmap_set(map, key, (void *)(uintptr_t)(i + 1));
+	}
+
+	uint32_t ops = 100000;
+	for (uint32_t i = 0; i < WARMUP_OPS; ++i) {
+		sprintf(key, "key-%d", i % HASH_KEYS);
+		hashmap_get(map, key);
+	}
+	uint64_t start = now_ns();
+	for (uint32_t i = 0; i < ops; ++i) {
+		sprintf(key, "key-%d", i % HASH_KEYS);
+		hashmap_get(map, key);
+	}
+	report("hashmap_get (hit, 10k keys)", now_ns() - start, ops);
+
+	start = now_ns();
+	for (uint32_t i = 0; i < ops; ++i) {
+		sprintf(key, "nope-%d", i % HASH_KEYS);
+		hashmap_get(map, key);
+	}
+	report("hashmap_get (miss, 10k keys)", now_ns() - start, ops);
+
+	hashmap_free(map);
+	free(map);
+}
+
+/*
+ * One process plays both ends of a pex connection, so an "op" here is
+ * a full client->server->client round trip through packetfs.
+ */
+static void bench_pex(void) {
+	FILE * server = pex_bind("benchmark");
+	if (!server) {
+		printf("%-32s %10s\n", "pex round trip", "skipped (no /dev/pex)");
+		return;
+	}
+	FILE * client = pex_connect("benchmark");
+	if (!client) {
+		printf("%-32s %10s\n", "pex round trip", "skipped");
+		fclose(server);
+		return;
+	}
+
+	char payload[64] = "ping";
+	char response[MAX_PACKET_SIZE];
+	pex_packet_t * packet = malloc(PACKET_SIZE);
+
+	uint32_t ops = 5000;
+	for (uint32_t i = 0; i < WARMUP_OPS; ++i) {
+		pex_reply(client, sizeof(payload), payload);
+		pex_listen(server, packet);
+		pex_send(server, packet->source, sizeof(payload), (char *)packet->data);
+		pex_recv(client, response);
+	}
+	uint64_t start = now_ns();
+	for (uint32_t i = 0; i < ops; ++i) {
+		pex_reply(client, sizeof(payload), payload);
+		pex_listen(server, packet);
+		pex_send(server, packet->source, sizeof(payload), (char *)packet->data);
+		pex_recv(client, response);
+	}
+	report("pex round trip (64 bytes)", now_ns() - start, ops);
+
+	free(packet);
+	fclose(client);
+	fclose(server);
+}
+
+static void bench_file(const char * path) {
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		printf("%-32s %10s (%s)\n", "file read", "skipped", path);
+		return;
+	}
+	off_t file_size = lseek(fd, 0, SEEK_END);
+	if (file_size < 4096) {
+		printf("%-32s %10s (%s too small)\n", "file read", "skipped", path);
+		close(fd);
+		return;
+	}
+
+	char buf[4096];
+	uint32_t ops = 0;
+
+	/* Warm the block cache so both passes measure the VFS, not the disk. */
+	lseek(fd, 0, SEEK_SET);
+	while (read(fd, buf, sizeof(buf)) > 0);
+
+	lseek(fd, 0, SEEK_SET);
+	uint64_t start = now_ns();
+	while (read(fd, buf, sizeof(buf)) > 0) ops++;
+	report("read sequential (4KB)", now_ns() - start, ops);
+
+	srand(5678);
+	ops = 2000;
+	start = now_ns();
+	for (uint32_t i = 0; i < ops; ++i) {
+		lseek(fd, (rand() % (file_size - 512)), SEEK_SET);
+		read(fd, buf, 512);
+	}
+	report("read random (512B)", now_ns() - start, ops);
+
+	/* The same sequential pass through an mmap'd view: no read
+	 * syscalls, and a second run shares pages with the first mapper. */
+	start = now_ns();
+	char * image = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (image != MAP_FAILED) {
+		volatile char sink = 0;
+		ops = 0;
+		for (off_t o = 0; o < file_size; o += 4096) {
+			sink += image[o];
+			ops++;
+		}
+		(void)sink;
+		report("mmap sequential (4KB)", now_ns() - start, ops);
+		munmap(image, file_size);
+	} else {
+		printf("%-32s %10s\n", "mmap sequential (4KB)", "skipped (no mmap)");
+	}
+
+	close(fd);
+}
+
+void show_usage(int argc, char * argv[]) {
+	printf(
+			"benchmark - time the hot library paths\n"
+			"\n"
+			"usage: %s [-f file] [test ...]\n"
+			"\n"
+			" -f     \033[3mfile to use for the read tests (default /bin/sh)\033[0m\n"
+			" -?     \033[3mshow this help text\033[0m\n"
+			"\n"
+			"tests: graphics malloc hashmap pex file (default: all)\n"
+			"\n", argv[0]);
+}
+
+int main(int argc, char * argv[]) {
+	const char * file = "/bin/sh";
+
+	int c;
+	while ((c = getopt(argc, argv, "f:?")) != -1) {
+		switch (c) {
+			case 'f':
+				file = optarg;
+				break;
+			case '?':
+				show_usage(argc, argv);
+				return 0;
+		}
+	}
+
+	if (optind == argc) {
+		bench_graphics();
+		bench_malloc();
+		bench_hashmap();
+		bench_pex();
+		bench_file(file);
+		return 0;
+	}
+
+	for (int i = optind; i < argc; ++i) {
+		if      (!strcmp(argv[i], "graphics")) bench_graphics();
+		else if (!strcmp(argv[i], "malloc"))   bench_malloc();
+		else if (!strcmp(argv[i], "hashmap"))  bench_hashmap();
+		else if (!strcmp(argv[i], "pex"))      bench_pex();
+		else if (!strcmp(argv[i], "file"))     bench_file(file);
+		else {
+			fprintf(stderr, "%s: unknown test '%s'\n", argv[0], argv[i]);
+			return 1;
+		}
+	}
+
+	return 0;
+}
@@ -151,6 +151,7 @@ typedef struct {
 	int istate;
 	int is_current;
 	int rev_status;
+	int paint_gen;
 	char_t   text[];
 } line_t;
 
@@ -305,6 +306,7 @@ typedef struct _env {
 	int    line_no;
 	int    line_count;
 	int    line_avail;
+	int    line_slack;
 	int    col_no;
 	int    preferred_column;
 	struct syntax_definition * syntax;
@@ -457,6 +459,12 @@ extern buffer_t ** buffers;
 
 extern const char * flag_to_color(int _flag);
 extern void redraw_line(int x);
+extern void redraw_statusbar(void);
+extern void redraw_commandline(void);
+extern int num_width(void);
+extern int gutter_width(void);
+extern void invalidate_screen_cache(void);
+extern int screen_paint_generation;
 extern int git_examine(char * filename);
 extern void search_next(void);
 extern void set_preferred_column(void);
@@ -1201,7 +1209,7 @@ buffer_t * buffer_close(buffer_t * buf) {
 		free(buf->lines[i]);
 	}
 
-	free(buf->lines);
+	free(buf->lines - buf->line_slack);
 
 	if (buf->file_name) {
 		free(buf->file_name);
@@ -1480,6 +1488,9 @@ void recalculate_syntax(line_t * line, int line_no) {
 			line->text[i].flags = 0;
 		}
 
+		/* The paint is changing; redraw_text must not skip this line. */
+		line->paint_gen = ++screen_paint_generation;
+
 		if (!env->syntax) {
 			if (line_no != -1) rehighlight_search(line);
 			return;
@@ -1685,6 +1696,18 @@ void line_replace(line_t * line, char_t _c, int offset, int lineno) {
 	}
 }
 
+/**
+ * The line pointer array is a gap buffer anchored at whichever end is
+ * closer to the edit: `env->lines` points `line_slack` slots into the
+ * underlying allocation, and inserting or removing a line shifts only
+ * the shorter side of the array into (or out of) that slack. Editing
+ * near the top of a half-million-line file no longer memmoves every
+ * line pointer below the cursor on each keystroke.
+ *
+ * Anything that frees or reallocates the array has to remember that
+ * the allocation actually starts at `lines - line_slack`.
+ */
+
 /**
  * Remove a line from the active buffer
  */
@@ -1710,8 +1733,17 @@ line_t ** remove_line(line_t ** lines, int offset) {
 	/* Otherwise, free the data used by the line */
 	free(lines[offset]);
 
-	/* Move other lines up */
-	if (offset < env->line_count-1) {
+	/* Close the hole from whichever side of it is shorter */
+	if (offset * 2 < env->line_count) {
+		/* Shift the lines above down into the hole */
+		if (offset) {
+			memmove(&lines[1], &lines[0], sizeof(line_t *) * offset);
+		}
+		lines++;
+		env->line_slack++;
+		env->line_avail--;
+	} else if (offset < env->line_count-1) {
+		/* Move other lines up */
 		memmove(&lines[offset], &lines[offset+1], sizeof(line_t *) * (env->line_count - (offset - 1)));
 		lines[env->line_count-1] = NULL;
 	}
@@ -1737,20 +1769,38 @@ line_t ** add_line(line_t ** lines, int offset) {
 	}
 
 	/* Not enough space */
-	if (env->line_count == env->line_avail) {
-		/* Allocate more space */
-		env->line_avail *= 2;
-		lines = realloc(lines, sizeof(line_t *) * env->line_avail);
-	}
+	if (offset * 2 < env->line_count && env->line_slack) {
+		/* The new line is closer to the top and there's slack there;
+		 * shift the short prefix up instead of everything below down. */
+		lines--;
+		env->line_slack--;
+		env->line_avail++;
+		if (offset) {
+			memmove(&lines[0], &lines[1], sizeof(line_t *) * offset);
+		}
+	} else {
+		if (env->line_count == env->line_avail) {
+			/* Allocate more space, leaving half of the new room in front
+			 * of the first line so future edits near the top have
+			 * somewhere cheap to shift into. */
+			int extra = env->line_avail;
+			line_t ** base = realloc(lines - env->line_slack, sizeof(line_t *) * (env->line_slack + env->line_avail + extra));
+			memmove(base + env->line_slack + extra / 2, base + env->line_slack, sizeof(line_t *) * env->line_count);
+			env->line_slack += extra / 2;
+			env->line_avail += extra - extra / 2;
+			lines = base + env->line_slack;
+		}
 
-	/* If this isn't the last line, move other lines down */
-	if (offset < env->line_count) {
-		memmove(&lines[offset+1], &lines[offset], sizeof(line_t *) * (env->line_count - offset));
+		/* If this isn't the last line, move other lines down */
+		if (offset < env->line_count) {
+			memmove(&lines[offset+1], &lines[offset], sizeof(line_t *) * (env->line_count - offset));
+		}
 	}
 
 	/* Allocate the new line */
 	lines[offset] = calloc(sizeof(line_t) + sizeof(char_t) * 32, 1);
 	lines[offset]->available = 32;
+	lines[offset]->paint_gen = ++screen_paint_generation;
 
 	/* There is one new line */
 	env->line_count += 1;
@@ -1868,19 +1918,31 @@ line_t ** split_line(line_t ** lines, int line, int split) {
 		HIST_APPEND(e);
 	}
 
-	/* Allocate more space as needed */
-	if (env->line_count == env->line_avail) {
-		env->line_avail *= 2;
-		lines = realloc(lines, sizeof(line_t *) * env->line_avail);
-	}
-
 	if (!env->loading) {
 		unhighlight_matching_paren();
 	}
 
-	/* Shift later lines down */
-	if (line < env->line_count) {
-		memmove(&lines[line+2], &lines[line+1], sizeof(line_t *) * (env->line_count - line));
+	if ((line + 1) * 2 < env->line_count && env->line_slack) {
+		/* Splitting near the top; shift the prefix up into the slack */
+		lines--;
+		env->line_slack--;
+		env->line_avail++;
+		memmove(&lines[0], &lines[1], sizeof(line_t *) * (line + 1));
+	} else {
+		/* Allocate more space as needed */
+		if (env->line_count == env->line_avail) {
+			int extra = env->line_avail;
+			line_t ** base = realloc(lines - env->line_slack, sizeof(line_t *) * (env->line_slack + env->line_avail + extra));
+			memmove(base + env->line_slack + extra / 2, base + env->line_slack, sizeof(line_t *) * env->line_count);
+			env->line_slack += extra / 2;
+			env->line_avail += extra - extra / 2;
+			lines = base + env->line_slack;
+		}
+
+		/* Shift later lines down */
+		if (line < env->line_count) {
+			memmove(&lines[line+2], &lines[line+1], sizeof(line_t *) * (env->line_count - line));
+		}
 	}
 
 	/* I have no idea what this is doing */
@@ -1899,6 +1961,7 @@ line_t ** split_line(line_t ** lines, int line, int split) {
 	lines[line+1] = calloc(sizeof(line_t) + sizeof(char_t) * v, 1);
 	lines[line+1]->available = v;
 	lines[line+1]->actual = remaining;
+	lines[line+1]->paint_gen = ++screen_paint_generation;
 
 	/* Move the data from the old line into the new line */
 	memmove(lines[line+1]->text, &lines[line]->text[split], sizeof(char_t) * remaining);
@@ -2091,7 +2154,7 @@ void setup_buffer(buffer_t * env) {
 		for (int i = 0; i < env->line_count; ++i) {
 			free(env->lines[i]);
 		}
-		free(env->lines);
+		free(env->lines - env->line_slack);
 	}
 
 	/* Default state parameters */
@@ -2102,6 +2165,7 @@ void setup_buffer(buffer_t * env) {
 	env->readonly    = 0;
 	env->offset      = 0;
 	env->line_avail  = 8; /* Default line buffer capacity */
+	env->line_slack  = 0; /* No gap before the first line yet */
 	env->tabs        = 1; /* Tabs by default */
 	env->tabstop     = 4; /* Tab stop width */
 	env->indent      = 1; /* Auto-indent by default */
@@ -2115,6 +2179,10 @@ void setup_buffer(buffer_t * env) {
 	/* Initialize the first line */
 	env->lines[0] = calloc(sizeof(line_t) + sizeof(char_t) * 32, 1);
 	env->lines[0]->available = 32;
+	env->lines[0]->paint_gen = ++screen_paint_generation;
+
+	/* Old rows may refer to the buffer we just emptied */
+	invalidate_screen_cache();
 }
 
 /**
@@ -2399,11 +2467,113 @@ void mouse_disable(void) {
 	}
 }
 
+/**
+ * Cache of what is currently drawn in the text area.
+ *
+ * Each terminal row remembers which buffer line was last painted on it,
+ * that line's paint generation at the time, and the horizontal offset it
+ * was rendered with. redraw_text() checks rows against this cache so it
+ * can skip lines that haven't changed and turn a plain scroll into a
+ * terminal scroll escape instead of a full repaint.
+ */
+struct screen_line_cache {
+	int line;    /* Buffer line drawn on this row; -1 for a ~ line, -2 for unknown */
+	int gen;     /* paint_gen the line had when it was drawn */
+	int coffset; /* Horizontal offset it was drawn with */
+};
+
+static struct screen_line_cache * screen_cache = NULL;
+static int screen_cache_rows = 0;
+int screen_paint_generation = 0;
+
+/* What the cached rows were drawn against; if any of this changes,
+ * every row needs to be repainted anyway. */
+static struct {
+	buffer_t * env;
+	int left;
+	int width;
+	int numbers;
+	int tabs;
+	int line_no;
+} screen_cache_source;
+
+/**
+ * Mark every cached row as unknown. Called whenever something has
+ * restyled lines without going through recalculate_syntax (search
+ * match flags, the git gutter, theme changes via redraw_all, ...).
+ */
+void invalidate_screen_cache(void) {
+	for (int i = 0; i < screen_cache_rows; ++i) {
+		screen_cache[i].line = -2;
+	}
+}
+
+/**
+ * Resize the cache to match the terminal. The old contents are
+ * meaningless after a resize, so everything becomes unknown.
+ */
+void resize_screen_cache(void) {
+	if (global_config.term_height != screen_cache_rows) {
+		screen_cache = realloc(screen_cache, sizeof(struct screen_line_cache) * global_config.term_height);
+		screen_cache_rows = global_config.term_height;
+	}
+	invalidate_screen_cache();
+}
+
+/**
+ * Throw the cache out if the rows were drawn for a different buffer,
+ * split arrangement, or gutter size than what we are about to draw.
+ */
+static void validate_screen_cache(void) {
+	int line_no = global_config.relative_lines ? env->line_no : 0;
+	if (screen_cache_source.env != env ||
+	    screen_cache_source.left != env->left ||
+	    screen_cache_source.width != env->width ||
+	    screen_cache_source.numbers != num_width() + gutter_width() ||
+	    screen_cache_source.tabs != global_config.tabs_visible ||
+	    screen_cache_source.line_no != line_no) {
+		screen_cache_source.env = env;
+		screen_cache_source.left = env->left;
+		screen_cache_source.width = env->width;
+		screen_cache_source.numbers = num_width() + gutter_width();
+		screen_cache_source.tabs = global_config.tabs_visible;
+		screen_cache_source.line_no = line_no;
+		invalidate_screen_cache();
+	}
+}
+
+/**
+ * Mirror a terminal scroll in the cache: rows from `top` down move up
+ * (amount > 0) or down (amount < 0), and whatever scrolled into view
+ * is unknown.
+ */
+static void shift_screen_cache(int top, int amount) {
+	if (!screen_cache) return;
+	if (amount > 0) {
+		for (int i = top; i < screen_cache_rows; ++i) {
+			if (i + amount < screen_cache_rows) {
+				screen_cache[i] = screen_cache[i + amount];
+			} else {
+				screen_cache[i].line = -2;
+			}
+		}
+	} else if (amount < 0) {
+		for (int i = screen_cache_rows - 1; i >= top; --i) {
+			if (i + amount >= top) {
+				screen_cache[i] = screen_cache[i + amount];
+			} else {
+				screen_cache[i].line = -2;
+			}
+		}
+	}
+}
+
 /**
  * Shift the screen up one line
  */
 void shift_up(int amount) {
 	printf("\033[%dS", amount);
+	shift_screen_cache(0, amount);
 }
 
 /**
@@ -2411,16 +2581,19 @@ void shift_up(int amount) {
  */
 void shift_down(int amount) {
 	printf("\033[%dT", amount);
+	shift_screen_cache(0, -amount);
 }
 
 void insert_lines_at(int line, int count) {
 	place_cursor(1, line);
 	printf("\033[%dL", count);
+	shift_screen_cache(line - 1, -count);
 }
 
 void delete_lines_at(int line, int count) {
 	place_cursor(1, line);
 	printf("\033[%dM", count);
+	shift_screen_cache(line - 1, count);
 }
 
 /**
@@ -2919,10 +3092,12 @@ void recalculate_current_line(void) {
 		for (int i = 0; i < env->line_count; ++i) {
 			if (env->lines[i]->is_current && i != env->line_no-1) {
 				env->lines[i]->is_current = 0;
+				env->lines[i]->paint_gen = ++screen_paint_generation;
 				something_changed = 1;
 				redraw_line(i);
 			} else if (i == env->line_no-1 && !env->lines[i]->is_current) {
 				env->lines[i]->is_current = 1;
+				env->lines[i]->paint_gen = ++screen_paint_generation;
 				something_changed = 1;
 				redraw_line(i);
 			}
@@ -2955,6 +3130,8 @@ void redraw_line(int x) {
 	/* Calculate offset in screen */
 	int j = x - env->offset;
 
+	validate_screen_cache();
+
 	/* Hide cursor when drawing */
 	hide_cursor();
 
@@ -3000,12 +3177,20 @@ void redraw_line(int x) {
 	 */
 	render_line(env->lines[x], env->width - gutter_width() - num_width(), (x + 1 == env->line_no || global_config.horizontal_shift_scrolling) ? env->coffset : 0, x+1);
 
+	/* Remember what this row now shows */
+	if (screen_cache && j + global_config.tabs_visible < screen_cache_rows) {
+		struct screen_line_cache * row = &screen_cache[j + global_config.tabs_visible];
+		row->line = x;
+		row->gen = env->lines[x]->paint_gen;
+		row->coffset = (x + 1 == env->line_no || global_config.horizontal_shift_scrolling) ? env->coffset : 0;
+	}
 }
 
 /**
  * Draw a ~ line where there is no buffer text.
  */
 void draw_excess_line(int j) {
+	validate_screen_cache();
 	place_cursor(1+env->left,1 + global_config.tabs_visible + j);
 	paint_line(COLOR_ALT_BG);
 	set_colors(COLOR_ALT_FG, COLOR_ALT_BG);
@@ -3018,6 +3203,13 @@ void draw_excess_line(int j) {
 			printf(" ");
 		}
 	}
+
+	if (screen_cache && j + global_config.tabs_visible < screen_cache_rows) {
+		struct screen_line_cache * row = &screen_cache[j + global_config.tabs_visible];
+		row->line = -1;
+		row->gen = 0;
+		row->coffset = 0;
+	}
 }
 
 /**
@@ -3034,16 +3226,55 @@ void redraw_text(void) {
 	int l = global_config.term_height - global_config.bottom_size - global_config.tabs_visible;
 	int j = 0;
 
+	validate_screen_cache();
+
+	/*
+	 * If the rows on screen are still good and only the view offset
+	 * moved, scroll the terminal and let the loops below fill in just
+	 * the rows that were exposed.
+	 */
+	int scrolled = 0;
+	int top = global_config.tabs_visible;
+	if (screen_cache && global_config.can_scroll && global_config.can_insert && !left_buffer &&
+	    top < screen_cache_rows && screen_cache[top].line >= 0) {
+		int delta = env->offset - screen_cache[top].line;
+		if (delta && delta > -l && delta < l) {
+			if (delta > 0) {
+				delete_lines_at(top + 1, delta);
+			} else {
+				insert_lines_at(top + 1, -delta);
+			}
+			scrolled = 1;
+		}
+	}
+
 	/* Draw each line */
-	for (int x = env->offset; j < l && x < env->line_count; x++) {
+	for (int x = env->offset; j < l && x < env->line_count; x++, j++) {
+		int row = j + global_config.tabs_visible;
+		if (screen_cache && row < screen_cache_rows &&
+		    screen_cache[row].line == x &&
+		    screen_cache[row].gen == env->lines[x]->paint_gen &&
+		    screen_cache[row].coffset == ((x + 1 == env->line_no || global_config.horizontal_shift_scrolling) ? env->coffset : 0)) {
+			/* Already showing exactly this; leave it alone */
+			continue;
+		}
 		redraw_line(x);
-		j++;
 	}
 
 	/* Draw the rest of the text region as ~ lines */
 	for (; j < l; ++j) {
+		int row = j + global_config.tabs_visible;
+		if (screen_cache && row < screen_cache_rows && screen_cache[row].line == -1) {
+			continue;
+		}
 		draw_excess_line(j);
 	}
+
+	/* Scrolling with IL/DL drags the bottom of the screen along; put it back. */
+	if (scrolled) {
+		redraw_statusbar();
+		redraw_commandline();
+	}
 }
 
 static int view_left_offset = 0;
@@ -3375,6 +3606,7 @@ BIM_ACTION(redraw_all, 0,
 	"Repaint the screen."
 )(void) {
 	if (!env) return;
+	invalidate_screen_cache();
 	redraw_tabbar();
 	redraw_text();
 	if (left_buffer) {
@@ -3698,6 +3930,7 @@ void update_screen_size(void) {
 			buffers[i]->width = w.ws_col;
 		}
 	}
+	resize_screen_cache();
 }
 
 /**
@@ -4386,6 +4619,8 @@ int git_examine(char * filename) {
 	}
 
 	fclose(f);
+	/* Gutter statuses changed without repaints; make sure they get drawn */
+	invalidate_screen_cache();
 	return 0;
 }
 
@@ -4411,6 +4646,8 @@ void output_file(buffer_t * env, FILE * f) {
 		if (env->crnl) fputc('\r', f);
 		fputc('\n', f);
 	}
+	/* rev_status was reset on every line */
+	invalidate_screen_cache();
 }
 
 /**
@@ -5440,6 +5677,7 @@ BIM_COMMAND(e,"e","Open a file") {
 		SWAP(line_t **, env->lines, new_env->lines);
 		SWAP(int, env->line_count, new_env->line_count);
 		SWAP(int, env->line_avail, new_env->line_avail);
+		SWAP(int, env->line_slack, new_env->line_slack);
 		SWAP(history_t *, env->history, new_env->history);
 
 		buffer_close(new_env); /* Should probably also free, this needs editing. */
@@ -6882,6 +7120,8 @@ void draw_search_match(uint32_t * buffer, int redraw_buffer) {
 		line  = -1;
 		col   = -1;
 	} while (_line != -1);
+	/* FLAG_SEARCH was set behind the cache's back */
+	invalidate_screen_cache();
 	redraw_text();
 	place_cursor_actual();
 	redraw_statusbar();
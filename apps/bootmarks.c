@@ -0,0 +1,71 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ * This file is part of ToaruOS and is released under the terms
+ * of the NCSA / University of Illinois License - see LICENSE.md
+ * Copyright (C) 2018 K. Lange
+ *
+ * bootmarks - Display boot-phase timing markers.
+ *
+ * Reads /proc/bootmarks, which lists each marker the kernel recorded
+ * during boot with its time since the first marker, and prints them
+ * with the per-phase delta alongside. Pass -r to print the raw file
+ * instead.
+ *
+ * Useful for before/after comparisons when poking at boot time.
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+int main(int argc, char * argv[]) {
+	int raw = 0;
+	int opt;
+	while ((opt = getopt(argc, argv, "r")) != -1) {
+		switch (opt) {
+			case 'r':
+				raw = 1;
+				break;
+			default:
+				fprintf(stderr, "usage: %s [-r]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	FILE * f = fopen("/proc/bootmarks", "r");
+	if (!f) {
+		fprintf(stderr, "%s: /proc/bootmarks: %s\n", argv[0], strerror(errno));
+		return 1;
+	}
+
+	char line[256];
+	char unit[32] = "us";
+	unsigned long previous = 0;
+
+	while (fgets(line, sizeof(line), f)) {
+		if (raw) {
+			fputs(line, stdout);
+			continue;
+		}
+
+		char * nl = strchr(line, '\n');
+		if (nl) *nl = '\0';
+
+		if (!strncmp(line, "unit ", 5)) {
+			sprintf(unit, "%s", line + 5);
+			printf("%10s %10s  (%s)\n", "time", "delta", unit);
+			continue;
+		}
+
+		char * sp = strchr(line, ' ');
+		if (!sp) continue;
+		*sp = '\0';
+
+		unsigned long stamp = strtoul(line, NULL, 10);
+		printf("%10lu %10lu  %s\n", stamp, stamp - previous, sp + 1);
+		previous = stamp;
+	}
+
+	fclose(f);
+	return 0;
+}
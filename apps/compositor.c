@@ -28,9 +28,12 @@
 #include <errno.h>
 #include <sys/stat.h>
 #include <sys/time.h>
-#include <sys/fswait.h>
+#include <sys/eventset.h>
 #include <sys/sysfunc.h>
 #include <sys/shm.h>
+#include <sys/ioctl.h>
+
+#include <kernel/video.h>
 #include <pthread.h>
 #include <dlfcn.h>
 /* auto-dep: export-dynamic */
@@ -43,8 +46,10 @@
 #include <toaru/yutani-internal.h>
 #include <toaru/yutani-server.h>
 #include <toaru/hashmap.h>
+#include <toaru/intmap.h>
 #include <toaru/list.h>
 #include <toaru/spinlock.h>
+#include <toaru/bitset.h>
 
 //#define _DEBUG_YUTANI
 #ifdef _DEBUG_YUTANI
@@ -56,6 +61,7 @@
 
 /* Early definitions */
 static void mark_window(yutani_globals_t * yg, yutani_server_window_t * window);
+static void mark_window_animation(yutani_globals_t * yg, yutani_server_window_t * window);
 static void window_actually_close(yutani_globals_t * yg, yutani_server_window_t * w);
 static void notify_subscribers(yutani_globals_t * yg);
 
@@ -152,6 +158,24 @@ static void try_load_extensions(yutani_globals_t * yg) {
 		renderer_blit_screen = dlsym(cairo, "renderer_blit_screen");
 	}
 
+	/* Without cairo, try the VMware SVGA-II presentation backend:
+	 * window blitting stays in software but damage rectangles are
+	 * queued to the device FIFO instead of the host tracing the
+	 * framebuffer. Only meaningful on a real display. */
+	if (!renderer_init && !yutani_options.nested) {
+		void * vmware = dlopen("libtoaru_ext_vmware_renderer.so", 0);
+		if (vmware) {
+			int (*probe)(void) = dlsym(vmware, "renderer_probe");
+			if (probe && !probe()) {
+				renderer_alloc = dlsym(vmware, "renderer_alloc");
+				renderer_init = dlsym(vmware, "renderer_init");
+				renderer_add_clip = dlsym(vmware, "renderer_add_clip");
+				renderer_destroy = dlsym(vmware, "renderer_destroy");
+				renderer_blit_screen = dlsym(vmware, "renderer_blit_screen");
+			}
+		}
+	}
+
 	/* On success, these are now set */
 	if (renderer_alloc) renderer_alloc(yg);
 	if (renderer_init)  renderer_init(yg);
@@ -165,29 +189,51 @@ static int32_t max(int32_t a, int32_t b) {
 	return (a > b) ? a : b;
 }
 
+/*
+ * Recycling id allocators. Ids come from the lowest unset bit of a
+ * bitset and are returned when released, so long-lived sessions keep
+ * the id space - and the wid intmap keyed by it - compact instead of
+ * counting upward forever. Bit zero stays set in both; 0 means "no
+ * buffer" and "no window".
+ */
+static bitset_t buf_id_set;
+static bitset_t wid_set;
+
+static int id_alloc(bitset_t * set) {
+	int id = bitset_ffub(set);
+	if (id < 0) id = set->size * 8; /* Full; bitset_set will grow it */
+	bitset_set(set, id);
+	return id;
+}
+
+static void id_sets_init(void) {
+	bitset_init(&buf_id_set, 8);
+	bitset_init(&wid_set, 8);
+	bitset_set(&buf_id_set, 0);
+	bitset_set(&wid_set, 0);
+}
+
 static int next_buf_id(void) {
-	static int _next = 1;
-	return _next++;
+	return id_alloc(&buf_id_set);
 }
 
 static int next_wid(void) {
-	static int _next = 1;
-	return _next++;
+	return id_alloc(&wid_set);
 }
 
 uint32_t yutani_current_time(yutani_globals_t * yg) {
-	struct timeval t;
-	gettimeofday(&t, NULL);
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
 
 	time_t sec_diff = t.tv_sec - yg->start_time;
-	suseconds_t usec_diff = t.tv_usec - yg->start_subtime;
+	long nsec_diff = t.tv_nsec - yg->start_subtime;
 
-	if (t.tv_usec < yg->start_subtime) {
+	if (nsec_diff < 0) {
 		sec_diff -= 1;
-		usec_diff = (1000000 + t.tv_usec) - yg->start_subtime;
+		nsec_diff += 1000000000L;
 	}
 
-	return (uint32_t)(sec_diff * 1000 + usec_diff / 1000);
+	return (uint32_t)(sec_diff * 1000 + nsec_diff / 1000000);
 }
 
 uint32_t yutani_time_since(yutani_globals_t * yg, uint32_t start_time) {
@@ -198,6 +244,44 @@ uint32_t yutani_time_since(yutani_globals_t * yg, uint32_t start_time) {
 	return diff;
 }
 
+/**
+ * Milliseconds since boot, matching the epoch the input drivers use
+ * for their packet timestamps; yutani_current_time can't be compared
+ * against those as it counts from compositor startup.
+ */
+static uint32_t yutani_absolute_time(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint32_t)(t.tv_sec * 1000 + t.tv_nsec / 1000000);
+}
+
+/**
+ * Input latency accounting. Deltas land in log2(ms) buckets; see
+ * struct yutani_msg_latency_stats for the bucket boundaries.
+ */
+static void latency_record(uint32_t * hist, uint32_t msec) {
+	int bucket = 0;
+	while (msec && bucket < YUTANI_LATENCY_BUCKETS - 1) {
+		msec >>= 1;
+		bucket++;
+	}
+	hist[bucket]++;
+}
+
+/**
+ * Note a device input event reaching the compositor. Records the
+ * driver-to-handler delta and remembers the earliest unpresented
+ * input timestamp so the render thread can attribute the next
+ * presented frame to it.
+ */
+static void input_note_arrival(yutani_globals_t * yg, uint32_t device_ts) {
+	uint32_t now = yutani_absolute_time();
+	if (!device_ts || device_ts > now) device_ts = now;
+	yg->input_events++;
+	latency_record(yg->latency_queue_hist, now - device_ts);
+	if (!yg->input_pending_since) yg->input_pending_since = device_ts;
+}
+
 /**
  * Translate and transform coordinate from screen-relative to window-relative.
  */
@@ -249,6 +333,22 @@ void yutani_window_to_device(yutani_server_window_t * window, int32_t x, int32_t
 	*out_y = (int32_t)n_y + (window->height / 2) + window->y;
 }
 
+/**
+ * Send a message to a client, framed for whatever protocol version it
+ * negotiated in its hello. v2 clients get compact frames; everyone
+ * else gets the v1 layout unchanged.
+ */
+static void server_send(yutani_globals_t * yg, uintptr_t dest, yutani_msg_t * msg) {
+	uintptr_t proto = (uintptr_t)hashmap_get(yg->client_protocols, (void *)dest);
+	if ((proto & 0xFF) >= 2) {
+		char buf[MAX_PACKET_SIZE];
+		size_t len = yutani_msg_compact_encode(msg, buf);
+		pex_send(yg->server, dest, len, buf);
+	} else {
+		pex_send(yg->server, dest, msg->size, (char *)msg);
+	}
+}
+
 /**
  * Remove a window from the z stack.
  */
@@ -344,14 +444,14 @@ static void set_focused_window(yutani_globals_t * yg, yutani_server_window_t * w
 		/* Send focus change to old focused window */
 		yutani_msg_buildx_window_focus_change_alloc(response);
 		yutani_msg_buildx_window_focus_change(response, yg->focused_window->wid, 0);
-		pex_send(yg->server, yg->focused_window->owner, response->size, (char *)response);
+		server_send(yg, yg->focused_window->owner, response);
 	}
 	yg->focused_window = w;
 	if (w) {
 		/* Send focus change to new focused window */
 		yutani_msg_buildx_window_focus_change_alloc(response);
 		yutani_msg_buildx_window_focus_change(response, w->wid, 1);
-		pex_send(yg->server, w->owner, response->size, (char *)response);
+		server_send(yg, w->owner, response);
 		make_top(yg, w);
 		mark_window(yg, w);
 	} else {
@@ -384,6 +484,153 @@ static int yutani_pick_animation(uint32_t flags, int direction) {
 	return (direction == 0) ? YUTANI_EFFECT_FADE_IN : YUTANI_EFFECT_FADE_OUT;
 }
 
+/* Frame scheduler interval in milliseconds; the PIT gives us millisecond
+ * granularity, so 16ms is the closest we can get to 60Hz. */
+#define YUTANI_FRAME_INTERVAL 16
+
+/* Duration of the move tween applied to programmatic window moves */
+#define YUTANI_MOVE_TWEEN_LENGTH 150
+
+/* Whether a window needs per-frame repaints for an active animation */
+static int window_is_animating(yutani_server_window_t * window) {
+	return window->anim_mode || window->move_anim_start;
+}
+
+
+/*
+ * Buffer atlas for small windows.
+ *
+ * Tooltips, menus, and the like are tiny, but each one used to cost a
+ * whole shm segment: a kernel chunk allocation, a tree insertion, and
+ * two mappings. Instead, buffers under YUTANI_ATLAS_MAX_WINDOW bytes
+ * are carved out of shared YUTANI_ATLAS_SEGMENT_SIZE segments with a
+ * first-fit span allocator. Each window still gets a contiguous
+ * width*height*4 region, so every blit path works unchanged; clients
+ * are told which segment and offset to map instead of a dedicated key.
+ * Double-buffered windows keep dedicated segments (their id pairing
+ * relies on it), and segments are pooled forever once created.
+ */
+#define YUTANI_ATLAS_SEGMENT_SIZE 0x40000
+#define YUTANI_ATLAS_MAX_WINDOW   0x10000
+
+struct atlas_segment {
+	uint32_t id;         /* shm id; shares the bufid namespace so keys never collide */
+	uint8_t * base;
+	list_t * free_spans; /* struct atlas_span, sorted by offset */
+};
+
+struct atlas_span {
+	uint32_t offset;
+	uint32_t size;
+};
+
+static list_t * atlas_segments = NULL;
+
+static uint8_t * atlas_try_segment(struct atlas_segment * seg, uint32_t size, uint32_t * offset) {
+	foreach (node, seg->free_spans) {
+		struct atlas_span * span = node->value;
+		if (span->size < size) continue;
+		*offset = span->offset;
+		span->offset += size;
+		span->size -= size;
+		if (!span->size) {
+			list_delete(seg->free_spans, node);
+			free(span);
+			free(node);
+		}
+		return seg->base + *offset;
+	}
+	return NULL;
+}
+
+static uint8_t * atlas_alloc(yutani_globals_t * yg, uint32_t size, uint32_t * seg_id, uint32_t * offset) {
+	if (!atlas_segments) atlas_segments = list_create();
+
+	foreach (node, atlas_segments) {
+		struct atlas_segment * seg = node->value;
+		uint8_t * out = atlas_try_segment(seg, size, offset);
+		if (out) {
+			*seg_id = seg->id;
+			return out;
+		}
+	}
+
+	/* No segment had room; grow the pool */
+	struct atlas_segment * seg = malloc(sizeof(struct atlas_segment));
+	seg->id = next_buf_id();
+
+	char key[1024];
+	YUTANI_SHMKEY_EXP(yg->server_ident, key, 1024, seg->id);
+	size_t seg_size = YUTANI_ATLAS_SEGMENT_SIZE;
+	seg->base = shm_obtain(key, &seg_size);
+	if (!seg->base) {
+		free(seg);
+		return NULL;
+	}
+
+	seg->free_spans = list_create();
+	struct atlas_span * span = malloc(sizeof(struct atlas_span));
+	span->offset = 0;
+	span->size = YUTANI_ATLAS_SEGMENT_SIZE;
+	list_insert(seg->free_spans, span);
+	list_insert(atlas_segments, seg);
+
+	*seg_id = seg->id;
+	return atlas_try_segment(seg, size, offset);
+}
+
+static void atlas_free(uint32_t seg_id, uint32_t offset, uint32_t size) {
+	if (!atlas_segments) return;
+	foreach (node, atlas_segments) {
+		struct atlas_segment * seg = node->value;
+		if (seg->id != seg_id) continue;
+
+		/* Insert in offset order, merging with both neighbors */
+		struct atlas_span * prev = NULL;
+		node_t * at = NULL;
+		foreach (snode, seg->free_spans) {
+			struct atlas_span * span = snode->value;
+			if (span->offset > offset) {
+				at = snode;
+				break;
+			}
+			prev = span;
+		}
+
+		if (prev && prev->offset + prev->size == offset) {
+			prev->size += size;
+			if (at) {
+				struct atlas_span * next = at->value;
+				if (prev->offset + prev->size == next->offset) {
+					prev->size += next->size;
+					list_delete(seg->free_spans, at);
+					free(next);
+					free(at);
+				}
+			}
+			return;
+		}
+
+		if (at) {
+			struct atlas_span * next = at->value;
+			if (offset + size == next->offset) {
+				next->offset = offset;
+				next->size += size;
+				return;
+			}
+		}
+
+		struct atlas_span * span = malloc(sizeof(struct atlas_span));
+		span->offset = offset;
+		span->size = size;
+		if (at) {
+			list_insert_before(seg->free_spans, at, span);
+		} else {
+			list_insert(seg->free_spans, span);
+		}
+		return;
+	}
+}
 
 /**
  * Create a server window object.
@@ -396,7 +643,7 @@ static yutani_server_window_t * server_window_create(yutani_globals_t * yg, int
 	win->wid = next_wid();
 	win->owner = owner;
 	list_insert(yg->windows, win);
-	hashmap_set(yg->wids_to_windows, (void*)win->wid, win);
+	intmap_set(yg->wids_to_windows, win->wid, win);
 
 	list_t * client_list = hashmap_get(yg->clients_to_windows, (void *)owner);
 	list_insert(client_list, win);
@@ -407,8 +654,14 @@ static yutani_server_window_t * server_window_create(yutani_globals_t * yg, int
 	win->width = width;
 	win->height = height;
 	win->bufid = next_buf_id();
+	/* Double-buffered windows get a second id immediately after the
+	 * first; the client relies on them being consecutive. */
+	win->bufid2 = (flags & YUTANI_WINDOW_FLAG_DOUBLE_BUFFERED) ? (uint32_t)next_buf_id() : 0;
+	win->buffer2 = NULL;
 	win->rotation = 0;
 	win->newbufid = 0;
+	win->newbufid2 = 0;
+	win->newbuffer2 = NULL;
 	win->client_flags   = 0;
 	win->client_offsets[0] = 0;
 	win->client_offsets[1] = 0;
@@ -419,6 +672,9 @@ static yutani_server_window_t * server_window_create(yutani_globals_t * yg, int
 	win->client_strings = NULL;
 	win->anim_mode = yutani_pick_animation(flags, 0);
 	win->anim_start = yutani_current_time(yg);
+	win->move_anim_start = 0;
+	win->move_from_x = 0;
+	win->move_from_y = 0;
 	win->alpha_threshold = 0;
 	win->show_mouse = 1;
 	win->tiled = 0;
@@ -427,15 +683,38 @@ static yutani_server_window_t * server_window_create(yutani_globals_t * yg, int
 	win->default_mouse = 1;
 	win->server_flags = flags;
 	win->opacity = 255;
-
-	char key[1024];
-	YUTANI_SHMKEY(yg->server_ident, key, 1024, win);
+	win->frame_notify = 0;
+	win->frame_pending = 0;
+	win->atlas = 0;
+	win->atlas_offset = 0;
+	win->atlas_size = 0;
+	win->newatlas = 0;
+	win->newatlas_offset = 0;
+	win->newatlas_size = 0;
 
 	size_t size = (width * height * 4);
 
-	win->buffer = shm_obtain(key, &size);
+	win->buffer = NULL;
+	if (!win->bufid2 && size <= YUTANI_ATLAS_MAX_WINDOW) {
+		win->buffer = atlas_alloc(yg, size, &win->atlas, &win->atlas_offset);
+		if (win->buffer) win->atlas_size = size;
+	}
+
+	if (!win->buffer) {
+		char key[1024];
+		YUTANI_SHMKEY(yg->server_ident, key, 1024, win);
+		win->buffer = shm_obtain(key, &size);
+	}
 	memset(win->buffer, 0, size);
 
+	if (win->bufid2) {
+		char key[1024];
+		YUTANI_SHMKEY_EXP(yg->server_ident, key, 1024, win->bufid2);
+		size = (width * height * 4);
+		win->buffer2 = shm_obtain(key, &size);
+		memset(win->buffer2, 0, size);
+	}
+
 	list_insert(yg->mid_zs, win);
 
 	return win;
@@ -472,14 +751,67 @@ static uint32_t server_window_resize(yutani_globals_t * yg, yutani_server_window
 		/* Already in the middle of an accept/done, bail */
 		return win->newbufid;
 	}
-	win->newbufid = next_buf_id();
 
-	{
+	/* Try to grow the current buffers in place first. If the kernel
+	 * can commit the delta pages within the chunk's reserved capacity,
+	 * everyone keeps their mapping, and handing the client back its
+	 * current bufid tells it no remap is needed. Atlas spans can't
+	 * grow (the segment is shared), so those always reallocate. */
+	if (!win->atlas) {
 		char key[1024];
-		YUTANI_SHMKEY_EXP(yg->server_ident, key, 1024, win->newbufid);
+		size_t size = (width * height * 4);
+		YUTANI_SHMKEY_EXP(yg->server_ident, key, 1024, win->bufid);
+		if (shm_resize(key, &size) == 0) {
+			int grown = 1;
+			if (win->bufid2) {
+				size = (width * height * 4);
+				YUTANI_SHMKEY_EXP(yg->server_ident, key, 1024, win->bufid2);
+				grown = (shm_resize(key, &size) == 0);
+			}
+			if (grown) {
+				win->newbufid = win->bufid;
+				win->newbuffer = win->buffer;
+				if (win->bufid2) {
+					win->newbufid2 = win->bufid2;
+					win->newbuffer2 = win->buffer2;
+				}
+				return win->newbufid;
+			}
+			/* The second buffer ran out of room; fall through to the
+			 * reallocating path. (The first chunk committed some extra
+			 * pages, but they go away with the old buffer.) */
+		}
+	}
 
+	win->newbufid = next_buf_id();
+	/* Keep the ids consecutive for double-buffered windows. */
+	win->newbufid2 = win->buffer2 ? (uint32_t)next_buf_id() : 0;
+
+	win->newatlas = 0;
+	win->newatlas_offset = 0;
+	win->newatlas_size = 0;
+
+	{
 		size_t size = (width * height * 4);
-		win->newbuffer = shm_obtain(key, &size);
+
+		win->newbuffer = NULL;
+		if (!win->newbufid2 && size <= YUTANI_ATLAS_MAX_WINDOW) {
+			win->newbuffer = atlas_alloc(yg, size, &win->newatlas, &win->newatlas_offset);
+			if (win->newbuffer) win->newatlas_size = size;
+		}
+
+		if (!win->newbuffer) {
+			char key[1024];
+			YUTANI_SHMKEY_EXP(yg->server_ident, key, 1024, win->newbufid);
+			win->newbuffer = shm_obtain(key, &size);
+		}
+
+		if (win->newbufid2) {
+			char key[1024];
+			YUTANI_SHMKEY_EXP(yg->server_ident, key, 1024, win->newbufid2);
+			size = (width * height * 4);
+			win->newbuffer2 = shm_obtain(key, &size);
+		}
 	}
 
 	return win->newbufid;
@@ -496,7 +828,15 @@ static void server_window_resize_finish(yutani_globals_t * yg, yutani_server_win
 		return;
 	}
 
+	/* A matching id means the buffers grew in place; there is no old
+	 * buffer to release and the pointers are already right. */
+	int in_place = (win->newbufid == win->bufid);
+
 	int oldbufid = win->bufid;
+	int oldbufid2 = win->bufid2;
+	uint32_t oldatlas = win->atlas;
+	uint32_t oldatlas_offset = win->atlas_offset;
+	uint32_t oldatlas_size = win->atlas_size;
 
 	mark_window(yg, win);
 
@@ -507,14 +847,41 @@ static void server_window_resize_finish(yutani_globals_t * yg, yutani_server_win
 
 	win->bufid = win->newbufid;
 	win->buffer = win->newbuffer;
+	win->atlas = win->newatlas;
+	win->atlas_offset = win->newatlas_offset;
+	win->atlas_size = win->newatlas_size;
 
 	win->newbuffer = NULL;
 	win->newbufid = 0;
+	win->newatlas = 0;
+	win->newatlas_offset = 0;
+	win->newatlas_size = 0;
 
-	{
-		char key[1024];
-		YUTANI_SHMKEY_EXP(yg->server_ident, key, 1024, oldbufid);
-		shm_release(key);
+	if (win->newbufid2) {
+		win->bufid2 = win->newbufid2;
+		win->buffer2 = win->newbuffer2;
+
+		win->newbuffer2 = NULL;
+		win->newbufid2 = 0;
+	}
+
+	if (!in_place) {
+		if (oldatlas) {
+			atlas_free(oldatlas, oldatlas_offset, oldatlas_size);
+		} else {
+			char key[1024];
+			YUTANI_SHMKEY_EXP(yg->server_ident, key, 1024, oldbufid);
+			shm_release(key);
+
+			if (oldbufid2) {
+				YUTANI_SHMKEY_EXP(yg->server_ident, key, 1024, oldbufid2);
+				shm_release(key);
+			}
+		}
+		/* The old ids (the client has already let go of them by the
+		 * time it sends RESIZE_DONE) go back to the allocator. */
+		bitset_clear(&buf_id_set, oldbufid);
+		if (oldbufid2) bitset_clear(&buf_id_set, oldbufid2);
 	}
 
 	spin_unlock(&yg->redraw_lock);
@@ -533,6 +900,20 @@ static void yutani_add_clip(yutani_globals_t * yg, double x, double y, double w,
 	}
 }
 
+/**
+ * Add a rectangle to a frame-local damage list.
+ */
+static void damage_add(list_t * damage, int32_t x, int32_t y, int32_t width, int32_t height) {
+	yutani_damage_rect_t * rect = malloc(sizeof(yutani_damage_rect_t));
+
+	rect->x = x;
+	rect->y = y;
+	rect->width = width;
+	rect->height = height;
+
+	list_insert(damage, rect);
+}
+
 /**
  * Mark a screen region as damaged.
  */
@@ -592,6 +973,28 @@ static void draw_cursor(yutani_globals_t * yg, int x, int y, int cursor) {
 		previous = sprite;
 	}
 
+	if (yg->cursor_plane > 0) {
+		/* Try the hardware cursor plane; only re-upload the image when
+		 * the sprite actually changes, and stop asking if the display
+		 * turns out not to have one. */
+		static sprite_t * uploaded = NULL;
+		static int have_plane = 1;
+		if (have_plane) {
+			if (sprite != uploaded) {
+				struct vid_cursor cursor = {48, 48, MOUSE_OFFSET_X, MOUSE_OFFSET_Y, sprite->bitmap};
+				have_plane = (ioctl(yg->cursor_plane, IO_VID_CURSOR, &cursor) == 0);
+				if (have_plane) uploaded = sprite;
+			}
+			if (have_plane) {
+				/* May fail when the host positions the cursor itself;
+				 * either way, no compositing work to do. */
+				struct vid_cursor_pos pos = {x / MOUSE_SCALE, y / MOUSE_SCALE, 1};
+				ioctl(yg->cursor_plane, IO_VID_CURSOR_MOVE, &pos);
+				return;
+			}
+		}
+	}
+
 	if (yg->vbox_pointer > 0) {
 		if (write(yg->vbox_pointer, sprite->bitmap, 48*48*4) > 0) {
 			/* if that was successful, we don't need to draw the cursor */
@@ -696,37 +1099,59 @@ uint32_t yutani_color_for_wid(yutani_wid_t wid) {
 	return colors[i];
 }
 
-/**
- * Blit a window to the framebuffer.
+/*
+ * Declarative animation state for one frame of one window.
  *
- * Applies transformations (rotation, animations) and then renders
- * the window through alpha blitting.
+ * Each effect - fade, squeeze, move tween - just contributes position,
+ * scale, and opacity here; a single render dispatch picks the cheapest
+ * blit that realizes the combination. Scaling is always centered on
+ * the window rectangle.
  */
-static int yutani_blit_window(yutani_globals_t * yg, yutani_server_window_t * window, int x, int y) {
+struct yutani_tween {
+	int32_t x;
+	int32_t y;
+	double scale_x;
+	double scale_y;
+	double opacity;
+};
+
+static double yutani_tween_ease(double t) {
+	return t * t * (3.0 - 2.0 * t);
+}
 
-	if (renderer_blit_window) {
-		return renderer_blit_window(yg,window,x,y);
+/*
+ * Evaluate a window's active animations into a tween for this frame,
+ * advancing or retiring them as their clocks run out. Returns nonzero
+ * when a closing animation has finished and the window should be
+ * removed instead of drawn.
+ */
+static int yutani_tween_evaluate(yutani_globals_t * yg, yutani_server_window_t * window, struct yutani_tween * tween) {
+	tween->x = window->x;
+	tween->y = window->y;
+	tween->scale_x = 1.0;
+	tween->scale_y = 1.0;
+	tween->opacity = (double)(window->opacity) / 255.0;
+
+	if (window->move_anim_start) {
+		int frame = yutani_time_since(yg, window->move_anim_start);
+		if (frame >= YUTANI_MOVE_TWEEN_LENGTH) {
+			window->move_anim_start = 0;
+		} else {
+			double t = yutani_tween_ease((double)frame / (double)YUTANI_MOVE_TWEEN_LENGTH);
+			tween->x = window->move_from_x + (window->x - window->move_from_x) * t;
+			tween->y = window->move_from_y + (window->y - window->move_from_y) * t;
+		}
 	}
 
-	sprite_t _win_sprite;
-	_win_sprite.width = window->width;
-	_win_sprite.height = window->height;
-	_win_sprite.bitmap = (uint32_t *)window->buffer;
-	_win_sprite.masks = NULL;
-	_win_sprite.blank = 0;
-	_win_sprite.alpha = ALPHA_EMBEDDED;
-
 	if (window->anim_mode) {
 		int frame = yutani_time_since(yg, window->anim_start);
 		if (frame >= yutani_animation_lengths[window->anim_mode]) {
 			/* XXX handle animation-end things like cleanup of closing windows */
 			if (yutani_is_closing_animation[window->anim_mode]) {
-				list_insert(yg->windows_to_remove, window);
-				goto draw_finish;
+				return 1;
 			}
 			window->anim_mode = 0;
 			window->anim_start = 0;
-			goto draw_window;
 		} else {
 			switch (window->anim_mode) {
 				case YUTANI_EFFECT_SQUEEZE_OUT:
@@ -740,31 +1165,83 @@ static int yutani_blit_window(yutani_globals_t * yg, yutani_server_window_t * wi
 						double time_diff = ((double)frame / (float)yutani_animation_lengths[window->anim_mode]);
 
 						if (window->server_flags & YUTANI_WINDOW_FLAG_DIALOG_ANIMATION) {
-							double x = time_diff;
-							int t_y = (window->height * (1.0 -x)) / 2;
-
-							draw_sprite_scaled(yg->backend_ctx, &_win_sprite, window->x, window->y + t_y, window->width, window->height * x);
+							tween->scale_y = time_diff;
 						} else {
-							double x = 0.75 + time_diff * 0.25;
-							int t_x = (window->width * (1.0 - x)) / 2;
-							int t_y = (window->height * (1.0 - x)) / 2;
-
-							double opacity = time_diff * (double)(window->opacity) / 255.0;
-
+							tween->opacity *= time_diff;
 							if (!yutani_window_is_top(yg, window) && !yutani_window_is_bottom(yg, window) &&
 									!(window->server_flags & YUTANI_WINDOW_FLAG_ALT_ANIMATION)) {
-								draw_sprite_scaled_alpha(yg->backend_ctx, &_win_sprite, window->x + t_x, window->y + t_y, window->width * x, window->height * x, opacity);
-							} else {
-								draw_sprite_alpha(yg->backend_ctx, &_win_sprite, window->x, window->y, opacity);
+								tween->scale_x = tween->scale_y = 0.75 + time_diff * 0.25;
 							}
 						}
 					}
 					break;
 				default:
-					goto draw_window;
 					break;
 			}
 		}
+	}
+
+	return 0;
+}
+
+/**
+ * Blit a window to the framebuffer.
+ *
+ * Applies transformations (rotation, animations) and then renders
+ * the window through alpha blitting.
+ */
+static int yutani_blit_window(yutani_globals_t * yg, yutani_server_window_t * window, int x, int y) {
+
+	if (renderer_blit_window) {
+		return renderer_blit_window(yg,window,x,y);
+	}
+
+	sprite_t _win_sprite;
+	_win_sprite.width = window->width;
+	_win_sprite.height = window->height;
+	_win_sprite.bitmap = (uint32_t *)window->buffer;
+	_win_sprite.masks = NULL;
+	_win_sprite.blank = 0;
+	_win_sprite.alpha = ALPHA_EMBEDDED;
+
+	if (window_is_animating(window)) {
+		struct yutani_tween tween;
+		if (yutani_tween_evaluate(yg, window, &tween)) {
+			list_insert(yg->windows_to_remove, window);
+			goto draw_finish;
+		}
+
+		if (!window_is_animating(window)) {
+			/* Every clock ran out during evaluation. */
+			goto draw_window;
+		}
+
+		/* Frame-budget degradation: if the previous frame blew the
+		 * deadline, drop the per-pixel alpha and scaling and paint
+		 * the tweened position with an ordinary blit - a stuttering
+		 * fade looks worse than no fade. */
+		if (yg->last_paint_msec > YUTANI_FRAME_INTERVAL) {
+			tween.scale_x = 1.0;
+			tween.scale_y = 1.0;
+			tween.opacity = 1.0;
+		}
+
+		int s_w = window->width * tween.scale_x;
+		int s_h = window->height * tween.scale_y;
+		int t_x = tween.x + (window->width - s_w) / 2;
+		int t_y = tween.y + (window->height - s_h) / 2;
+
+		if (tween.scale_x != 1.0 || tween.scale_y != 1.0) {
+			if (tween.opacity != 1.0) {
+				draw_sprite_scaled_alpha(yg->backend_ctx, &_win_sprite, t_x, t_y, s_w, s_h, tween.opacity);
+			} else {
+				draw_sprite_scaled(yg->backend_ctx, &_win_sprite, t_x, t_y, s_w, s_h);
+			}
+		} else if (tween.opacity != 1.0) {
+			draw_sprite_alpha(yg->backend_ctx, &_win_sprite, tween.x, tween.y, tween.opacity);
+		} else {
+			draw_sprite(yg->backend_ctx, &_win_sprite, tween.x, tween.y);
+		}
 	} else {
 draw_window:
 		if (window->opacity != 255) {
@@ -849,18 +1326,80 @@ static void yutani_post_vbox_rects(yutani_globals_t * yg) {
 	write(yg->vbox_rects, tmp, sizeof(tmp));
 }
 
+/**
+ * Check whether a window intersects any of this frame's damage regions.
+ *
+ * Windows that are rotated, animating, or being resized have screen
+ * bounds that don't match their width/height, so we just always draw
+ * those rather than try to be clever about it.
+ */
+static int window_is_damaged(yutani_globals_t * yg, list_t * damage, yutani_server_window_t * window) {
+	if (!damage) return 1;
+	if (window->rotation || window_is_animating(window) || window == yg->resizing_window) return 1;
+	foreach (node, damage) {
+		yutani_damage_rect_t * rect = node->value;
+		if (rect->x < window->x + (int32_t)window->width &&
+			rect->x + rect->width > window->x &&
+			rect->y < window->y + (int32_t)window->height &&
+			rect->y + rect->height > window->y) return 1;
+	}
+	return 0;
+}
+
+/**
+ * Check whether `top` fully covers `w` with opaque content.
+ *
+ * We can't see client pixels cheaply, so only tiled (maximized or
+ * half-screen) windows count as occluders: the decorators draw those
+ * with flat, opaque edges, while floating windows have alpha-blended
+ * rounded corners even at the default shape threshold. The occluder
+ * also can't be shaped, rotated, animating, or mid-resize.
+ */
+static int window_covers(yutani_globals_t * yg, yutani_server_window_t * top, yutani_server_window_t * w) {
+	if (!top->tiled || top->alpha_threshold || top->rotation || window_is_animating(top) || top == yg->resizing_window) return 0;
+	return (top->x <= w->x && top->y <= w->y &&
+			top->x + top->width  >= w->x + w->width &&
+			top->y + top->height >= w->y + w->height);
+}
+
+/**
+ * Check whether a window is entirely hidden behind a single opaque
+ * window above it in the stacking order.
+ *
+ * We don't attempt real region subtraction against the union of
+ * everything above - a single covering window catches the common
+ * case of a maximized window over a busy desktop.
+ */
+static int window_is_occluded(yutani_globals_t * yg, yutani_server_window_t * window, node_t * self) {
+	if (window->rotation || window_is_animating(window) || window == yg->resizing_window) return 0;
+	node_t * node = self ? self->next : yg->mid_zs->head;
+	for (; node; node = node->next) {
+		yutani_server_window_t * w = node->value;
+		if (w && window_covers(yg, w, window)) return 1;
+	}
+	if (yg->top_z && window_covers(yg, yg->top_z, window)) return 1;
+	return 0;
+}
+
 /**
  * Blit all windows into the given context.
  *
- * This is called for rendering and for screenshots.
+ * This is called for rendering and for screenshots. If a damage list
+ * is provided, windows that don't intersect any damaged region are
+ * skipped entirely; pass NULL to draw everything. Windows entirely
+ * hidden behind an opaque window above them are also skipped.
  */
-static void yutani_blit_windows(yutani_globals_t * yg) {
-	if (yg->bottom_z) yutani_blit_window(yg, yg->bottom_z, yg->bottom_z->x, yg->bottom_z->y);
+static void yutani_blit_windows(yutani_globals_t * yg, list_t * damage) {
+	if (yg->bottom_z && window_is_damaged(yg, damage, yg->bottom_z) && !window_is_occluded(yg, yg->bottom_z, NULL)) {
+		yutani_blit_window(yg, yg->bottom_z, yg->bottom_z->x, yg->bottom_z->y);
+	}
 	foreach (node, yg->mid_zs) {
 		yutani_server_window_t * w = node->value;
-		if (w) yutani_blit_window(yg, w, w->x, w->y);
+		if (w && window_is_damaged(yg, damage, w) && !window_is_occluded(yg, w, node)) {
+			yutani_blit_window(yg, w, w->x, w->y);
+		}
 	}
-	if (yg->top_z) yutani_blit_window(yg, yg->top_z, yg->top_z->x, yg->top_z->y);
+	if (yg->top_z && window_is_damaged(yg, damage, yg->top_z)) yutani_blit_window(yg, yg->top_z, yg->top_z->x, yg->top_z->y);
 }
 
 /**
@@ -942,7 +1481,7 @@ static void yutani_screenshot(yutani_globals_t * yg) {
  *
  * This is the main redraw function.
  */
-static void redraw_windows(yutani_globals_t * yg) {
+static int redraw_windows(yutani_globals_t * yg) {
 	int has_updates = 0;
 
 	/* We keep our own temporary mouse coordinates as they may change while we're drawing. */
@@ -982,21 +1521,26 @@ static void redraw_windows(yutani_globals_t * yg) {
 
 	if (renderer_push_state) renderer_push_state(yg);
 
+	/* Damage regions for this frame, used to skip untouched windows */
+	list_t * damage = list_create();
+
 	/* If the mouse has moved, that counts as two damage regions */
 	if ((yg->last_mouse_x != tmp_mouse_x) || (yg->last_mouse_y != tmp_mouse_y)) {
 		has_updates = 2;
 		yutani_add_clip(yg, yg->last_mouse_x / MOUSE_SCALE - MOUSE_OFFSET_X, yg->last_mouse_y / MOUSE_SCALE - MOUSE_OFFSET_Y, MOUSE_WIDTH, MOUSE_HEIGHT);
 		yutani_add_clip(yg, tmp_mouse_x / MOUSE_SCALE - MOUSE_OFFSET_X, tmp_mouse_y / MOUSE_SCALE - MOUSE_OFFSET_Y, MOUSE_WIDTH, MOUSE_HEIGHT);
+		damage_add(damage, yg->last_mouse_x / MOUSE_SCALE - MOUSE_OFFSET_X, yg->last_mouse_y / MOUSE_SCALE - MOUSE_OFFSET_Y, MOUSE_WIDTH, MOUSE_HEIGHT);
+		damage_add(damage, tmp_mouse_x / MOUSE_SCALE - MOUSE_OFFSET_X, tmp_mouse_y / MOUSE_SCALE - MOUSE_OFFSET_Y, MOUSE_WIDTH, MOUSE_HEIGHT);
 	}
 
 	yg->last_mouse_x = tmp_mouse_x;
 	yg->last_mouse_y = tmp_mouse_y;
 
-	if (yg->bottom_z && yg->bottom_z->anim_mode) mark_window(yg, yg->bottom_z);
-	if (yg->top_z && yg->top_z->anim_mode) mark_window(yg, yg->top_z);
+	if (yg->bottom_z && window_is_animating(yg->bottom_z)) mark_window_animation(yg, yg->bottom_z);
+	if (yg->top_z && window_is_animating(yg->top_z)) mark_window_animation(yg, yg->top_z);
 	foreach (node, yg->mid_zs) {
 		yutani_server_window_t * w = node->value;
-		if (w && w->anim_mode) mark_window(yg, w);
+		if (w && window_is_animating(w)) mark_window_animation(yg, w);
 	}
 
 	/* Calculate damage regions from currently queued updates */
@@ -1004,12 +1548,19 @@ static void redraw_windows(yutani_globals_t * yg) {
 	while (yg->update_list->length) {
 		node_t * win = list_dequeue(yg->update_list);
 		yutani_damage_rect_t * rect = (void *)win->value;
+		free(win);
+
+		/* Drop damage that lies entirely off screen */
+		if (rect->x >= (int32_t)yg->width || rect->y >= (int32_t)yg->height ||
+			rect->x + rect->width <= 0 || rect->y + rect->height <= 0) {
+			free(rect);
+			continue;
+		}
 
 		/* We add a clip region for each window in the update queue */
 		has_updates = 1;
 		yutani_add_clip(yg, rect->x, rect->y, rect->width, rect->height);
-		free(rect);
-		free(win);
+		list_insert(damage, rect);
 	}
 	spin_unlock(&yg->update_list_lock);
 
@@ -1031,7 +1582,7 @@ static void redraw_windows(yutani_globals_t * yg) {
 		 * we also need to render windows in stacking order...
 		 */
 		spin_lock(&yg->redraw_lock);
-		yutani_blit_windows(yg);
+		yutani_blit_windows(yg, damage);
 
 		/* Send VirtualBox rects */
 		yutani_post_vbox_rects(yg);
@@ -1093,6 +1644,20 @@ static void redraw_windows(yutani_globals_t * yg) {
 			 */
 			if (renderer_blit_screen) {
 				renderer_blit_screen(yg);
+			} else if (damage->length) {
+				/* Present just this frame's damage rectangles */
+				gfx_rect_t * rects = malloc(sizeof(gfx_rect_t) * damage->length);
+				size_t count = 0;
+				foreach (node, damage) {
+					yutani_damage_rect_t * rect = node->value;
+					rects[count].x = rect->x;
+					rects[count].y = rect->y;
+					rects[count].width = rect->width;
+					rects[count].height = rect->height;
+					count++;
+				}
+				flip_regions(yg->backend_ctx, rects, count);
+				free(rects);
 			} else {
 				flip(yg->backend_ctx);
 			}
@@ -1102,6 +1667,22 @@ static void redraw_windows(yutani_globals_t * yg) {
 
 		spin_unlock(&yg->redraw_lock);
 
+		/*
+		 * Tell opted-in clients their flips made it to the screen.
+		 * Clients that render from this callback paint exactly one
+		 * frame per frame presented instead of free-running.
+		 */
+		uint32_t frame_ts = yutani_current_time(yg);
+		foreach (node, yg->windows) {
+			yutani_server_window_t * w = node->value;
+			if (w && w->frame_pending) {
+				w->frame_pending = 0;
+				yutani_msg_buildx_frame_complete_alloc(response);
+				yutani_msg_buildx_frame_complete(response, w->wid, frame_ts);
+				server_send(yg, w->owner, response);
+			}
+		}
+
 		/*
 		 * If any windows were marked for removal,
 		 * then remove them.
@@ -1117,6 +1698,10 @@ static void redraw_windows(yutani_globals_t * yg) {
 
 	}
 
+	list_destroy(damage);
+	list_free(damage);
+	free(damage);
+
 	if (renderer_pop_state) renderer_pop_state(yg);
 
 	if (yg->screenshot_frame) {
@@ -1130,6 +1715,7 @@ static void redraw_windows(yutani_globals_t * yg) {
 		try_load_extensions(yg);
 	}
 
+	return has_updates;
 }
 
 /**
@@ -1144,29 +1730,47 @@ void yutani_clip_init(yutani_globals_t * yg) {
 /**
  * Redraw thread.
  *
- * Calls the redraw functions in a loop, with some
- * additional yielding and sleeping.
+ * Runs the redraw function on a fixed frame clock. Deadlines advance
+ * by the frame interval rather than from whenever we woke up, so a
+ * slow frame doesn't push every following frame later - damage keeps
+ * coalescing in the update list while we sleep and the next frame
+ * picks it all up at once. If we overran the deadline entirely, we
+ * realign to the next interval boundary instead of racing to catch up.
  */
 static void * redraw(void * in) {
 
 	sysfunc(TOARU_SYS_FUNC_THREADNAME,(char *[]){"compositor","render thread",NULL});
 
 	yutani_globals_t * yg = in;
+	uint32_t next_frame = yutani_current_time(yg) + YUTANI_FRAME_INTERVAL;
 	while (yg->server) {
 		/*
 		 * Perform whatever redraw work is required.
 		 */
-		redraw_windows(yg);
+		uint32_t start = yutani_current_time(yg);
+		int painted = redraw_windows(yg);
+		uint32_t end = yutani_current_time(yg);
+
+		if (painted) {
+			yg->frames_painted++;
+			yg->last_paint_msec = end - start;
+			yg->total_paint_msec += end - start;
+
+			/* Attribute this frame to the oldest input it presented */
+			if (yg->input_pending_since) {
+				latency_record(yg->latency_present_hist, yutani_absolute_time() - yg->input_pending_since);
+				yg->input_pending_since = 0;
+			}
+		}
 
-		/*
-		 * Attempt to run at about 60fps...
-		 * we should actually see how long it took to render so
-		 * we can sleep *less* if it took a long time to render
-		 * this particular frame. We are definitely not
-		 * going to run at 60fps unless there's nothing to do
-		 * (and even then we've wasted cycles checking).
-		 */
-		usleep(16666);
+		if (end >= next_frame) {
+			/* Missed the deadline; skip to the next interval boundary. */
+			yg->frames_missed += 1 + (end - next_frame) / YUTANI_FRAME_INTERVAL;
+			next_frame += ((end - next_frame) / YUTANI_FRAME_INTERVAL + 1) * YUTANI_FRAME_INTERVAL;
+		} else {
+			usleep((next_frame - end) * 1000);
+			next_frame += YUTANI_FRAME_INTERVAL;
+		}
 	}
 
 	return NULL;
@@ -1240,6 +1844,25 @@ static void mark_window(yutani_globals_t * yg, yutani_server_window_t * window)
 	mark_window_relative(yg, window, 0, 0, window->width, window->height);
 }
 
+/**
+ * Mark everything an animating window may touch this frame.
+ *
+ * A move tween draws the window somewhere between its old and new
+ * positions, so the bounding box of the whole glide path is marked;
+ * the other effects stay inside the window rectangle.
+ */
+static void mark_window_animation(yutani_globals_t * yg, yutani_server_window_t * window) {
+	if (window->move_anim_start) {
+		int32_t left = window->move_from_x < window->x ? window->move_from_x : window->x;
+		int32_t top  = window->move_from_y < window->y ? window->move_from_y : window->y;
+		int32_t right  = (window->move_from_x > window->x ? window->move_from_x : window->x) + window->width;
+		int32_t bottom = (window->move_from_y > window->y ? window->move_from_y : window->y) + window->height;
+		mark_screen(yg, left, top, right - left, bottom - top);
+	} else {
+		mark_window(yg, window);
+	}
+}
+
 /**
  * Set a window as closed. It will be removed after rendering has completed.
  */
@@ -1267,7 +1890,7 @@ static void window_remove_from_client(yutani_globals_t * yg, yutani_server_windo
  */
 static void window_actually_close(yutani_globals_t * yg, yutani_server_window_t * w) {
 	/* Remove from the wid -> window mapping */
-	hashmap_remove(yg->wids_to_windows, (void *)w->wid);
+	intmap_remove(yg->wids_to_windows, w->wid);
 
 	/* Remove from the general list of windows. */
 	list_remove(yg->windows, list_index_of(yg->windows, w));
@@ -1287,7 +1910,10 @@ static void window_actually_close(yutani_globals_t * yg, yutani_server_window_t
 		}
 	}
 
-	{
+	if (w->atlas) {
+		/* The span goes back to the pool; the segment stays mapped */
+		atlas_free(w->atlas, w->atlas_offset, w->atlas_size);
+	} else {
 		char key[1024];
 		YUTANI_SHMKEY_EXP(yg->server_ident, key, 1024, w->bufid);
 
@@ -1297,8 +1923,19 @@ static void window_actually_close(yutani_globals_t * yg, yutani_server_window_t
 		 * render thread, so we don't bother.
 		 */
 		shm_release(key);
+
+		if (w->bufid2) {
+			YUTANI_SHMKEY_EXP(yg->server_ident, key, 1024, w->bufid2);
+			shm_release(key);
+		}
 	}
 
+	/* The wid and buffer ids (atlas windows still hold ids as resize
+	 * tokens) are free for the next window. */
+	bitset_clear(&wid_set, w->wid);
+	bitset_clear(&buf_id_set, w->bufid);
+	if (w->bufid2) bitset_clear(&buf_id_set, w->bufid2);
+
 	/* Notify subscribers that there are changes to windows */
 	notify_subscribers(yg);
 }
@@ -1323,7 +1960,7 @@ static void yutani_query_result(yutani_globals_t * yg, uint32_t dest, yutani_ser
 	if (win && win->client_length) {
 		yutani_msg_buildx_window_advertise_alloc(response, win->client_length);
 		yutani_msg_buildx_window_advertise(response, win->wid, ad_flags(yg, win), win->client_offsets, win->client_length, win->client_strings);
-		pex_send(yg->server, dest, response->size, (char *)response);
+		server_send(yg, dest, response);
 	}
 }
 
@@ -1342,7 +1979,7 @@ static void notify_subscribers(yutani_globals_t * yg) {
 			}
 			list_insert(remove, node);
 		} else {
-			pex_send(yg->server, subscriber, response->size, (char *)response);
+			server_send(yg, subscriber, response);
 		}
 	}
 	if (remove) {
@@ -1357,13 +1994,27 @@ static void notify_subscribers(yutani_globals_t * yg) {
 
 static void window_move(yutani_globals_t * yg, yutani_server_window_t * window, int x, int y) {
 	mark_window(yg, window);
+
+	/* Interactive moves (dragging, interactive resizes) track the mouse
+	 * directly; anything else glides to its destination. Windows that
+	 * are mid-fade or mid-squeeze skip the glide so the effects don't
+	 * compound during initial placement. */
+	if (window != yg->mouse_window && window != yg->resizing_window &&
+			!window->anim_mode && (window->x != x || window->y != y)) {
+		window->move_from_x = window->x;
+		window->move_from_y = window->y;
+		window->move_anim_start = yutani_current_time(yg);
+	} else {
+		window->move_anim_start = 0;
+	}
+
 	window->x = x;
 	window->y = y;
 	mark_window(yg, window);
 
 	yutani_msg_buildx_window_move_alloc(response);
 	yutani_msg_buildx_window_move(response, window->wid, x, y);
-	pex_send(yg->server, window->owner, response->size, (char *)response);
+	server_send(yg, window->owner, response);
 }
 
 /**
@@ -1431,8 +2082,8 @@ static void window_tile(yutani_globals_t * yg, yutani_server_window_t * window,
 
 	window_move(yg, window, _x, _y);
 	yutani_msg_buildx_window_resize_alloc(response);
-	yutani_msg_buildx_window_resize(response, YUTANI_MSG_RESIZE_OFFER, window->wid, w, h, 0, tile);
-	pex_send(yg->server, window->owner, response->size, (char *)response);
+	yutani_msg_buildx_window_resize(response, YUTANI_MSG_RESIZE_OFFER, window->wid, w, h, 0, tile, 0, 0);
+	server_send(yg, window->owner, response);
 }
 
 /**
@@ -1442,8 +2093,8 @@ static void window_untile(yutani_globals_t * yg, yutani_server_window_t * window
 	window->tiled = 0;
 
 	yutani_msg_buildx_window_resize_alloc(response);
-	yutani_msg_buildx_window_resize(response,YUTANI_MSG_RESIZE_OFFER, window->wid, window->untiled_width, window->untiled_height, 0, 0);
-	pex_send(yg->server, window->owner, response->size, (char *)response);
+	yutani_msg_buildx_window_resize(response,YUTANI_MSG_RESIZE_OFFER, window->wid, window->untiled_width, window->untiled_height, 0, 0, 0, 0);
+	server_send(yg, window->owner, response);
 }
 
 /**
@@ -1504,7 +2155,7 @@ static void handle_key_event(yutani_globals_t * yg, struct yutani_msg_key_event
 			if (focused->z != YUTANI_ZORDER_BOTTOM && focused->z != YUTANI_ZORDER_TOP) {
 				yutani_msg_buildx_window_close_alloc(response);
 				yutani_msg_buildx_window_close(response, focused->wid);
-				pex_send(yg->server, focused->owner, response->size, (char *)response);
+				server_send(yg, focused->owner, response);
 				return;
 			}
 		}
@@ -1606,7 +2257,7 @@ static void handle_key_event(yutani_globals_t * yg, struct yutani_msg_key_event
 
 		yutani_msg_buildx_key_event_alloc(response);
 		yutani_msg_buildx_key_event(response,focused ? focused->wid : UINT32_MAX, &ke->event, &ke->state);
-		pex_send(yg->server, bind->owner, response->size, (char *)response);
+		server_send(yg, bind->owner, response);
 
 		if (bind->response == YUTANI_BIND_STEAL) {
 			/* If this keybinding was registered as "steal", we'll stop here. */
@@ -1619,7 +2270,7 @@ static void handle_key_event(yutani_globals_t * yg, struct yutani_msg_key_event
 
 		yutani_msg_buildx_key_event_alloc(response);
 		yutani_msg_buildx_key_event(response,focused->wid, &ke->event, &ke->state);
-		pex_send(yg->server, focused->owner, response->size, (char *)response);
+		server_send(yg, focused->owner, response);
 
 	}
 }
@@ -1772,6 +2423,18 @@ static void mouse_start_resize(yutani_globals_t * yg, yutani_scale_direction_t d
 	}
 }
 
+/*
+ * Hand a device mouse packet to the usual event path.
+ */
+static void handle_mouse_event(yutani_globals_t * yg, struct yutani_msg_mouse_event * me);
+static void device_mouse_event(yutani_globals_t * yg, mouse_device_packet_t * packet, int type) {
+	input_note_arrival(yg, packet->timestamp);
+	yg->last_mouse_buttons = packet->buttons;
+	yutani_msg_buildx_mouse_event_alloc(m);
+	yutani_msg_buildx_mouse_event(m, 0, packet, type);
+	handle_mouse_event(yg, (struct yutani_msg_mouse_event *)m->data);
+}
+
 static void handle_mouse_event(yutani_globals_t * yg, struct yutani_msg_mouse_event * me)  {
 	if (me->type == YUTANI_MOUSE_EVENT_TYPE_RELATIVE) {
 		yg->mouse_x += me->event.x_difference YUTANI_INCOMING_MOUSE_SCALE;
@@ -1818,7 +2481,7 @@ static void handle_mouse_event(yutani_globals_t * yg, struct yutani_msg_mouse_ev
 						yutani_msg_buildx_window_mouse_event(response,yg->mouse_window->wid, yg->mouse_click_x, yg->mouse_click_y, -1, -1, me->event.buttons, YUTANI_MOUSE_EVENT_DOWN, yg->active_modifiers);
 						yg->mouse_click_x_orig = yg->mouse_click_x;
 						yg->mouse_click_y_orig = yg->mouse_click_y;
-						pex_send(yg->server, yg->mouse_window->owner, response->size, (char *)response);
+						server_send(yg, yg->mouse_window->owner, response);
 					}
 				} else {
 					yg->mouse_window = get_focused(yg);
@@ -1828,7 +2491,7 @@ static void handle_mouse_event(yutani_globals_t * yg, struct yutani_msg_mouse_ev
 						yutani_device_to_window(yg->mouse_window, yg->mouse_x / MOUSE_SCALE, yg->mouse_y / MOUSE_SCALE, &x, &y);
 						yutani_msg_buildx_window_mouse_event_alloc(response);
 						yutani_msg_buildx_window_mouse_event(response,yg->mouse_window->wid, x, y, -1, -1, me->event.buttons, YUTANI_MOUSE_EVENT_MOVE, yg->active_modifiers);
-						pex_send(yg->server, yg->mouse_window->owner, response->size, (char *)response);
+						server_send(yg, yg->mouse_window->owner, response);
 					}
 					if (tmp_window) {
 						int32_t x, y;
@@ -1836,18 +2499,18 @@ static void handle_mouse_event(yutani_globals_t * yg, struct yutani_msg_mouse_ev
 						if (tmp_window != yg->old_hover_window) {
 							yutani_device_to_window(tmp_window, yg->mouse_x / MOUSE_SCALE, yg->mouse_y / MOUSE_SCALE, &x, &y);
 							yutani_msg_buildx_window_mouse_event(response, tmp_window->wid, x, y, -1, -1, me->event.buttons, YUTANI_MOUSE_EVENT_ENTER, yg->active_modifiers);
-							pex_send(yg->server, tmp_window->owner, response->size, (char *)response);
+							server_send(yg, tmp_window->owner, response);
 							if (yg->old_hover_window) {
 								yutani_device_to_window(yg->old_hover_window, yg->mouse_x / MOUSE_SCALE, yg->mouse_y / MOUSE_SCALE, &x, &y);
 								yutani_msg_buildx_window_mouse_event(response, yg->old_hover_window->wid, x, y, -1, -1, me->event.buttons, YUTANI_MOUSE_EVENT_LEAVE, yg->active_modifiers);
-								pex_send(yg->server, yg->old_hover_window->owner, response->size, (char *)response);
+								server_send(yg, yg->old_hover_window->owner, response);
 							}
 							yg->old_hover_window = tmp_window;
 						}
 						if (tmp_window != yg->mouse_window || (me->event.buttons & YUTANI_MOUSE_BUTTON_RIGHT)) {
 							yutani_device_to_window(tmp_window, yg->mouse_x / MOUSE_SCALE, yg->mouse_y / MOUSE_SCALE, &x, &y);
 							yutani_msg_buildx_window_mouse_event(response, tmp_window->wid, x, y, -1, -1, me->event.buttons, YUTANI_MOUSE_EVENT_MOVE, yg->active_modifiers);
-							pex_send(yg->server, tmp_window->owner, response->size, (char *)response);
+							server_send(yg, tmp_window->owner, response);
 						}
 					}
 				}
@@ -1933,11 +2596,11 @@ static void handle_mouse_event(yutani_globals_t * yg, struct yutani_msg_mouse_ev
 						if (!yg->mouse_moved) {
 							yutani_msg_buildx_window_mouse_event_alloc(response);
 							yutani_msg_buildx_window_mouse_event(response,yg->mouse_window->wid, yg->mouse_click_x, yg->mouse_click_y, -1, -1, me->event.buttons, YUTANI_MOUSE_EVENT_CLICK, yg->active_modifiers);
-							pex_send(yg->server, yg->mouse_window->owner, response->size, (char *)response);
+							server_send(yg, yg->mouse_window->owner, response);
 						} else {
 							yutani_msg_buildx_window_mouse_event_alloc(response);
 							yutani_msg_buildx_window_mouse_event(response,yg->mouse_window->wid, yg->mouse_click_x, yg->mouse_click_y, old_x, old_y, me->event.buttons, YUTANI_MOUSE_EVENT_RAISE, yg->active_modifiers);
-							pex_send(yg->server, yg->mouse_window->owner, response->size, (char *)response);
+							server_send(yg, yg->mouse_window->owner, response);
 						}
 					}
 				} else {
@@ -1950,7 +2613,7 @@ static void handle_mouse_event(yutani_globals_t * yg, struct yutani_msg_mouse_ev
 						if (old_x != yg->mouse_click_x || old_y != yg->mouse_click_y) {
 							yutani_msg_buildx_window_mouse_event_alloc(response);
 							yutani_msg_buildx_window_mouse_event(response,yg->mouse_window->wid, yg->mouse_click_x, yg->mouse_click_y, old_x, old_y, me->event.buttons, YUTANI_MOUSE_EVENT_DRAG, yg->active_modifiers);
-							pex_send(yg->server, yg->mouse_window->owner, response->size, (char *)response);
+							server_send(yg, yg->mouse_window->owner, response);
 						}
 					}
 				}
@@ -2036,8 +2699,8 @@ static void handle_mouse_event(yutani_globals_t * yg, struct yutani_msg_mouse_ev
 					TRACE("resize complete, now %d x %d", yg->resizing_w, yg->resizing_h);
 					window_move(yg, yg->resizing_window, x,y);
 					yutani_msg_buildx_window_resize_alloc(response);
-					yutani_msg_buildx_window_resize(response,YUTANI_MSG_RESIZE_OFFER, yg->resizing_window->wid, yg->resizing_w, yg->resizing_h, 0, yg->resizing_window->tiled);
-					pex_send(yg->server, yg->resizing_window->owner, response->size, (char *)response);
+					yutani_msg_buildx_window_resize(response,YUTANI_MSG_RESIZE_OFFER, yg->resizing_window->wid, yg->resizing_w, yg->resizing_h, 0, yg->resizing_window->tiled, 0, 0);
+					server_send(yg, yg->resizing_window->owner, response);
 					yg->resizing_window = NULL;
 					yg->mouse_window = NULL;
 					yg->mouse_state = YUTANI_MOUSE_STATE_NORMAL;
@@ -2094,10 +2757,10 @@ int main(int argc, char * argv[]) {
 	}
 
 	{
-		struct timeval t;
-		gettimeofday(&t, NULL);
+		struct timespec t;
+		clock_gettime(CLOCK_MONOTONIC, &t);
 		yg->start_time = t.tv_sec;
-		yg->start_subtime = t.tv_usec;
+		yg->start_subtime = t.tv_nsec;
 	}
 
 	yg->width = yg->backend_ctx->width;
@@ -2188,10 +2851,12 @@ int main(int argc, char * argv[]) {
 	yg->mouse_x = yg->width * MOUSE_SCALE / 2;
 	yg->mouse_y = yg->height * MOUSE_SCALE / 2;
 
+	id_sets_init();
 	yg->windows = list_create();
-	yg->wids_to_windows = hashmap_create_int(10);
+	yg->wids_to_windows = intmap_create(10);
 	yg->key_binds = hashmap_create_int(10);
 	yg->clients_to_windows = hashmap_create_int(10);
+	yg->client_protocols = hashmap_create_int(10);
 	yg->mid_zs = list_create();
 
 	yg->window_subscribers = list_create();
@@ -2224,6 +2889,7 @@ int main(int argc, char * argv[]) {
 	int fds[4];
 	int mfd = -1;
 	int kfd = -1;
+	int kefd = -1;
 	int amfd = -1;
 	int vmmouse = 0;
 	mouse_device_packet_t packet;
@@ -2236,7 +2902,11 @@ int main(int argc, char * argv[]) {
 		fds[1] = fileno(yg->host_context->sock);
 	} else {
 		mfd = open("/dev/mouse", O_RDONLY);
-		kfd = open("/dev/kbd", O_RDONLY);
+		kefd = open("/dev/kbdev", O_RDONLY);
+		if (kefd < 0) {
+			/* No translated event device; parse the raw scancode stream */
+			kfd = open("/dev/kbd", O_RDONLY);
+		}
 		amfd = open("/dev/absmouse", O_RDONLY);
 		if (amfd < 0) {
 			amfd = open("/dev/vmmouse", O_RDONLY);
@@ -2244,23 +2914,43 @@ int main(int argc, char * argv[]) {
 		}
 		yg->vbox_rects = open("/dev/vboxrects", O_WRONLY);
 		yg->vbox_pointer = open("/dev/vboxpointer", O_WRONLY);
+		yg->cursor_plane = open("/dev/fb0", O_RDONLY);
 
 		fds[1] = mfd;
-		fds[2] = kfd;
+		fds[2] = (kefd >= 0) ? kefd : kfd;
 		fds[3] = amfd;
 	}
 
+	/* Register everything with an event set once; each pass through
+	 * the loop then costs only the descriptor that is ready, instead
+	 * of re-registering the whole list like fswait does. */
+	int events = eventset_create();
+	eventset_ctl(events, EVENTSET_ADD, fds[0]);
+	if (yutani_options.nested) {
+		eventset_ctl(events, EVENTSET_ADD, fds[1]);
+	} else {
+		eventset_ctl(events, EVENTSET_ADD, mfd);
+		eventset_ctl(events, EVENTSET_ADD, fds[2]);
+		if (amfd != -1) {
+			eventset_ctl(events, EVENTSET_ADD, amfd);
+		}
+	}
+
 	while (1) {
-		if (yutani_options.nested) {
-			int index = fswait(2, fds);
+		int rfd = -1;
+		if (eventset_wait(events, &rfd, 1, -1) < 1) continue;
 
-			if (index == 1) {
+		if (yutani_options.nested) {
+			if (rfd == fds[1]) {
 				yutani_msg_t * m = yutani_poll(yg->host_context);
 				if (m) {
 					switch (m->type) {
 						case YUTANI_MSG_KEY_EVENT:
 							{
 								struct yutani_msg_key_event * ke = (void*)m->data;
+								/* The host's stamp is on its own clock; restamp locally */
+								ke->event.timestamp = yutani_absolute_time();
+								input_note_arrival(yg, ke->event.timestamp);
 								yutani_msg_buildx_key_event_alloc(m_);
 								yutani_msg_buildx_key_event(m_, 0, &ke->event, &ke->state);
 								handle_key_event(yg, (struct yutani_msg_key_event *)m_->data);
@@ -2274,6 +2964,7 @@ int main(int argc, char * argv[]) {
 								packet.buttons = me->buttons;
 								packet.x_difference = me->new_x;
 								packet.y_difference = me->new_y;
+								packet.timestamp = yutani_absolute_time();
 
 								yg->last_mouse_buttons = packet.buttons;
 
@@ -2310,38 +3001,80 @@ int main(int argc, char * argv[]) {
 				continue;
 			}
 		} else {
-			int index = fswait(amfd == -1 ? 3 : 4, fds);
-
-			if (index == 2) {
+			if (rfd == kefd) {
+				/* Events arrive already translated and stamped by the
+				 * driver, so use the interrupt time for latency tracking
+				 * and skip the scancode state machine entirely. */
+				key_event_t kevents[8];
+				int r = read(kefd, (char *)kevents, sizeof(kevents));
+				int count = r / sizeof(key_event_t);
+				for (int i = 0; i < count; ++i) {
+					input_note_arrival(yg, kevents[i].timestamp);
+					yutani_msg_buildx_key_event_alloc(m);
+					yutani_msg_buildx_key_event(m, 0, &kevents[i], &state);
+					handle_key_event(yg, (struct yutani_msg_key_event *)m->data);
+				}
+				continue;
+			} else if (rfd == kfd) {
 				unsigned char buf[1];
 				int r = read(kfd, buf, 1);
 				if (r > 0) {
 					kbd_scancode(&state, buf[0], &event);
+					/* The raw scancode stream carries no driver stamp;
+					 * read time is the closest thing we have. */
+					event.timestamp = yutani_absolute_time();
+					input_note_arrival(yg, event.timestamp);
 					yutani_msg_buildx_key_event_alloc(m);
 					yutani_msg_buildx_key_event(m,0, &event, &state);
 					handle_key_event(yg, (struct yutani_msg_key_event *)m->data);
 				}
 				continue;
-			} else if (index == 1) {
-				int r = read(mfd, (char *)&packet, sizeof(mouse_device_packet_t));
-				if (r > 0) {
-					yg->last_mouse_buttons = packet.buttons;
-					yutani_msg_buildx_mouse_event_alloc(m);
-					yutani_msg_buildx_mouse_event(m,0, &packet, YUTANI_MOUSE_EVENT_TYPE_RELATIVE);
-					handle_mouse_event(yg, (struct yutani_msg_mouse_event *)m->data);
+			} else if (rfd == mfd) {
+				/* Drain the whole backlog in one read and coalesce runs of
+				 * motion with the same button state into a single event, so
+				 * a fast mouse costs one cursor update per frame rather
+				 * than one per packet. Scroll packets are never merged. */
+				mouse_device_packet_t packets[32];
+				int r = read(mfd, (char *)packets, sizeof(packets));
+				int count = r / sizeof(mouse_device_packet_t);
+				int have_pending = 0;
+				for (int i = 0; i < count; ++i) {
+					mouse_device_packet_t * p = &packets[i];
+					int scrolled = p->buttons & (MOUSE_SCROLL_UP | MOUSE_SCROLL_DOWN);
+					if (have_pending && !scrolled && packet.buttons == p->buttons) {
+						packet.x_difference += p->x_difference;
+						packet.y_difference += p->y_difference;
+						continue;
+					}
+					if (have_pending) {
+						device_mouse_event(yg, &packet, YUTANI_MOUSE_EVENT_TYPE_RELATIVE);
+					}
+					packet = *p;
+					have_pending = !scrolled;
+					if (scrolled) {
+						device_mouse_event(yg, &packet, YUTANI_MOUSE_EVENT_TYPE_RELATIVE);
+					}
+				}
+				if (have_pending) {
+					device_mouse_event(yg, &packet, YUTANI_MOUSE_EVENT_TYPE_RELATIVE);
 				}
 				continue;
-			} else if (index == 3) {
-				int r = read(amfd, (char *)&packet, sizeof(mouse_device_packet_t));
-				if (r > 0) {
+			} else if (rfd == amfd && amfd != -1) {
+				/* Absolute positions supersede each other, so only the last
+				 * packet of a run with the same buttons needs delivering */
+				mouse_device_packet_t packets[32];
+				int r = read(amfd, (char *)packets, sizeof(packets));
+				int count = r / sizeof(mouse_device_packet_t);
+				for (int i = 0; i < count; ++i) {
+					mouse_device_packet_t * p = &packets[i];
+					int scrolled = p->buttons & (MOUSE_SCROLL_UP | MOUSE_SCROLL_DOWN);
+					if (i + 1 < count && !scrolled && packets[i+1].buttons == p->buttons) {
+						continue;
+					}
 					if (!vmmouse) {
-						packet.buttons = yg->last_mouse_buttons & 0xF;
-					} else {
-						yg->last_mouse_buttons = packet.buttons;
+						p->buttons = yg->last_mouse_buttons & 0xF;
 					}
-					yutani_msg_buildx_mouse_event_alloc(m);
-					yutani_msg_buildx_mouse_event(m,0, &packet, YUTANI_MOUSE_EVENT_TYPE_ABSOLUTE);
-					handle_mouse_event(yg, (struct yutani_msg_mouse_event *)m->data);
+					device_mouse_event(yg, p, YUTANI_MOUSE_EVENT_TYPE_ABSOLUTE);
 				}
 				continue;
 			}
@@ -2367,6 +3100,7 @@ int main(int argc, char * argv[]) {
 				list_free(client_list);
 				free(client_list);
 			}
+			hashmap_remove(yg->client_protocols, (void *)p->source);
 
 			if (hashmap_is_empty(yg->clients_to_windows)) {
 				TRACE("Last compositor client disconnected, exiting.");
@@ -2379,354 +3113,424 @@ int main(int argc, char * argv[]) {
 			continue;
 		}
 
-		if (m->magic != YUTANI_MSG__MAGIC) {
-			TRACE("Message has bad magic. (Should eject client, but will instead skip this message.) 0x%x", m->magic);
-			free(p);
-			continue;
-		}
+		/* Clients batch messages, so one packet may carry several;
+		 * v2 clients send them as compact frames. The decoder hands
+		 * back v1-shaped messages either way. */
+		for (size_t offset = 0; offset < p->size; ) {
+			size_t consumed = 0;
+			m = yutani_msg_decode((char *)p->data + offset, p->size - offset, &consumed);
 
-		switch(m->type) {
-			case YUTANI_MSG_HELLO:
-				{
-					TRACE("And hello to you, %08x!", p->source);
-					list_t * client_list = hashmap_get(yg->clients_to_windows, (void *)p->source);
-					if (!client_list) {
-						TRACE("Client is new: %x", p->source);
-						client_list = list_create();
-						hashmap_set(yg->clients_to_windows, (void *)p->source, client_list);
-					}
-					yutani_msg_buildx_welcome_alloc(response);
-					yutani_msg_buildx_welcome(response,yg->width, yg->height);
-					pex_send(server, p->source, response->size, (char *)response);
-				}
+			if (!m) {
+				TRACE("Undecodable message. (Should eject client, but will instead skip the rest of this packet.)");
 				break;
-			case YUTANI_MSG_WINDOW_NEW:
-			case YUTANI_MSG_WINDOW_NEW_FLAGS:
-				{
-					struct yutani_msg_window_new_flags * wn = (void *)m->data;
-					TRACE("Client %08x requested a new window (%dx%d).", p->source, wn->width, wn->height);
-					yutani_server_window_t * w = server_window_create(yg, wn->width, wn->height, p->source, m->type != YUTANI_MSG_WINDOW_NEW ? wn->flags : 0);
-					yutani_msg_buildx_window_init_alloc(response);
-					yutani_msg_buildx_window_init(response,w->wid, w->width, w->height, w->bufid);
-					pex_send(server, p->source, response->size, (char *)response);
-
-					if (!(w->server_flags & YUTANI_WINDOW_FLAG_NO_STEAL_FOCUS)) {
-						set_focused_window(yg, w);
+			}
+			offset += consumed;
+
+			switch(m->type) {
+				case YUTANI_MSG_HELLO:
+					{
+						TRACE("And hello to you, %08x!", p->source);
+						list_t * client_list = hashmap_get(yg->clients_to_windows, (void *)p->source);
+						if (!client_list) {
+							TRACE("Client is new: %x", p->source);
+							client_list = list_create();
+							hashmap_set(yg->clients_to_windows, (void *)p->source, client_list);
+						}
+						/* A bare hello is a v1 client; a payload is a
+						 * version announcement. Everything after the
+						 * welcome goes out framed to match. */
+						if (m->size >= sizeof(struct yutani_message) + sizeof(struct yutani_msg_hello)) {
+							struct yutani_msg_hello * hello = (void *)m->data;
+							uintptr_t version = hello->version > YUTANI_PROTOCOL_VERSION ? YUTANI_PROTOCOL_VERSION : hello->version;
+							hashmap_set(yg->client_protocols, (void *)p->source, (void *)(version | ((uintptr_t)hello->flags << 8)));
+						}
+						yutani_msg_buildx_welcome_alloc(response);
+						yutani_msg_buildx_welcome(response,yg->width, yg->height);
+						server_send(yg, p->source, response);
 					}
+					break;
+				case YUTANI_MSG_WINDOW_NEW:
+				case YUTANI_MSG_WINDOW_NEW_FLAGS:
+					{
+						struct yutani_msg_window_new_flags * wn = (void *)m->data;
+						TRACE("Client %08x requested a new window (%dx%d).", p->source, wn->width, wn->height);
+						yutani_server_window_t * w = server_window_create(yg, wn->width, wn->height, p->source, m->type != YUTANI_MSG_WINDOW_NEW ? wn->flags : 0);
+						yutani_msg_buildx_window_init_alloc(response);
+						yutani_msg_buildx_window_init(response,w->wid, w->width, w->height, w->bufid, w->atlas, w->atlas_offset);
+						server_send(yg, p->source, response);
+
+						if (!(w->server_flags & YUTANI_WINDOW_FLAG_NO_STEAL_FOCUS)) {
+							set_focused_window(yg, w);
+						}
 
-					notify_subscribers(yg);
-				}
-				break;
-			case YUTANI_MSG_FLIP:
-				{
-					struct yutani_msg_flip * wf = (void *)m->data;
-					yutani_server_window_t * w = hashmap_get(yg->wids_to_windows, (void *)wf->wid);
-					if (w) {
-						mark_window(yg, w);
+						notify_subscribers(yg);
 					}
-				}
-				break;
-			case YUTANI_MSG_FLIP_REGION:
-				{
-					struct yutani_msg_flip_region * wf = (void *)m->data;
-					yutani_server_window_t * w = hashmap_get(yg->wids_to_windows, (void *)wf->wid);
-					if (w) {
-						mark_window_relative(yg, w, wf->x, wf->y, wf->width, wf->height);
+					break;
+				case YUTANI_MSG_FLIP:
+					{
+						struct yutani_msg_flip * wf = (void *)m->data;
+						yutani_server_window_t * w = intmap_get(yg->wids_to_windows, wf->wid);
+						if (w) {
+							w->frame_pending = w->frame_notify;
+							mark_window(yg, w);
+						}
 					}
-				}
-				break;
-			case YUTANI_MSG_KEY_EVENT:
-				{
-					/* XXX Verify this is from a valid device client */
-					struct yutani_msg_key_event * ke = (void *)m->data;
-					handle_key_event(yg, ke);
-				}
-				break;
-			case YUTANI_MSG_MOUSE_EVENT:
-				{
-					/* XXX Verify this is from a valid device client */
-					struct yutani_msg_mouse_event * me = (void *)m->data;
-					handle_mouse_event(yg, me);
-				}
-				break;
-			case YUTANI_MSG_WINDOW_MOVE:
-				{
-					struct yutani_msg_window_move * wm = (void *)m->data;
-					//TRACE("%08x wanted to move window %d to %d, %d", p->source, wm->wid, (int)wm->x, (int)wm->y);
-					if (wm->x > (int)yg->width + 100 || wm->x < -(int)yg->width || wm->y > (int)yg->height + 100 || wm->y < -(int)yg->height) {
-						TRACE("Refusing to move window to these coordinates.");
-						break;
+					break;
+				case YUTANI_MSG_FLIP_REGION:
+					{
+						struct yutani_msg_flip_region * wf = (void *)m->data;
+						yutani_server_window_t * w = intmap_get(yg->wids_to_windows, wf->wid);
+						if (w) {
+							w->frame_pending = w->frame_notify;
+							mark_window_relative(yg, w, wf->x, wf->y, wf->width, wf->height);
+						}
 					}
-					yutani_server_window_t * win = hashmap_get(yg->wids_to_windows, (void*)wm->wid);
-					if (win) {
-						window_move(yg, win, wm->x, wm->y);
-					} else {
-						TRACE("%08x wanted to move window %d, but I can't find it?", p->source, wm->wid);
+					break;
+				case YUTANI_MSG_FLIP_BUFFER:
+					{
+						struct yutani_msg_flip_buffer * wf = (void *)m->data;
+						yutani_server_window_t * w = intmap_get(yg->wids_to_windows, wf->wid);
+						if (w && w->buffer2 && wf->bufid == w->bufid2) {
+							/* Swap the presented buffer under the redraw lock
+							 * so the render thread never sees a half-swap. */
+							spin_lock(&yg->redraw_lock);
+							uint8_t * tmp_buf = w->buffer;
+							uint32_t tmp_id = w->bufid;
+							w->buffer = w->buffer2;
+							w->bufid = w->bufid2;
+							w->buffer2 = tmp_buf;
+							w->bufid2 = tmp_id;
+							spin_unlock(&yg->redraw_lock);
+						}
+						if (w) {
+							w->frame_pending = w->frame_notify;
+							if (wf->width < 0 || wf->height < 0) {
+								mark_window(yg, w);
+							} else {
+								mark_window_relative(yg, w, wf->x, wf->y, wf->width, wf->height);
+							}
+						}
 					}
-				}
-				break;
-			case YUTANI_MSG_WINDOW_CLOSE:
-				{
-					struct yutani_msg_window_close * wc = (void *)m->data;
-					yutani_server_window_t * w = hashmap_get(yg->wids_to_windows, (void *)wc->wid);
-					if (w) {
-						window_mark_for_close(yg, w);
-						window_remove_from_client(yg, w);
+					break;
+				case YUTANI_MSG_KEY_EVENT:
+					{
+						/* XXX Verify this is from a valid device client */
+						struct yutani_msg_key_event * ke = (void *)m->data;
+						handle_key_event(yg, ke);
 					}
-				}
-				break;
-			case YUTANI_MSG_WINDOW_STACK:
-				{
-					struct yutani_msg_window_stack * ws = (void *)m->data;
-					yutani_server_window_t * w = hashmap_get(yg->wids_to_windows, (void *)ws->wid);
-					if (w) {
-						reorder_window(yg, w, ws->z);
+					break;
+				case YUTANI_MSG_MOUSE_EVENT:
+					{
+						/* XXX Verify this is from a valid device client */
+						struct yutani_msg_mouse_event * me = (void *)m->data;
+						handle_mouse_event(yg, me);
 					}
-				}
-				break;
-			case YUTANI_MSG_RESIZE_REQUEST:
-				{
-					struct yutani_msg_window_resize * wr = (void *)m->data;
-					yutani_server_window_t * w = hashmap_get(yg->wids_to_windows, (void *)wr->wid);
-					if (w) {
-						yutani_msg_buildx_window_resize_alloc(response);
-						yutani_msg_buildx_window_resize(response,YUTANI_MSG_RESIZE_OFFER, w->wid, wr->width, wr->height, 0, w->tiled);
-						pex_send(server, p->source, response->size, (char *)response);
+					break;
+				case YUTANI_MSG_WINDOW_MOVE:
+					{
+						struct yutani_msg_window_move * wm = (void *)m->data;
+						//TRACE("%08x wanted to move window %d to %d, %d", p->source, wm->wid, (int)wm->x, (int)wm->y);
+						if (wm->x > (int)yg->width + 100 || wm->x < -(int)yg->width || wm->y > (int)yg->height + 100 || wm->y < -(int)yg->height) {
+							TRACE("Refusing to move window to these coordinates.");
+							break;
+						}
+						yutani_server_window_t * win = intmap_get(yg->wids_to_windows, wm->wid);
+						if (win) {
+							window_move(yg, win, wm->x, wm->y);
+						} else {
+							TRACE("%08x wanted to move window %d, but I can't find it?", p->source, wm->wid);
+						}
 					}
-				}
-				break;
-			case YUTANI_MSG_RESIZE_OFFER:
-				{
-					struct yutani_msg_window_resize * wr = (void *)m->data;
-					yutani_server_window_t * w = hashmap_get(yg->wids_to_windows, (void *)wr->wid);
-					if (w) {
-						yutani_msg_buildx_window_resize_alloc(response);
-						yutani_msg_buildx_window_resize(response,YUTANI_MSG_RESIZE_OFFER, w->wid, wr->width, wr->height, 0, w->tiled);
-						pex_send(server, p->source, response->size, (char *)response);
+					break;
+				case YUTANI_MSG_WINDOW_CLOSE:
+					{
+						struct yutani_msg_window_close * wc = (void *)m->data;
+						yutani_server_window_t * w = intmap_get(yg->wids_to_windows, wc->wid);
+						if (w) {
+							window_mark_for_close(yg, w);
+							window_remove_from_client(yg, w);
+						}
 					}
-				}
-				break;
-			case YUTANI_MSG_RESIZE_ACCEPT:
-				{
-					struct yutani_msg_window_resize * wr = (void *)m->data;
-					yutani_server_window_t * w = hashmap_get(yg->wids_to_windows, (void *)wr->wid);
-					if (w) {
-						uint32_t newbufid = server_window_resize(yg, w, wr->width, wr->height);
-						yutani_msg_buildx_window_resize_alloc(response);
-						yutani_msg_buildx_window_resize(response,YUTANI_MSG_RESIZE_BUFID, w->wid, wr->width, wr->height, newbufid, 0);
-						pex_send(server, p->source, response->size, (char *)response);
+					break;
+				case YUTANI_MSG_WINDOW_STACK:
+					{
+						struct yutani_msg_window_stack * ws = (void *)m->data;
+						yutani_server_window_t * w = intmap_get(yg->wids_to_windows, ws->wid);
+						if (w) {
+							reorder_window(yg, w, ws->z);
+						}
 					}
-				}
-				break;
-			case YUTANI_MSG_RESIZE_DONE:
-				{
-					struct yutani_msg_window_resize * wr = (void *)m->data;
-					yutani_server_window_t * w = hashmap_get(yg->wids_to_windows, (void *)wr->wid);
-					if (w) {
-						server_window_resize_finish(yg, w, wr->width, wr->height);
+					break;
+				case YUTANI_MSG_RESIZE_REQUEST:
+					{
+						struct yutani_msg_window_resize * wr = (void *)m->data;
+						yutani_server_window_t * w = intmap_get(yg->wids_to_windows, wr->wid);
+						if (w) {
+							yutani_msg_buildx_window_resize_alloc(response);
+							yutani_msg_buildx_window_resize(response,YUTANI_MSG_RESIZE_OFFER, w->wid, wr->width, wr->height, 0, w->tiled, 0, 0);
+							server_send(yg, p->source, response);
+						}
 					}
-				}
-				break;
-			case YUTANI_MSG_QUERY_WINDOWS:
-				{
-					yutani_query_result(yg, p->source, yg->bottom_z);
-					foreach (node, yg->mid_zs) {
-						yutani_query_result(yg, p->source, node->value);
+					break;
+				case YUTANI_MSG_RESIZE_OFFER:
+					{
+						struct yutani_msg_window_resize * wr = (void *)m->data;
+						yutani_server_window_t * w = intmap_get(yg->wids_to_windows, wr->wid);
+						if (w) {
+							yutani_msg_buildx_window_resize_alloc(response);
+							yutani_msg_buildx_window_resize(response,YUTANI_MSG_RESIZE_OFFER, w->wid, wr->width, wr->height, 0, w->tiled, 0, 0);
+							server_send(yg, p->source, response);
+						}
 					}
-					yutani_query_result(yg, p->source, yg->top_z);
-					yutani_msg_buildx_window_advertise_alloc(response, 0);
-					yutani_msg_buildx_window_advertise(response,0, 0, NULL, 0, NULL);
-					pex_send(server, p->source, response->size, (char *)response);
-				}
-				break;
-			case YUTANI_MSG_SUBSCRIBE:
-				{
-					foreach(node, yg->window_subscribers) {
-						if ((uint32_t)node->value == p->source) {
-							break;
+					break;
+				case YUTANI_MSG_RESIZE_ACCEPT:
+					{
+						struct yutani_msg_window_resize * wr = (void *)m->data;
+						yutani_server_window_t * w = intmap_get(yg->wids_to_windows, wr->wid);
+						if (w) {
+							uint32_t newbufid = server_window_resize(yg, w, wr->width, wr->height);
+							yutani_msg_buildx_window_resize_alloc(response);
+							yutani_msg_buildx_window_resize(response,YUTANI_MSG_RESIZE_BUFID, w->wid, wr->width, wr->height, newbufid, 0, w->newatlas, w->newatlas_offset);
+							server_send(yg, p->source, response);
 						}
 					}
-					list_insert(yg->window_subscribers, (void*)p->source);
-				}
-				break;
-			case YUTANI_MSG_UNSUBSCRIBE:
-				{
-					node_t * node = list_find(yg->window_subscribers, (void*)p->source);
-					if (node) {
-						list_delete(yg->window_subscribers, node);
+					break;
+				case YUTANI_MSG_RESIZE_DONE:
+					{
+						struct yutani_msg_window_resize * wr = (void *)m->data;
+						yutani_server_window_t * w = intmap_get(yg->wids_to_windows, wr->wid);
+						if (w) {
+							server_window_resize_finish(yg, w, wr->width, wr->height);
+						}
 					}
-				}
-				break;
-			case YUTANI_MSG_WINDOW_ADVERTISE:
-				{
-					struct yutani_msg_window_advertise * wa = (void *)m->data;
-					yutani_server_window_t * w = hashmap_get(yg->wids_to_windows, (void *)wa->wid);
-					if (w) {
-						if (w->client_strings) free(w->client_strings);
-
-						for (int i = 0; i < 5; ++i) {
-							w->client_offsets[i] = wa->offsets[i];
+					break;
+				case YUTANI_MSG_QUERY_WINDOWS:
+					{
+						yutani_query_result(yg, p->source, yg->bottom_z);
+						foreach (node, yg->mid_zs) {
+							yutani_query_result(yg, p->source, node->value);
 						}
+						yutani_query_result(yg, p->source, yg->top_z);
+						yutani_msg_buildx_window_advertise_alloc(response, 0);
+						yutani_msg_buildx_window_advertise(response,0, 0, NULL, 0, NULL);
+						server_send(yg, p->source, response);
+					}
+					break;
+				case YUTANI_MSG_SUBSCRIBE:
+					{
+						foreach(node, yg->window_subscribers) {
+							if ((uint32_t)node->value == p->source) {
+								break;
+							}
+						}
+						list_insert(yg->window_subscribers, (void*)p->source);
+					}
+					break;
+				case YUTANI_MSG_UNSUBSCRIBE:
+					{
+						node_t * node = list_find(yg->window_subscribers, (void*)p->source);
+						if (node) {
+							list_delete(yg->window_subscribers, node);
+						}
+					}
+					break;
+				case YUTANI_MSG_WINDOW_ADVERTISE:
+					{
+						struct yutani_msg_window_advertise * wa = (void *)m->data;
+						yutani_server_window_t * w = intmap_get(yg->wids_to_windows, wa->wid);
+						if (w) {
+							if (w->client_strings) free(w->client_strings);
 
-						w->client_flags   = wa->flags;
-						w->client_length  = wa->size;
-						w->client_strings = malloc(wa->size);
-						memcpy(w->client_strings, wa->strings, wa->size);
+							for (int i = 0; i < 5; ++i) {
+								w->client_offsets[i] = wa->offsets[i];
+							}
 
-						notify_subscribers(yg);
+							w->client_flags   = wa->flags;
+							w->client_length  = wa->size;
+							w->client_strings = malloc(wa->size);
+							memcpy(w->client_strings, wa->strings, wa->size);
+
+							notify_subscribers(yg);
+						}
 					}
-				}
-				break;
-			case YUTANI_MSG_SESSION_END:
-				{
-					yutani_msg_buildx_session_end_alloc(response);
-					yutani_msg_buildx_session_end(response);
-					pex_broadcast(server, response->size, (char *)response);
-				}
-				break;
-			case YUTANI_MSG_WINDOW_FOCUS:
-				{
-					struct yutani_msg_window_focus * wa = (void *)m->data;
-					yutani_server_window_t * w = hashmap_get(yg->wids_to_windows, (void *)wa->wid);
-					if (w) {
-						set_focused_window(yg, w);
+					break;
+				case YUTANI_MSG_SESSION_END:
+					{
+						yutani_msg_buildx_session_end_alloc(response);
+						yutani_msg_buildx_session_end(response);
+						pex_broadcast(server, response->size, (char *)response);
 					}
-				}
-				break;
-			case YUTANI_MSG_KEY_BIND:
-				{
-					struct yutani_msg_key_bind * wa = (void *)m->data;
-					add_key_bind(yg, wa, p->source);
-				}
-				break;
-			case YUTANI_MSG_WINDOW_DRAG_START:
-				{
-					struct yutani_msg_window_drag_start * wa = (void *)m->data;
-					yutani_server_window_t * w = hashmap_get(yg->wids_to_windows, (void *)wa->wid);
-					if (w) {
-						/* Start dragging */
-						mouse_start_drag(yg, w);
+					break;
+				case YUTANI_MSG_WINDOW_FOCUS:
+					{
+						struct yutani_msg_window_focus * wa = (void *)m->data;
+						yutani_server_window_t * w = intmap_get(yg->wids_to_windows, wa->wid);
+						if (w) {
+							set_focused_window(yg, w);
+						}
 					}
-				}
-				break;
-			case YUTANI_MSG_WINDOW_UPDATE_SHAPE:
-				{
-					struct yutani_msg_window_update_shape * wa = (void *)m->data;
-					yutani_server_window_t * w = hashmap_get(yg->wids_to_windows, (void *)wa->wid);
-					if (w) {
-						/* Set shape parameter */
-						server_window_update_shape(yg, w, wa->set_shape);
+					break;
+				case YUTANI_MSG_KEY_BIND:
+					{
+						struct yutani_msg_key_bind * wa = (void *)m->data;
+						add_key_bind(yg, wa, p->source);
 					}
-				}
-				break;
-			case YUTANI_MSG_WINDOW_WARP_MOUSE:
-				{
-					struct yutani_msg_window_warp_mouse * wa = (void *)m->data;
-					yutani_server_window_t * w = hashmap_get(yg->wids_to_windows, (void *)wa->wid);
-					if (w) {
-						if (yg->focused_window == w) {
-							int32_t x, y;
-							yutani_window_to_device(w, wa->x, wa->y, &x, &y);
-
-							struct yutani_msg_mouse_event me;
-							me.event.x_difference = x;
-							me.event.y_difference = y;
-							me.event.buttons = yg->last_mouse_buttons;
-							me.type = YUTANI_MOUSE_EVENT_TYPE_ABSOLUTE;
-							me.wid = wa->wid;
-
-							handle_mouse_event(yg, &me);
+					break;
+				case YUTANI_MSG_WINDOW_DRAG_START:
+					{
+						struct yutani_msg_window_drag_start * wa = (void *)m->data;
+						yutani_server_window_t * w = intmap_get(yg->wids_to_windows, wa->wid);
+						if (w) {
+							/* Start dragging */
+							mouse_start_drag(yg, w);
 						}
 					}
-				}
-				break;
-			case YUTANI_MSG_WINDOW_SHOW_MOUSE:
-				{
-					struct yutani_msg_window_show_mouse * wa = (void *)m->data;
-					yutani_server_window_t * w = hashmap_get(yg->wids_to_windows, (void *)wa->wid);
-					if (w) {
-						if (wa->show_mouse == -1) {
-							w->show_mouse = w->default_mouse;
-						} else if (wa->show_mouse < 2) {
-							w->default_mouse = wa->show_mouse;
-							w->show_mouse = wa->show_mouse;
-						} else {
-							w->show_mouse = wa->show_mouse;
-						}
-						if (yg->focused_window == w) {
-							mark_screen(yg, yg->mouse_x / MOUSE_SCALE - MOUSE_OFFSET_X, yg->mouse_y / MOUSE_SCALE - MOUSE_OFFSET_Y, MOUSE_WIDTH, MOUSE_HEIGHT);
+					break;
+				case YUTANI_MSG_WINDOW_UPDATE_SHAPE:
+					{
+						struct yutani_msg_window_update_shape * wa = (void *)m->data;
+						yutani_server_window_t * w = intmap_get(yg->wids_to_windows, wa->wid);
+						if (w) {
+							/* Set shape parameter */
+							server_window_update_shape(yg, w, wa->set_shape);
 						}
 					}
-				}
-				break;
-			case YUTANI_MSG_WINDOW_RESIZE_START:
-				{
-					struct yutani_msg_window_resize_start * wa = (void *)m->data;
-					yutani_server_window_t * w = hashmap_get(yg->wids_to_windows, (void *)wa->wid);
-					if (w) {
-						if (yg->focused_window == w && !yg->resizing_window) {
-							yg->resizing_window = w;
-							yg->resizing_button = YUTANI_MOUSE_BUTTON_LEFT; /* XXX Uh, what if we used something else */
-							mouse_start_resize(yg, wa->direction);
+					break;
+				case YUTANI_MSG_WINDOW_WARP_MOUSE:
+					{
+						struct yutani_msg_window_warp_mouse * wa = (void *)m->data;
+						yutani_server_window_t * w = intmap_get(yg->wids_to_windows, wa->wid);
+						if (w) {
+							if (yg->focused_window == w) {
+								int32_t x, y;
+								yutani_window_to_device(w, wa->x, wa->y, &x, &y);
+
+								struct yutani_msg_mouse_event me;
+								me.event.x_difference = x;
+								me.event.y_difference = y;
+								me.event.buttons = yg->last_mouse_buttons;
+								me.type = YUTANI_MOUSE_EVENT_TYPE_ABSOLUTE;
+								me.wid = wa->wid;
+
+								handle_mouse_event(yg, &me);
+							}
 						}
 					}
-				}
-				break;
-			case YUTANI_MSG_SPECIAL_REQUEST:
-				{
-					struct yutani_msg_special_request * sr = (void *)m->data;
-					yutani_server_window_t * w = hashmap_get(yg->wids_to_windows, (void *)sr->wid);
-					switch (sr->request) {
-						case YUTANI_SPECIAL_REQUEST_MAXIMIZE:
-							if (w) {
-								if (w->tiled) {
-									window_untile(yg,w);
-									window_move(yg,w,w->untiled_left,w->untiled_top);
-								} else {
-									window_tile(yg, w, 1, 1, 0, 0);
-								}
-							}
-							break;
-						case YUTANI_SPECIAL_REQUEST_PLEASE_CLOSE:
-							if (w) {
-								yutani_msg_buildx_window_close_alloc(response);
-								yutani_msg_buildx_window_close(response, w->wid);
-								pex_send(yg->server, w->owner, response->size, (char *)response);
+					break;
+				case YUTANI_MSG_WINDOW_SHOW_MOUSE:
+					{
+						struct yutani_msg_window_show_mouse * wa = (void *)m->data;
+						yutani_server_window_t * w = intmap_get(yg->wids_to_windows, wa->wid);
+						if (w) {
+							if (wa->show_mouse == -1) {
+								w->show_mouse = w->default_mouse;
+							} else if (wa->show_mouse < 2) {
+								w->default_mouse = wa->show_mouse;
+								w->show_mouse = wa->show_mouse;
+							} else {
+								w->show_mouse = wa->show_mouse;
 							}
-							break;
-						case YUTANI_SPECIAL_REQUEST_CLIPBOARD:
-							{
-								yutani_msg_buildx_clipboard_alloc(response, yg->clipboard_size);
-								yutani_msg_buildx_clipboard(response, yg->clipboard);
-								pex_send(server, p->source, response->size, (char *)response);
+							if (yg->focused_window == w) {
+								mark_screen(yg, yg->mouse_x / MOUSE_SCALE - MOUSE_OFFSET_X, yg->mouse_y / MOUSE_SCALE - MOUSE_OFFSET_Y, MOUSE_WIDTH, MOUSE_HEIGHT);
 							}
-							break;
-						case YUTANI_SPECIAL_REQUEST_RELOAD:
-							{
-								yg->reload_renderer = 1;
+						}
+					}
+					break;
+				case YUTANI_MSG_WINDOW_RESIZE_START:
+					{
+						struct yutani_msg_window_resize_start * wa = (void *)m->data;
+						yutani_server_window_t * w = intmap_get(yg->wids_to_windows, wa->wid);
+						if (w) {
+							if (yg->focused_window == w && !yg->resizing_window) {
+								yg->resizing_window = w;
+								yg->resizing_button = YUTANI_MOUSE_BUTTON_LEFT; /* XXX Uh, what if we used something else */
+								mouse_start_resize(yg, wa->direction);
 							}
-							break;
-						default:
-							TRACE("Unknown special request type: 0x%x", sr->request);
-							break;
+						}
 					}
+					break;
+				case YUTANI_MSG_SPECIAL_REQUEST:
+					{
+						struct yutani_msg_special_request * sr = (void *)m->data;
+						yutani_server_window_t * w = intmap_get(yg->wids_to_windows, sr->wid);
+						switch (sr->request) {
+							case YUTANI_SPECIAL_REQUEST_MAXIMIZE:
+								if (w) {
+									if (w->tiled) {
+										window_untile(yg,w);
+										window_move(yg,w,w->untiled_left,w->untiled_top);
+									} else {
+										window_tile(yg, w, 1, 1, 0, 0);
+									}
+								}
+								break;
+							case YUTANI_SPECIAL_REQUEST_PLEASE_CLOSE:
+								if (w) {
+									yutani_msg_buildx_window_close_alloc(response);
+									yutani_msg_buildx_window_close(response, w->wid);
+									server_send(yg, w->owner, response);
+								}
+								break;
+							case YUTANI_SPECIAL_REQUEST_CLIPBOARD:
+								{
+									yutani_msg_buildx_clipboard_alloc(response, yg->clipboard_size);
+									yutani_msg_buildx_clipboard(response, yg->clipboard);
+									server_send(yg, p->source, response);
+								}
+								break;
+							case YUTANI_SPECIAL_REQUEST_RELOAD:
+								{
+									yg->reload_renderer = 1;
+								}
+								break;
+							case YUTANI_SPECIAL_REQUEST_FRAMES_ON:
+								if (w) {
+									w->frame_notify = 1;
+								}
+								break;
+							case YUTANI_SPECIAL_REQUEST_FRAMES_OFF:
+								if (w) {
+									w->frame_notify = 0;
+									w->frame_pending = 0;
+								}
+								break;
+							case YUTANI_SPECIAL_REQUEST_FRAME_STATS:
+								{
+									yutani_msg_buildx_frame_stats_alloc(response);
+									yutani_msg_buildx_frame_stats(response, YUTANI_FRAME_INTERVAL, yg->frames_painted, yg->frames_missed, yg->last_paint_msec, yg->total_paint_msec);
+									server_send(yg, p->source, response);
+								}
+								break;
+							case YUTANI_SPECIAL_REQUEST_LATENCY_STATS:
+								{
+									yutani_msg_buildx_latency_stats_alloc(response);
+									yutani_msg_buildx_latency_stats(response, yg->input_events, yg->latency_queue_hist, yg->latency_present_hist);
+									server_send(yg, p->source, response);
+								}
+								break;
+							default:
+								TRACE("Unknown special request type: 0x%x", sr->request);
+								break;
+						}
 
-				}
-				break;
-			case YUTANI_MSG_CLIPBOARD:
-				{
-					struct yutani_msg_clipboard * cb = (void *)m->data;
-					yg->clipboard_size = min(cb->size, 511);
-					memcpy(yg->clipboard, cb->content, yg->clipboard_size);
-					yg->clipboard[yg->clipboard_size] = '\0';
-					TRACE("Copied text to clipbard (size=%d)", yg->clipboard_size);
-				}
-				break;
-			default:
-				{
-					TRACE("Unknown type: 0x%8x", m->type);
-				}
-				break;
+					}
+					break;
+				case YUTANI_MSG_CLIPBOARD:
+					{
+						struct yutani_msg_clipboard * cb = (void *)m->data;
+						yg->clipboard_size = min(cb->size, 511);
+						memcpy(yg->clipboard, cb->content, yg->clipboard_size);
+						yg->clipboard[yg->clipboard_size] = '\0';
+						TRACE("Copied text to clipbard (size=%d)", yg->clipboard_size);
+					}
+					break;
+				default:
+					{
+						TRACE("Unknown type: 0x%8x", m->type);
+					}
+					break;
+			}
+			free(m);
 		}
 		free(p);
 	}
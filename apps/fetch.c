@@ -14,11 +14,16 @@
 #include <sys/time.h>
 #include <termios.h>
 #include <unistd.h>
+#include <fcntl.h>
+
+#include <sys/stat.h>
+#include <sys/fswait.h>
 
 #include <toaru/hashmap.h>
 
 #define SIZE 512
 #define BOUNDARY "------ToaruOSFetchUploadBoundary"
+#define MAX_SEGMENTS 8
 
 struct http_req {
 	char domain[SIZE];
@@ -27,7 +32,6 @@ struct http_req {
 
 struct {
 	int show_headers;
-	const char * output_file;
 	const char * cookie;
 	FILE * out;
 	int prompt_password;
@@ -40,8 +44,39 @@ struct {
 	int calculate_output;
 	int slow_upload;
 	int machine_readable;
+	int segments;
+	int resume;
+	size_t resume_from;
+	int keepalive_ok;
 } fetch_options = {0};
 
+/*
+ * A reusable connection to an HTTP server. Requests are sent with
+ * Connection: keep-alive; as long as the server agrees and the next
+ * URL is on the same host we skip the connection setup entirely,
+ * which is the dominant cost for small files on high-latency links.
+ */
+struct connection {
+	FILE * f;
+	char domain[SIZE];
+};
+
+static FILE * connection_for(struct connection * c, const char * domain) {
+	if (c->f && fetch_options.keepalive_ok && !strcmp(c->domain, domain)) {
+		return c->f;
+	}
+	if (c->f) {
+		fclose(c->f);
+	}
+	char file[SIZE+10];
+	sprintf(file, "/dev/net/%s", domain);
+	c->f = fopen(file, "r+");
+	if (c->f) {
+		strcpy(c->domain, domain);
+	}
+	return c->f;
+}
+
 void parse_url(char * d, struct http_req * r) {
 	if (strstr(d, "http://") == d) {
 
@@ -105,7 +140,7 @@ int usage(char * argv[]) {
 	fprintf(stderr,
 			"fetch - download files over HTTP\n"
 			"\n"
-			"usage: %s [-hOvmp?] [-c cookie] [-o file] [-u file] [-s speed] URL\n"
+			"usage: %s [-hOvmpr?] [-c cookie] [-o file] [-u file] [-s speed] [-n count] URL...\n"
 			"\n"
 			" -h     \033[3mshow headers\033[0m\n"
 			" -O     \033[3msave the file based on the filename in the URL\033[0m\n"
@@ -116,6 +151,8 @@ int usage(char * argv[]) {
 			" -o ... \033[3msave to the specified file\033[0m\n"
 			" -u ... \033[3mupload the specified file\033[0m\n"
 			" -s ... \033[3mspecify the speed for uploading slowly\033[0m\n"
+			" -n ... \033[3mdownload with this many parallel range segments\033[0m\n"
+			" -r     \033[3mresume a partial download\033[0m\n"
 			" -?     \033[3mshow this help text\033[0m\n"
 			"\n", argv[0]);
 	return 1;
@@ -161,8 +198,12 @@ void bad_response(void) {
 	exit(1);
 }
 
-int http_fetch(FILE * f) {
-	hashmap_t * headers = hashmap_create(10);
+/*
+ * Read a status line and headers from a response.
+ * Returns the status code; headers land in the provided hashmap.
+ */
+int read_response(FILE * f, hashmap_t * headers) {
+	int code;
 
 	/* Parse response */
 	{
@@ -182,10 +223,7 @@ int http_fetch(FILE * f) {
 		*elements[2] = '\0';
 		elements[2]++;
 
-		if (strcmp(elements[1], "200")) {
-			fprintf(stderr, "Bad response code: %s\n", elements[1]);
-			return 1;
-		}
+		code = atoi(elements[1]);
 	}
 
 	/* Parse headers */
@@ -217,6 +255,28 @@ int http_fetch(FILE * f) {
 		free(hash_keys);
 	}
 
+	/* Did the server agree to keep the connection open? */
+	char * connection = hashmap_get(headers, "Connection");
+	fetch_options.keepalive_ok = (connection && !strncmp(connection, "keep-alive", 10));
+
+	return code;
+}
+
+int http_fetch(FILE * f) {
+	hashmap_t * headers = hashmap_create(10);
+
+	int code = read_response(f, headers);
+	if (code == 416 && fetch_options.resume_from) {
+		/* The range starts at the end of the file: nothing left to do */
+		fetch_options.content_length = fetch_options.resume_from;
+		fetch_options.size = fetch_options.resume_from;
+		return 0;
+	}
+	if (code != 200 && code != 206) {
+		fprintf(stderr, "Bad response code: %d\n", code);
+		return 1;
+	}
+
 	/* determine how many bytes we should read now */
 	if (!hashmap_has(headers, "Content-Length")) {
 		fprintf(stderr, "Don't know how much to read.\n");
@@ -224,7 +284,15 @@ int http_fetch(FILE * f) {
 	}
 
 	int bytes_to_read = atoi(hashmap_get(headers, "Content-Length"));
-	fetch_options.content_length = bytes_to_read;
+	fetch_options.content_length = fetch_options.resume_from + bytes_to_read;
+	fetch_options.size = fetch_options.resume_from;
+
+	if (fetch_options.resume_from && code != 206) {
+		/* Server ignored the range; we are getting the whole file */
+		fetch_options.content_length = bytes_to_read;
+		fetch_options.size = 0;
+		rewind(fetch_options.out);
+	}
 
 	gettimeofday(&fetch_options.start, NULL);
 
@@ -244,11 +312,179 @@ int http_fetch(FILE * f) {
 	return 0;
 }
 
+struct segment {
+	FILE * f;
+	size_t offset;     /* Next write position in the output file */
+	size_t remaining;  /* Bytes left in this segment */
+};
+
+/*
+ * Download a file over several connections, each asking for its own
+ * byte range, writing into the right offsets of the output file as
+ * data arrives on whichever connection is ready.
+ */
+int segmented_fetch(struct http_req * r, const char * output_path, int segments) {
+	char file[SIZE+10];
+	sprintf(file, "/dev/net/%s", r->domain);
+
+	/* Probe for range support and the total size with a one-byte request */
+	FILE * probe = fopen(file, "r+");
+	if (!probe) {
+		fprintf(stderr, "Nope.\n");
+		return 1;
+	}
+	fprintf(probe,
+		"GET /%s HTTP/1.0\r\n"
+		"User-Agent: curl/7.35.0\r\n"
+		"Host: %s\r\n"
+		"Accept: */*\r\n"
+		"Range: bytes=0-0\r\n"
+		"\r\n", r->path, r->domain);
+
+	hashmap_t * headers = hashmap_create(10);
+	int code = read_response(probe, headers);
+
+	if (code != 206 || !hashmap_has(headers, "Content-Range")) {
+		/* No range support; the response is the whole file, stream it */
+		if (code != 200) {
+			fprintf(stderr, "Bad response code: %d\n", code);
+			fclose(probe);
+			return 1;
+		}
+		if (!hashmap_has(headers, "Content-Length")) {
+			fprintf(stderr, "Don't know how much to read.\n");
+			fclose(probe);
+			return 1;
+		}
+		size_t bytes_to_read = atoi(hashmap_get(headers, "Content-Length"));
+		fetch_options.content_length = bytes_to_read;
+		gettimeofday(&fetch_options.start, NULL);
+		while (bytes_to_read > 0) {
+			char buf[1024];
+			size_t r = fread(buf, 1, bytes_to_read < 1024 ? bytes_to_read : 1024, probe);
+			fwrite(buf, 1, r, fetch_options.out);
+			fetch_options.size += r;
+			print_progress(0);
+			bytes_to_read -= r;
+		}
+		print_progress(1);
+		fclose(probe);
+		return 0;
+	}
+
+	/* "Content-Range: bytes 0-0/12345" */
+	char * total_s = strchr(hashmap_get(headers, "Content-Range"), '/');
+	if (!total_s) bad_response();
+	size_t total = atoi(total_s + 1);
+
+	/* Drain the probe byte and drop the connection */
+	fgetc(probe);
+	fclose(probe);
+
+	if (!total) {
+		return 0;
+	}
+
+	if ((size_t)segments > total) segments = 1;
+
+	fetch_options.content_length = total;
+	gettimeofday(&fetch_options.start, NULL);
+
+	int out_fd = open(output_path, O_WRONLY | O_CREAT, 0644);
+	if (out_fd < 0) {
+		fprintf(stderr, "fetch: %s: could not open for writing\n", output_path);
+		return 1;
+	}
+
+	/* Carve the file into ranges and open a connection for each */
+	struct segment segs[MAX_SEGMENTS];
+	size_t chunk = total / segments;
+	for (int i = 0; i < segments; ++i) {
+		size_t lo = i * chunk;
+		size_t hi = (i == segments - 1) ? total - 1 : (lo + chunk - 1);
+
+		segs[i].f = fopen(file, "r+");
+		if (!segs[i].f) {
+			fprintf(stderr, "Nope.\n");
+			return 1;
+		}
+		/* Unbuffered: the body is read with read() below so we can poll */
+		setvbuf(segs[i].f, NULL, _IONBF, 0);
+		segs[i].offset = lo;
+		segs[i].remaining = hi - lo + 1;
+
+		fprintf(segs[i].f,
+			"GET /%s HTTP/1.0\r\n"
+			"User-Agent: curl/7.35.0\r\n"
+			"Host: %s\r\n"
+			"Accept: */*\r\n"
+			"Range: bytes=%lu-%lu\r\n"
+			"\r\n", r->path, r->domain, (unsigned long)lo, (unsigned long)hi);
+	}
+
+	/* Headers come back per connection; bodies stream in parallel after */
+	for (int i = 0; i < segments; ++i) {
+		hashmap_t * seg_headers = hashmap_create(10);
+		int seg_code = read_response(segs[i].f, seg_headers);
+		if (seg_code != 206) {
+			fprintf(stderr, "Bad response code: %d\n", seg_code);
+			return 1;
+		}
+	}
+
+	/* Write each connection's data as it becomes available */
+	int still_going = segments;
+	while (still_going) {
+		int fds[MAX_SEGMENTS];
+		int map[MAX_SEGMENTS];
+		int count = 0;
+		for (int i = 0; i < segments; ++i) {
+			if (!segs[i].remaining) continue;
+			fds[count] = fileno(segs[i].f);
+			map[count] = i;
+			count++;
+		}
+
+		int index = fswait2(count, fds, 200);
+		if (index < 0 || index >= count) continue;
+
+		struct segment * s = &segs[map[index]];
+		char buf[4096];
+		size_t want = s->remaining < 4096 ? s->remaining : 4096;
+		ssize_t r = read(fds[index], buf, want);
+		if (r <= 0) {
+			fprintf(stderr, "fetch: connection dropped mid-segment\n");
+			return 1;
+		}
+
+		lseek(out_fd, s->offset, SEEK_SET);
+		write(out_fd, buf, r);
+		s->offset += r;
+		s->remaining -= r;
+		if (!s->remaining) {
+			fclose(s->f);
+			still_going--;
+		}
+
+		fetch_options.size += r;
+		print_progress(0);
+		if (fetch_options.machine_readable) {
+			fprintf(stdout,"%d %d\n",(int)fetch_options.size, (int)fetch_options.content_length);
+		}
+	}
+	print_progress(1);
+
+	close(out_fd);
+	return 0;
+}
+
 int main(int argc, char * argv[]) {
 
 	int opt;
+	const char * output_files[64];
+	int output_count = 0;
 
-	while ((opt = getopt(argc, argv, "?c:hmo:Opu:vs:")) != -1) {
+	while ((opt = getopt(argc, argv, "?c:hmn:o:Opru:vs:")) != -1) {
 		switch (opt) {
 			case '?':
 				return usage(argv);
@@ -261,8 +497,18 @@ int main(int argc, char * argv[]) {
 			case 'h':
 				fetch_options.show_headers = 1;
 				break;
+			case 'n':
+				fetch_options.segments = atoi(optarg);
+				if (fetch_options.segments < 1) fetch_options.segments = 1;
+				if (fetch_options.segments > MAX_SEGMENTS) fetch_options.segments = MAX_SEGMENTS;
+				break;
 			case 'o':
-				fetch_options.output_file = optarg;
+				if (output_count < 64) {
+					output_files[output_count++] = optarg;
+				}
+				break;
+			case 'r':
+				fetch_options.resume = 1;
 				break;
 			case 'u':
 				fetch_options.upload_file = optarg;
@@ -286,39 +532,31 @@ int main(int argc, char * argv[]) {
 		return usage(argv);
 	}
 
-	struct http_req my_req;
-	parse_url(argv[optind], &my_req);
-
-	char file[100];
-	sprintf(file, "/dev/net/%s", my_req.domain);
-
-	if (fetch_options.calculate_output) {
-		char * tmp = strdup(my_req.path);
-		char * x = strrchr(tmp,'/');
-		if (x) {
-			tmp = x + 1;
-		}
-		fetch_options.output_file = tmp;
-	}
-
-	fetch_options.out = stdout;
-	if (fetch_options.output_file) {
-		fetch_options.out = fopen(fetch_options.output_file, "w+");
-	}
-
-	FILE * f = fopen(file,"r+");
-
-	if (!f) {
-		fprintf(stderr, "Nope.\n");
-		return 1;
-	}
-
 	if (fetch_options.prompt_password) {
 		fetch_options.password = malloc(100);
 		collect_password(fetch_options.password);
 	}
 
 	if (fetch_options.upload_file) {
+		/* Uploads keep the old single-URL flow */
+		struct http_req my_req;
+		parse_url(argv[optind], &my_req);
+
+		char file[100];
+		sprintf(file, "/dev/net/%s", my_req.domain);
+
+		fetch_options.out = stdout;
+		if (output_count) {
+			fetch_options.out = fopen(output_files[0], "w+");
+		}
+
+		FILE * f = fopen(file,"r+");
+
+		if (!f) {
+			fprintf(stderr, "Nope.\n");
+			return 1;
+		}
+
 		FILE * in_file = fopen(fetch_options.upload_file, "r");
 
 		srand(time(NULL));
@@ -378,35 +616,118 @@ int main(int argc, char * argv[]) {
 		fprintf(f,"\r\n--" BOUNDARY "%08x--\r\n", boundary_fuzz);
 		fflush(f);
 
-	} else if (fetch_options.cookie) {
-		fprintf(f,
-			"GET /%s HTTP/1.0\r\n"
-			"User-Agent: curl/7.35.0\r\n"
-			"Host: %s\r\n"
-			"Accept: */*\r\n"
-			"Cookie: %s\r\n"
-			"\r\n", my_req.path, my_req.domain, fetch_options.cookie);
+		http_fetch(f);
+
+		fflush(fetch_options.out);
+
+		if (fetch_options.show_progress) {
+			fprintf(stderr,"\n");
+		}
+
+		if (fetch_options.machine_readable) {
+			fprintf(stdout,"done\n");
+		}
+
+		return 0;
+	}
+
+	/* Downloads reuse one connection across URLs on the same host */
+	struct connection conn = {0};
+	int ret = 0;
+	int url_index = 0;
+
+	for (int i = optind; i < argc; ++i, ++url_index) {
+		struct http_req my_req;
+		parse_url(argv[i], &my_req);
+
+		/* Figure out where this document goes */
+		const char * output_file = NULL;
+		if (url_index < output_count) {
+			output_file = output_files[url_index];
+		} else if (fetch_options.calculate_output) {
+			char * tmp = strdup(my_req.path);
+			char * x = strrchr(tmp,'/');
+			if (x) {
+				tmp = x + 1;
+			}
+			output_file = tmp;
+		}
+
+		fetch_options.out = stdout;
+		fetch_options.size = 0;
+		fetch_options.content_length = 0;
+		fetch_options.resume_from = 0;
+
+		if (fetch_options.segments > 1 && output_file) {
+			ret |= segmented_fetch(&my_req, output_file, fetch_options.segments);
+			if (fetch_options.show_progress) {
+				fprintf(stderr,"\n");
+			}
+			if (fetch_options.machine_readable) {
+				fprintf(stdout,"done\n");
+			}
+			continue;
+		}
+
+		if (output_file) {
+			if (fetch_options.resume) {
+				struct stat st;
+				if (!stat(output_file, &st) && st.st_size > 0) {
+					fetch_options.resume_from = st.st_size;
+				}
+			}
+			fetch_options.out = fopen(output_file, fetch_options.resume_from ? "r+" : "w+");
+			if (!fetch_options.out) {
+				fprintf(stderr, "fetch: %s: could not open for writing\n", output_file);
+				return 1;
+			}
+			if (fetch_options.resume_from) {
+				fseek(fetch_options.out, 0, SEEK_END);
+			}
+		}
+
+		FILE * f = connection_for(&conn, my_req.domain);
+		if (!f) {
+			fprintf(stderr, "Nope.\n");
+			return 1;
+		}
 
-	} else {
 		fprintf(f,
 			"GET /%s HTTP/1.0\r\n"
 			"User-Agent: curl/7.35.0\r\n"
 			"Host: %s\r\n"
 			"Accept: */*\r\n"
-			"\r\n", my_req.path, my_req.domain);
-	}
+			"Connection: keep-alive\r\n", my_req.path, my_req.domain);
+		if (fetch_options.cookie) {
+			fprintf(f, "Cookie: %s\r\n", fetch_options.cookie);
+		}
+		if (fetch_options.resume_from) {
+			fprintf(f, "Range: bytes=%lu-\r\n", (unsigned long)fetch_options.resume_from);
+		}
+		fprintf(f, "\r\n");
+		fflush(f);
 
-	http_fetch(f);
+		if (http_fetch(f)) {
+			/* The body may not have been drained; the connection is dead to us */
+			fetch_options.keepalive_ok = 0;
+			ret = 1;
+		}
 
-	fflush(fetch_options.out);
+		if (fetch_options.out != stdout) {
+			fflush(fetch_options.out);
+			fclose(fetch_options.out);
+		} else {
+			fflush(fetch_options.out);
+		}
 
-	if (fetch_options.show_progress) {
-		fprintf(stderr,"\n");
-	}
+		if (fetch_options.show_progress) {
+			fprintf(stderr,"\n");
+		}
 
-	if (fetch_options.machine_readable) {
-		fprintf(stdout,"done\n");
+		if (fetch_options.machine_readable) {
+			fprintf(stdout,"done\n");
+		}
 	}
 
-	return 0;
+	return ret;
 }
@@ -30,6 +30,7 @@
 #include <toaru/menu.h>
 #include <toaru/icon_cache.h>
 #include <toaru/list.h>
+#include <toaru/hashmap.h>
 #include <toaru/sdf.h>
 #include <toaru/button.h>
 
@@ -47,6 +48,8 @@ struct File {
 	uint64_t size;       /* File size */
 	int type;            /* File type: 0 = normal, 1 = directory, 2 = launcher */
 	int selected;        /* Selection status */
+	ino_t inode;         /* Inode for cache validation */
+	time_t mtime;        /* Modification time for cache validation */
 };
 
 static yutani_t * yctx;
@@ -73,6 +76,10 @@ static char * current_directory = NULL; /* Current directory path */
 static int hilighted_offset = -1; /* Which file is hovered by the mouse */
 static struct File ** file_pointers = NULL; /* List of file pointers */
 static ssize_t file_pointers_len = 0; /* How many files are in the current list */
+static ssize_t file_pointers_avail = 0; /* How much space the file pointer list has */
+static DIR * scan_dirp = NULL; /* Directory currently being scanned incrementally, if any */
+static char * scan_path = NULL; /* Path the scan in progress was started for */
+static hashmap_t * file_info_cache = NULL; /* Examined files, keyed by path, validated by (inode, mtime) */
 static uint64_t last_click = 0; /* For double click */
 static int last_click_offset = -1; /* So that clicking two different things quickly doesn't count as a double click */
 
@@ -445,6 +452,263 @@ static void update_status(void) {
 	}
 }
 
+/* Launchers before directories before files, each sorted by name */
+static int compare_files(const void * c1, const void * c2) {
+	const struct File * f1 = *(const struct File **)(c1);
+	const struct File * f2 = *(const struct File **)(c2);
+	if (f1->type > f2->type) return -1;
+	if (f2->type > f1->type) return 1;
+	/* Launchers sorted by filename, not by display name */
+	if (f1->type == 2 && f2->type == 2) {
+		return strcmp(f1->filename, f2->filename);
+	}
+	/* Files sorted by name */
+	return strcmp(f1->name, f2->name);
+}
+
+/**
+ * Examine a directory entry: stat it, classify it, pick its icon and
+ * launcher. Results are cached keyed on the full path and validated
+ * against the file's inode and mtime, so refreshes and revisits skip
+ * the expensive parts (launcher files get opened and parsed!) for
+ * anything that hasn't changed.
+ */
+static struct File * examine_file(const char * path, const char * name) {
+	/* Calculate absolute path to file */
+	char tmp[strlen(path)+strlen(name)+2];
+	sprintf(tmp, "%s/%s", path, name);
+
+	struct stat statbuf;
+	struct stat statbufl;
+	lstat(tmp, &statbuf);
+
+	if (!file_info_cache) {
+		file_info_cache = hashmap_create(256);
+	}
+
+	/* If we already looked at this file and it hasn't changed, reuse that. */
+	struct File * cached = hashmap_get(file_info_cache, tmp);
+	if (cached && cached->inode == statbuf.st_ino && cached->mtime == statbuf.st_mtime) {
+		struct File * f = malloc(sizeof(struct File));
+		memcpy(f, cached, sizeof(struct File));
+		f->selected = 0;
+		return f;
+	}
+
+	/* Validate against the link itself, not what it points to */
+	ino_t inode = statbuf.st_ino;
+	time_t mtime = statbuf.st_mtime;
+
+	/* Set display name from file name */
+	struct File * f = malloc(sizeof(struct File));
+	sprintf(f->name, "%s", name); /* snprintf? copy min()? */
+
+	f->size = statbuf.st_size;
+
+	/* Read link target for symlinks */
+	if (S_ISLNK(statbuf.st_mode)) {
+		memcpy(&statbufl, &statbuf, sizeof(struct stat));
+		stat(tmp, &statbuf);
+		readlink(tmp, f->link, 256);
+	} else {
+		f->link[0] = '\0';
+	}
+
+	f->launcher[0] = '\0';
+	f->filetype[0] = '\0';
+	f->selected = 0;
+
+	if (S_ISDIR(statbuf.st_mode)) {
+		/* Directory */
+		sprintf(f->icon, "folder");
+		sprintf(f->filetype, "Directory");
+		f->type = 1;
+	} else {
+		/* Regular file */
+
+		/* Default regular files to open in bim */
+		sprintf(f->launcher, "exec terminal bim");
+
+		if (is_desktop_background && has_extension(f, ".launcher")) {
+			/* In desktop mode, read launchers specially */
+			FILE * file = fopen(tmp,"r");
+			char tbuf[1024];
+			while (!feof(file)) {
+				fgets(tbuf, 1024, file);
+				char * nl = strchr(tbuf,'\n');
+				if (nl) *nl = '\0';
+				char * eq = strchr(tbuf,'=');
+				if (!eq) continue;
+				*eq = '\0'; eq++;
+
+				if (!strcmp(tbuf, "icon")) {
+					sprintf(f->icon, "%s", eq);
+				} else if (!strcmp(tbuf, "run")) {
+					sprintf(f->launcher, "%s #", eq);
+				} else if (!strcmp(tbuf, "title")) {
+					sprintf(f->name, eq);
+				}
+			}
+			sprintf(f->filetype, "Launcher");
+			sprintf(f->filename, "%s", name);
+			f->type = 2;
+		} else {
+			/* Handle various file types */
+			if (has_extension(f, ".c")) {
+				sprintf(f->icon, "c");
+				sprintf(f->filetype, "C Source");
+			} else if (has_extension(f, ".h")) {
+				sprintf(f->icon, "h");
+				sprintf(f->filetype, "C Header");
+			} else if (has_extension(f, ".bmp")) {
+				sprintf(f->icon, "image");
+				sprintf(f->launcher, "exec imgviewer");
+				sprintf(f->filetype, "Bitmap Image");
+			} else if (has_extension(f, ".tga")) {
+				sprintf(f->icon, "image");
+				sprintf(f->launcher, "exec imgviewer");
+				sprintf(f->filetype, "Targa Image");
+			} else if (has_extension(f, ".jpg") || has_extension(f,".jpeg")) {
+				sprintf(f->icon, "image");
+				sprintf(f->launcher, "exec imgviewer");
+				sprintf(f->filetype, "JPEG Image");
+			} else if (has_extension(f, ".png")) {
+				sprintf(f->icon, "image");
+				sprintf(f->launcher, "exec imgviewer");
+				sprintf(f->filetype, "Portable Network Graphics Image");
+			} else if (has_extension(f, ".sdf")) {
+				sprintf(f->icon, "font");
+				sprintf(f->filetype, "SDF Font");
+				/* TODO: Font viewer for SDF and TrueType */
+			} else if (has_extension(f, ".ttf")) {
+				sprintf(f->icon, "font");
+				sprintf(f->filetype, "TrueType Font");
+			} else if (has_extension(f, ".tgz") || has_extension(f, ".tar.gz")) {
+				sprintf(f->icon, "package");
+				sprintf(f->filetype, "Compressed Archive File");
+			} else if (has_extension(f, ".tar")) {
+				sprintf(f->icon, "package");
+				sprintf(f->filetype, "Archive File");
+			} else if (has_extension(f, ".sh")) {
+				sprintf(f->icon, "sh");
+				if (statbuf.st_mode & 0111) {
+					/* Make executable */
+					sprintf(f->launcher, "SELF");
+					sprintf(f->filetype, "Executable Shell Script");
+				} else {
+					sprintf(f->filetype, "Shell Script");
+				}
+			} else if (has_extension(f, ".py")) {
+				sprintf(f->icon, "py");
+				if (statbuf.st_mode & 0111) {
+					/* Make executable */
+					sprintf(f->launcher, "SELF");
+					sprintf(f->filetype, "Executable Python Script");
+				} else {
+					sprintf(f->filetype, "Python Script");
+				}
+			} else if (has_extension(f, ".ko")) {
+				sprintf(f->icon, "file");
+				sprintf(f->filetype, "Kernel Module");
+			} else if (has_extension(f, ".o")) {
+				sprintf(f->icon, "file");
+				sprintf(f->filetype, "Object File");
+			} else if (has_extension(f, ".so")) {
+				sprintf(f->icon, "file");
+				sprintf(f->filetype, "Shared Object File");
+			} else if (has_extension(f, ".S")) {
+				sprintf(f->icon, "file");
+				sprintf(f->filetype, "Assembly Source");
+			} else if (has_extension(f, ".ld")) {
+				sprintf(f->icon, "file");
+				sprintf(f->filetype, "Linker Script");
+			} else if (statbuf.st_mode & 0111) {
+				/* Executable files - use their name for their icon, and launch themselves. */
+				sprintf(f->icon, "%s", f->name);
+				sprintf(f->launcher, "SELF");
+				sprintf(f->filetype, "Executable");
+			} else {
+				sprintf(f->icon, "file");
+				sprintf(f->filetype, "File");
+			}
+			f->type = 0;
+		}
+	}
+
+	f->inode = inode;
+	f->mtime = mtime;
+	f->selected = 0;
+
+	/* Remember what we figured out for next time */
+	struct File * copy = malloc(sizeof(struct File));
+	memcpy(copy, f, sizeof(struct File));
+	void * old = hashmap_set(file_info_cache, tmp, copy);
+	if (old) free(old);
+
+	return f;
+}
+
+/**
+ * Insert a file into the icon view, keeping the array sorted, so a
+ * directory that is still being scanned shows up in order as it loads.
+ */
+static void insert_file_sorted(struct File * f) {
+	if (file_pointers_len == file_pointers_avail) {
+		file_pointers_avail = file_pointers_avail ? file_pointers_avail * 2 : 64;
+		file_pointers = realloc(file_pointers, sizeof(struct File *) * file_pointers_avail);
+	}
+	ssize_t lo = 0, hi = file_pointers_len;
+	while (lo < hi) {
+		ssize_t mid = (lo + hi) / 2;
+		if (compare_files(&file_pointers[mid], &f) <= 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	if (lo < file_pointers_len) {
+		memmove(&file_pointers[lo+1], &file_pointers[lo], sizeof(struct File *) * (file_pointers_len - lo));
+	}
+	file_pointers[lo] = f;
+	file_pointers_len++;
+}
+
+/**
+ * Pull a batch of entries from the directory being scanned into the
+ * icon view. Returns the number of entries consumed; when the
+ * directory is exhausted, the scan state is torn down. The main loop
+ * calls this between events so big directories stream in without
+ * freezing the UI.
+ */
+static int scan_directory_step(int max) {
+	if (!scan_dirp) return 0;
+	int processed = 0;
+	while (processed < max) {
+		struct dirent * ent = readdir(scan_dirp);
+		if (!ent) {
+			closedir(scan_dirp);
+			scan_dirp = NULL;
+			free(scan_path);
+			scan_path = NULL;
+			break;
+		}
+		/* Count skipped entries too, so a pile of dotfiles can't stall us */
+		processed++;
+		if (ent->d_name[0] == '.' &&
+			(ent->d_name[1] == '\0' ||
+			 (ent->d_name[1] == '.' &&
+			  ent->d_name[2] == '\0'))) {
+			/* skip . and .. */
+			continue;
+		}
+		if (show_hidden || (ent->d_name[0] != '.')) {
+			insert_file_sorted(examine_file(scan_path, ent->d_name));
+		}
+	}
+	if (processed) update_status();
+	return processed;
+}
+
 /**
  * Read the contents of a directory into the icon view.
  */
@@ -475,6 +739,9 @@ static void load_directory(const char * path, int modifies_history) {
 			free(file_pointers[i]);
 		}
 		free(file_pointers);
+		file_pointers = NULL;
+		file_pointers_len = 0;
+		file_pointers_avail = 0;
 	}
 
 	if (modifies_history) {
@@ -536,201 +803,19 @@ static void load_directory(const char * path, int modifies_history) {
 	int this_year = timeinfo->tm_year;
 #endif
 
-	list_t * file_list = list_create();
-
-	struct dirent * ent = readdir(dirp);
-	while (ent != NULL) {
-		if (ent->d_name[0] == '.' &&
-			(ent->d_name[1] == '\0' || 
-			 (ent->d_name[1] == '.' &&
-			  ent->d_name[2] == '\0'))) {
-			/* skip . and .. */
-			ent = readdir(dirp);
-			continue;
-		}
-		if (show_hidden || (ent->d_name[0] != '.')) {
-
-			/* Set display name from file name */
-			struct File * f = malloc(sizeof(struct File));
-			sprintf(f->name, "%s", ent->d_name); /* snprintf? copy min()? */
-
-			struct stat statbuf;
-			struct stat statbufl;
-
-			/* Calculate absolute path to file */
-			char tmp[strlen(path)+strlen(ent->d_name)+2];
-			sprintf(tmp, "%s/%s", path, ent->d_name);
-			lstat(tmp, &statbuf);
-
-			f->size = statbuf.st_size;
-
-			/* Read link target for symlinks */
-			if (S_ISLNK(statbuf.st_mode)) {
-				memcpy(&statbufl, &statbuf, sizeof(struct stat));
-				stat(tmp, &statbuf);
-				readlink(tmp, f->link, 256);
-			} else {
-				f->link[0] = '\0';
-			}
-
-			f->launcher[0] = '\0';
-			f->filetype[0] = '\0';
-			f->selected = 0;
-
-			if (S_ISDIR(statbuf.st_mode)) {
-				/* Directory */
-				sprintf(f->icon, "folder");
-				sprintf(f->filetype, "Directory");
-				f->type = 1;
-			} else {
-				/* Regular file */
-
-				/* Default regular files to open in bim */
-				sprintf(f->launcher, "exec terminal bim");
-
-				if (is_desktop_background && has_extension(f, ".launcher")) {
-					/* In desktop mode, read launchers specially */
-					FILE * file = fopen(tmp,"r");
-					char tbuf[1024];
-					while (!feof(file)) {
-						fgets(tbuf, 1024, file);
-						char * nl = strchr(tbuf,'\n');
-						if (nl) *nl = '\0';
-						char * eq = strchr(tbuf,'=');
-						if (!eq) continue;
-						*eq = '\0'; eq++;
-
-						if (!strcmp(tbuf, "icon")) {
-							sprintf(f->icon, "%s", eq);
-						} else if (!strcmp(tbuf, "run")) {
-							sprintf(f->launcher, "%s #", eq);
-						} else if (!strcmp(tbuf, "title")) {
-							sprintf(f->name, eq);
-						}
-					}
-					sprintf(f->filetype, "Launcher");
-					sprintf(f->filename, "%s", ent->d_name);
-					f->type = 2;
-				} else {
-					/* Handle various file types */
-					if (has_extension(f, ".c")) {
-						sprintf(f->icon, "c");
-						sprintf(f->filetype, "C Source");
-					} else if (has_extension(f, ".h")) {
-						sprintf(f->icon, "h");
-						sprintf(f->filetype, "C Header");
-					} else if (has_extension(f, ".bmp")) {
-						sprintf(f->icon, "image");
-						sprintf(f->launcher, "exec imgviewer");
-						sprintf(f->filetype, "Bitmap Image");
-					} else if (has_extension(f, ".tga")) {
-						sprintf(f->icon, "image");
-						sprintf(f->launcher, "exec imgviewer");
-						sprintf(f->filetype, "Targa Image");
-					} else if (has_extension(f, ".jpg") || has_extension(f,".jpeg")) {
-						sprintf(f->icon, "image");
-						sprintf(f->launcher, "exec imgviewer");
-						sprintf(f->filetype, "JPEG Image");
-					} else if (has_extension(f, ".png")) {
-						sprintf(f->icon, "image");
-						sprintf(f->launcher, "exec imgviewer");
-						sprintf(f->filetype, "Portable Network Graphics Image");
-					} else if (has_extension(f, ".sdf")) {
-						sprintf(f->icon, "font");
-						sprintf(f->filetype, "SDF Font");
-						/* TODO: Font viewer for SDF and TrueType */
-					} else if (has_extension(f, ".ttf")) {
-						sprintf(f->icon, "font");
-						sprintf(f->filetype, "TrueType Font");
-					} else if (has_extension(f, ".tgz") || has_extension(f, ".tar.gz")) {
-						sprintf(f->icon, "package");
-						sprintf(f->filetype, "Compressed Archive File");
-					} else if (has_extension(f, ".tar")) {
-						sprintf(f->icon, "package");
-						sprintf(f->filetype, "Archive File");
-					} else if (has_extension(f, ".sh")) {
-						sprintf(f->icon, "sh");
-						if (statbuf.st_mode & 0111) {
-							/* Make executable */
-							sprintf(f->launcher, "SELF");
-							sprintf(f->filetype, "Executable Shell Script");
-						} else {
-							sprintf(f->filetype, "Shell Script");
-						}
-					} else if (has_extension(f, ".py")) {
-						sprintf(f->icon, "py");
-						if (statbuf.st_mode & 0111) {
-							/* Make executable */
-							sprintf(f->launcher, "SELF");
-							sprintf(f->filetype, "Executable Python Script");
-						} else {
-							sprintf(f->filetype, "Python Script");
-						}
-					} else if (has_extension(f, ".ko")) {
-						sprintf(f->icon, "file");
-						sprintf(f->filetype, "Kernel Module");
-					} else if (has_extension(f, ".o")) {
-						sprintf(f->icon, "file");
-						sprintf(f->filetype, "Object File");
-					} else if (has_extension(f, ".so")) {
-						sprintf(f->icon, "file");
-						sprintf(f->filetype, "Shared Object File");
-					} else if (has_extension(f, ".S")) {
-						sprintf(f->icon, "file");
-						sprintf(f->filetype, "Assembly Source");
-					} else if (has_extension(f, ".ld")) {
-						sprintf(f->icon, "file");
-						sprintf(f->filetype, "Linker Script");
-					} else if (statbuf.st_mode & 0111) {
-						/* Executable files - use their name for their icon, and launch themselves. */
-						sprintf(f->icon, "%s", f->name);
-						sprintf(f->launcher, "SELF");
-						sprintf(f->filetype, "Executable");
-					} else {
-						sprintf(f->icon, "file");
-						sprintf(f->filetype, "File");
-					}
-					f->type = 0;
-				}
-			}
-
-			list_insert(file_list, f);
-		}
-		ent = readdir(dirp);
-	}
-	closedir(dirp);
-
-	/* Store the entries in a flat array. */
-	file_pointers = malloc(sizeof(struct File *) * file_list->length);
-	file_pointers_len = file_list->length;
-	int i = 0;
-	foreach (node, file_list) {
-		file_pointers[i] = node->value;
-		i++;
+	/* Kick off (or restart) the incremental scan of this directory */
+	if (scan_dirp) {
+		closedir(scan_dirp);
+		free(scan_path);
 	}
+	scan_dirp = dirp;
+	scan_path = strdup(current_directory);
 
+	/* Do a first batch up front so small directories still load in one go;
+	 * anything left streams in from the main loop. */
+	scan_directory_step(64);
 	update_status();
 
-	/* Free our temporary linked list */
-	list_free(file_list);
-	free(file_list);
-
-	/* Sort files */
-	int comparator(const void * c1, const void * c2) {
-		const struct File * f1 = *(const struct File **)(c1);
-		const struct File * f2 = *(const struct File **)(c2);
-		/* Launchers before directories before files */
-		if (f1->type > f2->type) return -1;
-		if (f2->type > f1->type) return 1;
-		/* Launchers sorted by filename, not by display name */
-		if (f1->type == 2 && f2->type == 2) {
-			return strcmp(f1->filename, f2->filename);
-		}
-		/* Files sorted by name */
-		return strcmp(f1->name, f2->name);
-	}
-	qsort(file_pointers, file_pointers_len, sizeof(struct File *), comparator);
-
 	/* Reset scroll offset when navigating */
 	scroll_offset = 0;
 }
@@ -1796,7 +1881,7 @@ int main(int argc, char * argv[]) {
 	while (application_running) {
 		waitpid(-1, NULL, WNOHANG);
 		int fds[1] = {fileno(yctx->sock)};
-		int index = fswait2(1,fds,wallpaper_old ? 10 : 200);
+		int index = fswait2(1,fds,(wallpaper_old || scan_dirp) ? 10 : 200);
 
 		if (restart) {
 			execvp(argv[0],argv);
@@ -1804,6 +1889,11 @@ int main(int argc, char * argv[]) {
 		}
 
 		if (index == 1) {
+			/* Stream in more of the directory being scanned, if any */
+			if (scan_dirp && scan_directory_step(128)) {
+				reinitialize_contents();
+				redraw_window();
+			}
 			if (wallpaper_old) {
 				redraw_window();
 			}
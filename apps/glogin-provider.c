@@ -10,6 +10,7 @@
  */
 #include <stdlib.h>
 #include <assert.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <math.h>
 #include <string.h>
@@ -61,6 +62,54 @@ static char * LOGO = "/usr/share/logo_login.png";
 #define TEXTBOX_INTERIOR_LEFT 4
 #define EXTRA_TEXT_OFFSET 15
 
+/*
+ * Files the first session is going to fault in the moment the user
+ * logs in: the session binaries, the dynamic loader, and the shared
+ * libraries it reads for each of them. Pulling these through the VFS
+ * read cache while the user is still typing their password makes the
+ * login-to-desktop transition run mostly out of warm cache.
+ */
+static char * prewarm_paths[] = {
+	"/lib/ld.so",
+	"/bin/session",
+	"/bin/file-browser",
+	"/bin/panel",
+	"/bin/terminal",
+	"/lib/libtoaru_graphics.so",
+	"/lib/libtoaru_yutani.so",
+	"/lib/libtoaru_pex.so",
+	"/lib/libtoaru_hashmap.so",
+	"/lib/libtoaru_list.so",
+	"/lib/libtoaru_intmap.so",
+	"/lib/libtoaru_kbd.so",
+	"/lib/libtoaru_sdf.so",
+	"/lib/libtoaru_menu.so",
+	"/lib/libtoaru_icon_cache.so",
+	"/lib/libtoaru_confreader.so",
+	"/lib/libtoaru_decorations.so",
+	"/lib/libtoaru_decor-fancy.so",
+	"/lib/libtoaru_termemu.so",
+	"/lib/libtoaru_button.so",
+	"/lib/libtoaru_png.so",
+	"/lib/libtoaru_inflate.so",
+	NULL,
+};
+
+static pid_t prewarm_pid = 0;
+
+static void prewarm_session(void) {
+	prewarm_pid = fork();
+	if (prewarm_pid) return;
+
+	for (char ** path = prewarm_paths; *path; path++) {
+		int fd = open(*path, O_RDONLY);
+		if (fd < 0) continue;
+		posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+		close(fd);
+	}
+	exit(0);
+}
+
 int center_x(int x) {
 	return (win_width - x) / 2;
 }
@@ -230,7 +279,7 @@ int main (int argc, char ** argv) {
 
 	/* Load config */
 	{
-		confreader_t * conf = confreader_load("/etc/glogin.conf");
+		confreader_t * conf = confreader_get_shared("/etc/glogin.conf");
 
 		if (conf) {
 
@@ -251,13 +300,14 @@ int main (int argc, char ** argv) {
 
 			WALLPAPER = confreader_getd(conf, "image", "wallpaper", WALLPAPER);
 			LOGO = confreader_getd(conf, "image", "logo", LOGO);
-
-			confreader_free(conf);
 		}
 
 		TRACE("Loading complete");
 	}
 
+	/* Warm the session's working set in the background while we idle. */
+	prewarm_session();
+
 	TRACE("Loading logo...");
 	load_sprite(&logo, LOGO);
 	TRACE("... done.");
@@ -584,6 +634,9 @@ collect_events:
 	}
 
 _success:
+	/* Long since finished; this just collects the zombie. */
+	if (prewarm_pid > 0) waitpid(prewarm_pid, NULL, 0);
+
 	yutani_close(y, wina);
 
 
@@ -11,6 +11,12 @@
  * that ends up supporting - which at the time of writing is
  * just bitmaps of various types.
  *
+ * The decoded image is carved into 256px tiles backed by a
+ * 1/2, 1/4, 1/8 downscale pyramid, so pan and zoom only touch
+ * the tiles that are actually on screen. Tiles are built on
+ * demand, filled in by a background pass while the event loop
+ * is idle, and prefetched one row or column ahead in the
+ * direction of a pan.
  */
 
 #include <stdio.h>
@@ -25,6 +31,7 @@
 #include <toaru/graphics.h>
 #include <toaru/decorations.h>
 #include <toaru/menu.h>
+#include <toaru/kbd.h>
 
 /* Pointer to graphics memory */
 static yutani_t * yctx;
@@ -47,6 +54,32 @@ sprite_t img = {0};
 
 #define APPLICATION_TITLE "Image Viewer"
 
+#define TILE_SIZE 256
+#define PYRAMID_LEVELS 4
+
+struct tile_level {
+	int scale;     /* image pixels per level pixel: 1, 2, 4, 8 */
+	int width;     /* image dimensions at this level */
+	int height;
+	int tiles_x;
+	int tiles_y;
+	sprite_t ** tiles; /* NULL until built */
+};
+
+static struct tile_level pyramid[PYRAMID_LEVELS];
+static int tiles_total = 0;
+static int tiles_built = 0;
+
+static double zoom = 1.0;
+static int view_x = 0;  /* viewport offset into the zoomed image */
+static int view_y = 0;
+static int pan_dx = 0;  /* sign of the last pan, steers prefetch */
+static int pan_dy = 0;
+
+#define PREFETCH_MAX 16
+static int prefetch_queue[PREFETCH_MAX][3];
+static int prefetch_count = 0;
+
 void usage(char * argv[]) {
 	printf(
 			"Image Viewer - Shows images.\n"
@@ -57,23 +90,229 @@ void usage(char * argv[]) {
 			argv[0]);
 }
 
+static void pyramid_init(void) {
+	for (int l = 0; l < PYRAMID_LEVELS; ++l) {
+		struct tile_level * lvl = &pyramid[l];
+		lvl->scale = 1 << l;
+		lvl->width = ((int)img.width + lvl->scale - 1) / lvl->scale;
+		lvl->height = ((int)img.height + lvl->scale - 1) / lvl->scale;
+		lvl->tiles_x = (lvl->width + TILE_SIZE - 1) / TILE_SIZE;
+		lvl->tiles_y = (lvl->height + TILE_SIZE - 1) / TILE_SIZE;
+		lvl->tiles = calloc(lvl->tiles_x * lvl->tiles_y, sizeof(sprite_t *));
+		tiles_total += lvl->tiles_x * lvl->tiles_y;
+	}
+}
+
+/*
+ * Build one tile. Level 0 is a straight copy out of the decoded
+ * image; deeper levels box-average 2^l x 2^l blocks, which doubles
+ * as the filter that keeps zoomed-out views from shimmering.
+ */
+static sprite_t * tile_build(int l, int tx, int ty) {
+	struct tile_level * lvl = &pyramid[l];
+	int tw = lvl->width - tx * TILE_SIZE;
+	int th = lvl->height - ty * TILE_SIZE;
+	if (tw > TILE_SIZE) tw = TILE_SIZE;
+	if (th > TILE_SIZE) th = TILE_SIZE;
+
+	sprite_t * tile = create_sprite(tw, th, img.alpha);
+
+	if (l == 0) {
+		for (int y = 0; y < th; ++y) {
+			memcpy(&tile->bitmap[y * tw],
+			       &img.bitmap[(ty * TILE_SIZE + y) * img.width + tx * TILE_SIZE],
+			       tw * sizeof(uint32_t));
+		}
+	} else {
+		int sc = lvl->scale;
+		for (int y = 0; y < th; ++y) {
+			int sy0 = (ty * TILE_SIZE + y) * sc;
+			int sy1 = sy0 + sc;
+			if (sy1 > (int)img.height) sy1 = img.height;
+			for (int x = 0; x < tw; ++x) {
+				int sx0 = (tx * TILE_SIZE + x) * sc;
+				int sx1 = sx0 + sc;
+				if (sx1 > (int)img.width) sx1 = img.width;
+				uint32_t a = 0, r = 0, g = 0, b = 0, n = 0;
+				for (int sy = sy0; sy < sy1; ++sy) {
+					for (int sx = sx0; sx < sx1; ++sx) {
+						uint32_t p = img.bitmap[sy * img.width + sx];
+						a += (p >> 24) & 0xFF;
+						r += (p >> 16) & 0xFF;
+						g += (p >>  8) & 0xFF;
+						b +=  p        & 0xFF;
+						n++;
+					}
+				}
+				tile->bitmap[y * tw + x] = ((a / n) << 24) | ((r / n) << 16) | ((g / n) << 8) | (b / n);
+			}
+		}
+	}
+
+	lvl->tiles[ty * lvl->tiles_x + tx] = tile;
+	tiles_built++;
+	return tile;
+}
+
+static sprite_t * tile_get(int l, int tx, int ty) {
+	struct tile_level * lvl = &pyramid[l];
+	sprite_t * tile = lvl->tiles[ty * lvl->tiles_x + tx];
+	return tile ? tile : tile_build(l, tx, ty);
+}
+
+static void tile_prefetch(int l, int tx, int ty) {
+	struct tile_level * lvl = &pyramid[l];
+	if (tx < 0 || ty < 0 || tx >= lvl->tiles_x || ty >= lvl->tiles_y) return;
+	if (lvl->tiles[ty * lvl->tiles_x + tx]) return;
+	if (prefetch_count >= PREFETCH_MAX) return;
+	prefetch_queue[prefetch_count][0] = l;
+	prefetch_queue[prefetch_count][1] = tx;
+	prefetch_queue[prefetch_count][2] = ty;
+	prefetch_count++;
+}
+
+/*
+ * Build one outstanding tile: prefetch requests first, then the
+ * sequential background fill, coarsest level first so a zoom out
+ * is ready before the full-resolution copies finish. Returns 0
+ * when the whole pyramid is built.
+ */
+static int build_pending(void) {
+	while (prefetch_count) {
+		prefetch_count--;
+		int l = prefetch_queue[prefetch_count][0];
+		int tx = prefetch_queue[prefetch_count][1];
+		int ty = prefetch_queue[prefetch_count][2];
+		if (!pyramid[l].tiles[ty * pyramid[l].tiles_x + tx]) {
+			tile_build(l, tx, ty);
+			return 1;
+		}
+	}
+	if (tiles_built >= tiles_total) return 0;
+	for (int l = PYRAMID_LEVELS - 1; l >= 0; --l) {
+		struct tile_level * lvl = &pyramid[l];
+		for (int i = 0; i < lvl->tiles_x * lvl->tiles_y; ++i) {
+			if (!lvl->tiles[i]) {
+				tile_build(l, i % lvl->tiles_x, i / lvl->tiles_x);
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
+
 static void decors() {
 	render_decorations(window, ctx, APPLICATION_TITLE);
 }
 
-void redraw() {
-	static double r = 0.0;
+/* The offsets actually used for drawing: centered when the zoomed
+ * image fits the viewport, the clamped pan position when it doesn't. */
+static void effective_offsets(int * ox, int * oy) {
+	int disp_w = (int)(img.width * zoom);
+	int disp_h = (int)(img.height * zoom);
+
+	if (disp_w <= width) {
+		*ox = -(width - disp_w) / 2;
+	} else {
+		if (view_x < 0) view_x = 0;
+		if (view_x > disp_w - width) view_x = disp_w - width;
+		*ox = view_x;
+	}
+	if (disp_h <= height) {
+		*oy = -(height - disp_h) / 2;
+	} else {
+		if (view_y < 0) view_y = 0;
+		if (view_y > disp_h - height) view_y = disp_h - height;
+		*oy = view_y;
+	}
+}
 
+void redraw() {
 	for (int y = 0; y < height; ++y) {
 		for (int x = 0; x < width; ++x) {
 			GFX(ctx,x+decor_left_width,y+decor_top_height) = (((y / 10) % 2 == 0) ^ ((x / 10) % 2 == 0)) ? rgb(107,107,107) : rgb(147,147,147);
 		}
 	}
 
-	draw_sprite(ctx, &img, decor_left_width + width/2 - img.width/2, decor_top_height + height/2 - img.height/2);
+	/* Nearest pyramid level that is at least as detailed as the
+	 * current zoom, so tiles are only ever scaled up slightly. */
+	int l = 0;
+	while (l + 1 < PYRAMID_LEVELS && zoom <= 1.0 / (1 << (l + 1))) l++;
+	struct tile_level * lvl = &pyramid[l];
+	double s = zoom * lvl->scale;
+
+	int ox, oy;
+	effective_offsets(&ox, &oy);
+
+	int tx0 = ox > 0 ? (int)(ox / (TILE_SIZE * s)) : 0;
+	int ty0 = oy > 0 ? (int)(oy / (TILE_SIZE * s)) : 0;
+	int tx1 = (int)((ox + width - 1) / (TILE_SIZE * s));
+	int ty1 = (int)((oy + height - 1) / (TILE_SIZE * s));
+	if (tx1 >= lvl->tiles_x) tx1 = lvl->tiles_x - 1;
+	if (ty1 >= lvl->tiles_y) ty1 = lvl->tiles_y - 1;
+
+	for (int ty = ty0; ty <= ty1; ++ty) {
+		for (int tx = tx0; tx <= tx1; ++tx) {
+			sprite_t * tile = tile_get(l, tx, ty);
+			/* Both edges computed the same way, so adjacent tiles
+			 * always abut exactly despite the fractional scale */
+			int x0 = (int)(tx * TILE_SIZE * s) - ox + decor_left_width;
+			int y0 = (int)(ty * TILE_SIZE * s) - oy + decor_top_height;
+			int x1 = (int)((tx * TILE_SIZE + tile->width) * s) - ox + decor_left_width;
+			int y1 = (int)((ty * TILE_SIZE + tile->height) * s) - oy + decor_top_height;
+			if (s == 1.0) {
+				draw_sprite(ctx, tile, x0, y0);
+			} else {
+				draw_sprite_scaled(ctx, tile, x0, y0, x1 - x0, y1 - y0);
+			}
+		}
+	}
+
+	/* Queue the row/column just past the leading edge so the next
+	 * pan step finds its tiles already built. */
+	prefetch_count = 0;
+	if (pan_dx > 0) for (int ty = ty0; ty <= ty1; ++ty) tile_prefetch(l, tx1 + 1, ty);
+	if (pan_dx < 0) for (int ty = ty0; ty <= ty1; ++ty) tile_prefetch(l, tx0 - 1, ty);
+	if (pan_dy > 0) for (int tx = tx0; tx <= tx1; ++tx) tile_prefetch(l, tx, ty1 + 1);
+	if (pan_dy < 0) for (int tx = tx0; tx <= tx1; ++tx) tile_prefetch(l, tx, ty0 - 1);
+
 	decors();
 	flip(ctx);
-	r += 0.02;
+}
+
+static void refresh() {
+	redraw();
+	yutani_flip(yctx, window);
+}
+
+static void pan(int dx, int dy) {
+	view_x += dx;
+	view_y += dy;
+	pan_dx = (dx > 0) - (dx < 0);
+	pan_dy = (dy > 0) - (dy < 0);
+	refresh();
+}
+
+/* Zoom keeping the image point under (mx, my) fixed in place */
+static void set_zoom(double new_zoom, int mx, int my) {
+	if (new_zoom < 0.01) new_zoom = 0.01;
+	if (new_zoom > 8.0) new_zoom = 8.0;
+	if (new_zoom == zoom) return;
+
+	int ox, oy;
+	effective_offsets(&ox, &oy);
+	view_x = (int)((ox + mx) * (new_zoom / zoom)) - mx;
+	view_y = (int)((oy + my) * (new_zoom / zoom)) - my;
+	zoom = new_zoom;
+	pan_dx = 0;
+	pan_dy = 0;
+	refresh();
+}
+
+static double fit_zoom(void) {
+	double zw = (double)width / img.width;
+	double zh = (double)height / img.height;
+	return zw < zh ? zw : zh;
 }
 
 void resize_finish(int w, int h) {
@@ -155,8 +394,19 @@ int main(int argc, char * argv[]) {
 		return 1;
 	}
 
+	pyramid_init();
+
+	/* Window the size of the image, but never larger than fits on
+	 * the display - big photos start zoomed to fit and get panned. */
 	width = img.width;
 	height = img.height;
+	if (width > (int)yctx->display_width - 100) width = yctx->display_width - 100;
+	if (height > (int)yctx->display_height - 100) height = yctx->display_height - 100;
+	if (width < 100) width = 100;
+	if (height < 100) height = 100;
+	if ((int)img.width > width || (int)img.height > height) {
+		zoom = fit_zoom();
+	}
 
 	window = yutani_window_create(yctx, width + decor_width, height + decor_height);
 	yutani_window_move(yctx, window, left, top);
@@ -169,8 +419,18 @@ int main(int argc, char * argv[]) {
 	yutani_flip(yctx, window);
 
 	int playing = 1;
+	int dragging = 0;
+	int last_mx = 0, last_my = 0;
 	while (playing) {
-		yutani_msg_t * m = yutani_poll(yctx);
+		yutani_msg_t * m = yutani_poll_async(yctx);
+		if (!m) {
+			if (build_pending()) {
+				/* Keep filling the pyramid while we're idle; poll
+				 * between tiles so input stays responsive. */
+				continue;
+			}
+			m = yutani_poll(yctx);
+		}
 		while (m) {
 			if (menu_process_event(yctx, m)) {
 				/* just decorations should be fine */
@@ -182,8 +442,37 @@ int main(int argc, char * argv[]) {
 				case YUTANI_MSG_KEY_EVENT:
 					{
 						struct yutani_msg_key_event * ke = (void*)m->data;
-						if (ke->event.action == KEY_ACTION_DOWN && ke->event.keycode == 'q') {
-							playing = 0;
+						if (ke->event.action == KEY_ACTION_DOWN) {
+							switch (ke->event.keycode) {
+								case 'q':
+									playing = 0;
+									break;
+								case '+':
+								case '=':
+									set_zoom(zoom * 1.2, width / 2, height / 2);
+									break;
+								case '-':
+									set_zoom(zoom / 1.2, width / 2, height / 2);
+									break;
+								case '1':
+									set_zoom(1.0, width / 2, height / 2);
+									break;
+								case 'f':
+									set_zoom(fit_zoom(), width / 2, height / 2);
+									break;
+								case KEY_ARROW_LEFT:
+									pan(-64, 0);
+									break;
+								case KEY_ARROW_RIGHT:
+									pan(64, 0);
+									break;
+								case KEY_ARROW_UP:
+									pan(0, -64);
+									break;
+								case KEY_ARROW_DOWN:
+									pan(0, 64);
+									break;
+							}
 						}
 					}
 					break;
@@ -221,6 +510,26 @@ int main(int argc, char * argv[]) {
 								/* Other actions */
 								break;
 						}
+
+						int mx = me->new_x - decor_left_width;
+						int my = me->new_y - decor_top_height;
+						int in_content = (mx >= 0 && my >= 0 && mx < width && my < height);
+
+						if (in_content && (me->buttons & YUTANI_MOUSE_SCROLL_UP)) {
+							set_zoom(zoom * 1.2, mx, my);
+						} else if (in_content && (me->buttons & YUTANI_MOUSE_SCROLL_DOWN)) {
+							set_zoom(zoom / 1.2, mx, my);
+						} else if (in_content && me->command == YUTANI_MOUSE_EVENT_DOWN && (me->buttons & YUTANI_MOUSE_BUTTON_LEFT)) {
+							dragging = 1;
+							last_mx = me->new_x;
+							last_my = me->new_y;
+						} else if (dragging && me->command == YUTANI_MOUSE_EVENT_DRAG) {
+							pan(last_mx - me->new_x, last_my - me->new_y);
+							last_mx = me->new_x;
+							last_my = me->new_y;
+						} else if (me->command == YUTANI_MOUSE_EVENT_RAISE || me->command == YUTANI_MOUSE_EVENT_CLICK) {
+							dragging = 0;
+						}
 					}
 					break;
 				case YUTANI_MSG_WINDOW_CLOSE:
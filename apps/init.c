@@ -22,10 +22,26 @@
  * Startup scripts can be any executable binary. Shell scripts are
  * generally used to allow easy editing, but you could also use
  * a binary (even a dynamically linked one) as a startup script.
- * `init` will wait for each startup script (that is, it will wait for
- * the original process it started to exit) before running the next one.
- * So if you wish to run daemons, be sure to fork them off and then
- * exit so that the rest of the startup process can continue.
+ *
+ * By default, `init` will wait for each startup script (that is, it
+ * will wait for the original process it started to exit) before
+ * running the next one. So if you wish to run daemons, be sure to
+ * fork them off and then exit so that the rest of the startup process
+ * can continue.
+ *
+ * A script may opt in to running concurrently with other scripts by
+ * declaring its dependencies in a comment line near the top of the
+ * file:
+ *
+ *     # needs: 01_migrate.sh 03_tmpfs.sh
+ *
+ * An annotated script starts as soon as everything it names has
+ * finished, even while unrelated scripts are still running. Scripts
+ * without an annotation keep the old behavior and wait for every
+ * script sorted before them, so third-party scripts dropped into
+ * /etc/startup.d continue to work unmodified. Names that don't match
+ * an entry in the directory are ignored, so dependencies on optional
+ * scripts are safe.
  *
  * When the last startup script finishes, `init` will reboot the system.
  */
@@ -41,6 +57,19 @@
 #include <sys/wait.h>
 
 #define INITD_PATH "/etc/startup.d"
+#define MAX_UNITS 64
+
+struct unit {
+	char path[300];
+	char name[256];
+	char deps[256]; /* Space-separated names from a "# needs:" line */
+	int annotated;  /* Had a "# needs:" line (possibly empty) */
+	int pid;        /* Currently-running child, or 0 */
+	int done;
+};
+
+static struct unit units[MAX_UNITS];
+static int unit_count = 0;
 
 /* Initialize fd 0, 1, 2 */
 void set_console(void) {
@@ -88,6 +117,131 @@ int start_options(char * args[]) {
 	return cpid;
 }
 
+/* Fork a startup script without waiting for it */
+static int start_unit(struct unit * unit) {
+	int cpid = syscall_fork();
+
+	if (!cpid) {
+		syscall_execve(unit->path, (char *[]){unit->path, NULL}, environ);
+		syscall_exit(0);
+	}
+
+	return cpid;
+}
+
+/* Scan the head of a script for a "# needs:" annotation */
+static void read_deps(struct unit * unit) {
+	int fd = syscall_open(unit->path, 0, 0);
+	if (fd < 0) return;
+
+	char buf[513];
+	int r = syscall_read(fd, buf, 512);
+	syscall_close(fd);
+	if (r <= 0) return;
+	buf[r] = '\0';
+
+	char * line = buf;
+	while (line && *line) {
+		if (!strncmp(line, "# needs:", 8)) {
+			char * value = line + 8;
+			while (*value == ' ') value++;
+			int i = 0;
+			while (value[i] && value[i] != '\n' && i < (int)sizeof(unit->deps) - 1) {
+				unit->deps[i] = value[i];
+				i++;
+			}
+			unit->deps[i] = '\0';
+			unit->annotated = 1;
+			return;
+		}
+		line = strchr(line, '\n');
+		if (line) line++;
+	}
+}
+
+/* Has the named script finished? Unknown names don't hold anything back. */
+static int unit_named_done(const char * name, int len) {
+	for (int i = 0; i < unit_count; ++i) {
+		if (!strncmp(units[i].name, name, len) && !units[i].name[len]) {
+			return units[i].done;
+		}
+	}
+	return 1;
+}
+
+/* Can this script start yet? */
+static int unit_ready(struct unit * unit) {
+	if (!unit->annotated) {
+		/* Unannotated scripts keep the classic strict ordering */
+		for (struct unit * other = units; other < unit; other++) {
+			if (!other->done) return 0;
+		}
+		return 1;
+	}
+
+	char * d = unit->deps;
+	while (*d) {
+		while (*d == ' ') d++;
+		int len = 0;
+		while (d[len] && d[len] != ' ') len++;
+		if (len && !unit_named_done(d, len)) return 0;
+		d += len;
+	}
+	return 1;
+}
+
+/* Run every startup script, overlapping those whose dependencies allow it */
+static void run_units(void) {
+	int remaining = unit_count;
+
+	while (remaining) {
+		int running = 0;
+
+		/* Start everything whose dependencies have finished */
+		for (int i = 0; i < unit_count; ++i) {
+			struct unit * unit = &units[i];
+			if (unit->done) continue;
+			if (!unit->pid && unit_ready(unit)) {
+				unit->pid = start_unit(unit);
+			}
+			if (unit->pid) running++;
+		}
+
+		if (!running) {
+			/* Nothing is runnable but scripts remain: a dependency
+			 * cycle or self-dependency. Drop the annotations and fall
+			 * back to running the rest in sorted order. */
+			for (int i = 0; i < unit_count; ++i) {
+				units[i].annotated = 0;
+			}
+			continue;
+		}
+
+		/* Reap a child; orphans from daemonized services also land here */
+		int pid = waitpid(-1, NULL, WNOKERN);
+
+		if (pid > 0) {
+			for (int i = 0; i < unit_count; ++i) {
+				if (units[i].pid == pid) {
+					units[i].pid = 0;
+					units[i].done = 1;
+					remaining--;
+					break;
+				}
+			}
+		} else if (pid == -1 && errno == ECHILD) {
+			/* No children at all; whatever was running is gone */
+			for (int i = 0; i < unit_count; ++i) {
+				if (units[i].pid) {
+					units[i].pid = 0;
+					units[i].done = 1;
+					remaining--;
+				}
+			}
+		}
+	}
+}
+
 int main(int argc, char * argv[]) {
 	/* Initialize stdin/out/err */
 	set_console();
@@ -121,14 +275,17 @@ int main(int argc, char * argv[]) {
 		}
 		qsort(entries, count, sizeof(struct dirent), comparator);
 
-		/* Run scripts */
-		for (int i = 0; i < count; ++i) {
+		/* Collect scripts and their dependency annotations */
+		for (int i = 0; i < count && unit_count < MAX_UNITS; ++i) {
 			if (entries[i].d_name[0] != '.') {
-				char path[256];
-				sprintf(path, "/etc/startup.d/%s", entries[i].d_name);
-				start_options((char *[]){path, NULL});
+				struct unit * unit = &units[unit_count++];
+				sprintf(unit->name, "%s", entries[i].d_name);
+				sprintf(unit->path, "/etc/startup.d/%s", entries[i].d_name);
+				read_deps(unit);
 			}
 		}
+
+		run_units();
 	}
 
 	/* Self-explanatory */
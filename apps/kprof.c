@@ -0,0 +1,229 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ * This file is part of ToaruOS and is released under the terms
+ * of the NCSA / University of Illinois License - see LICENSE.md
+ * Copyright (C) 2018 K. Lange
+ *
+ * kprof - Sample the kernel profiler and emit folded stacks
+ *
+ * Enables the sampling profiler in the timer interrupt handler by
+ * writing an interval to /proc/profile, collects the binary samples
+ * it produces for a while, symbolizes them against /proc/ksym, and
+ * prints "process;symbol count" lines suitable for flamegraph.pl.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <toaru/hashmap.h>
+
+#define LINE_LEN 4096
+
+/* Must match struct profile_sample in the kernel. */
+struct sample {
+	uint32_t eip;
+	int32_t  pid;
+};
+
+struct ksym {
+	uintptr_t addr;
+	char * name;
+};
+
+static struct ksym * symbols = NULL;
+static size_t symbol_count = 0;
+
+static int ksym_compare(const void * a, const void * b) {
+	uintptr_t l = ((const struct ksym *)a)->addr;
+	uintptr_t r = ((const struct ksym *)b)->addr;
+	if (l < r) return -1;
+	if (l > r) return 1;
+	return 0;
+}
+
+static int load_symbols(void) {
+	FILE * f = fopen("/proc/ksym", "r");
+	if (!f) {
+		fprintf(stderr, "kprof: /proc/ksym: not available\n");
+		return 1;
+	}
+
+	size_t space = 256;
+	symbols = malloc(space * sizeof(struct ksym));
+
+	char line[LINE_LEN];
+	while (fgets(line, LINE_LEN, f) != NULL) {
+		char * nl = strstr(line, "\n");
+		if (nl) *nl = '\0';
+		char * sp = strstr(line, " ");
+		if (!sp) continue;
+		*sp = '\0';
+
+		if (symbol_count == space) {
+			space *= 2;
+			symbols = realloc(symbols, space * sizeof(struct ksym));
+		}
+		symbols[symbol_count].addr = strtoul(line, NULL, 0);
+		symbols[symbol_count].name = strdup(sp + 1);
+		symbol_count++;
+	}
+	fclose(f);
+
+	qsort(symbols, symbol_count, sizeof(struct ksym), ksym_compare);
+	return 0;
+}
+
+/* Largest symbol at or below eip, or NULL if it's not a kernel address. */
+static const char * symbolize(uintptr_t eip) {
+	if (!symbol_count || eip < symbols[0].addr) return NULL;
+
+	size_t lo = 0, hi = symbol_count;
+	while (hi - lo > 1) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (symbols[mid].addr <= eip) {
+			lo = mid;
+		} else {
+			hi = mid;
+		}
+	}
+	return symbols[lo].name;
+}
+
+static hashmap_t * process_names = NULL;
+
+static const char * process_name(int32_t pid) {
+	if (pid < 0) return "idle";
+
+	char key[20];
+	sprintf(key, "%d", pid);
+
+	char * cached = hashmap_get(process_names, key);
+	if (cached) return cached;
+
+	char * name = "exited";
+	char tmp[256];
+	sprintf(tmp, "/proc/%d/status", pid);
+	FILE * f = fopen(tmp, "r");
+	if (f) {
+		char line[LINE_LEN];
+		while (fgets(line, LINE_LEN, f) != NULL) {
+			char * nl = strstr(line, "\n");
+			if (nl) *nl = '\0';
+			char * tab = strstr(line, "\t");
+			if (!tab) continue;
+			*tab = '\0';
+			if (!strcmp(line, "Name:")) {
+				name = strdup(tab + 1);
+				break;
+			}
+		}
+		fclose(f);
+	}
+
+	hashmap_set(process_names, key, name);
+	return name;
+}
+
+static hashmap_t * counts = NULL;
+
+static void drain(int fd) {
+	struct sample buf[512];
+	ssize_t r;
+	while ((r = read(fd, buf, sizeof(buf))) > 0) {
+		for (ssize_t i = 0; i < (ssize_t)(r / sizeof(struct sample)); ++i) {
+			char key[LINE_LEN];
+			const char * sym = symbolize(buf[i].eip);
+			if (sym) {
+				sprintf(key, "%s;%s", process_name(buf[i].pid), sym);
+			} else {
+				sprintf(key, "%s;[user]", process_name(buf[i].pid));
+			}
+			uintptr_t count = (uintptr_t)hashmap_get(counts, key);
+			hashmap_set(counts, key, (void *)(count + 1));
+		}
+	}
+}
+
+static int set_interval(int interval) {
+	FILE * f = fopen("/proc/profile", "w");
+	if (!f) {
+		fprintf(stderr, "kprof: /proc/profile: not available (are you root?)\n");
+		return 1;
+	}
+	fprintf(f, "%d", interval);
+	fclose(f);
+	return 0;
+}
+
+void show_usage(int argc, char * argv[]) {
+	printf(
+			"kprof - sample kernel execution and emit folded stacks\n"
+			"\n"
+			"usage: %s [-d seconds] [-i interval]\n"
+			"\n"
+			" -d     \033[3mhow long to sample for (default 10)\033[0m\n"
+			" -i     \033[3mtimer ticks between samples (default 10)\033[0m\n"
+			" -?     \033[3mshow this help text\033[0m\n"
+			"\n", argv[0]);
+}
+
+int main(int argc, char * argv[]) {
+	int duration = 10;
+	int interval = 10;
+
+	int c;
+	while ((c = getopt(argc, argv, "d:i:?")) != -1) {
+		switch (c) {
+			case 'd':
+				duration = atoi(optarg);
+				break;
+			case 'i':
+				interval = atoi(optarg);
+				break;
+			case '?':
+				show_usage(argc, argv);
+				return 0;
+		}
+	}
+
+	if (duration < 1 || interval < 1) {
+		show_usage(argc, argv);
+		return 1;
+	}
+
+	if (load_symbols()) return 1;
+
+	counts = hashmap_create(100);
+	process_names = hashmap_create(20);
+
+	int fd = open("/proc/profile", O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "kprof: /proc/profile: not available\n");
+		return 1;
+	}
+
+	/* Throw away anything left over from an earlier run. */
+	char scratch[4096];
+	while (read(fd, scratch, sizeof(scratch)) > 0);
+
+	if (set_interval(interval)) return 1;
+
+	/* Drain regularly so the kernel ring doesn't overflow. */
+	for (int elapsed = 0; elapsed < duration * 2; ++elapsed) {
+		usleep(500000);
+		drain(fd);
+	}
+
+	set_interval(0);
+	drain(fd);
+	close(fd);
+
+	list_t * keys = hashmap_keys(counts);
+	foreach(node, keys) {
+		char * key = node->value;
+		printf("%s %lu\n", key, (unsigned long)(uintptr_t)hashmap_get(counts, key));
+	}
+
+	return 0;
+}
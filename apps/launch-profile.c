@@ -0,0 +1,166 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ * This file is part of ToaruOS and is released under the terms
+ * of the NCSA / University of Illinois License - see LICENSE.md
+ *
+ * launch-profile - Print an application startup waterfall
+ *
+ * Runs a command with LAUNCH_TRACE pointed at a scratch file, waits
+ * for the first flip (or exit, or a timeout), and prints each trace
+ * point with its offset from the exec timestamp the kernel recorded
+ * in /proc/<pid>/status. The trace points come from the dynamic
+ * linker and libtoaru_yutani; see toaru/launchtrace.h.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+
+#define MAX_EVENTS 64
+
+struct event {
+	double msec;
+	char name[64];
+};
+
+static void usage(char * argv[]) {
+	printf(
+			"Print an application startup waterfall.\n"
+			"\n"
+			"usage: %s [-t seconds] command [args...]\n"
+			"\n"
+			" -t --timeout  \033[3mSeconds to wait for the first flip (default 10)\033[0m\n"
+			" -h --help     \033[3mShow this help message.\033[0m\n",
+			argv[0]);
+}
+
+/* Fetch the exec timestamp the kernel recorded for a process. */
+static int read_exec_start(pid_t pid, double * msec) {
+	char tmp[64];
+	sprintf(tmp, "/proc/%d/status", pid);
+	FILE * f = fopen(tmp, "r");
+	if (!f) return 1;
+	char line[256];
+	int found = 1;
+	while (fgets(line, sizeof(line), f)) {
+		int sec, usec;
+		if (sscanf(line, "Start: %d.%d", &sec, &usec) == 2) {
+			*msec = sec * 1000.0 + usec / 1000.0;
+			found = 0;
+			break;
+		}
+	}
+	fclose(f);
+	return found;
+}
+
+/* Collect this pid's events from the trace file, newest run wins. */
+static int read_events(const char * path, pid_t pid, struct event * events) {
+	FILE * f = fopen(path, "r");
+	if (!f) return 0;
+	int count = 0;
+	char line[256];
+	while (fgets(line, sizeof(line), f)) {
+		int epid, sec, usec;
+		char name[64];
+		if (sscanf(line, "%d %d.%d %63s", &epid, &sec, &usec, name) != 4) continue;
+		if (epid != pid) continue;
+		if (count == MAX_EVENTS) break;
+		events[count].msec = sec * 1000.0 + usec / 1000.0;
+		strcpy(events[count].name, name);
+		count++;
+	}
+	fclose(f);
+	return count;
+}
+
+int main(int argc, char * argv[]) {
+
+	static struct option long_opts[] = {
+		{"timeout", required_argument, 0, 't'},
+		{"help",    no_argument,       0, 'h'},
+		{0,0,0,0}
+	};
+
+	int timeout = 10;
+	int index, c;
+	while ((c = getopt_long(argc, argv, "t:h", long_opts, &index)) != -1) {
+		switch (c) {
+			case 't':
+				timeout = atoi(optarg);
+				break;
+			case 'h':
+				usage(argv);
+				return 0;
+			default:
+				break;
+		}
+	}
+
+	if (optind >= argc) {
+		usage(argv);
+		return 1;
+	}
+
+	char tracefile[64];
+	sprintf(tracefile, "/tmp/launch-profile.%d", getpid());
+	unlink(tracefile);
+	setenv("LAUNCH_TRACE", tracefile, 1);
+
+	/* Fallback anchor in case the child exits before we can read its
+	 * exec timestamp out of procfs. */
+	struct timeval before;
+	gettimeofday(&before, NULL);
+
+	pid_t pid = fork();
+	if (!pid) {
+		execvp(argv[optind], &argv[optind]);
+		fprintf(stderr, "%s: %s: could not execute\n", argv[0], argv[optind]);
+		exit(1);
+	}
+
+	/* Wait for the first flip, exit, or the timeout. */
+	struct event events[MAX_EVENTS];
+	int count = 0;
+	int exited = 0;
+	double start = 0.0;
+	int have_start = 0;
+	for (int waited = 0; waited < timeout * 20; ++waited) {
+		if (!have_start && !read_exec_start(pid, &start)) {
+			have_start = 1;
+		}
+		count = read_events(tracefile, pid, events);
+		if (count && !strcmp(events[count-1].name, "yutani:first-flip")) break;
+		int status;
+		if (waitpid(pid, &status, WNOHANG) == pid) {
+			exited = 1;
+			break;
+		}
+		usleep(50000);
+	}
+	count = read_events(tracefile, pid, events);
+
+	if (!have_start) {
+		start = before.tv_sec * 1000.0 + before.tv_usec / 1000.0;
+	}
+
+	if (!count) {
+		fprintf(stderr, "%s: no trace points recorded%s\n", argv[0],
+				exited ? " (did the target start?)" : " (does the target use the dynamic linker?)");
+		unlink(tracefile);
+		return 1;
+	}
+
+	printf("%s: pid %d%s\n", argv[optind], pid, exited ? " (exited)" : "");
+	double previous = start;
+	for (int i = 0; i < count; ++i) {
+		printf("%9.2f ms  +%8.2f ms  %s\n",
+				events[i].msec - start, events[i].msec - previous, events[i].name);
+		previous = events[i].msec;
+	}
+
+	unlink(tracefile);
+	return 0;
+}
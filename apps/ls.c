@@ -223,12 +223,19 @@ static void print_entry_long(int * widths, struct tfile * file) {
 		printf("%*d ", widths[3], (int)file->statbuf.st_size);
 	}
 
-	char time_buf[80];
-	struct tm * timeinfo = localtime((time_t*)&file->statbuf.st_mtime);
-	if (timeinfo->tm_year == this_year) {
-		strftime(time_buf, 80, "%b %d %H:%M", timeinfo);
-	} else {
-		strftime(time_buf, 80, "%b %d  %Y", timeinfo);
+	/* The formats only show minute granularity, and mtimes within one
+	 * listing repeat massively, so reformat only when the minute changes. */
+	static char time_buf[80];
+	static time_t last_minute = -1;
+	time_t mtime = file->statbuf.st_mtime;
+	if (mtime / 60 != last_minute) {
+		struct tm * timeinfo = localtime(&mtime);
+		if (timeinfo->tm_year == this_year) {
+			strftime(time_buf, 80, "%b %d %H:%M", timeinfo);
+		} else {
+			strftime(time_buf, 80, "%b %d  %Y", timeinfo);
+		}
+		last_minute = mtime / 60;
 	}
 	printf("%s ", time_buf);
 
@@ -315,6 +322,10 @@ static int display_dir(char * p) {
 	list_t * ents_list = list_create();
 
 	TRACE("reading entries");
+	/* Short listings to a pipe use neither permissions nor colors, so
+	 * don't pay for a stat on every entry. */
+	int need_stat = long_mode || stdout_is_tty;
+
 	struct dirent * ent = readdir(dirp);
 	while (ent != NULL) {
 		if (show_hidden || (ent->d_name[0] != '.')) {
@@ -322,13 +333,17 @@ static int display_dir(char * p) {
 
 			f->name = strdup(ent->d_name);
 
-			char tmp[strlen(p)+strlen(ent->d_name)+2];
-			sprintf(tmp, "%s/%s", p, ent->d_name);
-			lstat(tmp, &f->statbuf);
-			if (S_ISLNK(f->statbuf.st_mode)) {
-				stat(tmp, &f->statbufl);
-				f->link = malloc(4096);
-				readlink(tmp, f->link, 4096);
+			if (need_stat) {
+				char tmp[strlen(p)+strlen(ent->d_name)+2];
+				sprintf(tmp, "%s/%s", p, ent->d_name);
+				lstat(tmp, &f->statbuf);
+				if (S_ISLNK(f->statbuf.st_mode)) {
+					stat(tmp, &f->statbufl);
+					f->link = malloc(4096);
+					readlink(tmp, f->link, 4096);
+				}
+			} else {
+				memset(&f->statbuf, 0, sizeof(struct stat));
 			}
 
 			list_insert(ents_list, (void *)f);
@@ -21,6 +21,7 @@
 #include <toaru/confreader.h>
 #include <toaru/list.h>
 #include <toaru/hashmap.h>
+#include <toaru/crc32.h>
 
 #define MSK_VERSION "1.0.0"
 #define VAR_PATH "/var/msk"
@@ -289,14 +290,46 @@ static int process_package(list_t * pkgs, char * name) {
 	return 0;
 }
 
+/* Check a downloaded package against the crc32 key from the manifest,
+ * when the manifest provides one. Streamed tgz installs never touch
+ * the disk, so there is nothing for us to check there. */
+static int verify_package(char * pkg) {
+	char * expected = confreader_getd(msk_manifest, pkg, "crc32", "");
+	if (!strlen(expected)) return 0;
+
+	char * source = confreader_get(msk_manifest, pkg, "source");
+	if (!source || source[0] != '/') return 0;
+
+	FILE * f = fopen(source, "r");
+	if (!f) {
+		fprintf(stderr, "\033[1;31merror\033[0m: %s: could not open '%s' to verify\n", pkg, source);
+		return 1;
+	}
+	unsigned int crc = crc32_file(f);
+	fclose(f);
+
+	if (crc != (unsigned int)strtoul(expected, NULL, 16)) {
+		fprintf(stderr, "\033[1;31merror\033[0m: %s: checksum mismatch (expected %s, got %8x)\n", pkg, expected, crc);
+		return 1;
+	}
+
+	if (verbose) {
+		fprintf(stderr, "  - Checksum for '%s' matches (%8x)\n", pkg, crc);
+	}
+
+	return 0;
+}
+
 static int install_package(char * pkg) {
 
 	char * type = confreader_getd(msk_manifest, pkg, "type", "");
 	char * msk_remote = confreader_get(msk_manifest, pkg, "remote_path");
 
-	if (strstr(msk_remote, "http:") == msk_remote) {
+	if (strstr(msk_remote, "http:") == msk_remote && strcmp(type, "tgz")) {
 		char * source = confreader_get(msk_manifest, pkg, "source");
-		if (source) {
+		/* Skip anything already downloaded by the batch pass;
+		 * tgz archives stream straight from the mirror below */
+		if (source && source[0] != '/') {
 			fprintf(stderr, "Download %s...\n", pkg);
 			char cmd[1024];
 			sprintf(cmd, "fetch -o /tmp/msk.file -v %s/%s", msk_remote,
@@ -306,6 +339,8 @@ static int install_package(char * pkg) {
 		}
 	}
 
+	if (verify_package(pkg)) return 1;
+
 	fprintf(stderr, "Install '%s'...\n", pkg);
 
 	if (!strcmp(type, "file")) {
@@ -354,16 +389,35 @@ static int install_package(char * pkg) {
 	} else if (!strcmp(type, "tgz")) {
 		/* Compressed archive */
 
-		if (verbose) {
-			fprintf(stderr, "  - Extract (compressed) '%s' to '%s'\n",
-					confreader_get(msk_manifest, pkg, "source"),
-					confreader_get(msk_manifest, pkg, "destination"));
-		}
-
+		char * source = confreader_get(msk_manifest, pkg, "source");
 		char cmd[1024];
-		sprintf(cmd, "cd %s; tar -xzf %s",
-				confreader_get(msk_manifest, pkg, "destination"),
-				confreader_get(msk_manifest, pkg, "source"));
+
+		if (strstr(msk_remote, "http:") == msk_remote && source && source[0] != '/') {
+			/*
+			 * Stream the download through inflate and tar in one pass:
+			 * no temporary file, and the data only hits the disk once,
+			 * as the extracted files themselves.
+			 */
+			if (verbose) {
+				fprintf(stderr, "  - Stream '%s/%s' into '%s'\n",
+						msk_remote, source,
+						confreader_get(msk_manifest, pkg, "destination"));
+			}
+
+			sprintf(cmd, "cd %s; fetch %s/%s | tar -xz",
+					confreader_get(msk_manifest, pkg, "destination"),
+					msk_remote, source);
+		} else {
+			if (verbose) {
+				fprintf(stderr, "  - Extract (compressed) '%s' to '%s'\n",
+						source,
+						confreader_get(msk_manifest, pkg, "destination"));
+			}
+
+			sprintf(cmd, "cd %s; tar -xzf %s",
+					confreader_get(msk_manifest, pkg, "destination"),
+					source);
+		}
 
 		int status;
 		if ((status = system(cmd))) {
@@ -396,6 +450,19 @@ static int install_package(char * pkg) {
 	return 0;
 }
 
+/*
+ * Should this package be fetched to a local file before install?
+ * tgz packages stream straight from the mirror into tar instead,
+ * so they never touch disk in compressed form.
+ */
+static int wants_predownload(char * pkg) {
+	char * remote = confreader_get(msk_manifest, pkg, "remote_path");
+	char * source = confreader_get(msk_manifest, pkg, "source");
+	char * type = confreader_getd(msk_manifest, pkg, "type", "");
+	if (!strcmp(type, "tgz")) return 0;
+	return remote && source && strstr(remote, "http:") == remote;
+}
+
 static int install_packages(int argc, char * argv[]) {
 	needs_root();
 	needs_lock();
@@ -431,6 +498,73 @@ static int install_packages(int argc, char * argv[]) {
 		}
 	}
 
+	/*
+	 * Download everything first with a single fetch invocation, so
+	 * files from the same remote share one keep-alive connection
+	 * instead of paying connection setup per package.
+	 */
+	{
+		size_t cmd_len = 64;
+		int remote_count = 0;
+		foreach(node, ordered) {
+			char * pkg = node->value;
+			char * remote = confreader_get(msk_manifest, pkg, "remote_path");
+			char * source = confreader_get(msk_manifest, pkg, "source");
+			if (wants_predownload(pkg)) {
+				cmd_len += strlen(remote) + strlen(source) + 64;
+				remote_count++;
+			}
+		}
+
+		if (remote_count) {
+			char * cmd = malloc(cmd_len);
+			strcpy(cmd, "fetch -v");
+			int i = 0;
+			foreach(node, ordered) {
+				char * pkg = node->value;
+				if (wants_predownload(pkg)) {
+					char tmp[64];
+					sprintf(tmp, " -o /tmp/msk.file.%d", i);
+					strcat(cmd, tmp);
+					i++;
+				}
+			}
+			i = 0;
+			foreach(node, ordered) {
+				char * pkg = node->value;
+				char * remote = confreader_get(msk_manifest, pkg, "remote_path");
+				char * source = confreader_get(msk_manifest, pkg, "source");
+				if (wants_predownload(pkg)) {
+					strcat(cmd, " ");
+					strcat(cmd, remote);
+					strcat(cmd, "/");
+					strcat(cmd, source);
+					i++;
+				}
+			}
+
+			fprintf(stderr, "Downloading %d file%s...\n", remote_count, remote_count == 1 ? "" : "s");
+			if (system(cmd)) {
+				fprintf(stderr, "Error downloading packages.\n");
+				free(cmd);
+				return 1;
+			}
+			free(cmd);
+
+			/* Point each package at its downloaded file */
+			i = 0;
+			foreach(node, ordered) {
+				char * pkg = node->value;
+				if (wants_predownload(pkg)) {
+					char tmp[64];
+					sprintf(tmp, "/tmp/msk.file.%d", i);
+					hashmap_set(hashmap_get(msk_manifest->sections, pkg), "source", strdup(tmp));
+					i++;
+				}
+			}
+		}
+	}
+
 	foreach(node, ordered) {
 		if (install_package(node->value)) {
 			return 1;
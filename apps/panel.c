@@ -70,6 +70,20 @@
 #define WIDGET_RIGHT (width - TIME_LEFT - DATE_WIDTH)
 #define WIDGET_POSITION(i) (WIDGET_RIGHT - WIDGET_WIDTH * (i+1))
 
+/*
+ * Damage regions for partial repaints. Each widget paints into its own
+ * horizontal span of the panel; redraw_regions() only restores the
+ * background, repaints, and flips the spans that actually changed, so
+ * the once-a-second steady state is just the clock, not the full strip.
+ */
+#define REGION_APPMENU 0x01
+#define REGION_WINLIST 0x02
+#define REGION_WIDGETS 0x04
+#define REGION_DATE    0x08
+#define REGION_CLOCK   0x10
+#define REGION_LOGOUT  0x20
+#define REGION_ALL     0x3F
+
 static yutani_t * yctx;
 
 static gfx_context_t * ctx = NULL;
@@ -143,6 +157,7 @@ static int center_x_a2(int x) {
 }
 
 static void redraw(void);
+static void redraw_regions(int regions);
 
 static volatile int _continue = 1;
 
@@ -213,7 +228,7 @@ static void launch_application(char * app) {
 static void set_focused(int i) {
 	if (focused_app != i) {
 		focused_app = i;
-		redraw();
+		redraw_regions(REGION_WINLIST);
 	}
 }
 
@@ -272,7 +287,7 @@ static void volume_raise(void) {
 	value.val    = volume_level;
 
 	ioctl(mixer, SND_MIXER_WRITE_KNOB, &value);
-	redraw();
+	redraw_regions(REGION_WIDGETS);
 }
 static void volume_lower(void) {
 	if (volume_level < 0x20000000) volume_level = 0x0;
@@ -284,7 +299,7 @@ static void volume_lower(void) {
 	value.val    = volume_level;
 
 	ioctl(mixer, SND_MIXER_WRITE_KNOB, &value);
-	redraw();
+	redraw_regions(REGION_WIDGETS);
 }
 
 static int weather_left = 0;
@@ -978,7 +993,44 @@ static void handle_key_event(struct yutani_msg_key_event * ke) {
 
 }
 
-static void redraw(void) {
+/*
+ * Compute the horizontal span of a damage region.
+ * Regions cover the full height of the panel.
+ */
+static void region_bounds(int region, int * x, int * w) {
+	switch (region) {
+		case REGION_APPMENU:
+			*x = 0;
+			*w = APP_OFFSET;
+			break;
+		case REGION_WINLIST:
+			*x = APP_OFFSET;
+			*w = LEFT_BOUND - APP_OFFSET;
+			break;
+		case REGION_WIDGETS:
+			*x = WIDGET_RIGHT - widgets_width;
+			*w = widgets_width;
+			break;
+		case REGION_DATE:
+			*x = width - TIME_LEFT - DATE_WIDTH;
+			*w = DATE_WIDTH;
+			break;
+		case REGION_CLOCK:
+			*x = width - TIME_LEFT;
+			*w = TIME_LEFT - 24;
+			break;
+		case REGION_LOGOUT:
+			*x = width - 24;
+			*w = 24;
+			break;
+		default:
+			*x = 0;
+			*w = 0;
+			break;
+	}
+}
+
+static void redraw_regions(int regions) {
 	spin_lock(&drawlock);
 
 	struct timeval now;
@@ -988,36 +1040,56 @@ static void redraw(void) {
 	uint32_t txt_color = TEXT_COLOR;
 	int t = 0;
 
-	/* Redraw the background */
-	memcpy(ctx->backbuffer, bg_blob, bg_size);
+	/* Restore the background under everything we are going to repaint */
+	if (regions == REGION_ALL) {
+		memcpy(ctx->backbuffer, bg_blob, bg_size);
+	} else {
+		for (int r = REGION_APPMENU; r <= REGION_LOGOUT; r <<= 1) {
+			if (!(regions & r)) continue;
+			int x, w;
+			region_bounds(r, &x, &w);
+			if (x < 0) { w += x; x = 0; }
+			if (x + w > width) { w = width - x; }
+			if (w <= 0) continue;
+			for (int y = 0; y < PANEL_HEIGHT; ++y) {
+				memcpy(&ctx->backbuffer[(y * width + x) * 4], &bg_blob[(y * width + x) * 4], w * 4);
+			}
+		}
+	}
 
 	/* Get the current time for the clock */
 	gettimeofday(&now, NULL);
 	timeinfo = localtime((time_t *)&now.tv_sec);
 
-	/* Hours : Minutes : Seconds */
-	strftime(buffer, 80, "%H:%M:%S", timeinfo);
-	draw_sdf_string(ctx, width - TIME_LEFT, 3, buffer, 20, clockmenu->window ? HILIGHT_COLOR : txt_color, SDF_FONT_THIN);
-
-	/* Day-of-week */
-	strftime(buffer, 80, "%A", timeinfo);
-	t = draw_sdf_string_width(buffer, 12, SDF_FONT_THIN);
-	t = (DATE_WIDTH - t) / 2;
-	draw_sdf_string(ctx, width - TIME_LEFT - DATE_WIDTH + t, 2, buffer, 12, calmenu->window ? HILIGHT_COLOR : txt_color, SDF_FONT_THIN);
+	if (regions & REGION_CLOCK) {
+		/* Hours : Minutes : Seconds */
+		strftime(buffer, 80, "%H:%M:%S", timeinfo);
+		draw_sdf_string(ctx, width - TIME_LEFT, 3, buffer, 20, clockmenu->window ? HILIGHT_COLOR : txt_color, SDF_FONT_THIN);
+	}
 
-	/* Month Day */
-	strftime(buffer, 80, "%h %e", timeinfo);
-	t = draw_sdf_string_width(buffer, 12, SDF_FONT_BOLD);
-	t = (DATE_WIDTH - t) / 2;
-	draw_sdf_string(ctx, width - TIME_LEFT - DATE_WIDTH + t, 12, buffer, 12, calmenu->window ? HILIGHT_COLOR : txt_color, SDF_FONT_BOLD);
+	if (regions & REGION_DATE) {
+		/* Day-of-week */
+		strftime(buffer, 80, "%A", timeinfo);
+		t = draw_sdf_string_width(buffer, 12, SDF_FONT_THIN);
+		t = (DATE_WIDTH - t) / 2;
+		draw_sdf_string(ctx, width - TIME_LEFT - DATE_WIDTH + t, 2, buffer, 12, calmenu->window ? HILIGHT_COLOR : txt_color, SDF_FONT_THIN);
+
+		/* Month Day */
+		strftime(buffer, 80, "%h %e", timeinfo);
+		t = draw_sdf_string_width(buffer, 12, SDF_FONT_BOLD);
+		t = (DATE_WIDTH - t) / 2;
+		draw_sdf_string(ctx, width - TIME_LEFT - DATE_WIDTH + t, 12, buffer, 12, calmenu->window ? HILIGHT_COLOR : txt_color, SDF_FONT_BOLD);
+	}
 
-	/* Applications menu */
-	draw_sdf_string(ctx, 8, 3, "Applications", 20, appmenu->window ? HILIGHT_COLOR : txt_color, SDF_FONT_THIN);
+	if (regions & REGION_APPMENU) {
+		/* Applications menu */
+		draw_sdf_string(ctx, 8, 3, "Applications", 20, appmenu->window ? HILIGHT_COLOR : txt_color, SDF_FONT_THIN);
+	}
 
 	/* Draw each widget */
 	int widget = 0;
 	/* Weather */
-	if (widgets_weather_enabled) {
+	if ((regions & REGION_WIDGETS) && widgets_weather_enabled) {
 		uint32_t color = (weather && weather->window) ? HILIGHT_COLOR : ICON_COLOR;
 		int t = draw_sdf_string_width(weather_temp_str, 15, SDF_FONT_THIN);
 		draw_sdf_string(ctx, WIDGET_POSITION(widget) + (WIDGET_WIDTH - t) / 2, 5, weather_temp_str, 15, color, SDF_FONT_THIN);
@@ -1025,7 +1097,7 @@ static void redraw(void) {
 		widget += 2;
 	}
 	/* - Network */
-	if (widgets_network_enabled) {
+	if ((regions & REGION_WIDGETS) && widgets_network_enabled) {
 		uint32_t color = (netstat && netstat->window) ? HILIGHT_COLOR : ICON_COLOR;
 		if (network_status == 1) {
 			draw_sprite_alpha_paint(ctx, sprite_net_active, WIDGET_POSITION(widget), 0, 1.0, color);
@@ -1035,7 +1107,7 @@ static void redraw(void) {
 		widget++;
 	}
 	/* - Volume */
-	if (widgets_volume_enabled) {
+	if ((regions & REGION_WIDGETS) && widgets_volume_enabled) {
 		if (volume_level < 10) {
 			draw_sprite_alpha_paint(ctx, sprite_volume_mute, WIDGET_POSITION(widget), 0, 1.0, ICON_COLOR);
 		} else if (volume_level < 0x547ae147) {
@@ -1051,7 +1123,7 @@ static void redraw(void) {
 	/* Now draw the window list */
 	int i = 0, j = 0;
 	spin_lock(&lock);
-	if (window_list) {
+	if ((regions & REGION_WINLIST) && window_list) {
 		foreach(node, window_list) {
 			struct window_ad * ad = node->value;
 			char * s = "";
@@ -1160,16 +1232,37 @@ static void redraw(void) {
 	}
 	spin_unlock(&lock);
 
-	/* Draw the logout button; XXX This should probably have some sort of focus hilight */
-	draw_sprite_alpha_paint(ctx, sprite_logout, width - 23, 1, 1.0, (logout_menu->window ? HILIGHT_COLOR : ICON_COLOR)); /* Logout button */
+	if (regions & REGION_LOGOUT) {
+		/* Draw the logout button; XXX This should probably have some sort of focus hilight */
+		draw_sprite_alpha_paint(ctx, sprite_logout, width - 23, 1, 1.0, (logout_menu->window ? HILIGHT_COLOR : ICON_COLOR)); /* Logout button */
+	}
 
-	/* Flip */
-	flip(ctx);
-	yutani_flip(yctx, panel);
+	/* Flip; partial repaints push only the damaged spans to the compositor */
+	if (regions == REGION_ALL) {
+		flip(ctx);
+		yutani_flip(yctx, panel);
+	} else {
+		for (int r = REGION_APPMENU; r <= REGION_LOGOUT; r <<= 1) {
+			if (!(regions & r)) continue;
+			int x, w;
+			region_bounds(r, &x, &w);
+			if (x < 0) { w += x; x = 0; }
+			if (x + w > width) { w = width - x; }
+			if (w <= 0) continue;
+			for (int y = 0; y < PANEL_HEIGHT; ++y) {
+				memcpy(&ctx->buffer[(y * width + x) * 4], &ctx->backbuffer[(y * width + x) * 4], w * 4);
+			}
+			yutani_flip_region(yctx, panel, x, 0, w, PANEL_HEIGHT);
+		}
+	}
 
 	spin_unlock(&drawlock);
 }
 
+static void redraw(void) {
+	redraw_regions(REGION_ALL);
+}
+
 static void update_window_list(void) {
 	yutani_query_windows(yctx);
 
@@ -1270,7 +1363,7 @@ static void update_window_list(void) {
 	spin_unlock(&lock);
 
 	/* And redraw the panel */
-	redraw();
+	redraw_regions(REGION_WINLIST);
 }
 
 static void resize_finish(int xwidth, int xheight) {
@@ -1583,6 +1676,11 @@ int main (int argc, char ** argv) {
 	logout_menu = menu_create();
 	menu_insert(logout_menu, menu_create_normal("exit", "log-out", "Log Out", launch_application_menu));
 
+	/* Pre-render the static menus so they open without a layout pass */
+	menu_prepare(appmenu, yctx);
+	menu_prepare(window_menu, yctx);
+	menu_prepare(logout_menu, yctx);
+
 	/* Subscribe to window updates */
 	yutani_subscribe_windows(yctx);
 
@@ -1593,6 +1691,8 @@ int main (int argc, char ** argv) {
 	bind_keys();
 
 	time_t last_tick = 0;
+	int last_day = -1;
+	int last_menus = 0;
 
 	int fds[1] = {fileno(yctx->sock)};
 
@@ -1647,10 +1747,56 @@ int main (int argc, char ** argv) {
 			if (now.tv_sec != last_tick) {
 				last_tick = now.tv_sec;
 				waitpid(-1, NULL, WNOHANG);
+
+				/* Figure out what actually changed this tick */
+				int regions = REGION_CLOCK;
+
+				uint32_t old_volume = volume_level;
+				int old_network = network_status;
+				int old_widgets_width = widgets_width;
+				char * old_weather = weather_temp_str ? strdup(weather_temp_str) : NULL;
+
 				update_volume_level();
 				update_network_status();
 				update_weather_status();
-				redraw();
+
+				if (old_volume != volume_level || old_network != network_status) {
+					regions |= REGION_WIDGETS;
+				}
+				if ((old_weather == NULL) != (weather_temp_str == NULL) ||
+				    (old_weather && weather_temp_str && strcmp(old_weather, weather_temp_str))) {
+					regions |= REGION_WIDGETS;
+				}
+				free(old_weather);
+
+				struct tm * timeinfo = localtime((time_t *)&now.tv_sec);
+				if (timeinfo->tm_mday != last_day) {
+					last_day = timeinfo->tm_mday;
+					regions |= REGION_DATE;
+				}
+
+				/* Menus opening or closing toggle the hover highlights */
+				int menus =
+					(appmenu->window              ? 0x01 : 0) |
+					(calmenu->window              ? 0x02 : 0) |
+					(clockmenu->window            ? 0x04 : 0) |
+					(logout_menu->window          ? 0x08 : 0) |
+					((weather && weather->window) ? 0x10 : 0) |
+					((netstat && netstat->window) ? 0x20 : 0);
+				int menu_diff = menus ^ last_menus;
+				last_menus = menus;
+				if (menu_diff & 0x01) regions |= REGION_APPMENU;
+				if (menu_diff & 0x02) regions |= REGION_DATE;
+				if (menu_diff & 0x04) regions |= REGION_CLOCK;
+				if (menu_diff & 0x08) regions |= REGION_LOGOUT;
+				if (menu_diff & 0x30) regions |= REGION_WIDGETS;
+
+				/* A widget appearing or disappearing moves everything else */
+				if (old_widgets_width != widgets_width) {
+					regions = REGION_ALL;
+				}
+
+				redraw_regions(regions);
 			}
 		}
 	}
@@ -76,28 +76,6 @@ int my_pgid;
 
 int is_subshell = 0;
 
-struct semaphore {
-	int fds[2];
-};
-
-struct semaphore create_semaphore(void) {
-	struct semaphore out;
-	pipe(out.fds);
-	return out;
-}
-
-void raise_semaphore(struct semaphore s){
-	close(s.fds[0]);
-	close(s.fds[1]);
-}
-
-void wait_semaphore(struct semaphore s) {
-	close(s.fds[1]);
-	char buf;
-	read(s.fds[0], &buf, 1);
-	close(s.fds[0]);
-}
-
 void set_pgid(int pgid) {
 	if (shell_interactive == 1) {
 		setpgid(0, pgid);
@@ -140,6 +118,8 @@ shell_command_t shell_find(char * str) {
 }
 
 void install_commands();
+int path_index_stale(void);
+void refresh_path_index(void);
 
 /* Maximum command length */
 #define LINE_LEN 4096
@@ -383,6 +363,21 @@ void redraw_prompt_func_c(rline_context_t * context) {
 	draw_prompt_c();
 }
 
+/* First index whose command sorts at or after the prefix; the command
+ * table is kept sorted, so prefix matches form a contiguous run. */
+static int command_lower_bound(const char * prefix, size_t len) {
+	int lo = 0, hi = shell_commands_len;
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (strncmp(shell_commands[mid], prefix, len) < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
 void tab_complete_func(rline_context_t * c) {
 	char * dup = malloc(LINE_LEN);
 	
@@ -473,11 +468,15 @@ void tab_complete_func(rline_context_t * c) {
 	if (complete_mode == COMPLETE_COMMAND) {
 		/* Complete a command name */
 
-		for (int i = 0; i < shell_commands_len; ++i) {
-			if (strstr(shell_commands[i], prefix) == shell_commands[i]) {
-				list_insert(matches, shell_commands[i]);
-				match = shell_commands[i];
-			}
+		if (path_index_stale()) {
+			refresh_path_index();
+		}
+
+		size_t plen = strlen(prefix);
+		for (int i = command_lower_bound(prefix, plen); i < shell_commands_len; ++i) {
+			if (strncmp(shell_commands[i], prefix, plen)) break;
+			list_insert(matches, shell_commands[i]);
+			match = shell_commands[i];
 		}
 	} else if (complete_mode == COMPLETE_FILE) {
 		/* Complete a file path */
@@ -786,8 +785,111 @@ static struct alternative cmd_alternatives[] = {
 	{NULL, NULL, NULL},
 };
 
+/*
+ * Cache of resolved $PATH lookups: command name → verified full path.
+ *
+ * execvp() re-walks $PATH with a stat() per directory on every exec.
+ * We resolve commands in the shell instead, remember the results, and
+ * throw the whole cache away if $PATH itself or the mtime of any
+ * directory in it changes. Lookups done before fork() are inherited
+ * by the children, so pipeline stages exec without walking anything.
+ */
+struct path_cache_dir {
+	char * dir;
+	time_t mtime;
+};
+
+static hashmap_t * path_cache = NULL;
+static char * path_cache_env = NULL;
+static list_t * path_cache_dirs = NULL;
+
+static void path_cache_validate(void) {
+	char * path = getenv("PATH");
+	if (!path) path = "/bin:/usr/bin";
+
+	if (path_cache && path_cache_env && !strcmp(path_cache_env, path)) {
+		int dirty = 0;
+		foreach(node, path_cache_dirs) {
+			struct path_cache_dir * d = node->value;
+			struct stat statbuf;
+			if (stat(d->dir, &statbuf) || statbuf.st_mtime != d->mtime) {
+				dirty = 1;
+				break;
+			}
+		}
+		if (!dirty) return;
+	}
+
+	/* Throw out the old cache */
+	if (path_cache) {
+		list_t * values = hashmap_values(path_cache);
+		foreach(node, values) {
+			free(node->value);
+		}
+		list_free(values);
+		free(values);
+		hashmap_free(path_cache);
+		free(path_cache);
+		free(path_cache_env);
+		foreach(node, path_cache_dirs) {
+			struct path_cache_dir * d = node->value;
+			free(d->dir);
+		}
+		list_destroy(path_cache_dirs);
+		list_free(path_cache_dirs);
+		free(path_cache_dirs);
+	}
+
+	path_cache = hashmap_create(10);
+	path_cache_env = strdup(path);
+	path_cache_dirs = list_create();
+
+	char * xpath = strdup(path);
+	char * p, * last;
+	for ((p = strtok_r(xpath, ":", &last)); p; p = strtok_r(NULL, ":", &last)) {
+		struct path_cache_dir * d = malloc(sizeof(struct path_cache_dir));
+		d->dir = strdup(p);
+		struct stat statbuf;
+		d->mtime = stat(p, &statbuf) ? 0 : statbuf.st_mtime;
+		list_insert(path_cache_dirs, d);
+	}
+	free(xpath);
+}
+
+/*
+ * Resolve a command name to a full path, through the cache.
+ * Returns NULL for anything with a '/' in it or not found in
+ * $PATH; callers fall back to execvp() in that case.
+ */
+static char * path_resolve(char * cmd) {
+	if (!cmd || strstr(cmd, "/")) return NULL;
+
+	path_cache_validate();
+
+	char * cached = hashmap_get(path_cache, cmd);
+	if (cached) return cached;
+
+	foreach(node, path_cache_dirs) {
+		struct path_cache_dir * d = node->value;
+		char * exe = malloc(strlen(d->dir) + strlen(cmd) + 2);
+		strcpy(exe, d->dir);
+		strcat(exe, "/");
+		strcat(exe, cmd);
+
+		struct stat statbuf;
+		if (!stat(exe, &statbuf) && (statbuf.st_mode & 0111)) {
+			hashmap_set(path_cache, cmd, exe);
+			return exe;
+		}
+		free(exe);
+	}
+
+	return NULL;
+}
+
 void run_cmd(char ** args) {
-	int i = execvp(*args, args);
+	char * full_path = path_resolve(*args);
+	int i = full_path ? execve(full_path, args, environ) : execvp(*args, args);
 	shell_command_t func = shell_find(*args);
 	if (func) {
 		int argc = 0;
@@ -1404,31 +1506,46 @@ _nope:
 		argv[tokenid-1] = NULL;
 	}
 
+	/*
+	 * Resolve every stage in the parent before forking anything, so
+	 * the children inherit warm path cache entries and exec directly.
+	 */
+	for (int j = 0; j <= cmdi; ++j) {
+		path_resolve(arg_starts[j][0]);
+	}
+
 	int pgid = 0;
 	if (cmdi > 0) {
 		int last_output[2];
 		pipe(last_output);
 
-		struct semaphore s = create_semaphore();
 		child_pid = fork();
 		if (!child_pid) {
 			set_pgid(0);
-			if (!nowait) set_pgrp(getpid());
-			raise_semaphore(s);
 			is_subshell = 1;
 			dup2(last_output[1], STDOUT_FILENO);
 			close(last_output[0]);
 			add_environment(extra_env);
 			run_cmd(arg_starts[0]);
 		}
-		wait_semaphore(s);
 
+		/*
+		 * The parent creates the process group itself, rather than
+		 * waiting for the leader to be scheduled and do it; this lets
+		 * every stage of the pipeline fork in one pass. The child also
+		 * sets its own group, whichever happens first wins.
+		 */
 		pgid = child_pid;
+		if (shell_interactive == 1) {
+			setpgid(child_pid, child_pid);
+			if (!nowait) set_pgrp(pgid);
+		}
 
 		for (int j = 1; j < cmdi; ++j) {
 			int tmp_out[2];
 			pipe(tmp_out);
-			if (!fork()) {
+			pid_t stage_pid = fork();
+			if (!stage_pid) {
 				is_subshell = 1;
 				set_pgid(pgid);
 				dup2(tmp_out[1], STDOUT_FILENO);
@@ -1438,6 +1555,7 @@ _nope:
 				add_environment(extra_env);
 				run_cmd(arg_starts[j]);
 			}
+			if (shell_interactive == 1) setpgid(stage_pid, pgid);
 			close(last_output[0]);
 			close(last_output[1]);
 			last_output[0] = tmp_out[0];
@@ -1471,6 +1589,7 @@ _nope:
 			add_environment(extra_env);
 			run_cmd(arg_starts[cmdi]);
 		}
+		if (shell_interactive == 1) setpgid(last_child, pgid);
 		close(last_output[0]);
 		close(last_output[1]);
 
@@ -1505,12 +1624,27 @@ _nope:
 			if (old_err != -1) dup2(old_err, STDERR_FILENO);
 			return result;
 		} else {
-			struct semaphore s = create_semaphore();
-			child_pid = fork();
-			if (!child_pid) {
+			/*
+			 * A plain external command with no redirections and no
+			 * per-command environment needs nothing set up in the
+			 * child, so the kernel can build it straight from the
+			 * binary - no page directory cloned just for exec to
+			 * tear down. Process-group assignment is already done
+			 * from the parent side below either way.
+			 */
+			char * full_path = path_resolve(arg_starts[0][0]);
+			int spawned = 0;
+			if (full_path && !output_files[cmdi] && !err_files[cmdi] && !extra_env->length) {
+				int fd_map[3] = {0, 1, 2};
+				pid_t s = spawn(full_path, arg_starts[0], environ, fd_map, 3);
+				if (s > 0) {
+					child_pid = s;
+					spawned = 1;
+				}
+			}
+			if (!spawned) child_pid = fork();
+			if (!spawned && !child_pid) {
 				set_pgid(0);
-				if (!nowait) set_pgrp(getpid());
-				raise_semaphore(s);
 				is_subshell = 1;
 				if (output_files[cmdi]) {
 					int fd = open(output_files[cmdi], file_args[cmdi], 0666);
@@ -1534,9 +1668,12 @@ _nope:
 				run_cmd(arg_starts[0]);
 			}
 
-			wait_semaphore(s);
-
+			/* As above: assign the group from the parent side */
 			pgid = child_pid;
+			if (shell_interactive == 1) {
+				setpgid(child_pid, child_pid);
+				if (!nowait) set_pgrp(pgid);
+			}
 			last_child = child_pid;
 		}
 	}
@@ -1565,7 +1702,23 @@ _nope:
 	return ret;
 }
 
+/* The directories the command index was built from, with the mtimes we
+ * saw at the time, so completion can tell when the index has gone stale
+ * without rescanning anything. */
+#define PATH_DIRS 16
+static char * path_dirs[PATH_DIRS];
+static time_t path_mtimes[PATH_DIRS];
+static int path_dirs_len = 0;
+static char * path_value = NULL;
+
 void add_path_contents(char * path) {
+	if (path_dirs_len < PATH_DIRS) {
+		struct stat statbuf;
+		path_dirs[path_dirs_len] = strdup(path);
+		path_mtimes[path_dirs_len] = stat(path, &statbuf) ? 0 : statbuf.st_mtime;
+		path_dirs_len++;
+	}
+
 	DIR * dirp = opendir(path);
 
 	if (!dirp) return; /* Failed to load directly */
@@ -1630,6 +1783,7 @@ void show_usage(int argc, char * argv[]) {
 void add_path(void) {
 
 	char * envvar = getenv("PATH");
+	path_value = strdup(envvar ? envvar : "");
 
 	if (!envvar) {
 		add_path_contents("/bin");
@@ -1651,6 +1805,52 @@ void add_path(void) {
 	free(tmp);
 }
 
+/* Has $PATH changed, or any of its directories been touched, since the
+ * command index was built? A few stats, so cheap enough per tab press. */
+int path_index_stale(void) {
+	if (!path_value) return 0; /* Index was never built */
+
+	char * envvar = getenv("PATH");
+	if (strcmp(path_value, envvar ? envvar : "")) return 1;
+
+	for (int i = 0; i < path_dirs_len; ++i) {
+		struct stat statbuf;
+		time_t mtime = stat(path_dirs[i], &statbuf) ? 0 : statbuf.st_mtime;
+		if (mtime != path_mtimes[i]) return 1;
+	}
+
+	return 0;
+}
+
+/* Drop the $PATH-derived entries from the command table - they are the
+ * ones without function pointers - and rescan. */
+void refresh_path_index(void) {
+	int kept = 0;
+	for (int i = 0; i < shell_commands_len; ++i) {
+		if (shell_pointers[i]) {
+			shell_commands[kept] = shell_commands[i];
+			shell_pointers[kept] = shell_pointers[i];
+			shell_descript[kept] = shell_descript[i];
+			kept++;
+		} else {
+			free(shell_commands[i]);
+		}
+	}
+	shell_commands_len = kept;
+	shell_commands[kept] = NULL;
+
+	for (int i = 0; i < path_dirs_len; ++i) {
+		free(path_dirs[i]);
+	}
+	path_dirs_len = 0;
+	free(path_value);
+	path_value = NULL;
+
+	add_path();
+	sort_commands();
+	rline_exp_set_shell_commands(shell_commands, shell_commands_len);
+}
+
 int run_script(FILE * f) {
 	current_line = 1;
 	while (!feof(f)) {
@@ -34,6 +34,8 @@
 #include <toaru/list.h>
 #include <toaru/spinlock.h>
 
+#include <sys/sysfunc.h>
+
 #include "vga-palette.h"
 
 #define USE_BELL 0
@@ -483,12 +485,28 @@ void handle_input_s(char * c) {
 
 unsigned short * textmemptr = (unsigned short *)0xB8000;
 unsigned short * mirrorcopy = NULL;
+
+/*
+ * Text memory is 32K - eight screens - and we scroll by sliding the
+ * display window through it with the CRTC start-address register,
+ * rebasing to the front with one full rewrite when we run off the
+ * end. `mirrorcopy` shadows the *logical* screen, so cell writes
+ * still only touch video memory when a cell actually changed.
+ */
+#define VGA_MEM_CELLS 16384
+static unsigned int vga_base = 0;
+
+static void vga_set_start(unsigned int cell) {
+	int x[] = {(int)(cell >> 8) & 0xFF, (int)(cell & 0xFF)};
+	sysfunc(TOARU_SYS_FUNC_SETVGASTART, (char **)x);
+}
+
 void placech(unsigned char c, int x, int y, int attr) {
 	unsigned int where = y * term_width + x;
 	unsigned int att = (c | (attr << 8));
 	if (mirrorcopy[where] != att) {
 		mirrorcopy[where] = att;
-		textmemptr[where] = att;
+		textmemptr[vga_base + where] = att;
 	}
 }
 
@@ -594,6 +612,39 @@ void term_redraw_all() {
 void term_shift_region(int top, int height, int how_much) {
 	if (how_much == 0) return;
 
+	/*
+	 * The common case - the whole screen scrolling up - is done in
+	 * hardware: shift the logical buffers, advance the start
+	 * address, and only the freshly blanked bottom lines are ever
+	 * written to video memory.
+	 */
+	if (top == 0 && height == term_height && how_much > 0 && how_much < height) {
+		int keep = (term_height - how_much) * term_width;
+		memmove(term_buffer, term_buffer + how_much * term_width, keep * sizeof(term_cell_t));
+		memmove(mirrorcopy, mirrorcopy + how_much * term_width, keep * sizeof(unsigned short));
+		for (int i = keep; i < term_width * term_height; ++i) {
+			/* Not a value placech can produce; forces the write */
+			mirrorcopy[i] = 0xFFFF;
+		}
+		if (vga_base + how_much * term_width + term_width * term_height <= VGA_MEM_CELLS) {
+			vga_base += how_much * term_width;
+		} else {
+			/* Ran off the end of text memory; rewrite at the front */
+			vga_base = 0;
+			for (int i = 0; i < keep; ++i) {
+				textmemptr[i] = mirrorcopy[i];
+			}
+		}
+		vga_set_start(vga_base);
+		for (int y = term_height - how_much; y < term_height; ++y) {
+			for (uint16_t x = 0; x < term_width; ++x) {
+				cell_set(x, y, ' ', current_fg, current_bg, ansi_state->flags);
+				cell_redraw(x, y);
+			}
+		}
+		return;
+	}
+
 	int destination, source;
 	int count, new_top, new_bottom;
 	if (how_much > height) {
@@ -1323,8 +1374,8 @@ int main(int argc, char ** argv) {
 			maybe_flip_cursor();
 			if (res[0]) {
 				int r = read(fd_master, buf, BUF_SIZE);
-				for (int i = 0; i < r; ++i) {
-					ansi_put(ansi_state, buf[i]);
+				if (r > 0) {
+					ansi_put_bytes(ansi_state, (char *)buf, r);
 				}
 			}
 			if (res[1]) {
@@ -54,6 +54,24 @@
 /* Bitmap font */
 #include "terminal-font.h"
 
+/*
+ * Palette entries resolved to final ARGB, including the alpha channel
+ * choices the render path used to OR in per draw. Cells store these
+ * resolved values (see cell_set), so drawing a palette color costs the
+ * same as truecolor passthrough: no color math at all.
+ */
+static uint32_t term_colors_fg[PALETTE_COLORS];
+static uint32_t term_colors_bg[PALETTE_COLORS];
+static uint32_t term_colors_bg_opaque[PALETTE_COLORS];
+
+static void init_resolved_colors(void) {
+	for (int i = 0; i < PALETTE_COLORS; ++i) {
+		term_colors_fg[i] = term_colors[i] | 0xFF000000;
+		term_colors_bg[i] = term_colors[i] | ((uint32_t)TERM_DEFAULT_OPAC << 24);
+		term_colors_bg_opaque[i] = term_colors[i] | 0xFF000000;
+	}
+}
+
 /* Show help text */
 static void usage(char * argv[]) {
 	printf(
@@ -146,6 +164,16 @@ static int32_t l_y = INT32_MAX;
 static int32_t r_x = -1;
 static int32_t r_y = -1;
 
+/*
+ * Deferred scroll state. Scrolls that happen while processing one
+ * burst of output are coalesced into a single pixel move when the
+ * display is flipped; rows touched in the meantime are flagged here
+ * and re-rendered from the cell grid after the move.
+ */
+static int32_t pending_scroll = 0;
+static uint64_t * row_dirty = NULL; /* Bitmap, one bit per row */
+static int32_t dirty_row_count = 0;
+
 static uint32_t window_width  = 640;
 static uint32_t window_height = 480;
 #define TERMINAL_TITLE_SIZE 512
@@ -166,15 +194,48 @@ static int decor_bottom_height = 0;
 static int decor_width = 0;
 static int decor_height = 0;
 
+/*
+ * Scrollback: an append-only ring of encoded line records.
+ *
+ * Rows are captured as they scroll off the top with trailing blanks
+ * trimmed and interior runs of blank cells run-length encoded: a
+ * record with a zero codepoint stands for `fg` consecutive blank
+ * cells, which no real cell can produce since the renderer already
+ * treats any cell with a zero codepoint as blank. Most lines collapse
+ * to a handful of records, which is what lets the history run to
+ * 100k lines in megabytes rather than hundreds.
+ */
 struct scrollback_row {
-	unsigned short width;
+	unsigned short width;   /* logical columns covered by the records */
+	unsigned short encoded; /* number of cell records that follow */
 	term_cell_t cells[];
 };
 
-#define MAX_SCROLLBACK 10240
-static list_t * scrollback_list = NULL;
+#define MAX_SCROLLBACK 100000
+static struct scrollback_row ** scrollback_ring = NULL;
+static unsigned int scrollback_head = 0;  /* next ring slot to write */
+static unsigned int scrollback_count = 0; /* rows currently stored */
 static int scrollback_offset = 0;
 
+/* The n'th row back from the present; 1 is the most recent. O(1). */
+static struct scrollback_row * scrollback_row_back(int n) {
+	if (n < 1 || (unsigned int)n > scrollback_count) return NULL;
+	return scrollback_ring[(scrollback_head + MAX_SCROLLBACK - n) % MAX_SCROLLBACK];
+}
+
+/* Cell x of an encoded row, in place; NULL means a blank cell. */
+static term_cell_t * scrollback_cell(struct scrollback_row * row, int x) {
+	if (x >= row->width) return NULL;
+	int at = 0;
+	for (int i = 0; i < row->encoded; ++i) {
+		term_cell_t * cell = &row->cells[i];
+		int span = cell->c ? 1 : (int)cell->fg;
+		if (x < at + span) return cell->c ? cell : NULL;
+		at += span;
+	}
+	return NULL;
+}
+
 /* Menu bar entries */
 struct menu_bar terminal_menu_bar = {0};
 struct menu_bar_entries terminal_menu_entries[] = {
@@ -191,6 +252,8 @@ static volatile int exit_application = 0;
 
 static void cell_redraw(uint16_t x, uint16_t y);
 static void cell_redraw_inverted(uint16_t x, uint16_t y);
+static void term_apply_pending_scroll(void);
+static void render_cursor(void);
 static void cell_redraw_offset(uint16_t x, uint16_t y);
 static void cell_redraw_offset_inverted(uint16_t x, uint16_t y);
 
@@ -201,7 +264,45 @@ static uint64_t get_ticks(void) {
 	return (uint64_t)now.tv_sec * 1000000LL + (uint64_t)now.tv_usec;
 }
 
+/*
+ * The dirty summary is a bitmap so the flip-time scan of a tall
+ * terminal reads a couple of words instead of walking a byte per row.
+ */
+static void mark_row_dirty(int y) {
+	if (y < 0 || y >= term_height || !row_dirty) return;
+	if (!(row_dirty[y >> 6] & (1ull << (y & 63)))) {
+		row_dirty[y >> 6] |= (1ull << (y & 63));
+		dirty_row_count++;
+	}
+}
+
+static int row_dirty_get(int y) {
+	return !!(row_dirty[y >> 6] & (1ull << (y & 63)));
+}
+
+static void row_dirty_put(int y, int dirty) {
+	if (dirty) {
+		row_dirty[y >> 6] |= (1ull << (y & 63));
+	} else {
+		row_dirty[y >> 6] &= ~(1ull << (y & 63));
+	}
+}
+
+/* memmove for dirty bits: carry them along when the cell grid shifts. */
+static void row_dirty_shift(int destination, int source, int count) {
+	if (destination < source) {
+		for (int i = 0; i < count; ++i) {
+			row_dirty_put(destination + i, row_dirty_get(source + i));
+		}
+	} else {
+		for (int i = count - 1; i >= 0; --i) {
+			row_dirty_put(destination + i, row_dirty_get(source + i));
+		}
+	}
+}
+
 static void display_flip(void) {
+	term_apply_pending_scroll();
 	if (l_x != INT32_MAX && l_y != INT32_MAX) {
 		flip(ctx);
 		yutani_flip_region(yctx, window, l_x, l_y, r_x - l_x, r_y - l_y);
@@ -420,19 +521,12 @@ static void count_selection(uint16_t x, uint16_t _y) {
 			}
 		}
 	} else {
-		node_t * node = scrollback_list->tail;
-		for (; y < -1; y++) {
-			if (!node) break;
-			node = node->prev;
-		}
-		if (node) {
-			struct scrollback_row * row = (struct scrollback_row *)node->value;
-			if (row && x < row->width) {
-				term_cell_t * cell = &row->cells[x];
-				if (cell && ((uint32_t *)cell)[0] != 0x00000000) {
-					char tmp[7];
-					_selection_count += to_eight(cell->c, tmp);
-				}
+		struct scrollback_row * row = scrollback_row_back(-y);
+		if (row) {
+			term_cell_t * cell = scrollback_cell(row, x);
+			if (cell) {
+				char tmp[7];
+				_selection_count += to_eight(cell->c, tmp);
 			}
 		}
 	}
@@ -458,22 +552,15 @@ void write_selection(uint16_t x, uint16_t _y) {
 			}
 		}
 	} else {
-		node_t * node = scrollback_list->tail;
-		for (; y < -1; y++) {
-			if (!node) break;
-			node = node->prev;
-		}
-		if (node) {
-			struct scrollback_row * row = (struct scrollback_row *)node->value;
-			if (row && x < row->width) {
-				term_cell_t * cell = &row->cells[x];
-				if (cell && ((uint32_t *)cell)[0] != 0x00000000) {
-					char tmp[7];
-					int count = to_eight(cell->c, tmp);
-					for (int i = 0; i < count; ++i) {
-						selection_text[_selection_i] = tmp[i];
-						_selection_i++;
-					}
+		struct scrollback_row * row = scrollback_row_back(-y);
+		if (row) {
+			term_cell_t * cell = scrollback_cell(row, x);
+			if (cell) {
+				char tmp[7];
+				int count = to_eight(cell->c, tmp);
+				for (int i = 0; i < count; ++i) {
+					selection_text[_selection_i] = tmp[i];
+					_selection_i++;
 				}
 			}
 		}
@@ -812,19 +899,38 @@ _extra_stuff:
 	}
 }
 
-/* Set a terminal cell */
-static void cell_set(uint16_t x, uint16_t y, uint32_t c, uint32_t fg, uint32_t bg, uint32_t flags) {
+/* Compare two cells as a pair of 64-bit words. */
+static inline int cell_same(const term_cell_t * a, const term_cell_t * b) {
+	const uint64_t * wa = (const uint64_t *)a;
+	const uint64_t * wb = (const uint64_t *)b;
+	return wa[0] == wb[0] && wa[1] == wb[1];
+}
+
+/*
+ * Set a terminal cell. Returns whether the cell actually changed, so
+ * callers repainting as they go can skip cells whose pixels already
+ * match - a full-screen application rewriting identical content costs
+ * two compares per cell instead of a glyph rasterization.
+ */
+static int cell_set(uint16_t x, uint16_t y, uint32_t c, uint32_t fg, uint32_t bg, uint32_t flags) {
 	/* Avoid setting cells out of range. */
-	if (x >= term_width || y >= term_height) return;
+	if (x >= term_width || y >= term_height) return 0;
 
 	/* Calculate the cell position in the terminal buffer */
 	term_cell_t * cell = (term_cell_t *)((uintptr_t)term_buffer + (y * term_width + x) * sizeof(term_cell_t));
 
-	/* Set cell attributes */
-	cell->c     = c;
-	cell->fg    = fg;
-	cell->bg    = bg;
-	cell->flags = flags;
+	/* Resolve palette indexes to final ARGB as the cell is written;
+	 * image cells smuggle a pointer through fg and are left alone. */
+	if (!(flags & ANSI_EXT_IMG)) {
+		if (fg < PALETTE_COLORS) fg = term_colors_fg[fg];
+		if (bg < PALETTE_COLORS) bg = (flags & ANSI_SPECBG) ? term_colors_bg_opaque[bg] : term_colors_bg[bg];
+	}
+
+	term_cell_t new_cell = { c, fg, bg, flags };
+	if (cell_same(cell, &new_cell)) return 0;
+
+	*cell = new_cell;
+	return 1;
 }
 
 /* Redraw an embedded image cell */
@@ -870,22 +976,13 @@ static void cell_redraw_offset(uint16_t x, uint16_t _y) {
 			term_write_char(cell->c, x * char_width, i * char_height, cell->fg, cell->bg, cell->flags);
 		}
 	} else {
-		node_t * node = scrollback_list->tail;
-		for (; y < -1; y++) {
-			if (!node) break;
-			node = node->prev;
-		}
-		if (node) {
-			struct scrollback_row * row = (struct scrollback_row *)node->value;
-			if (row && x < row->width) {
-				term_cell_t * cell = &row->cells[x];
-				if (!cell || ((uint32_t *)cell)[0] == 0x00000000) {
-					term_write_char(' ', x * char_width, i * char_height, TERM_DEFAULT_FG, TERM_DEFAULT_BG, TERM_DEFAULT_FLAGS);
-				} else {
-					term_write_char(cell->c, x * char_width, i * char_height, cell->fg, cell->bg, cell->flags);
-				}
-			} else {
+		struct scrollback_row * row = scrollback_row_back(-y);
+		if (row) {
+			term_cell_t * cell = scrollback_cell(row, x);
+			if (!cell) {
 				term_write_char(' ', x * char_width, i * char_height, TERM_DEFAULT_FG, TERM_DEFAULT_BG, TERM_DEFAULT_FLAGS);
+			} else {
+				term_write_char(cell->c, x * char_width, i * char_height, cell->fg, cell->bg, cell->flags);
 			}
 		}
 	}
@@ -906,22 +1003,13 @@ static void cell_redraw_offset_inverted(uint16_t x, uint16_t _y) {
 			term_write_char(cell->c, x * char_width, i * char_height, cell->bg, cell->fg, cell->flags);
 		}
 	} else {
-		node_t * node = scrollback_list->tail;
-		for (; y < -1; y++) {
-			if (!node) break;
-			node = node->prev;
-		}
-		if (node) {
-			struct scrollback_row * row = (struct scrollback_row *)node->value;
-			if (row && x < row->width) {
-				term_cell_t * cell = &row->cells[x];
-				if (!cell || ((uint32_t *)cell)[0] == 0x00000000) {
-					term_write_char(' ', x * char_width, i * char_height, TERM_DEFAULT_BG, TERM_DEFAULT_FG, TERM_DEFAULT_FLAGS);
-				} else {
-					term_write_char(cell->c, x * char_width, i * char_height, cell->bg, cell->fg, cell->flags);
-				}
-			} else {
+		struct scrollback_row * row = scrollback_row_back(-y);
+		if (row) {
+			term_cell_t * cell = scrollback_cell(row, x);
+			if (!cell) {
 				term_write_char(' ', x * char_width, i * char_height, TERM_DEFAULT_BG, TERM_DEFAULT_FG, TERM_DEFAULT_FLAGS);
+			} else {
+				term_write_char(cell->c, x * char_width, i * char_height, cell->bg, cell->fg, cell->flags);
 			}
 		}
 	}
@@ -930,6 +1018,12 @@ static void cell_redraw_offset_inverted(uint16_t x, uint16_t _y) {
 
 /* Redraw a text cell normally. */
 static void cell_redraw(uint16_t x, uint16_t y) {
+	/* While a scroll is pending, pixels are stale; render at flip time. */
+	if (pending_scroll) {
+		mark_row_dirty(y);
+		return;
+	}
+
 	/* Avoid cells out of range. */
 	if (x >= term_width || y >= term_height) return;
 
@@ -952,6 +1046,12 @@ static void cell_redraw(uint16_t x, uint16_t y) {
 
 /* Redraw text cell inverted. */
 static void cell_redraw_inverted(uint16_t x, uint16_t y) {
+	/* While a scroll is pending, pixels are stale; render at flip time. */
+	if (pending_scroll) {
+		mark_row_dirty(y);
+		return;
+	}
+
 	/* Avoid cells out of range. */
 	if (x >= term_width || y >= term_height) return;
 
@@ -974,6 +1074,12 @@ static void cell_redraw_inverted(uint16_t x, uint16_t y) {
 
 /* Redraw text cell with a surrounding box (used by cursor) */
 static void cell_redraw_box(uint16_t x, uint16_t y) {
+	/* While a scroll is pending, pixels are stale; render at flip time. */
+	if (pending_scroll) {
+		mark_row_dirty(y);
+		return;
+	}
+
 	/* Avoid cells out of range. */
 	if (x >= term_width || y >= term_height) return;
 
@@ -1080,7 +1186,7 @@ static void flush_unused_images(void) {
 	images_list = tmp;
 }
 
-static void term_shift_region(int top, int height, int how_much) {
+static void term_shift_region(int top, int height, int how_much, int defer) {
 	if (how_much == 0) return;
 
 	int destination, source;
@@ -1106,6 +1212,12 @@ static void term_shift_region(int top, int height, int how_much) {
 	/* Move from top+how_much to top */
 	if (count) {
 		memmove(term_buffer + destination, term_buffer + source, count * term_width * sizeof(term_cell_t));
+		if (defer) {
+			/* The pixel move happens at flip time; carry the dirty
+			 * flags along with their rows and we are done here. */
+			row_dirty_shift(destination / term_width, source / term_width, count);
+			goto clear_exposed;
+		}
 		/* Move displayed as well */
 		cell_redraw(csr_x, csr_y); /* Otherwise we may copy the inverted cursor */
 		uintptr_t dst = (uintptr_t)ctx->backbuffer + GFX_W(ctx) * (destination / term_width * char_height) * GFX_B(ctx);
@@ -1128,6 +1240,7 @@ static void term_shift_region(int top, int height, int how_much) {
 		}
 	}
 
+clear_exposed:
 	/* Clear new lines at bottom */
 	for (int i = new_top; i < new_bottom; ++i) {
 		for (uint16_t x = 0; x < term_width; ++x) {
@@ -1137,26 +1250,110 @@ static void term_shift_region(int top, int height, int how_much) {
 	}
 }
 
+/*
+ * Apply a deferred scroll: move the pixel region once for however many
+ * rows accumulated, then re-render only the rows flagged dirty.
+ */
+static void term_apply_pending_scroll(void) {
+	if (!pending_scroll && !dirty_row_count) return;
+
+	int how_much = pending_scroll;
+	pending_scroll = 0;
+
+	if (how_much) {
+		int destination = (how_much > 0) ? 0 : -how_much;
+		int source      = (how_much > 0) ? how_much : 0;
+		int count       = term_height - (destination + source);
+
+		uintptr_t dst = (uintptr_t)ctx->backbuffer + GFX_W(ctx) * (destination * char_height) * GFX_B(ctx);
+		uintptr_t src = (uintptr_t)ctx->backbuffer + GFX_W(ctx) * (source * char_height) * GFX_B(ctx);
+		if (!_no_frame) {
+			dst += (GFX_W(ctx) * (decor_top_height + menu_bar_height) + decor_left_width) * GFX_B(ctx);
+			src += (GFX_W(ctx) * (decor_top_height + menu_bar_height) + decor_left_width) * GFX_B(ctx);
+			if (dst < src) {
+				for (int i = 0; i < count * char_height; ++i) {
+					memmove((void*)(dst + i * GFX_W(ctx) * GFX_B(ctx)), (void*)(src + i * GFX_W(ctx) * GFX_B(ctx)), term_width * char_width * GFX_B(ctx));
+				}
+			} else {
+				for (int i = (count - 1) * char_height; i >= 0; --i) {
+					memmove((void*)(dst + i * GFX_W(ctx) * GFX_B(ctx)), (void*)(src + i * GFX_W(ctx) * GFX_B(ctx)), term_width * char_width * GFX_B(ctx));
+				}
+			}
+		} else {
+			memmove((void*)dst, (void*)src, count * char_height * GFX_W(ctx) * GFX_B(ctx));
+		}
+
+		/* Everything visible moved. */
+		l_x = 0; l_y = 0;
+		r_x = window->width;
+		r_y = window->height;
+	}
+
+	if (dirty_row_count) {
+		dirty_row_count = 0;
+		for (int w = 0; w < (term_height + 63) / 64; ++w) {
+			uint64_t bits = row_dirty[w];
+			if (!bits) continue;
+			row_dirty[w] = 0;
+			while (bits) {
+				int y = (w << 6) + __builtin_ctzll(bits);
+				bits &= bits - 1;
+				for (uint16_t x = 0; x < term_width; ++x) {
+					cell_redraw(x, y);
+				}
+			}
+		}
+		render_cursor();
+	}
+}
+
 /* Scroll the terminal up or down. */
 static void term_scroll(int how_much) {
+	if (!how_much) return;
 
-	term_shift_region(0, term_height, how_much);
+	if (how_much >= term_height || -how_much >= term_height) {
+		/* Nothing survives; clear and redraw everything. */
+		term_apply_pending_scroll();
+		term_shift_region(0, term_height, how_much, 0);
+	} else {
+		/* Direction changes don't coalesce. */
+		if (pending_scroll && ((pending_scroll > 0) != (how_much > 0))) {
+			term_apply_pending_scroll();
+		}
+		if (abs(pending_scroll + how_much) >= term_height) {
+			/*
+			 * The accumulated scroll replaces the whole screen -
+			 * drop the pixel move and mark every row for redraw.
+			 */
+			pending_scroll = 0;
+			for (int y = 0; y < term_height; ++y) mark_row_dirty(y);
+			term_shift_region(0, term_height, how_much, 1);
+		} else {
+			/* The inverted cursor may be drawn here; make sure the
+			 * row it lands on is re-rendered after the move. */
+			mark_row_dirty(csr_y);
+			pending_scroll += how_much;
+			term_shift_region(0, term_height, how_much, 1);
+		}
+	}
 
 	/* Remove image data for image cells that are no longer on screen. */
 	flush_unused_images();
 
-	/* Flip the entire window. */
-	yutani_flip(yctx, window);
+	/* The actual pixel move and flip happen in display_flip. */
 }
 
 static void insert_delete_lines(int how_many) {
 	if (how_many == 0) return;
 
+	/* Region shifts don't coalesce; settle any whole-screen scroll first. */
+	term_apply_pending_scroll();
+
 	if (how_many > 0) {
 		/* Insert lines is equivalent to scrolling from the current line */
-		term_shift_region(csr_y,term_height-csr_y,-how_many);
+		term_shift_region(csr_y,term_height-csr_y,-how_many,0);
 	} else {
-		term_shift_region(csr_y,term_height-csr_y,-how_many);
+		term_shift_region(csr_y,term_height-csr_y,-how_many,0);
 	}
 }
 
@@ -1168,22 +1365,59 @@ static int is_wide(uint32_t codepoint) {
 
 /* Save the row that is about to be scrolled offscreen into the scrollback buffer. */
 static void save_scrollback(void) {
-
-	/* If the scrollback is already full, remove the oldest element. */
-	if (scrollback_list->length == MAX_SCROLLBACK) {
-		node_t * n = list_dequeue(scrollback_list);
-		free(n->value);
-		free(n);
+	term_cell_t * cells = term_buffer;
+	term_cell_t tmp[term_width];
+
+	/* Trailing blanks aren't stored at all. */
+	int width = term_width;
+	while (width > 0 && cells[width-1].c == 0) width--;
+
+	/* Collapse interior blank runs into single records. */
+	int encoded = 0;
+	int x = 0;
+	while (x < width) {
+		if (cells[x].c == 0) {
+			uint32_t run = 0;
+			while (x < width && cells[x].c == 0) { run++; x++; }
+			tmp[encoded].c = 0;
+			tmp[encoded].fg = run;
+			tmp[encoded].bg = 0;
+			tmp[encoded].flags = 0;
+			encoded++;
+		} else {
+			tmp[encoded++] = cells[x++];
+		}
 	}
 
-	struct scrollback_row * row = malloc(sizeof(struct scrollback_row) + sizeof(term_cell_t) * term_width + 20);
-	row->width = term_width;
-	for (int i = 0; i < term_width; ++i) {
-		term_cell_t * cell = (term_cell_t *)((uintptr_t)term_buffer + (i) * sizeof(term_cell_t));
-		memcpy(&row->cells[i], cell, sizeof(term_cell_t));
-	}
+	struct scrollback_row * row = malloc(sizeof(struct scrollback_row) + sizeof(term_cell_t) * encoded);
+	row->width = width;
+	row->encoded = encoded;
+	memcpy(row->cells, tmp, sizeof(term_cell_t) * encoded);
 
-	list_insert(scrollback_list, row);
+	/* Append, overwriting the oldest row once the ring is full. */
+	if (scrollback_ring[scrollback_head]) free(scrollback_ring[scrollback_head]);
+	scrollback_ring[scrollback_head] = row;
+	scrollback_head = (scrollback_head + 1) % MAX_SCROLLBACK;
+	if (scrollback_count < MAX_SCROLLBACK) scrollback_count++;
+}
+
+/* Render one history row at display row y, decoding records as we go. */
+static void redraw_scrollback_row(struct scrollback_row * row, int y) {
+	int x = 0;
+	for (int i = 0; i < row->encoded && x < term_width; ++i) {
+		term_cell_t * cell = &row->cells[i];
+		if (cell->c == 0) {
+			for (uint32_t j = 0; j < cell->fg && x < term_width; ++j, ++x) {
+				term_write_char(' ', x * char_width, y * char_height, TERM_DEFAULT_FG, TERM_DEFAULT_BG, TERM_DEFAULT_FLAGS);
+			}
+		} else {
+			term_write_char(cell->c, x * char_width, y * char_height, cell->fg, cell->bg, cell->flags);
+			x++;
+		}
+	}
+	for (; x < term_width; ++x) {
+		term_write_char(' ', x * char_width, y * char_height, TERM_DEFAULT_FG, TERM_DEFAULT_BG, TERM_DEFAULT_FLAGS);
+	}
 }
 
 /* Draw the scrollback. */
@@ -1206,59 +1440,14 @@ static void redraw_scrollback(void) {
 				}
 			}
 		}
+	}
 
-		node_t * node = scrollback_list->tail;
-		for (int i = 0; i < scrollback_offset; ++i) {
-			struct scrollback_row * row = (struct scrollback_row *)node->value;
-
-			int y = scrollback_offset - 1 - i;
-			int width = row->width;
-			if (width > term_width) {
-				width = term_width;
-			} else {
-				for (int x = row->width; x < term_width; ++x) {
-					term_write_char(' ', x * char_width, y * char_height, TERM_DEFAULT_FG, TERM_DEFAULT_BG, TERM_DEFAULT_FLAGS);
-				}
-			}
-			for (int x = 0; x < width; ++x) {
-				term_cell_t * cell = &row->cells[x];
-				if (((uint32_t *)cell)[0] == 0x00000000) {
-					term_write_char(' ', x * char_width, y * char_height, TERM_DEFAULT_FG, TERM_DEFAULT_BG, TERM_DEFAULT_FLAGS);
-				} else {
-					term_write_char(cell->c, x * char_width, y * char_height, cell->fg, cell->bg, cell->flags);
-				}
-			}
-
-			node = node->prev;
-		}
-	} else {
-		node_t * node = scrollback_list->tail;
-		for (int i = 0; i < scrollback_offset - term_height; ++i) {
-			node = node->prev;
-		}
-		for (int i = scrollback_offset - term_height; i < scrollback_offset; ++i) {
-			struct scrollback_row * row = (struct scrollback_row *)node->value;
-
-			int y = scrollback_offset - 1 - i;
-			int width = row->width;
-			if (width > term_width) {
-				width = term_width;
-			} else {
-				for (int x = row->width; x < term_width; ++x) {
-					term_write_char(' ', x * char_width, y * char_height, TERM_DEFAULT_FG, TERM_DEFAULT_BG, TERM_DEFAULT_FLAGS);
-				}
-			}
-			for (int x = 0; x < width; ++x) {
-				term_cell_t * cell = &row->cells[x];
-				if (((uint32_t *)cell)[0] == 0x00000000) {
-					term_write_char(' ', x * char_width, y * char_height, TERM_DEFAULT_FG, TERM_DEFAULT_BG, TERM_DEFAULT_FLAGS);
-				} else {
-					term_write_char(cell->c, x * char_width, y * char_height, cell->fg, cell->bg, cell->flags);
-				}
-			}
-
-			node = node->prev;
-		}
+	/* Any viewport into the history is an O(1) slice of the ring. */
+	int first = (scrollback_offset < term_height) ? 0 : scrollback_offset - term_height;
+	for (int i = first; i < scrollback_offset; ++i) {
+		struct scrollback_row * row = scrollback_row_back(i + 1);
+		if (!row) continue;
+		redraw_scrollback_row(row, scrollback_offset - 1 - i);
 	}
 	display_flip();
 }
@@ -1268,18 +1457,20 @@ static void redraw_scrollback(void) {
  * Parses some things (\n\r, etc.) itself that should probably
  * be moved into the ANSI library.
  */
-static void term_write(char c) {
+/*
+ * One character of the write path, without any cursor work; the
+ * wrappers below un-draw the cursor before and re-draw it after, once
+ * per call rather than once per character.
+ */
+static void term_write_one(char c) {
 	static uint32_t unicode_state = 0;
 	static uint32_t codepoint = 0;
 
-	cell_redraw(csr_x, csr_y);
-
 	if (!decode(&unicode_state, &codepoint, (uint8_t)c)) {
 		uint32_t o = codepoint;
 		codepoint = 0;
 		if (c == '\r') {
 			csr_x = 0;
-			draw_cursor();
 			return;
 		}
 		if (csr_x < 0) csr_x = 0;
@@ -1301,7 +1492,6 @@ static void term_write(char c) {
 				term_scroll(1);
 				csr_y = term_height - 1;
 			}
-			draw_cursor();
 		} else if (c == '\007') {
 			/* bell */
 			/* XXX play sound */
@@ -1310,10 +1500,8 @@ static void term_write(char c) {
 				--csr_x;
 			}
 			cell_redraw(csr_x, csr_y);
-			draw_cursor();
 		} else if (c == '\t') {
 			csr_x += (8 - csr_x % 8);
-			draw_cursor();
 		} else {
 			int wide = is_wide(o);
 			uint8_t flags = ansi_state->flags;
@@ -1324,13 +1512,18 @@ static void term_write(char c) {
 			if (wide) {
 				flags = flags | ANSI_WIDE;
 			}
-			cell_set(csr_x,csr_y, o, current_fg, current_bg, flags);
-			cell_redraw(csr_x,csr_y);
+			/* Skip the repaint when the cell didn't change - unless a
+			 * selection is active, since selected cells are drawn
+			 * inverted and the grid doesn't record that. */
+			if (cell_set(csr_x,csr_y, o, current_fg, current_bg, flags) || selection) {
+				cell_redraw(csr_x,csr_y);
+			}
 			csr_x++;
 			if (wide && csr_x != term_width) {
-				cell_set(csr_x, csr_y, 0xFFFF, current_fg, current_bg, ansi_state->flags);
-				cell_redraw(csr_x,csr_y);
-				cell_redraw(csr_x-1,csr_y);
+				if (cell_set(csr_x, csr_y, 0xFFFF, current_fg, current_bg, ansi_state->flags) || selection) {
+					cell_redraw(csr_x,csr_y);
+					cell_redraw(csr_x-1,csr_y);
+				}
 				csr_x++;
 			}
 		}
@@ -1338,6 +1531,21 @@ static void term_write(char c) {
 		unicode_state = 0;
 		codepoint = 0;
 	}
+}
+
+/* ANSI callback for writing a single character. */
+static void term_write(char c) {
+	cell_redraw(csr_x, csr_y);
+	term_write_one(c);
+	draw_cursor();
+}
+
+/* ANSI callback for writing a run of plain characters at once. */
+static void term_write_span(const char * buf, size_t len) {
+	cell_redraw(csr_x, csr_y);
+	for (size_t i = 0; i < len; ++i) {
+		term_write_one(buf[i]);
+	}
 	draw_cursor();
 }
 
@@ -1400,8 +1608,13 @@ static void term_redraw_cursor() {
 
 /* ANSI callback to set a cell to a codepoint (only ever used to set spaces) */
 static void term_set_cell(int x, int y, uint32_t c) {
-	cell_set(x, y, c, current_fg, current_bg, ansi_state->flags);
-	cell_redraw(x, y);
+	int changed = cell_set(x, y, c, current_fg, current_bg, ansi_state->flags);
+	/* The cursor cell and selected cells are drawn with effects the
+	 * grid doesn't record, so a value match doesn't mean the pixels
+	 * match there. */
+	if (changed || (x == csr_x && y == csr_y) || selection) {
+		cell_redraw(x, y);
+	}
 }
 
 /* ANSI callback to clear the terminal. */
@@ -1478,6 +1691,7 @@ term_callbacks_t term_callbacks = {
 	term_set_csr_show,
 	term_switch_buffer,
 	insert_delete_lines,
+	term_write_span,
 };
 
 static void handle_input(char c) {
@@ -1503,7 +1717,7 @@ static void handle_input_s(char * c) {
 /* Scroll the view up (scrollback) */
 static void scroll_up(int amount) {
 	int i = 0;
-	while (i < amount && scrollback_list && scrollback_offset < (int)scrollback_list->length) {
+	while (i < amount && scrollback_offset < (int)scrollback_count) {
 		scrollback_offset ++;
 		i++;
 	}
@@ -1513,7 +1727,7 @@ static void scroll_up(int amount) {
 /* Scroll the view down (scrollback) */
 void scroll_down(int amount) {
 	int i = 0;
-	while (i < amount && scrollback_list && scrollback_offset != 0) {
+	while (i < amount && scrollback_offset != 0) {
 		scrollback_offset -= 1;
 		i++;
 	}
@@ -1694,8 +1908,8 @@ static void key_event(int ret, key_event_t * event) {
 				break;
 			case KEY_HOME:
 				if (event->modifiers & KEY_MOD_LEFT_SHIFT) {
-					if (scrollback_list) {
-						scrollback_offset = scrollback_list->length;
+					if (scrollback_count) {
+						scrollback_offset = scrollback_count;
 						redraw_scrollback();
 					}
 				} else {
@@ -1826,6 +2040,11 @@ static void reinit(void) {
 		term_buffer = term_buffer_a;
 	}
 
+	if (row_dirty) free(row_dirty);
+	row_dirty = calloc((term_height + 63) / 64, sizeof(uint64_t));
+	pending_scroll = 0;
+	dirty_row_count = 0;
+
 	/* Reset the ANSI library, ensuring we keep certain values */
 	int old_mouse_state = 0;
 	if (ansi_state) old_mouse_state = ansi_state->mouse_on;
@@ -2214,6 +2433,8 @@ static void _menu_action_set_scale(struct MenuEntry * self) {
 
 int main(int argc, char ** argv) {
 
+	init_resolved_colors();
+
 	window_width  = char_width * 80;
 	window_height = char_height * 24;
 
@@ -2376,7 +2597,7 @@ int main(int argc, char ** argv) {
 	menu_insert(m, menu_create_normal("star","star","About Terminal", _menu_action_show_about));
 	menu_set_insert(terminal_menu_bar.set, "help", m);
 
-	scrollback_list = list_create();
+	scrollback_ring = calloc(MAX_SCROLLBACK, sizeof(struct scrollback_row *));
 	images_list = list_create();
 
 	/* Initialize the graphics context */
@@ -2457,8 +2678,8 @@ int main(int argc, char ** argv) {
 			if (res[1]) {
 				/* Read from PTY */
 				int r = read(fd_master, buf, 4096);
-				for (int i = 0; i < r; ++i) {
-					ansi_put(ansi_state, buf[i]);
+				if (r > 0) {
+					ansi_put_bytes(ansi_state, (char *)buf, r);
 				}
 				display_flip();
 			}
@@ -0,0 +1,212 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ * This file is part of ToaruOS and is released under the terms
+ * of the NCSA / University of Illinois License - see LICENSE.md
+ * Copyright (C) 2018 K. Lange
+ *
+ * top
+ *
+ * periodically display processes sorted by CPU usage
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pwd.h>
+
+#include <kernel/procdata.h>
+
+#define MAX_PROCS 256
+
+struct sample {
+	int pid;
+	int uid;
+	int mem_permille;
+	int vsz;
+	unsigned long cpu_ms;  /* utime + stime at sample time */
+	int cpu_permille;      /* computed against previous sample */
+	char name[64];
+};
+
+static struct sample current[MAX_PROCS];
+static struct sample previous[MAX_PROCS];
+static int current_count = 0;
+static int previous_count = 0;
+
+static int delay = 1;
+
+/*
+ * Pull TotalMsec out of /proc/cpu so we have a wall-clock
+ * denominator for the usage deltas.
+ */
+static unsigned long read_total_ms(void) {
+	FILE * f = fopen("/proc/cpu", "r");
+	if (!f) return 0;
+
+	unsigned long out = 0;
+	char line[256];
+	while (fgets(line, 256, f) != NULL) {
+		char * tab = strstr(line, "\t");
+		if (!tab) continue;
+		*tab = '\0';
+		if (!strcmp(line, "TotalMsec:")) {
+			out = strtoul(tab + 1, NULL, 10);
+		}
+	}
+
+	fclose(f);
+	return out;
+}
+
+static int read_process(struct dirent * dent, struct sample * out) {
+	char tmp[256];
+	struct procfs_status_bin status;
+
+	sprintf(tmp, "/proc/%s/status_bin", dent->d_name);
+	FILE * f = fopen(tmp, "r");
+	if (!f) return 0;
+
+	size_t r = fread(&status, 1, sizeof(status), f);
+	fclose(f);
+
+	if (r < sizeof(status) || status.version != PROCFS_BIN_VERSION) return 0;
+	if (status.tgid != status.pid) return 0; /* skip threads */
+
+	out->pid = status.pid;
+	out->uid = status.uid;
+	out->mem_permille = status.mem_permille;
+	out->vsz = status.vm_size_kb;
+	out->cpu_ms = (unsigned long)status.utime_ms + (unsigned long)status.stime_ms;
+	out->cpu_permille = 0;
+	memcpy(out->name, status.name, sizeof(out->name));
+	out->name[sizeof(out->name)-1] = '\0';
+	return 1;
+}
+
+static struct sample * find_previous(int pid) {
+	for (int i = 0; i < previous_count; ++i) {
+		if (previous[i].pid == pid) return &previous[i];
+	}
+	return NULL;
+}
+
+static int compare_cpu(const void * a, const void * b) {
+	const struct sample * l = a;
+	const struct sample * r = b;
+	if (r->cpu_permille != l->cpu_permille) return r->cpu_permille - l->cpu_permille;
+	return r->mem_permille - l->mem_permille;
+}
+
+static void collect(unsigned long interval_ms) {
+	DIR * dirp = opendir("/proc");
+	if (!dirp) return;
+
+	current_count = 0;
+
+	struct dirent * ent = readdir(dirp);
+	while (ent != NULL) {
+		if (ent->d_name[0] >= '0' && ent->d_name[0] <= '9' && current_count < MAX_PROCS) {
+			if (read_process(ent, &current[current_count])) {
+				struct sample * old = find_previous(current[current_count].pid);
+				if (old && interval_ms) {
+					current[current_count].cpu_permille =
+						1000 * (current[current_count].cpu_ms - old->cpu_ms) / interval_ms;
+					if (current[current_count].cpu_permille > 1000) {
+						current[current_count].cpu_permille = 1000;
+					}
+				}
+				current_count++;
+			}
+		}
+		ent = readdir(dirp);
+	}
+	closedir(dirp);
+
+	qsort(current, current_count, sizeof(struct sample), compare_cpu);
+}
+
+static void display(void) {
+	/* Home the cursor and clear below; repainting in place
+	 * flickers less than clearing the whole screen first. */
+	printf("\033[H");
+	printf("\033[7m%5s %-8s %5s %5s %9s CMD\033[0m\033[K\n", "PID", "USER", "CPU%", "MEM%", "VSZ");
+
+	for (int i = 0; i < current_count; ++i) {
+		struct sample * p = &current[i];
+		struct passwd * pw = getpwuid(p->uid);
+		char user[10];
+		if (pw) {
+			sprintf(user, "%.8s", pw->pw_name);
+		} else {
+			sprintf(user, "%d", p->uid);
+		}
+		endpwent();
+		printf("%5d %-8s %3d.%01d %3d.%01d %9d %s\033[K\n",
+				p->pid, user,
+				p->cpu_permille / 10, p->cpu_permille % 10,
+				p->mem_permille / 10, p->mem_permille % 10,
+				p->vsz, p->name);
+	}
+	printf("\033[J");
+	fflush(stdout);
+}
+
+static void show_usage(char * argv[]) {
+	printf(
+			"top - periodically display processes sorted by CPU usage\n"
+			"\n"
+			"usage: %s [-d delay] [-1]\n"
+			"\n"
+			" -d delay \033[3mseconds between refreshes (default 1)\033[0m\n"
+			" -1       \033[3mcollect two samples, print once, and exit\033[0m\n"
+			" -?       \033[3mshow this help text\033[0m\n"
+			"\n", argv[0]);
+}
+
+int main(int argc, char * argv[]) {
+	int once = 0;
+
+	char c;
+	while ((c = getopt(argc, argv, "d:1?")) != -1) {
+		switch (c) {
+			case 'd':
+				delay = atoi(optarg);
+				if (delay < 1) delay = 1;
+				break;
+			case '1':
+				once = 1;
+				break;
+			case '?':
+				show_usage(argv);
+				return 0;
+		}
+	}
+
+	unsigned long last_ms = read_total_ms();
+	collect(0);
+
+	while (1) {
+		memcpy(previous, current, sizeof(struct sample) * current_count);
+		previous_count = current_count;
+
+		usleep(delay * 1000000);
+
+		unsigned long now_ms = read_total_ms();
+		collect(now_ms - last_ms);
+		last_ms = now_ms;
+
+		display();
+
+		if (once) break;
+	}
+
+	return 0;
+}
+
+/*
+ * vim: tabstop=4
+ * vim: shiftwidth=4
+ * vim: noexpandtab
+ */
@@ -0,0 +1,316 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ * This file is part of ToaruOS and is released under the terms
+ * of the NCSA / University of Illinois License - see LICENSE.md
+ * Copyright (C) 2018 K. Lange
+ *
+ * trace-viewer - Record scheduler trace events and draw a timeline
+ *
+ * Turns on the kernel scheduler trace (/proc/trace), records for a
+ * few seconds, then opens a window with one row per process showing
+ * exactly when it held the CPU, when it was made runnable, and when
+ * it went to sleep. Useful for finding out who had the CPU when the
+ * compositor missed a frame.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sched.h>
+
+#include <sys/fswait.h>
+
+#include <toaru/yutani.h>
+#include <toaru/graphics.h>
+#include <toaru/sdf.h>
+
+#define LINE_LEN 4096
+
+#define ROW_HEIGHT   24
+#define LABEL_WIDTH  120
+#define MAX_ROWS     20
+
+/* Must match struct trace_event in the kernel. */
+struct event {
+	uint64_t timestamp; /* monotonic nanoseconds */
+	int32_t  pid;
+	uint32_t event;
+};
+
+#define EVENT_SWITCH 1
+#define EVENT_READY  2
+#define EVENT_SLEEP  3
+
+static struct event * events = NULL;
+static size_t event_count = 0;
+
+struct row {
+	int32_t pid;
+	uint64_t cpu_ns;
+	char name[100];
+};
+
+static struct row rows[MAX_ROWS];
+static int row_count = 0;
+
+static yutani_t * yctx;
+static yutani_window_t * window;
+static gfx_context_t * ctx;
+static int should_exit = 0;
+
+static int record(int duration) {
+	int fd = open("/proc/trace", O_RDWR);
+	if (fd < 0) {
+		fprintf(stderr, "trace-viewer: /proc/trace: not available\n");
+		return 1;
+	}
+
+	/* Throw away anything left over from an earlier run. */
+	char scratch[4096];
+	while (read(fd, scratch, sizeof(scratch)) > 0);
+
+	write(fd, "1", 1);
+
+	size_t space = 4096;
+	events = malloc(space * sizeof(struct event));
+
+	for (int elapsed = 0; elapsed < duration * 2; ++elapsed) {
+		usleep(500000);
+		ssize_t r;
+		while ((r = read(fd, &events[event_count], (space - event_count) * sizeof(struct event))) > 0) {
+			event_count += r / sizeof(struct event);
+			if (event_count == space) {
+				space *= 2;
+				events = realloc(events, space * sizeof(struct event));
+			}
+		}
+	}
+
+	write(fd, "0", 1);
+	close(fd);
+
+	if (event_count < 2) {
+		fprintf(stderr, "trace-viewer: no events recorded\n");
+		return 1;
+	}
+	return 0;
+}
+
+static void fetch_name(struct row * row) {
+	sprintf(row->name, "pid %d", row->pid);
+	char tmp[256];
+	sprintf(tmp, "/proc/%d/status", row->pid);
+	FILE * f = fopen(tmp, "r");
+	if (!f) return;
+	char line[LINE_LEN];
+	while (fgets(line, LINE_LEN, f) != NULL) {
+		char * nl = strstr(line, "\n");
+		if (nl) *nl = '\0';
+		char * tab = strstr(line, "\t");
+		if (!tab) continue;
+		*tab = '\0';
+		if (!strcmp(line, "Name:")) {
+			sprintf(row->name, "%s (%d)", tab + 1, row->pid);
+			break;
+		}
+	}
+	fclose(f);
+}
+
+static int row_compare(const void * a, const void * b) {
+	uint64_t l = ((const struct row *)a)->cpu_ns;
+	uint64_t r = ((const struct row *)b)->cpu_ns;
+	if (l > r) return -1;
+	if (l < r) return 1;
+	return 0;
+}
+
+/*
+ * Pick the processes that ran the most; everything else is left off
+ * the timeline rather than shrinking the rows into unreadability.
+ */
+static void build_rows(void) {
+	struct row all[256];
+	int count = 0;
+
+	int32_t owner = -1;
+	uint64_t owner_since = events[0].timestamp;
+	for (size_t i = 0; i < event_count; ++i) {
+		if (events[i].event != EVENT_SWITCH) continue;
+		if (owner >= 0) {
+			for (int j = 0; j <= count; ++j) {
+				if (j == count) {
+					if (count == 256) break;
+					all[count].pid = owner;
+					all[count].cpu_ns = events[i].timestamp - owner_since;
+					count++;
+					break;
+				}
+				if (all[j].pid == owner) {
+					all[j].cpu_ns += events[i].timestamp - owner_since;
+					break;
+				}
+			}
+		}
+		owner = events[i].pid;
+		owner_since = events[i].timestamp;
+	}
+
+	qsort(all, count, sizeof(struct row), row_compare);
+
+	row_count = count < MAX_ROWS ? count : MAX_ROWS;
+	memcpy(rows, all, row_count * sizeof(struct row));
+	for (int i = 0; i < row_count; ++i) {
+		fetch_name(&rows[i]);
+	}
+}
+
+static int row_for_pid(int32_t pid) {
+	for (int i = 0; i < row_count; ++i) {
+		if (rows[i].pid == pid) return i;
+	}
+	return -1;
+}
+
+static uint32_t pid_color(int32_t pid) {
+	return rgb(70 + (pid * 73) % 160, 70 + (pid * 131) % 160, 70 + (pid * 37) % 160);
+}
+
+static void redraw(void) {
+	int width = window->width;
+	int height = window->height;
+
+	draw_fill(ctx, rgb(30, 30, 30));
+
+	uint64_t t0 = events[0].timestamp;
+	uint64_t t1 = events[event_count-1].timestamp;
+	if (t1 == t0) t1 = t0 + 1;
+	int span = width - LABEL_WIDTH;
+
+	for (int i = 0; i < row_count; ++i) {
+		int y = i * ROW_HEIGHT;
+		if (y + ROW_HEIGHT > height) break;
+		draw_sdf_string(ctx, 4, y + 4, rows[i].name, 14, rgb(220, 220, 220), SDF_FONT_THIN);
+		draw_line(ctx, LABEL_WIDTH, width, y + ROW_HEIGHT - 1, y + ROW_HEIGHT - 1, rgb(60, 60, 60));
+	}
+
+	/* CPU ownership bars */
+	int32_t owner = -1;
+	uint64_t owner_since = t0;
+	for (size_t i = 0; i < event_count; ++i) {
+		struct event * e = &events[i];
+		int x = LABEL_WIDTH + (e->timestamp - t0) * span / (t1 - t0);
+
+		if (e->event == EVENT_SWITCH) {
+			int row = row_for_pid(owner);
+			if (row >= 0) {
+				int sx = LABEL_WIDTH + (owner_since - t0) * span / (t1 - t0);
+				int w = x - sx;
+				if (w < 1) w = 1;
+				draw_rectangle_solid(ctx, sx, row * ROW_HEIGHT + 4, w, ROW_HEIGHT - 8, pid_color(owner));
+			}
+			owner = e->pid;
+			owner_since = e->timestamp;
+		} else {
+			int row = row_for_pid(e->pid);
+			if (row < 0) continue;
+			/* Wakeups tick up from the row line, sleeps tick down. */
+			int base = row * ROW_HEIGHT;
+			if (e->event == EVENT_READY) {
+				draw_line(ctx, x, x, base + 2, base + 8, rgb(120, 220, 120));
+			} else if (e->event == EVENT_SLEEP) {
+				draw_line(ctx, x, x, base + ROW_HEIGHT - 8, base + ROW_HEIGHT - 2, rgb(220, 120, 120));
+			}
+		}
+	}
+
+	flip(ctx);
+	yutani_flip(yctx, window);
+}
+
+void show_usage(int argc, char * argv[]) {
+	printf(
+			"trace-viewer - record and display a scheduler timeline\n"
+			"\n"
+			"usage: %s [-d seconds]\n"
+			"\n"
+			" -d     \033[3mhow long to record for (default 3)\033[0m\n"
+			" -?     \033[3mshow this help text\033[0m\n"
+			"\n", argv[0]);
+}
+
+int main(int argc, char * argv[]) {
+	int duration = 3;
+
+	int c;
+	while ((c = getopt(argc, argv, "d:?")) != -1) {
+		switch (c) {
+			case 'd':
+				duration = atoi(optarg);
+				break;
+			case '?':
+				show_usage(argc, argv);
+				return 0;
+		}
+	}
+
+	if (duration < 1) {
+		show_usage(argc, argv);
+		return 1;
+	}
+
+	if (record(duration)) return 1;
+	build_rows();
+
+	yctx = yutani_init();
+	if (!yctx) {
+		fprintf(stderr, "%s: failed to connect to compositor\n", argv[0]);
+		return 1;
+	}
+
+	window = yutani_window_create(yctx, 800, row_count * ROW_HEIGHT);
+	yutani_window_move(yctx, window, 100, 100);
+	yutani_window_advertise_icon(yctx, window, "trace-viewer", "trace-viewer");
+
+	ctx = init_graphics_yutani_double_buffer(window);
+	redraw();
+
+	while (!should_exit) {
+		int fds[1] = {fileno(yctx->sock)};
+		int index = fswait2(1, fds, 200);
+		if (index != 0) continue;
+		yutani_msg_t * m = yutani_poll(yctx);
+		while (m) {
+			switch (m->type) {
+				case YUTANI_MSG_KEY_EVENT:
+					{
+						struct yutani_msg_key_event * ke = (void*)m->data;
+						if (ke->event.action == KEY_ACTION_DOWN && ke->event.keycode == 'q') {
+							should_exit = 1;
+							sched_yield();
+						}
+					}
+					break;
+				case YUTANI_MSG_WINDOW_MOUSE_EVENT:
+					{
+						struct yutani_msg_window_mouse_event * me = (void*)m->data;
+						if (me->command == YUTANI_MOUSE_EVENT_DOWN && me->buttons & YUTANI_MOUSE_BUTTON_LEFT) {
+							yutani_window_drag_start(yctx, window);
+						}
+					}
+					break;
+				case YUTANI_MSG_WINDOW_CLOSE:
+				case YUTANI_MSG_SESSION_END:
+					should_exit = 1;
+					break;
+				default:
+					break;
+			}
+			free(m);
+			m = yutani_poll_async(yctx);
+		}
+	}
+
+	yutani_close(yctx, window);
+	return 0;
+}
@@ -27,6 +27,7 @@ void show_usage(int argc, char * argv[]) {
 			"\n"
 			" -r     \033[3mprint display resoluton\033[0m\n"
 			" -e     \033[3mask compositor to reload extensions\033[0m\n"
+			" -l     \033[3mprint input latency histograms\033[0m\n"
 			" -?     \033[3mshow this help text\033[0m\n"
 			"\n", argv[0]);
 }
@@ -49,10 +50,37 @@ int reload(void) {
 	return 0;
 }
 
+static void print_histogram(const char * label, const uint32_t * hist) {
+	printf("%s:\n", label);
+	for (int i = 0; i < YUTANI_LATENCY_BUCKETS; ++i) {
+		if (!hist[i]) continue;
+		if (i == 0) {
+			printf("  <1ms: %u\n", hist[i]);
+		} else {
+			printf("  %d-%dms: %u\n", 1 << (i - 1), (1 << i) - 1, hist[i]);
+		}
+	}
+}
+
+int show_latency(void) {
+	if (!yctx) {
+		if (!quiet) printf("(not connected)\n");
+		return 1;
+	}
+	yutani_special_request(yctx, NULL, YUTANI_SPECIAL_REQUEST_LATENCY_STATS);
+	yutani_msg_t * m = yutani_wait_for(yctx, YUTANI_MSG_LATENCY_STATS);
+	struct yutani_msg_latency_stats * ls = (void *)m->data;
+	printf("%u input events\n", ls->input_events);
+	print_histogram("device to compositor", ls->queue_hist);
+	print_histogram("device to presentation", ls->present_hist);
+	free(m);
+	return 0;
+}
+
 int main(int argc, char * argv[]) {
 	yctx = yutani_init();
 	int opt;
-	while ((opt = getopt(argc, argv, "?qre")) != -1) {
+	while ((opt = getopt(argc, argv, "?qrel")) != -1) {
 		switch (opt) {
 			case 'q':
 				quiet = 1;
@@ -63,6 +91,8 @@ int main(int argc, char * argv[]) {
 				return show_resolution();
 			case 'e':
 				return reload();
+			case 'l':
+				return show_latency();
 
 			case '?':
 				show_usage(argc,argv);
@@ -75,6 +105,8 @@ int main(int argc, char * argv[]) {
 			return show_resolution();
 		} else if (!strcmp(argv[optind], "reload")) {
 			return reload();
+		} else if (!strcmp(argv[optind], "latency")) {
+			return show_latency();
 		} else {
 			fprintf(stderr, "%s: unsupported command: %s\n", argv[0], argv[optind]);
 			return 1;
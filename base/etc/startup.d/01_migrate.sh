@@ -1,4 +1,5 @@
 #!/bin/sh
+# needs: 00_startuplog.sh
 
 if not kcmdline -q migrate then exit 0
 
@@ -1,4 +1,5 @@
 #!/bin/sh
+# needs: 01_migrate.sh
 
 export-cmd HOSTNAME cat /etc/hostname
 
@@ -1,4 +1,5 @@
 #!/bin/sh
+# needs: 01_migrate.sh
 
 echo -n "Mounting tmpfs..." > /dev/pex/splash
 mount tmpfs tmp,777 /tmp
@@ -1,4 +1,5 @@
 #!/bin/sh
+# needs: 01_migrate.sh
 
 if not stat -Lq /dev/cdrom0 then exit 0
 
@@ -1,4 +1,5 @@
 #!/bin/sh
+# needs: 01_migrate.sh
 
 # Only start if we're likely to be running a GUI
 export-cmd START kcmdline -g start
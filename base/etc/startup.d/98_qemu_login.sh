@@ -1,4 +1,5 @@
 #!/bin/sh
+# needs: 03_tmpfs.sh 04_mountcd.sh 91_font_server.sh
 
 if not qemu-fwcfg -q opt/org.toaruos.forceuser then exit 0
 
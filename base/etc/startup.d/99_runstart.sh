@@ -1,4 +1,5 @@
 #!/bin/sh
+# needs: 02_hostname.sh 03_tmpfs.sh 04_mountcd.sh 90_qemu_hack.sh 91_font_server.sh 98_qemu_login.sh
 
 export-cmd START kcmdline -g start
 
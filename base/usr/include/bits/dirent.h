@@ -10,9 +10,14 @@ typedef struct dirent {
 	char d_name[256];
 } dirent;
 
+#define _DIRENTS_BUFFERED 16
+
 typedef struct DIR {
 	int fd;
 	int cur_entry;
+	int buf_count;
+	int buf_pos;
+	struct dirent buffer[_DIRENTS_BUFFERED];
 } DIR;
 
 DIR * opendir (const char * dirname);
@@ -16,6 +16,7 @@ _Begin_C_Header
 #define O_PATH       0x2000
 #define O_NONBLOCK   0x4000
 #define O_DIRECTORY  0x8000
+#define O_SYNC      0x10000
 
 #define F_GETFD 1
 #define F_SETFD 2
@@ -43,8 +44,16 @@ struct flock {
 
 #define FD_CLOEXEC (1 << 0)
 
+#define POSIX_FADV_NORMAL     0
+#define POSIX_FADV_RANDOM     1
+#define POSIX_FADV_SEQUENTIAL 2
+#define POSIX_FADV_WILLNEED   3
+#define POSIX_FADV_DONTNEED   4
+#define POSIX_FADV_NOREUSE    5
+
 extern int open (const char *, int, ...);
 extern int chmod(const char *path, mode_t mode);
 extern int fcntl(int fd, int cmd, ...);
+extern int posix_fadvise(int fd, off_t offset, off_t len, int advice);
 
 _End_C_Header
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <kernel/types.h>
+
+#define AIO_OP_READ  0
+#define AIO_OP_WRITE 1
+
+/* Submission entry for aio_submit. Writes are captured at submit
+ * time, so the buffer may be reused immediately; read buffers must
+ * stay valid until the completion has been reaped. */
+struct aio_request {
+	int fd;
+	int op;
+	void * buffer;
+	uint64_t offset;
+	uint32_t length;
+};
+
+/* Completion entry returned by aio_reap */
+struct aio_completion {
+	int id;      /* As returned by aio_submit */
+	int result;  /* Bytes transferred, or -errno */
+};
+
+#ifdef _KERNEL_
+#include <kernel/fs.h>
+extern int aio_submit(fs_node_t * node, int op, uint64_t offset, uint32_t length, void * buffer);
+extern int aio_reap(struct aio_completion * out, int max, int wait);
+extern void aio_flush_process(pid_t pid);
+#else
+extern int aio_submit(struct aio_request * req);
+extern int aio_reap(struct aio_completion * out, int max, int wait);
+#endif
@@ -7,6 +7,7 @@
 typedef struct {
 	unsigned char *data;
 	size_t size;
+	size_t hint; /* No unset bit below this index */
 } bitset_t;
 
 void bitset_init(bitset_t *set, size_t size);
@@ -16,4 +17,8 @@ void bitset_clear(bitset_t *set, size_t bit);
 int bitset_test(bitset_t *set, size_t bit);
 /* Find first unset bit */
 int bitset_ffub(bitset_t *set);
-
+/* Set or clear [bit, bit + count) */
+void bitset_set_range(bitset_t *set, size_t bit, size_t count);
+void bitset_clear_range(bitset_t *set, size_t bit, size_t count);
+/* Number of set bits */
+size_t bitset_count(bitset_t *set);
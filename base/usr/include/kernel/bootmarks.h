@@ -0,0 +1,13 @@
+#pragma once
+
+#include <kernel/types.h>
+
+typedef struct {
+	uint64_t tsc;        /* RDTSC value when the marker was recorded */
+	const char * name;   /* Phase name; must point at storage that outlives boot */
+	const char * extra;  /* Optional qualifier (eg. a module name), or NULL */
+} boot_mark_t;
+
+extern void boot_marker(const char * name);
+extern void boot_marker_extra(const char * name, const char * extra);
+extern size_t bootmarks_dump(char * buffer, size_t size);
@@ -166,6 +166,7 @@ typedef struct ext2_dir ext2_dir_t;
 typedef struct {
 	uint32_t block_no;
 	uint32_t last_use;
+	uint32_t dirty_since; /* timer_ticks when the entry was first marked dirty */
 	uint8_t  dirty;
 	uint8_t *block;
 } ext2_disk_cache_entry_t;
@@ -19,6 +19,15 @@
 #define O_PATH       0x2000
 #define O_NONBLOCK   0x4000
 #define O_DIRECTORY  0x8000
+#define O_SYNC      0x10000
+
+/* posix_fadvise access pattern hints; stored per descriptor */
+#define POSIX_FADV_NORMAL     0
+#define POSIX_FADV_RANDOM     1
+#define POSIX_FADV_SEQUENTIAL 2
+#define POSIX_FADV_WILLNEED   3
+#define POSIX_FADV_DONTNEED   4
+#define POSIX_FADV_NOREUSE    5
 
 #define FS_FILE        0x01
 #define FS_DIRECTORY   0x02
@@ -27,6 +36,7 @@
 #define FS_PIPE        0x10
 #define FS_SYMLINK     0x20
 #define FS_MOUNTPOINT  0x40
+#define FS_CACHEABLE   0x80 /* Contents may be served from the VFS buffer cache */
 
 #define _IFMT       0170000 /* type of file */
 #define     _IFDIR  0040000 /* directory */
@@ -38,12 +48,15 @@
 #define     _IFIFO  0010000 /* fifo */
 
 struct fs_node;
+struct iovec;
 
 typedef uint32_t (*read_type_t) (struct fs_node *, uint64_t, uint32_t, uint8_t *);
 typedef uint32_t (*write_type_t) (struct fs_node *, uint64_t, uint32_t, uint8_t *);
+typedef uint32_t (*writev_type_t) (struct fs_node *, uint64_t, int, const struct iovec *);
 typedef void (*open_type_t) (struct fs_node *, unsigned int flags);
 typedef void (*close_type_t) (struct fs_node *);
 typedef struct dirent *(*readdir_type_t) (struct fs_node *, uint32_t);
+typedef int (*readdir_n_type_t) (struct fs_node *, uint32_t, struct dirent *, int);
 typedef struct fs_node *(*finddir_type_t) (struct fs_node *, char *name);
 typedef int (*create_type_t) (struct fs_node *, char *name, uint16_t permission);
 typedef int (*unlink_type_t) (struct fs_node *, char *name);
@@ -57,6 +70,7 @@ typedef int (*selectcheck_type_t) (struct fs_node *);
 typedef int (*selectwait_type_t) (struct fs_node *, void * process);
 typedef int (*chown_type_t) (struct fs_node *, int, int);
 typedef void (*truncate_type_t) (struct fs_node *);
+typedef int (*fsync_type_t) (struct fs_node *);
 
 typedef struct fs_node {
 	char name[256];         /* The filename. */
@@ -81,6 +95,7 @@ typedef struct fs_node {
 	open_type_t open;
 	close_type_t close;
 	readdir_type_t readdir;
+	readdir_n_type_t readdir_n;
 	finddir_type_t finddir;
 	create_type_t create;
 	mkdir_type_t mkdir;
@@ -100,6 +115,13 @@ typedef struct fs_node {
 	selectwait_type_t selectwait;
 
 	chown_type_t chown;
+
+	writev_type_t writev;  /* Optional gathering write; see writev_fs */
+
+	uint64_t last_read_offset; /* End of the most recent read; drivers use this to detect sequential access */
+
+	fsync_type_t fsync;    /* Optional; push this file's buffered writes to backing storage */
+	uint8_t written;       /* Set by write_fs; written nodes are flushed on close */
 } fs_node_t;
 
 struct dirent {
@@ -139,9 +161,13 @@ extern int pty_create(void *size, fs_node_t ** fs_master, fs_node_t ** fs_slave)
 int has_permission(fs_node_t *node, int permission_bit);
 uint32_t read_fs(fs_node_t *node, uint64_t offset, uint32_t size, uint8_t *buffer);
 uint32_t write_fs(fs_node_t *node, uint64_t offset, uint32_t size, uint8_t *buffer);
+uint32_t readv_fs(fs_node_t *node, uint64_t offset, int count, const struct iovec *iov);
+uint32_t writev_fs(fs_node_t *node, uint64_t offset, int count, const struct iovec *iov);
 void open_fs(fs_node_t *node, unsigned int flags);
+void vfs_ref(fs_node_t *node);
 void close_fs(fs_node_t *node);
 struct dirent *readdir_fs(fs_node_t *node, uint32_t index);
+int readdir_n_fs(fs_node_t *node, uint32_t index, struct dirent *out, int count);
 fs_node_t *finddir_fs(fs_node_t *node, char *name);
 int mkdir_fs(char *name, uint16_t permission);
 int create_file_fs(char *name, uint16_t permission);
@@ -157,12 +183,16 @@ int readlink_fs(fs_node_t * node, char * buf, size_t size);
 int selectcheck_fs(fs_node_t * node);
 int selectwait_fs(fs_node_t * node, void * process);
 void truncate_fs(fs_node_t * node);
+int fsync_fs(fs_node_t * node);
 
 void vfs_install(void);
+void vfs_cache_invalidate(fs_node_t * node);
+void vfs_dentry_invalidate(fs_node_t * parent, char * name);
 void * vfs_mount(char * path, fs_node_t * local_root);
 typedef fs_node_t * (*vfs_mount_callback)(char * arg, char * mount_point);
 int vfs_register(char * name, vfs_mount_callback callback);
 int vfs_mount_type(char * type, char * arg, char * mountpoint);
+size_t vfs_bootopens_dump(char * buf, size_t bufsize);
 void vfs_lock(fs_node_t * node);
 
 /* Debug purposes only, please */
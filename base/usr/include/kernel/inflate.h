@@ -0,0 +1,34 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ * This file is part of ToaruOS and is released under the terms
+ * of the NCSA / University of Illinois License - see LICENSE.md
+ *
+ * Kernel interface to the DEFLATE/gzip decompressor; see
+ * toaru/inflate.h for the userspace equivalent.
+ */
+
+#pragma once
+
+#include <kernel/types.h>
+
+struct huff_ring;
+
+struct inflate_context {
+
+	/* Consumer-private pointers for input/output storage */
+	void * input_priv;
+	void * output_priv;
+
+	/* Methods for reading / writing from the input / output */
+	uint8_t (*get_input)(struct inflate_context * ctx);
+	void (*write_output)(struct inflate_context * ctx, unsigned int sym);
+
+	/* Bit reservoir holding the next unconsumed input bits */
+	uint32_t bit_buffer;
+	int buffer_size;
+
+	/* Output ringbuffer for backwards lookups */
+	struct huff_ring * ring;
+};
+
+extern int deflate_decompress(struct inflate_context * ctx);
+extern int gzip_decompress(struct inflate_context * ctx);
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <kernel/system.h>
+#include <kernel/ringbuffer.h>
 
 struct ethernet_packet {
 	uint8_t destination[6];
@@ -91,6 +92,8 @@ struct tcp_check_header {
 	uint8_t  tcp_header[];
 };
 
+#define AF_INET 2
+
 #define SOCK_STREAM 1
 #define SOCK_DGRAM 2
 
@@ -128,34 +131,39 @@ extern uint32_t ip_aton(const char * in);
 extern void ip_ntoa(uint32_t src_addr, char * out);
 extern uint16_t calculate_ipv4_checksum(struct ipv4_packet * p);
 uint16_t calculate_tcp_checksum(struct tcp_check_header * p, struct tcp_header * h, void * d, size_t d_words);
+/* Recompute a checksum after rewriting one 16-bit field; network order */
+uint16_t checksum_update(uint16_t check, uint16_t old_field, uint16_t new_field);
 
 struct tcp_socket {
 	list_t* is_connected;
 	uint32_t seq_no;
 	uint32_t ack_no;
 	int status;
+	list_t* unacked;   /* Sent segments awaiting acknowledgement, oldest first */
+	list_t* ooo_queue; /* Received segments ahead of ack_no, awaiting reassembly */
+	uint8_t * tx_buf;  /* Coalescing buffer for short writes, one MSS long */
+	size_t tx_len;     /* Bytes waiting in tx_buf */
+	int nodelay;       /* Send short writes immediately (TCP_NODELAY) */
 };
 
-// Note: for now, not sure what to put in here, so removing from the union to get rid of compiler warnings about empty struct
-// struct udp_socket {
-// };
+struct udp_socket {
+	list_t * packets;     /* Queued datagrams (struct udp_datagram), bounded */
+	list_t * packet_wait; /* recvfrom() sleepers */
+};
 
 struct socket {
 	uint32_t ip;
 	uint8_t  mac[6];
 	uint32_t port_dest;
 	uint32_t port_recv;
-	list_t* packet_queue;
+	ring_buffer_t * rx_ring; /* Fixed receive buffer; free space drives the advertised window */
 	spin_lock_t packet_queue_lock;
-	list_t* packet_wait;
+	spin_lock_t tx_lock; /* Guards the TCP transmit coalescing buffer */
 	int32_t status;
-	size_t bytes_available;
-	size_t bytes_read;
-	void * current_packet;
 	uint32_t sock_type;
 	union {
 		struct tcp_socket tcp_socket;
-		// struct udp_socket udp_socket;
+		struct udp_socket udp_socket;
 	} proto_sock;
 	list_t * alert_waiters;
 };
@@ -181,8 +189,4 @@ struct sockaddr_in {
 	char			sin_zero[8];  // zero this if you want to
 };
 
-typedef struct {
-	uint8_t	*payload;
-	size_t	payload_size;
-} tcpdata_t;
 
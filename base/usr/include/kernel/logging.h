@@ -14,6 +14,9 @@ extern void * debug_file;
 extern void _debug_print(char * title, int line_no, log_type_t level, char *fmt, ...);
 extern void (*debug_hook)(void *, char *);
 extern void (*debug_video_crash)(char **);
+extern void klog_start(void);
+extern size_t klog_dump(char * buf, size_t bufsize);
+extern volatile int klog_in_drain;
 
 #ifndef MODULE_NAME
 #define MODULE_NAME __FILE__
@@ -11,6 +11,8 @@ extern void set_frame(uintptr_t frame_addr);
 extern void clear_frame(uintptr_t frame_addr);
 extern uint32_t test_frame(uintptr_t frame_addr);
 extern uint32_t first_frame(void);
+extern uintptr_t alloc_frames(int n);
+extern void free_frames(uintptr_t address, int n);
 
 extern uintptr_t map_to_physical(uintptr_t virtual);
 
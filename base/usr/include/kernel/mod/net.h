@@ -1,8 +1,28 @@
 #ifndef KERNEL_MOD_NET_H
 #define KERNEL_MOD_NET_H
 
+/*
+ * A received frame, handed up from a driver by reference. The driver
+ * owns the backing storage; the stack calls `release` exactly once when
+ * the payload has been consumed, letting the driver recycle the buffer
+ * (back into its RX pool, ring, or the heap) without an intermediate
+ * copy.
+ */
+struct netbuf {
+	struct ethernet_packet * eth;     /* The frame itself */
+	size_t size;                      /* Frame length in bytes (0 if the driver doesn't track it) */
+	void (*release)(struct netbuf *); /* Return the buffer to the driver */
+	void * extra;                     /* Driver cookie (physical address, ring slot, ...) */
+};
+
+/* One piece of a frame for scatter-gather transmit. */
+struct netif_frag {
+	uint8_t * buf;
+	size_t    len;
+};
+
 typedef uint8_t* (*get_mac_func)(void);
-typedef struct ethernet_packet* (*get_packet_func)(void);
+typedef struct netbuf* (*get_packet_func)(void);
 typedef void (*send_packet_func)(uint8_t*, size_t);
 
 struct netif {
@@ -18,12 +38,36 @@ struct netif {
 	char * driver;
 
 	uint32_t gateway;
+	uint32_t netmask;
 };
 
+typedef int (*netif_poll_func)(int budget);
+typedef void (*netif_irq_enable_func)(void);
+typedef void (*send_frags_func)(struct netif_frag * frags, int count);
+
 extern void init_netif_funcs(get_mac_func mac_func, get_packet_func get_func, send_packet_func send_func, char * device);
+extern void net_poll_install(netif_poll_func poll, netif_irq_enable_func irq_enable);
+extern void net_poll_schedule(void);
+extern void net_install_sendv(send_frags_func send_frags);
+extern struct netbuf * netbuf_wrap(struct ethernet_packet * eth, size_t size);
 extern void net_handler(void * data, char * name);
 extern size_t write_dhcp_packet(uint8_t * buffer);
 
+/*
+ * Socket syscall surface. The syscall table lives in the core kernel
+ * but the protocol implementation is in this module, so the kernel
+ * dispatches through this table once the module installs it. The
+ * kernel side owns fd allocation; the ops work on resolved fs_nodes.
+ */
+struct sockaddr;
+struct netsock_ops {
+	fs_node_t * (*socket)(int domain, int type, int protocol);
+	int (*bind)(fs_node_t * node, const struct sockaddr * addr, size_t addrlen);
+	int (*sendto)(fs_node_t * node, const void * buf, size_t len, const struct sockaddr * addr, size_t addrlen);
+	int (*recvfrom)(fs_node_t * node, void * buf, size_t len, struct sockaddr * addr, size_t * addrlen);
+};
+extern struct netsock_ops * netsock_ops;
+
 extern struct socket* net_open(uint32_t type);
 extern int net_send(struct socket* socket, uint8_t* payload, size_t payload_size, int flags);
 extern size_t net_recv(struct socket* socket, uint8_t* buffer, size_t len);
@@ -28,6 +28,10 @@ typedef struct snd_device {
 	int (*mixer_read)(uint32_t knob_id, uint32_t *val);
 	int (*mixer_write)(uint32_t knob_id, uint32_t val);
 
+	/* Current playback DMA position in samples, for just-in-time
+	 * writers. Optional; may be NULL. */
+	uint32_t (*get_position)(struct snd_device * device);
+
 	uint32_t id;
 } snd_device_t;
 
@@ -15,8 +15,8 @@ struct tmpfs_file {
 	unsigned int ctime;
 	size_t length;
 	size_t block_count;
-	size_t pointers;
-	char ** blocks;
+	size_t pointers;      /* slots in the group table */
+	uint32_t ** blocks;   /* groups of frame numbers, a page's worth each */
 	char * target;
 };
 
@@ -24,6 +24,8 @@ void (* symbol_find(const char * name))(void);
 
 extern int module_quickcheck(void * blob);
 extern void * module_load_direct(void * blob, size_t size);
+extern void * module_load_direct_deferred(void * blob, size_t size);
+extern void modules_run_deferred_inits(void);
 extern void * module_load(char * filename);
 extern void module_unload(char * name);
 extern void modules_install(void);
@@ -14,6 +14,7 @@ typedef struct {
 	int32_t x_difference;
 	int32_t y_difference;
 	mouse_click_t buttons;
+	uint32_t timestamp; /* Milliseconds; when the driver completed the packet */
 } mouse_device_packet_t;
 
 #define MOUSE_MAGIC 0xFEED1234
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * Fixed-layout binary counterparts to the text nodes in procfs,
+ * for collectors that poll frequently and don't want to pay for
+ * formatting and reparsing. Read the whole struct in one go; the
+ * version field identifies the layout and the generation field
+ * changes whenever the payload does, so a poller can skip
+ * processing an unchanged sample.
+ */
+
+#define PROCFS_BIN_VERSION 1
+
+/* /proc/meminfo_bin */
+struct procfs_meminfo_bin {
+	uint32_t version;
+	uint32_t generation;
+	uint32_t total_kb;
+	uint32_t free_kb;
+	uint32_t kheap_kb;
+};
+
+/* /proc/uptime_bin */
+struct procfs_uptime_bin {
+	uint32_t version;
+	uint32_t generation;
+	uint32_t ticks;
+	uint32_t subticks;
+};
+
+/*
+ * /proc/<pid>/fd_bin and /proc/<pid>/maps_bin are a fixed header
+ * followed by `count` fixed-size records. Both are rebuilt on every
+ * read; their generation fields are a checksum of the records, so a
+ * poller comparing generations still detects unchanged snapshots.
+ */
+
+/* /proc/<pid>/fd_bin */
+struct procfs_fd_bin_entry {
+	int32_t  fd;
+	uint32_t mode;       /* Flags the descriptor was opened with */
+	uint32_t node_flags; /* FS_* type flags of the backing node */
+	uint32_t offset_lo;  /* Current file offset, low and high words */
+	uint32_t offset_hi;
+	char     name[44];   /* Name of the backing node, truncated */
+};
+
+struct procfs_fd_bin {
+	uint32_t version;
+	uint32_t generation;
+	uint32_t count;
+	/* struct procfs_fd_bin_entry entries[count]; */
+};
+
+/* /proc/<pid>/maps_bin */
+#define PROCFS_MAP_WRITE 0x01 /* Pages are mapped writable */
+#define PROCFS_MAP_COW   0x02 /* Pages are copy-on-write */
+#define PROCFS_MAP_SHM   0x04 /* Region is above SHM_START */
+
+struct procfs_maps_bin_entry {
+	uint32_t start;
+	uint32_t end;   /* One past the last mapped byte */
+	uint32_t pages;
+	uint32_t flags; /* PROCFS_MAP_* */
+};
+
+struct procfs_maps_bin {
+	uint32_t version;
+	uint32_t generation;
+	uint32_t count;
+	/* struct procfs_maps_bin_entry entries[count]; */
+};
+
+/* /proc/<pid>/status_bin */
+struct procfs_status_bin {
+	uint32_t version;
+	uint32_t generation;
+	int32_t  pid;
+	int32_t  ppid;
+	int32_t  tgid;
+	int32_t  pgid;
+	int32_t  sid;
+	uint32_t uid;
+	uint8_t  state;      /* R, S, T, or Z, as in the text node */
+	uint8_t  _reserved[3];
+	uint32_t vm_size_kb;
+	uint32_t shm_size_kb;
+	uint32_t mem_permille;
+	uint32_t utime_ms;   /* Timer subticks charged in user mode */
+	uint32_t stime_ms;   /* Timer subticks charged in kernel mode */
+	uint32_t switches;   /* Times switched in */
+	uint32_t faults;     /* Page faults taken */
+	char     name[64];
+};
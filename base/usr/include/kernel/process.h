@@ -10,6 +10,17 @@
 
 #define KERNEL_STACK_SIZE 0x8000
 
+/* Scheduler priority levels; lower value = higher priority. */
+#define PROCESS_PRIORITY_LEVELS  8
+#define PRIORITY_HIGHEST         0
+#define PRIORITY_INTERACTIVE     2
+#define PRIORITY_DEFAULT         4
+#define PRIORITY_BATCH           6
+#define PRIORITY_LOWEST          (PROCESS_PRIORITY_LEVELS - 1)
+
+/* Embedded wait registration slots per process; see process_wait_node_insert */
+#define PROCESS_WAIT_SLOTS 8
+
 typedef signed int    pid_t;
 typedef unsigned int  user_t;
 typedef unsigned int  status_t;
@@ -47,6 +58,7 @@ typedef struct image {
 	uintptr_t user_stack;  /* User stack */
 	uintptr_t start;
 	uintptr_t shm_heap;
+	uintptr_t mmap_start;  /* Next mmap region allocation */
 	volatile int lock[2];
 } image_t;
 
@@ -55,8 +67,10 @@ typedef struct descriptor_table {
 	fs_node_t ** entries;
 	uint64_t  *  offsets;
 	int       *  modes;
+	int       *  advice;  /* posix_fadvise access pattern hints */
 	size_t       length;
 	size_t       capacity;
+	size_t       next_free; /* No free slot below this index */
 	size_t       refs;
 } fd_table_t;
 
@@ -97,26 +111,38 @@ typedef struct process {
 	struct regs * syscall_registers; /* Registers at interrupt */
 	list_t *      wait_queue;
 	list_t *      shm_mappings;      /* Shared memory chunk mappings */
-	list_t *      signal_queue;      /* Queued signals */
+	volatile uint64_t pending_signals; /* One bit per pending signal number */
+	uintptr_t     pending_handlers[NUMSIGNALS+1]; /* Handler captured when each signal was posted */
 	thread_t      signal_state;
 	char *        signal_kstack;
 	node_t        sched_node;
 	node_t        sleep_node;
-	node_t *      timed_sleep_node;
+	struct sleeper * timed_sleep_node;
 	uint8_t       is_tasklet;
 	volatile uint8_t sleep_interrupted;
 	list_t *      node_waits;
+	list_t        wait_list;         /* Storage behind node_waits; no list allocated per wait */
+	node_t        wait_slots[PROCESS_WAIT_SLOTS]; /* Embedded wait registrations; heap only past these */
 	int           awoken_index;
-	node_t *      timeout_node;
+	struct sleeper * timeout_node;
+	list_t *      event_sets;    /* Event set objects owned by this process */
 	struct timeval start;
 	uint8_t       suspended;
+	uint8_t       priority;          /* Run queue level, 0 (highest) .. PRIORITY_LOWEST */
+
+	/* CPU accounting */
+	unsigned long usage_user;        /* Timer subticks charged while in user mode */
+	unsigned long usage_kernel;      /* Timer subticks charged while in kernel mode */
+	unsigned long ctx_switches;      /* Times this process was switched in */
+	unsigned long page_faults;       /* Page faults taken */
 } process_t;
 
-typedef struct {
+typedef struct sleeper {
 	unsigned long end_tick;
 	unsigned long end_subtick;
 	process_t * process;
 	int is_fswait;
+	int cancelled; /* Lazily removed from the sleep heap on expiry */
 } sleeper_t;
 
 extern void initialize_process_tree(void);
@@ -128,6 +154,7 @@ extern void set_process_environment(process_t * proc, page_directory_t * directo
 extern void make_process_ready(process_t * proc);
 extern uint8_t process_available(void);
 extern process_t * next_ready_process(void);
+extern void process_set_priority(process_t * proc, int priority);
 extern uint32_t process_append_fd(process_t * proc, fs_node_t * node);
 extern process_t * process_from_pid(pid_t pid);
 extern void delete_process(process_t * proc);
@@ -140,11 +167,18 @@ extern void sleep_until(process_t * process, unsigned long seconds, unsigned lon
 
 extern volatile process_t * current_process;
 extern process_t * kernel_idle_task;
+
+/* System-wide accounting totals */
+extern unsigned long total_ctx_switches;
+extern unsigned long total_page_faults;
 extern list_t * process_list;
+extern list_t * run_queues[PROCESS_PRIORITY_LEVELS];
 
 extern int process_wait_nodes(process_t * process,fs_node_t * nodes[], int timeout);
 extern int process_alert_node(process_t * process, void * value);
 extern int process_awaken_from_fswait(process_t * process, int index);
+extern void process_wait_node_insert(process_t * process, void * value);
+extern void process_wait_node_release(process_t * process, node_t * node);
 
 typedef void (*tasklet_t) (void *, char *);
 extern int create_kernel_tasklet(tasklet_t tasklet, char * name, void * argp);
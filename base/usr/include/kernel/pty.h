@@ -42,4 +42,5 @@ typedef struct pty {
 void tty_output_process_slave(pty_t * pty, uint8_t c);
 void tty_output_process(pty_t * pty, uint8_t c);
 void tty_input_process(pty_t * pty, uint8_t c);
+void tty_input_process_buffer(pty_t * pty, uint8_t * buffer, size_t size);
 pty_t * pty_new(struct winsize * size);
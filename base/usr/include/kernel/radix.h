@@ -0,0 +1,32 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ */
+#pragma once
+
+#include <kernel/types.h>
+
+/*
+ * Radix tree: sparse container keyed by unsigned integers.
+ *
+ * Lookups walk a fixed number of fan-out levels - O(height) pointer
+ * chases, no hashing, no allocation. Only inserts allocate, and only
+ * for interior nodes missing along the key's path. The height tracks
+ * the largest key stored, so dense, small key spaces (page offsets,
+ * ids) stay one or two levels deep.
+ */
+
+struct radix_node;
+
+typedef struct radix_tree {
+	struct radix_node * root;
+	int height;        /* Levels from root to leaves; 0 = empty */
+	size_t count;      /* Stored values */
+} radix_tree_t;
+
+typedef void (*radix_iterator_t)(uintptr_t key, void * value, void * extra);
+
+extern radix_tree_t * radix_tree_create(void);
+extern void * radix_tree_get(radix_tree_t * tree, uintptr_t key);
+extern int radix_tree_set(radix_tree_t * tree, uintptr_t key, void * value);
+extern void * radix_tree_remove(radix_tree_t * tree, uintptr_t key);
+extern void radix_tree_foreach(radix_tree_t * tree, radix_iterator_t func, void * extra);
+extern void radix_tree_free(radix_tree_t * tree);
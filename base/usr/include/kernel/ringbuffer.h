@@ -2,15 +2,23 @@
 
 typedef struct {
 	unsigned char * buffer;
-	size_t write_ptr;
-	size_t read_ptr;
-	size_t size;
+	size_t size;      /* Always a power of two */
+	size_t size_mask; /* size - 1, for cheap wrapping */
+	int no_lock;      /* Single producer, single consumer; index updates need no lock */
 	volatile int lock[2];
+	int internal_stop;
+	int discard;
 	list_t * wait_queue_readers;
 	list_t * wait_queue_writers;
-	int internal_stop;
 	list_t * alert_waiters;
-	int discard;
+	/* The producer only writes write_ptr and the consumer only writes
+	 * read_ptr; each gets its own cache line so they will not
+	 * false-share when SMP happens. */
+	char _pad0[64];
+	volatile size_t write_ptr;
+	char _pad1[64];
+	volatile size_t read_ptr;
+	char _pad2[64];
 } ring_buffer_t;
 
 size_t ring_buffer_unread(ring_buffer_t * ring_buffer);
@@ -19,9 +27,11 @@ size_t ring_buffer_available(ring_buffer_t * ring_buffer);
 size_t ring_buffer_read(ring_buffer_t * ring_buffer, size_t size, uint8_t * buffer);
 size_t ring_buffer_write(ring_buffer_t * ring_buffer, size_t size, uint8_t * buffer);
 
+int ring_buffer_resize(ring_buffer_t * ring_buffer, size_t size);
+
 ring_buffer_t * ring_buffer_create(size_t size);
+ring_buffer_t * ring_buffer_create_unlocked(size_t size);
 void ring_buffer_destroy(ring_buffer_t * ring_buffer);
 void ring_buffer_interrupt(ring_buffer_t * ring_buffer);
 void ring_buffer_alert_waiters(ring_buffer_t * ring_buffer);
 void ring_buffer_select_wait(ring_buffer_t * ring_buffer, void * process);
-
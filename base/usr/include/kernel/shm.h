@@ -5,6 +5,8 @@
 #include <kernel/system.h>
 #include <kernel/types.h>
 
+#include <toaru/list.h>
+
 #define SHM_PATH_SEPARATOR "."
 
 /* Types */
@@ -15,8 +17,11 @@ typedef struct {
 	volatile uint8_t lock;
 	int32_t ref_count;
 
-	uint32_t num_frames;
+	uint32_t num_frames;   /* Committed frames */
+	uint32_t capacity;     /* Reserved frames; frames[] is this long */
 	uintptr_t *frames;
+
+	list_t * mappings;     /* Live shm_mapping_t's, for growing in place */
 } shm_chunk_t;
 
 typedef struct shm_node {
@@ -26,15 +31,19 @@ typedef struct shm_node {
 
 typedef struct {
 	shm_chunk_t * chunk;
+	process_t * owner;
 	uint8_t volatile lock;
 
-	uint32_t num_vaddrs;
+	uint32_t num_vaddrs;   /* Reserved addresses; only the committed ones are mapped */
 	uintptr_t *vaddrs;
+	int writable;          /* Whether pages are mapped read-write */
 } shm_mapping_t;
 
 /* Syscalls */
 extern void * shm_obtain(char * path, size_t * size);
+extern void * shm_obtain_ro(char * path, size_t * size);
 extern int    shm_release(char * path);
+extern int    shm_resize(char * path, size_t * size);
 
 /* Other exposed functions */
 extern void shm_install(void);
@@ -0,0 +1,33 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ */
+
+#pragma once
+
+#include <kernel/types.h>
+
+/*
+ * Object caches for hot fixed-size kernel allocations.
+ *
+ * A cache carves whole pages into equal-sized objects and hands
+ * them out as pointer bumps; freed objects go to a small magazine
+ * first so alloc/free bursts (wakeup storms, fork/exec cycles)
+ * never touch the general-purpose allocator.
+ */
+
+#define SLAB_MAGAZINE_SIZE 32
+
+typedef struct slab_cache {
+	char * name;            /* For diagnostics */
+	size_t object_size;     /* Rounded-up object size */
+	size_t objects_per_page;
+	void * free_list;       /* Singly-linked through the first word */
+	void * magazine[SLAB_MAGAZINE_SIZE]; /* Recently freed, LIFO */
+	int    magazine_count;
+	size_t total_objects;   /* Carved, ever */
+	size_t total_pages;
+	volatile int lock[2];
+} slab_cache_t;
+
+extern slab_cache_t * slab_create(char * name, size_t object_size);
+extern void * slab_alloc(slab_cache_t * cache);
+extern void slab_free(slab_cache_t * cache, void * object);
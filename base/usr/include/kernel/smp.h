@@ -0,0 +1,38 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ */
+
+#pragma once
+
+#include <kernel/types.h>
+#include <kernel/process.h>
+
+#define SMP_MAX_CORES 32
+
+/*
+ * Per-CPU state. The boot processor is always slot 0; application
+ * processors fill in the remaining slots as they come up.
+ */
+typedef struct processor {
+	int       cpu_id;            /* Logical index into processor_local_data */
+	int       lapic_id;          /* Local APIC ID from the MADT */
+	volatile int online;         /* Set once the AP has entered ap_main() */
+	volatile process_t * current_process; /* What this core is running */
+	process_t * kernel_idle_task;         /* Per-core idle task */
+	uintptr_t kernel_stack;      /* Stack the AP was started on */
+} processor_t;
+
+extern processor_t processor_local_data[SMP_MAX_CORES];
+extern int processor_count;
+
+/*
+ * Until the scheduler proper is made multi-core aware, everything
+ * that used to poke the global current_process should go through
+ * this_core so the conversion is mechanical later.
+ */
+#define this_core (&processor_local_data[0])
+
+extern void smp_initialize(void);
+extern int smp_processor_id(void);
+extern void lapic_send_ipi(int lapic_id, uint32_t value);
+extern void lapic_write(size_t addr, uint32_t value);
+extern uint32_t lapic_read(size_t addr);
@@ -43,11 +43,14 @@ extern char * boot_arg_extra; /* Extra data to pass to init */
 
 extern void *sbrk(uintptr_t increment);
 
-/* spin.c */
-typedef volatile int spin_lock_t[2];
+/* spin.c
+ * Ticket locks: next ticket, waiters, now serving, stats slot.
+ * All-zero initialization is a free lock. */
+typedef volatile int spin_lock_t[4];
 extern void spin_init(spin_lock_t lock);
 extern void spin_lock(spin_lock_t lock);
 extern void spin_unlock(spin_lock_t lock);
+extern size_t spin_debug_dump(char * buf);
 
 extern void return_to_userspace(void);
 
@@ -69,10 +72,16 @@ extern size_t rfind(const char * str, const char accept);
 
 extern uint32_t krand(void);
 
+/* Entropy pool (kernel/sys/system.c) */
+extern void random_feed_entropy(uint32_t value);
+extern void random_entropy_fetch(uint32_t * out, int words);
+extern volatile unsigned long entropy_events;
+
 extern uint8_t startswith(const char * str, const char * accept);
 
 /* GDT */
 extern void gdt_install(void);
+extern void gdt_install_ap(int core);
 extern void gdt_set_gate(uint8_t num, uint64_t base, uint64_t limit, uint8_t access, uint8_t gran);
 extern void set_kernel_stack(uintptr_t stack);
 
@@ -123,6 +132,21 @@ extern unsigned long timer_subticks;
 extern signed long timer_drift;
 extern void relative_time(unsigned long seconds, unsigned long subseconds, unsigned long * out_seconds, unsigned long * out_subseconds);
 
+/* TSC-backed monotonic clock (kernel/devices/timer.c) */
+#define CLOCK_REALTIME  0
+#define CLOCK_MONOTONIC 1
+extern uint64_t tsc_khz;
+extern uint64_t monotonic_time_ns(void);
+
+/* Sampling profiler (kernel/devices/timer.c) */
+struct profile_sample {
+	uint32_t eip;
+	int32_t  pid;
+};
+extern void profile_set_interval(unsigned int interval);
+extern unsigned int profile_get_interval(void);
+extern size_t profile_fetch(uint8_t * buffer, size_t size);
+
 /* Memory Management */
 extern uintptr_t placement_pointer;
 extern void kmalloc_startat(uintptr_t address);
@@ -144,6 +168,7 @@ extern void paging_mark_system(uint64_t addr);
 extern void switch_page_directory(page_directory_t * new);
 extern void invalidate_page_tables(void);
 extern void invalidate_tables_at(uintptr_t addr);
+extern void invalidate_tables_range(uintptr_t addr, size_t pages);
 extern page_t *get_page(uintptr_t address, int make, page_directory_t * dir);
 extern void page_fault(struct regs *r);
 extern void dma_frame(page_t * page, int, int, uintptr_t);
@@ -154,10 +179,27 @@ int debug_shell_start(void);
 void heap_install(void);
 
 void alloc_frame(page_t *page, int is_kernel, int is_writeable);
+void alloc_frame_lazy(page_t *page);
 void free_frame(page_t *page);
+extern void frame_ref(uint32_t frame);
+extern int frame_is_exclusive(uint32_t frame);
 uintptr_t memory_use(void);
 uintptr_t memory_total(void);
 
+/* Swap (kernel/mem/swap.c) */
+extern int swap_enable(char * path);
+extern int swap_active(void);
+extern int swap_fault_in(uintptr_t address);
+extern int swap_restore_page(page_t * page);
+extern void swap_discard_page(page_t * page);
+extern int swap_reclaim(int max_pages);
+extern uint32_t swap_slots_total;
+extern uint32_t swap_slots_used;
+extern unsigned long swap_pages_out;
+extern unsigned long swap_pages_in;
+extern unsigned long swap_pages_scanned;
+extern unsigned long swap_passes;
+
 /* klmalloc */
 void * __attribute__ ((malloc)) malloc(uintptr_t size);
 void * __attribute__ ((malloc)) realloc(void *ptr, uintptr_t size);
@@ -165,6 +207,11 @@ void * __attribute__ ((malloc)) calloc(uintptr_t nmemb, uintptr_t size);
 void * __attribute__ ((malloc)) valloc(uintptr_t size);
 void free(void *ptr);
 
+/* Heap trim and introspection (kernel/mem/alloc.c) */
+extern size_t heap_trim(void);
+extern void heap_trim_install(void);
+extern size_t heap_debug_dump(char * buf);
+
 /* Tasks */
 extern uintptr_t read_eip(void);
 extern void copy_page_physical(uint32_t, uint32_t);
@@ -179,6 +226,7 @@ extern void tasking_install(void);
 extern void switch_task(uint8_t reschedule);
 extern void switch_next(void);
 extern uint32_t fork(void);
+extern pid_t spawn_exec(char * path, int argc, char ** argv, char ** envp, int * fd_map, int fd_count);
 extern uint32_t clone(uintptr_t new_stack, uintptr_t thread_func, uintptr_t arg);
 extern uint32_t getpid(void);
 extern void enter_user_jmp(uintptr_t location, int argc, char ** argv, uintptr_t stack);
@@ -210,18 +258,57 @@ extern int system( char *, int, char **, char **);
 /* Sytem Calls */
 extern void syscalls_install(void);
 
+/* Shared library cache (kernel/mem/libcache.c) */
+extern int lib_cache_insert(char * name, uintptr_t vaddr, size_t size);
+extern int lib_cache_map(char * name, uintptr_t vaddr);
+
+/* Futexes (kernel/sys/futex.c) */
+extern int futex_wait(volatile int * addr, int value);
+extern int futex_wake(volatile int * addr, int count);
+
+/* Memory-mapped regions (kernel/mem/mmap.c) */
+struct fs_node;
+extern int mmap_map(struct fs_node * node, size_t length, int prot, int flags, int offset);
+extern int mmap_unmap(uintptr_t addr, size_t length);
+
+/* Event sets (kernel/fs/eventset.c) */
+extern struct fs_node * eventset_create(void);
+extern int eventset_ctl(struct fs_node * setnode, int op, struct fs_node * target, int fd);
+extern int eventset_wait(struct fs_node * setnode, int * out, int max, int timeout);
+extern int eventset_alert(void * process, void * token);
+
+/* Scheduler tracing (kernel/misc/trace.c) */
+#define TRACE_EVENT_SWITCH 1 /* pid was given the CPU */
+#define TRACE_EVENT_READY  2 /* pid was placed on the run queue */
+#define TRACE_EVENT_SLEEP  3 /* pid went to sleep */
+struct trace_event {
+	uint64_t timestamp; /* monotonic nanoseconds */
+	int32_t  pid;
+	uint32_t event;
+};
+extern int trace_enabled;
+extern void trace_record(int event, int pid);
+extern size_t trace_fetch(uint8_t * buffer, size_t size);
+
+/* Syscall statistics (kernel/sys/syscall.c) */
+#define SYSCALL_STAT_BUCKETS 32
+struct syscall_stats {
+	uint64_t count;
+	uint32_t buckets[SYSCALL_STAT_BUCKETS]; /* log2(cycles) latency histogram */
+};
+extern int syscall_stats_enabled;
+extern struct syscall_stats syscall_stats[];
+extern const char * syscall_names[];
+extern uint32_t num_syscalls;
+extern void syscall_stats_reset(void);
+
 /* wakeup queue */
 extern int wakeup_queue(list_t * queue);
+extern int wakeup_queue_n(list_t * queue, int n);
 extern int wakeup_queue_interrupted(list_t * queue);
 extern int sleep_on(list_t * queue);
 
-typedef struct {
-	uint32_t  signum;
-	uintptr_t handler;
-	regs_t registers_before;
-} signal_t;
-
-extern void handle_signal(process_t *, signal_t *);
+extern void handle_signal(process_t *, int signum, uintptr_t handler);
 
 extern int send_signal(pid_t process, uint32_t signal, int force);
 extern int group_send_signal(int group, uint32_t signal, int force_root);
@@ -230,6 +317,10 @@ extern int group_send_signal(int group, uint32_t signal, int force_root);
 #define USER_STACK_TOP    0xB0000000
 #define SHM_START         0xB0000000
 
+/* Window for mmap regions (kernel/mem/mmap.c) */
+#define MMAP_REGION_START 0x70000000
+#define MMAP_REGION_END   0x80000000
+
 extern void validate(void * ptr);
 extern int validate_safe(void * ptr);
 
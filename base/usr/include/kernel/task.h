@@ -12,7 +12,9 @@ typedef struct page {
 	unsigned int dirty:1;
 	unsigned int pat:1;
 	unsigned int global:1;
-	unsigned int unused:3;
+	unsigned int cow:1; /* Shared frame, copy on write fault */
+	unsigned int swapped:1; /* Not present; frame holds a swap slot */
+	unsigned int unused:1;
 	unsigned int frame:20;
 } __attribute__((packed)) page_t;
 
@@ -0,0 +1,33 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ */
+#pragma once
+
+#include <kernel/types.h>
+
+/*
+ * One-shot kernel timers.
+ *
+ * Kernel code schedules a callback to run after a delay; the timers
+ * live in a hierarchical wheel driven from the PIT tick, so insert,
+ * cancel, and expiry are all O(1). Callbacks run in process context
+ * on the high-priority work queue, not in the timer interrupt.
+ */
+
+typedef void (*timer_fn_t)(void * arg);
+
+struct ktimer;
+
+/* Schedule fn(arg) to run no earlier than ns nanoseconds from now.
+ * Resolution is the millisecond PIT subtick, and long delays are
+ * quantized so that close deadlines fire together. Returns a handle
+ * for timer_cancel, or NULL on allocation failure. Call from process
+ * context. */
+extern struct ktimer * timer_set(uint64_t ns, timer_fn_t fn, void * arg);
+
+/* Cancel a pending timer. Returns 0 if the callback will not run
+ * (the handle is freed), 1 if it already ran or is running (the
+ * handle is owned and freed by the expiry path). */
+extern int timer_cancel(struct ktimer * timer);
+
+/* Called from the timer interrupt, once per subtick. */
+extern void timerwheel_tick(void);
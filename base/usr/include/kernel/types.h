@@ -17,3 +17,8 @@ struct timeval {
 	uint32_t tv_usec;
 };
 
+struct timespec {
+	uint32_t tv_sec;
+	uint32_t tv_nsec;
+};
+
@@ -9,18 +9,59 @@
 #define IO_VID_STRIDE 0x5007
 #define IO_VID_DRIVER 0x5008
 #define IO_VID_REINIT 0x5009
+#define IO_VID_CURSOR 0x500A
+#define IO_VID_CURSOR_MOVE 0x500B
+#define IO_VID_UPDATE 0x500C
 
 struct vid_size {
 	uint32_t width;
 	uint32_t height;
 };
 
+/* Damage rectangle, for IO_VID_UPDATE. Tells the display hardware
+ * that this region of the framebuffer changed so it can present just
+ * that instead of rescanning the whole screen. Fails with -EINVAL
+ * when the driver has no accelerated update path; presentation then
+ * happens implicitly and callers need do nothing. */
+struct vid_update {
+	uint32_t x;
+	uint32_t y;
+	uint32_t width;
+	uint32_t height;
+};
+
+/* Cursor plane image, for IO_VID_CURSOR. Fails with -EINVAL when the
+ * display hardware has no cursor plane; draw it yourself instead. */
+struct vid_cursor {
+	uint16_t width;
+	uint16_t height;
+	uint16_t hot_x;
+	uint16_t hot_y;
+	uint32_t * bitmap; /* ARGB, width * height */
+};
+
+/* Cursor plane position, for IO_VID_CURSOR_MOVE. May fail with
+ * -EINVAL even when IO_VID_CURSOR worked - that means the host
+ * positions the cursor itself (absolute pointer integration). */
+struct vid_cursor_pos {
+	int x;
+	int y;
+	int visible;
+};
+
 #ifdef _KERNEL_
-extern void lfb_set_resolution(uint16_t x, uint16_t y);
+extern int lfb_set_resolution(uint16_t x, uint16_t y);
 extern uint16_t lfb_resolution_x;
 extern uint16_t lfb_resolution_y;
 extern uint16_t lfb_resolution_b;
 extern uint8_t * lfb_vid_memory;
 extern const char * lfb_driver_name;
+
+/* Cursor plane hooks, installed by display drivers that have one */
+extern int (*lfb_cursor_image_impl)(struct vid_cursor * cursor);
+extern int (*lfb_cursor_move_impl)(struct vid_cursor_pos * pos);
+
+/* Accelerated damage-update hook, for drivers with a command queue */
+extern int (*lfb_update_impl)(struct vid_update * update);
 #endif
 
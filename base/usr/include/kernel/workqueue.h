@@ -0,0 +1,30 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ */
+#pragma once
+
+#include <kernel/types.h>
+
+/*
+ * Deferred work queues.
+ *
+ * Interrupt handlers schedule a function to run later in a dedicated
+ * worker task instead of doing heavy lifting in interrupt context.
+ * Duplicate pending work (same function and argument) is coalesced,
+ * so a handler can schedule its bottom half on every interrupt and
+ * the worker runs it once per batch.
+ */
+
+typedef void (*work_fn_t)(void * arg);
+
+/* Queue selection; the high queue's worker runs at the scheduler's
+ * highest priority, the default queue at normal priority. */
+#define WORKQUEUE_PRIORITY_DEFAULT 0
+#define WORKQUEUE_PRIORITY_HIGH    1
+
+extern void workqueue_install(void);
+
+/* Returns 0 on success, 1 if the item was coalesced with an already
+ * pending duplicate, -1 if the queue is full (the caller should do
+ * the work inline or retry). Safe to call from interrupt context. */
+extern int workqueue_schedule_prio(work_fn_t fn, void * arg, int priority);
+extern int workqueue_schedule(work_fn_t fn, void * arg);
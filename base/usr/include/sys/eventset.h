@@ -0,0 +1,14 @@
+#pragma once
+
+#include <_cheader.h>
+
+#define EVENTSET_ADD 0 /* Start watching a descriptor */
+#define EVENTSET_DEL 1 /* Stop watching a descriptor */
+
+#ifndef _KERNEL_
+_Begin_C_Header
+extern int eventset_create(void);
+extern int eventset_ctl(int set, int op, int fd);
+extern int eventset_wait(int set, int * out, int max, int timeout);
+_End_C_Header
+#endif
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <_cheader.h>
+
+#define FUTEX_WAIT 0 /* Sleep while *addr == value */
+#define FUTEX_WAKE 1 /* Wake up to `value` sleepers on addr */
+
+_Begin_C_Header
+extern int futex(volatile int * addr, int op, int value);
+_End_C_Header
@@ -13,3 +13,6 @@
 
 #define IOCTL_PACKETFS_QUEUED 0x5050
 
+#define IOCTL_PIPE_SETSZ 0x5055 /* Resize a pipe's buffer; argp is a size_t* capacity */
+#define IOCTL_PIPE_GETSZ 0x5056 /* Current pipe buffer capacity */
+
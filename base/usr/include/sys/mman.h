@@ -1,3 +1,22 @@
 #pragma once
 
-/* Nothing here, we don't have an mmap implementation yet? */
+#include <_cheader.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#define PROT_NONE      0x00
+#define PROT_READ      0x01
+#define PROT_WRITE     0x02
+#define PROT_EXEC      0x04
+
+#define MAP_SHARED     0x01
+#define MAP_PRIVATE    0x02
+#define MAP_FIXED      0x10 /* Not supported */
+#define MAP_ANONYMOUS  0x20
+
+#define MAP_FAILED ((void *)-1)
+
+_Begin_C_Header
+extern void * mmap(void * addr, size_t length, int prot, int flags, int fd, off_t offset);
+extern int munmap(void * addr, size_t length);
+_End_C_Header
@@ -5,6 +5,10 @@
 
 _Begin_C_Header
 extern void * shm_obtain(char * path, size_t * size);
+/* Attach an existing segment with read-only mappings; returns NULL
+ * (and size 0) if nobody has created it yet. */
+extern void * shm_obtain_ro(char * path, size_t * size);
 extern int shm_release(char * path);
+extern int shm_resize(char * path, size_t * size);
 _End_C_Header
 
@@ -16,6 +16,8 @@
 #define TOARU_SYS_FUNC_WRITESDB      6
 #define TOARU_SYS_FUNC_KDEBUG        7
 #define TOARU_SYS_FUNC_INSMOD        8
+#define TOARU_SYS_FUNC_SHARELIB     14
+#define TOARU_SYS_FUNC_SWAPON       16
 
 /* Unpriviliged */
 #define TOARU_SYS_FUNC_SETHEAP       9
@@ -23,6 +25,8 @@
 #define TOARU_SYS_FUNC_THREADNAME   11
 #define TOARU_SYS_FUNC_DEBUGPRINT   12
 #define TOARU_SYS_FUNC_SETVGACURSOR 13
+#define TOARU_SYS_FUNC_MAPLIB       15
+#define TOARU_SYS_FUNC_SETVGASTART  17
 
 _Begin_C_Header
 extern int sysfunc(int command, char ** args);
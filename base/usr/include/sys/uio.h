@@ -0,0 +1,18 @@
+#pragma once
+
+#include <_cheader.h>
+#include <stddef.h>
+
+#define UIO_MAXIOV 16
+
+struct iovec {
+	void * iov_base;
+	size_t iov_len;
+};
+
+#ifndef _KERNEL_
+_Begin_C_Header
+extern int readv(int fd, const struct iovec * iov, int count);
+extern int writev(int fd, const struct iovec * iov, int count);
+_End_C_Header
+#endif
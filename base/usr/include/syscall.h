@@ -97,6 +97,15 @@ DECL_SYSCALL0(mousedevice);
 DECL_SYSCALL2(mkdir, char *, unsigned int);
 DECL_SYSCALL2(shm_obtain, char *, size_t *);
 DECL_SYSCALL1(shm_release, char *);
+DECL_SYSCALL2(shm_resize, char *, size_t *);
+DECL_SYSCALL1(fsync, int);
+DECL_SYSCALL1(fdatasync, int);
+DECL_SYSCALL4(fadvise, int, int, int, int);
+DECL_SYSCALL5(spawn, const char *, char * const *, char * const *, int *, int);
+struct aio_request;
+struct aio_completion;
+DECL_SYSCALL1(aio_submit, struct aio_request *);
+DECL_SYSCALL3(aio_reap, struct aio_completion *, int, int);
 DECL_SYSCALL2(send_signal, uint32_t, uint32_t);
 DECL_SYSCALL2(signal, uint32_t, void *);
 DECL_SYSCALL2(share_fd, int, int);
@@ -123,6 +132,17 @@ DECL_SYSCALL1(getpgid,int);
 DECL_SYSCALL0(geteuid);
 DECL_SYSCALL2(lstat, char *, void *);
 DECL_SYSCALL4(fswait3, int, int*, int, int*);
+DECL_SYSCALL2(clock_gettime, int, void *);
+DECL_SYSCALL5(mmap, int, int, int, int, int);
+DECL_SYSCALL2(munmap, int, int);
+DECL_SYSCALL3(futex, int *, int, int);
+DECL_SYSCALL0(eventset_create);
+DECL_SYSCALL3(eventset_ctl, int, int, int);
+DECL_SYSCALL4(eventset_wait, int, int *, int, int);
+struct iovec;
+DECL_SYSCALL3(readv, int, const struct iovec *, int);
+DECL_SYSCALL3(writev, int, const struct iovec *, int);
+DECL_SYSCALL4(readdirents, int, int, void *, int);
 
 _End_C_Header
 
@@ -55,3 +55,25 @@
 #define SYS_SETPGID 63
 #define SYS_GETPGID 64
 #define SYS_FSWAIT3 65
+#define SYS_SOCKET 66
+#define SYS_BIND 67
+#define SYS_SENDTO 68
+#define SYS_RECVFROM 69
+#define SYS_CLOCK_GETTIME 70
+#define SYS_MMAP 71
+#define SYS_MUNMAP 72
+#define SYS_FUTEX 73
+#define SYS_EVENTSET_CREATE 74
+#define SYS_EVENTSET_CTL 75
+#define SYS_EVENTSET_WAIT 76
+#define SYS_READV 77
+#define SYS_WRITEV 78
+#define SYS_READDIRENTS 79
+#define SYS_SHM_RESIZE 80
+#define SYS_FSYNC 81
+#define SYS_FDATASYNC 82
+#define SYS_FADVISE 83
+#define SYS_SPAWN 84
+#define SYS_AIO_SUBMIT 85
+#define SYS_AIO_REAP 86
+#define SYS_SHM_OBTAIN_RO 87
@@ -37,4 +37,16 @@ typedef int clock_t;
 extern clock_t clock(void);
 #define CLOCKS_PER_SEC 1
 
+typedef int clockid_t;
+
+#define CLOCK_REALTIME  0
+#define CLOCK_MONOTONIC 1
+
+struct timespec {
+	time_t tv_sec;
+	long   tv_nsec;
+};
+
+extern int clock_gettime(clockid_t clk_id, struct timespec * tp);
+
 _End_C_Header
@@ -0,0 +1,32 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ *
+ * Bit sets. Userspace port of kernel/bitset.h.
+ */
+#pragma once
+
+#include <_cheader.h>
+#include <stdint.h>
+#include <stddef.h>
+
+_Begin_C_Header
+
+typedef struct {
+	unsigned char *data;
+	size_t size;
+	size_t hint; /* No unset bit below this index */
+} bitset_t;
+
+extern void bitset_init(bitset_t *set, size_t size);
+extern void bitset_free(bitset_t *set);
+extern void bitset_set(bitset_t *set, size_t bit);
+extern void bitset_clear(bitset_t *set, size_t bit);
+extern int bitset_test(bitset_t *set, size_t bit);
+/* Find first unset bit */
+extern int bitset_ffub(bitset_t *set);
+/* Set or clear [bit, bit + count) */
+extern void bitset_set_range(bitset_t *set, size_t bit, size_t count);
+extern void bitset_clear_range(bitset_t *set, size_t bit, size_t count);
+/* Number of set bits */
+extern size_t bitset_count(bitset_t *set);
+
+_End_C_Header
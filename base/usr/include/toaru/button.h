@@ -12,6 +12,14 @@ struct TTKButton {
 	int height;
 	char * title;
 	int hilight;
+
+	/* Retained rendering cache, managed by ttk_button_draw; leave
+	 * zeroed. Static and zero-initialized buttons need no changes. */
+	sprite_t * _cache;
+	int _cache_hilight;
+	char * _cache_title;
 };
 
-extern void ttk_button_draw(gfx_context_t * ctx, struct TTKButton * button);
+/* Returns 1 when the button's appearance changed since the previous
+ * draw; pair with yutani_flip_region for button-sized damage. */
+extern int ttk_button_draw(gfx_context_t * ctx, struct TTKButton * button);
@@ -26,6 +26,7 @@ _Begin_C_Header
  */
 typedef struct {
 	hashmap_t * sections;
+	int shared; /* Owned by the shared cache; confreader_free is a no-op */
 } confreader_t;
 
 /**
@@ -36,6 +37,17 @@ typedef struct {
  */
 extern confreader_t * confreader_load(const char * file);
 
+/**
+ * confreader_get_shared
+ *
+ * Retrieve a cached parse of a configuration file, reparsing
+ * only when the file has changed on disk. The result is shared
+ * with other callers and must be treated as read-only; do not
+ * pass it to confreader_free.
+ * Returns NULL if the requested file failed to open.
+ */
+extern confreader_t * confreader_get_shared(const char * file);
+
 /**
  * confreader_get
  *
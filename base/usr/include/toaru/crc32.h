@@ -0,0 +1,13 @@
+#pragma once
+
+#include <_cheader.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+_Begin_C_Header
+
+extern uint32_t crc32_update(uint32_t crc, const void * data, size_t len);
+extern uint32_t crc32_file(FILE * f);
+
+_End_C_Header
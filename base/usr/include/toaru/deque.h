@@ -0,0 +1,41 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ *
+ * Indexed double-ended queue.
+ */
+#pragma once
+
+#include <_cheader.h>
+
+#ifdef _KERNEL_
+#	include <kernel/types.h>
+#else
+#	include <stdint.h>
+#	include <stddef.h>
+#endif
+
+_Begin_C_Header
+
+/*
+ * A ring of pointers: pushes and pops at either end are amortized
+ * O(1) and indexing is O(1), where a list pays O(n) for list_index.
+ * Positional insert and remove shift the shorter side.
+ */
+typedef struct deque {
+	void ** items;
+	size_t capacity;   /* Always a power of two */
+	size_t head;       /* Ring offset of element 0 */
+	size_t length;
+} deque_t;
+
+extern deque_t * deque_create(void);
+extern void deque_push_back(deque_t * deque, void * item);
+extern void deque_push_front(deque_t * deque, void * item);
+extern void * deque_pop_back(deque_t * deque);
+extern void * deque_pop_front(deque_t * deque);
+extern void * deque_index(deque_t * deque, size_t index);
+extern void deque_set(deque_t * deque, size_t index, void * item);
+extern void deque_insert(deque_t * deque, size_t index, void * item);
+extern void * deque_remove(deque_t * deque, size_t index);
+extern void deque_free(deque_t * deque);
+
+_End_C_Header
@@ -63,7 +63,15 @@ extern uint32_t alpha_blend(uint32_t bottom, uint32_t top, uint32_t mask);
 extern uint32_t alpha_blend_rgba(uint32_t bottom, uint32_t top);
 extern uint32_t framebuffer_stride(void);
 
+typedef struct {
+	int32_t x;
+	int32_t y;
+	int32_t width;
+	int32_t height;
+} gfx_rect_t;
+
 extern void flip(gfx_context_t * ctx);
+extern void flip_regions(gfx_context_t * ctx, gfx_rect_t * rects, size_t count);
 void clear_buffer(gfx_context_t * ctx);
 
 extern gfx_context_t * init_graphics_sprite(sprite_t * sprite);
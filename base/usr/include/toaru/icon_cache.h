@@ -6,6 +6,8 @@
 _Begin_C_Header
 
 extern sprite_t * icon_get_16(const char * name);
+extern sprite_t * icon_get_24(const char * name);
+extern sprite_t * icon_get_32(const char * name);
 extern sprite_t * icon_get_48(const char * name);
 
 _End_C_Header
@@ -23,8 +23,8 @@ struct inflate_context {
 	uint8_t (*get_input)(struct inflate_context * ctx);
 	void (*write_output)(struct inflate_context * ctx, unsigned int sym);
 
-	/* Bit buffer, which holds at most 8 bits from the input */
-	int bit_buffer;
+	/* Bit reservoir holding the next unconsumed input bits */
+	uint32_t bit_buffer;
 	int buffer_size;
 
 	/* Output ringbuffer for backwards lookups */
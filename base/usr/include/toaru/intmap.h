@@ -0,0 +1,56 @@
+#pragma once
+
+#include <_cheader.h>
+
+#ifdef _KERNEL_
+#	include <kernel/system.h>
+#else
+#	include <string.h>
+#	include <stddef.h>
+#	include <stdint.h>
+#	include <stdlib.h>
+#endif
+
+#include <toaru/list.h>
+
+_Begin_C_Header
+
+/*
+ * Open-addressing map from integer keys to pointers.
+ *
+ * Unlike the general hashmap, entries live inline in the slot array -
+ * no allocation per insert, no pointer chasing per lookup - which makes
+ * this the right table for hot integer-keyed lookups like wid lookups
+ * in the compositor. Growth rehashes incrementally: a few slots migrate
+ * per operation, so no single insert pays for the whole table.
+ */
+
+typedef struct intmap_slot {
+	uintptr_t key;
+	void * value;
+	int32_t dist; /* Probe distance from home slot; -1 marks an empty slot */
+} intmap_slot_t;
+
+typedef struct intmap {
+	intmap_slot_t * slots;
+	size_t size;  /* Always a power of two */
+	size_t count;
+
+	/* Previous slot array while an incremental rehash is draining it */
+	intmap_slot_t * old_slots;
+	size_t old_size;
+	size_t old_count;
+	size_t migrated; /* Next old slot to examine */
+} intmap_t;
+
+extern intmap_t * intmap_create(int size);
+extern void * intmap_set(intmap_t * map, uintptr_t key, void * value);
+extern void * intmap_get(intmap_t * map, uintptr_t key);
+extern void * intmap_remove(intmap_t * map, uintptr_t key);
+extern int intmap_has(intmap_t * map, uintptr_t key);
+extern list_t * intmap_keys(intmap_t * map);
+extern list_t * intmap_values(intmap_t * map);
+extern void intmap_free(intmap_t * map);
+extern int intmap_is_empty(intmap_t * map);
+
+_End_C_Header
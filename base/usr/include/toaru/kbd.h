@@ -1,6 +1,7 @@
 #pragma once
 
 #include <_cheader.h>
+#include <stdint.h>
 
 _Begin_C_Header
 
@@ -160,6 +161,8 @@ typedef struct {
 	kbd_act_t action;
 
 	unsigned char key; /* Key as a raw code, ready for reading, or \0 if it's not a good down strike / was a modifier change / etc/. */
+
+	uint32_t timestamp; /* Milliseconds; when the event was generated. Set by whoever turned the scancode into an event. */
 } key_event_t;
 
 typedef struct {
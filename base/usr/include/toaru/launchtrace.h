@@ -0,0 +1,44 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ * This file is part of ToaruOS and is released under the terms
+ * of the NCSA / University of Illinois License - see LICENSE.md
+ *
+ * launchtrace - Startup timing trace points
+ *
+ * When the LAUNCH_TRACE environment variable names a file, each call
+ * appends one line: "pid sec.usec event". The linker and client
+ * libraries mark their startup milestones with this; launch-profile
+ * combines the lines with the exec timestamp from /proc/<pid>/status
+ * into a launch waterfall. When the variable is unset, one check per
+ * process is the only cost.
+ *
+ * This is a header so the dynamic linker, which links nothing but
+ * libc, can use it too.
+ */
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+static FILE * _launchtrace_file = NULL;
+static int _launchtrace_state = 0; /* 0 = unchecked, 1 = on, -1 = off */
+
+static void launchtrace(const char * event) {
+	if (_launchtrace_state == 0) {
+		_launchtrace_state = -1;
+		/* Never let a suid target write to a caller-controlled path. */
+		if (getuid() == geteuid()) {
+			char * target = getenv("LAUNCH_TRACE");
+			if (target) {
+				_launchtrace_file = fopen(target, "a");
+				if (_launchtrace_file) _launchtrace_state = 1;
+			}
+		}
+	}
+	if (_launchtrace_state != 1) return;
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	fprintf(_launchtrace_file, "%d %d.%06d %s\n", getpid(), (int)now.tv_sec, (int)now.tv_usec, event);
+	fflush(_launchtrace_file);
+}
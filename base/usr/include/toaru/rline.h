@@ -40,8 +40,9 @@ extern void rline_history_insert(char * str);
 extern void rline_history_append_line(char * str);
 extern char * rline_history_get(int item);
 extern char * rline_history_prev(int item);
+extern int rline_history_search(const char * needle, int start_at);
 
-#define RLINE_HISTORY_ENTRIES 128
+#define RLINE_HISTORY_ENTRIES 4096
 extern char * rline_history[RLINE_HISTORY_ENTRIES];
 extern int rline_history_count;
 extern int rline_history_offset;
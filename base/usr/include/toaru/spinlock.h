@@ -1,14 +1,25 @@
 #pragma once
 
+#include <sys/futex.h>
+
 #ifndef spin_lock
+/* Uncontended locks never leave userspace; a contended lock parks in
+ * the kernel on its own address instead of burning timeslices yielding.
+ * 0 = unlocked, 1 = locked, 2 = locked with sleepers. */
 static void spin_lock(int volatile * lock) {
-	while(__sync_lock_test_and_set(lock, 0x01)) {
-		syscall_yield();
+	int c = __sync_val_compare_and_swap(lock, 0, 1);
+	while (c) {
+		if (c == 2 || __sync_val_compare_and_swap(lock, 1, 2) != 0) {
+			futex(lock, FUTEX_WAIT, 2);
+		}
+		c = __sync_val_compare_and_swap(lock, 0, 2);
 	}
 }
 
 static void spin_unlock(int volatile * lock) {
-	__sync_lock_release(lock);
+	if (__sync_fetch_and_sub(lock, 1) != 1) {
+		*lock = 0;
+		futex(lock, FUTEX_WAKE, 1);
+	}
 }
 #endif
-
@@ -0,0 +1,65 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ * This file is part of ToaruOS and is released under the terms
+ * of the NCSA / University of Illinois License - see LICENSE.md
+ * Copyright (C) 2018 K. Lange
+ *
+ * Sprite pack loader
+ *
+ * A sprite pack is a single file of pre-decoded, premultiplied
+ * ARGB sprites at known offsets, generated at image build time
+ * by util/make-spritepack.py. Opening one is a map and a magic
+ * check; no image decoding happens at load time.
+ */
+
+#pragma once
+
+#include <_cheader.h>
+#include <stdint.h>
+#include <toaru/graphics.h>
+
+_Begin_C_Header
+
+#define SPRITEPACK_MAGIC   0x4b415054 /* 'TPAK' */
+#define SPRITEPACK_VERSION 1
+
+struct spritepack_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t count;    /* Number of entries following the header */
+	uint32_t reserved;
+};
+
+struct spritepack_entry {
+	uint32_t offset;   /* Pixel data offset from the start of the file */
+	uint16_t width;
+	uint16_t height;
+	uint32_t alpha;    /* ALPHA_OPAQUE, ALPHA_EMBEDDED, ... */
+	uint32_t reserved;
+};
+
+/**
+ * spritepack_open
+ *
+ * Map a sprite pack into memory. Returns NULL if the file does
+ * not exist or is not a valid pack.
+ */
+extern void * spritepack_open(const char * path);
+
+/**
+ * spritepack_count
+ *
+ * Number of sprites in an opened pack.
+ */
+extern int spritepack_count(void * pack);
+
+/**
+ * spritepack_sprite
+ *
+ * Fill in a sprite whose bitmap points directly into the mapped
+ * pack. The pixel data is shared and read-only; do not draw into
+ * it or pass the sprite to sprite_free.
+ * Returns non-zero if the index is out of range.
+ */
+extern int spritepack_sprite(void * pack, unsigned int index, sprite_t * sprite);
+
+_End_C_Header
@@ -38,6 +38,8 @@ typedef struct {
 	void (*set_csr_on)(int);
 	void (*switch_buffer)(int);
 	void (*insert_delete_lines)(int);
+	/* Optional: write a whole run of plain bytes at once. */
+	void (*write_span)(const char *, size_t);
 } term_callbacks_t;
 
 typedef struct {
@@ -121,6 +123,7 @@ typedef struct {
 
 extern term_state_t * ansi_init(term_state_t * s, int w, int y, term_callbacks_t * callbacks_in);
 extern void ansi_put(term_state_t * s, char c);
+extern void ansi_put_bytes(term_state_t * s, const char * buf, size_t len);
 
 _End_C_Header
 
@@ -21,6 +21,10 @@ struct TR_Font {
 extern int tr_font_get_width(struct TR_Font * font, char * string);
 extern int tr_font_write(struct TR_Font * font, gfx_context_t * ctx, int x, int y, char * string);
 
+#define TR_UNIT_TEXT    0
+#define TR_UNIT_SPACE   1
+#define TR_UNIT_NEWLINE 2
+
 struct TR_TextUnit {
 	char * string;
 	int unit_type;
@@ -59,6 +63,27 @@ struct TR_TextRegion {
 	bool break_all; /* False by default */
 	char * title; /* blank by default */
 	int max_lines; /* 0 is None */
+
+	/* Retained-mode rendering state. Lines render once into cached
+	 * sprites; scrolling and repeated draws reuse them. Managed by
+	 * set_text/reflow/draw - leave zeroed. */
+	list_t * units;    /* TR_TextUnit list owned by the region */
+	int damage_scroll; /* scroll position at the last tracked draw */
+	int damage_all;    /* content or layout changed since last draw */
+};
+
+/* One flowed line: the units on it and its lazily-built rendering. */
+struct TR_Line {
+	list_t * units;   /* borrowed from the region's unit list */
+	int width;        /* total advance width of the line */
+	sprite_t * cache; /* rendered line; NULL until first drawn */
+};
+
+struct TR_DamageRect {
+	int x;
+	int y;
+	int width;
+	int height;
 };
 
 struct TR_Offset {
@@ -89,4 +114,10 @@ extern void tr_textregion_pick(struct TR_TextRegion * self, int x, int y, struct
 extern struct TR_TextUnit * tr_textregion_click(struct TR_TextRegion * self, int x, int y);
 extern void tr_textregion_draw(struct TR_TextRegion * self, gfx_context_t * ctx);
 
+/* Blit only what changed since the previous call and report it as
+ * rectangles for yutani_flip_region; returns the rectangle count (0
+ * when the screen already matches). Use tr_textregion_draw instead
+ * after externally clearing the area under the region. */
+extern int tr_textregion_draw_damage(struct TR_TextRegion * self, gfx_context_t * ctx, struct TR_DamageRect * rects, int max_rects);
+
 _End_C_Header
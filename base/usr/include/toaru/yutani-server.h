@@ -114,6 +114,12 @@ typedef struct YutaniServerWindow {
 	uint32_t newbufid;
 	uint8_t * newbuffer;
 
+	/* Second canvas for double-buffered windows */
+	uint8_t * buffer2;
+	uint32_t bufid2;
+	uint32_t newbufid2;
+	uint8_t * newbuffer2;
+
 	/* Connection that owns this window */
 	uint32_t owner;
 
@@ -130,6 +136,12 @@ typedef struct YutaniServerWindow {
 	int anim_mode;
 	uint32_t anim_start;
 
+	/* Move tween: programmatic moves glide from move_from_* to x/y.
+	 * A start time of 0 means no move tween is active. */
+	uint32_t move_anim_start;
+	int32_t move_from_x;
+	int32_t move_from_y;
+
 	/* Alpha shaping threshold */
 	int alpha_threshold;
 
@@ -154,6 +166,21 @@ typedef struct YutaniServerWindow {
 
 	/* Window opacity */
 	int opacity;
+
+	/* Frame-complete notifications: notify is the client opt-in,
+	 * pending means a client flip awaits presentation */
+	int frame_notify;
+	int frame_pending;
+
+	/* Atlas backing for small buffers: segment shm id (0 = dedicated
+	 * segment keyed by bufid), span offset and span size. The `new`
+	 * set mirrors newbufid during a resize. */
+	uint32_t atlas;
+	uint32_t atlas_offset;
+	uint32_t atlas_size;
+	uint32_t newatlas;
+	uint32_t newatlas_offset;
+	uint32_t newatlas_size;
 } yutani_server_window_t;
 
 typedef struct YutaniGlobals {
@@ -187,8 +214,8 @@ typedef struct YutaniGlobals {
 	/* List of all windows */
 	list_t * windows;
 
-	/* Hash of window IDs to their objects */
-	hashmap_t * wids_to_windows;
+	/* Map of window IDs to their objects */
+	intmap_t * wids_to_windows;
 
 	/*
 	 * Window stacking information
@@ -253,8 +280,8 @@ typedef struct YutaniGlobals {
 	list_t * window_subscribers;
 
 	/* When the server started, used for timing functions */
-	time_t start_time;
-	suseconds_t start_subtime;
+	time_t start_time;      /* Monotonic clock reading at startup... */
+	long start_subtime;     /* ...from which frame times are measured */
 
 	/* Basic lock to prevent redraw thread and communication thread interference */
 	volatile int redraw_lock;
@@ -275,6 +302,11 @@ typedef struct YutaniGlobals {
 	/* Map of clients to their windows */
 	hashmap_t * clients_to_windows;
 
+	/* Map of clients to their negotiated protocol version and hello
+	 * flags (version in the low byte, flags above it); clients absent
+	 * from the map are v1 */
+	hashmap_t * client_protocols;
+
 	/* Toggles for debugging window locations */
 	int debug_bounds;
 	int debug_shapes;
@@ -296,11 +328,28 @@ typedef struct YutaniGlobals {
 	int vbox_rects;
 	int vbox_pointer;
 
+	/* Framebuffer fd for the hardware cursor plane ioctls */
+	int cursor_plane;
+
 	/* Renderer plugin context */
 	void * renderer_ctx;
 
 	int reload_renderer;
 	uint8_t active_modifiers;
+
+	/* Frame scheduler statistics, updated by the render thread */
+	uint32_t frames_painted;
+	uint32_t frames_missed;
+	uint32_t last_paint_msec;
+	uint32_t total_paint_msec;
+
+	/* Input latency tracking: earliest unpresented device timestamp,
+	 * event count, and log2(ms) histograms for device-to-handling
+	 * and device-to-presentation deltas */
+	uint32_t input_pending_since;
+	uint32_t input_events;
+	uint32_t latency_queue_hist[YUTANI_LATENCY_BUCKETS];
+	uint32_t latency_present_hist[YUTANI_LATENCY_BUCKETS];
 } yutani_globals_t;
 
 struct key_bind {
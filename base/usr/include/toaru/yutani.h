@@ -15,6 +15,7 @@
 #include <stdbool.h>
 
 #include <toaru/hashmap.h>
+#include <toaru/intmap.h>
 #include <toaru/graphics.h>
 #include <toaru/kbd.h>
 #include <toaru/mouse.h>
@@ -34,14 +35,35 @@ typedef struct yutani_context {
 	size_t display_width;
 	size_t display_height;
 
-	/* Hash of window IDs to window objects */
-	hashmap_t * windows;
+	/* Map of window IDs to window objects */
+	intmap_t * windows;
 
 	/* queued events */
 	list_t * queued;
 
 	/* server identifier string */
 	char * server_ident;
+
+	/* outgoing message batch, sent as one packet */
+	char * out_buf;
+	size_t out_len;
+
+	/* negotiated protocol version; 1 until the welcome says otherwise */
+	int protocol;
+
+	/* hello flags we advertised (see YUTANI_HELLO_FLAG_*) */
+	uint32_t hello_flags;
+
+	/* Shared atlas segments mapped by this connection, refcounted so
+	 * windows sharing a segment don't unmap it from under each other */
+	intmap_t * atlases;
+
+	/* Per-type index into `queued`, so waiting for one message type
+	 * never rescans the others */
+	intmap_t * pending_by_type;
+
+	/* Handlers registered with yutani_set_msg_handler */
+	intmap_t * handlers;
 } yutani_t;
 
 typedef struct yutani_window {
@@ -79,6 +101,22 @@ typedef struct yutani_window {
 
 	/* Server context that owns this window */
 	yutani_t * ctx;
+
+	/* Second canvas and age bookkeeping for double-buffered windows */
+	char * buffer2;
+	uint32_t bufid2;
+	uint32_t oldbufid2;
+	uint32_t buffer_age;  /* Age of the current draw buffer; 0 = contents undefined */
+	uint32_t buffer2_age;
+
+	/* Called when the server presents a frame containing this window's
+	 * damage; see yutani_window_request_frames. */
+	void (*frame_callback)(struct yutani_window * window, uint32_t timestamp);
+
+	/* Shared-segment backing for small buffers; 0 = dedicated segment.
+	 * The buffer pointer already includes the offset. */
+	uint32_t atlas;
+	uint32_t oldatlas;
 } yutani_window_t;
 
 typedef struct yutani_message {
@@ -88,9 +126,51 @@ typedef struct yutani_message {
 	char data[];
 } yutani_msg_t;
 
+/*
+ * Protocol v2 frames replace the 12-byte header above with 4 bytes;
+ * `size` covers the whole frame. Message types fold to 16 bits with
+ * YUTANI_MSGC_SERVER standing in for the 0x0001xxxx response range.
+ * A frame is self-describing: the first four bytes of a v1 frame are
+ * always the magic, which no compact frame can produce, so both kinds
+ * can share a connection during negotiation.
+ */
+typedef struct yutani_compact_message {
+	uint16_t type;
+	uint16_t size;
+	char data[];
+} yutani_cmsg_t;
+
+#define YUTANI_PROTOCOL_VERSION 2
+
+#define YUTANI_MSGC_SERVER 0x8000
+
+/* Mouse events at motion speed dominate the event stream; they get a
+ * dedicated packed layout when the coordinates fit in 16 bits. */
+#define YUTANI_MSGC_MOUSE_PACKED 0x7F0C
+struct yutani_msgc_window_mouse_event {
+	uint32_t wid;
+	int16_t new_x;
+	int16_t new_y;
+	int16_t old_x;
+	int16_t old_y;
+	uint8_t buttons;
+	uint8_t command;
+	uint8_t modifiers;
+} __attribute__((packed));
+
+/* v1 clients send a bare hello; the payload is how v2 announces itself. */
+struct yutani_msg_hello {
+	uint32_t version;
+	uint32_t flags;
+};
+
+/* The client handles consecutive unread mouse MOVE events as one. */
+#define YUTANI_HELLO_FLAG_COALESCE_MOUSE (1 << 0)
+
 struct yutani_msg_welcome {
 	uint32_t display_width;
 	uint32_t display_height;
+	uint32_t version; /* Server protocol version; absent from v1 servers */
 };
 
 struct yutani_msg_flip {
@@ -117,6 +197,8 @@ struct yutani_msg_window_init {
 	uint32_t width;
 	uint32_t height;
 	uint32_t bufid;
+	uint32_t atlas;  /* shm id of shared segment; 0 = dedicated segment keyed by bufid */
+	uint32_t offset; /* byte offset of this buffer within the atlas segment */
 };
 
 struct yutani_msg_window_move {
@@ -166,12 +248,23 @@ struct yutani_msg_flip_region {
 	int32_t height;
 };
 
+struct yutani_msg_flip_buffer {
+	yutani_wid_t wid;
+	uint32_t bufid;
+	int32_t x;
+	int32_t y;
+	int32_t width;
+	int32_t height;
+};
+
 struct yutani_msg_window_resize {
 	yutani_wid_t wid;
 	uint32_t width;
 	uint32_t height;
 	uint32_t bufid;
 	uint32_t flags;
+	uint32_t atlas;  /* As in window_init; only meaningful in RESIZE_BUFID */
+	uint32_t offset;
 };
 
 struct yutani_msg_window_advertise {
@@ -238,6 +331,30 @@ struct yutani_msg_special_request {
 	uint32_t request;
 };
 
+struct yutani_msg_frame_stats {
+	uint32_t frame_interval;   /* Scheduler interval in milliseconds */
+	uint32_t frames_painted;   /* Frames that actually drew something */
+	uint32_t frames_missed;    /* Frames that overran their deadline */
+	uint32_t last_paint_msec;  /* Paint time of the most recent frame */
+	uint32_t total_paint_msec; /* Cumulative paint time across all frames */
+};
+
+struct yutani_msg_frame_complete {
+	yutani_wid_t wid;
+	uint32_t timestamp; /* Server clock, milliseconds */
+};
+
+/* Input latency histograms use log2(milliseconds) buckets:
+ * bucket 0 is <1ms, bucket n covers [2^(n-1), 2^n) ms, and the
+ * last bucket collects everything past it. */
+#define YUTANI_LATENCY_BUCKETS 16
+
+struct yutani_msg_latency_stats {
+	uint32_t input_events;                           /* Device events processed */
+	uint32_t queue_hist[YUTANI_LATENCY_BUCKETS];     /* Device timestamp to compositor handling */
+	uint32_t present_hist[YUTANI_LATENCY_BUCKETS];   /* Device timestamp to frame presentation */
+};
+
 struct yutani_msg_clipboard {
 	uint32_t size;
 	char content[];
@@ -285,6 +402,7 @@ struct yutani_msg_clipboard {
 #define YUTANI_MSG_KEY_BIND            0x00000040
 
 #define YUTANI_MSG_WINDOW_UPDATE_SHAPE 0x00000050
+#define YUTANI_MSG_FLIP_BUFFER         0x00000051
 
 #define YUTANI_MSG_CLIPBOARD           0x00000060
 
@@ -296,6 +414,9 @@ struct yutani_msg_clipboard {
 /* Server responses */
 #define YUTANI_MSG_WELCOME             0x00010001
 #define YUTANI_MSG_WINDOW_INIT         0x00010002
+#define YUTANI_MSG_FRAME_STATS         0x00010003
+#define YUTANI_MSG_FRAME_COMPLETE      0x00010004
+#define YUTANI_MSG_LATENCY_STATS       0x00010005
 
 /*
  * YUTANI_ZORDER
@@ -461,6 +582,15 @@ struct yutani_msg_clipboard {
 #define YUTANI_WINDOW_FLAG_ALT_ANIMATION    (1 << 3)
 #define YUTANI_WINDOW_FLAG_DIALOG_ANIMATION (1 << 4)
 
+/*
+ * Request two backing buffers for the window. The client draws into one
+ * while the server presents the other; yutani_window_swap_buffers trades
+ * them. The second buffer always has the id immediately after the first -
+ * both sides allocate them back to back and rely on that, which keeps
+ * the init and resize messages unchanged.
+ */
+#define YUTANI_WINDOW_FLAG_DOUBLE_BUFFERED  (1 << 5)
+
 /* YUTANI_SPECIAL_REQUEST
  *
  * Special one-off single-shot request messages.
@@ -472,6 +602,13 @@ struct yutani_msg_clipboard {
 
 #define YUTANI_SPECIAL_REQUEST_RELOAD       20
 
+#define YUTANI_SPECIAL_REQUEST_FRAME_STATS  30
+
+#define YUTANI_SPECIAL_REQUEST_FRAMES_ON    31
+#define YUTANI_SPECIAL_REQUEST_FRAMES_OFF   32
+
+#define YUTANI_SPECIAL_REQUEST_LATENCY_STATS 33
+
 /*
  * YUTANI_RESIZE
  *
@@ -497,7 +634,16 @@ extern yutani_msg_t * yutani_poll(yutani_t * y);
 extern yutani_msg_t * yutani_poll_async(yutani_t * y);
 extern size_t yutani_query(yutani_t * y);
 
+/* High-rate event types drop their oldest entries past this depth */
+#define YUTANI_TYPE_QUEUE_BOUND 512
+
+typedef void (*yutani_msg_handler_t)(yutani_t * y, yutani_msg_t * msg, void * data);
+extern void yutani_set_msg_handler(yutani_t * y, uint32_t type, yutani_msg_handler_t handler, void * data);
+extern int yutani_dispatch_pending(yutani_t * y);
+extern void yutani_dispatch(yutani_t * y);
+
 extern int yutani_msg_send(yutani_t * y, yutani_msg_t * msg);
+extern int yutani_flush(yutani_t * y);
 extern yutani_t * yutani_context_create(FILE * socket);
 extern yutani_t * yutani_init(void);
 extern yutani_window_t * yutani_window_create(yutani_t * y, int width, int height);
@@ -507,6 +653,8 @@ extern void yutani_window_move(yutani_t * yctx, yutani_window_t * window, int x,
 extern void yutani_close(yutani_t * y, yutani_window_t * win);
 extern void yutani_set_stack(yutani_t *, yutani_window_t *, int);
 extern void yutani_flip_region(yutani_t *, yutani_window_t * win, int32_t x, int32_t y, int32_t width, int32_t height);
+extern void yutani_window_swap_buffers(yutani_t * yctx, yutani_window_t * win, int32_t x, int32_t y, int32_t width, int32_t height);
+extern int yutani_window_buffer_age(yutani_window_t * win);
 extern void yutani_window_resize(yutani_t * yctx, yutani_window_t * window, uint32_t width, uint32_t height);
 extern void yutani_window_resize_offer(yutani_t * yctx, yutani_window_t * window, uint32_t width, uint32_t height);
 extern void yutani_window_resize_accept(yutani_t * yctx, yutani_window_t * window, uint32_t width, uint32_t height);
@@ -527,6 +675,7 @@ extern void yutani_window_show_mouse(yutani_t * yctx, yutani_window_t * window,
 extern void yutani_window_resize_start(yutani_t * yctx, yutani_window_t * window, yutani_scale_direction_t direction);
 extern void yutani_special_request(yutani_t * yctx, yutani_window_t * window, uint32_t request);
 extern void yutani_special_request_wid(yutani_t * yctx, yutani_wid_t wid, uint32_t request);
+extern void yutani_window_request_frames(yutani_t * yctx, yutani_window_t * window, void (*callback)(yutani_window_t *, uint32_t));
 extern void yutani_set_clipboard(yutani_t * yctx, char * content);
 extern FILE * yutani_open_clipboard(yutani_t * yctx);
 
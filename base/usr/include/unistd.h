@@ -23,6 +23,8 @@ extern int execv(const char *path, char *const argv[]);
 extern int execvp(const char *file, char *const argv[]);
 extern int execvpe(const char *file, char *const argv[], char *const envp[]);
 extern int execve(const char *name, char * const argv[], char * const envp[]);
+/* toaru-specific combined fork+exec; see libc/unistd/spawn.c */
+extern pid_t spawn(const char *path, char * const argv[], char * const envp[], int * fd_map, int fd_count);
 extern void _exit(int status);
 
 extern int setuid(uid_t uid);
@@ -42,6 +44,9 @@ extern int tcsetpgrp(int fd, pid_t pgrp);
 extern ssize_t write(int fd, const void * buf, size_t count);
 extern ssize_t read(int fd, void * buf, size_t count);
 
+extern int fsync(int fd);
+extern int fdatasync(int fd);
+
 extern int symlink(const char *target, const char *linkpath);
 extern ssize_t readlink(const char *pathname, char *buf, size_t bufsiz);
 
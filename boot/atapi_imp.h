@@ -180,18 +180,18 @@ _try_again:
 	}
 
 	atapi_command_t command;
-	command.command_bytes[0] = 0x28;
+	command.command_bytes[0] = 0xA8; /* READ(12), which has a full 32-bit transfer length */
 	command.command_bytes[1] = 0;
 	command.command_bytes[2] = (lba >> 0x18) & 0xFF;
 	command.command_bytes[3] = (lba >> 0x10) & 0xFF;
 	command.command_bytes[4] = (lba >> 0x08) & 0xFF;
 	command.command_bytes[5] = (lba >> 0x00) & 0xFF;
-	command.command_bytes[6] = sectors >> 16;
-	command.command_bytes[7] = sectors >> 8;
-	command.command_bytes[8] = sectors; /* bit 0 = PMI (0, last sector) */
-	command.command_bytes[9] = 0; /* control */
+	command.command_bytes[6] = (sectors >> 0x18) & 0xFF;
+	command.command_bytes[7] = (sectors >> 0x10) & 0xFF;
+	command.command_bytes[8] = (sectors >> 0x08) & 0xFF;
+	command.command_bytes[9] = (sectors >> 0x00) & 0xFF;
 	command.command_bytes[10] = 0;
-	command.command_bytes[11] = 0;
+	command.command_bytes[11] = 0; /* control */
 
 	for (int i = 0; i < 6; ++i) {
 		outports(bus, command.command_words[i]);
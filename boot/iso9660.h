@@ -118,14 +118,18 @@ static uint8_t * mod_dir = (uint8_t *)0x21000;
 static uint8_t * dir_entries = (uint8_t *)(0x30000);
 static struct ata_device * device = 0;
 
+static uint32_t dir_entries_lba = 0xFFFFFFFF;
+
 static int navigate(char * name) {
-	memset(dir_entries, 2048, 0xA5);
 	//print("reading from sector ");
 	//print_hex(dir_entry->extent_start_LSB);
 	//print("\n");
-	ata_device_read_sector_atapi(device, dir_entry->extent_start_LSB, dir_entries);
-	ata_device_read_sector_atapi(device, dir_entry->extent_start_LSB+1, dir_entries + 2048);
-	ata_device_read_sector_atapi(device, dir_entry->extent_start_LSB+2, dir_entries + 4096);
+	if (dir_entry->extent_start_LSB != dir_entries_lba) {
+		/* Cache the directory extent; scanning the module directory
+		 * hits this once per module otherwise. */
+		ata_device_read_sectors_atapi(device, dir_entry->extent_start_LSB, dir_entries, 3);
+		dir_entries_lba = dir_entry->extent_start_LSB;
+	}
 
 	long offset = 0;
 	while (1) {
@@ -419,6 +419,27 @@ done_video:
 #endif
 
 #ifndef EFI_PLATFORM
+
+#define SECTORS 512
+
+/* Stream a file extent into memory with large batched reads;
+ * returns the number of bytes the destination pointer advanced. */
+static long read_extent(uint32_t lba, uint32_t length, uint8_t * dest) {
+	long sectors = length / 2048 + 1;
+	long bytes = sectors * 2048;
+	while (sectors >= SECTORS) {
+		print_(".");
+		ata_device_read_sectors_atapi(device, lba, dest, SECTORS);
+		sectors -= SECTORS;
+		dest += 2048 * SECTORS;
+		lba += SECTORS;
+	}
+	if (sectors > 0) {
+		ata_device_read_sectors_atapi(device, lba, dest, sectors);
+	}
+	return bytes;
+}
+
 static void do_it(struct ata_device * _device) {
 	device = _device;
 	if (device->atapi_sector_size != 2048) {
@@ -445,10 +466,7 @@ done:
 		print_hex(dir_entry->extent_start_LSB); print(" ");
 		print_hex(dir_entry->extent_length_LSB); print("\n");
 		long offset = 0;
-		for (int i = dir_entry->extent_start_LSB; i < dir_entry->extent_start_LSB + dir_entry->extent_length_LSB / 2048 + 1; ++i, offset += 2048) {
-
-			ata_device_read_sector_atapi(device, i, (uint8_t *)KERNEL_LOAD_START + offset);
-		}
+		offset += read_extent(dir_entry->extent_start_LSB, dir_entry->extent_length_LSB, (uint8_t *)KERNEL_LOAD_START);
 		while (offset % 4096) offset++;
 		restore_root();
 		if (navigate(module_dir)) {
@@ -466,9 +484,7 @@ done:
 				} else {
 					modules_mboot[j].mod_start = KERNEL_LOAD_START + offset;
 					modules_mboot[j].mod_end = KERNEL_LOAD_START + offset + dir_entry->extent_length_LSB;
-					for (int i = dir_entry->extent_start_LSB; i < dir_entry->extent_start_LSB + dir_entry->extent_length_LSB / 2048 + 1; ++i, offset += 2048) {
-						ata_device_read_sector_atapi(device, i, (uint8_t *)KERNEL_LOAD_START + offset);
-					}
+					offset += read_extent(dir_entry->extent_start_LSB, dir_entry->extent_length_LSB, (uint8_t *)KERNEL_LOAD_START + offset);
 					while (offset % 4096) offset++;
 					j++;
 				}
@@ -486,22 +502,7 @@ done:
 
 				print_("Loading ramdisk");
 
-				int i = dir_entry->extent_start_LSB;
-				int sectors = dir_entry->extent_length_LSB / 2048 + 1;
-#define SECTORS 512
-				while (sectors >= SECTORS) {
-					print_(".");
-					ata_device_read_sectors_atapi(device, i, (uint8_t *)KERNEL_LOAD_START + offset, SECTORS);
-
-					sectors -= SECTORS;
-					offset += 2048 * SECTORS;
-					i += SECTORS;
-				}
-				if (sectors > 0) {
-					print_("!");
-					ata_device_read_sectors_atapi(device, i, (uint8_t *)KERNEL_LOAD_START + offset, sectors);
-					offset += 2048 * sectors;
-				}
+				offset += read_extent(dir_entry->extent_start_LSB, dir_entry->extent_length_LSB, (uint8_t *)KERNEL_LOAD_START + offset);
 
 				final_offset = (uint8_t *)KERNEL_LOAD_START + offset;
 				set_attr(0x07);
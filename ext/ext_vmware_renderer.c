@@ -0,0 +1,118 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ * This file is part of ToaruOS and is released under the terms
+ * of the NCSA / University of Illinois License - see LICENSE.md
+ * Copyright (C) 2018 K. Lange
+ *
+ * Compositor VMware SVGA-II renderer backend
+ *
+ * Window blitting stays in software (renderer_blit_window is not
+ * provided), but presentation goes through the device FIFO: each
+ * frame's damage rectangles are flipped to the visible framebuffer
+ * and then queued as UPDATE commands via IO_VID_UPDATE, so the host
+ * presents just those regions instead of tracing every framebuffer
+ * write.
+ *
+ * The compositor probes renderer_probe() before installing this
+ * backend; it fails on anything that isn't a vmware/QEMU SVGA-II
+ * display.
+ */
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <kernel/video.h>
+#include <toaru/yutani-server.h>
+
+#define MAX_RECTS 32
+
+struct vmware_renderer {
+	int fd;
+	int count;    /* Recorded damage rects; -1 means overflowed */
+	gfx_rect_t rects[MAX_RECTS];
+};
+
+/* Can this display actually take UPDATE commands? */
+int renderer_probe(void) {
+	int fd = open("/dev/fb0", O_RDONLY);
+	if (fd < 0) return 1;
+
+	struct vid_update u = {0, 0, 0, 0};
+	int res = ioctl(fd, IO_VID_UPDATE, &u);
+	close(fd);
+
+	return res < 0;
+}
+
+int renderer_alloc(yutani_globals_t * yg) {
+	struct vmware_renderer * c = malloc(sizeof(struct vmware_renderer));
+	c->fd = open("/dev/fb0", O_RDONLY);
+	c->count = 0;
+	yg->renderer_ctx = c;
+	return 0;
+}
+
+int renderer_init(yutani_globals_t * yg) {
+	struct vmware_renderer * c = yg->renderer_ctx;
+	c->count = 0;
+	return 0;
+}
+
+int renderer_add_clip(yutani_globals_t * yg, double x, double y, double w, double h) {
+	struct vmware_renderer * c = yg->renderer_ctx;
+
+	/* Software blitting still wants the backend clip regions */
+	gfx_add_clip(yg->backend_ctx, (int)x, (int)y, (int)w, (int)h);
+
+	if (c->count < 0) return 0;
+	if (c->count == MAX_RECTS) {
+		/* Too many regions this frame; degrade to one full update */
+		c->count = -1;
+		return 0;
+	}
+
+	c->rects[c->count].x = (int32_t)x;
+	c->rects[c->count].y = (int32_t)y;
+	c->rects[c->count].width = (int32_t)w;
+	c->rects[c->count].height = (int32_t)h;
+	c->count++;
+	return 0;
+}
+
+int renderer_destroy(yutani_globals_t * yg) {
+	struct vmware_renderer * c = yg->renderer_ctx;
+	c->count = 0;
+	return 0;
+}
+
+int renderer_blit_screen(yutani_globals_t * yg) {
+	struct vmware_renderer * c = yg->renderer_ctx;
+
+	if (c->count < 0) {
+		flip(yg->backend_ctx);
+		struct vid_update u = {0, 0, yg->width, yg->height};
+		ioctl(c->fd, IO_VID_UPDATE, &u);
+	} else {
+		flip_regions(yg->backend_ctx, c->rects, c->count);
+		for (int i = 0; i < c->count; ++i) {
+			/* Clamp to the screen; the host rejects rects that hang off it */
+			int32_t x = c->rects[i].x;
+			int32_t y = c->rects[i].y;
+			int32_t w = c->rects[i].width;
+			int32_t h = c->rects[i].height;
+			if (x < 0) { w += x; x = 0; }
+			if (y < 0) { h += y; y = 0; }
+			if (x + w > (int32_t)yg->width)  w = yg->width - x;
+			if (y + h > (int32_t)yg->height) h = yg->height - y;
+			if (w <= 0 || h <= 0) continue;
+
+			struct vid_update u = {x, y, w, h};
+			ioctl(c->fd, IO_VID_UPDATE, &u);
+		}
+	}
+
+	gfx_clear_clip(yg->backend_ctx);
+	c->count = 0;
+	return 0;
+}
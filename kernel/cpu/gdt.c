@@ -10,6 +10,7 @@
 #include <kernel/system.h>
 #include <kernel/logging.h>
 #include <kernel/tss.h>
+#include <kernel/smp.h>
 
 typedef struct {
 	/* Limits */
@@ -28,16 +29,16 @@ typedef struct {
 	uintptr_t base;
 } __attribute__((packed)) gdt_pointer_t;
 
-/* In the future we may need to put a lock on the access of this */
+/* One GDT (and TSS) per processor; slot 0 is the boot processor. */
 static struct {
     gdt_entry_t entries[6];
     gdt_pointer_t pointer;
     tss_entry_t tss;
-} gdt __attribute__((used));
+} gdt[SMP_MAX_CORES] __attribute__((used));
 
 extern void gdt_flush(uintptr_t);
 
-#define ENTRY(X) (gdt.entries[(X)])
+#define ENTRY(X) (gdt[0].entries[(X)])
 
 void gdt_set_gate(uint8_t num, uint64_t base, uint64_t limit, uint8_t access, uint8_t gran) {
 	/* Base Address */
@@ -53,11 +54,11 @@ void gdt_set_gate(uint8_t num, uint64_t base, uint64_t limit, uint8_t access, ui
 	ENTRY(num).access = access;
 }
 
-static void write_tss(int32_t num, uint16_t ss0, uint32_t esp0);
+static void write_tss(int core, int32_t num, uint16_t ss0, uint32_t esp0);
 
 void gdt_install(void) {
-	gdt_pointer_t *gdtp = &gdt.pointer;
-	gdtp->limit = sizeof gdt.entries - 1;
+	gdt_pointer_t *gdtp = &gdt[0].pointer;
+	gdtp->limit = sizeof gdt[0].entries - 1;
 	gdtp->base = (uintptr_t)&ENTRY(0);
 
 	gdt_set_gate(0, 0, 0, 0, 0);                /* NULL segment */
@@ -66,20 +67,44 @@ void gdt_install(void) {
 	gdt_set_gate(3, 0, 0xFFFFFFFF, 0xFA, 0xCF); /* User code */
 	gdt_set_gate(4, 0, 0xFFFFFFFF, 0xF2, 0xCF); /* User data */
 
-	write_tss(5, 0x10, 0x0);
+	write_tss(0, 5, 0x10, 0x0);
 
 	/* Go go go */
 	gdt_flush((uintptr_t)gdtp);
 	tss_flush();
 }
 
-static void write_tss(int32_t num, uint16_t ss0, uint32_t esp0) {
-	tss_entry_t * tss = &gdt.tss;
+/*
+ * Install a descriptor table on an application processor.
+ * The segment descriptors are identical to the boot processor's;
+ * only the TSS (and thus the kernel stack slot) is per-core.
+ */
+void gdt_install_ap(int core) {
+	memcpy(gdt[core].entries, gdt[0].entries, sizeof gdt[0].entries);
+
+	gdt_pointer_t * gdtp = &gdt[core].pointer;
+	gdtp->limit = sizeof gdt[core].entries - 1;
+	gdtp->base = (uintptr_t)&gdt[core].entries[0];
+
+	write_tss(core, 5, 0x10, 0x0);
+
+	gdt_flush((uintptr_t)gdtp);
+	tss_flush();
+}
+
+static void write_tss(int core, int32_t num, uint16_t ss0, uint32_t esp0) {
+	tss_entry_t * tss = &gdt[core].tss;
 	uintptr_t base = (uintptr_t)tss;
 	uintptr_t limit = base + sizeof *tss;
 
-	/* Add the TSS descriptor to the GDT */
-	gdt_set_gate(num, base, limit, 0xE9, 0x00);
+	/* Add the TSS descriptor to this core's GDT */
+	gdt_entry_t * entry = &gdt[core].entries[num];
+	entry->base_low    = (base & 0xFFFF);
+	entry->base_middle = (base >> 16) & 0xFF;
+	entry->base_high   = (base >> 24) & 0xFF;
+	entry->limit_low   = (limit & 0xFFFF);
+	entry->granularity = (limit >> 16) & 0x0F;
+	entry->access      = 0xE9;
 
 	memset(tss, 0x0, sizeof *tss);
 
@@ -96,7 +121,7 @@ static void write_tss(int32_t num, uint16_t ss0, uint32_t esp0) {
 }
 
 void set_kernel_stack(uintptr_t stack) {
-	/* Set the kernel stack */
-	gdt.tss.esp0 = stack;
+	/* Set the kernel stack for the core we are running on */
+	gdt[smp_processor_id()].tss.esp0 = stack;
 }
 
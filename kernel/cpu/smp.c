@@ -0,0 +1,245 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ * This file is part of ToaruOS and is released under the terms
+ * of the NCSA / University of Illinois License - see LICENSE.md
+ *
+ * Symmetric multiprocessing support
+ *
+ * Scans the ACPI tables for additional processors, brings them out
+ * of real mode through the trampoline in ap_boot.S, and gives each
+ * one its own GDT/TSS and idle stack. Application processors park
+ * in ap_main() until the scheduler is taught to feed them; the
+ * per-CPU bookkeeping they will need is established here.
+ */
+#include <kernel/system.h>
+#include <kernel/logging.h>
+#include <kernel/process.h>
+#include <kernel/smp.h>
+#include <kernel/args.h>
+#include <kernel/mem.h>
+
+processor_t processor_local_data[SMP_MAX_CORES] = {{0}};
+int processor_count = 1;
+
+static uintptr_t lapic_base = 0;
+
+/* ACPI table layouts - only as much as we need to find the MADT. */
+struct rsdp {
+	char     signature[8];
+	uint8_t  checksum;
+	char     oem[6];
+	uint8_t  revision;
+	uint32_t rsdt_address;
+} __attribute__((packed));
+
+struct sdt_header {
+	char     signature[4];
+	uint32_t length;
+	uint8_t  revision;
+	uint8_t  checksum;
+	char     oem[6];
+	char     oem_table[8];
+	uint32_t oem_revision;
+	uint32_t creator_id;
+	uint32_t creator_revision;
+} __attribute__((packed));
+
+struct madt {
+	struct sdt_header header;
+	uint32_t lapic_address;
+	uint32_t flags;
+	uint8_t  entries[];
+} __attribute__((packed));
+
+uint32_t lapic_read(size_t addr) {
+	return *(volatile uint32_t *)(lapic_base + addr);
+}
+
+void lapic_write(size_t addr, uint32_t value) {
+	*(volatile uint32_t *)(lapic_base + addr) = value;
+	lapic_read(0x20);
+}
+
+void lapic_send_ipi(int lapic_id, uint32_t value) {
+	lapic_write(0x310, lapic_id << 24);
+	lapic_write(0x300, value);
+	do { asm volatile ("pause" : : : "memory"); } while (lapic_read(0x300) & (1 << 12));
+}
+
+int smp_processor_id(void) {
+	if (!lapic_base) return 0;
+	int lapic_id = lapic_read(0x20) >> 24;
+	for (int i = 0; i < processor_count; ++i) {
+		if (processor_local_data[i].lapic_id == lapic_id) return i;
+	}
+	return 0;
+}
+
+static uint8_t checksum_range(uint8_t * data, size_t length) {
+	uint8_t check = 0;
+	while (length--) {
+		check += *data++;
+	}
+	return check;
+}
+
+/*
+ * Find the RSDP in the EBDA or the BIOS ROM area. These are
+ * identity-mapped with the rest of low memory at this point.
+ */
+static struct rsdp * find_rsdp(void) {
+	for (uintptr_t scan = 0x000E0000; scan < 0x00100000; scan += 16) {
+		if (!memcmp((void *)scan, "RSD PTR ", 8)) {
+			if (!checksum_range((uint8_t *)scan, sizeof(struct rsdp))) {
+				return (struct rsdp *)scan;
+			}
+		}
+	}
+	uintptr_t ebda = (*(uint16_t *)0x40E) << 4;
+	if (ebda) {
+		for (uintptr_t scan = ebda; scan < ebda + 0x400; scan += 16) {
+			if (!memcmp((void *)scan, "RSD PTR ", 8)) {
+				if (!checksum_range((uint8_t *)scan, sizeof(struct rsdp))) {
+					return (struct rsdp *)scan;
+				}
+			}
+		}
+	}
+	return NULL;
+}
+
+static void map_identity_page(uintptr_t addr) {
+	dma_frame(get_page(addr, 1, kernel_directory), 1, 1, addr);
+}
+
+/* Trampoline blob from ap_boot.S, copied to low memory for SIPI. */
+extern char _ap_bootstrap_start[];
+extern char _ap_bootstrap_end[];
+
+/* Mailbox the trampoline reads its stack and entry point from. */
+#define AP_BOOTSTRAP_BASE 0x5000
+#define AP_STACK_PTR      0x4F00
+#define AP_PAGE_DIR       0x4F04
+
+volatile int _ap_current_booting = 0;
+
+/* Roughly microsecond-scale delay that does not depend on the PIT. */
+static void short_delay(unsigned long microseconds) {
+	while (microseconds--) {
+		outportb(0x80, 0x00);
+	}
+}
+
+/*
+ * C entry point for application processors, reached from the
+ * trampoline with paging enabled on the kernel directory.
+ *
+ * For now APs set up their CPU-local descriptor tables and halt;
+ * they will start pulling from the run queues once the scheduler
+ * data structures are safe to share. Keeping them parked with a
+ * working LAPIC means a reschedule IPI is all that is needed to
+ * bring them into service later.
+ */
+void ap_main(void) {
+	int me = _ap_current_booting;
+	processor_t * proc = &processor_local_data[me];
+
+	gdt_install_ap(me);
+
+	lapic_write(0xF0, 0x127); /* Enable the local APIC, spurious vector 0x27 */
+
+	proc->online = 1;
+
+	while (1) {
+		asm volatile ("hlt");
+	}
+}
+
+static void smp_start_ap(int i) {
+	processor_t * proc = &processor_local_data[i];
+
+	proc->kernel_stack = (uintptr_t)kvmalloc(KERNEL_STACK_SIZE) + KERNEL_STACK_SIZE;
+	*((volatile uint32_t *)AP_STACK_PTR) = proc->kernel_stack;
+	*((volatile uint32_t *)AP_PAGE_DIR)  = kernel_directory->physical_address;
+	_ap_current_booting = i;
+
+	/* INIT, deassert, then up to two STARTUPs pointing at the trampoline. */
+	lapic_send_ipi(proc->lapic_id, 0x4500);
+	short_delay(5000UL);
+	lapic_send_ipi(proc->lapic_id, 0x4600 | (AP_BOOTSTRAP_BASE >> 12));
+
+	for (int t = 0; t < 100; ++t) {
+		if (proc->online) {
+			debug_print(NOTICE, "CPU %d (LAPIC %d) is up.", i, proc->lapic_id);
+			return;
+		}
+		short_delay(1000UL);
+	}
+	debug_print(WARNING, "CPU %d (LAPIC %d) failed to come up.", i, proc->lapic_id);
+}
+
+void smp_initialize(void) {
+	if (args_present("nosmp")) {
+		debug_print(NOTICE, "SMP disabled by kernel argument.");
+		return;
+	}
+
+	struct rsdp * rsdp = find_rsdp();
+	if (!rsdp) {
+		debug_print(NOTICE, "No RSDP located; assuming uniprocessor.");
+		return;
+	}
+
+	map_identity_page(rsdp->rsdt_address);
+	struct sdt_header * rsdt = (struct sdt_header *)rsdp->rsdt_address;
+	struct madt * madt = NULL;
+
+	uint32_t * tables = (uint32_t *)((uintptr_t)rsdt + sizeof(struct sdt_header));
+	size_t table_count = (rsdt->length - sizeof(struct sdt_header)) / sizeof(uint32_t);
+	for (size_t i = 0; i < table_count; ++i) {
+		map_identity_page(tables[i]);
+		struct sdt_header * header = (struct sdt_header *)tables[i];
+		if (!memcmp(header->signature, "APIC", 4)) {
+			madt = (struct madt *)header;
+			break;
+		}
+	}
+
+	if (!madt) {
+		debug_print(NOTICE, "No MADT in ACPI tables; assuming uniprocessor.");
+		return;
+	}
+
+	lapic_base = madt->lapic_address;
+	for (uintptr_t page = lapic_base; page < lapic_base + 0x1000; page += 0x1000) {
+		map_identity_page(page);
+	}
+
+	/* The boot processor gets slot 0. */
+	processor_local_data[0].cpu_id = 0;
+	processor_local_data[0].lapic_id = lapic_read(0x20) >> 24;
+	processor_local_data[0].online = 1;
+	processor_local_data[0].current_process = current_process;
+
+	for (uint8_t * entry = madt->entries; entry < (uint8_t *)madt + madt->header.length; entry += entry[1]) {
+		if (entry[0] == 0 && (entry[4] & 1)) { /* Enabled local APIC */
+			int lapic_id = entry[3];
+			if (lapic_id == processor_local_data[0].lapic_id) continue;
+			if (processor_count >= SMP_MAX_CORES) break;
+			processor_local_data[processor_count].cpu_id = processor_count;
+			processor_local_data[processor_count].lapic_id = lapic_id;
+			processor_count++;
+		}
+		if (entry[1] == 0) break;
+	}
+
+	debug_print(NOTICE, "MADT describes %d processor%s.", processor_count, processor_count == 1 ? "" : "s");
+	if (processor_count == 1) return;
+
+	/* Copy the real-mode trampoline somewhere a SIPI can reach. */
+	map_identity_page(AP_BOOTSTRAP_BASE);
+	memcpy((void *)AP_BOOTSTRAP_BASE, _ap_bootstrap_start, _ap_bootstrap_end - _ap_bootstrap_start);
+
+	for (int i = 1; i < processor_count; ++i) {
+		smp_start_ap(i);
+	}
+}
@@ -8,6 +8,7 @@
 #include <kernel/system.h>
 #include <kernel/logging.h>
 #include <kernel/process.h>
+#include <kernel/timerwheel.h>
 
 #define PIT_A 0x40
 #define PIT_B 0x41
@@ -47,13 +48,145 @@ signed long _timer_drift = 0;
 
 static int behind = 0;
 
+/*
+ * TSC-backed monotonic clock.
+ *
+ * The PIT only gives us SUBTICKS_PER_TICK granularity, which is useless
+ * for timing anything shorter than a millisecond. At boot we calibrate
+ * the TSC against the PIT countdown and then derive a monotonic
+ * nanosecond clock from it. This assumes the TSC ticks at a constant
+ * rate, which holds everywhere we run.
+ */
+uint64_t tsc_khz = 0; /* TSC ticks per millisecond; 0 until calibrated */
+static uint64_t tsc_boot = 0;
+
+static inline uint64_t read_tsc(void) {
+	uint64_t x;
+	asm volatile ("rdtsc" : "=A" (x));
+	return x;
+}
+
+static uint32_t pit_read_count(void) {
+	outportb(PIT_CONTROL, 0); /* latch channel 0 */
+	uint32_t lo = inportb(PIT_A);
+	uint32_t hi = inportb(PIT_A);
+	return (hi << 8) | lo;
+}
+
+/*
+ * Watch the channel 0 countdown for roughly 20ms and count how many
+ * TSC ticks pass. The counter reloads on wrap (rate generator mode),
+ * so this works whether or not interrupts are being serviced yet.
+ */
+static void tsc_calibrate(void) {
+	uint32_t divisor = PIT_SCALE / SUBTICKS_PER_TICK;
+	uint32_t target  = PIT_SCALE / 50;
+	uint32_t elapsed = 0;
+	uint32_t last = pit_read_count();
+	uint64_t start = read_tsc();
+	while (elapsed < target) {
+		uint32_t current = pit_read_count();
+		if (current <= last) {
+			elapsed += last - current;
+		} else {
+			elapsed += last + (divisor - current);
+		}
+		last = current;
+	}
+	uint64_t end = read_tsc();
+
+	tsc_khz  = (end - start) * (PIT_SCALE / 1000) / elapsed;
+	tsc_boot = start;
+
+	debug_print(NOTICE, "TSC runs at %d KHz", (uint32_t)tsc_khz);
+}
+
+/*
+ * Nanoseconds since boot. Monotonic; unaffected by CMOS resyncs.
+ */
+uint64_t monotonic_time_ns(void) {
+	if (!tsc_khz) {
+		/* Not calibrated (yet); the PIT counters are the best we have. */
+		return (uint64_t)timer_ticks * 1000000000ULL + (uint64_t)timer_subticks * 1000000ULL;
+	}
+	uint64_t delta = read_tsc() - tsc_boot;
+	/* Split the conversion so it doesn't overflow for days. */
+	return (delta / tsc_khz) * 1000000ULL + (delta % tsc_khz) * 1000000ULL / tsc_khz;
+}
+
+/*
+ * Sampling profiler.
+ *
+ * When enabled, every profile_interval-th timer interrupt records the
+ * interrupted EIP and the current process into a fixed ring of samples
+ * which is drained through /proc/profile. The writer runs entirely in
+ * interrupt context, so the generic ring buffer (which takes locks and
+ * sleeps when full) is not usable here; this ring instead drops the
+ * oldest sample on overflow and the reader masks interrupts while it
+ * drains.
+ */
+#define PROFILE_BUFFER_SIZE 4096
+
+static struct profile_sample profile_buffer[PROFILE_BUFFER_SIZE];
+static volatile unsigned int profile_read_ptr = 0;
+static volatile unsigned int profile_write_ptr = 0;
+static unsigned int profile_interval = 0;
+static unsigned int profile_countdown = 0;
+
+/*
+ * Set the sampling interval, in timer interrupts between samples.
+ * An interval of 0 disables sampling.
+ */
+void profile_set_interval(unsigned int interval) {
+	IRQ_OFF;
+	profile_interval = interval;
+	profile_countdown = 0;
+	IRQ_RES;
+}
+
+unsigned int profile_get_interval(void) {
+	return profile_interval;
+}
+
+static void profile_record(struct regs * r) {
+	unsigned int next = (profile_write_ptr + 1) % PROFILE_BUFFER_SIZE;
+	if (next == profile_read_ptr) {
+		/* Ring is full; drop the oldest sample so recent data wins. */
+		profile_read_ptr = (profile_read_ptr + 1) % PROFILE_BUFFER_SIZE;
+	}
+	profile_buffer[profile_write_ptr].eip = r->eip;
+	profile_buffer[profile_write_ptr].pid = current_process ? (int32_t)current_process->id : -1;
+	profile_write_ptr = next;
+}
+
+/*
+ * Copy out as many whole samples as fit in `size` bytes, consuming
+ * them from the ring. Called from process context (procfs).
+ */
+size_t profile_fetch(uint8_t * buffer, size_t size) {
+	size_t collected = 0;
+	IRQ_OFF;
+	while (profile_read_ptr != profile_write_ptr && collected + sizeof(struct profile_sample) <= size) {
+		memcpy(buffer + collected, (void *)&profile_buffer[profile_read_ptr], sizeof(struct profile_sample));
+		profile_read_ptr = (profile_read_ptr + 1) % PROFILE_BUFFER_SIZE;
+		collected += sizeof(struct profile_sample);
+	}
+	IRQ_RES;
+	return collected;
+}
+
 /*
  * IRQ handler for when the timer fires
  */
 int timer_handler(struct regs *r) {
+	if (profile_interval && ++profile_countdown >= profile_interval) {
+		profile_countdown = 0;
+		profile_record(r);
+	}
 	if (++timer_subticks == SUBTICKS_PER_TICK || (behind && ++timer_subticks == SUBTICKS_PER_TICK)) {
 		timer_ticks++;
 		timer_subticks = 0;
+		random_feed_entropy(timer_ticks);
 		if (timer_ticks % RESYNC_TIME == 0) {
 			uint32_t new_time = read_cmos();
 			_timer_drift = new_time - boot_time - timer_ticks;
@@ -61,8 +194,19 @@ int timer_handler(struct regs *r) {
 			else behind = 0;
 		}
 	}
+	/* Charge this subtick to whoever we interrupted; the low bits of
+	 * the saved CS tell us whether they were in user or kernel mode. */
+	if (current_process) {
+		if (r->cs & 0x3) {
+			current_process->usage_user++;
+		} else {
+			current_process->usage_kernel++;
+		}
+	}
+
 	irq_ack(TIMER_IRQ);
 
+	timerwheel_tick();
 	wakeup_sleepers(timer_ticks, timer_subticks);
 	switch_task(1);
 	return 1;
@@ -86,5 +230,6 @@ void timer_install(void) {
 	boot_time = read_cmos();
 	irq_install_handler(TIMER_IRQ, timer_handler, "pit timer");
 	timer_phase(SUBTICKS_PER_TICK); /* 100Hz */
+	tsc_calibrate();
 }
 
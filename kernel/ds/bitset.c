@@ -15,9 +15,14 @@
 	size_t offset = bit & 7; \
 	size_t mask   = 1 << offset;
 
+/* The data size is always a multiple of 8 bytes, so whole words can
+ * be scanned without a partial word at the end. */
+#define WORDS(set) ((set)->size >> 2)
+
 void bitset_init(bitset_t *set, size_t size) {
 	set->size = CEIL(size, 8);
 	set->data = malloc(set->size);
+	set->hint = 0;
 	memset(set->data, 0, set->size);
 }
 
@@ -30,6 +35,7 @@ static void bitset_resize(bitset_t *set, size_t size) {
 		return;
 	}
 
+	size = CEIL(size, 8);
 	set->data = realloc(set->data, size);
 	memset(set->data + set->size, 0, size - set->size);
 	set->size = size;
@@ -44,16 +50,22 @@ void bitset_set(bitset_t *set, size_t bit) {
 }
 
 int bitset_ffub(bitset_t *set) {
-	for (size_t i = 0; i < set->size * 8; i++) {
-		if (bitset_test(set, i)) {
-			continue;
+	/* No bit below the hint is unset, so the scan starts at its
+	 * word; full words cost one compare each and the winning word
+	 * gives up its bit to ctz instead of a bit-by-bit walk. */
+	uint32_t * words = (uint32_t *)set->data;
+	for (size_t i = set->hint >> 5; i < WORDS(set); i++) {
+		if (words[i] != 0xFFFFFFFF) {
+			size_t bit = (i << 5) + __builtin_ctz(~words[i]);
+			set->hint = bit;
+			return (int)bit;
 		}
-		return (int)i;
 	}
 	return -1;
 }
 
 void bitset_clear(bitset_t *set, size_t bit) {
+	if (bit < set->hint) set->hint = bit;
 	iom;
 	set->data[index] &= ~mask;
 }
@@ -63,3 +75,53 @@ int bitset_test(bitset_t *set, size_t bit) {
 	return !!(mask & set->data[index]);
 }
 
+void bitset_set_range(bitset_t *set, size_t bit, size_t count) {
+	if (!count) return;
+	size_t last = bit + count - 1;
+	if (set->size <= (last >> 3)) {
+		bitset_resize(set, (last >> 3) + 1);
+	}
+	/* Mask the ragged edges, memset the whole bytes between */
+	while (count && (bit & 7)) {
+		set->data[bit >> 3] |= 1 << (bit & 7);
+		bit++;
+		count--;
+	}
+	if (count >= 8) {
+		memset(&set->data[bit >> 3], 0xFF, count >> 3);
+		bit += count & ~(size_t)7;
+		count &= 7;
+	}
+	while (count--) {
+		set->data[bit >> 3] |= 1 << (bit & 7);
+		bit++;
+	}
+}
+
+void bitset_clear_range(bitset_t *set, size_t bit, size_t count) {
+	if (!count) return;
+	if (bit < set->hint) set->hint = bit;
+	while (count && (bit & 7)) {
+		set->data[bit >> 3] &= ~(1 << (bit & 7));
+		bit++;
+		count--;
+	}
+	if (count >= 8) {
+		memset(&set->data[bit >> 3], 0, count >> 3);
+		bit += count & ~(size_t)7;
+		count &= 7;
+	}
+	while (count--) {
+		set->data[bit >> 3] &= ~(1 << (bit & 7));
+		bit++;
+	}
+}
+
+size_t bitset_count(bitset_t *set) {
+	uint32_t * words = (uint32_t *)set->data;
+	size_t count = 0;
+	for (size_t i = 0; i < WORDS(set); i++) {
+		count += __builtin_popcount(words[i]);
+	}
+	return count;
+}
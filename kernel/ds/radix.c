@@ -0,0 +1,163 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ * This file is part of ToaruOS and is released under the terms
+ * of the NCSA / University of Illinois License - see LICENSE.md
+ * Copyright (C) 2018 K. Lange
+ *
+ * Radix tree
+ *
+ * Integer-keyed container with O(height) lookups that never allocate.
+ * Values are not owned by the tree; NULL is not a storable value, as
+ * an empty slot is how the tree represents absence.
+ */
+#include <kernel/system.h>
+#include <kernel/radix.h>
+
+/* 64-way fan-out: one level covers [0,64), two cover [0,4096), ... */
+#define RADIX_SHIFT 6
+#define RADIX_SLOTS (1UL << RADIX_SHIFT)
+#define RADIX_MASK  (RADIX_SLOTS - 1)
+
+/* Levels needed to cover the full key space */
+#define RADIX_MAX_HEIGHT ((sizeof(uintptr_t) * 8 + RADIX_SHIFT - 1) / RADIX_SHIFT)
+
+struct radix_node {
+	void * slots[RADIX_SLOTS];
+	uint32_t count;    /* Occupied slots, for pruning on remove */
+};
+
+/* Largest key a tree of this height can hold */
+static uintptr_t radix_max_key(int height) {
+	if ((size_t)height >= RADIX_MAX_HEIGHT) return (uintptr_t)-1;
+	return ((uintptr_t)1 << (height * RADIX_SHIFT)) - 1;
+}
+
+static struct radix_node * radix_node_create(void) {
+	struct radix_node * node = malloc(sizeof(struct radix_node));
+	memset(node->slots, 0, sizeof(node->slots));
+	node->count = 0;
+	return node;
+}
+
+radix_tree_t * radix_tree_create(void) {
+	radix_tree_t * tree = malloc(sizeof(radix_tree_t));
+	tree->root = NULL;
+	tree->height = 0;
+	tree->count = 0;
+	return tree;
+}
+
+void * radix_tree_get(radix_tree_t * tree, uintptr_t key) {
+	if (!tree->root || key > radix_max_key(tree->height)) return NULL;
+
+	struct radix_node * node = tree->root;
+	for (int level = tree->height - 1; level > 0; level--) {
+		node = node->slots[(key >> (level * RADIX_SHIFT)) & RADIX_MASK];
+		if (!node) return NULL;
+	}
+	return node->slots[key & RADIX_MASK];
+}
+
+int radix_tree_set(radix_tree_t * tree, uintptr_t key, void * value) {
+	if (!value) return 1;
+
+	/* Grow upward until the key fits; the old root covers the low
+	 * keys and becomes slot 0 of each new root. */
+	while (!tree->root || key > radix_max_key(tree->height)) {
+		struct radix_node * root = radix_node_create();
+		if (tree->root) {
+			root->slots[0] = tree->root;
+			root->count = 1;
+		}
+		tree->root = root;
+		tree->height++;
+	}
+
+	struct radix_node * node = tree->root;
+	for (int level = tree->height - 1; level > 0; level--) {
+		unsigned int index = (key >> (level * RADIX_SHIFT)) & RADIX_MASK;
+		if (!node->slots[index]) {
+			node->slots[index] = radix_node_create();
+			node->count++;
+		}
+		node = node->slots[index];
+	}
+
+	unsigned int index = key & RADIX_MASK;
+	if (!node->slots[index]) {
+		node->count++;
+		tree->count++;
+	}
+	node->slots[index] = value;
+	return 0;
+}
+
+void * radix_tree_remove(radix_tree_t * tree, uintptr_t key) {
+	if (!tree->root || key > radix_max_key(tree->height)) return NULL;
+
+	struct radix_node * path[RADIX_MAX_HEIGHT];
+	unsigned int index[RADIX_MAX_HEIGHT];
+	int depth = 0;
+
+	struct radix_node * node = tree->root;
+	for (int level = tree->height - 1; level > 0; level--) {
+		path[depth] = node;
+		index[depth] = (key >> (level * RADIX_SHIFT)) & RADIX_MASK;
+		node = node->slots[index[depth]];
+		if (!node) return NULL;
+		depth++;
+	}
+
+	unsigned int i = key & RADIX_MASK;
+	void * value = node->slots[i];
+	if (!value) return NULL;
+
+	node->slots[i] = NULL;
+	node->count--;
+	tree->count--;
+
+	/* Prune now-empty nodes back up the walk */
+	while (node->count == 0 && depth > 0) {
+		free(node);
+		depth--;
+		node = path[depth];
+		node->slots[index[depth]] = NULL;
+		node->count--;
+	}
+	if (node->count == 0) {
+		free(node);
+		tree->root = NULL;
+		tree->height = 0;
+	}
+
+	return value;
+}
+
+static void radix_node_foreach(struct radix_node * node, int level, uintptr_t prefix, radix_iterator_t func, void * extra) {
+	for (uintptr_t i = 0; i < RADIX_SLOTS; ++i) {
+		if (!node->slots[i]) continue;
+		if (level > 1) {
+			radix_node_foreach(node->slots[i], level - 1, (prefix << RADIX_SHIFT) | i, func, extra);
+		} else {
+			func((prefix << RADIX_SHIFT) | i, node->slots[i], extra);
+		}
+	}
+}
+
+void radix_tree_foreach(radix_tree_t * tree, radix_iterator_t func, void * extra) {
+	if (!tree->root) return;
+	radix_node_foreach(tree->root, tree->height, 0, func, extra);
+}
+
+static void radix_node_free(struct radix_node * node, int level) {
+	if (level > 1) {
+		for (uintptr_t i = 0; i < RADIX_SLOTS; ++i) {
+			if (node->slots[i]) radix_node_free(node->slots[i], level - 1);
+		}
+	}
+	free(node);
+}
+
+void radix_tree_free(radix_tree_t * tree) {
+	if (tree->root) radix_node_free(tree->root, tree->height);
+	free(tree);
+}
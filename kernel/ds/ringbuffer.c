@@ -7,6 +7,23 @@
 #include <kernel/ringbuffer.h>
 #include <kernel/process.h>
 
+/*
+ * In the unlocked (single-producer/single-consumer) mode the producer
+ * only ever stores write_ptr and the consumer only ever stores
+ * read_ptr, so the copy-then-publish sequence needs no lock; a full
+ * barrier before each index store keeps the data visible first, which
+ * is free on the current uniprocessor target but load-bearing once
+ * this runs on SMP. Rings whose ends can be shared between processes
+ * (pipes across fork, ttys) must use the locked mode.
+ */
+static inline void ring_buffer_lock(ring_buffer_t * ring_buffer) {
+	if (!ring_buffer->no_lock) spin_lock(ring_buffer->lock);
+}
+
+static inline void ring_buffer_unlock(ring_buffer_t * ring_buffer) {
+	if (!ring_buffer->no_lock) spin_unlock(ring_buffer->lock);
+}
+
 size_t ring_buffer_unread(ring_buffer_t * ring_buffer) {
 	if (ring_buffer->read_ptr == ring_buffer->write_ptr) {
 		return 0;
@@ -35,20 +52,6 @@ size_t ring_buffer_available(ring_buffer_t * ring_buffer) {
 	}
 }
 
-static inline void ring_buffer_increment_read(ring_buffer_t * ring_buffer) {
-	ring_buffer->read_ptr++;
-	if (ring_buffer->read_ptr == ring_buffer->size) {
-		ring_buffer->read_ptr = 0;
-	}
-}
-
-static inline void ring_buffer_increment_write(ring_buffer_t * ring_buffer) {
-	ring_buffer->write_ptr++;
-	if (ring_buffer->write_ptr == ring_buffer->size) {
-		ring_buffer->write_ptr = 0;
-	}
-}
-
 void ring_buffer_alert_waiters(ring_buffer_t * ring_buffer) {
 	if (ring_buffer->alert_waiters) {
 		while (ring_buffer->alert_waiters->head) {
@@ -68,20 +71,33 @@ void ring_buffer_select_wait(ring_buffer_t * ring_buffer, void * process) {
 	if (!list_find(ring_buffer->alert_waiters, process)) {
 		list_insert(ring_buffer->alert_waiters, process);
 	}
-	list_insert(((process_t *)process)->node_waits, ring_buffer);
+	process_wait_node_insert((process_t *)process, ring_buffer);
 }
 
+/*
+ * Reads and writes move min(available, requested) with at most two
+ * memcpys (one per side of the wrap point) inside a single locked
+ * section, rather than a byte per pass. Sleepers are only woken when
+ * a pass actually moved data, so a large transfer wakes the other
+ * side once per buffer-full instead of continuously.
+ */
 size_t ring_buffer_read(ring_buffer_t * ring_buffer, size_t size, uint8_t * buffer) {
 	size_t collected = 0;
 	while (collected == 0) {
-		spin_lock(ring_buffer->lock);
-		while (ring_buffer_unread(ring_buffer) > 0 && collected < size) {
-			buffer[collected] = ring_buffer->buffer[ring_buffer->read_ptr];
-			ring_buffer_increment_read(ring_buffer);
-			collected++;
+		ring_buffer_lock(ring_buffer);
+		size_t unread = ring_buffer_unread(ring_buffer);
+		while (unread > 0 && collected < size) {
+			/* Contiguous run from the read head */
+			size_t chunk = ring_buffer->size - ring_buffer->read_ptr;
+			if (chunk > unread) chunk = unread;
+			if (chunk > size - collected) chunk = size - collected;
+			memcpy(buffer + collected, ring_buffer->buffer + ring_buffer->read_ptr, chunk);
+			__sync_synchronize();
+			ring_buffer->read_ptr = (ring_buffer->read_ptr + chunk) & ring_buffer->size_mask;
+			collected += chunk;
+			unread -= chunk;
 		}
-		spin_unlock(ring_buffer->lock);
-		wakeup_queue(ring_buffer->wait_queue_writers);
+		ring_buffer_unlock(ring_buffer);
 		if (collected == 0) {
 			if (sleep_on(ring_buffer->wait_queue_readers) && ring_buffer->internal_stop) {
 				ring_buffer->internal_stop = 0;
@@ -96,17 +112,28 @@ size_t ring_buffer_read(ring_buffer_t * ring_buffer, size_t size, uint8_t * buff
 size_t ring_buffer_write(ring_buffer_t * ring_buffer, size_t size, uint8_t * buffer) {
 	size_t written = 0;
 	while (written < size) {
-		spin_lock(ring_buffer->lock);
+		ring_buffer_lock(ring_buffer);
 
-		while (ring_buffer_available(ring_buffer) > 0 && written < size) {
-			ring_buffer->buffer[ring_buffer->write_ptr] = buffer[written];
-			ring_buffer_increment_write(ring_buffer);
-			written++;
+		size_t available = ring_buffer_available(ring_buffer);
+		size_t moved = 0;
+		while (available > 0 && written < size) {
+			/* Contiguous run from the write head */
+			size_t chunk = ring_buffer->size - ring_buffer->write_ptr;
+			if (chunk > available) chunk = available;
+			if (chunk > size - written) chunk = size - written;
+			memcpy(ring_buffer->buffer + ring_buffer->write_ptr, buffer + written, chunk);
+			__sync_synchronize();
+			ring_buffer->write_ptr = (ring_buffer->write_ptr + chunk) & ring_buffer->size_mask;
+			written += chunk;
+			available -= chunk;
+			moved += chunk;
 		}
 
-		spin_unlock(ring_buffer->lock);
-		wakeup_queue(ring_buffer->wait_queue_readers);
-		ring_buffer_alert_waiters(ring_buffer);
+		ring_buffer_unlock(ring_buffer);
+		if (moved) {
+			wakeup_queue(ring_buffer->wait_queue_readers);
+			ring_buffer_alert_waiters(ring_buffer);
+		}
 		if (written < size) {
 			if (ring_buffer->discard) {
 				break;
@@ -123,13 +150,66 @@ size_t ring_buffer_write(ring_buffer_t * ring_buffer, size_t size, uint8_t * buf
 	return written;
 }
 
-ring_buffer_t * ring_buffer_create(size_t size) {
+static size_t round_to_power_of_two(size_t size) {
+	size_t out = 2;
+	while (out < size) out <<= 1;
+	return out;
+}
+
+/*
+ * Swap in a buffer of the requested capacity, carrying any unread
+ * data across. Refuses to shrink below the current content, and is
+ * unavailable on unlocked rings - there is no way to quiesce their
+ * lockless sides while the buffer moves.
+ */
+int ring_buffer_resize(ring_buffer_t * ring_buffer, size_t size) {
+	if (ring_buffer->no_lock) return -1;
+
+	size = round_to_power_of_two(size);
+
+	spin_lock(ring_buffer->lock);
+
+	size_t unread = ring_buffer_unread(ring_buffer);
+	if (size < unread + 1) {
+		spin_unlock(ring_buffer->lock);
+		return -1;
+	}
+
+	uint8_t * new_buffer = malloc(size);
+	size_t collected = 0;
+	while (collected < unread) {
+		size_t chunk = ring_buffer->size - ring_buffer->read_ptr;
+		if (chunk > unread - collected) chunk = unread - collected;
+		memcpy(new_buffer + collected, ring_buffer->buffer + ring_buffer->read_ptr, chunk);
+		ring_buffer->read_ptr = (ring_buffer->read_ptr + chunk) & ring_buffer->size_mask;
+		collected += chunk;
+	}
+
+	free(ring_buffer->buffer);
+	ring_buffer->buffer    = new_buffer;
+	ring_buffer->size      = size;
+	ring_buffer->size_mask = size - 1;
+	ring_buffer->read_ptr  = 0;
+	ring_buffer->write_ptr = unread;
+
+	spin_unlock(ring_buffer->lock);
+
+	/* A grown ring may have room for a blocked writer now */
+	wakeup_queue(ring_buffer->wait_queue_writers);
+	return 0;
+}
+
+static ring_buffer_t * ring_buffer_create_internal(size_t size, int no_lock) {
 	ring_buffer_t * out = malloc(sizeof(ring_buffer_t));
 
+	size = round_to_power_of_two(size);
+
 	out->buffer     = malloc(size);
 	out->write_ptr  = 0;
 	out->read_ptr   = 0;
 	out->size       = size;
+	out->size_mask  = size - 1;
+	out->no_lock    = no_lock;
 	out->alert_waiters = NULL;
 
 	spin_init(out->lock);
@@ -143,6 +223,14 @@ ring_buffer_t * ring_buffer_create(size_t size) {
 	return out;
 }
 
+ring_buffer_t * ring_buffer_create(size_t size) {
+	return ring_buffer_create_internal(size, 0);
+}
+
+ring_buffer_t * ring_buffer_create_unlocked(size_t size) {
+	return ring_buffer_create_internal(size, 1);
+}
+
 void ring_buffer_destroy(ring_buffer_t * ring_buffer) {
 	free(ring_buffer->buffer);
 
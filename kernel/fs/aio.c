@@ -0,0 +1,229 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ * This file is part of ToaruOS and is released under the terms
+ * of the NCSA / University of Illinois License - see LICENSE.md
+ * Copyright (C) 2018 K. Lange
+ *
+ * Asynchronous file I/O.
+ *
+ * A submission queue serviced by a small pool of kernel worker
+ * tasks. Submitting queues the request and returns immediately; the
+ * workers perform the blocking read_fs/write_fs on the submitter's
+ * behalf, and finished requests sit on a completion list until the
+ * owner reaps them. This gives single-threaded programs (the GUI
+ * apps, mostly) overlap of file I/O with their event loops without
+ * needing threads or helper processes.
+ *
+ * The workers run in kernel address space where user buffers aren't
+ * mapped, so data moves through kernel bounce buffers: write payloads
+ * are captured at submit time and read results are copied out at
+ * reap time, both in the owner's context. Completions are tagged
+ * with the owner's pid; process teardown flushes anything it never
+ * reaped, and a worker finishing a request for a dead pid frees it
+ * rather than queue it.
+ */
+#include <kernel/system.h>
+#include <kernel/fs.h>
+#include <kernel/logging.h>
+#include <kernel/process.h>
+#include <kernel/aio.h>
+
+#include <toaru/list.h>
+
+#define AIO_WORKERS 2
+#define AIO_MAX_LENGTH 0x100000
+#define AIO_REAP_BATCH 32
+
+typedef struct {
+	pid_t owner;
+	int id;
+	int op;
+	fs_node_t * node;
+	uint64_t offset;
+	uint32_t length;
+	void * ubuf;    /* Owner's buffer; only touched in the owner's context */
+	uint8_t * kbuf; /* Kernel bounce buffer */
+	int result;
+} aio_req_t;
+
+static list_t * aio_pending = NULL;
+static list_t * aio_done = NULL;
+static list_t * aio_idle_workers = NULL; /* Workers waiting for submissions */
+static list_t * aio_reapers = NULL;      /* Processes waiting for completions */
+static spin_lock_t aio_lock = { 0 };
+static int aio_next_id = 1;
+static volatile int aio_started = 0;
+
+static void aio_worker(void * arg, char * name) {
+	for (;;) {
+		spin_lock(aio_lock);
+		node_t * n = list_dequeue(aio_pending);
+		spin_unlock(aio_lock);
+
+		if (!n) {
+			/* A submit between our dequeue and this sleep just means
+			 * we wake on the one after; nothing is lost. */
+			sleep_on(aio_idle_workers);
+			continue;
+		}
+
+		aio_req_t * req = n->value;
+		free(n);
+
+		if (req->op == AIO_OP_WRITE) {
+			req->result = write_fs(req->node, req->offset, req->length, req->kbuf);
+		} else {
+			req->result = read_fs(req->node, req->offset, req->length, req->kbuf);
+		}
+
+		if (req->op == AIO_OP_WRITE || req->result < 0) {
+			/* Nothing to copy back at reap time */
+			free(req->kbuf);
+			req->kbuf = NULL;
+		}
+
+		close_fs(req->node);
+		req->node = NULL;
+
+		if (!process_from_pid(req->owner)) {
+			/* The owner died while we worked; nobody will reap this */
+			if (req->kbuf) free(req->kbuf);
+			free(req);
+			continue;
+		}
+
+		spin_lock(aio_lock);
+		list_insert(aio_done, req);
+		spin_unlock(aio_lock);
+		wakeup_queue(aio_reapers);
+	}
+}
+
+static void aio_start(void) {
+	aio_pending = list_create();
+	aio_done = list_create();
+	aio_idle_workers = list_create();
+	aio_reapers = list_create();
+	for (int i = 0; i < AIO_WORKERS; ++i) {
+		create_kernel_tasklet(aio_worker, strdup("[aio]"), NULL);
+	}
+}
+
+/* Queue a request against an open node; runs in the submitter's
+ * context. Returns the completion id, or -errno. */
+int aio_submit(fs_node_t * node, int op, uint64_t offset, uint32_t length, void * buffer) {
+	if (length > AIO_MAX_LENGTH) return -EINVAL;
+
+	if (!aio_started) {
+		/* First submission anywhere starts the workers */
+		aio_start();
+		aio_started = 1;
+	}
+
+	aio_req_t * req = malloc(sizeof(aio_req_t));
+	req->owner = current_process->id;
+	req->op = op;
+	req->node = node;
+	req->offset = offset;
+	req->length = length;
+	req->ubuf = buffer;
+	req->kbuf = malloc(length ? length : 1);
+	req->result = 0;
+
+	if (op == AIO_OP_WRITE) {
+		memcpy(req->kbuf, buffer, length);
+	}
+
+	/* The worker holds the node past any close() the owner might do */
+	vfs_ref(node);
+
+	spin_lock(aio_lock);
+	req->id = aio_next_id++;
+	list_insert(aio_pending, req);
+	spin_unlock(aio_lock);
+
+	wakeup_queue(aio_idle_workers);
+	return req->id;
+}
+
+/* Collect up to max completions for the calling process, copying
+ * read results out to the submitted buffers. Returns how many were
+ * reaped; blocks for at least one if wait is set. */
+int aio_reap(struct aio_completion * out, int max, int wait) {
+	if (max <= 0) return -EINVAL;
+	if (max > AIO_REAP_BATCH) max = AIO_REAP_BATCH;
+	if (!aio_started) return 0;
+
+	aio_req_t * batch[AIO_REAP_BATCH];
+
+	for (;;) {
+		int count = 0;
+
+		spin_lock(aio_lock);
+		node_t * node = aio_done->head;
+		while (node && count < max) {
+			node_t * next = node->next;
+			aio_req_t * req = node->value;
+			if (req->owner == current_process->id) {
+				list_delete(aio_done, node);
+				free(node);
+				batch[count++] = req;
+			}
+			node = next;
+		}
+		spin_unlock(aio_lock);
+
+		/* Copies happen outside the lock; these are our requests and
+		 * nothing else touches them now. */
+		for (int i = 0; i < count; ++i) {
+			aio_req_t * req = batch[i];
+			if (req->kbuf) {
+				if (req->result > 0) {
+					memcpy(req->ubuf, req->kbuf, req->result);
+				}
+				free(req->kbuf);
+			}
+			out[i].id = req->id;
+			out[i].result = req->result;
+			free(req);
+		}
+
+		if (count || !wait) return count;
+		sleep_on(aio_reapers);
+	}
+}
+
+/* Drop everything a dying process submitted but never reaped.
+ * Requests a worker currently holds are caught by its dead-owner
+ * check when they finish. */
+void aio_flush_process(pid_t pid) {
+	if (!aio_started) return;
+
+	list_t * collected = list_create();
+
+	spin_lock(aio_lock);
+	list_t * lists[] = { aio_pending, aio_done };
+	for (int l = 0; l < 2; ++l) {
+		node_t * node = lists[l]->head;
+		while (node) {
+			node_t * next = node->next;
+			aio_req_t * req = node->value;
+			if (req->owner == pid) {
+				list_delete(lists[l], node);
+				free(node);
+				list_insert(collected, req);
+			}
+			node = next;
+		}
+	}
+	spin_unlock(aio_lock);
+
+	node_t * node;
+	while ((node = list_dequeue(collected))) {
+		aio_req_t * req = node->value;
+		if (req->node) close_fs(req->node); /* Was still pending */
+		if (req->kbuf) free(req->kbuf);
+		free(req);
+		free(node);
+	}
+	free(collected);
+}
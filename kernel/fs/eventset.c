@@ -0,0 +1,289 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ * This file is part of ToaruOS and is released under the terms
+ * of the NCSA / University of Illinois License - see LICENSE.md
+ * Copyright (C) 2018 K. Lange
+ *
+ * Event sets - persistent readiness watches over file descriptors
+ *
+ * fswait re-runs selectcheck and selectwait over every descriptor on
+ * every call, so a process watching many descriptors (the compositor,
+ * the panel) pays O(registered) per wakeup. An event set registers
+ * each descriptor once; drivers push readiness into the set's ready
+ * list as it happens, and a wait drains only what is ready.
+ *
+ * This rides the existing selectwait machinery rather than adding a
+ * second registration path to every driver. Drivers record a token of
+ * their choosing (the pipe device, usually) in process->node_waits
+ * when asked to wait, and later alert with that same token; arming a
+ * watch lends the driver a scratch list to capture the token, and
+ * process_alert_node gives event sets first look at incoming tokens.
+ * Because alerts consume the driver-side registration, a drained
+ * watch is re-armed on the way out of a wait, which also keeps the
+ * set level-triggered: a descriptor that is still ready is reported
+ * again on the next wait.
+ *
+ * The set itself is a file node, so it sits in the descriptor table
+ * and is cleaned up by close like anything else. Events are routed to
+ * the creating process only; a set is not useful across fork. A
+ * descriptor should not be watched by an event set and plain fswait
+ * at the same time - whichever registered with the driver first eats
+ * the alert.
+ */
+
+#include <kernel/system.h>
+#include <kernel/fs.h>
+#include <kernel/process.h>
+#include <kernel/logging.h>
+
+#include <sys/eventset.h>
+#include <toaru/list.h>
+
+typedef struct eventset_watch {
+	fs_node_t * node;   /* What we are watching */
+	int fd;             /* The owner's descriptor for it, reported back from waits */
+	void * token;       /* The driver's alert token, captured at arm time */
+	int pending;        /* Non-zero while sitting in the ready list */
+} eventset_watch_t;
+
+typedef struct eventset {
+	spin_lock_t lock;
+	process_t * owner;
+	list_t * watches;       /* of eventset_watch_t */
+	list_t * ready;         /* watches with undrained events */
+	list_t * alert_waiters; /* processes blocked in eventset_wait */
+} eventset_t;
+
+static void eventset_alert_waiters(eventset_t * es) {
+	while (es->alert_waiters->head) {
+		node_t * node = list_dequeue(es->alert_waiters);
+		process_t * p = node->value;
+		free(node);
+		process_alert_node(p, es);
+	}
+}
+
+/*
+ * Register the owner with a watched node's driver and capture the
+ * token the driver will alert with. Interrupts stay off so an alert
+ * can't slip in between the registration and the token store, and so
+ * the scratch list can't be mistaken for a real fswait.
+ */
+static void eventset_arm(eventset_t * es, eventset_watch_t * watch) {
+	process_t * process = es->owner;
+
+	IRQ_OFF;
+	list_t * saved = process->node_waits;
+	process->node_waits = list_create();
+	if (selectwait_fs(watch->node, process) == 0 && process->node_waits->length) {
+		watch->token = process->node_waits->tail->value;
+	} else {
+		debug_print(NOTICE, "Bad selectwait arming event set? 0x%x", watch->node);
+	}
+	node_t * node;
+	while ((node = list_dequeue(process->node_waits))) {
+		process_wait_node_release(process, node);
+	}
+	free(process->node_waits);
+	process->node_waits = saved;
+
+	if (!watch->pending && selectcheck_fs(watch->node) == 0) {
+		/* Already readable; the alert may have fired before we armed. */
+		watch->pending = 1;
+		list_insert(es->ready, watch);
+	}
+	IRQ_RES;
+}
+
+/*
+ * Offer an incoming driver alert to the process's event sets. Returns
+ * non-zero if a set claimed it; process_alert_node falls back to the
+ * plain fswait path otherwise. Called before the node_waits scan.
+ */
+int eventset_alert(void * proc_v, void * token) {
+	process_t * process = proc_v;
+	if (!process->event_sets) return 0;
+
+	foreach(snode, process->event_sets) {
+		eventset_t * es = snode->value;
+		spin_lock(es->lock);
+		foreach(wnode, es->watches) {
+			eventset_watch_t * watch = wnode->value;
+			if (watch->token == token) {
+				if (!watch->pending) {
+					watch->pending = 1;
+					list_insert(es->ready, watch);
+				}
+				spin_unlock(es->lock);
+				eventset_alert_waiters(es);
+				return 1;
+			}
+		}
+		spin_unlock(es->lock);
+	}
+
+	return 0;
+}
+
+static int eventset_check(fs_node_t * node) {
+	eventset_t * es = node->device;
+	return es->ready->length ? 0 : 1;
+}
+
+static int eventset_wait_fs(fs_node_t * node, void * process) {
+	eventset_t * es = node->device;
+
+	spin_lock(es->lock);
+	if (!list_find(es->alert_waiters, process)) {
+		list_insert(es->alert_waiters, process);
+	}
+	spin_unlock(es->lock);
+	process_wait_node_insert((process_t *)process, es);
+
+	return 0;
+}
+
+static void eventset_close(fs_node_t * node) {
+	eventset_t * es = node->device;
+
+	if (is_valid_process(es->owner) && es->owner->event_sets) {
+		node_t * lnode = list_find(es->owner->event_sets, es);
+		if (lnode) {
+			list_delete(es->owner->event_sets, lnode);
+		}
+	}
+
+	/* Driver-side registrations are left in place; alerts for a dead
+	 * set find no matching token and are ignored. */
+	foreach(wnode, es->watches) {
+		free(wnode->value);
+	}
+	list_free(es->watches);
+	free(es->watches);
+	list_free(es->ready);
+	free(es->ready);
+	list_free(es->alert_waiters);
+	free(es->alert_waiters);
+	free(es);
+	node->device = NULL;
+}
+
+fs_node_t * eventset_create(void) {
+	fs_node_t * fnode = malloc(sizeof(fs_node_t));
+	eventset_t * es = malloc(sizeof(eventset_t));
+	memset(fnode, 0, sizeof(fs_node_t));
+	memset(es, 0, sizeof(eventset_t));
+
+	es->owner = (process_t *)current_process;
+	es->watches = list_create();
+	es->ready = list_create();
+	es->alert_waiters = list_create();
+
+	fnode->device = es;
+	strcpy(fnode->name, "[eventset]");
+	fnode->uid  = current_process->user;
+	fnode->gid  = current_process->user;
+	fnode->mask = 0600;
+	fnode->flags = FS_CHARDEVICE;
+	fnode->selectcheck = eventset_check;
+	fnode->selectwait  = eventset_wait_fs;
+	fnode->close = eventset_close;
+	fnode->ctime = now();
+	fnode->mtime = fnode->ctime;
+	fnode->atime = fnode->ctime;
+
+	if (!es->owner->event_sets) {
+		es->owner->event_sets = list_create();
+	}
+	list_insert(es->owner->event_sets, es);
+
+	return fnode;
+}
+
+static eventset_t * eventset_from_node(fs_node_t * node) {
+	if (!node || node->selectcheck != eventset_check) return NULL;
+	eventset_t * es = node->device;
+	if (!es || es->owner != (process_t *)current_process) return NULL;
+	return es;
+}
+
+int eventset_ctl(fs_node_t * setnode, int op, fs_node_t * target, int fd) {
+	eventset_t * es = eventset_from_node(setnode);
+	if (!es) return -EINVAL;
+	if (target == setnode) return -EINVAL;
+
+	switch (op) {
+		case EVENTSET_ADD: {
+			spin_lock(es->lock);
+			foreach(wnode, es->watches) {
+				if (((eventset_watch_t *)wnode->value)->fd == fd) {
+					spin_unlock(es->lock);
+					return -EEXIST;
+				}
+			}
+			if (selectcheck_fs(target) < 0) {
+				/* Not a waitable node */
+				spin_unlock(es->lock);
+				return -EINVAL;
+			}
+			eventset_watch_t * watch = malloc(sizeof(eventset_watch_t));
+			watch->node = target;
+			watch->fd = fd;
+			watch->token = NULL;
+			watch->pending = 0;
+			list_insert(es->watches, watch);
+			eventset_arm(es, watch);
+			spin_unlock(es->lock);
+			return 0;
+		}
+		case EVENTSET_DEL: {
+			spin_lock(es->lock);
+			foreach(wnode, es->watches) {
+				eventset_watch_t * watch = wnode->value;
+				if (watch->fd == fd) {
+					if (watch->pending) {
+						list_delete(es->ready, list_find(es->ready, watch));
+					}
+					list_delete(es->watches, wnode);
+					free(watch);
+					spin_unlock(es->lock);
+					return 0;
+				}
+			}
+			spin_unlock(es->lock);
+			return -ENOENT;
+		}
+		default:
+			return -EINVAL;
+	}
+}
+
+int eventset_wait(fs_node_t * setnode, int * out, int max, int timeout) {
+	eventset_t * es = eventset_from_node(setnode);
+	if (!es) return -EINVAL;
+	if (max <= 0) return -EINVAL;
+
+	if (!es->ready->length) {
+		fs_node_t * nodes[] = {setnode, NULL};
+		int result = process_wait_nodes((process_t *)current_process, nodes, timeout);
+		if (result == -2) return 0;    /* Timed out */
+		if (result < 0) return -EINTR;
+	}
+
+	int count = 0;
+	spin_lock(es->lock);
+	int pending = es->ready->length;
+	while (count < max && pending--) {
+		node_t * lnode = list_dequeue(es->ready);
+		eventset_watch_t * watch = lnode->value;
+		free(lnode);
+		watch->pending = 0;
+		out[count++] = watch->fd;
+		/* The alert consumed the driver-side registration; re-arm. If
+		 * the node is still readable this puts the watch straight
+		 * back on the ready list for the next wait. */
+		eventset_arm(es, watch);
+	}
+	spin_unlock(es->lock);
+
+	return count;
+}
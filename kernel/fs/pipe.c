@@ -238,7 +238,7 @@ static int pipe_wait(fs_node_t * node, void * process) {
 	if (!list_find(pipe->alert_waiters, process)) {
 		list_insert(pipe->alert_waiters, process);
 	}
-	list_insert(((process_t *)process)->node_waits, pipe);
+	process_wait_node_insert((process_t *)process, pipe);
 
 	return 0;
 }
@@ -14,6 +14,7 @@
 #include <kernel/fs.h>
 #include <kernel/printf.h>
 #include <kernel/mem.h>
+#include <kernel/inflate.h>
 
 static uint32_t read_ramdisk(fs_node_t *node, uint64_t offset, uint32_t size, uint8_t *buffer);
 static uint32_t write_ramdisk(fs_node_t *node, uint64_t offset, uint32_t size, uint8_t *buffer);
@@ -64,6 +65,12 @@ static int ioctl_ramdisk(fs_node_t * node, int request, void * argp) {
 			if (current_process->user != 0) {
 				return -EPERM;
 			} else {
+				if (node->impl) {
+					/* Decompressed into the kernel heap; those frames
+					 * belong to the allocator, not this ramdisk. */
+					node->length = 0;
+					return 0;
+				}
 				/* Clear all of the memory used by this ramdisk */
 				if (node->length >= 0x1000) {
 					if (node->length % 0x1000) {
@@ -101,10 +108,57 @@ static fs_node_t * ramdisk_device_create(int device_number, uintptr_t location,
 	return fnode;
 }
 
+/*
+ * Streaming callbacks for decompressing a gzip'd ramdisk image
+ * straight out of the multiboot module into a heap buffer.
+ */
+struct gzip_ramdisk {
+	uint8_t * input;
+	uint8_t * output;
+};
+
+static uint8_t ramdisk_get_input(struct inflate_context * ctx) {
+	struct gzip_ramdisk * g = ctx->input_priv;
+	return *g->input++;
+}
+
+static void ramdisk_write_output(struct inflate_context * ctx, unsigned int sym) {
+	struct gzip_ramdisk * g = ctx->output_priv;
+	*g->output++ = sym;
+}
+
 static int last_device_number = 0;
 fs_node_t * ramdisk_mount(uintptr_t location, size_t size) {
+	int compressed = 0;
+
+	if (size >= 18 && ((uint8_t *)location)[0] == 0x1F && ((uint8_t *)location)[1] == 0x8B) {
+		/* gzip image; the trailer's ISIZE field gives the expanded size */
+		uint32_t dsize;
+		memcpy(&dsize, (void *)(location + size - sizeof(uint32_t)), sizeof(uint32_t));
+		debug_print(NOTICE, "Decompressing gzip ramdisk: %d compressed, %d expanded", size, dsize);
+
+		uint8_t * out = (uint8_t *)malloc(dsize);
+		struct gzip_ramdisk g = { (uint8_t *)location, out };
+		struct inflate_context ctx = {0};
+		ctx.input_priv   = &g;
+		ctx.output_priv  = &g;
+		ctx.get_input    = ramdisk_get_input;
+		ctx.write_output = ramdisk_write_output;
+
+		if (gzip_decompress(&ctx)) {
+			debug_print(ERROR, "Failed to decompress ramdisk image.");
+			free(out);
+			return NULL;
+		}
+
+		location = (uintptr_t)out;
+		size = dsize;
+		compressed = 1;
+	}
+
 	fs_node_t * ramdisk = ramdisk_device_create(last_device_number, location, size);
 	if (ramdisk) {
+		ramdisk->impl = compressed;
 		char tmp[64];
 		sprintf(tmp, "/dev/%s", ramdisk->name);
 		vfs_mount(tmp, ramdisk);
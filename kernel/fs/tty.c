@@ -33,15 +33,38 @@ static void pty_write_out(pty_t * pty, uint8_t c) {
 #define IN(character)   pty->write_in(pty, (uint8_t)character)
 #define OUT(character)  pty->write_out(pty, (uint8_t)character)
 
-static void dump_input_buffer(pty_t * pty) {
-	char * c = pty->canon_buffer;
-	while (pty->canon_buflen > 0) {
-		IN(*c);
-		pty->canon_buflen--;
-		c++;
+/*
+ * Bulk counterparts to IN/OUT. When the endpoint is the stock ring
+ * writer we can hand the whole span to ring_buffer_write, which takes
+ * the ring lock and wakes the reader once per span instead of once per
+ * byte; overridden endpoints (eg. the serial port) still get fed a
+ * character at a time.
+ */
+static void write_in_buf(pty_t * pty, uint8_t * buffer, size_t size) {
+	if (pty->write_in == pty_write_in) {
+		ring_buffer_write(pty->in, size, buffer);
+	} else {
+		for (size_t i = 0; i < size; ++i) {
+			pty->write_in(pty, buffer[i]);
+		}
 	}
 }
 
+static void write_out_buf(pty_t * pty, uint8_t * buffer, size_t size) {
+	if (pty->write_out == pty_write_out) {
+		ring_buffer_write(pty->out, size, buffer);
+	} else {
+		for (size_t i = 0; i < size; ++i) {
+			pty->write_out(pty, buffer[i]);
+		}
+	}
+}
+
+static void dump_input_buffer(pty_t * pty) {
+	write_in_buf(pty, (uint8_t *)pty->canon_buffer, pty->canon_buflen);
+	pty->canon_buflen = 0;
+}
+
 static void clear_input_buffer(pty_t * pty) {
 	pty->canon_buflen = 0;
 	pty->canon_buffer[0] = '\0';
@@ -77,6 +100,15 @@ void tty_output_process(pty_t * pty, uint8_t c) {
 	output_process_slave(pty, c);
 }
 
+/* Would output_process_slave rewrite this byte? If not it can be
+ * copied out untouched as part of a larger span. */
+static int output_is_translated(pty_t * pty, uint8_t c) {
+	if (c == '\n' && (pty->tios.c_oflag & ONLCR))  return 1;
+	if (c == '\r' && (pty->tios.c_oflag & ONLRET)) return 1;
+	if (c >= 'a' && c <= 'z' && (pty->tios.c_oflag & OLCUC)) return 1;
+	return 0;
+}
+
 static int is_control(int c) {
 	return c < ' ' || c == 0x7F;
 }
@@ -244,6 +276,106 @@ void tty_input_process(pty_t * pty, uint8_t c) {
 	IN(c);
 }
 
+/* Echoes accumulate here and go out as one ring write per batch */
+#define TTY_ECHO_BATCH 256
+
+static void echo_flush(pty_t * pty, uint8_t * echo, size_t * echo_len) {
+	if (*echo_len) {
+		write_out_buf(pty, echo, *echo_len);
+		*echo_len = 0;
+	}
+}
+
+static void echo_bytes(pty_t * pty, uint8_t * echo, size_t * echo_len, uint8_t * data, size_t len) {
+	while (len) {
+		size_t chunk = TTY_ECHO_BATCH - *echo_len;
+		if (chunk > len) chunk = len;
+		memcpy(echo + *echo_len, data, chunk);
+		*echo_len += chunk;
+		if (*echo_len == TTY_ECHO_BATCH) {
+			echo_flush(pty, echo, echo_len);
+		}
+		data += chunk;
+		len  -= chunk;
+	}
+}
+
+#define SPECIAL_BIT(map,c) ((map)[(uint8_t)(c) >> 3] & (1 << ((c) & 7)))
+#define SET_SPECIAL(map,c) ((map)[(uint8_t)(c) >> 3] |= (1 << ((c) & 7)))
+
+/*
+ * Mark every byte the line discipline might react to: control
+ * characters, anything bound in c_cc (in case something printable was
+ * bound there), high bytes when ISTRIP would fold them into controls,
+ * and lowercase letters when OLCUC would transform their echo. A byte
+ * left unmarked passes through input processing completely unchanged,
+ * so runs of them can be moved with memcpy.
+ */
+static void build_special_map(pty_t * pty, uint8_t * map) {
+	memset(map, 0, 32);
+	for (int c = 0; c < ' '; ++c) {
+		SET_SPECIAL(map, c);
+	}
+	SET_SPECIAL(map, 0x7F);
+	if (pty->tios.c_iflag & ISTRIP) {
+		for (int c = 0x80; c <= 0xFF; ++c) {
+			SET_SPECIAL(map, c);
+		}
+	}
+	if (pty->tios.c_oflag & OLCUC) {
+		for (int c = 'a'; c <= 'z'; ++c) {
+			SET_SPECIAL(map, c);
+		}
+	}
+	for (int i = 0; i < NCCS; ++i) {
+		SET_SPECIAL(map, pty->tios.c_cc[i]);
+	}
+}
+
+void tty_input_process_buffer(pty_t * pty, uint8_t * buffer, size_t size) {
+	uint8_t special[32];
+	uint8_t echo[TTY_ECHO_BATCH];
+	size_t echo_len = 0;
+
+	build_special_map(pty, special);
+
+	size_t i = 0;
+	while (i < size) {
+		if (pty->next_is_verbatim || SPECIAL_BIT(special, buffer[i])) {
+			/* Push pending echoes first so output stays ordered */
+			echo_flush(pty, echo, &echo_len);
+			input_process(pty, buffer[i]);
+			i++;
+			continue;
+		}
+
+		/* Span of ordinary characters; find where it ends */
+		size_t j = i + 1;
+		while (j < size && !SPECIAL_BIT(special, buffer[j])) {
+			j++;
+		}
+		size_t span = j - i;
+
+		if (pty->tios.c_lflag & ICANON) {
+			size_t room = pty->canon_bufsize - pty->canon_buflen;
+			if (room > span) room = span;
+			memcpy(pty->canon_buffer + pty->canon_buflen, buffer + i, room);
+			pty->canon_buflen += room;
+			if (pty->tios.c_lflag & ECHO) {
+				echo_bytes(pty, echo, &echo_len, buffer + i, span);
+			}
+		} else {
+			if (pty->tios.c_lflag & ECHO) {
+				echo_bytes(pty, echo, &echo_len, buffer + i, span);
+			}
+			write_in_buf(pty, buffer + i, span);
+		}
+		i = j;
+	}
+
+	echo_flush(pty, echo, &echo_len);
+}
+
 static void tty_fill_name(pty_t * pty, char * out) {
 	((char*)out)[0] = '\0';
 	sprintf((char*)out, "/dev/pts/%d", pty->name);
@@ -326,12 +458,9 @@ uint32_t  read_pty_master(fs_node_t * node, uint64_t offset, uint32_t size, uint
 uint32_t write_pty_master(fs_node_t * node, uint64_t offset, uint32_t size, uint8_t *buffer) {
 	pty_t * pty = (pty_t *)node->device;
 
-	size_t l = 0;
-	for (uint8_t * c = buffer; l < size; ++c, ++l) {
-		input_process(pty, *c);
-	}
+	tty_input_process_buffer(pty, buffer, size);
 
-	return l;
+	return size;
 }
 void      open_pty_master(fs_node_t * node, unsigned int flags) {
 	return;
@@ -358,8 +487,19 @@ uint32_t write_pty_slave(fs_node_t * node, uint64_t offset, uint32_t size, uint8
 	pty_t * pty = (pty_t *)node->device;
 
 	size_t l = 0;
-	for (uint8_t * c = buffer; l < size; ++c, ++l) {
-		output_process_slave(pty, *c);
+	while (l < size) {
+		if (output_is_translated(pty, buffer[l])) {
+			output_process_slave(pty, buffer[l]);
+			l++;
+			continue;
+		}
+		/* Everything up to the next translated character passes through */
+		size_t j = l + 1;
+		while (j < size && !output_is_translated(pty, buffer[j])) {
+			j++;
+		}
+		write_out_buf(pty, buffer + l, j - l);
+		l = j;
 	}
 
 	return l;
@@ -12,7 +12,8 @@
 
 #include <sys/ioctl.h>
 
-#define UNIX_PIPE_BUFFER 512
+#define UNIX_PIPE_BUFFER 0x10000  /* Default capacity; resizable via IOCTL_PIPE_SETSZ */
+#define UNIX_PIPE_MAX    0x100000 /* 1MB cap on requested capacities */
 
 struct unix_pipe {
 	fs_node_t * read_end;
@@ -30,20 +31,14 @@ static void close_complete(struct unix_pipe * self) {
 
 static uint32_t read_unixpipe(fs_node_t * node, uint64_t offset, uint32_t size, uint8_t *buffer) {
 	struct unix_pipe * self = node->device;
-	size_t read = 0;
 
-	while (read < size) {
-		if (self->write_closed && !ring_buffer_unread(self->buffer)) {
-			return read;
-		}
-		size_t r = ring_buffer_read(self->buffer, 1, buffer+read);
-		if (r && *((char *)(buffer + read)) == '\n') {
-			return read+r;
-		}
-		read += r;
+	/* One bulk transfer: whatever is buffered, up to the request.
+	 * Blocks only when the pipe is empty and the writer is still
+	 * around; short reads are normal pipe behavior. */
+	if (self->write_closed && !ring_buffer_unread(self->buffer)) {
+		return 0;
 	}
-
-	return read;
+	return ring_buffer_read(self->buffer, size, buffer);
 }
 
 static uint32_t write_unixpipe(fs_node_t * node, uint64_t offset, uint32_t size, uint8_t *buffer) {
@@ -57,7 +52,8 @@ static uint32_t write_unixpipe(fs_node_t * node, uint64_t offset, uint32_t size,
 
 			return written;
 		}
-		size_t w = ring_buffer_write(self->buffer, 1, buffer+written);
+		size_t w = ring_buffer_write(self->buffer, size - written, buffer + written);
+		if (!w) break;
 		written += w;
 	}
 
@@ -93,6 +89,23 @@ static void close_write_pipe(fs_node_t * node) {
 	}
 }
 
+static int ioctl_unixpipe(fs_node_t * node, int request, void * argp) {
+	struct unix_pipe * self = node->device;
+
+	switch (request) {
+		case IOCTL_PIPE_GETSZ:
+			return self->buffer->size;
+		case IOCTL_PIPE_SETSZ: {
+			if (!argp) return -EINVAL;
+			size_t requested = *(size_t *)argp;
+			if (requested < 512 || requested > UNIX_PIPE_MAX) return -EINVAL;
+			return ring_buffer_resize(self->buffer, requested);
+		}
+		default:
+			return -EINVAL;
+	}
+}
+
 static int check_pipe(fs_node_t * node) {
 	struct unix_pipe * self = node->device;
 	if (ring_buffer_unread(self->buffer) > 0) {
@@ -133,6 +146,9 @@ int make_unix_pipe(fs_node_t ** pipes) {
 	pipes[0]->close = close_read_pipe;
 	pipes[1]->close = close_write_pipe;
 
+	pipes[0]->ioctl = ioctl_unixpipe;
+	pipes[1]->ioctl = ioctl_unixpipe;
+
 	/* Read end can wait */
 	pipes[0]->selectcheck = check_pipe;
 	pipes[0]->selectwait = wait_pipe;
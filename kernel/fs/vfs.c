@@ -14,6 +14,8 @@
 #include <kernel/process.h>
 #include <kernel/logging.h>
 
+#include <sys/uio.h>
+
 #include <toaru/list.h>
 #include <toaru/hashmap.h>
 
@@ -25,6 +27,146 @@ fs_node_t * fs_root = NULL; /* Pointer to the root mount fs_node (must be some f
 
 hashmap_t * fs_types = NULL;
 
+/**
+ * The VFS buffer cache.
+ *
+ * Filesystems that mark their regular files FS_CACHEABLE get their
+ * contents cached here in page-sized chunks keyed on the node's
+ * (device, inode) identity - which, unlike the node pointer, is
+ * stable across clone_fs(). Lookup is a hashmap probe; reuse is
+ * driven by an LRU list of the entries. Writes go through to the
+ * backing filesystem and update any overlapping cached chunks, so
+ * the cache never holds data the disk has not been told about.
+ */
+#define VFS_CACHE_PAGE  0x1000
+#define VFS_CACHE_PAGES 512 /* 2MiB ceiling */
+
+typedef struct vfs_cache_entry {
+	void *   device;
+	uint32_t inode;
+	uint32_t block;   /* offset / VFS_CACHE_PAGE */
+	node_t   lru_node;
+	uint8_t  data[VFS_CACHE_PAGE];
+} vfs_cache_entry_t;
+
+static hashmap_t * vfs_cache_map = NULL;
+static list_t * vfs_cache_lru = NULL; /* Head = oldest */
+static spin_lock_t vfs_cache_lock = { 0 };
+
+static uintptr_t vfs_cache_key(void * device, uint32_t inode, uint32_t block) {
+	return ((uintptr_t)device) ^ (inode * 2654435761UL) ^ (block * 40503UL);
+}
+
+static vfs_cache_entry_t * vfs_cache_find(fs_node_t * node, uint32_t block) {
+	vfs_cache_entry_t * entry = hashmap_get(vfs_cache_map, (void *)vfs_cache_key(node->device, node->inode, block));
+	if (!entry) return NULL;
+	/* The key is only a hash; verify the identity properly */
+	if (entry->device != node->device || entry->inode != node->inode || entry->block != block) {
+		return NULL;
+	}
+	list_delete(vfs_cache_lru, &entry->lru_node);
+	list_append(vfs_cache_lru, &entry->lru_node);
+	return entry;
+}
+
+/*
+ * Get an entry to fill for (node, block): recycle the LRU entry
+ * once the cache is full, allocate fresh ones until then.
+ */
+static vfs_cache_entry_t * vfs_cache_take(fs_node_t * node, uint32_t block) {
+	vfs_cache_entry_t * entry;
+	if (vfs_cache_lru->length >= VFS_CACHE_PAGES) {
+		node_t * lru = list_dequeue(vfs_cache_lru);
+		entry = lru->value;
+		hashmap_remove(vfs_cache_map, (void *)vfs_cache_key(entry->device, entry->inode, entry->block));
+	} else {
+		entry = malloc(sizeof(vfs_cache_entry_t));
+		memset(entry, 0, sizeof(vfs_cache_entry_t));
+		entry->lru_node.value = entry;
+	}
+	entry->device = node->device;
+	entry->inode  = node->inode;
+	entry->block  = block;
+	/* A hash conflict evicts the previous occupant of the slot */
+	hashmap_set(vfs_cache_map, (void *)vfs_cache_key(node->device, node->inode, block), entry);
+	list_append(vfs_cache_lru, &entry->lru_node);
+	return entry;
+}
+
+/*
+ * Drop all cached chunks for a node. Called when a file is
+ * truncated (and available for filesystems that recycle inodes).
+ */
+void vfs_cache_invalidate(fs_node_t * node) {
+	if (!vfs_cache_map || !node) return;
+	spin_lock(vfs_cache_lock);
+	node_t * n = vfs_cache_lru->head;
+	while (n) {
+		node_t * next = n->next;
+		vfs_cache_entry_t * entry = n->value;
+		if (entry->device == node->device && entry->inode == node->inode) {
+			hashmap_remove(vfs_cache_map, (void *)vfs_cache_key(entry->device, entry->inode, entry->block));
+			list_delete(vfs_cache_lru, n);
+			free(entry);
+		}
+		n = next;
+	}
+	spin_unlock(vfs_cache_lock);
+}
+
+static int vfs_cache_applies(fs_node_t * node) {
+	return vfs_cache_map && (node->flags & FS_CACHEABLE) && (node->flags & FS_FILE);
+}
+
+static uint32_t vfs_cache_read(fs_node_t * node, uint64_t offset, uint32_t size, uint8_t * buffer) {
+	/* Serve only within the known file size, like the backends do */
+	if (offset >= node->length) return 0;
+	if (offset + size > node->length) {
+		size = node->length - offset;
+	}
+
+	uint32_t out = 0;
+	while (out < size) {
+		uint32_t block = (offset + out) / VFS_CACHE_PAGE;
+		uint32_t block_offset = (offset + out) % VFS_CACHE_PAGE;
+		uint32_t chunk = VFS_CACHE_PAGE - block_offset;
+		if (chunk > size - out) chunk = size - out;
+
+		spin_lock(vfs_cache_lock);
+		vfs_cache_entry_t * entry = vfs_cache_find(node, block);
+		if (!entry) {
+			entry = vfs_cache_take(node, block);
+			spin_unlock(vfs_cache_lock);
+			/* Pull the whole chunk from the backing filesystem */
+			memset(entry->data, 0, VFS_CACHE_PAGE);
+			node->read(node, (uint64_t)block * VFS_CACHE_PAGE, VFS_CACHE_PAGE, entry->data);
+			spin_lock(vfs_cache_lock);
+		}
+		memcpy(buffer + out, entry->data + block_offset, chunk);
+		spin_unlock(vfs_cache_lock);
+		out += chunk;
+	}
+	return out;
+}
+
+static void vfs_cache_update(fs_node_t * node, uint64_t offset, uint32_t size, uint8_t * buffer) {
+	/* Keep any cached chunks coherent with a write-through */
+	uint32_t done = 0;
+	spin_lock(vfs_cache_lock);
+	while (done < size) {
+		uint32_t block = (offset + done) / VFS_CACHE_PAGE;
+		uint32_t block_offset = (offset + done) % VFS_CACHE_PAGE;
+		uint32_t chunk = VFS_CACHE_PAGE - block_offset;
+		if (chunk > size - done) chunk = size - done;
+		vfs_cache_entry_t * entry = vfs_cache_find(node, block);
+		if (entry) {
+			memcpy(entry->data + block_offset, buffer + done, chunk);
+		}
+		done += chunk;
+	}
+	spin_unlock(vfs_cache_lock);
+}
+
 
 int has_permission(fs_node_t * node, int permission_bit) {
 	if (!node) return 0;
@@ -136,6 +278,9 @@ uint32_t read_fs(fs_node_t *node, uint64_t offset, uint32_t size, uint8_t *buffe
 	if (!node) return -ENOENT;
 
 	if (node->read) {
+		if (vfs_cache_applies(node)) {
+			return vfs_cache_read(node, offset, size, buffer);
+		}
 		uint32_t ret = node->read(node, offset, size, buffer);
 		return ret;
 	} else {
@@ -156,13 +301,102 @@ uint32_t write_fs(fs_node_t *node, uint64_t offset, uint32_t size, uint8_t *buff
 	if (!node) return -ENOENT;
 
 	if (node->write) {
+		if (vfs_cache_applies(node)) {
+			vfs_cache_update(node, offset, size, buffer);
+		}
 		uint32_t ret = node->write(node, offset, size, buffer);
+		if ((int32_t)ret > 0) {
+			node->written = 1;
+			if (node->open_flags & O_SYNC) {
+				/* This opener asked for synchronous writes */
+				fsync_fs(node);
+				node->written = 0;
+			}
+		}
 		return ret;
 	} else {
 		return -EROFS;
 	}
 }
 
+/**
+ * fsync_fs: Push a file's buffered writes out to its backing storage.
+ *
+ * Filesystems whose writes land in a cache (ext2's dirty block cache
+ * waits on the flusher thread) provide an fsync hook; everything else
+ * writes through and has nothing to do here.
+ *
+ * @param node Node to flush
+ * @returns 0 on success or a negative error code
+ */
+int fsync_fs(fs_node_t * node) {
+	if (!node) return -ENOENT;
+
+	if (node->fsync) {
+		return node->fsync(node);
+	}
+	return 0;
+}
+
+/**
+ * readv_fs: Scattering read; fill each buffer in turn.
+ *
+ * There is no driver-side readv hook - a short read from any segment
+ * ends the operation, which is the right behavior for streams, and
+ * packet sources hand out one packet per read anyway.
+ *
+ * @param node    Node to read
+ * @param offset  Offset into the node data to read from
+ * @param count   Number of iovec entries
+ * @param iov     Buffers to fill, in order
+ * @returns Bytes read
+ */
+uint32_t readv_fs(fs_node_t *node, uint64_t offset, int count, const struct iovec *iov) {
+	if (!node) return -ENOENT;
+
+	uint32_t total = 0;
+	for (int i = 0; i < count; ++i) {
+		if (!iov[i].iov_len) continue;
+		uint32_t ret = read_fs(node, offset + total, iov[i].iov_len, iov[i].iov_base);
+		if ((int32_t)ret < 0) return total ? total : ret;
+		total += ret;
+		if (ret < iov[i].iov_len) break;
+	}
+	return total;
+}
+
+/**
+ * writev_fs: Gathering write over a list of buffers.
+ *
+ * Nodes that care about message boundaries (packetfs) provide a
+ * writev hook and receive the whole list as one operation; everything
+ * else gets sequential write_fs calls, which is equivalent for
+ * byte streams.
+ *
+ * @param node    Node to write to
+ * @param offset  Offset into the node data to write to
+ * @param count   Number of iovec entries
+ * @param iov     Buffers to write, in order
+ * @returns Bytes written
+ */
+uint32_t writev_fs(fs_node_t *node, uint64_t offset, int count, const struct iovec *iov) {
+	if (!node) return -ENOENT;
+
+	if (node->writev) {
+		return node->writev(node, offset, count, iov);
+	}
+
+	uint32_t total = 0;
+	for (int i = 0; i < count; ++i) {
+		if (!iov[i].iov_len) continue;
+		uint32_t ret = write_fs(node, offset + total, iov[i].iov_len, iov[i].iov_base);
+		if ((int32_t)ret < 0) return total ? total : ret;
+		total += ret;
+		if (ret < iov[i].iov_len) break;
+	}
+	return total;
+}
+
 /**
  * truncate_fs: set the size of a file to 9
  *
@@ -172,6 +406,7 @@ void truncate_fs(fs_node_t * node) {
 	if (!node) return;
 
 	if (node->truncate) {
+		vfs_cache_invalidate(node);
 		node->truncate(node);
 	}
 }
@@ -201,11 +436,29 @@ void open_fs(fs_node_t *node, unsigned int flags) {
 		spin_unlock(tmp_refcount_lock);
 	}
 
+	node->open_flags = flags;
+
 	if (node->open) {
 		node->open(node, flags);
 	}
 }
 
+/**
+ * vfs_ref: Take an extra reference to an open node.
+ *
+ * For kernel code that needs to hold a node beyond the life of the
+ * file descriptor it came from; unlike open_fs this does not re-run
+ * the node's open hook. Pair with close_fs.
+ */
+void vfs_ref(fs_node_t * node) {
+	if (!node) return;
+	if (node->refcount >= 0) {
+		spin_lock(tmp_refcount_lock);
+		node->refcount++;
+		spin_unlock(tmp_refcount_lock);
+	}
+}
+
 /**
  * close_fs: Close a file system node
  *
@@ -221,6 +474,13 @@ void close_fs(fs_node_t *node) {
 
 	if (node->refcount == -1) return;
 
+	/* Flush-on-close: anything written through this node goes out to
+	 * its backing store before the last reference can drop it. */
+	if (node->written) {
+		fsync_fs(node);
+		node->written = 0;
+	}
+
 	spin_lock(tmp_refcount_lock);
 	node->refcount--;
 	if (node->refcount == 0) {
@@ -273,6 +533,88 @@ struct dirent *readdir_fs(fs_node_t *node, uint32_t index) {
 	}
 }
 
+/**
+ * readdir_n_fs: Read several directory entries starting at the requested index
+ *
+ * Filesystems with a bulk implementation only walk their directory
+ * structures once per call; everything else falls back to repeated
+ * single-entry readdir calls, which is no worse than the caller doing
+ * the same from userspace.
+ *
+ * @param node  Directory to read
+ * @param index Offset of the first entry to store
+ * @param out   Array to fill
+ * @param count Size of the array
+ * @returns The number of entries stored.
+ */
+int readdir_n_fs(fs_node_t *node, uint32_t index, struct dirent *out, int count) {
+	if (!node) return 0;
+	if (!(node->flags & FS_DIRECTORY)) return 0;
+
+	if (node->readdir_n) {
+		return node->readdir_n(node, index, out, count);
+	}
+
+	if (node->readdir) {
+		int stored = 0;
+		while (stored < count) {
+			struct dirent * kentry = node->readdir(node, index + stored);
+			if (!kentry) break;
+			memcpy(&out[stored], kentry, sizeof(struct dirent));
+			free(kentry);
+			stored++;
+		}
+		return stored;
+	}
+
+	return 0;
+}
+
+/**
+ * The directory entry cache.
+ *
+ * Path resolution calls finddir once per component, and the hot
+ * prefixes (/lib, /usr/share) are looked up thousands of times per
+ * boot. Cache (parent device, parent inode, name) -> resolved node
+ * for directories that opted into caching with FS_CACHEABLE, plus
+ * negative entries for names known not to exist. Only directory
+ * results are kept - a cached copy of a file node would go stale
+ * when the file grows, while a directory node is just a (device,
+ * inode) handle that the backend re-reads on every operation.
+ */
+#define DENTRY_CACHE_MAX 1024
+
+typedef struct dentry {
+	fs_node_t node;  /* Copy of the resolved node (if not negative) */
+	int negative;    /* Name is known not to exist */
+} dentry_t;
+
+static hashmap_t * dentry_cache = NULL;
+static int dentry_count = 0;
+static spin_lock_t dentry_lock = { 0 };
+
+static void dentry_key(char * buf, fs_node_t * parent, char * name) {
+	sprintf(buf, "%x:%x:%s", (uintptr_t)parent->device, parent->inode, name);
+}
+
+/*
+ * Forget a cached entry. Anything that creates or removes a name in
+ * a directory must call this, or resolution will keep serving the
+ * old answer.
+ */
+void vfs_dentry_invalidate(fs_node_t * parent, char * name) {
+	if (!dentry_cache || !parent || strlen(name) >= 256) return;
+	char key[320];
+	dentry_key(key, parent, name);
+	spin_lock(dentry_lock);
+	dentry_t * d = hashmap_remove(dentry_cache, key);
+	if (d) {
+		dentry_count--;
+		free(d);
+	}
+	spin_unlock(dentry_lock);
+}
+
 /**
  * finddir_fs: Find the requested file in the directory and return an fs_node for it
  *
@@ -284,7 +626,44 @@ fs_node_t *finddir_fs(fs_node_t *node, char *name) {
 	if (!node) return NULL;
 
 	if ((node->flags & FS_DIRECTORY) && node->finddir) {
+		int cache_this = dentry_cache && (node->flags & FS_CACHEABLE) && strlen(name) < 256;
+		char key[320];
+
+		if (cache_this) {
+			dentry_key(key, node, name);
+			spin_lock(dentry_lock);
+			dentry_t * d = hashmap_get(dentry_cache, key);
+			if (d) {
+				if (d->negative) {
+					spin_unlock(dentry_lock);
+					return NULL;
+				}
+				fs_node_t * copy = malloc(sizeof(fs_node_t));
+				memcpy(copy, &d->node, sizeof(fs_node_t));
+				spin_unlock(dentry_lock);
+				return copy;
+			}
+			spin_unlock(dentry_lock);
+		}
+
 		fs_node_t *ret = node->finddir(node, name);
+
+		if (cache_this && (!ret || (ret->flags & FS_DIRECTORY))) {
+			spin_lock(dentry_lock);
+			if (dentry_count < DENTRY_CACHE_MAX && !hashmap_has(dentry_cache, key)) {
+				dentry_t * d = malloc(sizeof(dentry_t));
+				memset(d, 0, sizeof(dentry_t));
+				if (ret) {
+					memcpy(&d->node, ret, sizeof(fs_node_t));
+				} else {
+					d->negative = 1;
+				}
+				hashmap_set(dentry_cache, key, d);
+				dentry_count++;
+			}
+			spin_unlock(dentry_lock);
+		}
+
 		return ret;
 	} else {
 		debug_print(WARNING, "Node passed to finddir_fs isn't a directory!");
@@ -358,6 +737,7 @@ int create_file_fs(char *name, uint16_t permission) {
 
 	int ret = 0;
 	if (parent->create) {
+		vfs_dentry_invalidate(parent, f_path);
 		ret = parent->create(parent, f_path, permission);
 	} else {
 		ret = -EINVAL;
@@ -408,6 +788,7 @@ int unlink_fs(char * name) {
 
 	int ret = 0;
 	if (parent->unlink) {
+		vfs_dentry_invalidate(parent, f_path);
 		ret = parent->unlink(parent, f_path);
 	} else {
 		ret = -EINVAL;
@@ -473,6 +854,7 @@ int mkdir_fs(char *name, uint16_t permission) {
 
 	int ret = 0;
 	if (parent->mkdir) {
+		vfs_dentry_invalidate(parent, f_path);
 		ret = parent->mkdir(parent, f_path, permission);
 	} else {
 		ret = -EROFS;
@@ -525,6 +907,7 @@ int symlink_fs(char * target, char * name) {
 
 	int ret = 0;
 	if (parent->symlink) {
+		vfs_dentry_invalidate(parent, f_path);
 		ret = parent->symlink(parent, target, f_path);
 	} else {
 		ret = -EINVAL;
@@ -678,6 +1061,11 @@ void vfs_install(void) {
 	tree_set_root(fs_tree, root);
 
 	fs_types = hashmap_create(5);
+
+	vfs_cache_map = hashmap_create_int(256);
+	vfs_cache_lru = list_create();
+
+	dentry_cache = hashmap_create(256);
 }
 
 int vfs_register(char * name, vfs_mount_callback callback) {
@@ -1079,9 +1467,44 @@ fs_node_t *kopen_recur(char *filename, uint32_t flags, uint32_t symlink_depth, c
  * @param flags    Flag bits for read/write mode.
  * @returns A file system node element that the caller can free.
  */
+/*
+ * Boot open log: the first distinct paths opened after boot, in
+ * order. /proc/bootopens serves this to userspace so the image build
+ * tool (util/mkext2.py) can lay those files out sequentially on disk
+ * in the order the next boot will read them.
+ */
+#define BOOTOPENS_MAX  128
+#define BOOTOPENS_PATH 100
+static char bootopens[BOOTOPENS_MAX][BOOTOPENS_PATH];
+static int bootopens_count = 0;
+
+static void bootopens_record(char * path) {
+	if (bootopens_count >= BOOTOPENS_MAX) return;
+	if (!path || path[0] != '/') return;
+	for (int i = 0; i < bootopens_count; ++i) {
+		if (!strcmp(bootopens[i], path)) return;
+	}
+	if (strlen(path) >= BOOTOPENS_PATH) return;
+	strcpy(bootopens[bootopens_count++], path);
+}
+
+size_t vfs_bootopens_dump(char * buf, size_t bufsize) {
+	size_t len = 0;
+	for (int i = 0; i < bootopens_count; ++i) {
+		size_t l = strlen(bootopens[i]) + 1;
+		if (len + l >= bufsize) break;
+		memcpy(buf + len, bootopens[i], l - 1);
+		buf[len + l - 1] = '\n';
+		len += l;
+	}
+	buf[len] = '\0';
+	return len;
+}
+
 fs_node_t *kopen(char *filename, uint32_t flags) {
 	debug_print(NOTICE, "kopen(%s)", filename);
 
+	bootopens_record(filename);
 	return kopen_recur(filename, flags, 0, (char *)(current_process->wd_name));
 }
 
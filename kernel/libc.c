@@ -21,18 +21,40 @@
 #define BITOP(A, B, OP) \
  ((A)[(size_t)(B)/(8*sizeof *(A))] OP (size_t)1<<((size_t)(B)%(8*sizeof *(A))))
 
+/*
+ * Copy a dword at a time, with a byte tail. We can not use the SSE
+ * registers in here - the kernel does not save FPU state for itself,
+ * so touching them would corrupt whatever userspace had in them - but
+ * rep movsl still moves four times the data per iteration that the
+ * old rep movsb did, which is most of the win in the paging and pipe
+ * paths.
+ */
 void * memcpy(void * restrict dest, const void * restrict src, size_t n) {
-	asm volatile("cld; rep movsb"
-	            : "=c"((int){0})
-	            : "D"(dest), "S"(src), "c"(n)
-	            : "flags", "memory");
+	void * d = dest;
+	const void * s = src;
+	size_t count = n >> 2;
+	asm volatile("cld; rep movsl"
+	            : "+D"(d), "+S"(s), "+c"(count)
+	            : : "flags", "memory");
+	count = n & 3;
+	asm volatile("rep movsb"
+	            : "+D"(d), "+S"(s), "+c"(count)
+	            : : "flags", "memory");
 	return dest;
 }
 
 void * memset(void * dest, int c, size_t n) {
-	asm volatile("cld; rep stosb"
-	             : "=c"((int){0})
-	             : "D"(dest), "a"(c), "c"(n)
+	void * d = dest;
+	uint32_t fill = (uint8_t)c * 0x01010101UL;
+	size_t count = n >> 2;
+	asm volatile("cld; rep stosl"
+	             : "+D"(d), "+c"(count)
+	             : "a"(fill)
+	             : "flags", "memory");
+	count = n & 3;
+	asm volatile("rep stosb"
+	             : "+D"(d), "+c"(count)
+	             : "a"(fill)
 	             : "flags", "memory");
 	return dest;
 }
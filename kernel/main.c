@@ -49,6 +49,9 @@
 #include <kernel/args.h>
 #include <kernel/module.h>
 #include <kernel/pci.h>
+#include <kernel/smp.h>
+#include <kernel/workqueue.h>
+#include <kernel/bootmarks.h>
 
 uintptr_t initial_esp = 0;
 
@@ -82,6 +85,8 @@ int kmain(struct multiboot *mboot, uint32_t mboot_mag, uintptr_t esp) {
 	initial_esp = esp;
 	extern char * cmdline;
 
+	boot_marker("kmain");
+
 	uint32_t mboot_mods_count = 0;
 	mboot_mod_t * mboot_mods = NULL;
 	mboot_ptr = mboot;
@@ -148,6 +153,8 @@ int kmain(struct multiboot *mboot, uint32_t mboot_mag, uintptr_t esp) {
 	}
 	paging_finalize();
 
+	boot_marker("paging");
+
 	{
 		char cmdline_[1024];
 
@@ -175,9 +182,16 @@ int kmain(struct multiboot *mboot, uint32_t mboot_mag, uintptr_t esp) {
 	fpu_install();      /* FPU/SSE magic */
 	syscalls_install(); /* Install the system calls */
 	shm_install();      /* Install shared memory */
+	smp_initialize();   /* Find and start other processors */
+	workqueue_install(); /* Deferred work for interrupt handlers */
+	heap_trim_install(); /* Background return of free heap pages */
 	modules_install();  /* Modules! */
 	pci_remap();
 
+	boot_marker("subsystems");
+
+	klog_start();       /* Defer log output to the drain tasklet */
+
 	DISABLE_EARLY_BOOT_LOG();
 
 	/* Load modules from bootloader */
@@ -192,9 +206,9 @@ int kmain(struct multiboot *mboot, uint32_t mboot_mag, uintptr_t esp) {
 			int check_result = module_quickcheck((void *)module_start);
 			if (check_result == 1) {
 				debug_print(NOTICE, "Loading a module: 0x%x:0x%x", module_start, module_end);
-				module_data_t * mod_info = (module_data_t *)module_load_direct((void *)(module_start), module_size);
+				module_data_t * mod_info = (module_data_t *)module_load_direct_deferred((void *)(module_start), module_size);
 				if (mod_info) {
-					debug_print(NOTICE, "Loaded: %s", mod_info->mod_info->name);
+					debug_print(NOTICE, "Linked: %s", mod_info->mod_info->name);
 				}
 			} else if (check_result == 2) {
 				/* Mod pack */
@@ -206,9 +220,9 @@ int kmain(struct multiboot *mboot, uint32_t mboot_mag, uintptr_t esp) {
 					if (result != 1) {
 						debug_print(WARNING, "Not actually a module?! %x", start);
 					}
-					module_data_t * mod_info = (module_data_t *)module_load_direct(start, pack_header->region_size);
+					module_data_t * mod_info = (module_data_t *)module_load_direct_deferred(start, pack_header->region_size);
 					if (mod_info) {
-						debug_print(NOTICE, "Loaded: %s", mod_info->mod_info->name);
+						debug_print(NOTICE, "Linked: %s", mod_info->mod_info->name);
 					}
 					pack_header = (struct pack_header *)((uintptr_t)start + pack_header->region_size);
 				}
@@ -218,6 +232,13 @@ int kmain(struct multiboot *mboot, uint32_t mboot_mag, uintptr_t esp) {
 				ramdisk_mount(module_start, module_size);
 			}
 		}
+
+		/* Initializers run as concurrent tasks so probe delays in
+		 * independent drivers overlap; the root filesystem below
+		 * needs them all finished. */
+		modules_run_deferred_inits();
+
+		boot_marker("modules-ready");
 	}
 
 	/* Map /dev to a device mapper */
@@ -229,6 +250,7 @@ int kmain(struct multiboot *mboot, uint32_t mboot_mag, uintptr_t esp) {
 			root_type = args_value("root_type");
 		}
 		vfs_mount_type(root_type, args_value("root"), "/");
+		boot_marker("root-mounted");
 	}
 
 	if (args_present("args")) {
@@ -260,6 +282,7 @@ int kmain(struct multiboot *mboot, uint32_t mboot_mag, uintptr_t esp) {
 	while (argv[argc]) {
 		argc++;
 	}
+	boot_marker("exec-init");
 	system(argv[0], argc, argv, NULL); /* Run init */
 
 	debug_print(CRITICAL, "init failed");
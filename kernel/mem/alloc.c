@@ -103,6 +103,9 @@
 
 /* Includes {{{ */
 #include <kernel/system.h>
+#include <kernel/printf.h>
+#include <kernel/logging.h>
+#include <kernel/timerwheel.h>
 /* }}} */
 /* Definitions {{{ */
 
@@ -173,11 +176,45 @@ static void klfree(void * ptr);
 
 static spin_lock_t mem_lock =  { 0 };
 
+/*
+ * Call-site attribution. Every HEAP_SAMPLE_INTERVAL'th allocation
+ * records its caller's return address in a small open-addressed
+ * table, which is cheap enough to leave on; /proc/heap reports the
+ * table so a week of uptime can be blamed on actual callers.
+ * Callers hold mem_lock.
+ */
+#define HEAP_SITE_MAX 64
+#define HEAP_SAMPLE_INTERVAL 64
+
+struct heap_site {
+	uintptr_t eip;
+	uint32_t samples;
+	uint32_t bytes;
+};
+
+static struct heap_site heap_sites[HEAP_SITE_MAX];
+static unsigned int heap_sample_counter = 0;
+
+static void heap_sample(uintptr_t eip, uintptr_t size) {
+	if (++heap_sample_counter & (HEAP_SAMPLE_INTERVAL - 1)) return;
+	unsigned int index = (eip >> 2) % HEAP_SITE_MAX;
+	for (unsigned int i = 0; i < HEAP_SITE_MAX; ++i) {
+		struct heap_site * site = &heap_sites[(index + i) % HEAP_SITE_MAX];
+		if (site->eip && site->eip != eip) continue;
+		site->eip = eip;
+		site->samples++;
+		site->bytes += size;
+		return;
+	}
+	/* Table full; drop the sample. */
+}
+
 void * __attribute__ ((malloc)) malloc(uintptr_t size) {
 	spin_lock(mem_lock);
 #ifdef _DEBUG_MALLOC
 	size += 8;
 #endif
+	heap_sample((uintptr_t)__builtin_return_address(0), size);
 	void * ret = klmalloc(size);
 #ifdef _DEBUG_MALLOC
 	STACK_TRACE(size);
@@ -206,6 +243,7 @@ void * __attribute__ ((malloc)) realloc(void * ptr, uintptr_t size) {
 #ifdef _DEBUG_MALLOC
 	size += 8;
 #endif
+	heap_sample((uintptr_t)__builtin_return_address(0), size);
 	void * ret = klrealloc(ptr, size);
 #ifdef _DEBUG_MALLOC
 	STACK_TRACE(ptr);
@@ -231,6 +269,7 @@ void * __attribute__ ((malloc)) realloc(void * ptr, uintptr_t size) {
 
 void * __attribute__ ((malloc)) calloc(uintptr_t nmemb, uintptr_t size) {
 	spin_lock(mem_lock);
+	heap_sample((uintptr_t)__builtin_return_address(0), nmemb * size);
 	void * ret = klcalloc(nmemb, size);
 #ifdef _DEBUG_MALLOC
 	struct {
@@ -251,6 +290,7 @@ void * __attribute__ ((malloc)) valloc(uintptr_t size) {
 #ifdef _DEBUG_MALLOC
 	size += 8;
 #endif
+	heap_sample((uintptr_t)__builtin_return_address(0), size);
 	void * ret = klvalloc(size);
 #ifdef _DEBUG_MALLOC
 	STACK_TRACE(size);
@@ -373,6 +413,7 @@ typedef struct _klmalloc_big_bin_header {
 	uint32_t bin_magic;
 	struct _klmalloc_big_bin_header * prev;
 	struct _klmalloc_big_bin_header * forward[SKIP_MAX_LEVEL+1];
+	uint32_t trimmed;	/* Pages past the header were returned to the frame allocator */
 } klmalloc_big_bin_header;
 
 
@@ -791,6 +832,23 @@ static void * __attribute__ ((malloc)) klmalloc(uintptr_t size) {
 			 * Retreive the head of the block.
 			 */
 			uintptr_t ** item = klmalloc_stack_pop((klmalloc_bin_header *)bin_header);
+			/*
+			 * If heap_trim returned this block's pages to the frame
+			 * allocator while it sat free, commit fresh frames before
+			 * handing it out. Only the header page survived the trim.
+			 */
+			if (bin_header->trimmed) {
+				uintptr_t base = (uintptr_t)bin_header;
+				uintptr_t end = base + sizeof(klmalloc_big_bin_header) + bin_header->size;
+				for (uintptr_t addr = base + PAGE_SIZE; addr < end; addr += PAGE_SIZE) {
+					/* The page tables survived the trim; only the
+					 * entries were cleared. No allocation here. */
+					page_t * page = get_page(addr, 0, kernel_directory);
+					assert(page && "Heap page table went missing?");
+					alloc_frame(page, 1, 0);
+				}
+				bin_header->trimmed = 0;
+			}
 #if 0
 			/*
 			 * Resize block, if necessary
@@ -857,6 +915,7 @@ static void * __attribute__ ((malloc)) klmalloc(uintptr_t size) {
 			}
 			klmalloc_newest_big = bin_header;
 			bin_header->next = NULL;
+			bin_header->trimmed = 0;
 			/*
 			 * Return the head of the block.
 			 */
@@ -1114,3 +1173,122 @@ static void * __attribute__ ((malloc)) klcalloc(uintptr_t nmemb, uintptr_t size)
 	return ptr;
 }
 /* }}} */
+/* Trim {{{ */
+
+extern uintptr_t heap_end;
+extern uintptr_t kernel_heap_alloc_point;
+
+/*
+ * Return the backing frames of wholly-free big bins to the frame
+ * allocator. A free big bin keeps all of its metadata - the header
+ * and the free stack's single entry - in its first page, so every
+ * page after that holds nothing and can be unmapped until the bin
+ * is handed out again (see the trimmed check in klmalloc). The heap
+ * address space itself is never returned; klmalloc's bookkeeping
+ * assumes it owns a contiguous range.
+ *
+ * Pages below kernel_heap_alloc_point were committed before the
+ * frame allocator was fully up and are left alone.
+ *
+ * Returns the number of pages freed.
+ */
+size_t heap_trim(void) {
+	size_t pages = 0;
+
+	spin_lock(mem_lock);
+	for (klmalloc_big_bin_header * bin = klmalloc_big_bins.head.forward[0]; bin; bin = bin->forward[0]) {
+		if (bin->trimmed) continue;
+
+		uintptr_t base = (uintptr_t)bin;
+		uintptr_t end = base + sizeof(klmalloc_big_bin_header) + bin->size;
+		for (uintptr_t addr = base + PAGE_SIZE; addr < end; addr += PAGE_SIZE) {
+			if (addr < kernel_heap_alloc_point) continue;
+			page_t * page = get_page(addr, 0, kernel_directory);
+			if (!page || !page->frame) continue;
+			free_frame(page);
+			memset(page, 0, sizeof(page_t));
+			invalidate_tables_at(addr);
+			pages++;
+		}
+		bin->trimmed = 1;
+	}
+	spin_unlock(mem_lock);
+
+	return pages;
+}
+
+#define HEAP_TRIM_INTERVAL_NS (30ULL * 1000000000ULL)
+
+static void heap_trim_work(void * arg) {
+	(void)arg;
+	size_t pages = heap_trim();
+	if (pages) {
+		debug_print(INFO, "heap: returned %d pages to the frame allocator", pages);
+	}
+	timer_set(HEAP_TRIM_INTERVAL_NS, heap_trim_work, NULL);
+}
+
+/*
+ * Start the background trim. Kiosk deployments sit at week-long
+ * uptimes; without this, address space that spiked once (pipe
+ * buffers, packet queues) stays committed forever.
+ */
+void heap_trim_install(void) {
+	timer_set(HEAP_TRIM_INTERVAL_NS, heap_trim_work, NULL);
+}
+
+/* }}} */
+/* Introspection {{{ */
+
+/*
+ * Format heap occupancy for /proc/heap: footprint, per-bucket free
+ * cells, the big-bin free list with its largest run, and the sampled
+ * call-site table.
+ */
+size_t heap_debug_dump(char * buf) {
+	char * b = buf;
+
+	spin_lock(mem_lock);
+
+	b += sprintf(b, "heap end:  0x%x\n", heap_end);
+
+	b += sprintf(b, "small bins (with free space):\n");
+	for (unsigned int i = 0; i < NUM_BINS - 1; ++i) {
+		unsigned int bins = 0;
+		unsigned int cells = 0;
+		for (klmalloc_bin_header * bin = klmalloc_bin_head[i].first; bin; bin = bin->next) {
+			bins++;
+			for (uintptr_t ** cell = bin->head; cell; cell = (uintptr_t **)*cell) {
+				cells++;
+			}
+		}
+		if (!bins) continue;
+		b += sprintf(b, "  %d: %d bins, %d free cells\n", SMALLEST_BIN << i, bins, cells);
+	}
+
+	unsigned int big_bins = 0;
+	uintptr_t big_free = 0;
+	uintptr_t big_largest = 0;
+	unsigned int big_trimmed = 0;
+	for (klmalloc_big_bin_header * bin = klmalloc_big_bins.head.forward[0]; bin; bin = bin->forward[0]) {
+		big_bins++;
+		big_free += bin->size;
+		if (bin->size > big_largest) big_largest = bin->size;
+		if (bin->trimmed) big_trimmed++;
+	}
+	b += sprintf(b, "big bins:  %d free, %d bytes, largest %d, %d trimmed\n",
+			big_bins, big_free, big_largest, big_trimmed);
+
+	b += sprintf(b, "call sites (1/%d sampled):\n", HEAP_SAMPLE_INTERVAL);
+	for (unsigned int i = 0; i < HEAP_SITE_MAX; ++i) {
+		if (!heap_sites[i].eip) continue;
+		b += sprintf(b, "  0x%x %d %d\n",
+				heap_sites[i].eip, heap_sites[i].samples, heap_sites[i].bytes);
+	}
+
+	spin_unlock(mem_lock);
+
+	return b - buf;
+}
+
+/* }}} */
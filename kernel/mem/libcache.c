@@ -0,0 +1,123 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ * This file is part of ToaruOS and is released under the terms
+ * of the NCSA / University of Illinois License - see LICENSE.md
+ * Copyright (C) 2018 K. Lange
+ *
+ * Shared library cache
+ *
+ * Keeps the pristine in-memory image of each shared library so that
+ * only the first process to load one has to read it from the
+ * filesystem; every later process maps the same physical frames.
+ * The dynamic linker offers an image right after copying it in -
+ * before relocations have touched it - and maps cached images
+ * read-only with the copy-on-write bit set, so the regular fault
+ * handler duplicates exactly the pages relocation writes (the GOT
+ * and .data in practice) while .text stays shared.
+ *
+ * The cache holds a reference on every frame it keeps, so images
+ * stay pinned when their last mapper exits. Entries are never
+ * evicted; libraries only change when the system is rebuilt.
+ */
+#include <kernel/system.h>
+#include <kernel/process.h>
+#include <kernel/logging.h>
+#include <kernel/mem.h>
+
+#include <toaru/hashmap.h>
+
+static spin_lock_t lcl; // library cache lock
+static hashmap_t * lib_cache = NULL;
+
+typedef struct {
+	size_t size;         /* Image size in bytes, as loaded */
+	size_t num_frames;
+	uint32_t * frames;   /* Physical frame numbers backing the image */
+} lib_cache_entry_t;
+
+/*
+ * Take a reference on the frames mapped at [vaddr, vaddr+size) in the
+ * calling process and remember them under `name`. The caller's own
+ * mapping is downgraded to copy-on-write so its relocations copy
+ * instead of scribbling on the shared image.
+ */
+int lib_cache_insert(char * name, uintptr_t vaddr, size_t size) {
+	if (vaddr & 0xFFF) return -EINVAL;
+	if (!size) return -EINVAL;
+
+	spin_lock(lcl);
+	if (!lib_cache) {
+		lib_cache = hashmap_create(10);
+	}
+	if (hashmap_has(lib_cache, name)) {
+		/* Somebody beat us to it; keep the established image. */
+		spin_unlock(lcl);
+		return -EEXIST;
+	}
+
+	lib_cache_entry_t * entry = malloc(sizeof(lib_cache_entry_t));
+	entry->size = size;
+	entry->num_frames = (size + 0xFFF) / 0x1000;
+	entry->frames = malloc(sizeof(uint32_t) * entry->num_frames);
+
+	for (size_t i = 0; i < entry->num_frames; ++i) {
+		page_t * page = get_page(vaddr + i * 0x1000, 0, current_directory);
+		if (!page || !page->frame) {
+			/* A hole in the image means the caller lied about its
+			 * extent; give back what we took and refuse. */
+			for (size_t j = 0; j < i; ++j) {
+				page_t tmp = {0};
+				tmp.frame = entry->frames[j];
+				free_frame(&tmp);
+			}
+			free(entry->frames);
+			free(entry);
+			spin_unlock(lcl);
+			return -EFAULT;
+		}
+		frame_ref(page->frame);
+		entry->frames[i] = page->frame;
+		page->rw  = 0;
+		page->cow = 1;
+		invalidate_tables_at(vaddr + i * 0x1000);
+	}
+
+	hashmap_set(lib_cache, name, entry);
+	debug_print(INFO, "library cache: pinned %s (%d bytes) from process %d", name, size, current_process->id);
+	spin_unlock(lcl);
+	return 0;
+}
+
+/*
+ * Map the cached image for `name` at vaddr in the calling process,
+ * read-only and copy-on-write. Returns the image size in bytes, or
+ * -ENOENT if the library has not been cached.
+ */
+int lib_cache_map(char * name, uintptr_t vaddr) {
+	if (vaddr & 0xFFF) return -EINVAL;
+
+	spin_lock(lcl);
+	lib_cache_entry_t * entry = lib_cache ? hashmap_get(lib_cache, name) : NULL;
+	if (!entry) {
+		spin_unlock(lcl);
+		return -ENOENT;
+	}
+
+	for (size_t i = 0; i < entry->num_frames; ++i) {
+		page_t * page = get_page(vaddr + i * 0x1000, 1, current_directory);
+		if (page->frame) {
+			/* The target region is supposed to be unmapped. */
+			spin_unlock(lcl);
+			return -EFAULT;
+		}
+		frame_ref(entry->frames[i]);
+		page->frame   = entry->frames[i];
+		page->present = 1;
+		page->user    = 1;
+		page->rw      = 0;
+		page->cow     = 1;
+		invalidate_tables_at(vaddr + i * 0x1000);
+	}
+
+	spin_unlock(lcl);
+	return entry->size;
+}
@@ -21,6 +21,9 @@
 
 extern void *end;
 uintptr_t placement_pointer = (uintptr_t)&end;
+
+/* System-wide page fault count, for /proc/cpu */
+unsigned long total_page_faults = 0;
 uintptr_t heap_end = (uintptr_t)NULL;
 uintptr_t kernel_heap_alloc_point = KERNEL_HEAP_INIT;
 
@@ -136,6 +139,30 @@ kvmalloc_p(
 uint32_t *frames;
 uint32_t nframes;
 
+/*
+ * Per-frame sharing counts for copy-on-write. A count of 0 means
+ * the frame predates the counter (or is device memory) and is
+ * treated as singly-owned; 255 means the frame is pinned and will
+ * never be returned to the allocator.
+ */
+static uint8_t * frame_refs = NULL;
+
+#define FRAME_REFS_PINNED 255
+
+void frame_ref(uint32_t frame) {
+	if (!frame_refs || frame >= nframes) return;
+	if (frame_refs[frame] < FRAME_REFS_PINNED) {
+		frame_refs[frame]++;
+	}
+}
+
+/* Whether a frame has exactly one owner; only such frames are
+ * candidates for swap eviction, which keeps the swap code out of
+ * the refcounting business entirely. */
+int frame_is_exclusive(uint32_t frame) {
+	return frame_refs && frame < nframes && frame_refs[frame] == 1;
+}
+
 #define INDEX_FROM_BIT(b) (b / 0x20)
 #define OFFSET_FROM_BIT(b) (b % 0x20)
 
@@ -169,34 +196,62 @@ uint32_t test_frame(uintptr_t frame_addr) {
 }
 
 uint32_t first_n_frames(int n) {
-	for (uint32_t i = 0; i < nframes * 0x1000; i += 0x1000) {
+	for (uint32_t frame = 0; frame + n <= nframes; ) {
+		/* Word-aligned and fully allocated: skip all 32 at once */
+		if (OFFSET_FROM_BIT(frame) == 0 && frames[INDEX_FROM_BIT(frame)] == 0xFFFFFFFF) {
+			frame += 0x20;
+			continue;
+		}
 		int bad = 0;
 		for (int j = 0; j < n; ++j) {
-			if (test_frame(i + 0x1000 * j)) {
+			if (test_frame((frame + j) * 0x1000)) {
 				bad = j+1;
 			}
 		}
 		if (!bad) {
-			return i / 0x1000;
+			return frame;
 		}
+		/* No run starting before the last used page can succeed,
+		 * so resume the search just past it. */
+		frame += bad;
 	}
 	return 0xFFFFFFFF;
 }
 
+/*
+ * Where the last single-frame search left off. Frees during boot and
+ * steady-state churn cluster, so resuming the scan here (and wrapping)
+ * keeps first_frame from re-walking the fully-allocated low words of
+ * the bitmap on every call.
+ */
+static uint32_t frame_hint = 0;
+
 uint32_t first_frame(void) {
 	uint32_t i, j;
+	uint32_t words = INDEX_FROM_BIT(nframes);
+	uint32_t start = INDEX_FROM_BIT(frame_hint);
+	if (start >= words) start = 0;
 
-	for (i = 0; i < INDEX_FROM_BIT(nframes); ++i) {
+	for (uint32_t n = 0; n < words; ++n) {
+		i = start + n;
+		if (i >= words) i -= words;
 		if (frames[i] != 0xFFFFFFFF) {
-			for (j = 0; j < 32; ++j) {
-				uint32_t testFrame = (uint32_t)0x1 << j;
-				if (!(frames[i] & testFrame)) {
-					return i * 0x20 + j;
-				}
-			}
+			j = __builtin_ctz(~frames[i]);
+			frame_hint = i * 0x20 + j;
+			return i * 0x20 + j;
 		}
 	}
 
+	/* Exhausted; the caller decides whether reclaim can help
+	 * or whether this is fatal. */
+	return -1;
+}
+
+/*
+ * Terminal out-of-memory: there are no frames and reclaim either
+ * is not available or could not produce any.
+ */
+static void out_of_memory(void) {
 	debug_print(CRITICAL, "System claims to be out of usable memory, which means we probably overwrote the page frames.\033[0m");
 
 	if (debug_video_crash) {
@@ -205,8 +260,41 @@ uint32_t first_frame(void) {
 	}
 
 	STOP;
+}
 
-	return -1;
+/*
+ * Single-page fast path: a small stack of ready frames refilled in
+ * batches. Cached frames stay marked in the bitmap, so set_frame and
+ * the contiguous-run search can never hand one out twice; the cache
+ * just remembers which already-claimed frames are free to give away.
+ * One bitmap scan per batch replaces one scan per allocation, and
+ * free_frame feeds frames straight back without touching the bitmap.
+ * Callers must hold frame_alloc_lock.
+ */
+#define FRAME_CACHE_SIZE   64
+#define FRAME_CACHE_REFILL 32
+static uint32_t frame_cache[FRAME_CACHE_SIZE];
+static int frame_cache_count = 0;
+
+static uint32_t cache_alloc_frame(void) {
+	if (!frame_cache_count) {
+		for (int n = 0; n < FRAME_CACHE_REFILL; ++n) {
+			uint32_t index = first_frame();
+			if (index == (uint32_t)-1) break;
+			set_frame(index * 0x1000);
+			frame_cache[frame_cache_count++] = index;
+		}
+		if (!frame_cache_count) return (uint32_t)-1;
+	}
+	return frame_cache[--frame_cache_count];
+}
+
+static void cache_free_frame(uint32_t frame) {
+	if (frame_cache_count < FRAME_CACHE_SIZE) {
+		frame_cache[frame_cache_count++] = frame;
+	} else {
+		clear_frame(frame * 0x1000);
+	}
 }
 
 void
@@ -216,6 +304,11 @@ alloc_frame(
 		int is_writeable
 		) {
 	ASSUME(page != NULL);
+	if (page->swapped) {
+		/* The caller is reasserting a mapping whose contents went
+		 * out to swap; bring them back first. */
+		swap_restore_page(page);
+	}
 	if (page->frame != 0) {
 		page->present = 1;
 		page->rw      = (is_writeable == 1) ? 1 : 0;
@@ -223,9 +316,15 @@ alloc_frame(
 		return;
 	} else {
 		spin_lock(frame_alloc_lock);
-		uint32_t index = first_frame();
-		assert(index != (uint32_t)-1 && "Out of frames.");
-		set_frame(index * 0x1000);
+		uint32_t index = cache_alloc_frame();
+		if (index == (uint32_t)-1 && swap_active()) {
+			spin_unlock(frame_alloc_lock);
+			swap_reclaim(8);
+			spin_lock(frame_alloc_lock);
+			index = cache_alloc_frame();
+		}
+		if (index == (uint32_t)-1) out_of_memory();
+		if (frame_refs && index < nframes) frame_refs[index] = 1;
 		page->frame   = index;
 		spin_unlock(frame_alloc_lock);
 		page->present = 1;
@@ -234,6 +333,81 @@ alloc_frame(
 	}
 }
 
+/*
+ * Claim a run of n physically contiguous frames for DMA engines and
+ * other hardware that needs real addresses. Returns the physical
+ * address of the first frame, or 0 if no run was available.
+ */
+uintptr_t alloc_frames(int n) {
+	spin_lock(frame_alloc_lock);
+	uint32_t index = first_n_frames(n);
+	if (index == 0xFFFFFFFF) {
+		spin_unlock(frame_alloc_lock);
+		return 0;
+	}
+	for (int i = 0; i < n; ++i) {
+		set_frame((index + i) * 0x1000);
+		if (frame_refs && index + i < nframes) frame_refs[index + i] = 1;
+	}
+	spin_unlock(frame_alloc_lock);
+	return (uintptr_t)index * 0x1000;
+}
+
+/*
+ * Return a run claimed with alloc_frames. Runs go back to the bitmap
+ * rather than the single-page cache so they can be found contiguously
+ * again.
+ */
+void free_frames(uintptr_t address, int n) {
+	spin_lock(frame_alloc_lock);
+	for (int i = 0; i < n; ++i) {
+		uint32_t frame = address / 0x1000 + i;
+		if (frame_refs && frame < nframes) frame_refs[frame] = 0;
+		clear_frame(frame * 0x1000);
+	}
+	spin_unlock(frame_alloc_lock);
+}
+
+/*
+ * The shared zero frame backing untouched anonymous pages. It is
+ * created on first use (the heap is up by the time anyone execs)
+ * and pinned so it can never be returned to the allocator.
+ */
+static uint32_t zero_page_frame = 0;
+
+static uint32_t get_zero_page_frame(void) {
+	if (!zero_page_frame) {
+		uintptr_t phys;
+		uintptr_t virt = kvmalloc_p(0x1000, &phys);
+		memset((void *)virt, 0, 0x1000);
+		frame_refs[phys / 0x1000] = FRAME_REFS_PINNED;
+		zero_page_frame = phys / 0x1000;
+	}
+	return zero_page_frame;
+}
+
+/*
+ * Back an anonymous user page with the shared zero frame. The page
+ * reads as zeros immediately; the first write takes a CoW fault and
+ * gets a private frame. Pages that already have a frame behave as
+ * alloc_frame did, so callers can use this unconditionally.
+ */
+void
+alloc_frame_lazy(
+		page_t *page
+		) {
+	ASSUME(page != NULL);
+	if (page->frame != 0) {
+		alloc_frame(page, 0, 1);
+		return;
+	}
+	page->frame   = get_zero_page_frame();
+	page->present = 1;
+	page->user    = 1;
+	page->rw      = 0;
+	page->cow     = 1;
+}
+
 void
 dma_frame(
 		page_t *page,
@@ -259,7 +433,24 @@ free_frame(
 		assert(0);
 		return;
 	} else {
-		clear_frame(frame * 0x1000);
+		spin_lock(frame_alloc_lock);
+		if (frame_refs && frame < nframes && frame_refs[frame]) {
+			if (frame_refs[frame] == FRAME_REFS_PINNED) {
+				/* Pinned frames are never returned */
+				spin_unlock(frame_alloc_lock);
+				page->frame = 0x0;
+				return;
+			}
+			frame_refs[frame]--;
+			if (frame_refs[frame]) {
+				/* Someone else still maps this frame */
+				spin_unlock(frame_alloc_lock);
+				page->frame = 0x0;
+				return;
+			}
+		}
+		cache_free_frame(frame);
+		spin_unlock(frame_alloc_lock);
 		page->frame = 0x0;
 	}
 }
@@ -286,6 +477,8 @@ void paging_install(uint32_t memsize) {
 	nframes = memsize  / 4;
 	frames  = (uint32_t *)kmalloc(INDEX_FROM_BIT(nframes * 8));
 	memset(frames, 0, INDEX_FROM_BIT(nframes * 8));
+	frame_refs = (uint8_t *)kmalloc(nframes);
+	memset(frame_refs, 0, nframes);
 
 	uintptr_t phys;
 	kernel_directory = (page_directory_t *)kvmalloc_p(sizeof(page_directory_t),&phys);
@@ -407,10 +600,15 @@ switch_page_directory(
 		page_directory_t * dir
 		) {
 	current_directory = dir;
+	/*
+	 * PG, and also WP: supervisor writes must honor read-only
+	 * mappings or kernel-mode stores into user buffers would
+	 * silently punch through copy-on-write and zero-fill pages.
+	 */
 	asm volatile (
 			"mov %0, %%cr3\n"
 			"mov %%cr0, %%eax\n"
-			"orl $0x80000000, %%eax\n"
+			"orl $0x80010000, %%eax\n"
 			"mov %%eax, %%cr0\n"
 			:: "r"(dir->physical_address)
 			: "%eax");
@@ -430,6 +628,23 @@ void invalidate_tables_at(uintptr_t addr) {
 			:: "r"(addr) : "%eax");
 }
 
+/*
+ * Flush a contiguous range of pages. Small ranges get targeted
+ * invlpg; past a few dozen pages a full CR3 reload is cheaper than
+ * issuing one invlpg per page, though it costs every other mapping
+ * its TLB entries.
+ */
+#define INVLPG_BATCH_LIMIT 64
+void invalidate_tables_range(uintptr_t addr, size_t pages) {
+	if (pages >= INVLPG_BATCH_LIMIT) {
+		invalidate_page_tables();
+		return;
+	}
+	for (size_t i = 0; i < pages; ++i) {
+		invalidate_tables_at(addr + i * 0x1000);
+	}
+}
+
 page_t *
 get_page(
 		uintptr_t address,
@@ -452,6 +667,45 @@ get_page(
 	}
 }
 
+/*
+ * Resolve a write fault on a copy-on-write page. If the frame is
+ * still shared, copy it into a fresh frame; either way the page
+ * goes back to being privately writable.
+ *
+ * @return 1 if this was a CoW fault and it has been satisfied.
+ */
+static int resolve_cow_fault(uintptr_t address) {
+	page_t * page = get_page(address, 0, current_directory);
+	if (!page || !page->cow) return 0;
+
+	spin_lock(frame_alloc_lock);
+	uint32_t frame = page->frame;
+	if (frame_refs && frame < nframes && frame_refs[frame] > 1) {
+		uint32_t index = cache_alloc_frame();
+		if (index == (uint32_t)-1 && swap_active()) {
+			spin_unlock(frame_alloc_lock);
+			swap_reclaim(8);
+			spin_lock(frame_alloc_lock);
+			index = cache_alloc_frame();
+		}
+		if (index == (uint32_t)-1) out_of_memory();
+		frame_refs[index] = 1;
+		if (frame_refs[frame] != FRAME_REFS_PINNED) {
+			frame_refs[frame]--;
+		}
+		spin_unlock(frame_alloc_lock);
+		copy_page_physical(frame * 0x1000, index * 0x1000);
+		page->frame = index;
+	} else {
+		/* Last reference; just take the frame back */
+		spin_unlock(frame_alloc_lock);
+	}
+	page->cow = 0;
+	page->rw  = 1;
+	invalidate_tables_at(address & ~0xFFF);
+	return 1;
+}
+
 void
 page_fault(
 		struct regs *r)  {
@@ -459,6 +713,11 @@ page_fault(
 	uint32_t faulting_address;
 	asm volatile("mov %%cr2, %0" : "=r"(faulting_address));
 
+	total_page_faults++;
+	if (current_process) {
+		current_process->page_faults++;
+	}
+
 	if (r->eip == SIGNAL_RETURN) {
 		return_from_signal_handler();
 	} else if (r->eip == THREAD_RETURN) {
@@ -466,6 +725,32 @@ page_fault(
 		kexit(0);
 	}
 
+	/* Write to a present page: possibly a copy-on-write fault */
+	if ((r->err_code & 0x3) == 0x3 && resolve_cow_fault(faulting_address)) {
+		return;
+	}
+
+	/*
+	 * Grow the user stack on demand. exec_elf only maps the top of
+	 * the stack region; touching anything below it faults in here and
+	 * gets a page. The bottom page of the region is a hard guard and
+	 * is never mapped, so blowing the stack is a clean segfault
+	 * instead of a silent walk into the mmap region.
+	 */
+	if (!(r->err_code & 0x1) &&
+	    faulting_address >= USER_STACK_BOTTOM + 0x1000 &&
+	    faulting_address <  USER_STACK_TOP) {
+		page_t * page = get_page(faulting_address & ~0xFFF, 1, current_directory);
+		alloc_frame(page, 0, 1);
+		/* The entry was not present, so the TLB has nothing to flush. */
+		return;
+	}
+
+	/* Non-present fault on a page that went out to swap */
+	if (!(r->err_code & 0x1) && swap_fault_in(faulting_address)) {
+		return;
+	}
+
 #if 1
 	int present  = !(r->err_code & 0x1) ? 1 : 0;
 	int rw       = r->err_code & 0x2    ? 1 : 0;
@@ -555,7 +840,8 @@ void * sbrk(uintptr_t increment) {
 			assert(page && "Kernel heap allocation fault.");
 			alloc_frame(page, 1, 0);
 		}
-		invalidate_page_tables();
+		/* These entries were preallocated non-present, so nothing
+		 * stale can be cached; no flush required. */
 		debug_print(INFO, "Done.");
 	}
 
@@ -0,0 +1,216 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ * This file is part of ToaruOS and is released under the terms
+ * of the NCSA / University of Illinois License - see LICENSE.md
+ * Copyright (C) 2018 K. Lange
+ *
+ * mmap - memory-mapped regions
+ *
+ * Backs the mmap/munmap system calls. Mappings live in their own
+ * window of the address space, handed out by a per-process bump
+ * allocator; addresses are never reused within one process, which
+ * keeps the bookkeeping to a single pointer in the image struct.
+ *
+ * Anonymous mappings use the shared zero frame and materialize on
+ * first write, like sbrk growth. File mappings are filled through
+ * the VFS (so the buffer cache serves repeat reads), and whole-file
+ * mappings additionally register their frames in a per-file cache:
+ * the next process to map the same file gets the same physical
+ * frames, read-only for MAP_PRIVATE with copy-on-write resolving
+ * any writes, or writable and genuinely shared for MAP_SHARED.
+ * Shared file mappings are not written back to disk; the intended
+ * users are large read-only assets like fonts and wallpapers.
+ */
+#include <kernel/system.h>
+#include <kernel/process.h>
+#include <kernel/logging.h>
+#include <kernel/fs.h>
+#include <kernel/mem.h>
+
+#include <sys/mman.h>
+#include <toaru/hashmap.h>
+
+static spin_lock_t mml; // mmap file cache lock
+static hashmap_t * file_frame_cache = NULL;
+
+typedef struct {
+	void *     device;
+	uint32_t   inode;
+	size_t     file_size;   /* For staleness detection */
+	size_t     num_frames;
+	uint32_t * frames;
+} mmap_file_entry_t;
+
+/* Key scheme borrowed from the VFS buffer cache; the entry stores the
+ * real identity so a hash collision just misses. */
+static uintptr_t mmap_cache_key(void * device, uint32_t inode) {
+	return ((uintptr_t)device) ^ (inode * 2654435761UL);
+}
+
+static mmap_file_entry_t * mmap_cache_find(fs_node_t * node) {
+	if (!file_frame_cache) return NULL;
+	mmap_file_entry_t * entry = hashmap_get(file_frame_cache, (void *)mmap_cache_key(node->device, node->inode));
+	if (!entry) return NULL;
+	if (entry->device != node->device || entry->inode != node->inode) return NULL;
+	return entry;
+}
+
+static void mmap_cache_drop(mmap_file_entry_t * entry) {
+	hashmap_remove(file_frame_cache, (void *)mmap_cache_key(entry->device, entry->inode));
+	for (size_t i = 0; i < entry->num_frames; ++i) {
+		page_t tmp = {0};
+		tmp.frame = entry->frames[i];
+		free_frame(&tmp);
+	}
+	free(entry->frames);
+	free(entry);
+}
+
+/* Hand out a fresh page-aligned region from the process's window. */
+static uintptr_t mmap_allocate(size_t npages) {
+	process_t * proc = (process_t *)current_process;
+	if (proc->group != 0) {
+		proc = process_from_pid(proc->group);
+	}
+	spin_lock(proc->image.lock);
+	uintptr_t addr = proc->image.mmap_start;
+	if (addr + npages * 0x1000 > MMAP_REGION_END || addr + npages * 0x1000 < addr) {
+		spin_unlock(proc->image.lock);
+		return 0;
+	}
+	proc->image.mmap_start = addr + npages * 0x1000;
+	spin_unlock(proc->image.lock);
+	return addr;
+}
+
+int mmap_map(fs_node_t * node, size_t length, int prot, int flags, int offset) {
+	if (!length) return -EINVAL;
+	if (flags & MAP_FIXED) return -EINVAL;
+	if (!(flags & (MAP_PRIVATE | MAP_SHARED))) return -EINVAL;
+
+	size_t npages = (length + 0xFFF) / 0x1000;
+	uintptr_t addr = mmap_allocate(npages);
+	if (!addr) return -ENOMEM;
+
+	if (flags & MAP_ANONYMOUS) {
+		/* Zero-filled on demand via the shared zero frame. The region
+		 * is fresh from the bump allocator, so nothing can be cached
+		 * for these addresses and no TLB flush is needed. */
+		for (size_t i = 0; i < npages; ++i) {
+			alloc_frame_lazy(get_page(addr + i * 0x1000, 1, current_directory));
+		}
+		return addr;
+	}
+
+	if (!node) return -EBADF;
+	if (offset & 0xFFF) return -EINVAL;
+	if ((size_t)offset >= node->length) return -EINVAL;
+
+	int shareable = (offset == 0 && length >= node->length);
+
+	if (shareable) {
+		spin_lock(mml);
+		mmap_file_entry_t * entry = mmap_cache_find(node);
+		if (entry && entry->file_size != node->length) {
+			/* The file was replaced since it was cached. (A rewrite
+			 * that keeps the size is not caught; assets are written
+			 * once at build time, so this is a best-effort check.) */
+			mmap_cache_drop(entry);
+			entry = NULL;
+		}
+		if (entry) {
+			for (size_t i = 0; i < npages; ++i) {
+				page_t * page = get_page(addr + i * 0x1000, 1, current_directory);
+				if (i < entry->num_frames) {
+					frame_ref(entry->frames[i]);
+					page->frame   = entry->frames[i];
+					page->present = 1;
+					page->user    = 1;
+					if (flags & MAP_SHARED) {
+						page->rw  = (prot & PROT_WRITE) ? 1 : 0;
+						page->cow = 0;
+					} else {
+						page->rw  = 0;
+						page->cow = 1;
+					}
+				} else {
+					alloc_frame_lazy(page);
+				}
+			}
+			spin_unlock(mml);
+			return addr;
+		}
+		spin_unlock(mml);
+	}
+
+	/* Read the requested window into fresh frames. read_fs can sleep,
+	 * so this happens without the cache lock held. */
+	for (size_t i = 0; i < npages; ++i) {
+		alloc_frame(get_page(addr + i * 0x1000, 1, current_directory), 0, 1);
+	}
+	size_t window = node->length - offset;
+	if (window > length) window = length;
+	uint32_t got = read_fs(node, offset, window, (uint8_t *)addr);
+	memset((void *)(addr + got), 0, npages * 0x1000 - got);
+
+	if (shareable) {
+		/* Offer the pristine image to the file cache, unless another
+		 * process slipped in first - then our copy just stays private. */
+		size_t file_pages = (node->length + 0xFFF) / 0x1000;
+		spin_lock(mml);
+		if (!file_frame_cache) {
+			file_frame_cache = hashmap_create(10);
+		}
+		if (!mmap_cache_find(node)) {
+			mmap_file_entry_t * entry = malloc(sizeof(mmap_file_entry_t));
+			entry->device = node->device;
+			entry->inode  = node->inode;
+			entry->file_size = node->length;
+			entry->num_frames = file_pages;
+			entry->frames = malloc(sizeof(uint32_t) * file_pages);
+			for (size_t i = 0; i < file_pages; ++i) {
+				page_t * page = get_page(addr + i * 0x1000, 0, current_directory);
+				frame_ref(page->frame);
+				entry->frames[i] = page->frame;
+			}
+			hashmap_set(file_frame_cache, (void *)mmap_cache_key(node->device, node->inode), entry);
+		}
+		spin_unlock(mml);
+	}
+
+	/* Apply the requested protection. Private pages that made it into
+	 * the cache are shared now, so they go copy-on-write; an unshared
+	 * window is already a private copy and just gets the plain bits.
+	 * The fill above went through these translations, so this time the
+	 * TLB does need flushing - batched, since the whole range changed. */
+	for (size_t i = 0; i < npages; ++i) {
+		page_t * page = get_page(addr + i * 0x1000, 0, current_directory);
+		if (shareable && !(flags & MAP_SHARED)) {
+			page->rw  = 0;
+			page->cow = 1;
+		} else {
+			page->rw = (prot & PROT_WRITE) ? 1 : 0;
+		}
+	}
+	invalidate_tables_range(addr, npages);
+
+	return addr;
+}
+
+int mmap_unmap(uintptr_t addr, size_t length) {
+	if (addr & 0xFFF) return -EINVAL;
+	if (addr < MMAP_REGION_START) return -EINVAL;
+	if (addr + length > MMAP_REGION_END || addr + length < addr) return -EINVAL;
+
+	for (uintptr_t a = addr; a < addr + length; a += 0x1000) {
+		page_t * page = get_page(a, 0, current_directory);
+		if (page && page->frame) {
+			free_frame(page);
+			page->present = 0;
+			page->rw      = 0;
+			page->cow     = 0;
+		}
+	}
+	invalidate_tables_range(addr, (length + 0xFFF) / 0x1000);
+
+	return 0;
+}
@@ -11,6 +11,7 @@
 #include <kernel/logging.h>
 #include <kernel/shm.h>
 #include <kernel/mem.h>
+#include <kernel/radix.h>
 
 #include <toaru/tree.h>
 #include <toaru/list.h>
@@ -20,11 +21,30 @@
 static spin_lock_t bsl; // big shm lock
 tree_t * shm_tree = NULL;
 
+/* Whole-path index in front of the component walk below. Entries map
+ * a hash of the full path to its shm_node_t; the path is kept so a
+ * colliding hash can be told apart from a hit. */
+static radix_tree_t * shm_index = NULL;
+
+struct shm_index_entry {
+	char * path;
+	shm_node_t * node;
+};
+
+static uintptr_t shm_hash(char * path) {
+	uint32_t hash = 0x811c9dc5UL;
+	for (char * c = path; *c; ++c) {
+		hash ^= (uint8_t)*c;
+		hash *= 0x01000193UL;
+	}
+	return hash;
+}
 
 void shm_install(void) {
 	debug_print(NOTICE, "Installing shared memory layer...");
 	shm_tree = tree_create();
 	tree_set_root(shm_tree, NULL);
+	shm_index = radix_tree_create();
 }
 
 
@@ -68,12 +88,32 @@ static shm_node_t * _get_node(char * shm_path, int create, tree_node_t * from) {
 }
 
 static shm_node_t * get_node (char * shm_path, int create) {
+	/* Fast path: one radix probe instead of a strtok walk with a
+	 * string compare against every sibling at every level. The
+	 * Yutani buffer paths hit this on every map and resize. */
+	uintptr_t hash = shm_hash(shm_path);
+	struct shm_index_entry * entry = radix_tree_get(shm_index, hash);
+	if (entry && !strcmp(entry->path, shm_path)) {
+		return entry->node;
+	}
+
 	char * _path = malloc(strlen(shm_path)+1);
 	memcpy(_path, shm_path, strlen(shm_path)+1);
 
 	shm_node_t * node = _get_node(_path, create, shm_tree->root);
 
 	free(_path);
+
+	/* Nodes are never removed from shm_tree, so index entries can
+	 * not go stale. On a hash collision the older path keeps the
+	 * slot and the newer one stays on the walk above. */
+	if (node && !entry) {
+		entry = malloc(sizeof(struct shm_index_entry));
+		entry->path = strdup(shm_path);
+		entry->node = node;
+		radix_tree_set(shm_index, hash, entry);
+	}
+
 	return node;
 }
 
@@ -96,12 +136,20 @@ static shm_chunk_t * create_chunk (shm_node_t * parent, size_t size) {
 	chunk->ref_count = 1;
 
 	chunk->num_frames = (size / 0x1000) + ((size % 0x1000) ? 1 : 0);
-	chunk->frames = malloc(sizeof(uintptr_t) * chunk->num_frames);
+
+	/* Reserve room past the requested size so the chunk can grow in
+	 * place later; mappers set aside address space for the full
+	 * capacity, but only committed frames cost memory. */
+	chunk->capacity = 16;
+	while (chunk->capacity < chunk->num_frames) chunk->capacity <<= 1;
+
+	chunk->frames = malloc(sizeof(uintptr_t) * chunk->capacity);
 	if (chunk->frames == NULL) {
-		debug_print(ERROR, "Failed to allocate uintptr_t[%d]", chunk->num_frames);
+		debug_print(ERROR, "Failed to allocate uintptr_t[%d]", chunk->capacity);
 		free(chunk);
 		return NULL;
 	}
+	chunk->mappings = list_create();
 
 	/* Now grab some frames for this guy. */
 	for (uint32_t i = 0; i < chunk->num_frames; i++) {
@@ -133,6 +181,7 @@ static int release_chunk (shm_chunk_t * chunk) {
 
 			/* Then, get rid of the damn thing */
 			chunk->parent->chunk = NULL;
+			free(chunk->mappings);
 			free(chunk->frames);
 			free(chunk);
 		}
@@ -160,14 +209,18 @@ static uintptr_t proc_sbrk(uint32_t num_pages, process_t * proc) {
 	return initial;
 }
 
-static void * map_in (shm_chunk_t * chunk, process_t * proc) {
+static void * map_in (shm_chunk_t * chunk, process_t * proc, int writable) {
 	if (!chunk) {
 		return NULL;
 	}
 
 	shm_mapping_t * mapping = malloc(sizeof(shm_mapping_t));
 	mapping->chunk = chunk;
-	mapping->num_vaddrs = chunk->num_frames;
+	mapping->owner = proc;
+	mapping->writable = writable;
+	/* Reserve addresses for the whole capacity so the chunk can grow
+	 * into this mapping later without moving. */
+	mapping->num_vaddrs = chunk->capacity;
 	mapping->vaddrs = malloc(sizeof(uintptr_t) * mapping->num_vaddrs);
 
 	debug_print(INFO, "want %d bytes, running through mappings...", mapping->num_vaddrs * 0x1000);
@@ -180,17 +233,23 @@ static void * map_in (shm_chunk_t * chunk, process_t * proc) {
 			if (gap >= mapping->num_vaddrs * 0x1000) {
 				debug_print(INFO, "Gap is sufficient, we can insert here.");
 
-				/* Map the gap */
-				for (unsigned int i = 0; i < chunk->num_frames; ++i) {
-					page_t * page = get_page(last_address + i * 0x1000, 1, proc->thread.page_directory);
-					page->frame = chunk->frames[i];
-					alloc_frame(page, 0, 1);
-					invalidate_tables_at(last_address + i * 0x1000);
+				/* Map the gap. The entries here are either brand new or
+				 * were cleared (and flushed) by shm_release, so they are
+				 * not in the TLB and no invalidation is needed. Only the
+				 * committed frames get mapped; the rest of the reserved
+				 * range stays non-present until the chunk grows. */
+				for (unsigned int i = 0; i < mapping->num_vaddrs; ++i) {
 					mapping->vaddrs[i] = last_address + i * 0x1000;
+					if (i < chunk->num_frames) {
+						page_t * page = get_page(mapping->vaddrs[i], 1, proc->thread.page_directory);
+						page->frame = chunk->frames[i];
+						alloc_frame(page, 0, writable);
+					}
 				}
 
 				/* Insert us before this node */
 				list_insert_before(proc->shm_mappings, node, mapping);
+				list_insert(chunk->mappings, mapping);
 
 				return (void *)mapping->vaddrs[0];
 			}
@@ -204,15 +263,17 @@ static void * map_in (shm_chunk_t * chunk, process_t * proc) {
 		if (gap >= mapping->num_vaddrs * 0x1000) {
 			debug_print(INFO, "Gap is sufficient, we can insert here.");
 
-			for (unsigned int i = 0; i < chunk->num_frames; ++i) {
-				page_t * page = get_page(last_address + i * 0x1000, 1, proc->thread.page_directory);
-				page->frame = chunk->frames[i];
-				alloc_frame(page, 0, 1);
-				invalidate_tables_at(last_address + i * 0x1000);
+			for (unsigned int i = 0; i < mapping->num_vaddrs; ++i) {
 				mapping->vaddrs[i] = last_address + i * 0x1000;
+				if (i < chunk->num_frames) {
+					page_t * page = get_page(mapping->vaddrs[i], 1, proc->thread.page_directory);
+					page->frame = chunk->frames[i];
+					alloc_frame(page, 0, writable);
+				}
 			}
 
 			list_insert(proc->shm_mappings, mapping);
+			list_insert(chunk->mappings, mapping);
 
 			return (void *)mapping->vaddrs[0];
 		} else {
@@ -221,17 +282,18 @@ static void * map_in (shm_chunk_t * chunk, process_t * proc) {
 	}
 
 
-	for (uint32_t i = 0; i < chunk->num_frames; i++) {
+	for (uint32_t i = 0; i < mapping->num_vaddrs; i++) {
 		uintptr_t new_vpage = proc_sbrk(1, proc);
 		assert(new_vpage % 0x1000 == 0);
+		mapping->vaddrs[i] = new_vpage;
 
-		page_t * page = get_page(new_vpage, 1, proc->thread.page_directory);
-		assert(page && "Page not allocated by sys_sbrk?");
+		if (i < chunk->num_frames) {
+			page_t * page = get_page(new_vpage, 1, proc->thread.page_directory);
+			assert(page && "Page not allocated by sys_sbrk?");
 
-		page->frame = chunk->frames[i];
-		alloc_frame(page, 0, 1);
-		invalidate_tables_at(new_vpage);
-		mapping->vaddrs[i] = new_vpage;
+			page->frame = chunk->frames[i];
+			alloc_frame(page, 0, writable);
+		}
 
 #if 0
 			debug_print(INFO, "mapping vaddr 0x%x --> #%d", new_vpage, page->frame);
@@ -239,6 +301,7 @@ static void * map_in (shm_chunk_t * chunk, process_t * proc) {
 	}
 
 	list_insert(proc->shm_mappings, mapping);
+	list_insert(chunk->mappings, mapping);
 
 	return (void *)mapping->vaddrs[0];
 }
@@ -286,11 +349,42 @@ void * shm_obtain (char * path, size_t * size) {
 		/* New accessor! */
 		chunk->ref_count++;
 	}
-	void * vshm_start = map_in(chunk, proc);
+	void * vshm_start = map_in(chunk, proc, 1);
+	*size = chunk_size(chunk);
+
+	spin_unlock(bsl);
+
+	return vshm_start;
+}
+
+/*
+ * Attach an existing chunk with read-only page mappings. Unlike
+ * shm_obtain this never creates the chunk - a fresh segment nobody can
+ * write to is useless - so a missing path reports size 0 and returns
+ * NULL, which is also how consumers find out their producer hasn't
+ * started yet.
+ */
+void * shm_obtain_ro (char * path, size_t * size) {
+	spin_lock(bsl);
+	process_t * proc = (process_t *)current_process;
+
+	if (proc->group != 0) {
+		proc = process_from_pid(proc->group);
+	}
+
+	shm_node_t * node = get_node(path, 0);
+	if (!node || !node->chunk) {
+		if (size) *size = 0;
+		spin_unlock(bsl);
+		return NULL;
+	}
+	shm_chunk_t * chunk = node->chunk;
+	chunk->ref_count++;
+
+	void * vshm_start = map_in(chunk, proc, 0);
 	*size = chunk_size(chunk);
 
 	spin_unlock(bsl);
-	invalidate_page_tables();
 
 	return vshm_start;
 }
@@ -327,16 +421,25 @@ int shm_release (char * path) {
 
 	shm_mapping_t * mapping = (shm_mapping_t *)node->value;
 
-	/* Clear the mappings from the process's address space */
+	/* Clear the mappings from the process's address space. Flushing
+	 * just the affected pages keeps everyone else's TLB entries alive;
+	 * a full reload here cost every process its translations on every
+	 * window resize. The uncommitted tail of the reserved range may
+	 * not have page entries at all. */
 	for (uint32_t i = 0; i < mapping->num_vaddrs; i++) {
 		page_t * page = get_page(mapping->vaddrs[i], 0, proc->thread.page_directory);
-		assert(page && "Shared memory mapping was invalid!");
+		if (!page) continue;
 
 		memset(page, 0, sizeof(page_t));
+		invalidate_tables_at(mapping->vaddrs[i]);
 	}
-	invalidate_page_tables();
 
 	/* Clean up */
+	node_t * cnode = list_find(chunk->mappings, mapping);
+	if (cnode) {
+		list_delete(chunk->mappings, cnode);
+		free(cnode);
+	}
 	release_chunk(chunk);
 	list_delete(proc->shm_mappings, node);
 	free(node);
@@ -346,6 +449,61 @@ int shm_release (char * path) {
 	return 0;
 }
 
+/*
+ * Grow a chunk in place. Every process with the chunk mapped reserved
+ * address space for the full capacity at map time, so committing the
+ * delta frames here just fills in page entries that were non-present;
+ * existing pointers stay valid everywhere and nothing needs a TLB
+ * flush. Returns nonzero if the chunk doesn't exist or the new size
+ * exceeds the reserved capacity, in which case the caller has to fall
+ * back to allocating a new chunk.
+ */
+int shm_resize (char * path, size_t * size) {
+	spin_lock(bsl);
+
+	shm_node_t * node = get_node(path, 0);
+	if (!node || !node->chunk) {
+		spin_unlock(bsl);
+		return 1;
+	}
+	shm_chunk_t * chunk = node->chunk;
+
+	uint32_t new_frames = (*size / 0x1000) + ((*size % 0x1000) ? 1 : 0);
+	if (new_frames <= chunk->num_frames) {
+		/* Already big enough; shrinking isn't worth the churn. */
+		*size = chunk_size(chunk);
+		spin_unlock(bsl);
+		return 0;
+	}
+	if (new_frames > chunk->capacity) {
+		spin_unlock(bsl);
+		return 1;
+	}
+
+	/* Commit the delta frames... */
+	for (uint32_t i = chunk->num_frames; i < new_frames; i++) {
+		page_t tmp = {0};
+		alloc_frame(&tmp, 0, 0);
+		chunk->frames[i] = tmp.frame;
+	}
+
+	/* ...and map them into everyone holding the chunk. */
+	foreach(n, chunk->mappings) {
+		shm_mapping_t * mapping = n->value;
+		for (uint32_t i = chunk->num_frames; i < new_frames; i++) {
+			page_t * page = get_page(mapping->vaddrs[i], 1, mapping->owner->thread.page_directory);
+			page->frame = chunk->frames[i];
+			alloc_frame(page, 0, mapping->writable);
+		}
+	}
+
+	chunk->num_frames = new_frames;
+	*size = chunk_size(chunk);
+
+	spin_unlock(bsl);
+	return 0;
+}
+
 /* This function should only be called if the process's address space
  * is about to be destroyed -- chunks will not be unmounted therefrom ! */
 void shm_release_all (process_t * proc) {
@@ -354,6 +512,11 @@ void shm_release_all (process_t * proc) {
 	node_t * node;
 	while ((node = list_pop(proc->shm_mappings)) != NULL) {
 		shm_mapping_t * mapping = node->value;
+		node_t * cnode = list_find(mapping->chunk->mappings, mapping);
+		if (cnode) {
+			list_delete(mapping->chunk->mappings, cnode);
+			free(cnode);
+		}
 		release_chunk(mapping->chunk);
 		free(mapping);
 		free(node);
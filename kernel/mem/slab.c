@@ -0,0 +1,85 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ * This file is part of ToaruOS and is released under the terms
+ * of the NCSA / University of Illinois License - see LICENSE.md
+ *
+ * Object caches
+ *
+ * Typed caches for fixed-size kernel objects. klmalloc's bin logic
+ * is fine for general allocation, but the hottest kernel objects
+ * (processes, sleepers, packet headers) are all one size and churn
+ * constantly; keeping them in dedicated caches turns those
+ * allocations into a magazine pop or a pointer bump off a
+ * pre-carved page, and keeps their churn from fragmenting the
+ * general heap.
+ */
+#include <kernel/system.h>
+#include <kernel/logging.h>
+#include <kernel/slab.h>
+
+#define SLAB_PAGE_SIZE 0x1000
+
+slab_cache_t * slab_create(char * name, size_t object_size) {
+	slab_cache_t * cache = malloc(sizeof(slab_cache_t));
+	memset(cache, 0, sizeof(slab_cache_t));
+
+	/* Objects chain through their first word while free */
+	if (object_size < sizeof(void *)) {
+		object_size = sizeof(void *);
+	}
+	/* Keep objects pointer-aligned */
+	object_size = (object_size + sizeof(uintptr_t) - 1) & ~(sizeof(uintptr_t) - 1);
+
+	cache->name = name;
+	cache->object_size = object_size;
+	cache->objects_per_page = SLAB_PAGE_SIZE / object_size;
+	spin_init(cache->lock);
+
+	assert(cache->objects_per_page && "Object too large for a slab page.");
+
+	return cache;
+}
+
+/*
+ * Carve a fresh page into objects on the free list.
+ * Called with the cache lock held.
+ */
+static void slab_grow(slab_cache_t * cache) {
+	char * page = malloc(SLAB_PAGE_SIZE);
+	assert(page && "Out of memory growing a slab cache.");
+	for (size_t i = 0; i < cache->objects_per_page; ++i) {
+		void * object = page + i * cache->object_size;
+		*(void **)object = cache->free_list;
+		cache->free_list = object;
+	}
+	cache->total_objects += cache->objects_per_page;
+	cache->total_pages++;
+}
+
+void * slab_alloc(slab_cache_t * cache) {
+	spin_lock(cache->lock);
+	void * object;
+	if (cache->magazine_count) {
+		object = cache->magazine[--cache->magazine_count];
+	} else {
+		if (!cache->free_list) {
+			slab_grow(cache);
+		}
+		object = cache->free_list;
+		cache->free_list = *(void **)object;
+	}
+	spin_unlock(cache->lock);
+	memset(object, 0, cache->object_size);
+	return object;
+}
+
+void slab_free(slab_cache_t * cache, void * object) {
+	if (!object) return;
+	spin_lock(cache->lock);
+	if (cache->magazine_count < SLAB_MAGAZINE_SIZE) {
+		cache->magazine[cache->magazine_count++] = object;
+	} else {
+		*(void **)object = cache->free_list;
+		cache->free_list = object;
+	}
+	spin_unlock(cache->lock);
+}
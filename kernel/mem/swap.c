@@ -0,0 +1,329 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ * This file is part of ToaruOS and is released under the terms
+ * of the NCSA / University of Illinois License - see LICENSE.md
+ *
+ * Swap: page-out of idle anonymous pages to a block device.
+ *
+ * Enabled at runtime (sysfunc 16 points it at a partition), this
+ * adds an eviction path to the frame allocator. A background
+ * tasklet second-chances its way around user page tables - pages
+ * with the hardware accessed bit get it cleared and another pass,
+ * pages without it are written out and unmapped - and the page
+ * fault handler brings swapped pages back in transparently. When
+ * the allocator itself comes up empty it runs the same reclaim
+ * synchronously before giving up, so oversubscription degrades
+ * into disk traffic instead of a dead process.
+ *
+ * Only exclusively-owned, non-CoW user pages are candidates; CoW
+ * sharing, the zero page, and cached library images all keep
+ * multiple references and are skipped, which keeps the frame
+ * refcounting out of the picture entirely. A swapped-out page
+ * keeps its rw/user bits and stores its slot number in the frame
+ * field of the (non-present) entry, marked with the `swapped` bit.
+ *
+ * Everything that moves a page across the device goes through one
+ * bounce page under swap_op_lock, so an eviction mid-write and a
+ * fault-in can never race; the lock yields, so processes blocked
+ * on a fault just wait out the disk.
+ */
+
+#include <kernel/system.h>
+#include <kernel/fs.h>
+#include <kernel/mem.h>
+#include <kernel/process.h>
+#include <kernel/shm.h>
+#include <kernel/logging.h>
+
+#define SWAP_PAGE_SIZE 0x1000
+
+/* Start evicting below this much free memory; the emergency path
+ * in the allocator does not wait for the threshold. */
+#define SWAP_LOW_KB     4096
+#define SWAP_BATCH      64
+#define SWAP_MAX_DIRS   16
+
+static fs_node_t * swap_node = NULL;
+static int swap_enabled = 0;
+static uint32_t * swap_bitmap = NULL;
+static spin_lock_t swap_op_lock = { 0 };
+static uint8_t * swap_bounce = NULL;
+static uintptr_t swap_bounce_phys = 0;
+
+/* Exposed through /proc/meminfo */
+uint32_t swap_slots_total = 0;
+uint32_t swap_slots_used = 0;
+unsigned long swap_pages_out = 0;
+unsigned long swap_pages_in = 0;
+unsigned long swap_pages_scanned = 0;
+unsigned long swap_passes = 0;
+
+int swap_active(void) {
+	return swap_enabled;
+}
+
+/* Slot 0 is reserved so a slot number is never mistaken for an
+ * empty page entry. */
+static uint32_t swap_slot_alloc(void) {
+	IRQ_OFF;
+	for (uint32_t i = 0; i < swap_slots_total / 32; ++i) {
+		if (swap_bitmap[i] != 0xFFFFFFFF) {
+			uint32_t j = __builtin_ctz(~swap_bitmap[i]);
+			uint32_t slot = i * 32 + j;
+			if (slot >= swap_slots_total) break;
+			swap_bitmap[i] |= (1 << j);
+			swap_slots_used++;
+			IRQ_RES;
+			return slot;
+		}
+	}
+	IRQ_RES;
+	return 0;
+}
+
+static void swap_slot_free(uint32_t slot) {
+	if (!slot || slot >= swap_slots_total) return;
+	IRQ_OFF;
+	swap_bitmap[slot / 32] &= ~(1 << (slot % 32));
+	swap_slots_used--;
+	IRQ_RES;
+}
+
+/*
+ * Pull a swapped page back into a fresh frame, preserving its
+ * contents and permission bits. The caller is responsible for any
+ * TLB invalidation. Returns 0 on failure (out of frames with
+ * nothing left to reclaim).
+ */
+int swap_restore_page(page_t * page) {
+	uintptr_t phys = alloc_frames(1);
+	if (!phys) {
+		swap_reclaim(8);
+		phys = alloc_frames(1);
+		if (!phys) return 0;
+	}
+
+	spin_lock(swap_op_lock);
+	if (!page->swapped) {
+		/* Someone beat us to it while we waited on the lock */
+		spin_unlock(swap_op_lock);
+		free_frames(phys, 1);
+		return page->present;
+	}
+	uint32_t slot = page->frame;
+	read_fs(swap_node, (uint64_t)slot * SWAP_PAGE_SIZE, SWAP_PAGE_SIZE, swap_bounce);
+	copy_page_physical(swap_bounce_phys, phys);
+	page->frame   = phys / SWAP_PAGE_SIZE;
+	page->swapped = 0;
+	page->present = 1;
+	swap_slot_free(slot);
+	swap_pages_in++;
+	spin_unlock(swap_op_lock);
+	return 1;
+}
+
+/* Drop a swapped page without reading it back; used when the
+ * address space it belonged to is being torn down. */
+void swap_discard_page(page_t * page) {
+	if (!page->swapped) return;
+	swap_slot_free(page->frame);
+	page->swapped = 0;
+	page->frame = 0;
+}
+
+/*
+ * Fault-in path, called from the page fault handler for non-present
+ * faults. Returns 1 if the address was a swapped page and it is now
+ * mapped again.
+ */
+int swap_fault_in(uintptr_t address) {
+	if (!swap_enabled) return 0;
+	page_t * page = get_page(address & ~0xFFF, 0, current_directory);
+	if (!page || !page->swapped) return 0;
+
+	if (!swap_restore_page(page)) return 0;
+
+	invalidate_tables_at(address & ~0xFFF);
+	return 1;
+}
+
+/*
+ * Write one candidate page out and unmap it. The contents are
+ * snapshotted into the bounce page before the (sleeping) device
+ * write; if the owner touched the page in the meantime the
+ * hardware accessed/dirty bits give it away and the eviction is
+ * abandoned.
+ */
+static int swap_evict_page(page_t * page, uintptr_t address, int is_current) {
+	uint32_t slot = swap_slot_alloc();
+	if (!slot) return 0;
+
+	spin_lock(swap_op_lock);
+
+	if (!page->present || !page->user || page->cow || page->swapped ||
+	    !frame_is_exclusive(page->frame) || page->accessed) {
+		spin_unlock(swap_op_lock);
+		swap_slot_free(slot);
+		return 0;
+	}
+
+	uint32_t frame = page->frame;
+	page->dirty = 0;
+	if (is_current) invalidate_tables_at(address);
+
+	copy_page_physical(frame * SWAP_PAGE_SIZE, swap_bounce_phys);
+	write_fs(swap_node, (uint64_t)slot * SWAP_PAGE_SIZE, SWAP_PAGE_SIZE, swap_bounce);
+
+	IRQ_OFF;
+	if (!page->present || page->frame != frame || page->cow ||
+	    page->accessed || page->dirty) {
+		/* The owner used the page while we were writing; our copy
+		 * is stale, so it stays resident. */
+		IRQ_RES;
+		spin_unlock(swap_op_lock);
+		swap_slot_free(slot);
+		return 0;
+	}
+	page->present = 0;
+	page->swapped = 1;
+	page->frame   = slot;
+	IRQ_RES;
+
+	if (is_current) invalidate_tables_at(address);
+	free_frames((uintptr_t)frame * SWAP_PAGE_SIZE, 1);
+	swap_pages_out++;
+
+	spin_unlock(swap_op_lock);
+	return 1;
+}
+
+/*
+ * One second-chance pass over a directory's user tables. Accessed
+ * pages lose the bit and survive; untouched pages since the last
+ * pass go out. Returns the number of pages evicted.
+ */
+static int swap_scan_directory(page_directory_t * dir, int budget) {
+	int evicted = 0;
+	int is_current = (dir == current_directory);
+	int cleared = 0;
+
+	for (uint32_t i = 0; i < 1024 && evicted < budget; ++i) {
+		if (i * 0x1000 * 1024 >= SHM_START) break;
+		if (!dir->tables[i] || (uintptr_t)dir->tables[i] == (uintptr_t)0xFFFFFFFF) continue;
+		if (kernel_directory->tables[i] == dir->tables[i]) continue;
+
+		for (uint32_t j = 0; j < 1024 && evicted < budget; ++j) {
+			page_t * page = &dir->tables[i]->pages[j];
+			if (!page->present || !page->user || page->cow || page->swapped) continue;
+			if (!frame_is_exclusive(page->frame)) continue;
+
+			swap_pages_scanned++;
+			if (page->accessed) {
+				page->accessed = 0;
+				cleared = 1;
+				continue;
+			}
+
+			evicted += swap_evict_page(page, (i * 1024 + j) * 0x1000, is_current);
+		}
+	}
+
+	/* Cleared accessed bits only matter once stale translations are
+	 * gone; other directories reload wholesale on their next switch. */
+	if (is_current && cleared) invalidate_page_tables();
+
+	return evicted;
+}
+
+/* Round-robin position in the process list between passes */
+static unsigned int swap_scan_cursor = 0;
+
+/*
+ * Reclaim up to max_pages frames. Runs in the background tasklet
+ * when memory is low and synchronously from the allocator when it
+ * is gone. Directories are referenced for the duration of their
+ * scan so an exiting owner cannot free them under us.
+ */
+int swap_reclaim(int max_pages) {
+	if (!swap_enabled) return 0;
+
+	page_directory_t * dirs[SWAP_MAX_DIRS];
+	int num_dirs = 0;
+
+	IRQ_OFF;
+	unsigned int length = process_list->length;
+	unsigned int skip = swap_scan_cursor++ % (length ? length : 1);
+	for (int pass = 0; pass < 2 && !num_dirs; ++pass) {
+		/* Second pass from the top if the cursor landed past every
+		 * candidate, so emergency reclaim never comes up empty. */
+		foreach(node, process_list) {
+			if (skip) { skip--; continue; }
+			process_t * proc = node->value;
+			page_directory_t * dir = proc->thread.page_directory;
+			if (!dir || dir == kernel_directory) continue;
+			int seen = 0;
+			for (int i = 0; i < num_dirs; ++i) {
+				if (dirs[i] == dir) { seen = 1; break; }
+			}
+			if (seen) continue;
+			dir->ref_count++;
+			dirs[num_dirs++] = dir;
+			if (num_dirs == SWAP_MAX_DIRS) break;
+		}
+		skip = 0;
+	}
+	IRQ_RES;
+
+	int evicted = 0;
+	for (int i = 0; i < num_dirs; ++i) {
+		if (evicted < max_pages) {
+			evicted += swap_scan_directory(dirs[i], max_pages - evicted);
+		}
+		release_directory(dirs[i]);
+	}
+
+	swap_passes++;
+	return evicted;
+}
+
+static void swap_thread(void * arg, char * name) {
+	while (1) {
+		if (memory_total() - memory_use() < SWAP_LOW_KB) {
+			swap_reclaim(SWAP_BATCH);
+		}
+		unsigned long s, ss;
+		relative_time(1, 0, &s, &ss);
+		sleep_until((process_t *)current_process, s, ss);
+		switch_task(0);
+	}
+}
+
+/*
+ * Point swapping at a block device and start the reclaim tasklet.
+ * Root only (enforced at the sysfunc). Returns 0 on success.
+ */
+int swap_enable(char * path) {
+	if (swap_enabled) return -EEXIST;
+
+	fs_node_t * node = kopen(path, 0);
+	if (!node) return -ENOENT;
+	if (node->length < 16 * SWAP_PAGE_SIZE) {
+		close_fs(node);
+		return -EINVAL;
+	}
+
+	uint32_t slots = node->length / SWAP_PAGE_SIZE;
+	swap_bitmap = malloc((slots + 31) / 32 * 4);
+	memset(swap_bitmap, 0, (slots + 31) / 32 * 4);
+	swap_bitmap[0] = 1; /* Slot 0 is reserved */
+	swap_slots_total = slots;
+	swap_slots_used = 1;
+
+	swap_bounce = (uint8_t *)kvmalloc_p(SWAP_PAGE_SIZE, &swap_bounce_phys);
+
+	swap_node = node;
+	swap_enabled = 1;
+
+	debug_print(NOTICE, "Swap enabled on %s (%d MB)", path, slots * 4 / 1024);
+	create_kernel_tasklet(swap_thread, "[kswapd]", NULL);
+	return 0;
+}
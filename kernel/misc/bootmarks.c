@@ -0,0 +1,78 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ * This file is part of ToaruOS and is released under the terms
+ * of the NCSA / University of Illinois License - see LICENSE.md
+ * Copyright (C) 2018 K. Lange
+ *
+ * Boot-phase markers.
+ *
+ * A fixed table of RDTSC-stamped markers recorded from the earliest
+ * C code onward, so boot-time changes have numbers instead of
+ * anecdotes. Recording a marker touches only static storage - no
+ * heap, no locks - which is what lets kmain drop one before paging
+ * or the allocator exist. The slot index is claimed with an atomic
+ * add so concurrent module initializers can record safely.
+ *
+ * Names are stored as pointers, not copies, so callers must pass
+ * string literals or other storage that outlives boot.
+ *
+ * The table is dumped through /proc/bootmarks (see the procfs
+ * module) in microseconds relative to the first marker, using the
+ * TSC calibration the timer driver performed; the `bootmarks`
+ * userspace tool formats per-phase deltas from that.
+ */
+#include <kernel/system.h>
+#include <kernel/printf.h>
+#include <kernel/bootmarks.h>
+
+#define BOOTMARKS_MAX 128
+
+static boot_mark_t bootmarks[BOOTMARKS_MAX];
+static volatile int bootmarks_next = 0;
+
+void boot_marker_extra(const char * name, const char * extra) {
+	int i = __sync_fetch_and_add(&bootmarks_next, 1);
+	if (i >= BOOTMARKS_MAX) return;
+
+	uint64_t tsc;
+	asm volatile ("rdtsc" : "=A" (tsc));
+
+	bootmarks[i].tsc = tsc;
+	bootmarks[i].name = name;
+	bootmarks[i].extra = extra;
+}
+
+void boot_marker(const char * name) {
+	boot_marker_extra(name, NULL);
+}
+
+/*
+ * Render the marker table into a text buffer, one marker per line:
+ *
+ *     <microseconds since first marker> <name> [extra]
+ *
+ * Ticks are converted with the timer driver's TSC calibration; if
+ * that hasn't happened (or failed), raw tick deltas are reported and
+ * the unit line says so.
+ */
+size_t bootmarks_dump(char * buffer, size_t size) {
+	int count = bootmarks_next;
+	if (count > BOOTMARKS_MAX) count = BOOTMARKS_MAX;
+
+	size_t off = 0;
+	off += sprintf(buffer + off, "unit %s\n", tsc_khz ? "us" : "ticks");
+
+	for (int i = 0; i < count; ++i) {
+		uint64_t delta = bootmarks[i].tsc - bootmarks[0].tsc;
+		if (tsc_khz) {
+			delta = delta * 1000 / tsc_khz;
+		}
+		if (off + 80 > size) break;
+		if (bootmarks[i].extra) {
+			off += sprintf(buffer + off, "%d %s %s\n", (uint32_t)delta, bootmarks[i].name, bootmarks[i].extra);
+		} else {
+			off += sprintf(buffer + off, "%d %s\n", (uint32_t)delta, bootmarks[i].name);
+		}
+	}
+
+	return off;
+}
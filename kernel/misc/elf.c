@@ -13,66 +13,126 @@
 #include <kernel/process.h>
 #include <kernel/logging.h>
 
-int exec_elf(char * path, fs_node_t * file, int argc, char ** argv, char ** env, int interp) {
+#include <toaru/hashmap.h>
+
+/*
+ * Parsed header metadata for executables, keyed by (device, inode) and
+ * validated against mtime, so repeated execs of the same binary skip
+ * the header and program-header reads entirely. Entries are immutable
+ * once published and are never freed - a replaced entry (binary was
+ * rewritten) may still be in use by a concurrent exec, so the stale
+ * copy is deliberately leaked; the cache is bounded by the number of
+ * distinct binaries on disk.
+ */
+typedef struct elf_meta {
+	void *    device;
+	uint32_t  inode;
+	uint32_t  mtime;
+	int       is_dynamic;
 	Elf32_Header header;
+	Elf32_Phdr * phdrs;
+} elf_meta_t;
+
+static hashmap_t * elf_cache = NULL;
+static spin_lock_t elf_cache_lock = { 0 };
+
+static elf_meta_t * elf_meta_get(fs_node_t * file) {
+	uintptr_t key = (uintptr_t)file->device ^ (file->inode * 31);
+
+	spin_lock(elf_cache_lock);
+	if (!elf_cache) {
+		elf_cache = hashmap_create_int(64);
+	}
+	elf_meta_t * meta = hashmap_get(elf_cache, (void *)key);
+	spin_unlock(elf_cache_lock);
+
+	if (meta && meta->device == file->device && meta->inode == file->inode && meta->mtime == file->mtime) {
+		return meta;
+	}
+
+	meta = malloc(sizeof(elf_meta_t));
+	read_fs(file, 0, sizeof(Elf32_Header), (uint8_t *)&meta->header);
+
+	if (meta->header.e_ident[0] != ELFMAG0 ||
+	    meta->header.e_ident[1] != ELFMAG1 ||
+	    meta->header.e_ident[2] != ELFMAG2 ||
+	    meta->header.e_ident[3] != ELFMAG3) {
+		free(meta);
+		return NULL;
+	}
 
-	read_fs(file, 0, sizeof(Elf32_Header), (uint8_t *)&header);
+	meta->device = file->device;
+	meta->inode  = file->inode;
+	meta->mtime  = file->mtime;
+	meta->is_dynamic = 0;
+	meta->phdrs  = malloc(sizeof(Elf32_Phdr) * meta->header.e_phnum);
+
+	for (unsigned int i = 0; i < meta->header.e_phnum; ++i) {
+		read_fs(file, meta->header.e_phoff + i * meta->header.e_phentsize, sizeof(Elf32_Phdr), (uint8_t *)&meta->phdrs[i]);
+		if (meta->phdrs[i].p_type == PT_DYNAMIC) {
+			meta->is_dynamic = 1;
+		}
+	}
 
-	if (header.e_ident[0] != ELFMAG0 ||
-	    header.e_ident[1] != ELFMAG1 ||
-	    header.e_ident[2] != ELFMAG2 ||
-	    header.e_ident[3] != ELFMAG3) {
+	spin_lock(elf_cache_lock);
+	hashmap_set(elf_cache, (void *)key, meta);
+	spin_unlock(elf_cache_lock);
+
+	return meta;
+}
+
+int exec_elf(char * path, fs_node_t * file, int argc, char ** argv, char ** env, int interp) {
+	elf_meta_t * meta = elf_meta_get(file);
+
+	if (!meta) {
 		debug_print(ERROR, "Not a valid ELF executable.");
 		close_fs(file);
 		return -1;
 	}
 
+	Elf32_Header * header = &meta->header;
+
 	if (file->mask & 0x800) {
 		debug_print(WARNING, "setuid binary executed [%s, uid:%d]", file->name, file->uid);
 		current_process->user = file->uid;
 	}
 
-	for (uintptr_t x = 0; x < (uint32_t)header.e_phentsize * header.e_phnum; x += header.e_phentsize) {
-		Elf32_Phdr phdr;
-		read_fs(file, header.e_phoff + x, sizeof(Elf32_Phdr), (uint8_t *)&phdr);
-		if (phdr.p_type == PT_DYNAMIC) {
-			/* Dynamic */
-			close_fs(file);
-
-			/* Find interpreter? */
-			debug_print(INFO, "Dynamic executable");
-
-			unsigned int nargc = argc + 3;
-			char * args[nargc+1];
-			args[0] = "ld.so";
-			args[1] = "-e";
-			args[2] = strdup(current_process->name);
-			int j = 3;
-			for (int i = 0; i < argc; ++i, ++j) {
-				args[j] = argv[i];
-			}
-			args[j] = NULL;
-
-			fs_node_t * file = kopen("/lib/ld.so",0);
-			if (!file) return -1;
+	if (meta->is_dynamic) {
+		/* Dynamic */
+		close_fs(file);
 
-			return exec_elf(NULL, file, nargc, args, env, 1);
+		/* Find interpreter? */
+		debug_print(INFO, "Dynamic executable");
+
+		unsigned int nargc = argc + 3;
+		char * args[nargc+1];
+		args[0] = "ld.so";
+		args[1] = "-e";
+		args[2] = strdup(current_process->name);
+		int j = 3;
+		for (int i = 0; i < argc; ++i, ++j) {
+			args[j] = argv[i];
 		}
+		args[j] = NULL;
+
+		fs_node_t * interp_file = kopen("/lib/ld.so",0);
+		if (!interp_file) return -1;
+
+		return exec_elf(NULL, interp_file, nargc, args, env, 1);
 	}
 
-	uintptr_t entry = (uintptr_t)header.e_entry;
+	uintptr_t entry = (uintptr_t)header->e_entry;
 	uintptr_t base_addr = 0xFFFFFFFF;
 	uintptr_t end_addr  = 0x0;
 
-	for (uintptr_t x = 0; x < (uint32_t)header.e_phentsize * header.e_phnum; x += header.e_phentsize) {
-		Elf32_Phdr phdr;
-		read_fs(file, header.e_phoff + x, sizeof(Elf32_Phdr), (uint8_t *)&phdr);
-		if (phdr.p_type == PT_LOAD) {
-			if (phdr.p_vaddr < base_addr) {
-				base_addr = phdr.p_vaddr;
+	for (unsigned int i = 0; i < header->e_phnum; ++i) {
+		Elf32_Phdr * phdr = &meta->phdrs[i];
+		if (phdr->p_type == PT_LOAD) {
+			if (phdr->p_vaddr < base_addr) {
+				base_addr = phdr->p_vaddr;
 			}
-			if (phdr.p_memsz + phdr.p_vaddr > end_addr) {
-				end_addr = phdr.p_memsz + phdr.p_vaddr;
+			if (phdr->p_memsz + phdr->p_vaddr > end_addr) {
+				end_addr = phdr->p_memsz + phdr->p_vaddr;
 			}
 		}
 	}
@@ -84,16 +144,21 @@ int exec_elf(char * path, fs_node_t * file, int argc, char ** argv, char ** env,
 	invalidate_page_tables();
 
 
-	for (uintptr_t x = 0; x < (uint32_t)header.e_phentsize * header.e_phnum; x += header.e_phentsize) {
-		Elf32_Phdr phdr;
-		read_fs(file, header.e_phoff + x, sizeof(Elf32_Phdr), (uint8_t *)&phdr);
+	for (unsigned int i = 0; i < header->e_phnum; ++i) {
+		Elf32_Phdr phdr = meta->phdrs[i];
 		if (phdr.p_type == PT_LOAD) {
 			/* TODO: These virtual address bounds should be in a header somewhere */
 			if (phdr.p_vaddr < 0x20000000) return -EINVAL;
 			/* TODO Upper bounds */
 			for (uintptr_t i = phdr.p_vaddr; i < phdr.p_vaddr + phdr.p_memsz; i += 0x1000) {
-				/* This doesn't care if we already allocated this page */
-				alloc_frame(get_page(i, 1, current_directory), 0, 1);
+				page_t * page = get_page(i, 1, current_directory);
+				if (i >= phdr.p_vaddr + phdr.p_filesz && !page->frame) {
+					/* Entirely past the file contents: zero-fill on demand */
+					alloc_frame_lazy(page);
+				} else {
+					/* This doesn't care if we already allocated this page */
+					alloc_frame(page, 0, 1);
+				}
 				invalidate_tables_at(i);
 			}
 			IRQ_RES;
@@ -101,6 +166,12 @@ int exec_elf(char * path, fs_node_t * file, int argc, char ** argv, char ** env,
 			IRQ_OFF;
 			size_t r = phdr.p_filesz;
 			while (r < phdr.p_memsz) {
+				page_t * page = get_page(phdr.p_vaddr + r, 0, current_directory);
+				if (page && page->cow && !((phdr.p_vaddr + r) & 0xFFF) && phdr.p_memsz - r >= 0x1000) {
+					/* Whole page is backed by the shared zero page already */
+					r += 0x1000;
+					continue;
+				}
 				*(char *)(phdr.p_vaddr + r) = 0;
 				r++;
 			}
@@ -109,7 +180,9 @@ int exec_elf(char * path, fs_node_t * file, int argc, char ** argv, char ** env,
 
 	close_fs(file);
 
-	for (uintptr_t stack_pointer = USER_STACK_BOTTOM; stack_pointer < USER_STACK_TOP; stack_pointer += 0x1000) {
+	/* Map only the top of the stack; the rest is grown at fault time
+	 * (see page_fault), with the bottom page left as a hard guard. */
+	for (uintptr_t stack_pointer = USER_STACK_TOP - 4 * 0x1000; stack_pointer < USER_STACK_TOP; stack_pointer += 0x1000) {
 		alloc_frame(get_page(stack_pointer, 1, current_directory), 0, 1);
 		invalidate_tables_at(stack_pointer);
 	}
@@ -170,6 +243,7 @@ int exec_elf(char * path, fs_node_t * file, int argc, char ** argv, char ** env,
 	alloc_frame(get_page(current_process->image.heap_actual, 1, current_directory), 0, 1);
 	invalidate_tables_at(current_process->image.heap_actual);
 	current_process->image.user_stack  = USER_STACK_TOP;
+	current_process->image.mmap_start  = MMAP_REGION_START;
 
 	current_process->image.start = entry;
 
@@ -180,6 +254,9 @@ int exec_elf(char * path, fs_node_t * file, int argc, char ** argv, char ** env,
 			current_process->fds->entries[i] = NULL;
 		}
 	}
+	if (current_process->fds->next_free > 3) {
+		current_process->fds->next_free = 3;
+	}
 
 	/* Go go go */
 	enter_user_jmp(entry, argc, argv_, USER_STACK_TOP);
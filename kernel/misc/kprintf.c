@@ -5,8 +5,9 @@
  *
  * Kernel printf implementation
  *
- * Simple, painfully lacking, implementation of printf(),
- * for the kernel of all things.
+ * Kernel port of the libc formatting engine; keep the conversion
+ * logic in sync with libc/stdio/printf.c. Floating point and wide
+ * strings are omitted - nothing in the kernel formats either.
  */
 #include <kernel/system.h>
 #include <kernel/process.h>
@@ -14,34 +15,63 @@
 
 #include <va_list.h>
 
-/*
- * Integer to string
- */
-static void print_dec(unsigned int value, unsigned int width, char * buf, int * ptr ) {
-	unsigned int n_width = 1;
-	unsigned int i = 9;
-	while (value > i && i < UINT32_MAX) {
-		n_width += 1;
-		i *= 10;
-		i += 9;
+/* Two-digit pairs: each % 100 costs one division and emits
+ * two digits with a table read instead of dividing per digit. */
+static const char two_digits[] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+static void print_dec(unsigned long long value, unsigned int width, char * buf, int * ptr, int fill_zero, int align_right, int precision) {
+	/* Digits are generated backwards into a local buffer; padding
+	 * runs are block fills rather than byte-at-a-time stores. */
+	char digits[20];
+	int n_width = 0;
+
+	if (precision == -1) precision = 1;
+
+	unsigned long long v = value;
+	while (v >= 100) {
+		unsigned int pair = v % 100;
+		v /= 100;
+		digits[n_width++] = two_digits[pair * 2 + 1];
+		digits[n_width++] = two_digits[pair * 2];
 	}
+	if (v >= 10) {
+		digits[n_width++] = two_digits[v * 2 + 1];
+		digits[n_width++] = two_digits[v * 2];
+	} else {
+		digits[n_width++] = '0' + v;
+	}
+
+	/* Zero has no natural width; precision (default 1) supplies it */
+	if (value == 0) n_width = 0;
 
-	int printed = 0;
-	while (n_width + printed < width) {
-		buf[*ptr] = '0';
+	int total = n_width > precision ? n_width : precision;
+
+	if (align_right && total < (int)width) {
+		memset(buf + *ptr, fill_zero ? '0' : ' ', width - total);
+		*ptr += width - total;
+	}
+	if (total > n_width) {
+		memset(buf + *ptr, '0', total - n_width);
+		*ptr += total - n_width;
+	}
+	for (int i = n_width - 1; i >= 0; i--) {
+		buf[*ptr] = digits[i];
 		*ptr += 1;
-		printed += 1;
 	}
-
-	i = n_width;
-	while (i > 0) {
-		unsigned int n = value / 10;
-		int r = value % 10;
-		buf[*ptr + i - 1] = r + '0';
-		i--;
-		value = n;
+	if (!align_right && total < (int)width) {
+		memset(buf + *ptr, fill_zero ? '0' : ' ', width - total);
+		*ptr += width - total;
 	}
-	*ptr += n_width;
 }
 
 /*
@@ -53,17 +83,13 @@ static void print_hex(unsigned int value, unsigned int width, char * buf, int *
 	if (i == 0) i = 8;
 
 	unsigned int n_width = 1;
-	unsigned int j = 0x0F;
-	while (value > j && j < UINT32_MAX) {
+	while ((value >> (4 * n_width)) && n_width < 8) {
 		n_width += 1;
-		j *= 0x10;
-		j += 0x0F;
 	}
 
-	while (i > (int)n_width) {
-		buf[*ptr] = '0';
-		*ptr += 1;
-		i--;
+	if (i > (int)n_width) {
+		memset(buf + *ptr, '0', i - n_width);
+		*ptr += i - n_width;
 	}
 
 	i = (int)n_width;
@@ -80,6 +106,7 @@ size_t vasprintf(char * buf, const char * fmt, va_list args) {
 	int i = 0;
 	char * s;
 	char * b = buf;
+	int precision = -1;
 	for (const char *f = fmt; *f; f++) {
 		if (*f != '%') {
 			*b++ = *f;
@@ -87,33 +114,149 @@ size_t vasprintf(char * buf, const char * fmt, va_list args) {
 		}
 		++f;
 		unsigned int arg_width = 0;
+		int align = 1; /* right */
+		int fill_zero = 0;
+		int big = 0;
+		int alt = 0;
+		int always_sign = 0;
+		while (1) {
+			if (*f == '-') {
+				align = 0;
+				++f;
+			} else if (*f == '#') {
+				alt = 1;
+				++f;
+			} else if (*f == '*') {
+				arg_width = (char)va_arg(args, int);
+				++f;
+			} else if (*f == '0') {
+				fill_zero = 1;
+				++f;
+			} else if (*f == '+') {
+				always_sign = 1;
+				++f;
+			} else {
+				break;
+			}
+		}
 		while (*f >= '0' && *f <= '9') {
 			arg_width *= 10;
 			arg_width += *f - '0';
 			++f;
 		}
+		if (*f == '.') {
+			++f;
+			precision = 0;
+			if (*f == '*') {
+				precision = (int)va_arg(args, int);
+				++f;
+			} else  {
+				while (*f >= '0' && *f <= '9') {
+					precision *= 10;
+					precision += *f - '0';
+					++f;
+				}
+			}
+		}
+		if (*f == 'l') {
+			big = 1;
+			++f;
+			if (*f == 'l') {
+				big = 2;
+				++f;
+			}
+		}
+		if (*f == 'z') {
+			big = 1;
+			++f;
+		}
 		/* fmt[i] == '%' */
 		switch (*f) {
 			case 's': /* String pointer -> String */
-				s = (char *)va_arg(args, char *);
-				if (s == NULL) {
-					s = "(null)";
-				}
-				while (*s) {
-					*b++ = *s++;
+				{
+					size_t count = 0;
+					s = (char *)va_arg(args, char *);
+					if (s == NULL) {
+						s = "(null)";
+					}
+					if (precision >= 0) {
+						while (*s && precision > 0) {
+							*b++ = *s++;
+							count++;
+							precision--;
+							if (arg_width && count == arg_width) break;
+						}
+					} else {
+						while (*s) {
+							*b++ = *s++;
+							count++;
+							if (arg_width && count == arg_width) break;
+						}
+					}
+					while (count < arg_width) {
+						*b++ = ' ';
+						count++;
+					}
 				}
 				break;
 			case 'c': /* Single character */
 				*b++ = (char)va_arg(args, int);
 				break;
+			case 'p':
+				if (!arg_width) {
+					arg_width = 8;
+				}
+				/* fallthrough */
 			case 'x': /* Hexadecimal number */
+				if (alt) {
+					*b++ = '0';
+					*b++ = 'x';
+				}
 				i = b - buf;
-				print_hex((unsigned long)va_arg(args, unsigned long), arg_width, buf, &i);
+				if (big == 2) {
+					unsigned long long val = (unsigned long long)va_arg(args, unsigned long long);
+					if (val > 0xFFFFFFFF) {
+						print_hex(val >> 32, arg_width > 8 ? (arg_width - 8) : 0, buf, &i);
+					}
+					print_hex(val & 0xFFFFFFFF, arg_width > 8 ? 8 : arg_width, buf, &i);
+				} else {
+					print_hex((unsigned long)va_arg(args, unsigned long), arg_width, buf, &i);
+				}
 				b = buf + i;
 				break;
+			case 'i':
 			case 'd': /* Decimal number */
 				i = b - buf;
-				print_dec((unsigned long)va_arg(args, unsigned long), arg_width, buf, &i);
+				{
+					long long val;
+					if (big == 2) {
+						val = (long long)va_arg(args, long long);
+					} else {
+						val = (long)va_arg(args, long);
+					}
+					if (val < 0) {
+						*b++ = '-';
+						buf++;
+						val = -val;
+					} else if (always_sign) {
+						*b++ = '+';
+						buf++;
+					}
+					print_dec(val, arg_width, buf, &i, fill_zero, align, precision);
+				}
+				b = buf + i;
+				break;
+			case 'u': /* Unsigned decimal number */
+				i = b - buf;
+				{
+					unsigned long long val;
+					if (big == 2) {
+						val = (unsigned long long)va_arg(args, unsigned long long);
+					} else {
+						val = (unsigned long)va_arg(args, unsigned long);
+					}
+					print_dec(val, arg_width, buf, &i, fill_zero, align, precision);
+				}
 				b = buf + i;
 				break;
 			case '%': /* Escape */
@@ -156,4 +299,3 @@ int sprintf(char * buf, const char *fmt, ...) {
 	va_end(args);
 	return out;
 }
-
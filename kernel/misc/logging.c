@@ -5,16 +5,19 @@
  *
  * Kernel Logging Facility
  *
- * Maintains a log in-memory as well as to serial (unless
- * told not to).
+ * Messages are recorded into a fixed in-memory ring with their
+ * timestamps and drained to the debug device by a low-priority
+ * kernel tasklet, so the logging hot path never waits on the
+ * serial port. Until the tasklet is running (or if it never is),
+ * messages are written out synchronously as before.
  */
 
 #include <kernel/system.h>
 #include <kernel/logging.h>
 #include <kernel/printf.h>
+#include <kernel/process.h>
 
 #include <va_list.h>
-#include <toaru/list.h>
 
 log_type_t debug_level = NOTICE;
 void * debug_file = NULL;
@@ -30,25 +33,124 @@ static char * c_messages[] = {
 	" \033[1;31;44mINSANE\033[0m:"
 };
 
-static char buffer[1024];
+/*
+ * In-memory log ring. Producers claim a slot with an atomic add, so
+ * logging is safe from interrupt context without taking a lock. A
+ * producer preempted mid-line can hand the drain a torn message, but
+ * a rare garbled debug line is not worth locking the hot path for.
+ */
+#define KLOG_LINES 128
+#define KLOG_LINE_SIZE 256
+
+struct klog_line {
+	unsigned long ticks;
+	unsigned long subticks;
+	log_type_t level;
+	int line_no;
+	char * title;   /* Static string supplied by the debug_print macro */
+	char text[KLOG_LINE_SIZE];
+};
+
+static struct klog_line klog_ring[KLOG_LINES];
+static volatile unsigned int klog_produced = 0;
+static volatile unsigned int klog_drained = 0;
+static int klog_async = 0;
+
+/* Set while the drain tasklet is writing to the debug device, so a
+ * buffered console driver can drop log bytes instead of stalling the
+ * drain when its output ring is full. */
+volatile int klog_in_drain = 0;
+
+/* Render the line prefix; this is the part whose formatting we defer */
+static void klog_format(struct klog_line * line, char * out) {
+	char * type;
+	if (line->level > INSANE) {
+		type = "";
+	} else {
+		type = c_messages[line->level];
+	}
+
+	sprintf(out, "[%10d.%3d:%s:%d]%s %s\n", line->ticks, line->subticks, line->title, line->line_no, type, line->text);
+}
 
 void _debug_print(char * title, int line_no, log_type_t level, char *fmt, ...) {
-	if (level >= debug_level && debug_file) {
-		va_list args;
-		va_start(args, fmt);
-		vasprintf(buffer, fmt, args);
-		va_end(args);
-
-		char * type;
-		if (level > INSANE) {
-			type = "";
-		} else {
-			type = c_messages[level];
-		}
+	if (level < debug_level) return;
+
+	unsigned int index = __sync_fetch_and_add(&klog_produced, 1);
+	struct klog_line * line = &klog_ring[index % KLOG_LINES];
+	line->ticks = timer_ticks;
+	line->subticks = timer_subticks;
+	line->level = level;
+	line->line_no = line_no;
+	line->title = title;
 
-		fprintf(debug_file, "[%10d.%3d:%s:%d]%s %s\n", timer_ticks, timer_subticks, title, line_no, type, buffer);
+	char buffer[KLOG_LINE_SIZE * 2];
+	va_list args;
+	va_start(args, fmt);
+	size_t len = vasprintf(buffer, fmt, args);
+	va_end(args);
+	if (len >= KLOG_LINE_SIZE) {
+		buffer[KLOG_LINE_SIZE - 1] = '\0';
+	}
+	memcpy(line->text, buffer, strlen(buffer) + 1);
+
+	if (!klog_async && debug_file) {
+		/* No drain tasklet yet; write it out ourselves */
+		char out[KLOG_LINE_SIZE + 128];
+		klog_format(line, out);
+		fprintf(debug_file, "%s", out);
+		klog_drained = klog_produced;
+	}
+}
 
+static void klog_drain(void * data, char * name) {
+	while (1) {
+		while (klog_drained != klog_produced) {
+			if (klog_produced - klog_drained > KLOG_LINES) {
+				/* The writers lapped us; skip what we lost */
+				klog_drained = klog_produced - KLOG_LINES;
+			}
+			struct klog_line * line = &klog_ring[klog_drained % KLOG_LINES];
+			if (debug_file) {
+				char out[KLOG_LINE_SIZE + 128];
+				klog_format(line, out);
+				klog_in_drain = 1;
+				fprintf(debug_file, "%s", out);
+				klog_in_drain = 0;
+			}
+			klog_drained++;
+		}
+		unsigned long s, ss;
+		relative_time(0, 10, &s, &ss);
+		sleep_until((process_t *)current_process, s, ss);
+		switch_task(0);
 	}
-	/* else ignore */
 }
 
+/* Hand off log output to the drain tasklet; called once the
+ * scheduler and timer are up. */
+void klog_start(void) {
+	klog_async = 1;
+	create_kernel_tasklet(klog_drain, "[klogd]", NULL);
+}
+
+/* Format the surviving window of the ring into a buffer, oldest
+ * line first - this backs /proc/klog. */
+size_t klog_dump(char * buf, size_t bufsize) {
+	size_t len = 0;
+	unsigned int produced = klog_produced;
+	unsigned int start = (produced > KLOG_LINES) ? produced - KLOG_LINES : 0;
+
+	for (unsigned int i = start; i != produced; ++i) {
+		struct klog_line * line = &klog_ring[i % KLOG_LINES];
+		char out[KLOG_LINE_SIZE + 128];
+		klog_format(line, out);
+		size_t l = strlen(out);
+		if (len + l >= bufsize) break;
+		memcpy(buf + len, out, l);
+		len += l;
+	}
+
+	buf[len] = '\0';
+	return len;
+}
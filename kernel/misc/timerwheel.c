@@ -0,0 +1,175 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ * This file is part of ToaruOS and is released under the terms
+ * of the NCSA / University of Illinois License - see LICENSE.md
+ * Copyright (C) 2018 K. Lange
+ *
+ * Hierarchical timer wheel.
+ *
+ * sleep_until only works on processes; this gives kernel code a way
+ * to schedule a plain callback. Timers sit in a four-level wheel of
+ * millisecond slots: the bottom level has one slot per subtick and
+ * each level above covers the one below it, so a timer is placed by
+ * indexing with bits of its expiry time and cascades down one level
+ * at a time as the clock advances. Everything is an O(1) list
+ * operation under a masked-interrupt section.
+ *
+ * Expired timers are handed to the high-priority work queue and run
+ * in process context; the interrupt path only moves list nodes.
+ */
+#include <kernel/system.h>
+#include <kernel/logging.h>
+#include <kernel/process.h>
+#include <kernel/workqueue.h>
+#include <kernel/timerwheel.h>
+
+#include <toaru/list.h>
+
+/* Level 0 covers 256ms at 1ms per slot; each level above covers 64x
+ * the one below. Total reach is about 18 hours; anything longer just
+ * re-cascades from the top level. */
+#define WHEEL_L0_BITS 8
+#define WHEEL_LN_BITS 6
+#define WHEEL_L0_SIZE (1 << WHEEL_L0_BITS)
+#define WHEEL_LN_SIZE (1 << WHEEL_LN_BITS)
+#define WHEEL_LEVELS  4
+
+struct ktimer {
+	node_t node;          /* Intrusive; lives in a wheel slot or the fired list */
+	uint64_t expires;     /* Absolute expiry, in ms since boot */
+	timer_fn_t fn;
+	void * arg;
+};
+
+static list_t wheel_l0[WHEEL_L0_SIZE];
+static list_t wheel_ln[WHEEL_LEVELS - 1][WHEEL_LN_SIZE];
+static list_t fired_list;
+
+static volatile uint64_t wheel_now = 0;
+
+/*
+ * Hang a timer off the slot matching its expiry. Called with
+ * interrupts masked.
+ */
+static void wheel_place(struct ktimer * timer) {
+	uint64_t delta = timer->expires - wheel_now;
+
+	if (delta < WHEEL_L0_SIZE) {
+		list_append(&wheel_l0[timer->expires & (WHEEL_L0_SIZE - 1)], &timer->node);
+		return;
+	}
+
+	int shift = WHEEL_L0_BITS;
+	for (int level = 0; level < WHEEL_LEVELS - 2; ++level) {
+		if (delta < (1UL << (shift + WHEEL_LN_BITS))) {
+			list_append(&wheel_ln[level][(timer->expires >> shift) & (WHEEL_LN_SIZE - 1)], &timer->node);
+			return;
+		}
+		shift += WHEEL_LN_BITS;
+	}
+
+	/* Top level catches everything else; far-out timers re-cascade. */
+	list_append(&wheel_ln[WHEEL_LEVELS - 2][(timer->expires >> shift) & (WHEEL_LN_SIZE - 1)], &timer->node);
+}
+
+/*
+ * Run the fired list. Executes on the work queue in process context.
+ */
+static void timerwheel_run(void * arg) {
+	while (1) {
+		struct ktimer * timer = NULL;
+
+		IRQ_OFF;
+		node_t * node = list_dequeue(&fired_list);
+		if (node) {
+			timer = node->value;
+		}
+		IRQ_RES;
+
+		if (!timer) break;
+
+		timer->fn(timer->arg);
+		free(timer);
+	}
+}
+
+/*
+ * Advance the wheel one subtick. Called from the timer interrupt.
+ */
+void timerwheel_tick(void) {
+	wheel_now++;
+
+	int fired = 0;
+	int slot = wheel_now & (WHEEL_L0_SIZE - 1);
+
+	/* When a level-0 lap completes, pull the next upper slot apart and
+	 * re-place its timers, cascading further up on each full lap. */
+	if (slot == 0) {
+		int shift = WHEEL_L0_BITS;
+		for (int level = 0; level < WHEEL_LEVELS - 1; ++level) {
+			int upper = (wheel_now >> shift) & (WHEEL_LN_SIZE - 1);
+			node_t * node;
+			while ((node = list_dequeue(&wheel_ln[level][upper]))) {
+				wheel_place(node->value);
+			}
+			if (upper != 0) break;
+			shift += WHEEL_LN_BITS;
+		}
+	}
+
+	node_t * node;
+	while ((node = list_dequeue(&wheel_l0[slot]))) {
+		list_append(&fired_list, node);
+		fired = 1;
+	}
+
+	if (fired) {
+		workqueue_schedule_prio(timerwheel_run, NULL, WORKQUEUE_PRIORITY_HIGH);
+	}
+}
+
+struct ktimer * timer_set(uint64_t ns, timer_fn_t fn, void * arg) {
+	struct ktimer * timer = malloc(sizeof(struct ktimer));
+	if (!timer) return NULL;
+
+	uint64_t delay = (ns + 999999ULL) / 1000000ULL;
+	if (!delay) delay = 1;
+
+	/* Coalesce distant deadlines: rounding the expiry up drops close
+	 * timers into the same slot so they fire in one batch. Nothing
+	 * fires early, and the error stays under about one percent. */
+	uint64_t quantum = 1;
+	if (delay >= 4096) quantum = 64;
+	else if (delay >= 1024) quantum = 16;
+	else if (delay >= 256) quantum = 4;
+
+	memset(&timer->node, 0, sizeof(timer->node));
+	timer->node.value = timer;
+	timer->fn  = fn;
+	timer->arg = arg;
+
+	IRQ_OFF;
+	timer->expires = wheel_now + delay;
+	if (quantum > 1) {
+		timer->expires = (timer->expires + quantum - 1) & ~(quantum - 1);
+	}
+	wheel_place(timer);
+	IRQ_RES;
+
+	return timer;
+}
+
+int timer_cancel(struct ktimer * timer) {
+	IRQ_OFF;
+	if (!timer->node.owner) {
+		/* Already dequeued by the expiry path; it owns the memory
+		 * and the callback ran or is about to. */
+		IRQ_RES;
+		return 1;
+	}
+	/* Still in a wheel slot or on the fired list */
+	list_delete(timer->node.owner, &timer->node);
+	IRQ_RES;
+
+	free(timer);
+	return 0;
+}
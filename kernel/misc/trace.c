@@ -0,0 +1,60 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ * This file is part of ToaruOS and is released under the terms
+ * of the NCSA / University of Illinois License - see LICENSE.md
+ * Copyright (C) 2018 K. Lange
+ *
+ * Scheduler trace events
+ *
+ * Records fixed-size events from the scheduler - who got the CPU,
+ * who was made ready, who went to sleep - into a ring of binary
+ * records drained through /proc/trace. Off by default; when
+ * disabled the hooks cost one flag test.
+ */
+#include <kernel/system.h>
+#include <kernel/process.h>
+#include <kernel/logging.h>
+
+#define TRACE_BUFFER_SIZE 8192
+
+int trace_enabled = 0;
+
+static struct trace_event trace_buffer[TRACE_BUFFER_SIZE];
+static volatile unsigned int trace_read_ptr = 0;
+static volatile unsigned int trace_write_ptr = 0;
+
+/*
+ * Append one event to the ring. Events originate both from interrupt
+ * context (the timer-driven task switch) and from process context
+ * (wakeups), so interrupts are masked around the pointer updates;
+ * on overflow the oldest event is dropped.
+ */
+void trace_record(int event, int pid) {
+	if (!trace_enabled) return;
+
+	IRQ_OFF;
+	unsigned int next = (trace_write_ptr + 1) % TRACE_BUFFER_SIZE;
+	if (next == trace_read_ptr) {
+		trace_read_ptr = (trace_read_ptr + 1) % TRACE_BUFFER_SIZE;
+	}
+	trace_buffer[trace_write_ptr].timestamp = monotonic_time_ns();
+	trace_buffer[trace_write_ptr].pid = pid;
+	trace_buffer[trace_write_ptr].event = event;
+	trace_write_ptr = next;
+	IRQ_RES;
+}
+
+/*
+ * Copy out as many whole events as fit in `size` bytes, consuming
+ * them from the ring. Called from process context (procfs).
+ */
+size_t trace_fetch(uint8_t * buffer, size_t size) {
+	size_t collected = 0;
+	IRQ_OFF;
+	while (trace_read_ptr != trace_write_ptr && collected + sizeof(struct trace_event) <= size) {
+		memcpy(buffer + collected, (void *)&trace_buffer[trace_read_ptr], sizeof(struct trace_event));
+		trace_read_ptr = (trace_read_ptr + 1) % TRACE_BUFFER_SIZE;
+		collected += sizeof(struct trace_event);
+	}
+	IRQ_RES;
+	return collected;
+}
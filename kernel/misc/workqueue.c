@@ -0,0 +1,124 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ * This file is part of ToaruOS and is released under the terms
+ * of the NCSA / University of Illinois License - see LICENSE.md
+ * Copyright (C) 2018 K. Lange
+ *
+ * Deferred work queues.
+ *
+ * A generic bottom-half mechanism: interrupt handlers push a function
+ * and argument into a fixed ring and a worker tasklet runs them in
+ * process context. Two queues exist, distinguished only by the
+ * scheduler priority of their worker - time-critical completion work
+ * (disk, network) goes on the high queue, housekeeping on the default
+ * one.
+ *
+ * The rings are fixed-size so scheduling never allocates; producers
+ * mask interrupts around the ring update, which is all the locking a
+ * uniprocessor needs. A schedule for a (fn, arg) pair that is already
+ * pending is coalesced into the existing entry, so handlers can
+ * schedule unconditionally on every interrupt.
+ */
+#include <kernel/system.h>
+#include <kernel/logging.h>
+#include <kernel/process.h>
+#include <kernel/workqueue.h>
+
+#define WORKQUEUE_SLOTS 64
+
+struct work {
+	work_fn_t fn;
+	void * arg;
+};
+
+struct workqueue {
+	struct work slots[WORKQUEUE_SLOTS];
+	volatile unsigned int produced;
+	volatile unsigned int consumed;
+	list_t * wait;
+	int task_priority;
+	char * name;
+};
+
+static struct workqueue queues[] = {
+	[WORKQUEUE_PRIORITY_DEFAULT] = { .task_priority = PRIORITY_DEFAULT, .name = "[kworker]" },
+	[WORKQUEUE_PRIORITY_HIGH]    = { .task_priority = PRIORITY_HIGHEST, .name = "[kworker/hi]" },
+};
+
+#define NUM_QUEUES (sizeof(queues) / sizeof(*queues))
+
+static int workqueues_ready = 0;
+
+int workqueue_schedule_prio(work_fn_t fn, void * arg, int priority) {
+	if (!workqueues_ready || priority < 0 || priority >= (int)NUM_QUEUES) {
+		/* No workers yet (early boot); just run it here, which is
+		 * what callers did before work queues existed. */
+		fn(arg);
+		return 0;
+	}
+
+	struct workqueue * q = &queues[priority];
+	int out = 0;
+
+	IRQ_OFF;
+	/* Coalesce with an already-pending duplicate */
+	for (unsigned int i = q->consumed; i != q->produced; ++i) {
+		struct work * w = &q->slots[i % WORKQUEUE_SLOTS];
+		if (w->fn == fn && w->arg == arg) {
+			IRQ_RES;
+			return 1;
+		}
+	}
+
+	if (q->produced - q->consumed >= WORKQUEUE_SLOTS) {
+		out = -1;
+	} else {
+		q->slots[q->produced % WORKQUEUE_SLOTS].fn  = fn;
+		q->slots[q->produced % WORKQUEUE_SLOTS].arg = arg;
+		q->produced++;
+	}
+	IRQ_RES;
+
+	if (!out) {
+		wakeup_queue(q->wait);
+	}
+
+	return out;
+}
+
+int workqueue_schedule(work_fn_t fn, void * arg) {
+	return workqueue_schedule_prio(fn, arg, WORKQUEUE_PRIORITY_DEFAULT);
+}
+
+static void workqueue_worker(void * argp, char * name) {
+	struct workqueue * q = argp;
+	process_set_priority((process_t *)current_process, q->task_priority);
+
+	while (1) {
+		struct work w = {0};
+
+		IRQ_OFF;
+		if (q->consumed != q->produced) {
+			w = q->slots[q->consumed % WORKQUEUE_SLOTS];
+			q->consumed++;
+		}
+		IRQ_RES;
+
+		if (w.fn) {
+			w.fn(w.arg);
+		} else {
+			/* A wakeup between the check above and going to sleep is
+			 * lost, but every schedule wakes us, so at worst one item
+			 * waits for the next one. */
+			sleep_on(q->wait);
+		}
+	}
+}
+
+void workqueue_install(void) {
+	debug_print(NOTICE, "Initializing work queues");
+	for (unsigned int i = 0; i < NUM_QUEUES; ++i) {
+		queues[i].wait = list_create();
+		create_kernel_tasklet(workqueue_worker, queues[i].name, &queues[i]);
+	}
+	workqueues_ready = 1;
+}
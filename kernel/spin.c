@@ -3,13 +3,30 @@
  * of the NCSA / University of Illinois License - see LICENSE.md
  * Copyright (C) 2015 Dale Weiler
  *
- * Spin locks with waiters
+ * Ticket spin locks with pause backoff and optional statistics.
  *
+ * Tickets hand the lock over in arrival order, which matters once
+ * there is more than one processor to arrive on; today the fairness
+ * is free and the pause backoff keeps IRQ-vs-task spins polite.
+ * Build with -DSPINLOCK_DEBUG=1 for per-lock contention and hold
+ * counters, readable through /proc/spinlocks.
  */
 #include <kernel/system.h>
+#include <kernel/printf.h>
 
-static inline int arch_atomic_swap(volatile int * x, int v) {
-	asm("xchg %0, %1" : "=r"(v), "=m"(*x) : "0"(v) : "memory");
+#ifndef SPINLOCK_DEBUG
+#define SPINLOCK_DEBUG 0
+#endif
+
+/* Pause iterations double up to this before we give up our slice */
+#define SPIN_BACKOFF_MAX 256
+
+/* Lock layout: [0] next ticket, [1] waiters, [2] now serving,
+ * [3] statistics slot (one-based; 0 = unassigned). All-zero
+ * initialization leaves the lock free. */
+
+static inline int arch_atomic_xadd(volatile int * x, int v) {
+	asm volatile("lock; xaddl %0, %1" : "+r"(v), "+m"(*x) : : "memory");
 	return v;
 }
 
@@ -25,33 +42,109 @@ static inline void arch_atomic_dec(volatile int * x) {
 	asm("lock; decl %0" : "=m"(*x) : "m"(*x) : "memory");
 }
 
-void spin_wait(volatile int * addr, volatile int * waiters) {
-	if (waiters) {
-		arch_atomic_inc(waiters);
-	}
-	while (*addr) {
-		switch_task(1);
-	}
-	if (waiters) {
-		arch_atomic_dec(waiters);
-	}
+static inline void arch_pause(void) {
+	asm volatile("pause");
 }
 
-void spin_lock(spin_lock_t lock) {
-	while (arch_atomic_swap(lock, 1)) {
-		spin_wait(lock, lock+1);
+#if SPINLOCK_DEBUG
+#define SPIN_STAT_MAX 64
+
+struct spin_stat {
+	void * lock;
+	unsigned int acquisitions;
+	unsigned int contentions;
+	unsigned long hold_msec;
+	unsigned long acquired_at;
+};
+
+static struct spin_stat spin_stats[SPIN_STAT_MAX];
+static volatile int spin_stat_next = 0;
+
+static struct spin_stat * spin_stat_for(spin_lock_t lock) {
+	if (!lock[3]) {
+		int slot = arch_atomic_xadd(&spin_stat_next, 1);
+		if (slot >= SPIN_STAT_MAX) return NULL;
+		spin_stats[slot].lock = (void *)lock;
+		lock[3] = slot + 1;
 	}
+	if (lock[3] > SPIN_STAT_MAX) return NULL;
+	return &spin_stats[lock[3] - 1];
 }
+#endif
 
 void spin_init(spin_lock_t lock) {
 	lock[0] = 0;
 	lock[1] = 0;
+	lock[2] = 0;
+	lock[3] = 0;
+}
+
+void spin_lock(spin_lock_t lock) {
+	int ticket = arch_atomic_xadd(&lock[0], 1);
+
+	if (lock[2] != ticket) {
+#if SPINLOCK_DEBUG
+		struct spin_stat * stat = spin_stat_for(lock);
+		if (stat) stat->contentions++;
+#endif
+		arch_atomic_inc(&lock[1]);
+		int delay = 1;
+		while (lock[2] != ticket) {
+			for (int i = 0; i < delay; ++i) {
+				arch_pause();
+			}
+			if (delay < SPIN_BACKOFF_MAX) {
+				delay <<= 1;
+			} else {
+				/* The holder is another task; it can only make
+				 * progress if we stop spinning and let it run. */
+				switch_task(1);
+			}
+		}
+		arch_atomic_dec(&lock[1]);
+	}
+
+#if SPINLOCK_DEBUG
+	struct spin_stat * stat = spin_stat_for(lock);
+	if (stat) {
+		stat->acquisitions++;
+		stat->acquired_at = timer_ticks * 1000 + timer_subticks;
+	}
+#endif
 }
 
 void spin_unlock(spin_lock_t lock) {
-	if (lock[0]) {
-		arch_atomic_store(lock, 0);
+	if (lock[0] != lock[2]) {
+#if SPINLOCK_DEBUG
+		if (lock[3] && lock[3] <= SPIN_STAT_MAX) {
+			struct spin_stat * stat = &spin_stats[lock[3] - 1];
+			stat->hold_msec += (timer_ticks * 1000 + timer_subticks) - stat->acquired_at;
+		}
+#endif
+		arch_atomic_store(&lock[2], lock[2] + 1);
 		if (lock[1])
 			switch_task(1);
 	}
 }
+
+/*
+ * Format lock statistics for /proc/spinlocks.
+ */
+size_t spin_debug_dump(char * buf) {
+#if SPINLOCK_DEBUG
+	char * b = buf;
+	b += sprintf(b, "lock       acquisitions contentions hold_msec\n");
+	int count = spin_stat_next < SPIN_STAT_MAX ? spin_stat_next : SPIN_STAT_MAX;
+	for (int i = 0; i < count; ++i) {
+		struct spin_stat * stat = &spin_stats[i];
+		b += sprintf(b, "0x%x %u %u %u\n",
+				(uintptr_t)stat->lock,
+				stat->acquisitions,
+				stat->contentions,
+				(unsigned int)stat->hold_msec);
+	}
+	return b - buf;
+#else
+	return sprintf(buf, "Rebuild with SPINLOCK_DEBUG=1 for spinlock statistics.\n");
+#endif
+}
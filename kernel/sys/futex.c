@@ -0,0 +1,107 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ * This file is part of ToaruOS and is released under the terms
+ * of the NCSA / University of Illinois License - see LICENSE.md
+ * Copyright (C) 2018 K. Lange
+ *
+ * futex - addressed wait/wake for userspace synchronization
+ *
+ * Lets a userspace lock keep its fast path entirely in userspace and
+ * only enter the kernel when contended: FUTEX_WAIT sleeps the caller
+ * as long as the word at an address still holds an expected value,
+ * FUTEX_WAKE wakes up to N sleepers on that address. Wait queues are
+ * keyed by (address space, address), so locks are private to their
+ * process and its threads; waiting across fork is not supported.
+ *
+ * The queues live on the regular sleep_on/wakeup machinery. The
+ * expected-value check runs with interrupts masked right before the
+ * sleep, which closes the lost-wakeup race against a waker that
+ * changes the word between our check and our sleep.
+ */
+#include <kernel/system.h>
+#include <kernel/process.h>
+#include <kernel/logging.h>
+
+#include <sys/futex.h>
+#include <toaru/hashmap.h>
+
+static spin_lock_t ftl; // futex table lock
+static hashmap_t * futex_queues = NULL;
+
+typedef struct {
+	list_t * queue;
+	int pending; /* Waiters that have not finished their own cleanup */
+} futex_queue_t;
+
+/* String keys make collisions impossible; a futex miss hangs a
+ * process, so "verify and evict" like the block cache does would not
+ * be good enough here. */
+static void futex_key(char * buf, uintptr_t addr) {
+	sprintf(buf, "%x:%x", (uintptr_t)current_directory, addr);
+}
+
+/* Drop an entry nobody is using anymore. Called with the table lock held. */
+static void futex_reap(futex_queue_t * q, char * key) {
+	if (q->pending || q->queue->length) return;
+	hashmap_remove(futex_queues, key);
+	list_free(q->queue);
+	free(q->queue);
+	free(q);
+}
+
+int futex_wait(volatile int * addr, int value) {
+	char key[34];
+	futex_key(key, (uintptr_t)addr);
+
+	spin_lock(ftl);
+	if (!futex_queues) {
+		futex_queues = hashmap_create(10);
+	}
+	futex_queue_t * q = hashmap_get(futex_queues, key);
+	if (!q) {
+		q = malloc(sizeof(futex_queue_t));
+		q->queue = list_create();
+		q->pending = 0;
+		hashmap_set(futex_queues, key, q);
+	}
+	/* Hold the entry so a waker can't reap it out from under us. */
+	q->pending++;
+	spin_unlock(ftl);
+
+	IRQ_OFF;
+	if (*addr != value) {
+		/* The word already changed; the wake we would have waited
+		 * for has happened (or never will be needed). */
+		IRQ_RES;
+		spin_lock(ftl);
+		q->pending--;
+		futex_reap(q, key);
+		spin_unlock(ftl);
+		return -EAGAIN;
+	}
+	int interrupted = sleep_on(q->queue);
+	IRQ_RES;
+
+	spin_lock(ftl);
+	q->pending--;
+	futex_reap(q, key);
+	spin_unlock(ftl);
+
+	return interrupted ? -EINTR : 0;
+}
+
+int futex_wake(volatile int * addr, int count) {
+	char key[34];
+	futex_key(key, (uintptr_t)addr);
+
+	spin_lock(ftl);
+	futex_queue_t * q = futex_queues ? hashmap_get(futex_queues, key) : NULL;
+	if (!q) {
+		spin_unlock(ftl);
+		return 0;
+	}
+	int woken = wakeup_queue_n(q->queue, count);
+	futex_reap(q, key);
+	spin_unlock(ftl);
+
+	return woken;
+}
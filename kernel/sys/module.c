@@ -8,10 +8,13 @@
 #include <kernel/fs.h>
 #include <kernel/elf.h>
 #include <kernel/module.h>
+#include <kernel/bootmarks.h>
 
 #include <toaru/hashmap.h>
 
-#define SYMBOLTABLE_HASHMAP_SIZE 10
+/* There are a few thousand kernel symbols; with only a handful of
+ * buckets every module relocation degenerated into a list walk. */
+#define SYMBOLTABLE_HASHMAP_SIZE 1024
 #define MODULE_HASHMAP_SIZE 10
 
 static hashmap_t * symboltable = NULL;
@@ -69,7 +72,32 @@ _maybe_pack:
 	return 0;
 }
 
+/*
+ * Boot-time deferred initialization: multiboot modules are linked
+ * sequentially (relocation needs its dependencies' symbols in the
+ * table), but their initialize() functions - where the probe delays
+ * live - are queued here and later run as concurrent kernel tasks,
+ * gated on the moddeps graph, so slow hardware waits overlap.
+ */
+typedef struct {
+	module_data_t * mod;
+	volatile int state; /* 0 = waiting, 1 = running, 2 = done */
+} module_boot_init_t;
+
+static list_t * boot_init_queue = NULL;
+static volatile int boot_init_remaining = 0;
+
+static void * module_load_internal(void * blob, size_t length, int defer_init);
+
 void * module_load_direct(void * blob, size_t length) {
+	return module_load_internal(blob, length, 0);
+}
+
+void * module_load_direct_deferred(void * blob, size_t length) {
+	return module_load_internal(blob, length, 1);
+}
+
+static void * module_load_internal(void * blob, size_t length, int defer_init) {
 	Elf32_Header * target = (Elf32_Header *)blob;
 
 	if (target->e_ident[0] != ELFMAG0 ||
@@ -190,16 +218,9 @@ void * module_load_direct(void * blob, size_t length) {
 					} else {
 						Elf32_Shdr * s = NULL;
 						{
-							int i = 0;
-							int set = 0;
-							for (unsigned int x = 0; x < (unsigned int)target->e_shentsize * target->e_shnum; x += target->e_shentsize) {
-								Elf32_Shdr * shdr = (Elf32_Shdr *)((uintptr_t)target + (target->e_shoff + x));
-								if (i == table->st_shndx) {
-									set = 1;
-									s = shdr;
-									break;
-								}
-								i++;
+							/* Section headers are contiguous; index directly */
+							if (table->st_shndx < target->e_shnum) {
+								s = (Elf32_Shdr *)((uintptr_t)target + (target->e_shoff + table->st_shndx * target->e_shentsize));
 							}
 							/*
 							 * Common symbols
@@ -209,7 +230,7 @@ void * module_load_direct(void * blob, size_t length) {
 							 * undefined common symbol at this point should be immediately
 							 * allocated and zeroed.
 							 */
-							if (!set && table->st_shndx == 65522) {
+							if (!s && table->st_shndx == 65522) {
 								if (!hashmap_get(symboltable, name)) {
 									void * final = malloc(table->st_value);
 									memset(final, 0, table->st_value);
@@ -231,18 +252,10 @@ void * module_load_direct(void * blob, size_t length) {
 					char * name = (char *)((uintptr_t)symstrtab + table->st_name);
 					Elf32_Shdr * s = NULL;
 					{
-						int i = 0;
-						int set = 0;
-						for (unsigned int x = 0; x < (unsigned int)target->e_shentsize * target->e_shnum; x += target->e_shentsize) {
-							Elf32_Shdr * shdr = (Elf32_Shdr *)((uintptr_t)target + (target->e_shoff + x));
-							if (i == table->st_shndx) {
-								set = 1;
-								s = shdr;
-								break;
-							}
-							i++;
+						if (table->st_shndx < target->e_shnum) {
+							s = (Elf32_Shdr *)((uintptr_t)target + (target->e_shoff + table->st_shndx * target->e_shentsize));
 						}
-						if (!set && table->st_shndx == 65522) {
+						if (!s && table->st_shndx == 65522) {
 							if (!hashmap_get(symboltable, name)) {
 								void * final = calloc(1, table->st_value);
 								debug_print(NOTICE, "point %s to 0x%x", name, (uintptr_t)final);
@@ -337,10 +350,6 @@ void * module_load_direct(void * blob, size_t length) {
 		goto mod_load_error;
 	}
 
-	mod_info->initialize();
-
-	debug_print(NOTICE, "Finished loading module %s", mod_info->name);
-
 	/* We don't do this anymore
 	 * TODO: Do this in the module unload function
 	hashmap_free(local_symbols);
@@ -356,8 +365,27 @@ void * module_load_direct(void * blob, size_t length) {
 	mod_data->deps_length = deps_length;
 	mod_data->text_addr = text_addr;
 
+	/* Registered at link time either way, so later modules' dependency
+	 * checks pass before this one has initialized. */
 	hashmap_set(modules, mod_info->name, (void *)mod_data);
 
+	boot_marker_extra("mod-linked", mod_info->name);
+
+	if (defer_init) {
+		if (!boot_init_queue) {
+			boot_init_queue = list_create();
+		}
+		module_boot_init_t * ent = malloc(sizeof(module_boot_init_t));
+		ent->mod = mod_data;
+		ent->state = 0;
+		list_insert(boot_init_queue, ent);
+	} else {
+		boot_marker_extra("mod-init", mod_info->name);
+		mod_info->initialize();
+		boot_marker_extra("mod-init-done", mod_info->name);
+		debug_print(NOTICE, "Finished loading module %s", mod_info->name);
+	}
+
 	return mod_data;
 
 mod_load_error_unload:
@@ -367,6 +395,95 @@ mod_load_error:
 	return NULL;
 }
 
+static void module_boot_init_task(void * arg, char * name) {
+	module_boot_init_t * ent = arg;
+	boot_marker_extra("mod-init", ent->mod->mod_info->name);
+	ent->mod->mod_info->initialize();
+	boot_marker_extra("mod-init-done", ent->mod->mod_info->name);
+	debug_print(NOTICE, "Finished loading module %s", ent->mod->mod_info->name);
+	ent->state = 2;
+	__sync_fetch_and_sub(&boot_init_remaining, 1);
+	kexit(0);
+}
+
+static int module_deps_done(hashmap_t * by_name, module_data_t * mod) {
+	if (!mod->deps) return 1;
+	unsigned int i = 0;
+	while (i < mod->deps_length) {
+		char * dep = &mod->deps[i];
+		if (strlen(dep)) {
+			module_boot_init_t * dent = hashmap_get(by_name, dep);
+			if (dent && dent->state != 2) return 0;
+		}
+		i += strlen(dep) + 1;
+	}
+	return 1;
+}
+
+/*
+ * Run every queued initializer, as concurrently as the dependency
+ * graph allows: each pass starts a kernel task for every module whose
+ * declared dependencies have finished, then yields until something
+ * completes. Returns once all modules have initialized.
+ */
+void modules_run_deferred_inits(void) {
+	if (!boot_init_queue || !boot_init_queue->length) return;
+
+	hashmap_t * by_name = hashmap_create(10);
+	foreach(node, boot_init_queue) {
+		module_boot_init_t * ent = node->value;
+		hashmap_set(by_name, ent->mod->mod_info->name, ent);
+	}
+
+	boot_init_remaining = boot_init_queue->length;
+
+	while (boot_init_remaining) {
+		int progress = 0;
+		foreach(node, boot_init_queue) {
+			module_boot_init_t * ent = node->value;
+			if (ent->state == 1) {
+				progress = 1;
+				continue;
+			}
+			if (ent->state != 0) continue;
+			if (!module_deps_done(by_name, ent->mod)) continue;
+			ent->state = 1;
+			/* The task frees its name on exit; don't hand it ours */
+			create_kernel_tasklet(module_boot_init_task, strdup(ent->mod->mod_info->name), ent);
+			progress = 1;
+		}
+		if (!boot_init_remaining) break;
+		if (!progress) {
+			/* Nothing runnable and nothing in flight: a dependency
+			 * cycle. Initialize the stragglers in list order rather
+			 * than hang the boot. */
+			foreach(node, boot_init_queue) {
+				module_boot_init_t * ent = node->value;
+				if (ent->state == 0) {
+					debug_print(ERROR, "Module dependency cycle involving %s", ent->mod->mod_info->name);
+					ent->state = 1;
+					ent->mod->mod_info->initialize();
+					ent->state = 2;
+					boot_init_remaining--;
+				}
+			}
+			break;
+		}
+		switch_task(1); /* Yield while initializers run */
+	}
+
+	hashmap_free(by_name);
+	free(by_name);
+
+	node_t * node;
+	while ((node = list_dequeue(boot_init_queue))) {
+		free(node->value);
+		free(node);
+	}
+	free(boot_init_queue);
+	boot_init_queue = NULL;
+}
+
 uintptr_t module_get_text_addr(char * name) {
 	module_data_t * mod_data = hashmap_get(modules, name);
 	if (!mod_data) return -1;
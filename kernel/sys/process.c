@@ -16,6 +16,8 @@
 #include <kernel/logging.h>
 #include <kernel/shm.h>
 #include <kernel/printf.h>
+#include <kernel/slab.h>
+#include <kernel/aio.h>
 
 #include <sys/wait.h>
 
@@ -24,8 +26,9 @@
 
 tree_t * process_tree;  /* Parent->Children tree */
 list_t * process_list;  /* Flat storage */
-list_t * process_queue; /* Ready queue */
-list_t * sleep_queue;
+list_t * run_queues[PROCESS_PRIORITY_LEVELS]; /* Per-priority ready queues */
+static uint32_t run_queue_bitmap = 0; /* Bit n set = run_queues[n] non-empty */
+list_t * sleep_queue; /* Kept empty; only serves as the sleep_node owner marker for timed sleeps */
 volatile process_t * current_process = NULL;
 process_t * kernel_idle_task = NULL;
 
@@ -36,6 +39,71 @@ static spin_lock_t sleep_lock = { 0 };
 
 static bitset_t pid_set;
 
+/* Object caches for the scheduler's hottest allocations */
+static slab_cache_t * process_cache = NULL;
+static slab_cache_t * sleeper_cache = NULL;
+
+/*
+ * Reaped processes are parked here with their kernel stack, queue
+ * headers, and fd table storage intact; spawn_process pulls one of
+ * these carcasses before going to the allocator, so a fork/exec/exit
+ * cycle reuses the previous process's kernel objects instead of
+ * freeing and reallocating a dozen of them each time.
+ */
+#define PROCESS_POOL_MAX 8
+static list_t * process_pool = NULL;
+static spin_lock_t pool_lock = { 0 };
+
+/*
+ * Timed sleeps live in a binary min-heap keyed on (end_tick, end_subtick),
+ * so inserting a sleeper is O(log n) instead of the O(n) walk the old
+ * sorted list needed, and each timer tick still pops only expired
+ * entries from the top. Cancellation (a sleeper woken early, or an
+ * fswait satisfied before its timeout) just flags the entry; the
+ * expiry pop discards flagged entries, which keeps the heap free of
+ * random-access deletes. All access is under sleep_lock with
+ * interrupts off, same as the list it replaces.
+ */
+static sleeper_t ** sleep_heap = NULL;
+static size_t sleep_heap_size = 0;
+static size_t sleep_heap_capacity = 0;
+
+static int sleeper_before(sleeper_t * a, sleeper_t * b) {
+	return (a->end_tick < b->end_tick) ||
+	       (a->end_tick == b->end_tick && a->end_subtick <= b->end_subtick);
+}
+
+static void sleep_heap_insert(sleeper_t * proc) {
+	if (sleep_heap_size == sleep_heap_capacity) {
+		sleep_heap_capacity = sleep_heap_capacity ? sleep_heap_capacity * 2 : 64;
+		sleep_heap = realloc(sleep_heap, sleep_heap_capacity * sizeof(sleeper_t *));
+	}
+	size_t i = sleep_heap_size++;
+	while (i && sleeper_before(proc, sleep_heap[(i - 1) / 2])) {
+		sleep_heap[i] = sleep_heap[(i - 1) / 2];
+		i = (i - 1) / 2;
+	}
+	sleep_heap[i] = proc;
+}
+
+static sleeper_t * sleep_heap_pop(void) {
+	sleeper_t * top = sleep_heap[0];
+	sleeper_t * last = sleep_heap[--sleep_heap_size];
+	size_t i = 0;
+	while (1) {
+		size_t child = 2 * i + 1;
+		if (child >= sleep_heap_size) break;
+		if (child + 1 < sleep_heap_size && sleeper_before(sleep_heap[child + 1], sleep_heap[child])) {
+			child++;
+		}
+		if (sleeper_before(last, sleep_heap[child])) break;
+		sleep_heap[i] = sleep_heap[child];
+		i = child;
+	}
+	sleep_heap[i] = last;
+	return top;
+}
+
 /* Default process name string */
 char * default_name = "[unnamed]";
 
@@ -61,9 +129,15 @@ int is_valid_process(process_t * process) {
 void initialize_process_tree(void) {
 	process_tree = tree_create();
 	process_list = list_create();
-	process_queue = list_create();
+	for (int i = 0; i < PROCESS_PRIORITY_LEVELS; ++i) {
+		run_queues[i] = list_create();
+	}
 	sleep_queue = list_create();
 
+	process_cache = slab_create("process_t", sizeof(process_t));
+	sleeper_cache = slab_create("sleeper_t", sizeof(sleeper_t));
+	process_pool = list_create();
+
 	/* Start off with enough bits for 64 processes */
 	bitset_init(&pid_set, MAX_PID / 8);
 	/* First two bits are set by default */
@@ -118,42 +192,69 @@ void debug_print_process_tree(void) {
  * Retreive the next ready process.
  * XXX: POPs from the ready queue!
  *
+ * The run queue is split into PROCESS_PRIORITY_LEVELS round-robin
+ * lists; run_queue_bitmap tracks which lists are non-empty, so
+ * picking the highest-priority runnable process is a find-first-set
+ * and a dequeue - no scanning.
+ *
  * @return A pointer to the next process in the queue.
  */
 process_t * next_ready_process(void) {
 	if (!process_available()) {
 		return kernel_idle_task;
 	}
-	if (process_queue->head->owner != process_queue) {
-		debug_print(ERROR, "Erroneous process located in process queue: node 0x%x has owner 0x%x, but process_queue is 0x%x", process_queue->head, process_queue->head->owner, process_queue);
+	int level = __builtin_ctz(run_queue_bitmap);
+	list_t * queue = run_queues[level];
+	if (queue->head->owner != queue) {
+		debug_print(ERROR, "Erroneous process located in process queue: node 0x%x has owner 0x%x, but run queue %d is 0x%x", queue->head, queue->head->owner, level, queue);
 
-		process_t * proc = process_queue->head->value;
+		process_t * proc = queue->head->value;
 
 		debug_print(ERROR, "PID associated with this node is %d", proc->id);
 	}
-	node_t * np = list_dequeue(process_queue);
+	node_t * np = list_dequeue(queue);
 	assert(np && "Ready queue is empty.");
+	if (!queue->head) {
+		run_queue_bitmap &= ~(1 << level);
+	}
 	process_t * next = np->value;
 	return next;
 }
 
+/*
+ * Change the scheduling priority of a process.
+ *
+ * Takes effect the next time the process is queued; we deliberately
+ * do not dig an already-ready process out of its current level.
+ *
+ * @param proc     Process to adjust
+ * @param priority New level, clamped to the valid range
+ */
+void process_set_priority(process_t * proc, int priority) {
+	if (priority < PRIORITY_HIGHEST) priority = PRIORITY_HIGHEST;
+	if (priority > PRIORITY_LOWEST)  priority = PRIORITY_LOWEST;
+	proc->priority = priority;
+}
+
 /*
  * Reinsert a process into the ready queue.
  *
  * @param proc Process to reinsert
  */
 void make_process_ready(process_t * proc) {
+	trace_record(TRACE_EVENT_READY, proc->id);
 	if (proc->sleep_node.owner != NULL) {
 		if (proc->sleep_node.owner == sleep_queue) {
 			/* XXX can't wake from timed sleep */
 			if (proc->timed_sleep_node) {
 				IRQ_OFF;
 				spin_lock(sleep_lock);
-				list_delete(sleep_queue, proc->timed_sleep_node);
+				/* The expiry pop will discard the flagged entry. */
+				proc->timed_sleep_node->cancelled = 1;
 				spin_unlock(sleep_lock);
 				IRQ_RES;
 				proc->sleep_node.owner = NULL;
-				free(proc->timed_sleep_node->value);
+				proc->timed_sleep_node = NULL;
 			}
 			/* Else: I have no idea what happened. */
 		} else {
@@ -165,11 +266,12 @@ void make_process_ready(process_t * proc) {
 	}
 	if (proc->sched_node.owner) {
 		debug_print(WARNING, "Can't make process ready without removing from owner list: %d", proc->id);
-		debug_print(WARNING, "  (This is a bug) Current owner list is 0x%x (ready queue is 0x%x)", proc->sched_node.owner, process_queue);
+		debug_print(WARNING, "  (This is a bug) Current owner list is 0x%x", proc->sched_node.owner);
 		return;
 	}
 	spin_lock(process_queue_lock);
-	list_append(process_queue, &proc->sched_node);
+	list_append(run_queues[proc->priority], &proc->sched_node);
+	run_queue_bitmap |= (1 << proc->priority);
 	spin_unlock(process_queue_lock);
 }
 
@@ -210,8 +312,31 @@ void delete_process(process_t * proc) {
 
 	bitset_clear(&pid_set, proc->id);
 
-	/* Uh... */
-	free(proc);
+	/* Park the carcass for the next spawn if there is room and it
+	 * still owns its stack and fd table storage. */
+	if (proc->image.stack && process_pool) {
+		spin_lock(pool_lock);
+		if (process_pool->length < PROCESS_POOL_MAX) {
+			list_append(process_pool, &proc->sched_node);
+			spin_unlock(pool_lock);
+			return;
+		}
+		spin_unlock(pool_lock);
+	}
+
+	if (proc->fds) {
+		free(proc->fds->entries);
+		free(proc->fds->offsets);
+		free(proc->fds->modes);
+		free(proc->fds->advice);
+		free(proc->fds);
+	}
+	if (proc->image.stack) {
+		free((void *)(proc->image.stack - KERNEL_STACK_SIZE));
+	}
+	free(proc->wait_queue);
+	free(proc->shm_mappings);
+	slab_free(process_cache, proc);
 }
 
 static void _kidle(void) {
@@ -225,8 +350,7 @@ static void _kidle(void) {
  * Spawn the idle "process".
  */
 process_t * spawn_kidle(void) {
-	process_t * idle = malloc(sizeof(process_t));
-	memset(idle, 0x00, sizeof(process_t));
+	process_t * idle = slab_alloc(process_cache);
 	idle->id = -1;
 	idle->name = strdup("[kidle]");
 	idle->is_tasklet = 1;
@@ -238,9 +362,9 @@ process_t * spawn_kidle(void) {
 
 	idle->started = 1;
 	idle->running = 1;
+	idle->priority = PRIORITY_LOWEST; /* Never queued, but keep it honest */
 	idle->wait_queue = list_create();
 	idle->shm_mappings = list_create();
-	idle->signal_queue = list_create();
 
 	gettimeofday(&idle->start, NULL);
 
@@ -258,7 +382,7 @@ process_t * spawn_init(void) {
 	assert((!process_tree->root) && "Tried to regenerate init!");
 
 	/* Allocate space for a new process */
-	process_t * init = malloc(sizeof(process_t));
+	process_t * init = slab_alloc(process_cache);
 	/* Set it as the root process */
 	tree_set_root(process_tree, (void *)init);
 	/* Set its tree entry pointer so we can keep track
@@ -278,9 +402,11 @@ process_t * spawn_init(void) {
 	init->fds->refs = 1;
 	init->fds->length   = 0;  /* Initialize the file descriptors */
 	init->fds->capacity = 4;
+	init->fds->next_free = 0;
 	init->fds->entries  = malloc(sizeof(fs_node_t *) * init->fds->capacity);
 	init->fds->modes    = malloc(sizeof(int) * init->fds->capacity);
 	init->fds->offsets  = malloc(sizeof(uint64_t) * init->fds->capacity);
+	init->fds->advice   = malloc(sizeof(int) * init->fds->capacity);
 
 	/* Set the working directory */
 	init->wd_node = clone_fs(fs_root);
@@ -294,6 +420,7 @@ process_t * spawn_init(void) {
 	init->image.user_stack  = 0;
 	init->image.size        = 0;
 	init->image.shm_heap    = SHM_START; /* Yeah, a bit of a hack. */
+	init->image.mmap_start  = MMAP_REGION_START;
 
 	spin_init(init->image.lock);
 
@@ -304,7 +431,6 @@ process_t * spawn_init(void) {
 	init->running = 1;
 	init->wait_queue = list_create();
 	init->shm_mappings = list_create();
-	init->signal_queue = list_create();
 	init->signal_kstack = NULL; /* None yet initialized */
 
 	init->sched_node.prev = NULL;
@@ -316,8 +442,10 @@ process_t * spawn_init(void) {
 	init->sleep_node.value = init;
 
 	init->timed_sleep_node = NULL;
+	init->event_sets = NULL;
 
 	init->is_tasklet = 0;
+	init->priority = PRIORITY_DEFAULT;
 
 	set_process_environment(init, current_directory);
 
@@ -375,13 +503,44 @@ void process_disown(process_t * proc) {
  * @param parent The parent process to spawn the new one off of.
  * @return A pointer to the new process.
  */
+/*
+ * Pull a recycled carcass out of the pool, handing its reusable
+ * resources back to the caller, or fall back to the zeroing slab.
+ */
+static process_t * process_alloc(uintptr_t * stack, fd_table_t ** fds, list_t ** wait_queue, list_t ** shm_mappings) {
+	*stack = 0;
+	*fds = NULL;
+	*wait_queue = NULL;
+	*shm_mappings = NULL;
+
+	if (process_pool) {
+		spin_lock(pool_lock);
+		node_t * node = list_dequeue(process_pool);
+		spin_unlock(pool_lock);
+		if (node) {
+			process_t * proc = node->value;
+			*stack        = proc->image.stack;
+			*fds          = proc->fds;
+			*wait_queue   = proc->wait_queue;
+			*shm_mappings = proc->shm_mappings;
+			memset(proc, 0, sizeof(process_t));
+			return proc;
+		}
+	}
+
+	return slab_alloc(process_cache);
+}
+
 process_t * spawn_process(volatile process_t * parent, int reuse_fds) {
 	assert(process_tree->root && "Attempted to spawn a process without init.");
 
-	/* Allocate a new process */
+	/* Allocate a new process, preferably a recycled one */
 	debug_print(INFO,"   process_t {");
-	process_t * proc = malloc(sizeof(process_t));
-	memset(proc, 0, sizeof(process_t));
+	uintptr_t    recycled_stack;
+	fd_table_t * recycled_fds;
+	list_t     * recycled_wait_queue;
+	list_t     * recycled_shm_mappings;
+	process_t * proc = process_alloc(&recycled_stack, &recycled_fds, &recycled_wait_queue, &recycled_shm_mappings);
 	debug_print(INFO,"   }");
 	proc->id = get_next_pid(); /* Set its PID */
 	proc->group = proc->id;    /* Set the GID */
@@ -411,10 +570,11 @@ process_t * spawn_process(volatile process_t * parent, int reuse_fds) {
 	proc->image.heap_actual = parent->image.heap_actual;
 	proc->image.size        = parent->image.size;
 	debug_print(INFO,"    stack {");
-	proc->image.stack       = (uintptr_t)kvmalloc(KERNEL_STACK_SIZE) + KERNEL_STACK_SIZE;
+	proc->image.stack       = recycled_stack ? recycled_stack : (uintptr_t)kvmalloc(KERNEL_STACK_SIZE) + KERNEL_STACK_SIZE;
 	debug_print(INFO,"    }");
 	proc->image.user_stack  = parent->image.user_stack;
 	proc->image.shm_heap    = SHM_START; /* Yeah, a bit of a hack. */
+	proc->image.mmap_start  = parent->image.mmap_start;
 
 	spin_init(proc->image.lock);
 
@@ -424,21 +584,45 @@ process_t * spawn_process(volatile process_t * parent, int reuse_fds) {
 	if (reuse_fds) {
 		proc->fds = parent->fds;
 		proc->fds->refs++;
+		if (recycled_fds) {
+			/* Nobody to give this one to; toss it. */
+			free(recycled_fds->entries);
+			free(recycled_fds->offsets);
+			free(recycled_fds->modes);
+			free(recycled_fds->advice);
+			free(recycled_fds);
+		}
 	} else {
-		proc->fds = malloc(sizeof(fd_table_t));
+		if (recycled_fds && recycled_fds->capacity < parent->fds->capacity) {
+			/* The carcass's table can't hold the parent's descriptors. */
+			free(recycled_fds->entries);
+			free(recycled_fds->offsets);
+			free(recycled_fds->modes);
+			free(recycled_fds->advice);
+			free(recycled_fds);
+			recycled_fds = NULL;
+		}
+		debug_print(INFO,"    fds / files {");
+		if (recycled_fds) {
+			proc->fds = recycled_fds;
+		} else {
+			proc->fds = malloc(sizeof(fd_table_t));
+			proc->fds->capacity = parent->fds->capacity;
+			proc->fds->entries  = malloc(sizeof(fs_node_t *) * proc->fds->capacity);
+			proc->fds->modes    = malloc(sizeof(int) * proc->fds->capacity);
+			proc->fds->offsets  = malloc(sizeof(uint64_t) * proc->fds->capacity);
+			proc->fds->advice   = malloc(sizeof(int) * proc->fds->capacity);
+		}
 		proc->fds->refs     = 1;
 		proc->fds->length   = parent->fds->length;
-		proc->fds->capacity = parent->fds->capacity;
-		debug_print(INFO,"    fds / files {");
-		proc->fds->entries  = malloc(sizeof(fs_node_t *) * proc->fds->capacity);
-		proc->fds->modes    = malloc(sizeof(int) * proc->fds->capacity);
-		proc->fds->offsets  = malloc(sizeof(uint64_t) * proc->fds->capacity);
+		proc->fds->next_free = parent->fds->next_free;
 		assert(proc->fds->entries && "Failed to allocate file descriptor table for new process.");
 		debug_print(INFO,"    ---");
 		for (uint32_t i = 0; i < parent->fds->length; ++i) {
 			proc->fds->entries[i] = clone_fs(parent->fds->entries[i]);
 			proc->fds->modes[i]   = parent->fds->modes[i];
 			proc->fds->offsets[i] = parent->fds->offsets[i];
+			proc->fds->advice[i]  = parent->fds->advice[i];
 		}
 		debug_print(INFO,"    }");
 	}
@@ -454,9 +638,8 @@ process_t * spawn_process(volatile process_t * parent, int reuse_fds) {
 	proc->started = 0;
 	proc->running = 0;
 	memset(proc->signals.functions, 0x00, sizeof(uintptr_t) * NUMSIGNALS);
-	proc->wait_queue = list_create();
-	proc->shm_mappings = list_create();
-	proc->signal_queue = list_create();
+	proc->wait_queue = recycled_wait_queue ? recycled_wait_queue : list_create();
+	proc->shm_mappings = recycled_shm_mappings ? recycled_shm_mappings : list_create();
 	proc->signal_kstack = NULL; /* None yet initialized */
 
 	proc->sched_node.prev = NULL;
@@ -468,8 +651,10 @@ process_t * spawn_process(volatile process_t * parent, int reuse_fds) {
 	proc->sleep_node.value = proc;
 
 	proc->timed_sleep_node = NULL;
+	proc->event_sets = NULL; /* Event sets are not inherited; events route to their creator */
 
 	proc->is_tasklet = 0;
+	proc->priority = parent->priority; /* Children inherit their parent's run queue level */
 
 	gettimeofday(&proc->start, NULL);
 
@@ -575,7 +760,7 @@ void set_process_environment(process_t * proc, page_directory_t * directory) {
  * @return 1 if there are processes available, 0 otherwise
  */
 uint8_t process_available(void) {
-	return (process_queue->head != NULL);
+	return (run_queue_bitmap != 0);
 }
 
 /*
@@ -586,13 +771,16 @@ uint8_t process_available(void) {
  * @return The actual fd, for use in userspace
  */
 uint32_t process_append_fd(process_t * proc, fs_node_t * node) {
-	/* Fill gaps */
-	for (unsigned int i = 0; i < proc->fds->length; ++i) {
+	/* Fill gaps. Nothing below next_free is free (closes move it
+	 * back down), so the scan starts there instead of at zero. */
+	for (unsigned int i = proc->fds->next_free; i < proc->fds->length; ++i) {
 		if (!proc->fds->entries[i]) {
 			proc->fds->entries[i] = node;
 			/* modes, offsets must be set by caller */
 			proc->fds->modes[i] = 0;
 			proc->fds->offsets[i] = 0;
+			proc->fds->advice[i] = 0;
+			proc->fds->next_free = i + 1;
 			return i;
 		}
 	}
@@ -602,12 +790,15 @@ uint32_t process_append_fd(process_t * proc, fs_node_t * node) {
 		proc->fds->entries = realloc(proc->fds->entries, sizeof(fs_node_t *) * proc->fds->capacity);
 		proc->fds->modes   = realloc(proc->fds->modes,   sizeof(int) * proc->fds->capacity);
 		proc->fds->offsets = realloc(proc->fds->offsets, sizeof(uint64_t) * proc->fds->capacity);
+		proc->fds->advice  = realloc(proc->fds->advice,  sizeof(int) * proc->fds->capacity);
 	}
 	proc->fds->entries[proc->fds->length] = node;
 	/* modes, offsets must be set by caller */
 	proc->fds->modes[proc->fds->length] = 0;
 	proc->fds->offsets[proc->fds->length] = 0;
+	proc->fds->advice[proc->fds->length] = 0;
 	proc->fds->length++;
+	proc->fds->next_free = proc->fds->length;
 	return proc->fds->length-1;
 }
 
@@ -632,6 +823,7 @@ uint32_t process_move_fd(process_t * proc, int src, int dest) {
 		proc->fds->entries[dest] = proc->fds->entries[src];
 		proc->fds->modes[dest] = proc->fds->modes[src];
 		proc->fds->offsets[dest] = proc->fds->offsets[src];
+		proc->fds->advice[dest] = proc->fds->advice[src];
 		open_fs(proc->fds->entries[dest], 0);
 	}
 	return dest;
@@ -651,6 +843,21 @@ int wakeup_queue(list_t * queue) {
 	return awoken_processes;
 }
 
+/* Wake at most n sleepers; the rest stay queued for a later wake. */
+int wakeup_queue_n(list_t * queue, int n) {
+	int awoken_processes = 0;
+	while (queue->length > 0 && awoken_processes < n) {
+		spin_lock(wait_lock_tmp);
+		node_t * node = list_pop(queue);
+		spin_unlock(wait_lock_tmp);
+		if (!((process_t *)node->value)->finished) {
+			make_process_ready(node->value);
+		}
+		awoken_processes++;
+	}
+	return awoken_processes;
+}
+
 int wakeup_queue_interrupted(list_t * queue) {
 	int awoken_processes = 0;
 	while (queue->length > 0) {
@@ -669,6 +876,7 @@ int wakeup_queue_interrupted(list_t * queue) {
 
 
 int sleep_on(list_t * queue) {
+	trace_record(TRACE_EVENT_SLEEP, current_process->id);
 	if (current_process->sleep_node.owner) {
 		/* uh, we can't sleep right now, we're marked as ready */
 		switch_task(0);
@@ -690,29 +898,27 @@ int process_is_ready(process_t * proc) {
 void wakeup_sleepers(unsigned long seconds, unsigned long subseconds) {
 	IRQ_OFF;
 	spin_lock(sleep_lock);
-	if (sleep_queue->length) {
-		sleeper_t * proc = ((sleeper_t *)sleep_queue->head->value);
-		while (proc && (proc->end_tick < seconds || (proc->end_tick == seconds && proc->end_subtick <= subseconds))) {
-
-			if (proc->is_fswait) {
-				proc->is_fswait = -1;
-				process_alert_node(proc->process,proc);
-			} else {
-				process_t * process = proc->process;
-				process->sleep_node.owner = NULL;
-				process->timed_sleep_node = NULL;
-				if (!process_is_ready(process)) {
-					make_process_ready(process);
-				}
-			}
-			free(proc);
-			free(list_dequeue(sleep_queue));
-			if (sleep_queue->length) {
-				proc = ((sleeper_t *)sleep_queue->head->value);
-			} else {
-				break;
+	while (sleep_heap_size) {
+		sleeper_t * proc = sleep_heap[0];
+		if (proc->end_tick > seconds || (proc->end_tick == seconds && proc->end_subtick > subseconds)) {
+			break;
+		}
+		sleep_heap_pop();
+
+		if (proc->cancelled) {
+			/* Woken early; nothing left to do but free the entry. */
+		} else if (proc->is_fswait) {
+			proc->is_fswait = -1;
+			process_alert_node(proc->process,proc);
+		} else {
+			process_t * process = proc->process;
+			process->sleep_node.owner = NULL;
+			process->timed_sleep_node = NULL;
+			if (!process_is_ready(process)) {
+				make_process_ready(process);
 			}
 		}
+		slab_free(sleeper_cache, proc);
 	}
 	spin_unlock(sleep_lock);
 	IRQ_RES;
@@ -727,20 +933,14 @@ void sleep_until(process_t * process, unsigned long seconds, unsigned long subse
 
 	IRQ_OFF;
 	spin_lock(sleep_lock);
-	node_t * before = NULL;
-	foreach(node, sleep_queue) {
-		sleeper_t * candidate = ((sleeper_t *)node->value);
-		if (candidate->end_tick > seconds || (candidate->end_tick == seconds && candidate->end_subtick > subseconds)) {
-			break;
-		}
-		before = node;
-	}
-	sleeper_t * proc = malloc(sizeof(sleeper_t));
+	sleeper_t * proc = slab_alloc(sleeper_cache);
 	proc->process     = process;
 	proc->end_tick    = seconds;
 	proc->end_subtick = subseconds;
 	proc->is_fswait = 0;
-	process->timed_sleep_node = list_insert_after(sleep_queue, before, proc);
+	proc->cancelled = 0;
+	sleep_heap_insert(proc);
+	process->timed_sleep_node = proc;
 	spin_unlock(sleep_lock);
 	IRQ_RES;
 }
@@ -749,24 +949,37 @@ void cleanup_process(process_t * proc, int retval) {
 	proc->status   = retval;
 	proc->finished = 1;
 
-	list_free(proc->wait_queue);
-	free(proc->wait_queue);
-	list_free(proc->signal_queue);
-	free(proc->signal_queue);
+	/* Empty the queue but keep its header; it goes to the pool
+	 * with the rest of the carcass in delete_process. */
+	while (list_dequeue(proc->wait_queue));
+	proc->pending_signals = 0;
 	free(proc->wd_name);
+	proc->wd_name = NULL;
 
 
+	if (proc->event_sets) {
+		/* The sets themselves are freed when their descriptors close. */
+		list_free(proc->event_sets);
+		free(proc->event_sets);
+		proc->event_sets = NULL;
+	}
+
 	if (proc->node_waits) {
-		list_free(proc->node_waits);
-		free(proc->node_waits);
+		node_t * node;
+		while ((node = list_dequeue(proc->node_waits))) {
+			process_wait_node_release(proc, node);
+		}
 		proc->node_waits = NULL;
 	}
+	/* Unreaped async I/O completions would leak with the process */
+	aio_flush_process(proc->id);
+
 	debug_print(INFO, "Releasing shared memory for %d", proc->id);
 	shm_release_all(proc);
-	free(proc->shm_mappings);
 	debug_print(INFO, "Freeing more mems %d", proc->id);
 	if (proc->signal_kstack) {
 		free(proc->signal_kstack);
+		proc->signal_kstack = NULL;
 	}
 
 	release_directory(proc->thread.page_directory);
@@ -782,13 +995,15 @@ void cleanup_process(process_t * proc, int retval) {
 				proc->fds->entries[i] = NULL;
 			}
 		}
-		debug_print(INFO, "... and their storage %d", proc->id);
-		free(proc->fds->entries);
-		free(proc->fds->offsets);
-		free(proc->fds->modes);
-		free(proc->fds);
-		debug_print(INFO, "... and the kernel stack (hope this ain't us) %d", proc->id);
-		free((void *)(proc->image.stack - KERNEL_STACK_SIZE));
+		proc->fds->length = 0;
+		proc->fds->next_free = 0;
+		/* The table storage and the kernel stack stay attached; the
+		 * carcass carries them into the recycling pool. */
+	} else {
+		/* Someone else still holds the table; the last closer frees
+		 * it, and the stack with it, so this carcass brings neither. */
+		proc->fds = NULL;
+		proc->image.stack = 0;
 	}
 }
 
@@ -885,6 +1100,37 @@ int waitpid(int pid, int * status, int options) {
 	} while (1);
 }
 
+/*
+ * Wait registrations are intrusive: each process embeds a small pool
+ * of list nodes and the list header itself, so registering for a
+ * handful of nodes - the overwhelmingly common case - costs no heap
+ * traffic at all. Only a wait on more than PROCESS_WAIT_SLOTS nodes
+ * at once falls back to malloc for the overflow.
+ */
+static node_t * process_wait_node_alloc(process_t * process) {
+	for (int i = 0; i < PROCESS_WAIT_SLOTS; ++i) {
+		node_t * slot = &process->wait_slots[i];
+		if (!slot->owner && !slot->next && !slot->prev && !slot->value) {
+			return slot;
+		}
+	}
+	return calloc(1, sizeof(node_t));
+}
+
+void process_wait_node_insert(process_t * process, void * value) {
+	node_t * node = process_wait_node_alloc(process);
+	node->value = value;
+	list_append(process->node_waits, node);
+}
+
+void process_wait_node_release(process_t * process, node_t * node) {
+	if (node >= process->wait_slots && node < process->wait_slots + PROCESS_WAIT_SLOTS) {
+		node->value = NULL; /* prev/next/owner were cleared on unlink */
+	} else {
+		free(node);
+	}
+}
+
 int process_wait_nodes(process_t * process,fs_node_t * nodes[], int timeout) {
 	assert(!process->node_waits && "Tried to wait on nodes while already waiting on nodes.");
 
@@ -911,7 +1157,10 @@ int process_wait_nodes(process_t * process,fs_node_t * nodes[], int timeout) {
 
 	n = nodes;
 
-	process->node_waits = list_create();
+	process->wait_list.head = NULL;
+	process->wait_list.tail = NULL;
+	process->wait_list.length = 0;
+	process->node_waits = &process->wait_list;
 	if (*n) {
 		do {
 			if (selectwait_fs(*n, process) < 0) {
@@ -928,21 +1177,15 @@ int process_wait_nodes(process_t * process,fs_node_t * nodes[], int timeout) {
 
 		IRQ_OFF;
 		spin_lock(sleep_lock);
-		node_t * before = NULL;
-		foreach(node, sleep_queue) {
-			sleeper_t * candidate = ((sleeper_t *)node->value);
-			if (candidate->end_tick > s || (candidate->end_tick == s && candidate->end_subtick > ss)) {
-				break;
-			}
-			before = node;
-		}
-		sleeper_t * proc = malloc(sizeof(sleeper_t));
+		sleeper_t * proc = slab_alloc(sleeper_cache);
 		proc->process     = process;
 		proc->end_tick    = s;
 		proc->end_subtick = ss;
 		proc->is_fswait = 1;
-		list_insert(((process_t *)process)->node_waits, proc);
-		process->timeout_node = list_insert_after(sleep_queue, before, proc);
+		proc->cancelled = 0;
+		process_wait_node_insert((process_t *)process, proc);
+		sleep_heap_insert(proc);
+		process->timeout_node = proc;
 		spin_unlock(sleep_lock);
 		IRQ_RES;
 	} else {
@@ -958,15 +1201,17 @@ int process_wait_nodes(process_t * process,fs_node_t * nodes[], int timeout) {
 
 int process_awaken_from_fswait(process_t * process, int index) {
 	process->awoken_index = index;
-	list_free(process->node_waits);
-	free(process->node_waits);
+	node_t * node;
+	while ((node = list_dequeue(process->node_waits))) {
+		process_wait_node_release(process, node);
+	}
 	process->node_waits = NULL;
-	if (process->timeout_node && process->timeout_node->owner == sleep_queue) {
-		sleeper_t * proc = process->timeout_node->value;
+	if (process->timeout_node) {
+		sleeper_t * proc = process->timeout_node;
 		if (proc->is_fswait != -1) {
-			list_delete(sleep_queue, process->timeout_node);
-			free(process->timeout_node->value);
-			free(process->timeout_node);
+			/* Timeout hasn't fired; flag it for the expiry pop to discard.
+			 * (If it has, wakeup_sleepers owns the entry and frees it.) */
+			proc->cancelled = 1;
 		}
 	}
 	process->timeout_node = NULL;
@@ -981,7 +1226,11 @@ int process_alert_node(process_t * process, void * value) {
 		return 0;
 	}
 
-
+	/* Event sets get first look; they hold persistent registrations
+	 * and route alerts into their ready lists. */
+	if (process->event_sets && eventset_alert(process, value)) {
+		return 0;
+	}
 
 	if (!process->node_waits) {
 		return 0; /* Possibly already returned. Wait for another call. */
@@ -83,11 +83,7 @@ char isdeadly[] = {
 	0, /* SIGCAT     */
 };
 
-void handle_signal(process_t * proc, signal_t * sig) {
-	uintptr_t handler = sig->handler;
-	uintptr_t signum  = sig->signum;
-	free(sig);
-
+void handle_signal(process_t * proc, int signum, uintptr_t handler) {
 	if (proc->finished) {
 		return;
 	}
@@ -241,11 +237,14 @@ int send_signal(pid_t process, uint32_t signal, int force_root) {
 		}
 	}
 
-	/* Append signal to list */
-	signal_t * sig = malloc(sizeof(signal_t));
-	sig->handler = (uintptr_t)receiver->signals.functions[signal];
-	sig->signum  = signal;
-	memset(&sig->registers_before, 0x00, sizeof(regs_t));
+	/*
+	 * Mark the signal pending. The handler is captured into its slot
+	 * before the bit is published, so the delivery side always sees a
+	 * valid handler; re-sending a still-pending signal just coalesces.
+	 */
+	receiver->pending_handlers[signal] = (uintptr_t)receiver->signals.functions[signal];
+	__sync_synchronize();
+	__sync_fetch_and_or(&receiver->pending_signals, 1ULL << signal);
 
 	if (receiver->node_waits) {
 		process_awaken_from_fswait(receiver, -1);
@@ -254,8 +253,6 @@ int send_signal(pid_t process, uint32_t signal, int force_root) {
 		make_process_ready(receiver);
 	}
 
-	list_insert(receiver->signal_queue, sig);
-
 	if (receiver == current_process) {
 		/* Forces us to be rescheduled and enter signal handler */
 		if (receiver->signal_kstack) {
@@ -17,8 +17,14 @@
 #include <kernel/printf.h>
 #include <kernel/module.h>
 #include <kernel/args.h>
+#include <kernel/aio.h>
+
+#include <kernel/mod/net.h>
 
 #include <sys/utsname.h>
+#include <sys/mman.h>
+#include <sys/futex.h>
+#include <sys/uio.h>
 #include <syscall_nums.h>
 
 static char   hostname[256];
@@ -34,6 +40,8 @@ static size_t hostname_len = 0;
 	(current_process->fds->offsets[(FD)])
 #define FD_MODE(FD) \
 	(current_process->fds->modes[(FD)])
+#define FD_ADVICE(FD) \
+	(current_process->fds->advice[(FD)])
 
 #define PTR_INRANGE(PTR) \
 	((uintptr_t)(PTR) > current_process->image.entry)
@@ -71,6 +79,13 @@ static int sys_read(int fd, char * ptr, int len) {
 			debug_print(WARNING, "access denied (read, fd=%d, mode=%d, %s, %s)", fd, FD_MODE(fd), node->name, current_process->name);
 			return -EACCES;
 		}
+		/* Access pattern hints steer the drivers' sequential-read
+		 * detection, which keys off node->last_read_offset. */
+		if (FD_ADVICE(fd) == POSIX_FADV_RANDOM) {
+			node->last_read_offset = (uint64_t)-1;
+		} else if (FD_ADVICE(fd) == POSIX_FADV_SEQUENTIAL) {
+			node->last_read_offset = FD_OFFSET(fd);
+		}
 		uint32_t out = read_fs(node, FD_OFFSET(fd), len, (uint8_t *)ptr);
 		FD_OFFSET(fd) += out;
 		return (int)out;
@@ -101,6 +116,15 @@ static int sys_readdir(int fd, int index, struct dirent * entry) {
 	return -EBADF;
 }
 
+static int sys_readdirents(int fd, int index, struct dirent * entries, int count) {
+	if (FD_CHECK(fd)) {
+		if (count <= 0) return -EINVAL;
+		PTR_VALIDATE(entries);
+		return readdir_n_fs(FD_ENTRY(fd), (uint32_t)index, entries, count);
+	}
+	return -EBADF;
+}
+
 static int sys_write(int fd, char * ptr, int len) {
 	if (FD_CHECK(fd)) {
 		PTR_VALIDATE(ptr);
@@ -216,6 +240,9 @@ static int sys_close(int fd) {
 	if (FD_CHECK(fd)) {
 		close_fs(FD_ENTRY(fd));
 		FD_ENTRY(fd) = NULL;
+		if ((size_t)fd < current_process->fds->next_free) {
+			current_process->fds->next_free = fd;
+		}
 		return 0;
 	}
 	return -EBADF;
@@ -234,7 +261,8 @@ static int sys_sbrk(int size) {
 	while (proc->image.heap > proc->image.heap_actual) {
 		proc->image.heap_actual += 0x1000;
 		assert(proc->image.heap_actual % 0x1000 == 0);
-		alloc_frame(get_page(proc->image.heap_actual, 1, current_directory), 0, 1);
+		/* Zero-filled on demand; most sbrk growth is touched sparsely */
+		alloc_frame_lazy(get_page(proc->image.heap_actual, 1, current_directory));
 		invalidate_tables_at(proc->image.heap_actual);
 	}
 	spin_unlock(proc->image.lock);
@@ -312,6 +340,64 @@ static int sys_execve(const char * filename, char *const argv[], char *const env
 	return exec((char *)filename, argc, (char **)argv_, (char **)envp_, 0);
 }
 
+static int sys_spawn(const char * path, char * const argv[], char * const envp[], int * fd_map, int fd_count) {
+	PTR_VALIDATE(path);
+	PTR_VALIDATE(argv);
+	PTR_VALIDATE(envp);
+
+	if (!path || !argv) return -EINVAL;
+
+	if (fd_map) {
+		PTR_VALIDATE(fd_map);
+		if (fd_count < 0 || fd_count > (int)current_process->fds->capacity) {
+			return -EINVAL;
+		}
+	}
+
+	int argc = 0;
+	int envc = 0;
+	while (argv[argc]) {
+		PTR_VALIDATE(argv[argc]);
+		++argc;
+	}
+
+	if (envp) {
+		while (envp[envc]) {
+			PTR_VALIDATE(envp[envc]);
+			++envc;
+		}
+	}
+
+	/* The child starts life in a different address space, so everything
+	 * it needs is copied to the kernel heap; it owns the copies. */
+	char * path_ = malloc(strlen(path) + 1);
+	memcpy(path_, path, strlen(path) + 1);
+	char ** argv_ = malloc(sizeof(char *) * (argc + 1));
+	for (int j = 0; j < argc; ++j) {
+		argv_[j] = malloc((strlen(argv[j]) + 1) * sizeof(char));
+		memcpy(argv_[j], argv[j], strlen(argv[j]) + 1);
+	}
+	argv_[argc] = 0;
+	char ** envp_ = malloc(sizeof(char *) * (envc + 1));
+	for (int j = 0; j < envc; ++j) {
+		envp_[j] = malloc((strlen(envp[j]) + 1) * sizeof(char));
+		memcpy(envp_[j], envp[j], strlen(envp[j]) + 1);
+	}
+	envp_[envc] = 0;
+
+	int * fd_map_ = NULL;
+	if (fd_map) {
+		fd_map_ = malloc(sizeof(int) * fd_count);
+		memcpy(fd_map_, fd_map, sizeof(int) * fd_count);
+	}
+
+	int pid = spawn_exec(path_, argc, argv_, envp_, fd_map_, fd_map_ ? fd_count : 0);
+
+	free(fd_map_);
+
+	return pid;
+}
+
 static int sys_seek(int fd, int offset, int whence) {
 	if (FD_CHECK(fd)) {
 		if ((FD_ENTRY(fd)->flags & FS_PIPE) || (FD_ENTRY(fd)->flags & FS_CHARDEVICE)) return -ESPIPE;
@@ -591,6 +677,97 @@ static int sys_yield(void) {
 	return 1;
 }
 
+/*
+ * Memory-mapped regions
+ *
+ * The syscall path only carries five arguments, so the address hint
+ * is dropped in libc; the kernel always chooses the placement.
+ */
+static int sys_mmap(size_t length, int prot, int flags, int fd, int offset) {
+	fs_node_t * node = NULL;
+	if (!(flags & MAP_ANONYMOUS)) {
+		if (!FD_CHECK(fd)) return -EBADF;
+		node = FD_ENTRY(fd);
+	}
+	return mmap_map(node, length, prot, flags, offset);
+}
+
+static int sys_munmap(uintptr_t addr, size_t length) {
+	return mmap_unmap(addr, length);
+}
+
+/*
+ * Vectored I/O
+ *
+ * The iovec list itself and every segment base are validated up
+ * front; the segments then go down to the VFS as one operation so
+ * message-oriented nodes can keep the list in a single packet.
+ */
+static int sys_readv(int fd, const struct iovec * iov, int count) {
+	if (!FD_CHECK(fd)) return -EBADF;
+	PTR_VALIDATE(iov);
+	if (!iov || count < 0 || count > UIO_MAXIOV) return -EINVAL;
+	if (!(FD_MODE(fd) & 01)) return -EACCES;
+	for (int i = 0; i < count; ++i) {
+		PTR_VALIDATE(iov[i].iov_base);
+	}
+	fs_node_t * node = FD_ENTRY(fd);
+	uint32_t out = readv_fs(node, FD_OFFSET(fd), count, iov);
+	if ((int32_t)out > 0) FD_OFFSET(fd) += out;
+	return (int)out;
+}
+
+static int sys_writev(int fd, const struct iovec * iov, int count) {
+	if (!FD_CHECK(fd)) return -EBADF;
+	PTR_VALIDATE(iov);
+	if (!iov || count < 0 || count > UIO_MAXIOV) return -EINVAL;
+	if (!(FD_MODE(fd) & 02)) return -EACCES;
+	for (int i = 0; i < count; ++i) {
+		PTR_VALIDATE(iov[i].iov_base);
+	}
+	fs_node_t * node = FD_ENTRY(fd);
+	uint32_t out = writev_fs(node, FD_OFFSET(fd), count, iov);
+	if ((int32_t)out > 0) FD_OFFSET(fd) += out;
+	return (int)out;
+}
+
+/*
+ * Event sets
+ *
+ * Persistent readiness watches; see kernel/fs/eventset.c. The set
+ * lives in the file descriptor table so it is closed like any file.
+ */
+static int sys_eventset_create(void) {
+	fs_node_t * node = eventset_create();
+	open_fs(node, 0);
+	return process_append_fd((process_t *)current_process, node);
+}
+
+static int sys_eventset_ctl(int setfd, int op, int fd) {
+	if (!FD_CHECK(setfd) || !FD_CHECK(fd)) return -EBADF;
+	return eventset_ctl(FD_ENTRY(setfd), op, FD_ENTRY(fd), fd);
+}
+
+static int sys_eventset_wait(int setfd, int * out, int max, int timeout) {
+	if (!FD_CHECK(setfd)) return -EBADF;
+	PTR_VALIDATE(out);
+	if (!out) return -EINVAL;
+	return eventset_wait(FD_ENTRY(setfd), out, max, timeout);
+}
+
+static int sys_futex(int * addr, int op, int value) {
+	PTR_VALIDATE(addr);
+	if (!addr || ((uintptr_t)addr & 0x3)) return -EINVAL;
+	switch (op) {
+		case FUTEX_WAIT:
+			return futex_wait(addr, value);
+		case FUTEX_WAKE:
+			return futex_wake(addr, value);
+		default:
+			return -EINVAL;
+	}
+}
+
 /*
  * System Function
  */
@@ -672,6 +849,31 @@ static int sys_sysfunc(int fn, char ** args) {
 					}
 					return 0;
 				}
+			case 14:
+				/*
+				 * Offer a freshly loaded library image to the shared
+				 * library cache. Root only: a cached image is mapped
+				 * into every later process that asks for that library,
+				 * so unprivileged processes must not be able to seed it.
+				 */
+				{
+					PTR_VALIDATE(args);
+					PTR_VALIDATE(args[0]);
+					uintptr_t address = (uintptr_t)args[1];
+					if (address < 0x20000000) return -EINVAL;
+					return lib_cache_insert(args[0], address, (size_t)args[2]);
+				}
+			case 16:
+				/*
+				 * Enable swapping to a block device (swapon). Root
+				 * only: pointing the pager at an arbitrary node would
+				 * let anyone scribble over it with page contents.
+				 */
+				{
+					PTR_VALIDATE(args);
+					PTR_VALIDATE(args[0]);
+					return swap_enable((char *)args[0]);
+				}
 		}
 	}
 	switch (fn) {
@@ -784,6 +986,35 @@ static int sys_sysfunc(int fn, char ** args) {
 
 			return 0;
 
+		case 17:
+			/*
+			 * Set VGA text-mode start address; the VGA terminal
+			 * scrolls by sliding the display window over text
+			 * memory instead of rewriting it.
+			 */
+			PTR_VALIDATE(args);
+			outportb(0x3D4, 12);
+			outportb(0x3D5, (unsigned int)args[0]);
+			outportb(0x3D4, 13);
+			outportb(0x3D5, (unsigned int)args[1]);
+
+			return 0;
+
+		case 15:
+			/*
+			 * Map a cached library image copy-on-write. Safe for any
+			 * user: the mapping is read-only and writes are resolved
+			 * by duplicating the faulting page, so a mapper can never
+			 * modify the cached frames.
+			 */
+			{
+				PTR_VALIDATE(args);
+				PTR_VALIDATE(args[0]);
+				uintptr_t address = (uintptr_t)args[1];
+				if (address < 0x20000000) return -EINVAL;
+				return lib_cache_map(args[0], address);
+			}
+
 		default:
 			debug_print(ERROR, "Bad system function %d", fn);
 			break;
@@ -838,12 +1069,115 @@ static int sys_shm_obtain(char * path, size_t * size) {
 	return (int)shm_obtain(path, size);
 }
 
+static int sys_shm_obtain_ro(char * path, size_t * size) {
+	PTR_VALIDATE(path);
+	PTR_VALIDATE(size);
+
+	return (int)shm_obtain_ro(path, size);
+}
+
 static int sys_shm_release(char * path) {
 	PTR_VALIDATE(path);
 
 	return shm_release(path);
 }
 
+static int sys_shm_resize(char * path, size_t * size) {
+	PTR_VALIDATE(path);
+	PTR_VALIDATE(size);
+
+	return shm_resize(path, size);
+}
+
+static int sys_fsync(int fd) {
+	if (FD_CHECK(fd)) {
+		return fsync_fs(FD_ENTRY(fd));
+	}
+	return -EBADF;
+}
+
+/*
+ * We don't track data and metadata dirtiness separately,
+ * so this is the same flush fsync does.
+ */
+static int sys_fdatasync(int fd) {
+	if (FD_CHECK(fd)) {
+		return fsync_fs(FD_ENTRY(fd));
+	}
+	return -EBADF;
+}
+
+/*
+ * posix_fadvise: per-descriptor access pattern hints.
+ *
+ * SEQUENTIAL and RANDOM stick to the descriptor and bias the read
+ * path's readahead detection; WILLNEED warms the caches by reading
+ * the range through them now; DONTNEED drops this file's pages from
+ * the VFS read cache. The offset and length are honored for WILLNEED
+ * and ignored for the sticky hints, which apply to the whole file.
+ */
+static int sys_fadvise(int fd, int offset, int len, int advice) {
+	if (!FD_CHECK(fd)) return -EBADF;
+
+	switch (advice) {
+		case POSIX_FADV_NORMAL:
+		case POSIX_FADV_SEQUENTIAL:
+		case POSIX_FADV_RANDOM:
+		case POSIX_FADV_NOREUSE:
+			FD_ADVICE(fd) = advice;
+			return 0;
+		case POSIX_FADV_WILLNEED: {
+			fs_node_t * node = FD_ENTRY(fd);
+			if (!node->read || !(node->flags & FS_CACHEABLE)) return 0;
+			if (offset < 0 || len < 0) return -EINVAL;
+			uint32_t end = len ? (uint32_t)offset + (uint32_t)len : node->length;
+			if (end > node->length) end = node->length;
+			/* Warming more than the cache can hold just evicts itself */
+			if (end - (uint32_t)offset > 0x80000) end = offset + 0x80000;
+			uint8_t * scratch = malloc(0x1000);
+			for (uint32_t at = offset; at < end; at += 0x1000) {
+				uint32_t chunk = (end - at > 0x1000) ? 0x1000 : (end - at);
+				if ((int32_t)read_fs(node, at, chunk, scratch) <= 0) break;
+			}
+			free(scratch);
+			return 0;
+		}
+		case POSIX_FADV_DONTNEED:
+			vfs_cache_invalidate(FD_ENTRY(fd));
+			return 0;
+	}
+	return -EINVAL;
+}
+
+/*
+ * Asynchronous I/O: validate the descriptor in the caller's context,
+ * then hand the open node to the worker queue in kernel/fs/aio.c.
+ * The offset here is absolute - async requests don't touch the
+ * descriptor's file position.
+ */
+static int sys_aio_submit(struct aio_request * req) {
+	PTR_VALIDATE(req);
+	if (!req) return -EFAULT;
+	if (!FD_CHECK(req->fd)) return -EBADF;
+	PTR_VALIDATE(req->buffer);
+
+	if (req->op == AIO_OP_READ) {
+		if (!(FD_MODE(req->fd) & 01)) return -EACCES;
+	} else if (req->op == AIO_OP_WRITE) {
+		if (!(FD_MODE(req->fd) & 02)) return -EACCES;
+	} else {
+		return -EINVAL;
+	}
+
+	return aio_submit(FD_ENTRY(req->fd), req->op, req->offset, req->length, req->buffer);
+}
+
+static int sys_aio_reap(struct aio_completion * out, int max, int wait) {
+	PTR_VALIDATE(out);
+	if (!out) return -EFAULT;
+	return aio_reap(out, max, wait);
+}
+
 static int sys_kill(pid_t process, uint32_t signal) {
 	if (process < -1) {
 		return group_send_signal(-process, signal, 0);
@@ -861,6 +1195,29 @@ static int sys_gettimeofday(struct timeval * tv, void * tz) {
 	return gettimeofday(tv, tz);
 }
 
+static int sys_clock_gettime(int clockid, struct timespec * t) {
+	PTR_VALIDATE(t);
+	if (!t) return -EFAULT;
+
+	switch (clockid) {
+		case CLOCK_MONOTONIC: {
+			uint64_t ns = monotonic_time_ns();
+			t->tv_sec  = ns / 1000000000ULL;
+			t->tv_nsec = ns % 1000000000ULL;
+			return 0;
+		}
+		case CLOCK_REALTIME: {
+			struct timeval tv;
+			gettimeofday(&tv, NULL);
+			t->tv_sec  = tv.tv_sec;
+			t->tv_nsec = tv.tv_usec * 1000;
+			return 0;
+		}
+		default:
+			return -EINVAL;
+	}
+}
+
 static int sys_openpty(int * master, int * slave, char * name, void * _ign0, void * size) {
 	/* We require a place to put these when we are done. */
 	if (!master || !slave) return -EINVAL;
@@ -1081,6 +1438,48 @@ static int sys_getpgid(pid_t pid) {
 /*
  * System Call Internals
  */
+/*
+ * Socket calls are serviced by the network module, when one is loaded;
+ * until then they all fail with EINVAL. The module installs its ops
+ * table here, and we keep fd bookkeeping on this side of the fence.
+ */
+struct netsock_ops * netsock_ops = NULL;
+
+static int sys_socket(int domain, int type, int protocol) {
+	if (!netsock_ops) return -EINVAL;
+	fs_node_t * node = netsock_ops->socket(domain, type, protocol);
+	if (!node) return -EINVAL;
+	int fd = process_append_fd((process_t *)current_process, node);
+	FD_MODE(fd) = 03;
+	FD_OFFSET(fd) = 0;
+	return fd;
+}
+
+static int sys_bind(int sockfd, const struct sockaddr * addr, size_t addrlen) {
+	if (!netsock_ops) return -EINVAL;
+	if (!FD_CHECK(sockfd)) return -EBADF;
+	PTR_VALIDATE(addr);
+	return netsock_ops->bind(FD_ENTRY(sockfd), addr, addrlen);
+}
+
+/* No flags argument on these two - the syscall path only carries five. */
+static int sys_sendto(int sockfd, const void * buf, size_t len, const struct sockaddr * addr, size_t addrlen) {
+	if (!netsock_ops) return -EINVAL;
+	if (!FD_CHECK(sockfd)) return -EBADF;
+	PTR_VALIDATE(buf);
+	PTR_VALIDATE(addr);
+	return netsock_ops->sendto(FD_ENTRY(sockfd), buf, len, addr, addrlen);
+}
+
+static int sys_recvfrom(int sockfd, void * buf, size_t len, struct sockaddr * addr, size_t * addrlen) {
+	if (!netsock_ops) return -EINVAL;
+	if (!FD_CHECK(sockfd)) return -EBADF;
+	PTR_VALIDATE(buf);
+	PTR_VALIDATE(addr);
+	PTR_VALIDATE(addrlen);
+	return netsock_ops->recvfrom(FD_ENTRY(sockfd), buf, len, addr, addrlen);
+}
+
 static int (*syscalls[])() = {
 	/* System Call Table */
 	[SYS_EXT]          = sys_exit,
@@ -1138,10 +1537,136 @@ static int (*syscalls[])() = {
 	[SYS_SETSID]       = sys_setsid,
 	[SYS_SETPGID]      = sys_setpgid,
 	[SYS_GETPGID]      = sys_getpgid,
+	[SYS_SOCKET]       = sys_socket,
+	[SYS_BIND]         = sys_bind,
+	[SYS_SENDTO]       = sys_sendto,
+	[SYS_RECVFROM]     = sys_recvfrom,
+	[SYS_CLOCK_GETTIME] = sys_clock_gettime,
+	[SYS_MMAP]         = sys_mmap,
+	[SYS_MUNMAP]       = sys_munmap,
+	[SYS_FUTEX]        = sys_futex,
+	[SYS_EVENTSET_CREATE] = sys_eventset_create,
+	[SYS_EVENTSET_CTL] = sys_eventset_ctl,
+	[SYS_EVENTSET_WAIT] = sys_eventset_wait,
+	[SYS_READV]        = sys_readv,
+	[SYS_WRITEV]       = sys_writev,
+	[SYS_READDIRENTS]  = sys_readdirents,
+	[SYS_SHM_RESIZE]   = sys_shm_resize,
+	[SYS_FSYNC]        = sys_fsync,
+	[SYS_FDATASYNC]    = sys_fdatasync,
+	[SYS_FADVISE]      = sys_fadvise,
+	[SYS_SPAWN]        = sys_spawn,
+	[SYS_AIO_SUBMIT]   = sys_aio_submit,
+	[SYS_AIO_REAP]     = sys_aio_reap,
+	[SYS_SHM_OBTAIN_RO] = sys_shm_obtain_ro,
 };
 
 uint32_t num_syscalls = sizeof(syscalls) / sizeof(*syscalls);
 
+const char * syscall_names[] = {
+	[SYS_EXT]          = "exit",
+	[SYS_GETEUID]      = "geteuid",
+	[SYS_OPEN]         = "open",
+	[SYS_READ]         = "read",
+	[SYS_WRITE]        = "write",
+	[SYS_CLOSE]        = "close",
+	[SYS_GETTIMEOFDAY] = "gettimeofday",
+	[SYS_EXECVE]       = "execve",
+	[SYS_FORK]         = "fork",
+	[SYS_GETPID]       = "getpid",
+	[SYS_SBRK]         = "sbrk",
+	[SYS_UNAME]        = "uname",
+	[SYS_OPENPTY]      = "openpty",
+	[SYS_SEEK]         = "seek",
+	[SYS_STAT]         = "stat",
+	[SYS_MKPIPE]       = "mkpipe",
+	[SYS_DUP2]         = "dup2",
+	[SYS_GETUID]       = "getuid",
+	[SYS_SETUID]       = "setuid",
+	[SYS_REBOOT]       = "reboot",
+	[SYS_READDIR]      = "readdir",
+	[SYS_CHDIR]        = "chdir",
+	[SYS_GETCWD]       = "getcwd",
+	[SYS_CLONE]        = "clone",
+	[SYS_SETHOSTNAME]  = "sethostname",
+	[SYS_GETHOSTNAME]  = "gethostname",
+	[SYS_MKDIR]        = "mkdir",
+	[SYS_SHM_OBTAIN]   = "shm_obtain",
+	[SYS_SHM_RELEASE]  = "shm_release",
+	[SYS_KILL]         = "kill",
+	[SYS_SIGNAL]       = "signal",
+	[SYS_GETTID]       = "gettid",
+	[SYS_YIELD]        = "yield",
+	[SYS_SYSFUNC]      = "sysfunc",
+	[SYS_SLEEPABS]     = "sleepabs",
+	[SYS_SLEEP]        = "sleep",
+	[SYS_IOCTL]        = "ioctl",
+	[SYS_ACCESS]       = "access",
+	[SYS_STATF]        = "statf",
+	[SYS_CHMOD]        = "chmod",
+	[SYS_UMASK]        = "umask",
+	[SYS_UNLINK]       = "unlink",
+	[SYS_WAITPID]      = "waitpid",
+	[SYS_PIPE]         = "pipe",
+	[SYS_MOUNT]        = "mount",
+	[SYS_SYMLINK]      = "symlink",
+	[SYS_READLINK]     = "readlink",
+	[SYS_LSTAT]        = "lstat",
+	[SYS_FSWAIT]       = "fswait",
+	[SYS_FSWAIT2]      = "fswait2",
+	[SYS_FSWAIT3]      = "fswait3",
+	[SYS_CHOWN]        = "chown",
+	[SYS_SETSID]       = "setsid",
+	[SYS_SETPGID]      = "setpgid",
+	[SYS_GETPGID]      = "getpgid",
+	[SYS_SOCKET]       = "socket",
+	[SYS_BIND]         = "bind",
+	[SYS_SENDTO]       = "sendto",
+	[SYS_RECVFROM]     = "recvfrom",
+	[SYS_CLOCK_GETTIME] = "clock_gettime",
+	[SYS_MMAP]         = "mmap",
+	[SYS_MUNMAP]       = "munmap",
+	[SYS_FUTEX]        = "futex",
+	[SYS_EVENTSET_CREATE] = "eventset_create",
+	[SYS_EVENTSET_CTL] = "eventset_ctl",
+	[SYS_EVENTSET_WAIT] = "eventset_wait",
+	[SYS_READV]        = "readv",
+	[SYS_WRITEV]       = "writev",
+	[SYS_READDIRENTS]  = "readdirents",
+	[SYS_SHM_RESIZE]   = "shm_resize",
+	[SYS_FSYNC]        = "fsync",
+	[SYS_FDATASYNC]    = "fdatasync",
+	[SYS_FADVISE]      = "fadvise",
+	[SYS_SPAWN]        = "spawn",
+	[SYS_AIO_SUBMIT]   = "aio_submit",
+	[SYS_AIO_REAP]     = "aio_reap",
+	[SYS_SHM_OBTAIN_RO] = "shm_obtain_ro",
+};
+
+/*
+ * Per-syscall invocation counts and log2(cycles) latency histograms,
+ * exported through /proc/syscalls and toggled from the debug shell.
+ * This kernel is uniprocessor and syscalls only switch away at sleep
+ * points, so plain increments are safe here.
+ */
+int syscall_stats_enabled = 0;
+struct syscall_stats syscall_stats[sizeof(syscalls) / sizeof(*syscalls)];
+
+void syscall_stats_reset(void) {
+	memset(syscall_stats, 0, sizeof(syscall_stats));
+}
+
+static void syscall_stats_record(uint32_t num, uint64_t elapsed) {
+	struct syscall_stats * s = &syscall_stats[num];
+	s->count++;
+	int bucket = 0;
+	while (elapsed > 1 && bucket < SYSCALL_STAT_BUCKETS - 1) {
+		elapsed >>= 1;
+		bucket++;
+	}
+	s->buckets[bucket]++;
+}
+
 typedef uint32_t (*scall_func)(unsigned int, ...);
 
 pid_t trace_pid = 0;
@@ -1165,7 +1690,18 @@ void syscall_handler(struct regs * r) {
 
 	/* Call the syscall function */
 	scall_func func = (scall_func)location;
-	uint32_t ret = func(r->ebx, r->ecx, r->edx, r->esi, r->edi);
+	uint32_t ret;
+	if (syscall_stats_enabled) {
+		uint32_t num = r->eax;
+		uint64_t tsc_before;
+		asm volatile ("rdtsc" : "=A" (tsc_before));
+		ret = func(r->ebx, r->ecx, r->edx, r->esi, r->edi);
+		uint64_t tsc_after;
+		asm volatile ("rdtsc" : "=A" (tsc_after));
+		syscall_stats_record(num, tsc_after - tsc_before);
+	} else {
+		ret = func(r->ebx, r->ecx, r->edx, r->esi, r->edi);
+	}
 
 	if ((current_process->syscall_registers == r) ||
 			(location != (uintptr_t)&fork && location != (uintptr_t)&clone)) {
@@ -23,6 +23,38 @@ unsigned short * memsetw(unsigned short * dest, unsigned short val, int count) {
 	return dest;
 }
 
+/*
+ * Entropy pool. Interrupt handlers feed event values here along with
+ * the cycle counter at the time of the event; the timing jitter in
+ * the low TSC bits is the real entropy. The /dev/random module folds
+ * the pool into its generator key when it reseeds. Feeding is a few
+ * arithmetic ops, safe and cheap from any interrupt handler.
+ */
+#define ENTROPY_POOL_WORDS 32
+static uint32_t entropy_pool[ENTROPY_POOL_WORDS];
+static unsigned int entropy_pos = 0;
+volatile unsigned long entropy_events = 0;
+
+void random_feed_entropy(uint32_t value) {
+	uint32_t tsc_lo, tsc_hi;
+	asm volatile ("rdtsc" : "=a"(tsc_lo), "=d"(tsc_hi));
+	uint32_t mixed = (value * 2654435761U) ^ tsc_lo ^ (tsc_hi << 16);
+	entropy_pool[entropy_pos % ENTROPY_POOL_WORDS] ^= mixed;
+	entropy_pool[(entropy_pos + 13) % ENTROPY_POOL_WORDS] += (mixed << 7) | (mixed >> 25);
+	entropy_pos++;
+	entropy_events++;
+}
+
+/* XOR-fold the whole pool into `out`; the caller mixes this into
+ * whatever keying material it keeps. Never reveals the pool raw. */
+void random_entropy_fetch(uint32_t * out, int words) {
+	for (int i = 0; i < ENTROPY_POOL_WORDS; ++i) {
+		uint32_t v = entropy_pool[i] * 2246822519U;
+		out[i % words] ^= (v << 11) | (v >> 21);
+	}
+	out[0] ^= (uint32_t)entropy_events;
+}
+
 uint32_t __attribute__ ((pure)) krand(void) {
 	static uint32_t x = 123456789;
 	static uint32_t y = 362436069;
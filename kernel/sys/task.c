@@ -62,6 +62,8 @@ clone_directory(
 			}
 		}
 	}
+	/* Cloning may have downgraded our own pages to copy-on-write */
+	invalidate_page_tables();
 	return dir;
 }
 
@@ -80,7 +82,9 @@ void release_directory(page_directory_t * dir) {
 			if (kernel_directory->tables[i] != dir->tables[i]) {
 				if (i * 0x1000 * 1024 < SHM_START) {
 					for (uint32_t j = 0; j < 1024; ++j) {
-						if (dir->tables[i]->pages[j].frame) {
+						if (dir->tables[i]->pages[j].swapped) {
+							swap_discard_page(&(dir->tables[i]->pages[j]));
+						} else if (dir->tables[i]->pages[j].frame) {
 							free_frame(&(dir->tables[i]->pages[j]));
 						}
 					}
@@ -102,7 +106,9 @@ void release_directory_for_exec(page_directory_t * dir) {
 		if (kernel_directory->tables[i] != dir->tables[i]) {
 			if (i * 0x1000 * 1024 < USER_STACK_BOTTOM) {
 				for (uint32_t j = 0; j < 1024; ++j) {
-					if (dir->tables[i]->pages[j].frame) {
+					if (dir->tables[i]->pages[j].swapped) {
+						swap_discard_page(&(dir->tables[i]->pages[j]));
+					} else if (dir->tables[i]->pages[j].frame) {
 						free_frame(&(dir->tables[i]->pages[j]));
 					}
 				}
@@ -133,26 +139,36 @@ clone_table(
 	memset(table, 0, sizeof(page_table_t));
 	uint32_t i;
 	for (i = 0; i < 1024; ++i) {
+		/* A swapped-out page holds a slot number, not a frame;
+		 * bring it back in so it can be shared like any other. */
+		if (src->pages[i].swapped) {
+			if (!swap_restore_page(&src->pages[i])) continue;
+		}
 		/* For each frame in the table... */
 		if (!src->pages[i].frame) {
 			continue;
 		}
-		/* Allocate a new frame */
-		alloc_frame(&table->pages[i], 0, 0);
-		/* Set the correct access bit */
-		if (src->pages[i].present)	table->pages[i].present = 1;
-		if (src->pages[i].rw)		table->pages[i].rw = 1;
-		if (src->pages[i].user)		table->pages[i].user = 1;
-		if (src->pages[i].writethrough)	table->pages[i].writethrough = 1;
-		if (src->pages[i].cachedisable)	table->pages[i].cachedisable = 1;
-		/* Copy the contents of the page from the old table to the new one */
-		copy_page_physical(src->pages[i].frame * 0x1000, table->pages[i].frame * 0x1000);
+		/*
+		 * Share the frame instead of copying it. Writable pages
+		 * are downgraded to read-only copy-on-write in both address
+		 * spaces; the page fault handler duplicates them on first
+		 * write. Read-only pages (program text) are just shared.
+		 */
+		if (src->pages[i].rw) {
+			src->pages[i].rw  = 0;
+			src->pages[i].cow = 1;
+		}
+		table->pages[i] = src->pages[i];
+		frame_ref(src->pages[i].frame);
 	}
 	return table;
 }
 
 uintptr_t frozen_stack = 0;
 
+/* System-wide context switch count, for /proc/cpu */
+unsigned long total_ctx_switches = 0;
+
 /*
  * Install multitasking functionality.
  */
@@ -232,6 +248,110 @@ uint32_t fork(void) {
 	return new_proc->id;
 }
 
+struct spawn_args {
+	char *  path;
+	int     argc;
+	char ** argv;
+	char ** envp;
+};
+
+/*
+ * First thing a spawned child runs, on its own kernel stack and in its
+ * own (empty) address space: load the target binary. exec() only
+ * returns on failure, in which case the child dies with the shell's
+ * customary 127.
+ */
+static void spawn_entry(void * arg) {
+	struct spawn_args * s = arg;
+	current_process->cmdline = s->argv;
+	exec(s->path, s->argc, s->argv, s->envp, 0);
+	debug_print(WARNING, "spawn: exec of %s failed", s->path);
+	for (int i = 0; s->argv[i]; ++i) free(s->argv[i]);
+	for (int i = 0; s->envp[i]; ++i) free(s->envp[i]);
+	free(s->argv);
+	free(s->envp);
+	free(s->path);
+	free(s);
+	kexit(127 << 8);
+}
+
+/*
+ * Combined fork+exec. The child's directory is a clone of the kernel
+ * directory - page tables are linked, not copied, so unlike fork there
+ * is no user address space duplicated just for exec to throw away.
+ * path, argv and envp must be kernel-heap copies; the child owns them.
+ * fd_map, if given, lists for each child descriptor which parent
+ * descriptor it aliases (-1 for closed); a NULL map inherits the whole
+ * table as fork would.
+ *
+ * @return To the parent: PID of the child. The child never returns here.
+ */
+pid_t spawn_exec(char * path, int argc, char ** argv, char ** envp, int * fd_map, int fd_count) {
+	IRQ_OFF;
+
+	process_t * parent = (process_t *)current_process;
+
+	page_directory_t * directory = clone_directory(kernel_directory);
+	assert(directory && "Could not allocate a new page directory!");
+
+	process_t * new_proc = spawn_process(current_process, 0);
+	assert(new_proc && "Could not allocate a new process!");
+	set_process_environment(new_proc, directory);
+	/* Nothing of the parent's image survives into the child */
+	new_proc->image.shm_heap = SHM_START;
+
+	if (fd_map) {
+		/* Drop the wholesale copy spawn_process made and install the
+		 * requested dispositions instead. fd_map indexes the parent's
+		 * table, which is distinct from the copy being replaced. */
+		fd_table_t * fds = new_proc->fds;
+		for (uint32_t i = 0; i < fds->length; ++i) {
+			if (fds->entries[i]) {
+				close_fs(fds->entries[i]);
+				fds->entries[i] = NULL;
+			}
+		}
+		fds->length = fd_count;
+		fds->next_free = 0;
+		for (int i = 0; i < fd_count; ++i) {
+			int src = fd_map[i];
+			if (src >= 0 && src < (int)parent->fds->length && parent->fds->entries[src]) {
+				fds->entries[i] = clone_fs(parent->fds->entries[src]);
+				fds->offsets[i] = parent->fds->offsets[src];
+				fds->modes[i]   = parent->fds->modes[src];
+				fds->advice[i]  = parent->fds->advice[src];
+			} else {
+				fds->entries[i] = NULL;
+				fds->offsets[i] = 0;
+				fds->modes[i]   = 0;
+				fds->advice[i]  = 0;
+			}
+		}
+	}
+
+	struct spawn_args * sargs = malloc(sizeof(struct spawn_args));
+	sargs->path = path;
+	sargs->argc = argc;
+	sargs->argv = argv;
+	sargs->envp = envp;
+
+	uintptr_t esp = new_proc->image.stack;
+	uintptr_t ebp = esp;
+
+	PUSH(esp, uintptr_t, (uintptr_t)sargs);
+	PUSH(esp, uintptr_t, (uintptr_t)&task_exit);
+
+	new_proc->thread.esp = esp;
+	new_proc->thread.ebp = ebp;
+	new_proc->thread.eip = (uintptr_t)&spawn_entry;
+
+	make_process_ready(new_proc);
+
+	IRQ_RES;
+
+	return new_proc->id;
+}
+
 int create_kernel_tasklet(tasklet_t tasklet, char * name, void * argp) {
 	IRQ_OFF;
 
@@ -390,11 +510,11 @@ void switch_task(uint8_t reschedule) {
 
 		/* XXX: Signals */
 		if (!current_process->finished) {
-			if (current_process->signal_queue->length > 0) {
-				node_t * node = list_dequeue(current_process->signal_queue);
-				signal_t * sig = node->value;
-				free(node);
-				handle_signal((process_t *)current_process, sig);
+			if (current_process->pending_signals) {
+				/* Deliver the lowest pending signal number */
+				int signum = __builtin_ctzll(current_process->pending_signals);
+				__sync_fetch_and_and(&current_process->pending_signals, ~(1ULL << signum));
+				handle_signal((process_t *)current_process, signum, current_process->pending_handlers[signum]);
 			}
 		}
 
@@ -445,6 +565,11 @@ void switch_next(void) {
 		switch_next();
 	}
 
+	trace_record(TRACE_EVENT_SWITCH, current_process->id);
+
+	current_process->ctx_switches++;
+	total_ctx_switches++;
+
 	/* Set the page directory */
 	current_directory = current_process->thread.page_directory;
 	switch_page_directory(current_directory);
@@ -453,7 +578,7 @@ void switch_next(void) {
 
 	if (current_process->started) {
 		if (!current_process->signal_kstack) {
-			if (current_process->signal_queue->length > 0) {
+			if (current_process->pending_signals) {
 				current_process->signal_kstack  = malloc(KERNEL_STACK_SIZE);
 				current_process->signal_state.esp = current_process->thread.esp;
 				current_process->signal_state.eip = current_process->thread.eip;
@@ -0,0 +1,132 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ * This file is part of ToaruOS and is released under the terms
+ * of the NCSA / University of Illinois License - see LICENSE.md
+ * Copyright (C) 2015-2018 K. Lange
+ *               2015 Dale Weiler
+ *
+ * Userspace port of kernel/ds/bitset.c; keep the two in sync.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include <toaru/bitset.h>
+
+#define CEIL(NUMBER, BASE) \
+	(((NUMBER) + (BASE) - 1) & ~((BASE) - 1))
+
+#define iom \
+	size_t index  = bit >> 3; \
+	bit = bit - index * 8; \
+	size_t offset = bit & 7; \
+	size_t mask   = 1 << offset;
+
+/* The data size is always a multiple of 8 bytes, so whole words can
+ * be scanned without a partial word at the end. */
+#define WORDS(set) ((set)->size >> 2)
+
+void bitset_init(bitset_t *set, size_t size) {
+	set->size = CEIL(size, 8);
+	set->data = malloc(set->size);
+	set->hint = 0;
+	memset(set->data, 0, set->size);
+}
+
+void bitset_free(bitset_t *set) {
+	free(set->data);
+}
+
+static void bitset_resize(bitset_t *set, size_t size) {
+	if (set->size >= size) {
+		return;
+	}
+
+	size = CEIL(size, 8);
+	set->data = realloc(set->data, size);
+	memset(set->data + set->size, 0, size - set->size);
+	set->size = size;
+}
+
+void bitset_set(bitset_t *set, size_t bit) {
+	iom;
+	if (set->size <= index) {
+		bitset_resize(set, set->size << 1);
+	}
+	set->data[index] |= mask;
+}
+
+int bitset_ffub(bitset_t *set) {
+	/* No bit below the hint is unset, so the scan starts at its
+	 * word; full words cost one compare each and the winning word
+	 * gives up its bit to ctz instead of a bit-by-bit walk. */
+	uint32_t * words = (uint32_t *)set->data;
+	for (size_t i = set->hint >> 5; i < WORDS(set); i++) {
+		if (words[i] != 0xFFFFFFFF) {
+			size_t bit = (i << 5) + __builtin_ctz(~words[i]);
+			set->hint = bit;
+			return (int)bit;
+		}
+	}
+	return -1;
+}
+
+void bitset_clear(bitset_t *set, size_t bit) {
+	if (bit < set->hint) set->hint = bit;
+	iom;
+	set->data[index] &= ~mask;
+}
+
+int bitset_test(bitset_t *set, size_t bit) {
+	iom;
+	return !!(mask & set->data[index]);
+}
+
+void bitset_set_range(bitset_t *set, size_t bit, size_t count) {
+	if (!count) return;
+	size_t last = bit + count - 1;
+	if (set->size <= (last >> 3)) {
+		bitset_resize(set, (last >> 3) + 1);
+	}
+	/* Mask the ragged edges, memset the whole bytes between */
+	while (count && (bit & 7)) {
+		set->data[bit >> 3] |= 1 << (bit & 7);
+		bit++;
+		count--;
+	}
+	if (count >= 8) {
+		memset(&set->data[bit >> 3], 0xFF, count >> 3);
+		bit += count & ~(size_t)7;
+		count &= 7;
+	}
+	while (count--) {
+		set->data[bit >> 3] |= 1 << (bit & 7);
+		bit++;
+	}
+}
+
+void bitset_clear_range(bitset_t *set, size_t bit, size_t count) {
+	if (!count) return;
+	if (bit < set->hint) set->hint = bit;
+	while (count && (bit & 7)) {
+		set->data[bit >> 3] &= ~(1 << (bit & 7));
+		bit++;
+		count--;
+	}
+	if (count >= 8) {
+		memset(&set->data[bit >> 3], 0, count >> 3);
+		bit += count & ~(size_t)7;
+		count &= 7;
+	}
+	while (count--) {
+		set->data[bit >> 3] &= ~(1 << (bit & 7));
+		bit++;
+	}
+}
+
+size_t bitset_count(bitset_t *set) {
+	uint32_t * words = (uint32_t *)set->data;
+	size_t count = 0;
+	for (size_t i = 0; i < WORDS(set); i++) {
+		count += __builtin_popcount(words[i]);
+	}
+	return count;
+}
@@ -5,39 +5,42 @@
  *
  * ttk button widget
  */
+#include <string.h>
+#include <stdlib.h>
 #include <toaru/graphics.h>
 #include <toaru/button.h>
 #include <toaru/sdf.h>
 #include <toaru/icon_cache.h>
 
-void ttk_button_draw(gfx_context_t * ctx, struct TTKButton * button) {
-	if (button->width == 0) {
-		return;
-	}
-
+/*
+ * Render the button at the given offset. This is the full rendering
+ * path - gradients, sheen, label - and runs against the cache sprite,
+ * not the application's context.
+ */
+static void render_button(gfx_context_t * ctx, struct TTKButton * button, int x, int y) {
 	int hilight = button->hilight & 0xFF;
 	int disabled = button->hilight & 0x100;
 
 	/* Dark edge */
 	if (hilight < 3) {
-		struct gradient_definition edge = {button->height, button->y, rgb(166,166,166), rgb(136,136,136)};
-		draw_rounded_rectangle_pattern(ctx, button->x, button->y, button->width, button->height, 4, gfx_vertical_gradient_pattern, &edge);
+		struct gradient_definition edge = {button->height, y, rgb(166,166,166), rgb(136,136,136)};
+		draw_rounded_rectangle_pattern(ctx, x, y, button->width, button->height, 4, gfx_vertical_gradient_pattern, &edge);
 	}
 
 	/* Sheen */
 	if (hilight < 2) {
-		draw_rounded_rectangle(ctx, button->x + 1, button->y + 1, button->width - 2, button->height - 2, 3, rgb(238,238,238));
+		draw_rounded_rectangle(ctx, x + 1, y + 1, button->width - 2, button->height - 2, 3, rgb(238,238,238));
 	/* Button face - this should normally be a gradient */
 		if (hilight == 1) {
-			struct gradient_definition face = {button->height-3, button->y + 2, rgb(240,240,240), rgb(230,230,230)};
-			draw_rounded_rectangle_pattern(ctx, button->x + 2, button->y + 2, button->width - 4, button->height - 3, 2, gfx_vertical_gradient_pattern, &face);
+			struct gradient_definition face = {button->height-3, y + 2, rgb(240,240,240), rgb(230,230,230)};
+			draw_rounded_rectangle_pattern(ctx, x + 2, y + 2, button->width - 4, button->height - 3, 2, gfx_vertical_gradient_pattern, &face);
 		} else {
-			struct gradient_definition face = {button->height-3, button->y + 2, rgb(219,219,219), rgb(204,204,204)};
-			draw_rounded_rectangle_pattern(ctx, button->x + 2, button->y + 2, button->width - 4, button->height - 3, 2, gfx_vertical_gradient_pattern, &face);
+			struct gradient_definition face = {button->height-3, y + 2, rgb(219,219,219), rgb(204,204,204)};
+			draw_rounded_rectangle_pattern(ctx, x + 2, y + 2, button->width - 4, button->height - 3, 2, gfx_vertical_gradient_pattern, &face);
 		}
 	} else if (hilight == 2) {
-		struct gradient_definition face = {button->height-2, button->y + 1, rgb(180,180,180), rgb(160,160,160)};
-		draw_rounded_rectangle_pattern(ctx, button->x + 1, button->y + 1, button->width - 2, button->height - 2, 3, gfx_vertical_gradient_pattern, &face);
+		struct gradient_definition face = {button->height-2, y + 1, rgb(180,180,180), rgb(160,160,160)};
+		draw_rounded_rectangle_pattern(ctx, x + 1, y + 1, button->width - 2, button->height - 2, 3, gfx_vertical_gradient_pattern, &face);
 	}
 
 	if (button->title[0] != '\033') {
@@ -45,17 +48,51 @@ void ttk_button_draw(gfx_context_t * ctx, struct TTKButton * button) {
 		int centered = (button->width - label_width) / 2;
 
 		int centered_y = (button->height - 16) / 2;
-		draw_sdf_string(ctx, button->x + centered + (hilight == 2), button->y + centered_y + (hilight == 2), button->title, 16, disabled ? rgb(120,120,120) : rgb(0,0,0), SDF_FONT_THIN);
+		draw_sdf_string(ctx, x + centered + (hilight == 2), y + centered_y + (hilight == 2), button->title, 16, disabled ? rgb(120,120,120) : rgb(0,0,0), SDF_FONT_THIN);
 	} else {
 		sprite_t * icon = icon_get_16(button->title+1);
-		int centered = button->x + (button->width - icon->width) / 2 + (hilight == 2);
-		int centered_y = button->y + (button->height - icon->height) / 2 + (hilight == 2);
+		int centered = x + (button->width - icon->width) / 2 + (hilight == 2);
+		int centered_y = y + (button->height - icon->height) / 2 + (hilight == 2);
 		if (disabled) {
 			draw_sprite_alpha(ctx, icon, centered, centered_y, 0.5);
 		} else {
 			draw_sprite(ctx, icon, centered, centered_y);
 		}
 	}
-
 }
 
+/*
+ * Draw a button, reusing the cached rendering when nothing about its
+ * appearance changed. Returns 1 when the pixels differ from the
+ * previous draw - a hover or press costs one sprite blit, and the
+ * caller can hand the button's rectangle to yutani_flip_region instead
+ * of flipping the whole window.
+ */
+int ttk_button_draw(gfx_context_t * ctx, struct TTKButton * button) {
+	if (button->width == 0) {
+		return 0;
+	}
+
+	int changed = 0;
+
+	if (!button->_cache ||
+	    button->_cache->width != button->width ||
+	    button->_cache->height != button->height ||
+	    button->_cache_hilight != button->hilight ||
+	    !button->_cache_title || strcmp(button->_cache_title, button->title)) {
+		if (button->_cache) sprite_free(button->_cache);
+		button->_cache = create_sprite(button->width, button->height, ALPHA_EMBEDDED);
+		gfx_context_t * cctx = init_graphics_sprite(button->_cache);
+		draw_fill(cctx, rgba(0,0,0,0));
+		render_button(cctx, button, 0, 0);
+		free(cctx);
+
+		if (button->_cache_title) free(button->_cache_title);
+		button->_cache_title = strdup(button->title);
+		button->_cache_hilight = button->hilight;
+		changed = 1;
+	}
+
+	draw_sprite(ctx, button->_cache, button->x, button->y);
+	return changed;
+}
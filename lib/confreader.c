@@ -12,6 +12,7 @@
  * - [sections]
  */
 #include <stdio.h>
+#include <sys/stat.h>
 #include <toaru/hashmap.h>
 #include <toaru/confreader.h>
 
@@ -24,6 +25,21 @@ static void free_hashmap(void * h) {
 	free(h);
 }
 
+/* Values are interned in a process-wide table: repeated strings across
+ * sections and files share one allocation and live for the life of the
+ * process, so pointers handed out by confreader_get stay valid. */
+static hashmap_t * intern_table = NULL;
+
+static char * conf_intern(char * str) {
+	if (!intern_table) intern_table = hashmap_create(20);
+	char * interned = hashmap_get(intern_table, str);
+	if (!interned) {
+		interned = strdup(str);
+		hashmap_set(intern_table, str, interned);
+	}
+	return interned;
+}
+
 static int write_section(FILE * f, hashmap_t * section) {
 	list_t * keys = hashmap_keys(section);
 	foreach(node, keys) {
@@ -63,9 +79,48 @@ int confreader_write(confreader_t * config, const char * file) {
 confreader_t * confreader_create_empty(void) {
 	confreader_t * out = malloc(sizeof(confreader_t));
 	out->sections = hashmap_create(10);
+	out->shared = 0;
 	return out;
 }
 
+/* Shared parses are cached by path and reparsed only when the file's
+ * mtime changes; entries belong to the cache and outlive the caller. */
+struct conf_cache_entry {
+	confreader_t * conf;
+	uint32_t mtime;
+};
+
+static hashmap_t * conf_cache = NULL;
+
+confreader_t * confreader_get_shared(const char * file) {
+	struct stat statbuf;
+	if (stat(file, &statbuf) < 0) return NULL;
+
+	if (!conf_cache) conf_cache = hashmap_create(5);
+
+	struct conf_cache_entry * entry = hashmap_get(conf_cache, (void *)file);
+	if (entry && entry->mtime == statbuf.st_mtime) {
+		TRACE("serving %s from cache", file);
+		return entry->conf;
+	}
+
+	confreader_t * conf = confreader_load(file);
+	if (!conf) return NULL;
+	conf->shared = 1;
+
+	if (entry) {
+		entry->conf->shared = 0;
+		confreader_free(entry->conf);
+	} else {
+		entry = malloc(sizeof(struct conf_cache_entry));
+		hashmap_set(conf_cache, (void *)file, entry);
+	}
+	entry->conf = conf;
+	entry->mtime = statbuf.st_mtime;
+
+	return conf;
+}
+
 confreader_t * confreader_load(const char * file) {
 
 	FILE * f = fopen(file, "r");
@@ -139,7 +194,7 @@ confreader_t * confreader_load(const char * file) {
 				*foo = '\0';
 			}
 			TRACE("setting value %s to %s", tmp, tmp2);
-			hashmap_set(current_section, tmp, strdup(tmp2));
+			hashmap_set(current_section, tmp, conf_intern(tmp2));
 		}
 	}
 
@@ -151,6 +206,8 @@ confreader_t * confreader_load(const char * file) {
 }
 
 void confreader_free(confreader_t * conf) {
+	/* Shared parses belong to the cache */
+	if (conf->shared) return;
 	free_hashmap(conf->sections);
 	free(conf);
 }
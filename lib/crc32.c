@@ -0,0 +1,79 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ * This file is part of ToaruOS and is released under the terms
+ * of the NCSA / University of Illinois License - see LICENSE.md
+ *
+ * libtoaru_crc32: Shared CRC32 (polynomial 0xEDB88320)
+ *
+ * Slice-by-8: eight derived tables let the inner loop fold eight
+ * input bytes per step instead of one, which is several times
+ * faster than the classic one-table loop on long buffers. The
+ * tables are generated on first use rather than pasted in.
+ *
+ * Callers pass 0 as the initial crc and may chain calls over
+ * consecutive chunks of a stream; the pre/post inversion is
+ * handled internally.
+ */
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include <toaru/crc32.h>
+
+static uint32_t crc_tables[8][256];
+static int crc_tables_ready = 0;
+
+static void crc32_build_tables(void) {
+	for (int i = 0; i < 256; ++i) {
+		uint32_t c = i;
+		for (int j = 0; j < 8; ++j) {
+			c = (c >> 1) ^ ((c & 1) ? 0xEDB88320 : 0);
+		}
+		crc_tables[0][i] = c;
+	}
+	for (int k = 1; k < 8; ++k) {
+		for (int i = 0; i < 256; ++i) {
+			uint32_t c = crc_tables[k-1][i];
+			crc_tables[k][i] = (c >> 8) ^ crc_tables[0][c & 0xFF];
+		}
+	}
+	crc_tables_ready = 1;
+}
+
+uint32_t crc32_update(uint32_t crc, const void * data, size_t len) {
+	if (!crc_tables_ready) crc32_build_tables();
+
+	const uint8_t * p = data;
+	crc = ~crc;
+
+	while (len >= 8) {
+		uint32_t one = (p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24)) ^ crc;
+		uint32_t two =  p[4] | (p[5] << 8) | (p[6] << 16) | ((uint32_t)p[7] << 24);
+		crc = crc_tables[7][one & 0xFF] ^
+		      crc_tables[6][(one >> 8) & 0xFF] ^
+		      crc_tables[5][(one >> 16) & 0xFF] ^
+		      crc_tables[4][one >> 24] ^
+		      crc_tables[3][two & 0xFF] ^
+		      crc_tables[2][(two >> 8) & 0xFF] ^
+		      crc_tables[1][(two >> 16) & 0xFF] ^
+		      crc_tables[0][two >> 24];
+		p += 8;
+		len -= 8;
+	}
+
+	while (len--) {
+		crc = (crc >> 8) ^ crc_tables[0][(crc ^ *p++) & 0xFF];
+	}
+
+	return ~crc;
+}
+
+uint32_t crc32_file(FILE * f) {
+	static char buf[65536];
+	uint32_t crc = 0;
+	while (!feof(f)) {
+		size_t r = fread(buf, 1, sizeof(buf), f);
+		if (!r) break;
+		crc = crc32_update(crc, buf, r);
+	}
+	return crc;
+}
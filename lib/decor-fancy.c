@@ -9,16 +9,20 @@
  * many years ago.
  */
 #include <stdint.h>
+#include <string.h>
 #include <dlfcn.h>
 
 #include <toaru/yutani.h>
 #include <toaru/graphics.h>
+#include <toaru/hashmap.h>
 #include <toaru/decorations.h>
 #include <toaru/sdf.h>
+#include <toaru/spritepack.h>
 
 #define INACTIVE 10
 
 #define TTK_FANCY_PATH "/usr/share/ttk/"
+#define TTK_FANCY_PACK TTK_FANCY_PATH "fancy.pack"
 
 static int u_height = 33;
 static int ul_width = 10;
@@ -30,6 +34,23 @@ static int lr_width = 9;
 
 static sprite_t * sprites[20];
 
+/*
+ * Rendered decorations are cached per window and only re-rendered
+ * when something they depend on changes, so that damage events
+ * during a drag cost a few row copies instead of twenty sprite
+ * blits and a round of text layout.
+ */
+struct render_cache {
+	uint32_t width;
+	uint32_t height;
+	uint32_t flags;
+	int active;
+	char * title;
+	sprite_t * rendered;
+};
+
+static hashmap_t * render_caches = NULL;
+
 #define TEXT_OFFSET ((window->decorator_flags & DECOR_FLAG_TILED) ? 5 : 10)
 #define BUTTON_OFFSET ((window->decorator_flags & DECOR_FLAG_TILED) ? 5 : 0)
 
@@ -63,7 +84,7 @@ static int get_bounds_fancy(yutani_window_t * window, struct decor_bounds * boun
 	return 0;
 }
 
-static void render_decorations_fancy(yutani_window_t * window, gfx_context_t * ctx, char * title, int decors_active) {
+static void render_decorations_fancy_raw(yutani_window_t * window, gfx_context_t * ctx, char * title, int decors_active) {
 	int width = window->width;
 	int height = window->height;
 
@@ -183,6 +204,66 @@ static void render_decorations_fancy(yutani_window_t * window, gfx_context_t * c
 	}
 }
 
+static void render_decorations_fancy(yutani_window_t * window, gfx_context_t * ctx, char * title, int decors_active) {
+	struct render_cache * cache = hashmap_get(render_caches, (void*)(uintptr_t)window->wid);
+
+	if (!cache) {
+		cache = calloc(1, sizeof(struct render_cache));
+		hashmap_set(render_caches, (void*)(uintptr_t)window->wid, cache);
+	}
+
+	if (!cache->rendered ||
+		cache->width != window->width || cache->height != window->height ||
+		cache->flags != window->decorator_flags || cache->active != decors_active ||
+		!cache->title || strcmp(cache->title, title)) {
+
+		/* Render the decorations once at full window size... */
+		if (cache->rendered && (cache->width != window->width || cache->height != window->height)) {
+			sprite_free(cache->rendered);
+			cache->rendered = NULL;
+		}
+		if (!cache->rendered) {
+			cache->rendered = create_sprite(window->width, window->height, ALPHA_EMBEDDED);
+		}
+		if (cache->title) free(cache->title);
+
+		cache->width  = window->width;
+		cache->height = window->height;
+		cache->flags  = window->decorator_flags;
+		cache->active = decors_active;
+		cache->title  = strdup(title);
+
+		gfx_context_t * cache_ctx = init_graphics_sprite(cache->rendered);
+		render_decorations_fancy_raw(window, cache_ctx, title, decors_active);
+		free(cache_ctx);
+	}
+
+	/* ... then a repaint is just copying the border rectangles. */
+	struct decor_bounds bounds;
+	get_bounds_fancy(window, &bounds);
+
+	sprite_t * r = cache->rendered;
+	int width = window->width;
+	int height = window->height;
+
+	for (int j = 0; j < (int)bounds.top_height; ++j) {
+		memcpy(&GFX(ctx,0,j), &SPRITE(r,0,j), width * sizeof(uint32_t));
+	}
+	for (int j = height - (int)bounds.bottom_height; j < height; ++j) {
+		memcpy(&GFX(ctx,0,j), &SPRITE(r,0,j), width * sizeof(uint32_t));
+	}
+	if (bounds.left_width || bounds.right_width) {
+		for (int j = (int)bounds.top_height; j < height - (int)bounds.bottom_height; ++j) {
+			if (bounds.left_width) {
+				memcpy(&GFX(ctx,0,j), &SPRITE(r,0,j), bounds.left_width * sizeof(uint32_t));
+			}
+			if (bounds.right_width) {
+				memcpy(&GFX(ctx,width-(int)bounds.right_width,j), &SPRITE(r,width-(int)bounds.right_width,j), bounds.right_width * sizeof(uint32_t));
+			}
+		}
+	}
+}
+
 static int check_button_press_fancy(yutani_window_t * window, int x, int y) {
 	if (x >= (int)window->width - 28 + BUTTON_OFFSET && x <= (int)window->width - 18 + BUTTON_OFFSET &&
 		y >= 16 && y <= 26) {
@@ -200,6 +281,21 @@ static int check_button_press_fancy(yutani_window_t * window, int x, int y) {
 }
 
 void decor_init() {
+	render_caches = hashmap_create_int(10);
+
+	/* The theme pack holds the same pixels pre-decoded; fall back
+	 * to the individual PNGs if the image was built without one. */
+	void * pack = spritepack_open(TTK_FANCY_PACK);
+	if (pack && spritepack_count(pack) >= 2 * INACTIVE) {
+		for (int i = 0; i < INACTIVE; ++i) {
+			sprites[i] = malloc(sizeof(sprite_t));
+			spritepack_sprite(pack, i, sprites[i]);
+			sprites[INACTIVE + i] = malloc(sizeof(sprite_t));
+			spritepack_sprite(pack, INACTIVE + i, sprites[INACTIVE + i]);
+		}
+		goto sprites_loaded;
+	}
+
 	init_sprite(0, TTK_FANCY_PATH "active/ul.png");
 	init_sprite(1, TTK_FANCY_PATH "active/um.png");
 	init_sprite(2, TTK_FANCY_PATH "active/ur.png");
@@ -222,6 +318,7 @@ void decor_init() {
 	init_sprite(INACTIVE + 8, TTK_FANCY_PATH "inactive/button-close.png");
 	init_sprite(INACTIVE + 9, TTK_FANCY_PATH "inactive/button-maximize.png");
 
+sprites_loaded:
 	decor_render_decorations = render_decorations_fancy;
 	decor_check_button_press = check_button_press_fancy;
 	decor_get_bounds = get_bounds_fancy;
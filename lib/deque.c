@@ -0,0 +1,134 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ * This file is part of ToaruOS and is released under the terms
+ * of the NCSA / University of Illinois License - see LICENSE.md
+ * Copyright (C) 2018 K. Lange
+ *
+ * Indexed double-ended queue.
+ *
+ * This file is shared with kernel/ds/deque.c; keep the two in sync.
+ */
+
+#ifdef _KERNEL_
+#	include <kernel/system.h>
+#else
+#	include <stddef.h>
+#	include <stdlib.h>
+#	include <string.h>
+#endif
+
+#include <toaru/deque.h>
+
+#define DEQUE_INITIAL_CAPACITY 8
+
+/* Physical slot of logical index i */
+static size_t deque_slot(deque_t * deque, size_t index) {
+	return (deque->head + index) & (deque->capacity - 1);
+}
+
+static void deque_grow(deque_t * deque) {
+	size_t capacity = deque->capacity * 2;
+	void ** items = malloc(sizeof(void *) * capacity);
+
+	/* Unroll the ring so element 0 lands in slot 0 */
+	size_t tail = deque->capacity - deque->head;
+	if (tail > deque->length) tail = deque->length;
+	memcpy(items, &deque->items[deque->head], sizeof(void *) * tail);
+	memcpy(&items[tail], deque->items, sizeof(void *) * (deque->length - tail));
+
+	free(deque->items);
+	deque->items = items;
+	deque->capacity = capacity;
+	deque->head = 0;
+}
+
+deque_t * deque_create(void) {
+	deque_t * deque = malloc(sizeof(deque_t));
+	deque->capacity = DEQUE_INITIAL_CAPACITY;
+	deque->items = malloc(sizeof(void *) * deque->capacity);
+	deque->head = 0;
+	deque->length = 0;
+	return deque;
+}
+
+void deque_push_back(deque_t * deque, void * item) {
+	if (deque->length == deque->capacity) deque_grow(deque);
+	deque->items[deque_slot(deque, deque->length)] = item;
+	deque->length++;
+}
+
+void deque_push_front(deque_t * deque, void * item) {
+	if (deque->length == deque->capacity) deque_grow(deque);
+	deque->head = (deque->head - 1) & (deque->capacity - 1);
+	deque->items[deque->head] = item;
+	deque->length++;
+}
+
+void * deque_pop_back(deque_t * deque) {
+	if (!deque->length) return NULL;
+	deque->length--;
+	return deque->items[deque_slot(deque, deque->length)];
+}
+
+void * deque_pop_front(deque_t * deque) {
+	if (!deque->length) return NULL;
+	void * item = deque->items[deque->head];
+	deque->head = (deque->head + 1) & (deque->capacity - 1);
+	deque->length--;
+	return item;
+}
+
+void * deque_index(deque_t * deque, size_t index) {
+	if (index >= deque->length) return NULL;
+	return deque->items[deque_slot(deque, index)];
+}
+
+void deque_set(deque_t * deque, size_t index, void * item) {
+	if (index >= deque->length) return;
+	deque->items[deque_slot(deque, index)] = item;
+}
+
+void deque_insert(deque_t * deque, size_t index, void * item) {
+	if (index >= deque->length) {
+		deque_push_back(deque, item);
+		return;
+	}
+	if (deque->length == deque->capacity) deque_grow(deque);
+
+	if (index < deque->length - index) {
+		/* Shift the front down one slot */
+		deque->head = (deque->head - 1) & (deque->capacity - 1);
+		for (size_t i = 0; i < index; ++i) {
+			deque->items[deque_slot(deque, i)] = deque->items[deque_slot(deque, i + 1)];
+		}
+	} else {
+		/* Shift the back up one slot */
+		for (size_t i = deque->length; i > index; --i) {
+			deque->items[deque_slot(deque, i)] = deque->items[deque_slot(deque, i - 1)];
+		}
+	}
+	deque->items[deque_slot(deque, index)] = item;
+	deque->length++;
+}
+
+void * deque_remove(deque_t * deque, size_t index) {
+	if (index >= deque->length) return NULL;
+	void * item = deque->items[deque_slot(deque, index)];
+
+	if (index < deque->length - index) {
+		for (size_t i = index; i > 0; --i) {
+			deque->items[deque_slot(deque, i)] = deque->items[deque_slot(deque, i - 1)];
+		}
+		deque->head = (deque->head + 1) & (deque->capacity - 1);
+	} else {
+		for (size_t i = index; i < deque->length - 1; ++i) {
+			deque->items[deque_slot(deque, i)] = deque->items[deque_slot(deque, i + 1)];
+		}
+	}
+	deque->length--;
+	return item;
+}
+
+void deque_free(deque_t * deque) {
+	free(deque->items);
+	free(deque);
+}
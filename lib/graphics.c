@@ -85,6 +85,38 @@ void flip(gfx_context_t * ctx) {
 	} else {
 		memcpy(ctx->buffer, ctx->backbuffer, ctx->size);
 	}
+	/* The framebuffer is mapped write-combining, so push any stores
+	 * still sitting in the WC buffers out to the display. */
+	asm volatile ("sfence" ::: "memory");
+}
+
+/**
+ * Present only the given rectangles from the backbuffer.
+ *
+ * Each rectangle is clamped to the context and copied one row segment
+ * at a time, so a typical frame writes just the pixels that changed
+ * instead of streaming the whole backbuffer out to video memory.
+ */
+void flip_regions(gfx_context_t * ctx, gfx_rect_t * rects, size_t count) {
+	for (size_t i = 0; i < count; ++i) {
+		int32_t x = rects[i].x;
+		int32_t y = rects[i].y;
+		int32_t w = rects[i].width;
+		int32_t h = rects[i].height;
+
+		if (x < 0) { w += x; x = 0; }
+		if (y < 0) { h += y; y = 0; }
+		if (x + w > (int32_t)ctx->width)  w = ctx->width - x;
+		if (y + h > (int32_t)ctx->height) h = ctx->height - y;
+		if (w <= 0 || h <= 0) continue;
+
+		for (int32_t row = y; row < y + h; ++row) {
+			memcpy(&ctx->buffer[row * GFX_S(ctx) + x * 4],
+			       &ctx->backbuffer[row * GFX_S(ctx) + x * 4],
+			       w * 4);
+		}
+	}
+	asm volatile ("sfence" ::: "memory");
 }
 
 void clearbuffer(gfx_context_t * ctx) {
@@ -290,9 +322,16 @@ static void _box_blur_horizontal(gfx_context_t * _src, int radius) {
 	int w = _src->width;
 	int h = _src->height;
 	int half_radius = radius / 2;
+	if (half_radius < 1) return; /* The window is a single pixel. */
+#ifndef NO_SSE
+	/* Channel sums need to fit in 16-bit lanes. */
+	if (half_radius > 127) half_radius = 127;
+#endif
 	uint32_t * out_color = calloc(sizeof(uint32_t), w);
 
 	for (int y = 0; y < h; y++) {
+		if (!_is_in_clip(_src, y)) continue;
+#ifdef NO_SSE
 		int hits = 0;
 		int r = 0;
 		int g = 0;
@@ -328,11 +367,39 @@ static void _box_blur_horizontal(gfx_context_t * _src, int radius) {
 				out_color[x] = rgba(r / hits, g / hits, b / hits, a / hits);
 			}
 		}
+#else
+		/* All four channel sums live in 16-bit lanes of one register;
+		 * the per-pixel divide becomes a multiply by 65536/hits, which
+		 * only needs recomputing near the edges where hits changes. */
+		__m128i acc = _mm_setzero_si128();
+		__m128i recip = _mm_setzero_si128();
+		int hits = 0;
+		int last_hits = -1;
+		for (int x = -half_radius; x < w; x++) {
+			int old_p = x - half_radius - 1;
+			if (old_p >= 0) {
+				__m128i col = _mm_unpacklo_epi8(_mm_cvtsi32_si128(GFX(_src, old_p, y)), _mm_setzero_si128());
+				acc = _mm_sub_epi16(acc, col);
+				hits--;
+			}
 
-		if (!_is_in_clip(_src, y)) continue;
-		for (int x = 0; x < w; x++) {
-			GFX(_src,x,y) = out_color[x];
+			int newPixel = x + half_radius;
+			if (newPixel < w) {
+				__m128i col = _mm_unpacklo_epi8(_mm_cvtsi32_si128(GFX(_src, newPixel, y)), _mm_setzero_si128());
+				acc = _mm_add_epi16(acc, col);
+				hits++;
+			}
+
+			if (x >= 0) {
+				if (hits != last_hits) {
+					recip = _mm_set1_epi16((65536 + hits - 1) / hits);
+					last_hits = hits;
+				}
+				out_color[x] = _mm_cvtsi128_si32(_mm_packus_epi16(_mm_mulhi_epu16(acc, recip), _mm_setzero_si128()));
+			}
 		}
+#endif
+		memcpy(&GFX(_src,0,y), out_color, sizeof(uint32_t) * w);
 	}
 
 	free(out_color);
@@ -342,56 +409,156 @@ static void _box_blur_vertical(gfx_context_t * _src, int radius) {
 	int w = _src->width;
 	int h = _src->height;
 	int half_radius = radius / 2;
+	if (half_radius < 1) return; /* The window is a single pixel. */
+#ifndef NO_SSE
+	/* Channel sums need to fit in 16-bit lanes. */
+	if (half_radius > 127) half_radius = 127;
+#endif
 
-	uint32_t * out_color = calloc(sizeof(uint32_t), h);
+	/*
+	 * This pass walks rows, not columns, so that memory access stays
+	 * sequential: one channel accumulator per column slides down the
+	 * image. Output rows are written in place, so original rows are
+	 * saved in a small ring until they fall out of the window and get
+	 * subtracted from the accumulators.
+	 */
+	int ring = half_radius + 2;
+	uint32_t * saved = malloc(sizeof(uint32_t) * w * ring);
+#ifdef NO_SSE
+	int * acc = calloc(sizeof(int), w * 4);
+#else
+	uint16_t * acc = calloc(sizeof(uint16_t), w * 4);
+#endif
+	int hits = 0;
 
-	for (int x = 0; x < w; x++) {
-		int hits = 0;
-		int r = 0;
-		int g = 0;
-		int b = 0;
-		int a = 0;
-		for (int y = -half_radius; y < h; y++) {
-			int old_p = y - half_radius - 1;
-			if (old_p >= 0) {
-				uint32_t col = GFX(_src,x,clamp(old_p,0,h-1));
-				if (col != 0) {
-					r -= _RED(col);
-					g -= _GRE(col);
-					b -= _BLU(col);
-					a -= _ALP(col);
-				}
-				hits--;
+	for (int y = -half_radius; y < h; y++) {
+		int old_p = y - half_radius - 1;
+		if (old_p >= 0) {
+			uint32_t * row = &saved[(old_p % ring) * w];
+#ifdef NO_SSE
+			for (int x = 0; x < w; x++) {
+				uint32_t col = row[x];
+				acc[x*4+0] -= _RED(col);
+				acc[x*4+1] -= _GRE(col);
+				acc[x*4+2] -= _BLU(col);
+				acc[x*4+3] -= _ALP(col);
 			}
-
-			int newPixel = y + half_radius;
-			if (newPixel < h) {
-				uint32_t col = GFX(_src,x,clamp(newPixel,0,h-1));
-				if (col != 0)
-				{
-					r += _RED(col);
-					g += _GRE(col);
-					b += _BLU(col);
-					a += _ALP(col);
-				}
-				hits++;
+#else
+			int x = 0;
+			for (; x < w - 1; x += 2) {
+				__m128i col = _mm_unpacklo_epi8(_mm_loadl_epi64((void *)&row[x]), _mm_setzero_si128());
+				_mm_storeu_si128((void *)&acc[x*4], _mm_sub_epi16(_mm_loadu_si128((void *)&acc[x*4]), col));
+			}
+			for (; x < w; x++) {
+				uint32_t col = row[x];
+				acc[x*4+0] -= _RED(col);
+				acc[x*4+1] -= _GRE(col);
+				acc[x*4+2] -= _BLU(col);
+				acc[x*4+3] -= _ALP(col);
 			}
+#endif
+			hits--;
+		}
 
-			if (y >= 0 && y < h) {
-				out_color[y] = rgba(r / hits, g / hits, b / hits, a / hits);
+		int newPixel = y + half_radius;
+		if (newPixel < h) {
+#ifdef NO_SSE
+			for (int x = 0; x < w; x++) {
+				uint32_t col = GFX(_src, x, newPixel);
+				acc[x*4+0] += _RED(col);
+				acc[x*4+1] += _GRE(col);
+				acc[x*4+2] += _BLU(col);
+				acc[x*4+3] += _ALP(col);
+			}
+#else
+			int x = 0;
+			for (; x < w - 1; x += 2) {
+				__m128i col = _mm_unpacklo_epi8(_mm_loadl_epi64((void *)&GFX(_src, x, newPixel)), _mm_setzero_si128());
+				_mm_storeu_si128((void *)&acc[x*4], _mm_add_epi16(_mm_loadu_si128((void *)&acc[x*4]), col));
 			}
+			for (; x < w; x++) {
+				uint32_t col = GFX(_src, x, newPixel);
+				acc[x*4+0] += _RED(col);
+				acc[x*4+1] += _GRE(col);
+				acc[x*4+2] += _BLU(col);
+				acc[x*4+3] += _ALP(col);
+			}
+#endif
+			hits++;
 		}
 
-		for (int y = 0; y < h; y++) {
+		if (y >= 0) {
+			/* Keep the original row around for the subtraction side. */
+			memcpy(&saved[(y % ring) * w], &GFX(_src,0,y), sizeof(uint32_t) * w);
 			if (!_is_in_clip(_src, y)) continue;
-			GFX(_src,x,y) = out_color[y];
+#ifdef NO_SSE
+			for (int x = 0; x < w; x++) {
+				GFX(_src,x,y) = rgba(acc[x*4+0] / hits, acc[x*4+1] / hits, acc[x*4+2] / hits, acc[x*4+3] / hits);
+			}
+#else
+			__m128i recip = _mm_set1_epi16((65536 + hits - 1) / hits);
+			int x = 0;
+			for (; x < w - 1; x += 2) {
+				__m128i avg = _mm_mulhi_epu16(_mm_loadu_si128((void *)&acc[x*4]), recip);
+				_mm_storel_epi64((void *)&GFX(_src,x,y), _mm_packus_epi16(avg, _mm_setzero_si128()));
+			}
+			for (; x < w; x++) {
+				GFX(_src,x,y) = rgba(acc[x*4+0] / hits, acc[x*4+1] / hits, acc[x*4+2] / hits, acc[x*4+3] / hits);
+			}
+#endif
 		}
 	}
 
-	free(out_color);
+	free(acc);
+	free(saved);
+}
+
+/* Average two colors without splitting out the channels. */
+static inline uint32_t _avg2(uint32_t a, uint32_t b) {
+	return (a & b) + (((a ^ b) & 0xFEFEFEFE) >> 1);
 }
 
 void blur_context_box(gfx_context_t * _src, int radius) {
+	/*
+	 * Large radii get the classic shortcut: box-downsample to half
+	 * resolution, blur that with half the radius, and interpolate the
+	 * result back up. The upscale's softness is hidden by the blur
+	 * itself, and each halving quarters the work. Clipped contexts
+	 * take the direct path since the copy ignores the clip list.
+	 */
+	if (radius > 16 && !_src->clips && _src->width >= 2 && _src->height >= 2) {
+		int hw = _src->width / 2;
+		int hh = _src->height / 2;
+		sprite_t * half = create_sprite(hw, hh, ALPHA_EMBEDDED);
+		gfx_context_t * half_ctx = init_graphics_sprite(half);
+
+		for (int y = 0; y < hh; y++) {
+			for (int x = 0; x < hw; x++) {
+				GFX(half_ctx,x,y) = _avg2(
+					_avg2(GFX(_src,x*2,y*2),   GFX(_src,x*2+1,y*2)),
+					_avg2(GFX(_src,x*2,y*2+1), GFX(_src,x*2+1,y*2+1)));
+			}
+		}
+
+		blur_context_box(half_ctx, radius / 2);
+
+		for (int y = 0; y < (int)_src->height; y++) {
+			int sy = min(y / 2, hh - 1);
+			int ty = min(sy + (y & 1), hh - 1);
+			for (int x = 0; x < (int)_src->width; x++) {
+				int sx = min(x / 2, hw - 1);
+				int tx = min(sx + (x & 1), hw - 1);
+				GFX(_src,x,y) = _avg2(
+					_avg2(GFX(half_ctx,sx,sy), GFX(half_ctx,tx,sy)),
+					_avg2(GFX(half_ctx,sx,ty), GFX(half_ctx,tx,ty)));
+			}
+		}
+
+		free(half_ctx);
+		sprite_free(half);
+		return;
+	}
+
 	_box_blur_horizontal(_src,radius);
 	_box_blur_vertical(_src,radius);
 }
@@ -756,12 +923,30 @@ void draw_line_thick(gfx_context_t * ctx, int32_t x0, int32_t x1, int32_t y0, in
 }
 
 
+__attribute__((__force_align_arg_pointer__))
 void draw_fill(gfx_context_t * ctx, uint32_t color) {
+#ifdef NO_SSE
 	for (uint16_t y = 0; y < ctx->height; ++y) {
 		for (uint16_t x = 0; x < ctx->width; ++x) {
 			GFX(ctx, x, y) = color;
 		}
 	}
+#else
+	__m128i c = _mm_set1_epi32(color);
+	for (uint16_t y = 0; y < ctx->height; ++y) {
+		uint16_t x = 0;
+		/* Ensure alignment */
+		for (; x < ctx->width && ((uintptr_t)&GFX(ctx, x, y) & 15); ++x) {
+			GFX(ctx, x, y) = color;
+		}
+		for (; x < ctx->width - 3; x += 4) {
+			_mm_store_si128((void *)&GFX(ctx, x, y), c);
+		}
+		for (; x < ctx->width; ++x) {
+			GFX(ctx, x, y) = color;
+		}
+	}
+#endif
 }
 
 /* Bilinear filtering from Wikipedia */
@@ -794,33 +979,91 @@ uint32_t getBilinearFilteredPixelColor(sprite_t * tex, double u, double v) {
 	return rgb(r_RED,r_GRE,r_BLU) & (0xFFFFFF + ((uint32_t)r_ALP << 24));
 }
 
+/*
+ * Sample a 2x2 texel quad with 8-bit filter weights.
+ *
+ * The four texels land in 16-bit lanes; each axis is a weighted sum
+ * with the weight pair summing to 256, shifting back down after each.
+ */
+static inline uint32_t gfx_bilinear_sample(uint32_t t00, uint32_t t01, uint32_t t10, uint32_t t11, int fx, int fy) {
+#ifdef NO_SSE
+	return interp_colors(interp_colors(t00, t01, fx), interp_colors(t10, t11, fx), fy);
+#else
+	__m128i wx  = _mm_set_epi16(fx,fx,fx,fx, 256-fx,256-fx,256-fx,256-fx);
+	__m128i top = _mm_unpacklo_epi8(_mm_set_epi32(0, 0, t01, t00), _mm_setzero_si128());
+	__m128i bot = _mm_unpacklo_epi8(_mm_set_epi32(0, 0, t11, t10), _mm_setzero_si128());
+
+	top = _mm_srli_epi16(_mm_mullo_epi16(top, wx), 8);
+	bot = _mm_srli_epi16(_mm_mullo_epi16(bot, wx), 8);
+
+	/* Fold the two weighted texels of each row together */
+	top = _mm_add_epi16(top, _mm_srli_si128(top, 8));
+	bot = _mm_add_epi16(bot, _mm_srli_si128(bot, 8));
+
+	__m128i out = _mm_add_epi16(
+		_mm_srli_epi16(_mm_mullo_epi16(top, _mm_set1_epi16(256-fy)), 8),
+		_mm_srli_epi16(_mm_mullo_epi16(bot, _mm_set1_epi16(fy)), 8));
+
+	return _mm_cvtsi128_si32(_mm_packus_epi16(out, _mm_setzero_si128()));
+#endif
+}
+
+__attribute__((__force_align_arg_pointer__))
 void draw_sprite_scaled(gfx_context_t * ctx, sprite_t * sprite, int32_t x, int32_t y, uint16_t width, uint16_t height) {
+	if (!width || !height) return;
+
+	/* A 1:1 blit doesn't need to sample at all. */
+	if (width == sprite->width && height == sprite->height) {
+		draw_sprite(ctx, sprite, x, y);
+		return;
+	}
+
 	int32_t _left   = max(x, 0);
 	int32_t _top    = max(y, 0);
 	int32_t _right  = min(x + width,  ctx->width - 1);
 	int32_t _bottom = min(y + height, ctx->height - 1);
+
+	/* 16.16 fixed-point source steps */
+	uint32_t du = ((uint32_t)sprite->width << 16) / width;
+	uint32_t dv = ((uint32_t)sprite->height << 16) / height;
+
 	for (uint16_t _y = 0; _y < height; ++_y) {
 		if (!_is_in_clip(ctx, y + _y)) continue;
-		for (uint16_t _x = 0; _x < width; ++_x) {
-			if (x + _x < _left || x + _x > _right || y + _y < _top || y + _y > _bottom)
-				continue;
+		if (y + _y < _top || y + _y > _bottom) continue;
+		uint32_t v = _y * dv;
+		int sy = v >> 16;
+		int ty = min(sy + 1, sprite->height - 1);
+		int fy = (v >> 8) & 0xFF;
+		uint32_t u = 0;
+		for (uint16_t _x = 0; _x < width; ++_x, u += du) {
+			if (x + _x < _left || x + _x > _right) continue;
+			int sx = u >> 16;
+			int tx = min(sx + 1, sprite->width - 1);
+			int fx = (u >> 8) & 0xFF;
+			uint32_t n_color = gfx_bilinear_sample(
+				SPRITE(sprite, sx, sy), SPRITE(sprite, tx, sy),
+				SPRITE(sprite, sx, ty), SPRITE(sprite, tx, ty), fx, fy);
 			if (sprite->alpha > 0) {
-				uint32_t n_color = getBilinearFilteredPixelColor(sprite, (double)_x / (double)width, (double)_y/(double)height);
 				GFX(ctx, x + _x, y + _y) = alpha_blend_rgba(GFX(ctx, x + _x, y + _y), n_color);
 			} else {
-				GFX(ctx, x + _x, y + _y) = getBilinearFilteredPixelColor(sprite, (double)_x / (double)width, (double)_y/(double)height);
+				GFX(ctx, x + _x, y + _y) = n_color;
 			}
 		}
 	}
 }
 
+__attribute__((__force_align_arg_pointer__))
 void draw_sprite_alpha(gfx_context_t * ctx, sprite_t * sprite, int32_t x, int32_t y, float alpha) {
 	int32_t _left   = max(x, 0);
 	int32_t _top    = max(y, 0);
 	int32_t _right  = min(x + sprite->width,  ctx->width - 1);
 	int32_t _bottom = min(y + sprite->height, ctx->height - 1);
+#ifndef NO_SSE
+	__m128i scale = _mm_set1_epi16((uint16_t)(255 * alpha));
+#endif
 	for (uint16_t _y = 0; _y < sprite->height; ++_y) {
 		if (!_is_in_clip(ctx, y + _y)) continue;
+#ifdef NO_SSE
 		for (uint16_t _x = 0; _x < sprite->width; ++_x) {
 			if (x + _x < _left || x + _x > _right || y + _y < _top || y + _y > _bottom)
 				continue;
@@ -829,6 +1072,76 @@ void draw_sprite_alpha(gfx_context_t * ctx, sprite_t * sprite, int32_t x, int32_
 			f_color = (f_color & 0xFFFFFF) | ((uint32_t)(alpha * _ALP(n_color)) << 24);
 			GFX(ctx, x + _x, y + _y) = alpha_blend_rgba(GFX(ctx, x + _x, y + _y), f_color);
 		}
+#else
+		uint16_t _x = 0;
+
+		/* Ensure alignment */
+		for (; _x < sprite->width; ++_x) {
+			if (x + _x < _left || x + _x > _right || y + _y < _top || y + _y > _bottom)
+				continue;
+			if (!((uintptr_t)&GFX(ctx, x + _x, y + _y) & 15))
+				break;
+			uint32_t n_color = SPRITE(sprite, _x, _y);
+			uint32_t f_color = premultiply((n_color & 0xFFFFFF) | ((uint32_t)(255 * alpha) << 24));
+			f_color = (f_color & 0xFFFFFF) | ((uint32_t)(alpha * _ALP(n_color)) << 24);
+			GFX(ctx, x + _x, y + _y) = alpha_blend_rgba(GFX(ctx, x + _x, y + _y), f_color);
+		}
+		for (; _x < sprite->width - 3; _x += 4) {
+			if (x + _x < _left || y + _y < _top || y + _y > _bottom) {
+				continue;
+			}
+			if (x + _x + 3 > _right)
+				break;
+
+			__m128i d = _mm_load_si128((void *)&GFX(ctx, x + _x, y + _y));
+			__m128i s = _mm_loadu_si128((void *)&SPRITE(sprite, _x, _y));
+
+			__m128i d_l, d_h;
+			__m128i s_l, s_h;
+
+			// unpack destination
+			d_l = _mm_unpacklo_epi8(d, _mm_setzero_si128());
+			d_h = _mm_unpackhi_epi8(d, _mm_setzero_si128());
+
+			// unpack source
+			s_l = _mm_unpacklo_epi8(s, _mm_setzero_si128());
+			s_h = _mm_unpackhi_epi8(s, _mm_setzero_si128());
+
+			// scale all four source channels by the global alpha
+			s_l = _mm_mulhi_epu16(_mm_adds_epu16(_mm_mullo_epi16(s_l,scale),mask0080),mask0101);
+			s_h = _mm_mulhi_epu16(_mm_adds_epu16(_mm_mullo_epi16(s_h,scale),mask0080),mask0101);
+
+			__m128i a_l, a_h;
+			__m128i t_l, t_h;
+
+			// extract scaled source alpha RGBA → AAAA
+			a_l = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s_l, _MM_SHUFFLE(3,3,3,3)), _MM_SHUFFLE(3,3,3,3));
+			a_h = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s_h, _MM_SHUFFLE(3,3,3,3)), _MM_SHUFFLE(3,3,3,3));
+
+			// negate source alpha
+			t_l = _mm_xor_si128(a_l, mask00ff);
+			t_h = _mm_xor_si128(a_h, mask00ff);
+
+			// apply source alpha to destination
+			d_l = _mm_mulhi_epu16(_mm_adds_epu16(_mm_mullo_epi16(d_l,t_l),mask0080),mask0101);
+			d_h = _mm_mulhi_epu16(_mm_adds_epu16(_mm_mullo_epi16(d_h,t_h),mask0080),mask0101);
+
+			// combine source and destination
+			d_l = _mm_adds_epu8(s_l,d_l);
+			d_h = _mm_adds_epu8(s_h,d_h);
+
+			// pack low + high and write back to memory
+			_mm_storeu_si128((void*)&GFX(ctx, x + _x, y + _y), _mm_packus_epi16(d_l,d_h));
+		}
+		for (; _x < sprite->width; ++_x) {
+			if (x + _x < _left || x + _x > _right || y + _y < _top || y + _y > _bottom)
+				continue;
+			uint32_t n_color = SPRITE(sprite, _x, _y);
+			uint32_t f_color = premultiply((n_color & 0xFFFFFF) | ((uint32_t)(255 * alpha) << 24));
+			f_color = (f_color & 0xFFFFFF) | ((uint32_t)(alpha * _ALP(n_color)) << 24);
+			GFX(ctx, x + _x, y + _y) = alpha_blend_rgba(GFX(ctx, x + _x, y + _y), f_color);
+		}
+#endif
 	}
 }
 
@@ -5,18 +5,40 @@
  *
  * icon_cache - caches icons
  *
- * Used be a few different applications.
- * Probably needs scaling?
+ * Used by a few different applications.
+ *
+ * Icons are decoded and scaled to each requested size exactly once,
+ * system-wide: the baked pixels live in named shared memory segments,
+ * so the panel, menus and file browser all map the same copy instead
+ * of each decoding the same files and rescaling them at paint time.
  */
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/shm.h>
 
 #include <toaru/graphics.h>
 #include <toaru/hashmap.h>
 
+/* Layout of a baked icon in its shared memory segment */
+struct icon_shm {
+	uint32_t magic;
+	uint16_t width;
+	uint16_t height;
+	uint8_t  alpha;
+	uint32_t ready;     /* Written last, after the pixels are in place */
+	uint32_t pixels[];
+};
+
+#define ICON_SHM_MAGIC 0x4e4f4349 /* 'ICON' */
+#define ICON_SHM_READY 0x59444152 /* 'RADY' */
+
+/* Per-process maps of icon name → shared sprite, one per size */
 static hashmap_t * icon_cache_16;
+static hashmap_t * icon_cache_24;
+static hashmap_t * icon_cache_32;
 static hashmap_t * icon_cache_48;
 
 static char * icon_directories_16[] = {
@@ -28,6 +50,15 @@ static char * icon_directories_16[] = {
 	NULL
 };
 
+static char * icon_directories_24[] = {
+	"/usr/share/icons/24",
+	"/usr/share/icons/48",
+	"/usr/share/icons/16",
+	"/usr/share/icons",
+	"/usr/share/icons/external",
+	NULL
+};
+
 static char * icon_directories_48[] = {
 	"/usr/share/icons/48",
 	"/usr/share/icons/24",
@@ -43,25 +74,81 @@ static char * prefixes[] = {
 	NULL
 };
 
-__attribute__((constructor))
-static void _init_caches(void) {
-	icon_cache_16 = hashmap_create(10);
-	{ /* Generic fallback icon */
-		sprite_t * app_icon = malloc(sizeof(sprite_t));
-		load_sprite(app_icon, "/usr/share/icons/16/applications-generic.png");
-		hashmap_set(icon_cache_16, "generic", app_icon);
+/**
+ * Wrap the pixels of a baked segment in a sprite we can hand to the
+ * caller. The bitmap points straight into the shared mapping; icon
+ * sprites are treated as read-only by everyone anyway.
+ */
+static sprite_t * icon_from_shm(struct icon_shm * shm) {
+	sprite_t * icon = malloc(sizeof(sprite_t));
+	icon->width  = shm->width;
+	icon->height = shm->height;
+	icon->bitmap = shm->pixels;
+	icon->masks  = NULL;
+	icon->blank  = 0;
+	icon->alpha  = shm->alpha;
+	return icon;
+}
+
+/**
+ * Obtain the shared segment for an icon at a given size, baking it
+ * from the source file if we're the first to ask. If two clients
+ * race on a cold cache they both write the same deterministic
+ * pixels, so the worst case is decoding twice.
+ */
+static sprite_t * icon_load_shared(const char * name, int size, char * path) {
+	char key[100];
+	sprintf(key, "sys.icons.%d.%s", size, name);
+
+	size_t shm_size = sizeof(struct icon_shm) + sizeof(uint32_t) * size * size;
+	struct icon_shm * shm = shm_obtain(key, &shm_size);
+	if (!shm || shm_size < sizeof(struct icon_shm) + sizeof(uint32_t) * size * size) {
+		/* No shared memory for us; just load it privately */
+		sprite_t * icon = malloc(sizeof(sprite_t));
+		load_sprite(icon, path);
+		return icon;
 	}
 
-	icon_cache_48 = hashmap_create(10);
-	{ /* Generic fallback icon */
-		sprite_t * app_icon = malloc(sizeof(sprite_t));
-		load_sprite(app_icon, "/usr/share/icons/48/applications-generic.png");
-		hashmap_set(icon_cache_48, "generic", app_icon);
+	if (shm->magic == ICON_SHM_MAGIC && shm->ready == ICON_SHM_READY &&
+		shm->width == size && shm->height == size) {
+		/* Someone already baked this icon */
+		return icon_from_shm(shm);
+	}
+
+	sprite_t source;
+	if (load_sprite(&source, path)) {
+		shm_release(key);
+		return NULL;
+	}
+
+	shm->ready  = 0;
+	shm->magic  = ICON_SHM_MAGIC;
+	shm->width  = size;
+	shm->height = size;
+
+	if (source.width == size && source.height == size) {
+		/* Right size already, just install the pixels */
+		shm->alpha = source.alpha;
+		memcpy(shm->pixels, source.bitmap, sizeof(uint32_t) * size * size);
+	} else {
+		/* Scale once now so nobody has to at paint time */
+		shm->alpha = ALPHA_EMBEDDED;
+		sprite_t tmp = { .width = size, .height = size, .bitmap = shm->pixels, .masks = NULL, .blank = 0, .alpha = ALPHA_EMBEDDED };
+		gfx_context_t * ctx = init_graphics_sprite(&tmp);
+		draw_fill(ctx, rgba(0,0,0,0));
+		draw_sprite_scaled(ctx, &source, 0, 0, size, size);
+		free(ctx);
 	}
-}
 
+	free(source.bitmap);
 
-static sprite_t * icon_get_int(const char * name, hashmap_t * icon_cache, char ** icon_directories) {
+	/* Publish - readers only trust the segment once this lands */
+	shm->ready = ICON_SHM_READY;
+
+	return icon_from_shm(shm);
+}
+
+static sprite_t * icon_get_int(const char * name, int size, hashmap_t * icon_cache, char ** icon_directories) {
 
 	if (!strcmp(name,"")) {
 		/* If a window doesn't have an icon set, return the generic icon */
@@ -81,11 +168,12 @@ static sprite_t * icon_get_int(const char * name, hashmap_t * icon_cache, char *
 			while (*prefix) {
 				sprintf(path, "%s/%s.%s", icon_directories[i], name, *prefix);
 				if (access(path, R_OK) == 0) {
-					/* And if we find one, cache it */
-					icon = malloc(sizeof(sprite_t));
-					load_sprite(icon, path);
-					hashmap_set(icon_cache, (void*)name, icon);
-					return icon;
+					/* And if we find one, map the shared copy and cache it */
+					icon = icon_load_shared(name, size, path);
+					if (icon) {
+						hashmap_set(icon_cache, (void*)name, icon);
+						return icon;
+					}
 				}
 				prefix++;
 			}
@@ -101,10 +189,33 @@ static sprite_t * icon_get_int(const char * name, hashmap_t * icon_cache, char *
 	return icon;
 }
 
+static void _init_cache(hashmap_t ** cache, int size, char ** icon_directories) {
+	*cache = hashmap_create(10);
+	/* Generic fallback icon */
+	sprite_t * app_icon = icon_get_int("applications-generic", size, *cache, icon_directories);
+	hashmap_set(*cache, "generic", app_icon);
+}
+
+__attribute__((constructor))
+static void _init_caches(void) {
+	_init_cache(&icon_cache_16, 16, icon_directories_16);
+	_init_cache(&icon_cache_24, 24, icon_directories_24);
+	_init_cache(&icon_cache_32, 32, icon_directories_48);
+	_init_cache(&icon_cache_48, 48, icon_directories_48);
+}
+
 sprite_t * icon_get_16(const char * name) {
-	return icon_get_int(name, icon_cache_16, icon_directories_16);
+	return icon_get_int(name, 16, icon_cache_16, icon_directories_16);
+}
+
+sprite_t * icon_get_24(const char * name) {
+	return icon_get_int(name, 24, icon_cache_24, icon_directories_24);
+}
+
+sprite_t * icon_get_32(const char * name) {
+	return icon_get_int(name, 32, icon_cache_32, icon_directories_48);
 }
 
 sprite_t * icon_get_48(const char * name) {
-	return icon_get_int(name, icon_cache_48, icon_directories_48);
+	return icon_get_int(name, 48, icon_cache_48, icon_directories_48);
 }
@@ -12,12 +12,25 @@
 #include <toaru/inflate.h>
 #endif
 
+/**
+ * Number of bits resolved by the fast lookup table. Codes longer
+ * than this fall back to the bit-by-bit canonical walk; in practice
+ * that covers the overwhelming majority of literal/length codes.
+ */
+#define HUFF_FAST_BITS 9
+#define HUFF_FAST_SIZE (1 << HUFF_FAST_BITS)
+
 /**
  * Decoded Huffman table
  */
 struct huff {
 	uint16_t counts[16];   /* Number of symbols of each length */
 	uint16_t symbols[288]; /* Ordered symbols */
+	/* Direct lookup table indexed by the next HUFF_FAST_BITS input
+	 * bits (LSB-first, as they appear in the stream). Each entry is
+	 * (length << 12) | symbol; 0 means the code is longer than
+	 * HUFF_FAST_BITS and the slow path must be used. */
+	uint16_t fast[HUFF_FAST_SIZE];
 };
 
 /**
@@ -34,51 +47,70 @@ struct huff_ring {
 struct huff fixed_lengths;
 struct huff fixed_dists;
 
+/**
+ * Load one more input byte into the bit reservoir.
+ *
+ * The reservoir is only ever refilled on demand, so the decoder
+ * never consumes input past the byte holding the last bit it
+ * actually needed - consumers like the PNG loader rely on picking
+ * up their trailing checksums right where the DEFLATE stream ends.
+ */
+static void load_byte(struct inflate_context * ctx) {
+	ctx->bit_buffer |= (uint32_t)ctx->get_input(ctx) << ctx->buffer_size;
+	ctx->buffer_size += 8;
+}
+
+/**
+ * Read a byte from the input, preferring whole bytes
+ * still sitting in the bit reservoir.
+ */
+static uint8_t next_byte(struct inflate_context * ctx) {
+	if (ctx->buffer_size >= 8) {
+		uint8_t out = ctx->bit_buffer & 0xFF;
+		ctx->bit_buffer >>= 8;
+		ctx->buffer_size -= 8;
+		return out;
+	}
+	return ctx->get_input(ctx);
+}
+
 /**
  * Read a little-endian short from the input.
  */
 static uint16_t read_16le(struct inflate_context * ctx) {
 	uint16_t a, b;
-	a = ctx->get_input(ctx);
-	b = ctx->get_input(ctx);
+	a = next_byte(ctx);
+	b = next_byte(ctx);
 	return (a << 0) | (b << 8);
 }
 
 /**
  * Read a single bit from the source.
- * Fills the byte buffer with one byte when it runs out.
+ * Only used by the slow decode path; everything else
+ * pulls multiple bits from the reservoir at once.
  */
 static uint8_t read_bit(struct inflate_context * ctx) {
-
-	/* When we run out of bits... */
 	if (ctx->buffer_size == 0) {
-		/* Refill from the next input byte */
-		ctx->bit_buffer = ctx->get_input(ctx);
-		/* And restore bit buffer size to 8 bits */
-		ctx->buffer_size = 8;
+		load_byte(ctx);
 	}
 
-	/* Get the next available bit */
 	int out = ctx->bit_buffer & 1;
-
-	/* Shift the bit buffer forward */
 	ctx->bit_buffer >>= 1;
-
-	/* There is now one less bit available */
 	ctx->buffer_size--;
 
 	return out;
 }
 
 /**
- * Read multible bits, in bit order, from the source.
+ * Read multiple bits, in bit order, from the source.
  */
 static uint32_t read_bits(struct inflate_context * ctx, unsigned int count) {
-	uint32_t out = 0;
-	for (unsigned int bit = 0; bit < count; bit++) {
-		/* Read one bit at a time, from least to most significant */
-		out |= (read_bit(ctx) << bit);
+	while (ctx->buffer_size < (int)count) {
+		load_byte(ctx);
 	}
+	uint32_t out = ctx->bit_buffer & ((1UL << count) - 1);
+	ctx->bit_buffer >>= count;
+	ctx->buffer_size -= count;
 	return out;
 }
 
@@ -109,6 +141,30 @@ static void build_huffman(uint8_t * lengths, size_t size, struct huff * out) {
 	for (unsigned int i = 0; i < size; ++i) {
 		if (lengths[i]) out->symbols[offsets[lengths[i]]++] = i;
 	}
+
+	/* Zero the fast table; 0 marks "code too long, take the slow path" */
+	for (unsigned int i = 0; i < HUFF_FAST_SIZE; ++i) out->fast[i] = 0;
+
+	/* Walk the canonical codes in order and fill the fast table.
+	 * Codes arrive from the stream least-significant-bit first, so
+	 * each code is bit-reversed and then replicated across every
+	 * table index that has it in its low bits. */
+	unsigned int code = 0;
+	unsigned int sym = 0;
+	for (unsigned int len = 1; len < 16; ++len) {
+		for (unsigned int n = 0; n < out->counts[len]; ++n, ++sym, ++code) {
+			if (len > HUFF_FAST_BITS) continue;
+			unsigned int rev = 0;
+			for (unsigned int b = 0; b < len; ++b) {
+				rev |= ((code >> b) & 1) << (len - 1 - b);
+			}
+			uint16_t entry = (len << 12) | out->symbols[sym];
+			for (unsigned int i = rev; i < HUFF_FAST_SIZE; i += (1 << len)) {
+				out->fast[i] = entry;
+			}
+		}
+		code <<= 1;
+	}
 }
 
 /**
@@ -147,8 +203,28 @@ static void build_fixed(void) {
 
 /**
  * Decode a symbol from the source using a Huffman table.
+ *
+ * The fast table resolves codes of up to HUFF_FAST_BITS bits in a
+ * single lookup. Looking up with fewer than HUFF_FAST_BITS bits in
+ * the reservoir is fine: the missing high bits index as zeroes, and
+ * since no code is a prefix of another, a match no longer than the
+ * bits we actually have can only be the real code. More input is
+ * only pulled when the code demonstrably needs it.
  */
 static int decode(struct inflate_context * ctx, struct huff * huff) {
+	while (1) {
+		uint16_t entry = huff->fast[ctx->bit_buffer & (HUFF_FAST_SIZE - 1)];
+		int len = entry >> 12;
+		if (len && len <= ctx->buffer_size) {
+			ctx->bit_buffer >>= len;
+			ctx->buffer_size -= len;
+			return entry & 0xFFF;
+		}
+		if (ctx->buffer_size >= HUFF_FAST_BITS) break;
+		load_byte(ctx);
+	}
+
+	/* Code is longer than HUFF_FAST_BITS; walk it out bit by bit. */
 	int count = 0, cur = 0;
 	for (int i = 1; cur >= 0; i++) {
 		cur = (cur << 1) | read_bit(ctx); /* Shift */
@@ -173,13 +249,6 @@ static void emit(struct inflate_context * ctx, unsigned char byte) {
 	ctx->ring->pointer++;
 }
 
-/**
- * Look backwards in the output ring buffer.
- */
-static uint8_t peek(struct inflate_context * ctx, int offset) {
-	return ctx->ring->data[(ctx->ring->pointer - offset) % 32768];
-}
-
 /**
  * Decompress a block of Huffman-encoded data.
  */
@@ -253,9 +322,14 @@ static int inflate(struct inflate_context * ctx, struct huff * huff_len, struct
 			distance = decode(ctx, huff_dist);
 			offset = read_bits(ctx, dext[distance]) + dists[distance];
 
+			/* Walk the window copy with a running source index
+			 * instead of recomputing the lookback each byte; since
+			 * the source trails the write pointer, overlapping
+			 * copies (offset < length) repeat bytes correctly. */
+			size_t src = (ctx->ring->pointer - offset) & 0x7FFF;
 			for (int i = 0; i < length; ++i) {
-				uint8_t b = peek(ctx, offset);
-				emit(ctx, b);
+				emit(ctx, ctx->ring->data[src]);
+				src = (src + 1) & 0x7FFF;
 			}
 		}
 	}
@@ -337,9 +411,11 @@ static void decode_huffman(struct inflate_context * ctx) {
  * Decode an uncompressed block.
  */
 static int uncompressed(struct inflate_context * ctx) {
-	/* Reset byte alignment */
-	ctx->bit_buffer = 0;
-	ctx->buffer_size = 0;
+	/* Discard bits up to the next byte boundary; whole bytes already
+	 * in the reservoir are still valid input and stay buffered. */
+	int align = ctx->buffer_size & 7;
+	ctx->bit_buffer >>= align;
+	ctx->buffer_size -= align;
 
 	/* "The rest of the block consists of the following information:"
 	 *    0   1   2   3   4...
@@ -357,7 +433,7 @@ static int uncompressed(struct inflate_context * ctx) {
 
 	/* Emit LEN bytes from the source to the output */
 	for (int i = 0; i < len; ++i) {
-		emit(ctx, ctx->get_input(ctx));
+		emit(ctx, next_byte(ctx));
 	}
 
 	return 0;
@@ -415,15 +491,17 @@ int deflate_decompress(struct inflate_context * ctx) {
 
 static unsigned int read_32le(struct inflate_context * ctx) {
 	unsigned int a, b, c, d;
-	a = ctx->get_input(ctx);
-	b = ctx->get_input(ctx);
-	c = ctx->get_input(ctx);
-	d = ctx->get_input(ctx);
+	a = next_byte(ctx);
+	b = next_byte(ctx);
+	c = next_byte(ctx);
+	d = next_byte(ctx);
 
 	return (d << 24) | (c << 16) | (b << 8) | (a << 0);
 }
 
 int gzip_decompress(struct inflate_context * ctx) {
+	ctx->bit_buffer = 0;
+	ctx->buffer_size = 0;
 
 	/* Read gzip headers */
 	if (ctx->get_input(ctx) != 0x1F) return 1;
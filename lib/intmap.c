@@ -0,0 +1,253 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ * This file is part of ToaruOS and is released under the terms
+ * of the NCSA / University of Illinois License - see LICENSE.md
+ * Copyright (C) 2018 K. Lange
+ *
+ * Open-addressing integer map.
+ *
+ * Robin-hood linear probing over an inline slot array: an insert that
+ * has probed further than the entry it lands on evicts that entry and
+ * carries it forward, which keeps probe sequences short and uniform.
+ * Deletion backward-shifts the following run, so there are no
+ * tombstones to skip over. When the table passes 3/4 load a new array
+ * of twice the size is allocated and the old one drains a few slots at
+ * a time from subsequent operations, rather than all at once.
+ */
+
+#include <toaru/list.h>
+#include <toaru/intmap.h>
+
+#define INTMAP_MIN_SIZE      8
+#define INTMAP_MIGRATE_CHUNK 8
+
+static size_t intmap_hash(intmap_t * map, size_t size, uintptr_t key) {
+	(void)map;
+	/* Fibonacci hashing; sequential keys (wids, fds, pids) would
+	 * otherwise cluster into sequential slots. */
+	return (key * 2654435761UL) & (size - 1);
+}
+
+/*
+ * Place an entry into a slot array, evicting and carrying forward any
+ * poorer entry found along the probe path. Returns the previous value
+ * when the key was already present.
+ */
+static void * intmap_insert(intmap_t * map, intmap_slot_t * slots, size_t size, uintptr_t key, void * value, size_t * count) {
+	size_t index = intmap_hash(map, size, key);
+	int32_t dist = 0;
+
+	while (1) {
+		intmap_slot_t * slot = &slots[index];
+		if (slot->dist < 0) {
+			slot->key   = key;
+			slot->value = value;
+			slot->dist  = dist;
+			(*count)++;
+			return NULL;
+		}
+		if (slot->key == key) {
+			void * out = slot->value;
+			slot->value = value;
+			return out;
+		}
+		if (slot->dist < dist) {
+			uintptr_t t_key   = slot->key;
+			void *    t_value = slot->value;
+			int32_t   t_dist  = slot->dist;
+			slot->key   = key;
+			slot->value = value;
+			slot->dist  = dist;
+			key   = t_key;
+			value = t_value;
+			dist  = t_dist;
+		}
+		index = (index + 1) & (size - 1);
+		dist++;
+	}
+}
+
+/*
+ * Move a few entries out of the old slot array. Called from every
+ * public operation while a rehash is in flight.
+ */
+static void intmap_migrate(intmap_t * map, size_t chunk) {
+	if (!map->old_slots) return;
+
+	while (chunk && map->migrated < map->old_size) {
+		intmap_slot_t * slot = &map->old_slots[map->migrated];
+		if (slot->dist >= 0) {
+			intmap_insert(map, map->slots, map->size, slot->key, slot->value, &map->count);
+			map->old_count--;
+		}
+		map->migrated++;
+		chunk--;
+	}
+
+	if (map->migrated >= map->old_size) {
+		free(map->old_slots);
+		map->old_slots = NULL;
+		map->old_size  = 0;
+		map->old_count = 0;
+		map->migrated  = 0;
+	}
+}
+
+static void intmap_begin_rehash(intmap_t * map) {
+	/* Finish any rehash still in flight before starting another */
+	intmap_migrate(map, map->old_size);
+
+	map->old_slots = map->slots;
+	map->old_size  = map->size;
+	map->old_count = map->count;
+	map->migrated  = 0;
+
+	map->size  = map->size * 2;
+	map->count = 0;
+	map->slots = malloc(sizeof(intmap_slot_t) * map->size);
+	for (size_t i = 0; i < map->size; ++i) {
+		map->slots[i].dist = -1;
+	}
+}
+
+intmap_t * intmap_create(int size) {
+	intmap_t * map = malloc(sizeof(intmap_t));
+
+	size_t real_size = INTMAP_MIN_SIZE;
+	while (real_size < (size_t)size) real_size <<= 1;
+
+	map->size  = real_size;
+	map->count = 0;
+	map->slots = malloc(sizeof(intmap_slot_t) * real_size);
+	for (size_t i = 0; i < real_size; ++i) {
+		map->slots[i].dist = -1;
+	}
+
+	map->old_slots = NULL;
+	map->old_size  = 0;
+	map->old_count = 0;
+	map->migrated  = 0;
+
+	return map;
+}
+
+void * intmap_set(intmap_t * map, uintptr_t key, void * value) {
+	intmap_migrate(map, INTMAP_MIGRATE_CHUNK);
+
+	/* If the key is still in the old array, replace it there */
+	if (map->old_slots) {
+		size_t index = intmap_hash(map, map->old_size, key);
+		int32_t dist = 0;
+		while (1) {
+			intmap_slot_t * slot = &map->old_slots[index];
+			if (slot->dist < 0 || slot->dist < dist) break;
+			if (slot->key == key) {
+				void * out = slot->value;
+				slot->value = value;
+				return out;
+			}
+			index = (index + 1) & (map->old_size - 1);
+			dist++;
+		}
+	}
+
+	if ((map->count + map->old_count + 1) * 4 >= map->size * 3) {
+		intmap_begin_rehash(map);
+	}
+
+	return intmap_insert(map, map->slots, map->size, key, value, &map->count);
+}
+
+static intmap_slot_t * intmap_find(intmap_t * map, intmap_slot_t * slots, size_t size, uintptr_t key) {
+	size_t index = intmap_hash(map, size, key);
+	int32_t dist = 0;
+
+	while (1) {
+		intmap_slot_t * slot = &slots[index];
+		/* An empty slot, or one poorer than we would be, means the key
+		 * can not be further along the probe sequence. */
+		if (slot->dist < 0 || slot->dist < dist) return NULL;
+		if (slot->key == key) return slot;
+		index = (index + 1) & (size - 1);
+		dist++;
+	}
+}
+
+void * intmap_get(intmap_t * map, uintptr_t key) {
+	intmap_slot_t * slot = intmap_find(map, map->slots, map->size, key);
+	if (!slot && map->old_slots) {
+		slot = intmap_find(map, map->old_slots, map->old_size, key);
+	}
+	return slot ? slot->value : NULL;
+}
+
+int intmap_has(intmap_t * map, uintptr_t key) {
+	if (intmap_find(map, map->slots, map->size, key)) return 1;
+	if (map->old_slots && intmap_find(map, map->old_slots, map->old_size, key)) return 1;
+	return 0;
+}
+
+static void * intmap_delete(intmap_t * map, intmap_slot_t * slots, size_t size, uintptr_t key, size_t * count) {
+	intmap_slot_t * slot = intmap_find(map, slots, size, key);
+	if (!slot) return NULL;
+
+	void * out = slot->value;
+	size_t index = slot - slots;
+
+	/* Shift the rest of the run back one slot */
+	while (1) {
+		size_t next = (index + 1) & (size - 1);
+		if (slots[next].dist <= 0) break;
+		slots[index] = slots[next];
+		slots[index].dist--;
+		index = next;
+	}
+	slots[index].dist = -1;
+	(*count)--;
+
+	return out;
+}
+
+void * intmap_remove(intmap_t * map, uintptr_t key) {
+	intmap_migrate(map, INTMAP_MIGRATE_CHUNK);
+
+	void * out = intmap_delete(map, map->slots, map->size, key, &map->count);
+	if (!out && map->old_slots) {
+		out = intmap_delete(map, map->old_slots, map->old_size, key, &map->old_count);
+	}
+	return out;
+}
+
+list_t * intmap_keys(intmap_t * map) {
+	list_t * l = list_create();
+
+	for (size_t i = 0; i < map->size; ++i) {
+		if (map->slots[i].dist >= 0) list_insert(l, (void *)map->slots[i].key);
+	}
+	for (size_t i = map->migrated; i < map->old_size; ++i) {
+		if (map->old_slots[i].dist >= 0) list_insert(l, (void *)map->old_slots[i].key);
+	}
+
+	return l;
+}
+
+list_t * intmap_values(intmap_t * map) {
+	list_t * l = list_create();
+
+	for (size_t i = 0; i < map->size; ++i) {
+		if (map->slots[i].dist >= 0) list_insert(l, map->slots[i].value);
+	}
+	for (size_t i = map->migrated; i < map->old_size; ++i) {
+		if (map->old_slots[i].dist >= 0) list_insert(l, map->old_slots[i].value);
+	}
+
+	return l;
+}
+
+int intmap_is_empty(intmap_t * map) {
+	return (map->count + map->old_count) == 0;
+}
+
+void intmap_free(intmap_t * map) {
+	free(map->slots);
+	if (map->old_slots) free(map->old_slots);
+}
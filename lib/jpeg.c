@@ -34,7 +34,6 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <math.h>
 
 #include <toaru/graphics.h>
 
@@ -75,26 +74,15 @@ static int zigzag[] = {
 static uint8_t quant_mapping[3] = {0};
 static uint8_t quant[8][64];
 
+/* Restart interval in MCUs, from a DRI section; 0 when unused */
+static int restart_interval = 0;
+
 static int clamp(int col) {
 	if (col > 255) return 255;
 	if (col < 0) return 0;
 	return col;
 }
 
-/* YCbCr to RGB conversion */
-static void color_conversion(
-		float Y, float Cb, float Cr,
-		int *R, int *G, int *B
-	) {
-	float r = (Cr*(2.0-2.0*0.299) + Y);
-	float b = (Cb*(2.0-2.0*0.114) + Y);
-	float g = (Y - 0.144 * b - 0.229 * r) / 0.587;
-
-	*R = clamp(r + 128);
-	*G = clamp(g + 128);
-	*B = clamp(b + 128);
-}
-
 static int xy_to_lin(int x, int y) {
 	return x + y * 8;
 }
@@ -104,13 +92,35 @@ struct huffman_table {
 	uint8_t elements[256];
 } huffman_tables[256] = {0};
 
+/*
+ * The entropy-coded scan is served out of memory; going through
+ * stdio for every byte costs more than the Huffman decode itself.
+ */
 struct stream {
-	FILE * file;
+	uint8_t * data;
+	long len;
+	long off;
 	uint8_t byte;
 	int have;
 	int pos;
+	int marker;
+};
+
+/**
+ * AAN IDCT scale factors: cos(k×π/16) × √2, and 1.0 for k = 0.
+ * These get folded into the dequantization multipliers below, along
+ * with the overall 1/8, so the transform passes themselves only need
+ * the four rotation constants.
+ */
+static const double aan_scales[8] = {
+	1.0, 1.387039845, 1.306562965, 1.175875602,
+	1.0, 0.785694958, 0.541196100, 0.275899379
 };
 
+/* Dequantization multipliers with the AAN scale factors folded in,
+ * indexed by zig-zag position to match the coefficient stream. */
+static float aan_quant[8][64];
+
 static void define_quant_table(FILE * f, int len) {
 
 	TRACE("Defining quant table");
@@ -118,6 +128,14 @@ static void define_quant_table(FILE * f, int len) {
 		uint8_t hdr;
 		fread(&hdr, 1, 1, f);
 		fread(&quant[(hdr) & 0xF], 64, 1, f);
+
+		/* Fold the AAN scale factors into the dequantizer */
+		for (int i = 0; i < 64; ++i) {
+			int z = zigzag[i];
+			aan_quant[hdr & 0xF][i] = quant[hdr & 0xF][i] *
+				(float)(aan_scales[z >> 3] * aan_scales[z & 0x7] / 8.0);
+		}
+
 		len -= 65;
 	}
 	TRACE("Done");
@@ -207,68 +225,138 @@ static void define_huffman_table(FILE * f, int len) {
 }
 
 struct idct {
-	float base[64];
+	float base[64] __attribute__((aligned(16)));
 };
 
+/* The four rotation constants from the AAN factorization */
+#define AAN_C_1_414 1.414213562f /* sqrt(2) */
+#define AAN_C_1_847 1.847759065f /* (cos(pi/8) + cos(3pi/8)) * sqrt(2) */
+#define AAN_C_1_082 1.082392200f /* 2 * cos(3pi/8) * sqrt(2) */
+#define AAN_C_2_613 2.613125930f /* 2 * cos(pi/8) * sqrt(2) */
+
 /**
- * norm_coeff[0] = 0.35355339059
- * norm_coeff[1] = 0.5
+ * One 8-point IDCT pass over a row or column of the block,
+ * using the AAN factorization (5 multiplies, 29 adds). The
+ * AAN output scale factors are pre-folded into aan_quant.
  */
-static float cosines[8][8] = {
-	{ 0.35355339059,0.35355339059,0.35355339059,0.35355339059,0.35355339059,0.35355339059,0.35355339059,0.35355339059 },
-	{ 0.490392640202,0.415734806151,0.27778511651,0.0975451610081,-0.0975451610081,-0.27778511651,-0.415734806151,-0.490392640202 },
-	{ 0.461939766256,0.191341716183,-0.191341716183,-0.461939766256,-0.461939766256,-0.191341716183,0.191341716183,0.461939766256 },
-	{ 0.415734806151,-0.0975451610081,-0.490392640202,-0.27778511651,0.27778511651,0.490392640202,0.0975451610081,-0.415734806151 },
-	{ 0.353553390593,-0.353553390593,-0.353553390593,0.353553390593,0.353553390593,-0.353553390593,-0.353553390593,0.353553390593 },
-	{ 0.27778511651,-0.490392640202,0.0975451610081,0.415734806151,-0.415734806151,-0.0975451610081,0.490392640202,-0.27778511651 },
-	{ 0.191341716183,-0.461939766256,0.461939766256,-0.191341716183,-0.191341716183,0.461939766256,-0.461939766256,0.191341716183 },
-	{ 0.0975451610081,-0.27778511651,0.415734806151,-0.490392640202,0.490392640202,-0.415734806151,0.27778511651,-0.0975451610081 },
-};
+static void idct_1d(float * blk, int stride) {
+	/* Even part */
+	float t10 = blk[0 * stride] + blk[4 * stride];
+	float t11 = blk[0 * stride] - blk[4 * stride];
+	float t13 = blk[2 * stride] + blk[6 * stride];
+	float t12 = (blk[2 * stride] - blk[6 * stride]) * AAN_C_1_414 - t13;
+
+	float e0 = t10 + t13;
+	float e3 = t10 - t13;
+	float e1 = t11 + t12;
+	float e2 = t11 - t12;
+
+	/* Odd part */
+	float z13 = blk[5 * stride] + blk[3 * stride];
+	float z10 = blk[5 * stride] - blk[3 * stride];
+	float z11 = blk[1 * stride] + blk[7 * stride];
+	float z12 = blk[1 * stride] - blk[7 * stride];
+
+	float t7 = z11 + z13;
+	float o11 = (z11 - z13) * AAN_C_1_414;
+	float z5 = (z10 + z12) * AAN_C_1_847;
+	float t4_ = AAN_C_1_082 * z12 - z5;
+	float t6_ = z5 - AAN_C_2_613 * z10;
+
+	float t6 = t6_ - t7;
+	float t5 = o11 - t6;
+	float t4 = t4_ + t5;
+
+	blk[0 * stride] = e0 + t7;
+	blk[7 * stride] = e0 - t7;
+	blk[1 * stride] = e1 + t6;
+	blk[6 * stride] = e1 - t6;
+	blk[2 * stride] = e2 + t5;
+	blk[5 * stride] = e2 - t5;
+	blk[4 * stride] = e3 + t4;
+	blk[3 * stride] = e3 - t4;
+}
 
-static float premul[8][8][8][8]= {{{{0}}}};
+/**
+ * Full 8×8 inverse DCT: a column pass and then a row pass,
+ * replacing the old scheme of accumulating a 64-entry basis
+ * image for every nonzero coefficient. The column pass runs
+ * four columns at a time through the SSE units.
+ */
+static void idct_2d(struct idct * self) {
+	float * b = self->base;
 
-static void add_idc(struct idct * self, int n, int m, int coeff) {
 #ifdef NO_SSE
-	for (int y = 0; y < 8; ++y) {
-		for (int x = 0; x < 8; ++x) {
-			self->base[xy_to_lin(x, y)] += premul[n][m][y][x] * coeff;
-		}
+	for (int x = 0; x < 8; ++x) {
+		idct_1d(b + x, 8);
 	}
 #else
-	__m128 c = _mm_set_ps(coeff,coeff,coeff,coeff);
-	for (int y = 0; y < 8; ++y) {
-		__m128 a, b;
-		/* base[y][x] = base[y][x] + premul[n][m][y][x] * coeff */
-
-		/* x = 0..3 */
-		a = _mm_load_ps(&premul[n][m][y][0]);
-		a = _mm_mul_ps(a,c);
-		b = _mm_load_ps(&self->base[xy_to_lin(0,y)]);
-		a = _mm_add_ps(a,b);
-		_mm_store_ps(&self->base[xy_to_lin(0,y)], a);
-
-		/* x = 4..7 */
-		a = _mm_load_ps(&premul[n][m][y][4]);
-		a = _mm_mul_ps(a,c);
-		b = _mm_load_ps(&self->base[xy_to_lin(4,y)]);
-		a = _mm_add_ps(a,b);
-		_mm_store_ps(&self->base[xy_to_lin(4,y)], a);
+	for (int off = 0; off < 8; off += 4) {
+		__m128 in0 = _mm_load_ps(b + 0 * 8 + off);
+		__m128 in1 = _mm_load_ps(b + 1 * 8 + off);
+		__m128 in2 = _mm_load_ps(b + 2 * 8 + off);
+		__m128 in3 = _mm_load_ps(b + 3 * 8 + off);
+		__m128 in4 = _mm_load_ps(b + 4 * 8 + off);
+		__m128 in5 = _mm_load_ps(b + 5 * 8 + off);
+		__m128 in6 = _mm_load_ps(b + 6 * 8 + off);
+		__m128 in7 = _mm_load_ps(b + 7 * 8 + off);
+
+		/* Even part */
+		__m128 t10 = _mm_add_ps(in0, in4);
+		__m128 t11 = _mm_sub_ps(in0, in4);
+		__m128 t13 = _mm_add_ps(in2, in6);
+		__m128 t12 = _mm_sub_ps(_mm_mul_ps(_mm_sub_ps(in2, in6), _mm_set1_ps(AAN_C_1_414)), t13);
+
+		__m128 e0 = _mm_add_ps(t10, t13);
+		__m128 e3 = _mm_sub_ps(t10, t13);
+		__m128 e1 = _mm_add_ps(t11, t12);
+		__m128 e2 = _mm_sub_ps(t11, t12);
+
+		/* Odd part */
+		__m128 z13 = _mm_add_ps(in5, in3);
+		__m128 z10 = _mm_sub_ps(in5, in3);
+		__m128 z11 = _mm_add_ps(in1, in7);
+		__m128 z12 = _mm_sub_ps(in1, in7);
+
+		__m128 t7 = _mm_add_ps(z11, z13);
+		__m128 o11 = _mm_mul_ps(_mm_sub_ps(z11, z13), _mm_set1_ps(AAN_C_1_414));
+		__m128 z5 = _mm_mul_ps(_mm_add_ps(z10, z12), _mm_set1_ps(AAN_C_1_847));
+		__m128 t4_ = _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(AAN_C_1_082), z12), z5);
+		__m128 t6_ = _mm_sub_ps(z5, _mm_mul_ps(_mm_set1_ps(AAN_C_2_613), z10));
+
+		__m128 t6 = _mm_sub_ps(t6_, t7);
+		__m128 t5 = _mm_sub_ps(o11, t6);
+		__m128 t4 = _mm_add_ps(t4_, t5);
+
+		_mm_store_ps(b + 0 * 8 + off, _mm_add_ps(e0, t7));
+		_mm_store_ps(b + 7 * 8 + off, _mm_sub_ps(e0, t7));
+		_mm_store_ps(b + 1 * 8 + off, _mm_add_ps(e1, t6));
+		_mm_store_ps(b + 6 * 8 + off, _mm_sub_ps(e1, t6));
+		_mm_store_ps(b + 2 * 8 + off, _mm_add_ps(e2, t5));
+		_mm_store_ps(b + 5 * 8 + off, _mm_sub_ps(e2, t5));
+		_mm_store_ps(b + 4 * 8 + off, _mm_add_ps(e3, t4));
+		_mm_store_ps(b + 3 * 8 + off, _mm_sub_ps(e3, t4));
 	}
 #endif
+
+	for (int y = 0; y < 8; ++y) {
+		idct_1d(b + y * 8, 1);
+	}
 }
 
-static void add_zigzag(struct idct * self, int zi, int coeff) {
-	int i = zigzag[zi];
-	int n = i & 0x7;
-	int m = i >> 3;
-	add_idc(self, n, m, coeff);
+/* Pull the next byte of scan data, or -1 at the end */
+static int stream_byte(struct stream * st) {
+	if (st->off < st->len) {
+		return st->data[st->off++];
+	}
+	return -1;
 }
 
 /* Read a bit from the stream */
 static int get_bit(struct stream * st) {
 	while ((st->pos >> 3) >= st->have) {
 		/* We have finished using the current byte and need to read another one */
-		int t = fgetc(st->file);
+		int t = stream_byte(st);
 		if (t < 0) {
 			/* EOF */
 			st->byte = 0;
@@ -281,12 +369,13 @@ static int get_bit(struct stream * st) {
 			 * If we see 0xFF, it's followed by a 0x00
 			 * that should be skipped.
 			 */
-			int tmp = fgetc(st->file);
+			int tmp = stream_byte(st);
 			if (tmp != 0) {
 				/*
-				 * If it's *not*, we reached the end of the file - but
-				 * this shouldn't happen.
+				 * If it's *not*, this is a marker (eg. a restart or
+				 * the end of the scan); remember it for the scan loop.
 				 */
+				st->marker = tmp;
 				st->byte = 0;
 			}
 		}
@@ -304,6 +393,26 @@ static int get_bit(struct stream * st) {
 	return (b >> s) & 1;
 }
 
+/*
+ * Resume entropy decoding after a restart marker. The encoder pads
+ * the current byte and emits an RSTn marker between restart
+ * intervals; each interval is independently decodable, which is also
+ * what would let a threaded decoder split the scan up later.
+ */
+static void stream_restart(struct stream * st) {
+	/* Skip any padding bits left in the current byte */
+	st->pos = st->have << 3;
+
+	if (st->marker) {
+		/* The bit reader already tripped over the marker */
+		st->marker = 0;
+	} else {
+		/* Otherwise it is sitting right ahead of us */
+		stream_byte(st); /* 0xFF */
+		stream_byte(st); /* RSTn */
+	}
+}
+
 /* Advance forward and get the n'th next bit */
 static int get_bitn(struct stream * st, int l) {
 	int val = 0;
@@ -349,14 +458,16 @@ static int decode(int code, int bits) {
 }
 
 /* Build IDCT matrix */
-static struct idct * build_matrix(struct idct * i, struct stream * st, int idx, uint8_t * quant, int oldcoeff, int * outcoeff) {
+static struct idct * build_matrix(struct idct * i, struct stream * st, int idx, float * quant, int oldcoeff, int * outcoeff) {
 	memset(i, 0, sizeof(struct idct));
 
 	int code = get_code(&huffman_tables[idx], st);
 	int bits = get_bitn(st, code);
 	int dccoeff = decode(code, bits) + oldcoeff;
 
-	add_zigzag(i, 0, dccoeff * quant[0]);
+	/* Gather the dequantized coefficients in natural order,
+	 * then transform the block in one go. */
+	i->base[0] = dccoeff * quant[0];
 	int l = 1;
 
 	while (l < 64) {
@@ -368,30 +479,39 @@ static struct idct * build_matrix(struct idct * i, struct stream * st, int idx,
 		}
 		bits = get_bitn(st, code);
 		int coeff = decode(code, bits);
-		add_zigzag(i, l, coeff * quant[l]);
+		if (l < 64) i->base[zigzag[l]] = coeff * quant[l];
 		l += 1;
 	}
 
+	idct_2d(i);
+
 	*outcoeff = dccoeff;
 	return i;
 }
 
-/* Set pixel in sprite buffer with bounds checking */
-static void set_pixel(int x, int y, uint32_t color) {
-	if ((x < sprite->width) && (y < sprite->height)) {
-		SPRITE(sprite,x,y) = color;
-	}
-}
-
-/* Concvert YCbCr values to RGB pixels */
+/* Convert YCbCr values to RGB pixels */
 static void draw_matrix(int x, int y, struct idct * L, struct idct * cb, struct idct * cr) {
-	for (int yy = 0; yy < 8; ++yy) {
-		for (int xx = 0; xx < 8; ++xx) {
-			int o = xy_to_lin(xx,yy);
-			int r, g, b;
-			color_conversion(L->base[o], cb->base[o], cr->base[o], &r, &g, &b);
-			uint32_t c = 0xFF000000 | (r << 16) | (g << 8) | b;
-			set_pixel((x * 8 + xx), (y * 8 + yy), c);
+	/* Clip the block against the image edges */
+	int wlim = sprite->width - x * 8;
+	if (wlim > 8) wlim = 8;
+	int hlim = sprite->height - y * 8;
+	if (hlim > 8) hlim = 8;
+
+	for (int yy = 0; yy < hlim; ++yy) {
+		/* Write converted pixels straight into the sprite row */
+		uint32_t * out = &SPRITE(sprite, x * 8, y * 8 + yy);
+		for (int xx = 0; xx < wlim; ++xx) {
+			int o = xy_to_lin(xx, yy);
+			int Y  = (int)L->base[o];
+			int Cb = (int)cb->base[o];
+			int Cr = (int)cr->base[o];
+
+			/* BT.601 coefficients in 16-bit fixed point */
+			int r = clamp(Y + ((91881 * Cr) >> 16) + 128);
+			int g = clamp(Y - ((22554 * Cb + 46802 * Cr) >> 16) + 128);
+			int b = clamp(Y + ((116130 * Cb) >> 16) + 128);
+
+			out[xx] = 0xFF000000 | (r << 16) | (g << 8) | b;
 		}
 	}
 }
@@ -403,34 +523,57 @@ static void start_of_scan(FILE * f, int len) {
 	/* Skip header */
 	fseek(f, len, SEEK_CUR);
 
+	/* Slurp the rest of the file for the bit reader */
+	long start = ftell(f);
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f) - start;
+	fseek(f, start, SEEK_SET);
+	uint8_t * data = malloc(size);
+	fread(data, 1, size, f);
+
 	/* Initialize bit stream */
 	struct stream _st = {0};
-	_st.file = f;
+	_st.data = data;
+	_st.len = size;
 	struct stream * st = &_st;
 
 	int old_lum = 0;
 	int old_crd = 0;
 	int old_cbd = 0;
-	for (int y = 0; y < sprite->height / 8 + !!(sprite->height & 0x7); ++y) {
+	int mcus_x = sprite->width / 8 + !!(sprite->width & 0x7);
+	int mcus_y = sprite->height / 8 + !!(sprite->height & 0x7);
+	int mcu = 0;
+	for (int y = 0; y < mcus_y; ++y) {
 		TRACE("Star row %d", y );
-		for (int x = 0; x < sprite->width / 8 + !!(sprite->width & 0x7); ++x) {
+		for (int x = 0; x < mcus_x; ++x) {
 			if (y >= 134) {
 				TRACE("Start col %d", x);
 			}
 
 			/* Build matrices */
 			struct idct matL, matCr, matCb;
-			build_matrix(&matL,  st, 0, quant[quant_mapping[0]], old_lum, &old_lum);
-			build_matrix(&matCb, st, 1, quant[quant_mapping[1]], old_cbd, &old_cbd);
-			build_matrix(&matCr, st, 1, quant[quant_mapping[2]], old_crd, &old_crd);
+			build_matrix(&matL,  st, 0, aan_quant[quant_mapping[0]], old_lum, &old_lum);
+			build_matrix(&matCb, st, 1, aan_quant[quant_mapping[1]], old_cbd, &old_cbd);
+			build_matrix(&matCr, st, 1, aan_quant[quant_mapping[2]], old_crd, &old_crd);
 
 			if (y >= 134) {
 				TRACE("Draw col %d", x);
 			}
 			draw_matrix(x, y, &matL, &matCb, &matCr);
+
+			/* Restart markers reset the DC predictions; there is
+			 * no marker after the last interval in the scan. */
+			if (restart_interval && ++mcu == restart_interval &&
+				!(y == mcus_y - 1 && x == mcus_x - 1)) {
+				stream_restart(st);
+				old_lum = old_cbd = old_crd = 0;
+				mcu = 0;
+			}
 		}
 	}
 
+	free(data);
+
 	TRACE("Done.");
 }
 
@@ -443,18 +586,7 @@ int load_sprite_jpg(sprite_t * tsprite, char * filename) {
 	sprite = tsprite;
 
 	memset(huffman_tables, 0, sizeof(huffman_tables));
-
-	if (premul[0][0][0][0] == 0.0) {
-		for (int n = 0; n < 8; ++n) {
-			for (int m = 0; m < 8; ++m) {
-				for (int y = 0; y < 8; ++y) {
-					for (int x = 0; x < 8; ++x) {
-						premul[n][m][y][x] = cosines[n][x] * cosines[m][y];
-					}
-				}
-			}
-		}
-	}
+	restart_interval = 0;
 
 	while (1) {
 
@@ -490,6 +622,15 @@ int load_sprite_jpg(sprite_t * tsprite, char * filename) {
 				baseline_dct(f, len);
 			} else if (hdr == 0xffc4) {
 				define_huffman_table(f, len);
+			} else if (hdr == 0xffdd) {
+				/* Define restart interval */
+				uint16_t ri;
+				fread(&ri, 2, 1, f);
+				swap16(&ri);
+				restart_interval = ri;
+				if (len > 2) {
+					fseek(f, len - 2, SEEK_CUR);
+				}
 			} else if (hdr == 0xffda) {
 				start_of_scan(f, len);
 				/* End immediately after reading the data */
@@ -297,6 +297,7 @@ int kbd_scancode(key_event_state_t * state, unsigned char c, key_event_t * event
 	event->action    = 0;
 	event->modifiers = 0;
 	event->key       = 0;
+	event->timestamp = 0;
 
 #if DEBUG_SCANCODES
 	fprintf(stderr, "[%d] %d\n", state->kbd_s_state, (int)c);
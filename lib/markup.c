@@ -36,6 +36,28 @@ struct markup_state * markup_init(void * user, markup_callback_tag_open open, ma
 	return out;
 }
 
+/* Tag and attribute names come from a small, repeated vocabulary;
+ * well-known names are served from this static table instead of
+ * being allocated fresh for every tag. */
+static const char * markup_well_known[] = {
+	"b", "br", "h1", "h2", "i", "link", "color", "target",
+	NULL
+};
+
+static char * markup_intern(const char * name) {
+	for (const char ** s = markup_well_known; *s; ++s) {
+		if (!strcmp(*s, name)) return (char *)*s;
+	}
+	return strdup(name);
+}
+
+static int markup_is_interned(const char * name) {
+	for (const char ** s = markup_well_known; *s; ++s) {
+		if (*s == name) return 1;
+	}
+	return 0;
+}
+
 static void _dump_buffer(struct markup_state * state) {
 	if (state->len) {
 		state->data[state->len] = '\0';
@@ -47,7 +69,7 @@ static void _dump_buffer(struct markup_state * state) {
 
 static void _finish_name(struct markup_state * state) {
 	state->data[state->len] = '\0';
-	state->tag.name = strdup(state->data);
+	state->tag.name = markup_intern(state->data);
 	state->tag.options = hashmap_create(5);
 	state->data[0] = '\0';
 	state->len = 0;
@@ -69,14 +91,14 @@ static void _finish_tag(struct markup_state * state) {
 
 static void _finish_bare_attr(struct markup_state * state) {
 	state->data[state->len] = '\0';
-	hashmap_set(state->tag.options, state->data, strdup(state->data));
+	hashmap_set(state->tag.options, state->data, markup_intern(state->data));
 	state->data[0] = '\0';
 	state->len = 0;
 }
 
 static void _finish_attr(struct markup_state * state) {
 	state->data[state->len] = '\0';
-	state->attr = strdup(state->data);
+	state->attr = markup_intern(state->data);
 	state->data[0] = '\0';
 	state->len = 0;
 	state->state = 4;
@@ -85,18 +107,19 @@ static void _finish_attr(struct markup_state * state) {
 static void _finish_attr_value(struct markup_state * state) {
 	state->data[state->len] = '\0';
 	hashmap_set(state->tag.options, state->attr, strdup(state->data));
-	free(state->attr);
+	if (!markup_is_interned(state->attr)) free(state->attr);
 	state->data[0] = '\0';
 	state->len = 0;
 	state->state = 2;
 }
 
 int markup_free_tag(struct markup_tag * tag) {
-	free(tag->name);
+	if (!markup_is_interned(tag->name)) free(tag->name);
 	list_t * keys = hashmap_keys(tag->options);
 	if (keys->length) {
 		foreach(node, keys) {
-			free(hashmap_get(tag->options, node->value));
+			char * value = hashmap_get(tag->options, node->value);
+			if (!markup_is_interned(value)) free(value);
 		}
 	}
 	list_free(keys);
@@ -278,6 +278,7 @@ void menu_update_title(struct MenuEntry * self, char * new_title) {
 		}
 		_self->title = strdup(new_title);
 		_self->rwidth = 50 + string_width(_self->title);
+		if (self->_owner) self->_owner->dirty = 1;
 	} else if (self->_type == MenuEntry_Submenu) {
 		struct MenuEntry_Submenu * _self = (struct MenuEntry_Submenu *)self;
 		if (_self->title) {
@@ -285,6 +286,7 @@ void menu_update_title(struct MenuEntry * self, char * new_title) {
 		}
 		_self->title = strdup(new_title);
 		_self->rwidth = 50 + string_width(_self->title);
+		if (self->_owner) self->_owner->dirty = 1;
 	}
 }
 
@@ -360,6 +362,7 @@ struct MenuList * menu_set_get_menu(struct MenuSet * menu, char * submenu) {
 void menu_insert(struct MenuList * menu, struct MenuEntry * entry) {
 	list_insert(menu->entries, entry);
 	entry->_owner = menu;
+	menu->dirty = 1;
 }
 
 struct MenuList * menu_create(void) {
@@ -372,6 +375,8 @@ struct MenuList * menu_create(void) {
 	p->_bar = NULL;
 	p->parent = NULL;
 	p->closed = 1;
+	p->backing = NULL;
+	p->dirty = 1;
 	return p;
 }
 
@@ -428,6 +433,8 @@ struct MenuSet * menu_set_from_description(const char * path, void (*callback)(s
 			p->_bar = NULL;
 			p->parent = NULL;
 			p->closed = 1;
+			p->backing = NULL;
+			p->dirty = 1;
 			hashmap_set(out, line+1, p);
 			current_menu = p;
 		} else if (*line == '#') {
@@ -495,10 +502,34 @@ failure:
 	return NULL;
 }
 
-static void _menu_redraw(yutani_window_t * menu_window, yutani_t * yctx, struct MenuList * menu) {
+static void _menu_prerender(struct MenuList * menu) {
+	if (menu->backing && !menu->dirty) return;
+
+	/* Calculate window dimensions */
+	int height, width;
+	_menu_calculate_dimensions(menu, &height, &width);
+
+	if (menu->window) {
+		/* Keep the cache in step with the live window; new dimensions
+		 * will take effect the next time the menu is shown. */
+		width = menu->window->width;
+		height = menu->window->height;
+		foreach(node, menu->entries) {
+			struct MenuEntry * entry = node->value;
+			entry->width = width;
+		}
+	}
+
+	if (menu->backing && ((int)menu->backing->width != width || (int)menu->backing->height != height)) {
+		sprite_free(menu->backing);
+		menu->backing = NULL;
+	}
+	if (!menu->backing) {
+		menu->backing = create_sprite(width, height, ALPHA_OPAQUE);
+	}
+
+	gfx_context_t * ctx = init_graphics_sprite(menu->backing);
 
-	gfx_context_t * ctx = menu->ctx;
-	list_t * entries = menu->entries;
 	/* Window background */
 	draw_fill(ctx, MENU_BACKGROUND);
 
@@ -508,13 +539,48 @@ static void _menu_redraw(yutani_window_t * menu_window, yutani_t * yctx, struct
 	draw_line(ctx, ctx->width-1, ctx->width-1, 0, ctx->height-1, rgb(109,111,112));
 	draw_line(ctx, 0, ctx->width-1, ctx->height-1, ctx->height-1, rgb(109,111,112));
 
-	/* Draw menu entries */
+	/* Draw every entry in its resting state */
+	struct MenuList * saved_child = menu->child;
+	menu->child = NULL;
 	int offset = 4;
-	foreach(node, entries) {
+	foreach(node, menu->entries) {
 		struct MenuEntry * entry = node->value;
+		int h = entry->hilight;
+		entry->hilight = 0;
 		if (entry->renderer) {
 			entry->renderer(ctx, entry, offset);
 		}
+		entry->hilight = h;
+		offset += entry->height;
+	}
+	menu->child = saved_child;
+
+	free(ctx);
+	menu->dirty = 0;
+}
+
+static void _menu_redraw(yutani_window_t * menu_window, yutani_t * yctx, struct MenuList * menu) {
+
+	gfx_context_t * ctx = menu->ctx;
+
+	/* Start from the cached render of the resting menu... */
+	memcpy(ctx->backbuffer, menu->backing->bitmap, menu->backing->width * menu->backing->height * sizeof(uint32_t));
+
+	/* ...and re-render only the entries that differ from it */
+	int offset = 4;
+	foreach(node, menu->entries) {
+		struct MenuEntry * entry = node->value;
+		entry->offset = offset;
+		int changed = entry->hilight;
+		if (entry->_type == MenuEntry_Submenu) {
+			struct MenuEntry_Submenu * sub = (struct MenuEntry_Submenu *)entry;
+			if (sub->_my_child && menu->child == sub->_my_child) {
+				changed = 1;
+			}
+		}
+		if (changed && entry->renderer) {
+			entry->renderer(ctx, entry, offset);
+		}
 
 		offset += entry->height;
 	}
@@ -524,17 +590,21 @@ static void _menu_redraw(yutani_window_t * menu_window, yutani_t * yctx, struct
 	yutani_flip(yctx, menu_window);
 }
 
-void menu_show(struct MenuList * menu, yutani_t * yctx) {
-	/* Calculate window dimensions */
-	int height, width;
-	_menu_calculate_dimensions(menu,&height, &width);
+void menu_prepare(struct MenuList * menu, yutani_t * yctx) {
+	my_yctx = yctx;
+	_menu_prerender(menu);
+}
 
+void menu_show(struct MenuList * menu, yutani_t * yctx) {
 	my_yctx = yctx;
 
 	menu->closed = 0;
 
+	/* Make sure the cached render is up to date; it decides our size */
+	_menu_prerender(menu);
+
 	/* Create window */
-	yutani_window_t * menu_window = yutani_window_create_flags(yctx, width, height, YUTANI_WINDOW_FLAG_ALT_ANIMATION);
+	yutani_window_t * menu_window = yutani_window_create_flags(yctx, menu->backing->width, menu->backing->height, YUTANI_WINDOW_FLAG_ALT_ANIMATION);
 	if (menu->ctx) {
 		reinit_graphics_yutani(menu->ctx, menu_window);
 	} else {
@@ -787,6 +857,10 @@ void menu_mouse_action(struct MenuList * menu, struct yutani_msg_window_mouse_ev
 void menu_force_redraw(struct MenuList * menu) {
 	yutani_window_t * window = menu->window;
 	yutani_t * yctx = window->ctx;
+	/* Entries with dynamic content (eg. the panel's clock) depend on
+	 * this invalidating the cached render, not just repainting it. */
+	menu->dirty = 1;
+	_menu_prerender(menu);
 	_menu_redraw(window,yctx,menu);
 }
 
@@ -8,7 +8,6 @@
  * Provides a friendly interface to the "Packet Exchange"
  * functionality provided by the packetfs kernel module.
  */
-#include <alloca.h>
 #include <assert.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -16,17 +15,20 @@
 #include <string.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
+#include <sys/uio.h>
 
 #include <toaru/pex.h>
 
 size_t pex_send(FILE * sock, unsigned int rcpt, size_t size, char * blob) {
 	assert(size <= MAX_PACKET_SIZE);
-	pex_header_t * broadcast = malloc(sizeof(pex_header_t) + size);
-	broadcast->target = rcpt;
-	memcpy(broadcast->data, blob, size);
-	size_t out = write(fileno(sock), broadcast, sizeof(pex_header_t) + size);
-	free(broadcast);
-	return out;
+	/* The routing header and the payload go down as separate
+	 * segments; packetfs keeps them in one packet. */
+	pex_header_t header = { .target = rcpt };
+	struct iovec iov[2] = {
+		{ &header, sizeof(pex_header_t) },
+		{ blob, size },
+	};
+	return writev(fileno(sock), iov, 2);
 }
 
 size_t pex_broadcast(FILE * sock, size_t size, char * blob) {
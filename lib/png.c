@@ -7,10 +7,15 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <toaru/graphics.h>
 #include <toaru/inflate.h>
 
+#ifndef NO_SSE
+#include <emmintrin.h>
+#endif
+
 /**
  * Read 32-bit big-endian value from file.
  */
@@ -50,12 +55,7 @@ static char*  reorder_type(unsigned int type) {
 struct png_ctx {
 	FILE * f;          /* File being decoded. */
 	sprite_t * sprite; /* Sprite being generated. */
-	int y;             /* Cursor pointers for writing out bitmap data */
-	int x;
-	char buffer[4];   /* A buffer to hold a pixel's worth of data until it can
-	                     be written out to the image with the right filter. */
-	int  buf_off;     /* How much data is in the above buffer */
-	int seen_ihdr;    /* Whether the IHDR was seen; for error handling */
+	int seen_ihdr;     /* Whether the IHDR was seen; for error handling */
 
 	unsigned int width;   /* Image width (dup from sprite) */
 	unsigned int height;  /* Image height (dup from sprite) */
@@ -63,10 +63,26 @@ struct png_ctx {
 	int color_type;       /* PNG color type */
 	int compression;      /* Compression method (must be 0) */
 	int filter;           /* Filter method (must be 0) */
-	int interlace;        /* Interlace method (we only support 0) */
+	int interlace;        /* Interlace method (0 or Adam7) */
 
 	unsigned int size;    /* Remaining IDAT chunk size */
 	int sf;               /* Current scanline filter type */
+
+	int bpp;              /* Bytes per pixel in the byte stream */
+	uint8_t * row;        /* Raw bytes of the scanline being collected */
+	uint8_t * prev;       /* The previous, already-defiltered scanline */
+	unsigned int row_bytes; /* Byte length of a scanline in the current pass */
+	unsigned int row_off; /* Progress through the current scanline */
+	unsigned int row_num; /* Scanline within the current pass */
+	int done;             /* All passes complete; discard further output */
+
+	/* Geometry of the current interlace pass; a non-interlaced
+	 * image is a single pass covering the whole frame. */
+	int pass;
+	unsigned int pass_w;
+	unsigned int pass_h;
+	int xoff, yoff;
+	int xstep, ystep;
 };
 
 /* PNG chunk types */
@@ -133,230 +149,175 @@ static int paeth(int a, int b, int c) {
 	return c;
 }
 
-static void write_pixel(struct png_ctx * c, uint32_t color) {
-	SPRITE((c->sprite), (c->x), (c->y)) = color;
-
-	/* Reset the short buffer */
-	c->buf_off = 0;
-
-	/* Advance to next pixel */
-	c->x++;
-	if (c->x == (int)c->width) {
-		/* Advance to next line; next read is scanline filter type */
-		c->x = -1;
-		c->y++;
-	}
-}
+/* Adam7 pass geometry; pixels within each 8×8 tile, per pass */
+static const int adam7_xoff[7]  = { 0, 4, 0, 2, 0, 1, 0 };
+static const int adam7_yoff[7]  = { 0, 0, 4, 0, 2, 0, 1 };
+static const int adam7_xstep[7] = { 8, 8, 4, 4, 2, 2, 1 };
+static const int adam7_ystep[7] = { 8, 8, 8, 4, 4, 2, 2 };
 
-static void process_pixel_type_6(struct png_ctx * c) {
-	/*
-	 * Obtain pixel data from short buffer;
-	 * For color type 6, this is always in R G B A order in the
-	 * bytestream, so we don't have to worry about subpixel ordering
-	 * or weird color masks.
-	 */
-	unsigned int r = c->buffer[0];
-	unsigned int g = c->buffer[1];
-	unsigned int b = c->buffer[2];
-	unsigned int a = c->buffer[3];
-
-	/* Apply filters */
-	if (c->sf == PNG_FILTER_SUB) {
-		/* Add raw value to the pixel on the left */
-		if (c->x > 0) {
-			uint32_t left = SPRITE((c->sprite), (c->x - 1), (c->y));
-			r += _RED(left);
-			g += _GRE(left);
-			b += _BLU(left);
-			a += _ALP(left);
-		}
-	} else if (c->sf == PNG_FILTER_UP) {
-		/* Add raw value to the pixel above */
-		if (c->y > 0) {
-			uint32_t up = SPRITE((c->sprite), (c->x), (c->y - 1));
-			r += _RED(up);
-			g += _GRE(up);
-			b += _BLU(up);
-			a += _ALP(up);
+/**
+ * Advance to the next pass that actually has pixels in it.
+ * Returns 0 when the image is complete.
+ */
+static int setup_pass(struct png_ctx * c) {
+	if (!c->interlace) {
+		/* The whole image is one pass */
+		if (c->pass) return 0;
+		c->pass = 1;
+		c->xoff = 0; c->yoff = 0;
+		c->xstep = 1; c->ystep = 1;
+		c->pass_w = c->width;
+		c->pass_h = c->height;
+	} else {
+		while (1) {
+			if (c->pass == 7) return 0;
+			int p = c->pass++;
+			c->xoff = adam7_xoff[p];
+			c->yoff = adam7_yoff[p];
+			c->xstep = adam7_xstep[p];
+			c->ystep = adam7_ystep[p];
+			c->pass_w = (c->width  > (unsigned int)c->xoff) ? (c->width  - c->xoff + c->xstep - 1) / c->xstep : 0;
+			c->pass_h = (c->height > (unsigned int)c->yoff) ? (c->height - c->yoff + c->ystep - 1) / c->ystep : 0;
+			/* Small images can leave a pass with no pixels at all,
+			 * in which case it has no scanlines either */
+			if (c->pass_w && c->pass_h) break;
 		}
-	} else if (c->sf == PNG_FILTER_AVG) {
-		/* Add raw value to the average of the pixel above and left */
-		uint32_t left = (c->x > 0) ? SPRITE((c->sprite), (c->x - 1), (c->y)) : 0;
-		uint32_t up = (c->y > 0) ? SPRITE((c->sprite), (c->x), (c->y - 1)) : 0;
-
-		r += ((int)_RED(left) + (int)_RED(up)) / 2;
-		g += ((int)_GRE(left) + (int)_GRE(up)) / 2;
-		b += ((int)_BLU(left) + (int)_BLU(up)) / 2;
-		a += ((int)_ALP(left) + (int)_ALP(up)) / 2;
-	} else if (c->sf == PNG_FILTER_PAETH) {
-		/* Use the Paeth predictor */
-		uint32_t left = (c->x > 0) ? SPRITE((c->sprite), (c->x - 1), (c->y)) : 0;
-		uint32_t up = (c->y > 0) ? SPRITE((c->sprite), (c->x), (c->y - 1)) : 0;
-		uint32_t upleft = (c->x > 0 && c->y > 0) ? SPRITE((c->sprite), (c->x - 1), (c->y - 1)) : 0;
-
-		r = ((int)r + paeth((int)_RED(left),(int)_RED(up),(int)_RED(upleft))) % 256;
-		g = ((int)g + paeth((int)_GRE(left),(int)_GRE(up),(int)_GRE(upleft))) % 256;
-		b = ((int)b + paeth((int)_BLU(left),(int)_BLU(up),(int)_BLU(upleft))) % 256;
-		a = ((int)a + paeth((int)_ALP(left),(int)_ALP(up),(int)_ALP(upleft))) % 256;
 	}
 
-	/* Write new pixel to the image */
-	write_pixel(c, rgba(r,g,b,a));
-}
+	c->row_bytes = c->pass_w * c->bpp;
+	c->row_num = 0;
 
-static void process_pixel_type_2(struct png_ctx * c) {
-	/*
-	 * Obtain pixel data from short buffer;
-	 * For color type 6, this is always in R G B A order in the
-	 * bytestream, so we don't have to worry about subpixel ordering
-	 * or weird color masks.
-	 */
-	unsigned int r = c->buffer[0];
-	unsigned int g = c->buffer[1];
-	unsigned int b = c->buffer[2];
-
-	/* Apply filters */
-	if (c->sf == PNG_FILTER_SUB) {
-		/* Add raw value to the pixel on the left */
-		if (c->x > 0) {
-			uint32_t left = SPRITE((c->sprite), (c->x - 1), (c->y));
-			r += _RED(left);
-			g += _GRE(left);
-			b += _BLU(left);
-		}
-	} else if (c->sf == PNG_FILTER_UP) {
-		/* Add raw value to the pixel above */
-		if (c->y > 0) {
-			uint32_t up = SPRITE((c->sprite), (c->x), (c->y - 1));
-			r += _RED(up);
-			g += _GRE(up);
-			b += _BLU(up);
-		}
-	} else if (c->sf == PNG_FILTER_AVG) {
-		/* Add raw value to the average of the pixel above and left */
-		uint32_t left = (c->x > 0) ? SPRITE((c->sprite), (c->x - 1), (c->y)) : 0;
-		uint32_t up = (c->y > 0) ? SPRITE((c->sprite), (c->x), (c->y - 1)) : 0;
-
-		r += ((int)_RED(left) + (int)_RED(up)) / 2;
-		g += ((int)_GRE(left) + (int)_GRE(up)) / 2;
-		b += ((int)_BLU(left) + (int)_BLU(up)) / 2;
-	} else if (c->sf == PNG_FILTER_PAETH) {
-		/* Use the Paeth predictor */
-		uint32_t left = (c->x > 0) ? SPRITE((c->sprite), (c->x - 1), (c->y)) : 0;
-		uint32_t up = (c->y > 0) ? SPRITE((c->sprite), (c->x), (c->y - 1)) : 0;
-		uint32_t upleft = (c->x > 0 && c->y > 0) ? SPRITE((c->sprite), (c->x - 1), (c->y - 1)) : 0;
-
-		r = ((int)r + paeth((int)_RED(left),(int)_RED(up),(int)_RED(upleft))) % 256;
-		g = ((int)g + paeth((int)_GRE(left),(int)_GRE(up),(int)_GRE(upleft))) % 256;
-		b = ((int)b + paeth((int)_BLU(left),(int)_BLU(up),(int)_BLU(upleft))) % 256;
-	}
+	/* The first scanline of a pass filters against an all-zero row */
+	memset(c->prev, 0, c->row_bytes);
 
-	/* Write new pixel to the image */
-	write_pixel(c, rgb(r,g,b));
+	return 1;
 }
 
-static void process_pixel_type_4(struct png_ctx * c) {
-	/*
-	 * Obtain pixel data from short buffer;
-	 * For color type 6, this is always in R G B A order in the
-	 * bytestream, so we don't have to worry about subpixel ordering
-	 * or weird color masks.
-	 */
-	unsigned int b = c->buffer[0];
-	unsigned int a = c->buffer[1];
-
-	/* Apply filters */
-	if (c->sf == PNG_FILTER_SUB) {
-		/* Add raw value to the pixel on the left */
-		if (c->x > 0) {
-			uint32_t left = SPRITE((c->sprite), (c->x - 1), (c->y));
-			b += _BLU(left);
-			a += _ALP(left);
-		}
-	} else if (c->sf == PNG_FILTER_UP) {
-		/* Add raw value to the pixel above */
-		if (c->y > 0) {
-			uint32_t up = SPRITE((c->sprite), (c->x), (c->y - 1));
-			b += _BLU(up);
-			a += _ALP(up);
-		}
-	} else if (c->sf == PNG_FILTER_AVG) {
-		/* Add raw value to the average of the pixel above and left */
-		uint32_t left = (c->x > 0) ? SPRITE((c->sprite), (c->x - 1), (c->y)) : 0;
-		uint32_t up = (c->y > 0) ? SPRITE((c->sprite), (c->x), (c->y - 1)) : 0;
-
-		b += ((int)_BLU(left) + (int)_BLU(up)) / 2;
-		a += ((int)_ALP(left) + (int)_ALP(up)) / 2;
-	} else if (c->sf == PNG_FILTER_PAETH) {
-		/* Use the Paeth predictor */
-		uint32_t left = (c->x > 0) ? SPRITE((c->sprite), (c->x - 1), (c->y)) : 0;
-		uint32_t up = (c->y > 0) ? SPRITE((c->sprite), (c->x), (c->y - 1)) : 0;
-		uint32_t upleft = (c->x > 0 && c->y > 0) ? SPRITE((c->sprite), (c->x - 1), (c->y - 1)) : 0;
-
-		b = ((int)b + paeth((int)_BLU(left),(int)_BLU(up),(int)_BLU(upleft))) % 256;
-		a = ((int)a + paeth((int)_ALP(left),(int)_ALP(up),(int)_ALP(upleft))) % 256;
+/**
+ * Reverse the scanline filter over the whole row at once.
+ * Everything here works on raw stream bytes, so it is independent
+ * of the color type; `prev` is the defiltered previous scanline.
+ */
+static void defilter_row(struct png_ctx * c) {
+	uint8_t * row = c->row;
+	uint8_t * prev = c->prev;
+	unsigned int n = c->row_bytes;
+	unsigned int bpp = c->bpp;
+	unsigned int i;
+
+	switch (c->sf) {
+		case PNG_FILTER_NONE:
+			break;
+		case PNG_FILTER_SUB:
+			/* Serial in the pixel before, so this one stays scalar */
+			for (i = bpp; i < n; ++i) {
+				row[i] += row[i - bpp];
+			}
+			break;
+		case PNG_FILTER_UP:
+			/* No horizontal dependency - add the previous row straight across */
+#ifndef NO_SSE
+			for (i = 0; i + 16 <= n; i += 16) {
+				__m128i r = _mm_loadu_si128((__m128i *)&row[i]);
+				__m128i p = _mm_loadu_si128((__m128i *)&prev[i]);
+				_mm_storeu_si128((__m128i *)&row[i], _mm_add_epi8(r, p));
+			}
+#else
+			i = 0;
+#endif
+			for (; i < n; ++i) {
+				row[i] += prev[i];
+			}
+			break;
+		case PNG_FILTER_AVG:
+			for (i = 0; i < bpp; ++i) {
+				row[i] += prev[i] / 2;
+			}
+			for (i = bpp; i < n; ++i) {
+				row[i] += (row[i - bpp] + prev[i]) / 2;
+			}
+			break;
+		case PNG_FILTER_PAETH:
+			/* paeth(0,b,0) is always b */
+			for (i = 0; i < bpp; ++i) {
+				row[i] += prev[i];
+			}
+			for (i = bpp; i < n; ++i) {
+				row[i] += paeth(row[i - bpp], prev[i], prev[i - bpp]);
+			}
+			break;
 	}
-
-	/* Write new pixel to the image */
-	write_pixel(c, rgba(b,b,b,a));
 }
 
-static void process_pixel_type_0(struct png_ctx * c) {
-	unsigned int b = c->buffer[0];
-	if (c->sf == PNG_FILTER_SUB) {
-		if (c->x > 0) {
-			uint32_t left = SPRITE((c->sprite), (c->x - 1), (c->y));
-			b += _BLU(left);
-		}
-	} else if (c->sf == PNG_FILTER_UP) {
-		if (c->y > 0) {
-			uint32_t up = SPRITE((c->sprite), (c->x), (c->y - 1));
-			b += _BLU(up);
-		}
-	} else if (c->sf == PNG_FILTER_AVG) {
-		uint32_t left = (c->x > 0) ? SPRITE((c->sprite), (c->x - 1), (c->y)) : 0;
-		uint32_t up = (c->y > 0) ? SPRITE((c->sprite), (c->x), (c->y - 1)) : 0;
-		b += ((int)_BLU(left) + (int)_BLU(up)) / 2;
-	} else if (c->sf == PNG_FILTER_PAETH) {
-		uint32_t left = (c->x > 0) ? SPRITE((c->sprite), (c->x - 1), (c->y)) : 0;
-		uint32_t up = (c->y > 0) ? SPRITE((c->sprite), (c->x), (c->y - 1)) : 0;
-		uint32_t upleft = (c->x > 0 && c->y > 0) ? SPRITE((c->sprite), (c->x - 1), (c->y - 1)) : 0;
-		b = ((int)b + paeth((int)_BLU(left),(int)_BLU(up),(int)_BLU(upleft))) % 256;
+/**
+ * Convert a defiltered scanline to pixels in the sprite.
+ */
+static void emit_row(struct png_ctx * c) {
+	int y = c->yoff + c->row_num * c->ystep;
+	int x = c->xoff;
+	uint8_t * s = c->row;
+
+	switch (c->color_type) {
+		case 0:
+			for (unsigned int i = 0; i < c->pass_w; ++i, x += c->xstep, s += 1) {
+				SPRITE((c->sprite), x, y) = rgb(s[0], s[0], s[0]);
+			}
+			break;
+		case 2:
+			for (unsigned int i = 0; i < c->pass_w; ++i, x += c->xstep, s += 3) {
+				SPRITE((c->sprite), x, y) = rgb(s[0], s[1], s[2]);
+			}
+			break;
+		case 4:
+			for (unsigned int i = 0; i < c->pass_w; ++i, x += c->xstep, s += 2) {
+				SPRITE((c->sprite), x, y) = rgba(s[0], s[0], s[0], s[1]);
+			}
+			break;
+		case 6:
+			for (unsigned int i = 0; i < c->pass_w; ++i, x += c->xstep, s += 4) {
+				SPRITE((c->sprite), x, y) = rgba(s[0], s[1], s[2], s[3]);
+			}
+			break;
 	}
-
-	/* Write new pixel to the image */
-	write_pixel(c, rgb(b,b,b));
 }
 
-
 /**
  * Handle decompressed output from the inflater
  *
- * Writes pixel data to the image, and applies relevant filters.
+ * Collects scanlines, defiltering and writing each one out to the
+ * sprite as soon as its last byte arrives, so decompression and
+ * filtering stay overlapped and nothing is buffered beyond two rows.
  */
 static void _write(struct inflate_context * ctx, unsigned int sym) {
 	struct png_ctx * c = (ctx->input_priv);
 
-	/* Put this byte into the short buffer */
-	c->buffer[c->buf_off] = sym;
-	c->buf_off++;
+	if (c->done) return;
 
-	/* If this is the beginning of a scanline... */
-	if (c->x == -1 && c->buf_off == 1) {
-		/* Then this is the scanline filter type */
+	/* The first byte of every scanline is its filter type */
+	if (c->row_off == 0) {
 		c->sf = sym;
+		c->row_off++;
+		return;
+	}
+
+	c->row[c->row_off - 1] = sym;
+	c->row_off++;
 
-		/* Reset the buffer, advance to the beginning of the actual scanline */
-		c->x = 0;
-		c->buf_off = 0;
-	} else if (c->buf_off == 1 && c->color_type == 0) {
-		process_pixel_type_0(c);
-	} else if (c->buf_off == 2 && c->color_type == 4) {
-		process_pixel_type_4(c);
-	} else if (c->buf_off == 3 && c->color_type == 2) {
-		process_pixel_type_2(c);
-	} else if (c->buf_off == 4 && c->color_type == 6) {
-		process_pixel_type_6(c);
+	if (c->row_off == c->row_bytes + 1) {
+		/* Scanline complete */
+		defilter_row(c);
+		emit_row(c);
+
+		/* This row is the filter input for the next one */
+		uint8_t * tmp = c->prev;
+		c->prev = c->row;
+		c->row = tmp;
+
+		c->row_off = 0;
+		c->row_num++;
+		if (c->row_num == c->pass_h) {
+			if (!setup_pass(c)) c->done = 1;
+		}
 	}
 }
 
@@ -389,12 +350,9 @@ int load_sprite_png(sprite_t * sprite, char * filename) {
 
 	/* Set up context for future calls to inflate */
 	struct png_ctx c;
+	memset(&c, 0, sizeof(struct png_ctx));
 	c.sprite = sprite;
-	c.x = -1;
-	c.y = 0;
 	c.f = f;
-	c.buf_off = 0;
-	c.seen_ihdr = 0;
 
 	while (1) {
 		/* read chunks */
@@ -436,6 +394,16 @@ int load_sprite_png(sprite_t * sprite, char * filename) {
 					sprite->alpha = color_type_has_alpha(c.color_type);
 					sprite->blank = 0;
 
+					/* Scanline buffers, sized for the widest pass */
+					switch (c.color_type) {
+						case 0: c.bpp = 1; break;
+						case 2: c.bpp = 3; break;
+						case 4: c.bpp = 2; break;
+						default: c.bpp = 4; break;
+					}
+					c.row  = malloc(c.width * c.bpp);
+					c.prev = malloc(c.width * c.bpp);
+					setup_pass(&c);
 
 					/* Skip */
 					for (unsigned int i = 13; i < size; ++i) fgetc(f);
@@ -490,6 +458,9 @@ int load_sprite_png(sprite_t * sprite, char * filename) {
 		(void)crc32;
 	}
 
+	free(c.row);
+	free(c.prev);
+
 	/*
 	 * Data in PNGs is unpremultiplied, but our sprites expect
 	 * premultiplied alpha, so convert the image data
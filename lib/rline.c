@@ -61,6 +61,21 @@ char * rline_exit_string = "exit\n";
 
 static char rline_temp[1024];
 
+/* One-word bloom filter of the characters in each history entry; an
+ * entry can only contain the search input if its mask covers the
+ * input's, which lets reverse search skip most entries without
+ * running strstr on them. */
+static uint32_t rline_history_masks[RLINE_HISTORY_ENTRIES];
+
+static uint32_t rline_charmask(const char * str) {
+	uint32_t mask = 0;
+	while (*str) {
+		mask |= 1 << (*str & 31);
+		str++;
+	}
+	return mask;
+}
+
 void rline_history_insert(char * str) {
 	if (str[strlen(str)-1] == '\n') {
 		str[strlen(str)-1] = '\0';
@@ -74,9 +89,11 @@ void rline_history_insert(char * str) {
 	if (rline_history_count == RLINE_HISTORY_ENTRIES) {
 		free(rline_history[rline_history_offset]);
 		rline_history[rline_history_offset] = str;
+		rline_history_masks[rline_history_offset] = rline_charmask(str);
 		rline_history_offset = (rline_history_offset + 1) % RLINE_HISTORY_ENTRIES;
 	} else {
 		rline_history[rline_history_count] = str;
+		rline_history_masks[rline_history_count] = rline_charmask(str);
 		rline_history_count++;
 	}
 }
@@ -91,6 +108,7 @@ void rline_history_append_line(char * str) {
 		}
 		free(*s);
 		*s = c;
+		rline_history_masks[(rline_history_count - 1 + rline_history_offset) % RLINE_HISTORY_ENTRIES] = rline_charmask(c);
 	} else {
 		/* wat */
 	}
@@ -104,6 +122,20 @@ char * rline_history_prev(int item) {
 	return rline_history_get(rline_history_count - item);
 }
 
+/*
+ * Newest-first index (0 = most recent) of the first entry at or after
+ * start_at containing needle, or -1 if nothing matches.
+ */
+int rline_history_search(const char * needle, int start_at) {
+	uint32_t mask = rline_charmask(needle);
+	for (int i = start_at; i < rline_history_count; i++) {
+		int slot = (rline_history_count - (i + 1) + rline_history_offset) % RLINE_HISTORY_ENTRIES;
+		if ((rline_history_masks[slot] & mask) != mask) continue;
+		if (strstr(rline_history[slot], needle)) return i;
+	}
+	return -1;
+}
+
 void rline_reverse_search(rline_context_t * context) {
 	char input[512] = {0};
 	int collected = 0;
@@ -120,13 +152,10 @@ try_rev_search_again:
 		if (collected && changed) {
 			match = "";
 			match_index = 0;
-			for (int i = start_at; i < rline_history_count; i++) {
-				char * c = rline_history_prev(i+1);
-				if (strstr(c, input)) {
-					match = c;
-					match_index = i;
-					break;
-				}
+			int found = rline_history_search(input, start_at);
+			if (found >= 0) {
+				match = rline_history_prev(found + 1);
+				match_index = found;
 			}
 			if (!strcmp(match,"")) {
 				if (start_at) {
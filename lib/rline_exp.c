@@ -864,7 +864,6 @@ static void set_colors(const char * fg, const char * bg) {
 	} else {
 		printf("38;%sm", fg);
 	}
-	fflush(stdout);
 }
 
 /**
@@ -884,25 +883,134 @@ static void set_fg_color(const char * fg) {
 	} else {
 		printf("38;%sm", fg);
 	}
-	fflush(stdout);
 }
 
 /**
- * Mostly copied from bim, but with some minor
- * alterations and removal of selection support.
+ * Damage tracking for incremental redraw.
+ *
+ * render_line() builds the row into an array of cells (one terminal
+ * column each, with the colors in effect) and diffs it against the
+ * cells from the previous paint, so a keypress normally costs one
+ * cursor move plus the span that actually changed instead of a full
+ * prompt + line + highlight repaint. That matters a lot over serial
+ * consoles and pty links.
  */
-static void render_line(void) {
-	printf("\033[?25l");
-	if (show_left_side) {
-		printf("\033[0m\r%s", prompt);
-	} else {
-		printf("\033[0m\r$");
+struct render_cell {
+	char bytes[8];          /* UTF-8 bytes drawn in this column */
+	const char * fg;        /* Colors in effect when it was drawn */
+	const char * bg;
+};
+
+static struct render_cell * cells_new = NULL;
+static struct render_cell * cells_old = NULL;
+static int cells_avail = 0;
+static int cells_new_count = 0;
+static int cells_old_count = 0;
+static const char * cell_fg;
+static const char * cell_bg;
+
+/* What the previous paint looked like outside the cell region;
+ * if any of this changed the whole row is repainted. */
+static struct {
+	int valid;
+	char * prompt;
+	char * prompt_right;
+	int offset_marker;
+	int width;
+	int prompt_width_calc;
+	int show_left_side;
+	int show_right_side;
+} last_paint = {0};
+
+static void cell_colors(const char * fg, const char * bg) {
+	cell_fg = fg;
+	cell_bg = bg;
+}
+
+static void cell_fg_only(const char * fg) {
+	cell_fg = fg;
+}
+
+/* Append one column to the row being built */
+static void cell_char(const char * bytes) {
+	if (cells_new_count == cells_avail) {
+		cells_avail = cells_avail ? cells_avail * 2 : 256;
+		cells_new = realloc(cells_new, sizeof(struct render_cell) * cells_avail);
+		cells_old = realloc(cells_old, sizeof(struct render_cell) * cells_avail);
+	}
+	struct render_cell * c = &cells_new[cells_new_count++];
+	size_t len = strlen(bytes);
+	if (len > sizeof(c->bytes) - 1) len = sizeof(c->bytes) - 1;
+	memcpy(c->bytes, bytes, len);
+	c->bytes[len] = '\0';
+	c->fg = cell_fg;
+	c->bg = cell_bg;
+}
+
+/* Append a multi-column ASCII rendering, one byte per cell */
+static void cell_ascii(const char * s) {
+	char one[2] = {0, 0};
+	for (; *s; ++s) {
+		one[0] = *s;
+		cell_char(one);
 	}
+}
 
-	if (offset && prompt_width_calc) {
-		set_colors(COLOR_ALT_FG, COLOR_ALT_BG);
-		printf("\b<");
+static int cell_same(struct render_cell * a, struct render_cell * b) {
+	return !strcmp(a->bytes, b->bytes) && !strcmp(a->fg, b->fg) && !strcmp(a->bg, b->bg);
+}
+
+/* Write a run of cells to the terminal, changing colors only when needed */
+static void emit_cells(int from, int to) {
+	const char * efg = NULL;
+	const char * ebg = NULL;
+	for (int k = from; k <= to; ++k) {
+		struct render_cell * c = &cells_new[k];
+		if (!efg || strcmp(c->bg, ebg)) {
+			set_colors(c->fg, c->bg);
+			efg = c->fg;
+			ebg = c->bg;
+		} else if (strcmp(c->fg, efg)) {
+			set_fg_color(c->fg);
+			efg = c->fg;
+		}
+		printf("%s", c->bytes);
 	}
+}
+
+static int last_paint_matches(void) {
+	return last_paint.valid &&
+		last_paint.width == width &&
+		last_paint.prompt_width_calc == prompt_width_calc &&
+		last_paint.show_left_side == show_left_side &&
+		last_paint.show_right_side == show_right_side &&
+		last_paint.offset_marker == (offset && prompt_width_calc ? 1 : 0) &&
+		last_paint.prompt && !strcmp(last_paint.prompt, prompt) &&
+		last_paint.prompt_right && !strcmp(last_paint.prompt_right, prompt_right);
+}
+
+static void last_paint_store(void) {
+	if (last_paint.prompt) free(last_paint.prompt);
+	if (last_paint.prompt_right) free(last_paint.prompt_right);
+	last_paint.valid = 1;
+	last_paint.prompt = strdup(prompt);
+	last_paint.prompt_right = strdup(prompt_right);
+	last_paint.offset_marker = (offset && prompt_width_calc ? 1 : 0);
+	last_paint.width = width;
+	last_paint.prompt_width_calc = prompt_width_calc;
+	last_paint.show_left_side = show_left_side;
+	last_paint.show_right_side = show_right_side;
+}
+
+/**
+ * Mostly copied from bim, but with some minor
+ * alterations and removal of selection support.
+ *
+ * The visible line is first modelled as cells, then only the part of
+ * the screen that differs from the previous paint is rewritten.
+ */
+static void render_line(void) {
+	cells_new_count = 0;
 
 	int i = 0; /* Offset in char_t line data entries */
 	int j = 0; /* Offset in terminal cells */
@@ -911,7 +1019,7 @@ static void render_line(void) {
 	int was_searching = 0;
 
 	/* Set default text colors */
-	set_colors(COLOR_FG, COLOR_BG);
+	cell_colors(COLOR_FG, COLOR_BG);
 
 	/*
 	 * When we are rendering in the middle of a wide character,
@@ -931,9 +1039,9 @@ static void render_line(void) {
 			/* If we should be drawing by now... */
 			if (j >= offset) {
 				/* Fill remainder with -'s */
-				set_colors(COLOR_ALT_FG, COLOR_ALT_BG);
-				printf("-");
-				set_colors(COLOR_FG, COLOR_BG);
+				cell_colors(COLOR_ALT_FG, COLOR_ALT_BG);
+				cell_char("-");
+				cell_colors(COLOR_FG, COLOR_BG);
 			}
 
 			/* One less remaining width cell to fill */
@@ -962,17 +1070,17 @@ static void render_line(void) {
 			/* If this character is going to fall off the edge of the screen... */
 			if (j - offset + c.display_width >= width - prompt_width_calc) {
 				/* We draw this with special colors so it isn't ambiguous */
-				set_colors(COLOR_ALT_FG, COLOR_ALT_BG);
+				cell_colors(COLOR_ALT_FG, COLOR_ALT_BG);
 
 				/* If it's wide, draw ---> as needed */
 				while (j - offset < width - prompt_width_calc - 1) {
-					printf("-");
+					cell_char("-");
 					j++;
 				}
 
 				/* End the line with a > to show it overflows */
-				printf(">");
-				set_colors(COLOR_FG, COLOR_BG);
+				cell_char(">");
+				cell_colors(COLOR_FG, COLOR_BG);
 				j++;
 				break;
 			}
@@ -980,61 +1088,61 @@ static void render_line(void) {
 			/* Syntax hilighting */
 			const char * color = flag_to_color(c.flags);
 			if ((c.flags & FLAG_SEARCH) || (c.flags == FLAG_NOTICE)) {
-				set_colors(COLOR_SEARCH_FG, COLOR_SEARCH_BG);
+				cell_colors(COLOR_SEARCH_FG, COLOR_SEARCH_BG);
 				was_searching = 1;
 			} else if (was_searching) {
-				set_colors(color, COLOR_BG);
+				cell_colors(color, COLOR_BG);
 				last_color = color;
 			} else if (!last_color || strcmp(color, last_color)) {
-				set_fg_color(color);
+				cell_fg_only(color);
 				last_color = color;
 			}
 
 			/* Render special characters */
 			if (c.codepoint == '\t') {
-				set_colors(COLOR_ALT_FG, COLOR_ALT_BG);
-				printf("»");
+				cell_colors(COLOR_ALT_FG, COLOR_ALT_BG);
+				cell_char("»");
 				for (int i = 1; i < c.display_width; ++i) {
-					printf("·");
+					cell_char("·");
 				}
-				set_colors(last_color ? last_color : COLOR_FG, COLOR_BG);
+				cell_colors(last_color ? last_color : COLOR_FG, COLOR_BG);
 			} else if (c.codepoint < 32) {
 				/* Codepoints under 32 to get converted to ^@ escapes */
-				set_colors(COLOR_ALT_FG, COLOR_ALT_BG);
-				printf("^%c", '@' + c.codepoint);
-				set_colors(last_color ? last_color : COLOR_FG, COLOR_BG);
+				char tmp[3] = {'^', '@' + c.codepoint, '\0'};
+				cell_colors(COLOR_ALT_FG, COLOR_ALT_BG);
+				cell_ascii(tmp);
+				cell_colors(last_color ? last_color : COLOR_FG, COLOR_BG);
 			} else if (c.codepoint == 0x7f) {
-				set_colors(COLOR_ALT_FG, COLOR_ALT_BG);
-				printf("^?");
-				set_colors(last_color ? last_color : COLOR_FG, COLOR_BG);
+				cell_colors(COLOR_ALT_FG, COLOR_ALT_BG);
+				cell_ascii("^?");
+				cell_colors(last_color ? last_color : COLOR_FG, COLOR_BG);
 			} else if (c.codepoint > 0x7f && c.codepoint < 0xa0) {
-				set_colors(COLOR_ALT_FG, COLOR_ALT_BG);
-				printf("<%2x>", c.codepoint);
-				set_colors(last_color ? last_color : COLOR_FG, COLOR_BG);
+				char tmp[8];
+				sprintf(tmp, "<%2x>", c.codepoint);
+				cell_colors(COLOR_ALT_FG, COLOR_ALT_BG);
+				cell_ascii(tmp);
+				cell_colors(last_color ? last_color : COLOR_FG, COLOR_BG);
 			} else if (c.codepoint == 0xa0) {
-				set_colors(COLOR_ALT_FG, COLOR_ALT_BG);
-				printf("_");
-				set_colors(last_color ? last_color : COLOR_FG, COLOR_BG);
+				cell_colors(COLOR_ALT_FG, COLOR_ALT_BG);
+				cell_char("_");
+				cell_colors(last_color ? last_color : COLOR_FG, COLOR_BG);
 			} else if (c.display_width == 8) {
-				set_colors(COLOR_ALT_FG, COLOR_ALT_BG);
-				printf("[U+%04x]", c.codepoint);
-				set_colors(last_color ? last_color : COLOR_FG, COLOR_BG);
+				char tmp[12];
+				sprintf(tmp, "[U+%04x]", c.codepoint);
+				cell_colors(COLOR_ALT_FG, COLOR_ALT_BG);
+				cell_ascii(tmp);
+				cell_colors(last_color ? last_color : COLOR_FG, COLOR_BG);
 			} else if (c.display_width == 10) {
-				set_colors(COLOR_ALT_FG, COLOR_ALT_BG);
-				printf("[U+%06x]", c.codepoint);
-				set_colors(last_color ? last_color : COLOR_FG, COLOR_BG);
-#if 0
-			} else if (c.codepoint == ' ' && i == line->actual - 1) {
-				/* Special case: space at end of line */
-				set_colors(COLOR_ALT_FG, COLOR_ALT_BG);
-				printf("·");
-				set_colors(COLOR_FG, COLOR_BG);
-#endif
+				char tmp[12];
+				sprintf(tmp, "[U+%06x]", c.codepoint);
+				cell_colors(COLOR_ALT_FG, COLOR_ALT_BG);
+				cell_ascii(tmp);
+				cell_colors(last_color ? last_color : COLOR_FG, COLOR_BG);
 			} else {
 				/* Normal characters get output */
 				char tmp[7]; /* Max six bytes, use 7 to ensure last is always nil */
 				to_eight(c.codepoint, tmp);
-				printf("%s", tmp);
+				cell_char(tmp);
 			}
 
 			/* Advance the terminal cell offset by the render width of this character */
@@ -1058,17 +1166,59 @@ static void render_line(void) {
 		}
 	}
 
-	set_colors(COLOR_FG, COLOR_BG);
+	cell_colors(COLOR_FG, COLOR_BG);
 
 	/* Fill to end right hand side */
 	for (; j < width + offset - prompt_width_calc; ++j) {
-		printf(" ");
+		cell_char(" ");
 	}
 
-	/* Print right hand side */
-	if (show_right_side) {
-		printf("\033[0m%s", prompt_right);
+	/* Hide cursor while we paint */
+	printf("\033[?25l");
+
+	if (!last_paint_matches()) {
+		/* Full repaint: prompt, every cell, right side */
+		if (show_left_side) {
+			printf("\033[0m\r%s", prompt);
+		} else {
+			printf("\033[0m\r$");
+		}
+
+		if (offset && prompt_width_calc) {
+			set_colors(COLOR_ALT_FG, COLOR_ALT_BG);
+			printf("\b<");
+		}
+
+		if (cells_new_count) {
+			emit_cells(0, cells_new_count - 1);
+		}
+
+		/* Print right hand side */
+		if (show_right_side) {
+			printf("\033[0m%s", prompt_right);
+		}
+
+		last_paint_store();
+	} else {
+		/* Emit only the span of cells that changed since last time */
+		int lo = 0;
+		int hi = cells_new_count - 1;
+		while (lo < cells_new_count && lo < cells_old_count && cell_same(&cells_new[lo], &cells_old[lo])) lo++;
+		while (hi >= lo && hi < cells_old_count && cell_same(&cells_new[hi], &cells_old[hi])) hi--;
+		if (hi >= lo) {
+			printf("\033[%dG", prompt_width_calc + 1 + lo);
+			emit_cells(lo, hi);
+		}
 	}
+
+	/* The new row becomes the old row for the next paint */
+	struct render_cell * tmp_cells = cells_old;
+	cells_old = cells_new;
+	cells_new = tmp_cells;
+	cells_old_count = cells_new_count;
+
+	/* One flush for the whole paint; colors no longer flush per escape */
+	fflush(stdout);
 }
 
 /**
@@ -1546,6 +1696,10 @@ static void call_rline_func(rline_callback_t func, rline_context_t * context) {
 	/* Call the function */
 	func(context);
 
+	/* The callback may have printed (completion candidates, etc.),
+	 * so the damage cache no longer reflects the screen. */
+	last_paint.valid = 0;
+
 	/* Now convert back */
 	loading = 1;
 	int final_column = 0;
@@ -1595,6 +1749,7 @@ static int read_line(void) {
 	uint32_t istate = 0;
 	int immediate = 1;
 
+	last_paint.valid = 0;
 	set_colors(COLOR_ALT_FG, COLOR_ALT_BG);
 	fprintf(stdout, "◄\033[0m"); /* TODO: This could be retrieved from an envvar */
 	for (int i = 0; i < full_width - 1; ++i) {
@@ -1667,6 +1822,7 @@ static int read_line(void) {
 						/* Don't bother with unicode, just take the next byte */
 						place_cursor_actual();
 						printf("^\b");
+						last_paint.valid = 0;
 						insert_char(getc(stdin));
 						immediate = 0;
 						break;
@@ -1676,6 +1832,7 @@ static int read_line(void) {
 						break;
 					case 12: /* ^L - Repaint the whole screen */
 						printf("\033[2J\033[H");
+						last_paint.valid = 0;
 						render_line();
 						place_cursor_actual();
 						break;
@@ -32,6 +32,11 @@ static sprite_t _font_data_mono_bold_oblique;
 
 static hashmap_t * _font_cache;
 
+/* Baked glyphs, keyed by codepoint / size / font / color */
+static hashmap_t * _glyph_cache;
+static int _glyph_cache_count = 0;
+#define GLYPH_CACHE_MAX 512
+
 static volatile int _sdf_lock = 0;
 static double gamma = 1.7;
 
@@ -69,12 +74,16 @@ __attribute__((constructor))
 static void _init_sdf(void) {
 	/* Load the font. */
 	_font_cache = hashmap_create_int(10);
+	_glyph_cache = hashmap_create(10);
 	{
 		char tmp[100];
 		char * display = getenv("DISPLAY");
 		if (!display) display = "compositor";
 		sprintf(tmp, "sys.%s.fonts", display);
-		_font_data = shm_obtain(tmp, &_font_data_size);
+		/* The compositor owns this segment; attach it read-only so a
+		 * stray write in one client can't corrupt the glyph data for
+		 * every process on the desktop. */
+		_font_data = shm_obtain_ro(tmp, &_font_data_size);
 	}
 
 	if (!_font_data_size) return;
@@ -156,27 +165,22 @@ static int _select_width(int _ch, int font) {
 	}
 }
 
-static int draw_sdf_character(gfx_context_t * ctx, int32_t x, int32_t y, int _ch, int size, uint32_t color, sprite_t * tmp, int font, sprite_t * _font_data, double buffer) {
-	int ch = (_ch >= 0 && _ch <= 128) ? _ch : (int)ununicode(_ch);
-
+static sprite_t * _bake_glyph(int ch, int size, uint32_t color, sprite_t * tmp, sprite_t * _font_data, double buffer) {
 	double scale = (double)size / 50.0;
-	int width = _select_width(ch, font) * scale;
 	int fx = ((BASE_WIDTH * ch) % _font_data->width) * scale;
 	int fy = (((BASE_WIDTH * ch) / _font_data->width) * BASE_HEIGHT) * scale;
 
 	int height = BASE_HEIGHT * ((double)size / 50.0);
 
+	sprite_t * out = create_sprite(size, height, ALPHA_EMBEDDED);
+	memset(out->bitmap, 0, sizeof(uint32_t) * size * height);
 
 	/* ignore size */
 	for (int j = 0; j < height; ++j) {
-		if (y + j < 0) continue;
-		if (y + j >= ctx->height) continue;
 		if (fy+j >= tmp->height) continue;
 		for (int i = 0; i < size; ++i) {
 			/* TODO needs to do bilinear filter */
 			if (fx+i >= tmp->width) continue;
-			if (x + i < 0) continue;
-			if (x + i >= ctx->width) continue;
 			uint32_t c = SPRITE((tmp), fx+i, fy+j);
 			double dist = (double)_RED(c) / 255.0;
 			double edge0 = buffer - gamma * 1.4142 / (double)size;
@@ -187,10 +191,41 @@ static int draw_sdf_character(gfx_context_t * ctx, int32_t x, int32_t y, int _ch
 			a = a * a * (3 - 2 * a);
 			uint32_t f_color = premultiply((color & 0xFFFFFF) | ((uint32_t)(255 * a) << 24));
 			f_color = (f_color & 0xFFFFFF) | ((uint32_t)(a * _ALP(color)) << 24);
-			GFX(ctx,x+i,y+j) = alpha_blend_rgba(GFX(ctx,x+i,y+j), f_color);
+			out->bitmap[j * size + i] = f_color;
 		}
 	}
 
+	return out;
+}
+
+static int draw_sdf_character(gfx_context_t * ctx, int32_t x, int32_t y, int _ch, int size, uint32_t color, sprite_t * tmp, int font, sprite_t * _font_data, double buffer) {
+	int ch = (_ch >= 0 && _ch <= 128) ? _ch : (int)ununicode(_ch);
+
+	double scale = (double)size / 50.0;
+	int width = _select_width(ch, font) * scale;
+
+	char key[100];
+	sprintf(key, "%d:%d:%d:%x:%g:%g", ch, size, font, color, gamma, buffer);
+
+	sprite_t * glyph = hashmap_get(_glyph_cache, key);
+	if (!glyph) {
+		if (_glyph_cache_count >= GLYPH_CACHE_MAX) {
+			/* Drop everything; the steady-state working set is much smaller. */
+			list_t * keys = hashmap_keys(_glyph_cache);
+			foreach(node, keys) {
+				sprite_free(hashmap_remove(_glyph_cache, node->value));
+			}
+			list_free(keys);
+			free(keys);
+			_glyph_cache_count = 0;
+		}
+		glyph = _bake_glyph(ch, size, color, tmp, _font_data, buffer);
+		hashmap_set(_glyph_cache, key, glyph);
+		_glyph_cache_count++;
+	}
+
+	draw_sprite(ctx, glyph, x, y);
+
 	return width;
 
 }
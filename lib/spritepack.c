@@ -0,0 +1,63 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ * This file is part of ToaruOS and is released under the terms
+ * of the NCSA / University of Illinois License - see LICENSE.md
+ * Copyright (C) 2018 K. Lange
+ *
+ * Sprite pack loader
+ *
+ * Serves pre-decoded sprites out of a mapped pack file; see
+ * toaru/spritepack.h for the format and util/make-spritepack.py
+ * for the generator.
+ */
+
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <toaru/graphics.h>
+#include <toaru/spritepack.h>
+
+void * spritepack_open(const char * path) {
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) return NULL;
+
+	struct stat statbuf;
+	if (fstat(fd, &statbuf) < 0 || statbuf.st_size < (int)sizeof(struct spritepack_header)) {
+		close(fd);
+		return NULL;
+	}
+
+	void * data = mmap(NULL, statbuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) return NULL;
+
+	struct spritepack_header * header = data;
+	if (header->magic != SPRITEPACK_MAGIC || header->version != SPRITEPACK_VERSION) {
+		munmap(data, statbuf.st_size);
+		return NULL;
+	}
+
+	return data;
+}
+
+int spritepack_count(void * pack) {
+	return ((struct spritepack_header *)pack)->count;
+}
+
+int spritepack_sprite(void * pack, unsigned int index, sprite_t * sprite) {
+	struct spritepack_header * header = pack;
+	if (index >= header->count) return 1;
+
+	struct spritepack_entry * entry = &((struct spritepack_entry *)((char *)pack + sizeof(struct spritepack_header)))[index];
+
+	sprite->width  = entry->width;
+	sprite->height = entry->height;
+	sprite->bitmap = (uint32_t *)((char *)pack + entry->offset);
+	sprite->masks  = NULL;
+	sprite->blank  = 0;
+	sprite->alpha  = entry->alpha;
+
+	return 0;
+}
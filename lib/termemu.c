@@ -602,6 +602,37 @@ void ansi_put(term_state_t * s, char c) {
 	_spin_unlock(&s->lock);
 }
 
+/*
+ * Feed a whole buffer to the state machine. Runs of plain bytes - no
+ * escapes, no box-drawing substitution - skip the per-character state
+ * dispatch entirely and go to the renderer as one span when it
+ * provides a span writer, so bulk text is limited by rendering rather
+ * than parsing.
+ */
+void ansi_put_bytes(term_state_t * s, const char * buf, size_t len) {
+	_spin_lock(&s->lock);
+	while (len) {
+		if (s->escape == 0 && s->box == 0 && *buf != ANSI_ESCAPE && *buf != 0) {
+			size_t span = 1;
+			while (span < len && buf[span] != ANSI_ESCAPE && buf[span] != 0) span++;
+			if (s->callbacks->write_span) {
+				s->callbacks->write_span(buf, span);
+			} else {
+				for (size_t i = 0; i < span; ++i) {
+					s->callbacks->writer(buf[i]);
+				}
+			}
+			buf += span;
+			len -= span;
+		} else {
+			_ansi_put(s, *buf);
+			buf++;
+			len--;
+		}
+	}
+	_spin_unlock(&s->lock);
+}
+
 term_state_t * ansi_init(term_state_t * s, int w, int y, term_callbacks_t * callbacks_in) {
 
 	if (!s) {
@@ -12,6 +12,8 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <toaru/textregion.h>
 #include <toaru/sdf.h>
 
@@ -61,25 +63,250 @@ int tr_textregion_get_visible_lines(struct TR_TextRegion * self) {
 	return self->height / self->line_height;
 }
 
-void tr_textregion_reflow(struct TR_TextRegion * self) {
-	if (self->lines) {
-		fprintf(stderr, "Need to clean out lines\n");
-#if 0
-		list_destroy(self->lines);
-		list_free(self->lines);
-		free(self->lines);
-#endif
+static struct TR_TextUnit * tr_textunit_create(char * string, int unit_type, struct TR_Font * font) {
+	struct TR_TextUnit * unit = calloc(1, sizeof(struct TR_TextUnit));
+	unit->string = strdup(string);
+	unit->unit_type = unit_type;
+	unit->font = font;
+	unit->width = (unit_type == TR_UNIT_NEWLINE) ? 0 : tr_font_get_width(font, unit->string);
+	return unit;
+}
+
+static void tr_textunit_free(struct TR_TextUnit * unit) {
+	free(unit->string);
+	if (unit->extra) {
+		hashmap_free(unit->extra);
+		free(unit->extra);
 	}
+	free(unit);
+}
+
+/**
+ * Split text into word, whitespace, and newline units. When
+ * `whitespace` is false the spaces are dropped rather than kept as
+ * their own units.
+ */
+list_t * tr_textregion_units_from_text(struct TR_TextRegion * self, char * text, struct TR_Font * font, bool whitespace) {
+	list_t * units = list_create();
+	char * copy = strdup(text);
+	char * c = copy;
+
+	while (*c) {
+		if (*c == '\n') {
+			list_insert(units, tr_textunit_create("\n", TR_UNIT_NEWLINE, font));
+			c++;
+		} else if (*c == ' ') {
+			char * start = c;
+			while (*c == ' ') c++;
+			if (whitespace) {
+				char saved = *c;
+				*c = '\0';
+				list_insert(units, tr_textunit_create(start, TR_UNIT_SPACE, font));
+				*c = saved;
+			}
+		} else {
+			char * start = c;
+			while (*c && *c != ' ' && *c != '\n') c++;
+			char saved = *c;
+			*c = '\0';
+			list_insert(units, tr_textunit_create(start, TR_UNIT_TEXT, font));
+			*c = saved;
+		}
+	}
+
+	free(copy);
+	return units;
+}
+
+static void tr_textregion_clear_lines(struct TR_TextRegion * self) {
+	if (!self->lines) return;
+	foreach(node, self->lines) {
+		struct TR_Line * line = node->value;
+		if (line->cache) sprite_free(line->cache);
+		list_free(line->units);
+		free(line->units);
+		free(line);
+	}
+	list_free(self->lines);
+	free(self->lines);
+	self->lines = NULL;
+}
+
+/**
+ * Flow the region's units into lines of at most `width` pixels.
+ * Everything downstream of this - the line sprites - is invalidated,
+ * so callers that merely scroll should not come through here.
+ */
+void tr_textregion_reflow(struct TR_TextRegion * self) {
+	tr_textregion_clear_lines(self);
 
-#if 0
 	self->lines = list_create();
+	if (!self->units) return;
+
+	struct TR_Line * current = NULL;
 
-	int current_width = 0;
-	list_t * current_units = list_create();
-	struct TR_TextUnit * leftover = NULL;
+	foreach(node, self->units) {
+		struct TR_TextUnit * unit = node->value;
 
+		if (!current) {
+			/* Lines do not start with whitespace left over from a wrap. */
+			if (unit->unit_type == TR_UNIT_SPACE) continue;
+			current = calloc(1, sizeof(struct TR_Line));
+			current->units = list_create();
+		}
+
+		if (unit->unit_type == TR_UNIT_NEWLINE) {
+			list_insert(self->lines, current);
+			current = NULL;
+			continue;
+		}
+
+		if (!self->one_line && current->units->length &&
+		    current->width + unit->width > self->width) {
+			list_insert(self->lines, current);
+			current = NULL;
+			if (unit->unit_type == TR_UNIT_SPACE) continue;
+			current = calloc(1, sizeof(struct TR_Line));
+			current->units = list_create();
+		}
+
+		list_insert(current->units, unit);
+		current->width += unit->width;
+
+		if (self->max_lines && (int)self->lines->length >= self->max_lines) {
+			list_free(current->units);
+			free(current->units);
+			free(current);
+			current = NULL;
+			break;
+		}
+	}
+
+	if (current) list_insert(self->lines, current);
+	self->damage_all = 1;
+}
+
+void tr_textregion_set_text(struct TR_TextRegion * self, char * text) {
+	if (self->units) {
+		foreach(node, self->units) {
+			tr_textunit_free(node->value);
+		}
+		list_free(self->units);
+		free(self->units);
+	}
+	if (self->text) free(self->text);
+	self->text = strdup(text);
+	self->units = tr_textregion_units_from_text(self, text, self->font, true);
+	tr_textregion_reflow(self);
+}
+
+void tr_textregion_set_font(struct TR_TextRegion * self, struct TR_Font * font) {
+	self->font = font;
+	if (self->units) {
+		foreach(node, self->units) {
+			struct TR_TextUnit * unit = node->value;
+			tr_textunit_set_font(unit, font);
+		}
+	}
+	tr_textregion_reflow(self);
+}
+
+void tr_textregion_set_line_height(struct TR_TextRegion * self, int line_height) {
+	self->line_height = line_height;
+	tr_textregion_reflow(self);
+}
+
+void tr_textregion_set_one_line(struct TR_TextRegion * self, bool one_line) {
+	self->one_line = one_line;
+	tr_textregion_reflow(self);
+}
+
+void tr_textregion_set_ellipsis(struct TR_TextRegion * self, char * ellipsis) {
+	self->ellipsis = ellipsis; /* TODO actually render the ellipsis on truncation */
+}
+
+void tr_textregion_resize(struct TR_TextRegion * self, int width, int height) {
+	int rewrap = (self->width != width);
+	self->width = width;
+	self->height = height;
+	if (rewrap) {
+		tr_textregion_reflow(self);
+	} else {
+		self->damage_all = 1;
+	}
+}
+
+void tr_textregion_move(struct TR_TextRegion * self, int x, int y) {
+	self->x = x;
+	self->y = y;
+	self->damage_all = 1;
+}
+
+/**
+ * Render one line into its cache sprite. This is the only place text
+ * is actually rasterized; scrolling and hover redraws just blit.
+ */
+static void tr_line_render(struct TR_TextRegion * self, struct TR_Line * line) {
+	line->cache = create_sprite(self->width, self->line_height, ALPHA_EMBEDDED);
+	gfx_context_t * ctx = init_graphics_sprite(line->cache);
+	draw_fill(ctx, rgba(0,0,0,0));
+
+	int x = 0;
+	if (self->align == 1) x = (self->width - line->width) / 2;
+	else if (self->align == 2) x = self->width - line->width;
+
+	foreach(node, line->units) {
+		struct TR_TextUnit * unit = node->value;
+		x += tr_font_write(unit->font, ctx, x, 0, unit->string);
+	}
+
+	free(ctx);
+}
+
+static void tr_textregion_blit(struct TR_TextRegion * self, gfx_context_t * ctx) {
+	if (!self->lines) tr_textregion_reflow(self);
+	if (!self->line_height) return;
+
+	int visible = tr_textregion_get_visible_lines(self);
 	int i = 0;
-	while (i < self->text_units
-#endif
+	foreach(node, self->lines) {
+		struct TR_Line * line = node->value;
+		if (i >= self->scroll + visible) break;
+		if (i >= self->scroll) {
+			if (!line->cache) tr_line_render(self, line);
+			draw_sprite(ctx, line->cache, self->x, self->y + (i - self->scroll) * self->line_height);
+		}
+		i++;
+	}
+}
+
+void tr_textregion_draw(struct TR_TextRegion * self, gfx_context_t * ctx) {
+	tr_textregion_blit(self, ctx);
+	self->damage_all = 0;
+	self->damage_scroll = self->scroll;
+}
+
+/**
+ * Like tr_textregion_draw, but skips the blits entirely when nothing
+ * changed and reports what it repainted so the caller can flip just
+ * those rectangles. The whole region is one rectangle today - every
+ * visible line moves when the region scrolls - but the expensive part,
+ * re-rasterizing the text, is already avoided by the line caches.
+ */
+int tr_textregion_draw_damage(struct TR_TextRegion * self, gfx_context_t * ctx, struct TR_DamageRect * rects, int max_rects) {
+	if (!self->damage_all && self->scroll == self->damage_scroll) {
+		return 0;
+	}
 
+	tr_textregion_blit(self, ctx);
+	self->damage_all = 0;
+	self->damage_scroll = self->scroll;
+
+	if (rects && max_rects > 0) {
+		rects[0].x = self->x;
+		rects[0].y = self->y;
+		rects[0].width = self->width;
+		rects[0].height = self->height;
+	}
+	return 1;
 }
@@ -14,15 +14,198 @@
 #include <toaru/pex.h>
 #include <toaru/graphics.h>
 #include <toaru/kbd.h>
-#include <toaru/hashmap.h>
+#include <toaru/intmap.h>
 #include <toaru/list.h>
 #include <toaru/yutani.h>
 #include <toaru/yutani-internal.h>
 #include <toaru/mouse.h>
+#include <toaru/launchtrace.h>
+
+/* Launch tracing marks the first window and first flip only. */
+static int _launchtrace_window_done = 0;
+static int _launchtrace_flip_done = 0;
 
 /* We need the flags but don't want the library dep (maybe the flags should be here?) */
 #include <toaru/./decorations.h>
 
+/**
+ * yutani_msg_compact_encode
+ *
+ * Write a message as a v2 compact frame. The payload bytes are carried
+ * unchanged except for mouse events, which get the packed layout when
+ * their coordinates fit.
+ */
+size_t yutani_msg_compact_encode(yutani_msg_t * msg, char * out) {
+	yutani_cmsg_t * c = (void *)out;
+
+	if (msg->type == YUTANI_MSG_WINDOW_MOUSE_EVENT) {
+		struct yutani_msg_window_mouse_event * me = (void *)msg->data;
+		if (me->new_x >= INT16_MIN && me->new_x <= INT16_MAX &&
+		    me->new_y >= INT16_MIN && me->new_y <= INT16_MAX &&
+		    me->old_x >= INT16_MIN && me->old_x <= INT16_MAX &&
+		    me->old_y >= INT16_MIN && me->old_y <= INT16_MAX) {
+			c->type = YUTANI_MSGC_MOUSE_PACKED;
+			c->size = sizeof(yutani_cmsg_t) + sizeof(struct yutani_msgc_window_mouse_event);
+			struct yutani_msgc_window_mouse_event * pe = (void *)c->data;
+			pe->wid = me->wid;
+			pe->new_x = me->new_x;
+			pe->new_y = me->new_y;
+			pe->old_x = me->old_x;
+			pe->old_y = me->old_y;
+			pe->buttons = me->buttons;
+			pe->command = me->command;
+			pe->modifiers = me->modifiers;
+			return c->size;
+		}
+	}
+
+	c->type = (msg->type & 0x7FFF) | ((msg->type >> 16) ? YUTANI_MSGC_SERVER : 0);
+	c->size = sizeof(yutani_cmsg_t) + (msg->size - sizeof(struct yutani_message));
+	memcpy(c->data, msg->data, msg->size - sizeof(struct yutani_message));
+	return c->size;
+}
+
+/**
+ * yutani_msg_decode
+ *
+ * Pull one frame - v1 or compact - off the front of a buffer and
+ * return it as an allocated v1-shaped message. A v1 frame always
+ * starts with the magic, which a compact frame cannot produce, so no
+ * out-of-band version information is needed here.
+ */
+yutani_msg_t * yutani_msg_decode(const char * buf, size_t avail, size_t * consumed) {
+	if (avail < sizeof(yutani_cmsg_t)) return NULL;
+
+	const yutani_msg_t * v1 = (const void *)buf;
+	if (avail >= sizeof(struct yutani_message) && v1->magic == YUTANI_MSG__MAGIC) {
+		if (v1->size < sizeof(struct yutani_message) || v1->size > avail) return NULL;
+		yutani_msg_t * out = malloc(v1->size);
+		memcpy(out, v1, v1->size);
+		*consumed = v1->size;
+		return out;
+	}
+
+	const yutani_cmsg_t * c = (const void *)buf;
+	if (c->size < sizeof(yutani_cmsg_t) || c->size > avail) return NULL;
+
+	if (c->type == YUTANI_MSGC_MOUSE_PACKED) {
+		if (c->size != sizeof(yutani_cmsg_t) + sizeof(struct yutani_msgc_window_mouse_event)) return NULL;
+		const struct yutani_msgc_window_mouse_event * pe = (const void *)c->data;
+		yutani_msg_t * out = malloc(sizeof(struct yutani_message) + sizeof(struct yutani_msg_window_mouse_event));
+		out->magic = YUTANI_MSG__MAGIC;
+		out->type = YUTANI_MSG_WINDOW_MOUSE_EVENT;
+		out->size = sizeof(struct yutani_message) + sizeof(struct yutani_msg_window_mouse_event);
+		struct yutani_msg_window_mouse_event * me = (void *)out->data;
+		me->wid = pe->wid;
+		me->new_x = pe->new_x;
+		me->new_y = pe->new_y;
+		me->old_x = pe->old_x;
+		me->old_y = pe->old_y;
+		me->buttons = pe->buttons;
+		me->command = pe->command;
+		me->modifiers = pe->modifiers;
+		*consumed = c->size;
+		return out;
+	}
+
+	size_t payload = c->size - sizeof(yutani_cmsg_t);
+	yutani_msg_t * out = malloc(sizeof(struct yutani_message) + payload);
+	out->magic = YUTANI_MSG__MAGIC;
+	out->type = (c->type & YUTANI_MSGC_SERVER) ? (0x00010000 | (c->type & 0x7FFF)) : c->type;
+	out->size = sizeof(struct yutani_message) + payload;
+	memcpy(out->data, c->data, payload);
+	*consumed = c->size;
+	return out;
+}
+
+/*
+ * Pending messages live on the global FIFO `queued` and, in parallel,
+ * on a per-type list of the FIFO nodes. Both are in arrival order, so
+ * the head of a type list is always that type's oldest entry in the
+ * FIFO - waits by type and ordered polls are both O(1).
+ */
+static list_t * _type_bucket(yutani_t * y, uint32_t type) {
+	list_t * bucket = intmap_get(y->pending_by_type, type);
+	if (!bucket) {
+		bucket = list_create();
+		intmap_set(y->pending_by_type, type, bucket);
+	}
+	return bucket;
+}
+
+/* Drop the type-list entry matching a message just dequeued from the
+ * head of the FIFO. */
+static void _bucket_pop(yutani_t * y, uint32_t type) {
+	list_t * bucket = intmap_get(y->pending_by_type, type);
+	if (bucket && bucket->length) {
+		node_t * bnode = list_dequeue(bucket);
+		free(bnode);
+	}
+}
+
+static void _enqueue(yutani_t * y, yutani_msg_t * out) {
+	/*
+	 * Coalesce at the queue tail: a hover motion arriving right
+	 * behind another motion for the same window overwrites it in
+	 * place, so a storm of them occupies one slot instead of
+	 * growing the queue.
+	 */
+	if ((y->hello_flags & YUTANI_HELLO_FLAG_COALESCE_MOUSE) &&
+	    out->type == YUTANI_MSG_WINDOW_MOUSE_EVENT && y->queued->tail) {
+		yutani_msg_t * tail = y->queued->tail->value;
+		if (tail->type == YUTANI_MSG_WINDOW_MOUSE_EVENT) {
+			struct yutani_msg_window_mouse_event * pe = (void *)tail->data;
+			struct yutani_msg_window_mouse_event * me = (void *)out->data;
+			if (pe->wid == me->wid &&
+			    pe->command == YUTANI_MOUSE_EVENT_MOVE &&
+			    me->command == YUTANI_MOUSE_EVENT_MOVE) {
+				/* The run still starts where the first event started */
+				me->old_x = pe->old_x;
+				me->old_y = pe->old_y;
+				memcpy(tail->data, out->data, sizeof(struct yutani_msg_window_mouse_event));
+				free(out);
+				return;
+			}
+		}
+	}
+
+	list_t * bucket = _type_bucket(y, out->type);
+
+	/* Input storms shed their oldest events rather than growing
+	 * without bound; request/response types are never dropped. */
+	if ((out->type == YUTANI_MSG_WINDOW_MOUSE_EVENT || out->type == YUTANI_MSG_MOUSE_EVENT) &&
+	    bucket->length >= YUTANI_TYPE_QUEUE_BOUND) {
+		node_t * bnode = list_dequeue(bucket);
+		node_t * gnode = bnode->value;
+		free(gnode->value);
+		list_delete(y->queued, gnode);
+		free(gnode);
+		free(bnode);
+	}
+
+	node_t * gnode = list_insert(y->queued, out);
+	list_insert(bucket, gnode);
+}
+
+/**
+ * _fetch
+ *
+ * Read one packet from the server and queue every message in it.
+ * v2 servers batch events, so a single datagram may carry several.
+ */
+static void _fetch(yutani_t * y) {
+	char tmp[MAX_PACKET_SIZE];
+	size_t size = pex_recv(y->sock, tmp);
+	size_t offset = 0;
+	while (offset < size) {
+		size_t consumed = 0;
+		yutani_msg_t * out = yutani_msg_decode(tmp + offset, size - offset, &consumed);
+		if (!out) break;
+		offset += consumed;
+		_enqueue(y, out);
+	}
+}
+
 /**
  * yutani_wait_for
  *
@@ -30,21 +213,21 @@
  * of messages for processing later.
  */
 yutani_msg_t * yutani_wait_for(yutani_t * y, uint32_t type) {
+	yutani_flush(y);
+	list_t * bucket = _type_bucket(y, type);
 	do {
-		yutani_msg_t * out;
-		size_t size;
-		{
-			char tmp[MAX_PACKET_SIZE];
-			size = pex_recv(y->sock, tmp);
-			out = malloc(size);
-			memcpy(out, tmp, size);
-		}
-
-		if (out->type == type) {
+		/* The wanted message may already be queued - including by the
+		 * very packet that carried it alongside unrelated events. */
+		if (bucket->length) {
+			node_t * bnode = list_dequeue(bucket);
+			node_t * gnode = bnode->value;
+			yutani_msg_t * out = gnode->value;
+			list_delete(y->queued, gnode);
+			free(gnode);
+			free(bnode);
 			return out;
-		} else {
-			list_insert(y->queued, out);
 		}
+		_fetch(y);
 	} while (1); /* XXX: (!y->abort) */
 }
 
@@ -56,6 +239,7 @@ yutani_msg_t * yutani_wait_for(yutani_t * y, uint32_t type) {
  */
 size_t yutani_query(yutani_t * y) {
 	if (y->queued->length > 0) return 1;
+	yutani_flush(y);
 	return pex_query(y->sock);
 }
 
@@ -81,7 +265,7 @@ static void _handle_internal(yutani_t * y, yutani_msg_t * out) {
 		case YUTANI_MSG_WINDOW_MOVE:
 			{
 				struct yutani_msg_window_move * wm = (void *)out->data;
-				yutani_window_t * win = hashmap_get(y->windows, (void *)wm->wid);
+				yutani_window_t * win = intmap_get(y->windows, wm->wid);
 				if (win) {
 					win->x = wm->x;
 					win->y = wm->y;
@@ -91,12 +275,22 @@ static void _handle_internal(yutani_t * y, yutani_msg_t * out) {
 		case YUTANI_MSG_RESIZE_OFFER:
 			{
 				struct yutani_msg_window_resize * wr = (void *)out->data;
-				yutani_window_t * win = hashmap_get(y->windows, (void *)wr->wid);
+				yutani_window_t * win = intmap_get(y->windows, wr->wid);
 				if (win) {
 					win->decorator_flags &= ~(DECOR_FLAG_TILED);
 					win->decorator_flags |= (wr->flags & YUTANI_RESIZE_TILED) << 2;
 				}
 			}
+			break;
+		case YUTANI_MSG_FRAME_COMPLETE:
+			{
+				struct yutani_msg_frame_complete * fc = (void *)out->data;
+				yutani_window_t * win = intmap_get(y->windows, fc->wid);
+				if (win && win->frame_callback) {
+					win->frame_callback(win, fc->timestamp);
+				}
+			}
+			break;
 		default:
 			break;
 	}
@@ -111,20 +305,40 @@ static void _handle_internal(yutani_t * y, yutani_msg_t * out) {
 yutani_msg_t * yutani_poll(yutani_t * y) {
 	yutani_msg_t * out;
 
-	if (y->queued->length > 0) {
-		node_t * node = list_dequeue(y->queued);
-		out = (yutani_msg_t *)node->value;
-		free(node);
-		_handle_internal(y, out);
-		return out;
+	if (!y->queued->length) {
+		yutani_flush(y);
+		do {
+			_fetch(y);
+		} while (!y->queued->length);
 	}
 
-	size_t size;
-	{
-		char tmp[MAX_PACKET_SIZE];
-		size = pex_recv(y->sock, tmp);
-		out = malloc(size);
-		memcpy(out, tmp, size);
+	node_t * node = list_dequeue(y->queued);
+	out = (yutani_msg_t *)node->value;
+	free(node);
+	_bucket_pop(y, out->type);
+
+	/*
+	 * Motion coalescing: if more hover movement for the same window is
+	 * already waiting, nothing can care about the intermediate
+	 * positions - deliver one event spanning the whole run.
+	 */
+	if ((y->hello_flags & YUTANI_HELLO_FLAG_COALESCE_MOUSE) && out->type == YUTANI_MSG_WINDOW_MOUSE_EVENT) {
+		struct yutani_msg_window_mouse_event * me = (void *)out->data;
+		while (me->command == YUTANI_MOUSE_EVENT_MOVE && y->queued->length) {
+			yutani_msg_t * peek = (yutani_msg_t *)y->queued->head->value;
+			if (peek->type != YUTANI_MSG_WINDOW_MOUSE_EVENT) break;
+			struct yutani_msg_window_mouse_event * pe = (void *)peek->data;
+			if (pe->wid != me->wid || pe->command != YUTANI_MOUSE_EVENT_MOVE) break;
+			/* The run starts where the first event started. */
+			pe->old_x = me->old_x;
+			pe->old_y = me->old_y;
+			node = list_dequeue(y->queued);
+			free(node);
+			_bucket_pop(y, YUTANI_MSG_WINDOW_MOUSE_EVENT);
+			free(out);
+			out = peek;
+			me = pe;
+		}
 	}
 
 	_handle_internal(y, out);
@@ -147,10 +361,74 @@ yutani_msg_t * yutani_poll_async(yutani_t * y) {
 	return NULL;
 }
 
-void yutani_msg_buildx_hello(yutani_msg_t * msg) {
+struct yutani_handler {
+	yutani_msg_handler_t func;
+	void * data;
+};
+
+/**
+ * yutani_set_msg_handler
+ *
+ * Register `handler` for messages of `type`, to be called from
+ * yutani_dispatch / yutani_dispatch_pending. Pass NULL to remove a
+ * handler. Dispatched messages are freed by the dispatcher.
+ */
+void yutani_set_msg_handler(yutani_t * y, uint32_t type, yutani_msg_handler_t handler, void * data) {
+	struct yutani_handler * old = intmap_remove(y->handlers, type);
+	if (old) free(old);
+	if (handler) {
+		struct yutani_handler * h = malloc(sizeof(struct yutani_handler));
+		h->func = handler;
+		h->data = data;
+		intmap_set(y->handlers, type, h);
+	}
+}
+
+static void _dispatch_one(yutani_t * y, yutani_msg_t * msg) {
+	struct yutani_handler * h = intmap_get(y->handlers, msg->type);
+	if (h) {
+		h->func(y, msg, h->data);
+	}
+	free(msg);
+}
+
+/**
+ * yutani_dispatch_pending
+ *
+ * Drain everything already queued or readable, routing each message
+ * to its registered handler; messages with no handler are discarded.
+ * Returns the number of messages processed. Does not block, so this
+ * pairs with fswait-style main loops watching the socket.
+ */
+int yutani_dispatch_pending(yutani_t * y) {
+	int count = 0;
+	while (yutani_query(y)) {
+		_dispatch_one(y, yutani_poll(y));
+		count++;
+	}
+	return count;
+}
+
+/**
+ * yutani_dispatch
+ *
+ * Block for one message and route it to its handler.
+ */
+void yutani_dispatch(yutani_t * y) {
+	_dispatch_one(y, yutani_poll(y));
+}
+
+void yutani_msg_buildx_hello(yutani_msg_t * msg, uint32_t flags) {
 	msg->magic = YUTANI_MSG__MAGIC;
 	msg->type  = YUTANI_MSG_HELLO;
-	msg->size  = sizeof(struct yutani_message);
+	msg->size  = sizeof(struct yutani_message) + sizeof(struct yutani_msg_hello);
+
+	/* The payload is the version announcement; v1 clients send a bare
+	 * header and old servers ignore whatever follows it. */
+	struct yutani_msg_hello * mh = (void *)msg->data;
+
+	mh->version = YUTANI_PROTOCOL_VERSION;
+	mh->flags = flags;
 }
 
 
@@ -174,6 +452,7 @@ void yutani_msg_buildx_welcome(yutani_msg_t * msg, uint32_t width, uint32_t heig
 
 	mw->display_width = width;
 	mw->display_height = height;
+	mw->version = YUTANI_PROTOCOL_VERSION;
 }
 
 
@@ -202,7 +481,7 @@ void yutani_msg_buildx_window_new_flags(yutani_msg_t * msg, uint32_t width, uint
 }
 
 
-void yutani_msg_buildx_window_init(yutani_msg_t * msg, yutani_wid_t wid, uint32_t width, uint32_t height, uint32_t bufid) {
+void yutani_msg_buildx_window_init(yutani_msg_t * msg, yutani_wid_t wid, uint32_t width, uint32_t height, uint32_t bufid, uint32_t atlas, uint32_t offset) {
 	msg->magic = YUTANI_MSG__MAGIC;
 	msg->type  = YUTANI_MSG_WINDOW_INIT;
 	msg->size  = sizeof(struct yutani_message) + sizeof(struct yutani_msg_window_init);
@@ -213,6 +492,8 @@ void yutani_msg_buildx_window_init(yutani_msg_t * msg, yutani_wid_t wid, uint32_
 	mw->width = width;
 	mw->height = height;
 	mw->bufid = bufid;
+	mw->atlas = atlas;
+	mw->offset = offset;
 }
 
 
@@ -323,7 +604,23 @@ void yutani_msg_buildx_flip_region(yutani_msg_t * msg, yutani_wid_t wid, int32_t
 }
 
 
-void yutani_msg_buildx_window_resize(yutani_msg_t * msg, uint32_t type, yutani_wid_t wid, uint32_t width, uint32_t height, uint32_t bufid, uint32_t flags) {
+void yutani_msg_buildx_flip_buffer(yutani_msg_t * msg, yutani_wid_t wid, uint32_t bufid, int32_t x, int32_t y, int32_t width, int32_t height) {
+	msg->magic = YUTANI_MSG__MAGIC;
+	msg->type  = YUTANI_MSG_FLIP_BUFFER;
+	msg->size  = sizeof(struct yutani_message) + sizeof(struct yutani_msg_flip_buffer);
+
+	struct yutani_msg_flip_buffer * mw = (void *)msg->data;
+
+	mw->wid = wid;
+	mw->bufid = bufid;
+	mw->x = x;
+	mw->y = y;
+	mw->width = width;
+	mw->height = height;
+}
+
+
+void yutani_msg_buildx_window_resize(yutani_msg_t * msg, uint32_t type, yutani_wid_t wid, uint32_t width, uint32_t height, uint32_t bufid, uint32_t flags, uint32_t atlas, uint32_t offset) {
 	msg->magic = YUTANI_MSG__MAGIC;
 	msg->type  = type;
 	msg->size  = sizeof(struct yutani_message) + sizeof(struct yutani_msg_window_resize);
@@ -335,6 +632,8 @@ void yutani_msg_buildx_window_resize(yutani_msg_t * msg, uint32_t type, yutani_w
 	mw->height = height;
 	mw->bufid = bufid;
 	mw->flags = flags;
+	mw->atlas = atlas;
+	mw->offset = offset;
 }
 
 
@@ -489,6 +788,43 @@ void yutani_msg_buildx_special_request(yutani_msg_t * msg, yutani_wid_t wid, uin
 	sr->request = request;
 }
 
+void yutani_msg_buildx_frame_stats(yutani_msg_t * msg, uint32_t frame_interval, uint32_t frames_painted, uint32_t frames_missed, uint32_t last_paint_msec, uint32_t total_paint_msec) {
+	msg->magic = YUTANI_MSG__MAGIC;
+	msg->type  = YUTANI_MSG_FRAME_STATS;
+	msg->size  = sizeof(struct yutani_message) + sizeof(struct yutani_msg_frame_stats);
+
+	struct yutani_msg_frame_stats * fs = (void *)msg->data;
+
+	fs->frame_interval = frame_interval;
+	fs->frames_painted = frames_painted;
+	fs->frames_missed = frames_missed;
+	fs->last_paint_msec = last_paint_msec;
+	fs->total_paint_msec = total_paint_msec;
+}
+
+void yutani_msg_buildx_frame_complete(yutani_msg_t * msg, yutani_wid_t wid, uint32_t timestamp) {
+	msg->magic = YUTANI_MSG__MAGIC;
+	msg->type  = YUTANI_MSG_FRAME_COMPLETE;
+	msg->size  = sizeof(struct yutani_message) + sizeof(struct yutani_msg_frame_complete);
+
+	struct yutani_msg_frame_complete * fc = (void *)msg->data;
+
+	fc->wid = wid;
+	fc->timestamp = timestamp;
+}
+
+void yutani_msg_buildx_latency_stats(yutani_msg_t * msg, uint32_t input_events, const uint32_t * queue_hist, const uint32_t * present_hist) {
+	msg->magic = YUTANI_MSG__MAGIC;
+	msg->type  = YUTANI_MSG_LATENCY_STATS;
+	msg->size  = sizeof(struct yutani_message) + sizeof(struct yutani_msg_latency_stats);
+
+	struct yutani_msg_latency_stats * ls = (void *)msg->data;
+
+	ls->input_events = input_events;
+	memcpy(ls->queue_hist, queue_hist, sizeof(ls->queue_hist));
+	memcpy(ls->present_hist, present_hist, sizeof(ls->present_hist));
+}
+
 void yutani_msg_buildx_clipboard(yutani_msg_t * msg, char * content) {
 	msg->magic = YUTANI_MSG__MAGIC;
 	msg->type  = YUTANI_MSG_CLIPBOARD;
@@ -500,8 +836,36 @@ void yutani_msg_buildx_clipboard(yutani_msg_t * msg, char * content) {
 	memcpy(cl->content, content, strlen(content));
 }
 
+/**
+ * yutani_flush
+ *
+ * Push any batched messages to the server as a single packet.
+ */
+int yutani_flush(yutani_t * y) {
+	if (!y->out_len) return 0;
+	size_t len = y->out_len;
+	y->out_len = 0;
+	return pex_reply(y->sock, len, y->out_buf);
+}
+
 int yutani_msg_send(yutani_t * y, yutani_msg_t * msg) {
-	return pex_reply(y->sock, msg->size, (char *)msg);
+	/*
+	 * Messages are appended to a batch buffer rather than hitting
+	 * /dev/pex one syscall at a time; the batch goes out on flip,
+	 * on an explicit yutani_flush, before any read, or when full.
+	 */
+	if (msg->size > MAX_PACKET_SIZE - y->out_len) {
+		yutani_flush(y);
+	}
+	if (y->protocol >= 2) {
+		/* Compact frames are never larger than the v1 message, so the
+		 * flush check above is safely conservative. */
+		y->out_len += yutani_msg_compact_encode(msg, y->out_buf + y->out_len);
+	} else {
+		memcpy(y->out_buf + y->out_len, msg, msg->size);
+		y->out_len += msg->size;
+	}
+	return msg->size;
 }
 
 yutani_t * yutani_context_create(FILE * socket) {
@@ -510,11 +874,58 @@ yutani_t * yutani_context_create(FILE * socket) {
 	out->sock = socket;
 	out->display_width  = 0;
 	out->display_height = 0;
-	out->windows = hashmap_create_int(10);
+	out->windows = intmap_create(10);
 	out->queued = list_create();
+	out->out_buf = malloc(MAX_PACKET_SIZE);
+	out->out_len = 0;
+	out->atlases = intmap_create(4);
+	out->pending_by_type = intmap_create(16);
+	out->handlers = intmap_create(16);
+	out->protocol = 1;
+	out->hello_flags = YUTANI_HELLO_FLAG_COALESCE_MOUSE;
 	return out;
 }
 
+/*
+ * Shared atlas segments are mapped once per connection and refcounted
+ * per window, since releasing an shm key unmaps a whole mapping - a
+ * second window using the same segment must not lose its buffer when
+ * the first closes.
+ */
+struct yutani_atlas_ref {
+	char * base;
+	int refs;
+};
+
+static char * _atlas_obtain(yutani_t * y, uint32_t atlas) {
+	struct yutani_atlas_ref * ref = intmap_get(y->atlases, atlas);
+	if (!ref) {
+		char key[1024];
+		YUTANI_SHMKEY_EXP(y->server_ident, key, 1024, atlas);
+		size_t size = 0;
+		char * base = shm_obtain(key, &size);
+		if (!base) return NULL;
+		ref = malloc(sizeof(struct yutani_atlas_ref));
+		ref->base = base;
+		ref->refs = 0;
+		intmap_set(y->atlases, atlas, ref);
+	}
+	ref->refs++;
+	return ref->base;
+}
+
+static void _atlas_release(yutani_t * y, uint32_t atlas) {
+	struct yutani_atlas_ref * ref = intmap_get(y->atlases, atlas);
+	if (!ref) return;
+	if (--ref->refs) return;
+
+	char key[1024];
+	YUTANI_SHMKEY_EXP(y->server_ident, key, 1024, atlas);
+	shm_release(key);
+	intmap_remove(y->atlases, atlas);
+	free(ref);
+}
+
 /**
  * yutani_init
  *
@@ -535,7 +946,7 @@ yutani_t * yutani_init(void) {
 
 	yutani_t * y = yutani_context_create(c);
 	yutani_msg_buildx_hello_alloc(m);
-	yutani_msg_buildx_hello(m);
+	yutani_msg_buildx_hello(m, y->hello_flags);
 	yutani_msg_send(y, m);
 
 	yutani_msg_t * mm = yutani_wait_for(y, YUTANI_MSG_WELCOME);
@@ -543,8 +954,14 @@ yutani_t * yutani_init(void) {
 	y->display_width = mw->display_width;
 	y->display_height = mw->display_height;
 	y->server_ident = server_name;
+	/* A v1 server's welcome is too short to carry a version. */
+	if (mm->size >= sizeof(struct yutani_message) + sizeof(struct yutani_msg_welcome) && mw->version >= 2) {
+		y->protocol = 2;
+	}
 	free(mm);
 
+	launchtrace("yutani:init");
+
 	return y;
 }
 
@@ -573,15 +990,42 @@ yutani_window_t * yutani_window_create_flags(yutani_t * y, int width, int height
 	win->y = 0;
 	win->user_data = NULL;
 	win->ctx = y;
+	win->buffer2 = NULL;
+	win->bufid2 = 0;
+	win->oldbufid2 = 0;
+	win->buffer_age = 0;
+	win->buffer2_age = 0;
+	win->frame_callback = NULL;
+	win->atlas = mw->atlas;
+	win->oldatlas = 0;
+	uint32_t buf_offset = mw->offset;
 	free(mm);
 
-	hashmap_set(y->windows, (void*)win->wid, win);
+	intmap_set(y->windows, win->wid, win);
 
 	char key[1024];
-	YUTANI_SHMKEY(y->server_ident, key, 1024, win);
-
 	size_t size = (width * height * 4);
-	win->buffer = shm_obtain(key, &size);
+	if (win->atlas) {
+		/* Small buffers live in a shared segment at a given offset */
+		win->buffer = _atlas_obtain(y, win->atlas) + buf_offset;
+	} else {
+		YUTANI_SHMKEY(y->server_ident, key, 1024, win);
+		win->buffer = shm_obtain(key, &size);
+	}
+
+	if (flags & YUTANI_WINDOW_FLAG_DOUBLE_BUFFERED) {
+		/* The server allocated the second buffer right after the first. */
+		win->bufid2 = win->bufid + 1;
+		YUTANI_SHMKEY_EXP(y->server_ident, key, 1024, win->bufid2);
+		size = (width * height * 4);
+		win->buffer2 = shm_obtain(key, &size);
+	}
+
+	if (!_launchtrace_window_done) {
+		_launchtrace_window_done = 1;
+		launchtrace("yutani:first-window");
+	}
+
 	return win;
 
 }
@@ -604,6 +1048,11 @@ void yutani_flip(yutani_t * y, yutani_window_t * win) {
 	yutani_msg_buildx_flip_alloc(m);
 	yutani_msg_buildx_flip(m, win->wid);
 	yutani_msg_send(y, m);
+	yutani_flush(y);
+	if (!_launchtrace_flip_done) {
+		_launchtrace_flip_done = 1;
+		launchtrace("yutani:first-flip");
+	}
 }
 
 /**
@@ -615,6 +1064,61 @@ void yutani_flip_region(yutani_t * yctx, yutani_window_t * win, int32_t x, int32
 	yutani_msg_buildx_flip_region_alloc(m);
 	yutani_msg_buildx_flip_region(m, win->wid, x, y, width, height);
 	yutani_msg_send(yctx, m);
+	yutani_flush(yctx);
+}
+
+/**
+ * yutani_window_swap_buffers
+ *
+ * Present the current draw buffer of a double-buffered window and
+ * swap to the other one. The damage rectangle is relative to the
+ * window; a width or height of -1 presents the whole window.
+ */
+void yutani_window_swap_buffers(yutani_t * yctx, yutani_window_t * win, int32_t x, int32_t y, int32_t width, int32_t height) {
+	if (!win->buffer2) {
+		/* Not double-buffered; treat this as a regular flip. */
+		if (width < 0 || height < 0) {
+			yutani_flip(yctx, win);
+		} else {
+			yutani_flip_region(yctx, win, x, y, width, height);
+		}
+		return;
+	}
+
+	yutani_msg_buildx_flip_buffer_alloc(m);
+	yutani_msg_buildx_flip_buffer(m, win->wid, win->bufid, x, y, width, height);
+	yutani_msg_send(yctx, m);
+	yutani_flush(yctx);
+
+	/*
+	 * Age the buffers: the one we just presented is now one frame old,
+	 * and the other one - if it has ever been drawn - falls one frame
+	 * further behind. We track ages ourselves since we know our own
+	 * flip history; there is nothing to ask the server.
+	 */
+	if (win->buffer2_age) win->buffer2_age++;
+	win->buffer_age = 1;
+
+	char * tmp_buf = win->buffer;
+	uint32_t tmp_id = win->bufid;
+	uint32_t tmp_age = win->buffer_age;
+	win->buffer = win->buffer2;
+	win->bufid = win->bufid2;
+	win->buffer_age = win->buffer2_age;
+	win->buffer2 = tmp_buf;
+	win->bufid2 = tmp_id;
+	win->buffer2_age = tmp_age;
+}
+
+/**
+ * yutani_window_buffer_age
+ *
+ * How many swaps ago the current draw buffer was last presented.
+ * 1 means it holds the last presented frame, 2 the one before that;
+ * 0 means its contents are undefined and a full repaint is needed.
+ */
+int yutani_window_buffer_age(yutani_window_t * win) {
+	return win->buffer_age;
 }
 
 /**
@@ -629,13 +1133,19 @@ void yutani_close(yutani_t * y, yutani_window_t * win) {
 	yutani_msg_send(y, m);
 
 	/* Now destroy our end of the window */
-	{
+	if (win->atlas) {
+		_atlas_release(y, win->atlas);
+	} else {
 		char key[1024];
 		YUTANI_SHMKEY_EXP(y->server_ident, key, 1024, win->bufid);
 		shm_release(key);
+		if (win->buffer2) {
+			YUTANI_SHMKEY_EXP(y->server_ident, key, 1024, win->bufid2);
+			shm_release(key);
+		}
 	}
 
-	hashmap_remove(y->windows, (void*)win->wid);
+	intmap_remove(y->windows, win->wid);
 	free(win);
 }
 
@@ -668,7 +1178,7 @@ void yutani_set_stack(yutani_t * yctx, yutani_window_t * window, int z) {
  */
 void yutani_window_resize(yutani_t * yctx, yutani_window_t * window, uint32_t width, uint32_t height) {
 	yutani_msg_buildx_window_resize_alloc(m);
-	yutani_msg_buildx_window_resize(m, YUTANI_MSG_RESIZE_REQUEST, window->wid, width, height, 0, 0);
+	yutani_msg_buildx_window_resize(m, YUTANI_MSG_RESIZE_REQUEST, window->wid, width, height, 0, 0, 0, 0);
 	yutani_msg_send(yctx, m);
 }
 
@@ -681,7 +1191,7 @@ void yutani_window_resize(yutani_t * yctx, yutani_window_t * window, uint32_t wi
  */
 void yutani_window_resize_offer(yutani_t * yctx, yutani_window_t * window, uint32_t width, uint32_t height) {
 	yutani_msg_buildx_window_resize_alloc(m);
-	yutani_msg_buildx_window_resize(m, YUTANI_MSG_RESIZE_OFFER, window->wid, width, height, 0, 0);
+	yutani_msg_buildx_window_resize(m, YUTANI_MSG_RESIZE_OFFER, window->wid, width, height, 0, 0, 0, 0);
 	yutani_msg_send(yctx, m);
 }
 
@@ -693,7 +1203,7 @@ void yutani_window_resize_offer(yutani_t * yctx, yutani_window_t * window, uint3
  */
 void yutani_window_resize_accept(yutani_t * yctx, yutani_window_t * window, uint32_t width, uint32_t height) {
 	yutani_msg_buildx_window_resize_alloc(m);
-	yutani_msg_buildx_window_resize(m, YUTANI_MSG_RESIZE_ACCEPT, window->wid, width, height, 0, 0);
+	yutani_msg_buildx_window_resize(m, YUTANI_MSG_RESIZE_ACCEPT, window->wid, width, height, 0, 0, 0, 0);
 	yutani_msg_send(yctx, m);
 
 	/* Now wait for the new bufid */
@@ -708,18 +1218,54 @@ void yutani_window_resize_accept(yutani_t * yctx, yutani_window_t * window, uint
 	/* Update the window */
 	window->width = wr->width;
 	window->height = wr->height;
+
+	if (wr->bufid == window->bufid) {
+		/* The server grew our buffers in place; the kernel already
+		 * extended this mapping, so there is nothing to remap and no
+		 * old buffer to release later. */
+		window->oldbufid = 0;
+		window->oldbufid2 = 0;
+		if (window->buffer2) {
+			/* The new area of both buffers is uninitialized. */
+			window->buffer_age = 0;
+			window->buffer2_age = 0;
+		}
+		free(mm);
+		return;
+	}
+
 	window->oldbufid = window->bufid;
+	window->oldatlas = window->atlas;
 	window->bufid = wr->bufid;
+	window->atlas = wr->atlas;
+	uint32_t buf_offset = wr->offset;
 	free(mm);
 
 	/* Allocate the buffer */
-	{
+	if (window->atlas) {
+		window->buffer = _atlas_obtain(yctx, window->atlas) + buf_offset;
+	} else {
 		char key[1024];
 		YUTANI_SHMKEY(yctx->server_ident, key, 1024, window);
 
 		size_t size = (window->width * window->height * 4);
 		window->buffer = shm_obtain(key, &size);
 	}
+
+	if (window->buffer2) {
+		/* The server allocated our new second buffer right after the first. */
+		window->oldbufid2 = window->bufid2;
+		window->bufid2 = window->bufid + 1;
+
+		char key[1024];
+		YUTANI_SHMKEY_EXP(yctx->server_ident, key, 1024, window->bufid2);
+		size_t size = (window->width * window->height * 4);
+		window->buffer2 = shm_obtain(key, &size);
+
+		/* Both buffers are fresh; their contents are undefined. */
+		window->buffer_age = 0;
+		window->buffer2_age = 0;
+	}
 }
 
 /**
@@ -730,15 +1276,27 @@ void yutani_window_resize_accept(yutani_t * yctx, yutani_window_t * window, uint
  * discard the old buffer and switch to the new one.
  */
 void yutani_window_resize_done(yutani_t * yctx, yutani_window_t * window) {
-	/* Destroy the old buffer */
-	{
-		char key[1024];
-		YUTANI_SHMKEY_EXP(yctx->server_ident, key, 1024, window->oldbufid);
-		shm_release(key);
+	/* Destroy the old buffer, unless the resize was in place and
+	 * there never was one. */
+	if (window->oldbufid) {
+		if (window->oldatlas) {
+			_atlas_release(yctx, window->oldatlas);
+		} else {
+			char key[1024];
+			YUTANI_SHMKEY_EXP(yctx->server_ident, key, 1024, window->oldbufid);
+			shm_release(key);
+			if (window->oldbufid2) {
+				YUTANI_SHMKEY_EXP(yctx->server_ident, key, 1024, window->oldbufid2);
+				shm_release(key);
+				window->oldbufid2 = 0;
+			}
+		}
+		window->oldbufid = 0;
+		window->oldatlas = 0;
 	}
 
 	yutani_msg_buildx_window_resize_alloc(m);
-	yutani_msg_buildx_window_resize(m, YUTANI_MSG_RESIZE_DONE, window->wid, window->width, window->height, window->bufid, 0);
+	yutani_msg_buildx_window_resize(m, YUTANI_MSG_RESIZE_DONE, window->wid, window->width, window->height, window->bufid, 0, 0, 0);
 	yutani_msg_send(yctx, m);
 }
 
@@ -1004,6 +1562,24 @@ void yutani_special_request_wid(yutani_t * yctx, yutani_wid_t wid, uint32_t requ
 	yutani_msg_send(yctx, m);
 }
 
+/**
+ * yutani_window_request_frames
+ *
+ * Ask the server to send FRAME_COMPLETE after each presented frame
+ * that included this window's damage, and call `callback` when they
+ * arrive. The intended pattern is to render and flip once from the
+ * callback, so a client paints exactly one frame per frame shown
+ * instead of free-running. Pass NULL to turn notifications off.
+ *
+ * Callbacks fire from the message processing in yutani_poll; clients
+ * that filter with yutani_wait_for will not see them until those
+ * queued messages are drained.
+ */
+void yutani_window_request_frames(yutani_t * yctx, yutani_window_t * window, void (*callback)(yutani_window_t *, uint32_t)) {
+	window->frame_callback = callback;
+	yutani_special_request(yctx, window, callback ? YUTANI_SPECIAL_REQUEST_FRAMES_ON : YUTANI_SPECIAL_REQUEST_FRAMES_OFF);
+}
+
 /**
  * yutani_set_clipboard
  *
@@ -7,6 +7,7 @@
 #include <bits/dirent.h>
 
 DEFN_SYSCALL3(readdir, SYS_READDIR, int, int, void *);
+DEFN_SYSCALL4(readdirents, SYS_READDIRENTS, int, int, void *, int);
 
 DIR * opendir (const char * dirname) {
 	int fd = open(dirname, O_RDONLY);
@@ -18,6 +19,8 @@ DIR * opendir (const char * dirname) {
 	DIR * dir = (DIR *)malloc(sizeof(DIR));
 	dir->fd = fd;
 	dir->cur_entry = -1;
+	dir->buf_count = 0;
+	dir->buf_pos = 0;
 	return dir;
 }
 
@@ -30,20 +33,23 @@ int closedir (DIR * dir) {
 }
 
 struct dirent * readdir (DIR * dirp) {
-	static struct dirent ent;
-
-	int ret = syscall_readdir(dirp->fd, ++dirp->cur_entry, &ent);
-	if (ret < 0) {
-		errno = -ret;
-		memset(&ent, 0, sizeof(struct dirent));
-		return NULL;
-	}
-
-	if (ret == 0) {
-		/* end of directory */
-		memset(&ent, 0, sizeof(struct dirent));
-		return NULL;
+	if (dirp->buf_pos >= dirp->buf_count) {
+		/* Refill the buffer with a batch of entries in one syscall */
+		int ret = syscall_readdirents(dirp->fd, dirp->cur_entry + 1, dirp->buffer, _DIRENTS_BUFFERED);
+		if (ret < 0) {
+			errno = -ret;
+			return NULL;
+		}
+
+		if (ret == 0) {
+			/* end of directory */
+			return NULL;
+		}
+
+		dirp->buf_count = ret;
+		dirp->buf_pos = 0;
 	}
 
-	return &ent;
+	dirp->cur_entry++;
+	return &dirp->buffer[dirp->buf_pos++];
 }
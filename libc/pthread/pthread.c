@@ -11,6 +11,7 @@
 #include <errno.h>
 
 #include <sys/wait.h>
+#include <sys/futex.h>
 
 DEFN_SYSCALL3(clone, SYS_CLONE, uintptr_t, uintptr_t, void *);
 DEFN_SYSCALL0(gettid, SYS_GETTID);
@@ -56,22 +57,36 @@ void pthread_cleanup_pop(int execute) {
 	/* do nothing */
 }
 
+/*
+ * Futex-backed mutex: 0 = unlocked, 1 = locked, 2 = locked with
+ * waiters. The uncontended lock and unlock never enter the kernel;
+ * a contended lock sleeps instead of spinning.
+ */
 int pthread_mutex_lock(pthread_mutex_t *mutex) {
-	while (__sync_lock_test_and_set(mutex, 0x01)) {
-		syscall_yield();
+	int c = __sync_val_compare_and_swap(mutex, 0, 1);
+	while (c) {
+		/* Advertise that someone is waiting, then sleep until the
+		 * holder's unlock wakes us. */
+		if (c == 2 || __sync_val_compare_and_swap(mutex, 1, 2) != 0) {
+			futex(mutex, FUTEX_WAIT, 2);
+		}
+		c = __sync_val_compare_and_swap(mutex, 0, 2);
 	}
 	return 0;
 }
 
 int pthread_mutex_trylock(pthread_mutex_t *mutex) {
-	if (__sync_lock_test_and_set(mutex, 0x01)) {
+	if (__sync_val_compare_and_swap(mutex, 0, 1)) {
 		return EBUSY;
 	}
 	return 0;
 }
 
 int pthread_mutex_unlock(pthread_mutex_t *mutex) {
-	__sync_lock_release(mutex);
+	if (__sync_fetch_and_sub(mutex, 1) != 1) {
+		*mutex = 0;
+		futex(mutex, FUTEX_WAKE, 1);
+	}
 	return 0;
 }
 
@@ -84,6 +99,37 @@ int pthread_mutex_destroy(pthread_mutex_t *mutex) {
 	return 0;
 }
 
+int pthread_cond_init(pthread_cond_t *cond, const pthread_condattr_t *attr) {
+	cond->seq = 0;
+	return 0;
+}
+
+int pthread_cond_destroy(pthread_cond_t *cond) {
+	return 0;
+}
+
+int pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex) {
+	int seq = cond->seq;
+	pthread_mutex_unlock(mutex);
+	/* If a signal arrives after the unlock, the sequence number has
+	 * moved and the wait returns immediately. */
+	futex(&cond->seq, FUTEX_WAIT, seq);
+	pthread_mutex_lock(mutex);
+	return 0;
+}
+
+int pthread_cond_signal(pthread_cond_t *cond) {
+	__sync_fetch_and_add(&cond->seq, 1);
+	futex(&cond->seq, FUTEX_WAKE, 1);
+	return 0;
+}
+
+int pthread_cond_broadcast(pthread_cond_t *cond) {
+	__sync_fetch_and_add(&cond->seq, 1);
+	futex(&cond->seq, FUTEX_WAKE, INT32_MAX);
+	return 0;
+}
+
 int pthread_attr_init(pthread_attr_t *attr) {
 	*attr = 0;
 	return 0;
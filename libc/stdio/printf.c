@@ -2,70 +2,62 @@
 #include <string.h>
 #include <va_list.h>
 
-static void print_dec(unsigned int value, unsigned int width, char * buf, int * ptr, int fill_zero, int align_right, int precision) {
-	unsigned int n_width = 1;
-	unsigned int i = 9;
+/* Two-digit pairs: each % 100 costs one division and emits
+ * two digits with a table read instead of dividing per digit. */
+static const char two_digits[] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+static void print_dec(unsigned long long value, unsigned int width, char * buf, int * ptr, int fill_zero, int align_right, int precision) {
+	/* Digits are generated backwards into a local buffer; padding
+	 * runs are block fills rather than byte-at-a-time stores. */
+	char digits[20];
+	int n_width = 0;
+
 	if (precision == -1) precision = 1;
 
-	if (value == 0) {
-		n_width = 0;
-	} else if (value < 10UL) {
-		n_width = 1;
-	} else if (value < 100UL) {
-		n_width = 2;
-	} else if (value < 1000UL) {
-		n_width = 3;
-	} else if (value < 10000UL) {
-		n_width = 4;
-	} else if (value < 100000UL) {
-		n_width = 5;
-	} else if (value < 1000000UL) {
-		n_width = 6;
-	} else if (value < 10000000UL) {
-		n_width = 7;
-	} else if (value < 100000000UL) {
-		n_width = 8;
-	} else if (value < 1000000000UL) {
-		n_width = 9;
+	unsigned long long v = value;
+	while (v >= 100) {
+		unsigned int pair = v % 100;
+		v /= 100;
+		digits[n_width++] = two_digits[pair * 2 + 1];
+		digits[n_width++] = two_digits[pair * 2];
+	}
+	if (v >= 10) {
+		digits[n_width++] = two_digits[v * 2 + 1];
+		digits[n_width++] = two_digits[v * 2];
 	} else {
-		n_width = 10;
+		digits[n_width++] = '0' + v;
 	}
 
-	if (n_width < (unsigned int)precision) n_width = precision;
+	/* Zero has no natural width; precision (default 1) supplies it */
+	if (value == 0) n_width = 0;
 
-	int printed = 0;
-	if (align_right) {
-		while (n_width + printed < width) {
-			buf[*ptr] = fill_zero ? '0' : ' ';
-			*ptr += 1;
-			printed += 1;
-		}
+	int total = n_width > precision ? n_width : precision;
 
-		i = n_width;
-		while (i > 0) {
-			unsigned int n = value / 10;
-			int r = value % 10;
-			buf[*ptr + i - 1] = r + '0';
-			i--;
-			value = n;
-		}
-		*ptr += n_width;
-	} else {
-		i = n_width;
-		while (i > 0) {
-			unsigned int n = value / 10;
-			int r = value % 10;
-			buf[*ptr + i - 1] = r + '0';
-			i--;
-			value = n;
-			printed++;
-		}
-		*ptr += n_width;
-		while (printed < (int)width) {
-			buf[*ptr] = fill_zero ? '0' : ' ';
-			*ptr += 1;
-			printed += 1;
-		}
+	if (align_right && total < (int)width) {
+		memset(buf + *ptr, fill_zero ? '0' : ' ', width - total);
+		*ptr += width - total;
+	}
+	if (total > n_width) {
+		memset(buf + *ptr, '0', total - n_width);
+		*ptr += total - n_width;
+	}
+	for (int i = n_width - 1; i >= 0; i--) {
+		buf[*ptr] = digits[i];
+		*ptr += 1;
+	}
+	if (!align_right && total < (int)width) {
+		memset(buf + *ptr, fill_zero ? '0' : ' ', width - total);
+		*ptr += width - total;
 	}
 }
 
@@ -78,17 +70,13 @@ static void print_hex(unsigned int value, unsigned int width, char * buf, int *
 	if (i == 0) i = 8;
 
 	unsigned int n_width = 1;
-	unsigned int j = 0x0F;
-	while (value > j && j < UINT32_MAX) {
+	while ((value >> (4 * n_width)) && n_width < 8) {
 		n_width += 1;
-		j *= 0x10;
-		j += 0x0F;
 	}
 
-	while (i > (int)n_width) {
-		buf[*ptr] = '0';
-		*ptr += 1;
-		i--;
+	if (i > (int)n_width) {
+		memset(buf + *ptr, '0', i - n_width);
+		*ptr += i - n_width;
 	}
 
 	i = (int)n_width;
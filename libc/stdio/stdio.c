@@ -20,6 +20,14 @@ struct _FILE {
 	int bufsiz;
 	long last_read_start;
 	char * _name;
+
+	char * write_buf;
+	size_t written;
+	size_t wbufsiz;
+	int buf_mode;
+	int user_buf;       /* write_buf belongs to the caller (setvbuf) */
+
+	struct _FILE * next; /* All open streams, for fflush(NULL) */
 };
 
 FILE _stdin = {
@@ -56,19 +64,30 @@ FILE _stderr = {
 	.eof = 0,
 	.last_read_start = 0,
 	.bufsiz = BUFSIZ,
+	.buf_mode = _IONBF,
 };
 
 FILE * stdin = &_stdin;
 FILE * stdout = &_stdout;
 FILE * stderr = &_stderr;
 
+static FILE * _head = NULL;
+
 void __stdio_init_buffers(void) {
 	_stdin.read_buf = malloc(BUFSIZ);
-	//_stdout.read_buf = malloc(BUFSIZ);
-	//_stderr.read_buf = malloc(BUFSIZ);
 	_stdin._name = strdup("stdin");
 	_stdout._name = strdup("stdout");
 	_stderr._name = strdup("stderr");
+
+	/* ANSI: line buffered on a terminal, block buffered otherwise;
+	 * stderr is always unbuffered. */
+	_stdout.write_buf = malloc(BUFSIZ);
+	_stdout.wbufsiz = BUFSIZ;
+	_stdout.buf_mode = isatty(1) ? _IOLBF : _IOFBF;
+
+	_stdin.next = &_stdout;
+	_stdout.next = &_stderr;
+	_head = &_stdin;
 }
 
 #if 0
@@ -86,15 +105,18 @@ extern int __libc_debug;
 extern char * _argv_0;
 
 int setvbuf(FILE * stream, char * buf, int mode, size_t size) {
-	if (mode != _IOLBF) {
-		return -1; /* Unsupported */
+	if (mode != _IONBF && mode != _IOLBF && mode != _IOFBF) {
+		return -1;
 	}
+	fflush(stream);
+	stream->buf_mode = mode;
 	if (buf) {
-		if (stream->read_buf) {
-			free(stream->read_buf);
+		if (stream->write_buf && !stream->user_buf) {
+			free(stream->write_buf);
 		}
-		stream->read_buf = buf;
-		stream->bufsiz = size;
+		stream->write_buf = buf;
+		stream->wbufsiz = size;
+		stream->user_buf = 1;
 	}
 	return 0;
 }
@@ -102,6 +124,14 @@ int setvbuf(FILE * stream, char * buf, int mode, size_t size) {
 static size_t read_bytes(FILE * f, char * out, size_t len) {
 	size_t r_out = 0;
 
+	/* Reading from a stream commits anything we had buffered to write,
+	 * and reading from stdin flushes prompts sitting in stdout. */
+	if (f->written) fflush(f);
+	if (f == &_stdin) fflush(&_stdout);
+	if (!f->read_buf) {
+		f->read_buf = malloc(f->bufsiz);
+	}
+
 	//fprintf(stderr, "%s: Read %d bytes from %s\n", _argv_0, len, stream_id(f));
 	//fprintf(stderr, "%s: off[%d] avail[%d] read[%d]\n", _argv_0, f->offset, f->available, f->read_from);
 
@@ -205,6 +235,10 @@ FILE * fopen(const char *path, const char *mode) {
 	out->ungetc = -1;
 	out->eof = 0;
 	out->_name = strdup(path);
+	out->buf_mode = _IOFBF;
+
+	out->next = _head;
+	_head = out;
 
 	return out;
 }
@@ -253,10 +287,14 @@ FILE * fdopen(int fd, const char *mode){
 	out->offset = 0;
 	out->ungetc = -1;
 	out->eof = 0;
+	out->buf_mode = isatty(fd) ? _IOLBF : _IOFBF;
 	char tmp[30];
 	sprintf(tmp, "fd[%d]", fd);
 	out->_name = strdup(tmp);
 
+	out->next = _head;
+	_head = out;
+
 	return out;
 }
 
@@ -265,12 +303,29 @@ int _fwouldblock(FILE * stream) {
 }
 
 int fclose(FILE * stream) {
+	fflush(stream);
 	int out = syscall_close(stream->fd);
 	free(stream->_name);
 	free(stream->read_buf);
+	stream->_name = NULL;
+	stream->read_buf = NULL;
+	if (stream->write_buf && !stream->user_buf) {
+		free(stream->write_buf);
+	}
+	stream->write_buf = NULL;
 	if (stream == &_stdin || stream == &_stdout || stream == &_stderr) {
 		return out;
 	} else {
+		if (_head == stream) {
+			_head = stream->next;
+		} else {
+			for (FILE * f = _head; f; f = f->next) {
+				if (f->next == stream) {
+					f->next = stream->next;
+					break;
+				}
+			}
+		}
 		free(stream);
 		return out;
 	}
@@ -284,6 +339,7 @@ static char * _whence_str(int whence) {
 }
 
 int fseek(FILE * stream, long offset, int whence) {
+	fflush(stream);
 	if (_argv_0 && strcmp(_argv_0, "ld.so")) {
 		if (stream->read_from && whence == SEEK_CUR) {
 			if (__libc_debug) {
@@ -310,6 +366,7 @@ int fseek(FILE * stream, long offset, int whence) {
 }
 
 long ftell(FILE * stream) {
+	fflush(stream);
 	if (_argv_0 && strcmp(_argv_0, "ld.so") && __libc_debug) {
 		fprintf(stderr, "%s: ftell(%s)\n", _argv_0, stream->_name);
 	}
@@ -356,18 +413,54 @@ size_t fread(void *ptr, size_t size, size_t nmemb, FILE * stream) {
 	return nmemb;
 }
 
+static int write_all(FILE * stream, const char * ptr, size_t out_size) {
+	int r = syscall_write(stream->fd, (void*)ptr, out_size);
+	if (r < 0) {
+		errno = -r;
+		return -1;
+	}
+	return r;
+}
+
 size_t fwrite(const void *ptr, size_t size, size_t nmemb, FILE * stream) {
 	size_t out_size = size * nmemb;
 
 	if (!out_size) return 0;
 
-	int r = syscall_write(stream->fd, (void*)ptr, out_size);
-	if (r < 0) {
-		errno = -r;
-		return -1;
+	if (stream->buf_mode == _IONBF) {
+		int r = write_all(stream, ptr, out_size);
+		if (r < 0) return -1;
+		return r / size;
 	}
 
-	return r / size;
+	if (!stream->write_buf) {
+		stream->write_buf = malloc(BUFSIZ);
+		stream->wbufsiz = BUFSIZ;
+	}
+
+	/*
+	 * Large writes skip the buffer entirely - one copy and one syscall
+	 * beats chopping the data up into buffer-sized pieces.
+	 */
+	if (out_size >= stream->wbufsiz) {
+		if (fflush(stream)) return -1;
+		int r = write_all(stream, ptr, out_size);
+		if (r < 0) return -1;
+		return r / size;
+	}
+
+	if (stream->written + out_size > stream->wbufsiz) {
+		if (fflush(stream)) return -1;
+	}
+
+	memcpy(&stream->write_buf[stream->written], ptr, out_size);
+	stream->written += out_size;
+
+	if (stream->buf_mode == _IOLBF && memchr(ptr, '\n', out_size)) {
+		if (fflush(stream)) return -1;
+	}
+
+	return nmemb;
 }
 
 int fileno(FILE * stream) {
@@ -375,6 +468,19 @@ int fileno(FILE * stream) {
 }
 
 int fflush(FILE * stream) {
+	if (!stream) {
+		for (FILE * f = _head; f; f = f->next) {
+			if (f->written) fflush(f);
+		}
+		return 0;
+	}
+	if (stream->written) {
+		size_t to_write = stream->written;
+		stream->written = 0;
+		if (write_all(stream, stream->write_buf, to_write) < 0) {
+			return EOF;
+		}
+	}
 	return 0;
 }
 
@@ -446,7 +552,7 @@ void rewind(FILE *stream) {
 }
 
 void setbuf(FILE * stream, char * buf) {
-	// ...
+	setvbuf(stream, buf, buf ? _IOFBF : _IONBF, BUFSIZ);
 }
 
 int feof(FILE * stream) {
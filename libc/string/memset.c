@@ -1,10 +1,50 @@
 #include <stddef.h>
+#include <stdint.h>
 
-void * memset(void * dest, int c, size_t n) {
+#include <emmintrin.h>
+
+/*
+ * Small fills: rep stosb setup is cheaper than anything else.
+ */
+static inline void _memset_small(void * dest, int c, size_t n) {
 	asm volatile("cld; rep stosb"
 	             : "=c"((int){0})
 	             : "D"(dest), "a"(c), "c"(n)
 	             : "flags", "memory");
-	return dest;
 }
 
+/*
+ * Large fills use 64-byte aligned SSE stores; see memcpy.c for the
+ * reasoning (and lib/graphics.c draw_fill for the same trick on
+ * framebuffer rows).
+ */
+void * memset(void * dest, int c, size_t n) {
+	char * d = dest;
+
+	if (n < 64) {
+		_memset_small(d, c, n);
+		return dest;
+	}
+
+	size_t head = (-(uintptr_t)d) & 15;
+	if (head) {
+		_memset_small(d, c, head);
+		d += head;
+		n -= head;
+	}
+
+	__m128i v = _mm_set1_epi8((char)c);
+	while (n >= 64) {
+		_mm_store_si128((__m128i *)(d),      v);
+		_mm_store_si128((__m128i *)(d + 16), v);
+		_mm_store_si128((__m128i *)(d + 32), v);
+		_mm_store_si128((__m128i *)(d + 48), v);
+		d += 64; n -= 64;
+	}
+
+	if (n) {
+		_memset_small(d, c, n);
+	}
+
+	return dest;
+}
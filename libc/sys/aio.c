@@ -0,0 +1,15 @@
+#include <errno.h>
+#include <syscall.h>
+#include <syscall_nums.h>
+#include <kernel/aio.h>
+
+DEFN_SYSCALL1(aio_submit, SYS_AIO_SUBMIT, struct aio_request *);
+DEFN_SYSCALL3(aio_reap, SYS_AIO_REAP, struct aio_completion *, int, int);
+
+int aio_submit(struct aio_request * req) {
+	__sets_errno(syscall_aio_submit(req));
+}
+
+int aio_reap(struct aio_completion * out, int max, int wait) {
+	__sets_errno(syscall_aio_reap(out, max, wait));
+}
@@ -0,0 +1,20 @@
+#include <sys/eventset.h>
+#include <errno.h>
+#include <syscall.h>
+#include <syscall_nums.h>
+
+DEFN_SYSCALL0(eventset_create, SYS_EVENTSET_CREATE);
+DEFN_SYSCALL3(eventset_ctl, SYS_EVENTSET_CTL, int, int, int);
+DEFN_SYSCALL4(eventset_wait, SYS_EVENTSET_WAIT, int, int *, int, int);
+
+int eventset_create(void) {
+	__sets_errno(syscall_eventset_create());
+}
+
+int eventset_ctl(int set, int op, int fd) {
+	__sets_errno(syscall_eventset_ctl(set, op, fd));
+}
+
+int eventset_wait(int set, int * out, int max, int timeout) {
+	__sets_errno(syscall_eventset_wait(set, out, max, timeout));
+}
@@ -0,0 +1,10 @@
+#include <sys/futex.h>
+#include <errno.h>
+#include <syscall.h>
+#include <syscall_nums.h>
+
+DEFN_SYSCALL3(futex, SYS_FUTEX, int *, int, int);
+
+int futex(volatile int * addr, int op, int value) {
+	__sets_errno(syscall_futex((int *)addr, op, value));
+}
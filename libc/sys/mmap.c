@@ -0,0 +1,21 @@
+#include <sys/mman.h>
+#include <errno.h>
+#include <syscall.h>
+#include <syscall_nums.h>
+
+DEFN_SYSCALL5(mmap, SYS_MMAP, int, int, int, int, int);
+DEFN_SYSCALL2(munmap, SYS_MUNMAP, int, int);
+
+void * mmap(void * addr, size_t length, int prot, int flags, int fd, off_t offset) {
+	(void)addr; /* Address hints are ignored; the kernel picks the placement. */
+	int ret = syscall_mmap(length, prot, flags, fd, offset);
+	if (ret < 0) {
+		errno = -ret;
+		return MAP_FAILED;
+	}
+	return (void *)ret;
+}
+
+int munmap(void * addr, size_t length) {
+	__sets_errno(syscall_munmap((int)addr, length));
+}
@@ -2,12 +2,22 @@
 #include <syscall_nums.h>
 
 DEFN_SYSCALL2(shm_obtain,  SYS_SHM_OBTAIN, char *, size_t *);
+DEFN_SYSCALL2(shm_obtain_ro, SYS_SHM_OBTAIN_RO, char *, size_t *);
 DEFN_SYSCALL1(shm_release, SYS_SHM_RELEASE, char *);
+DEFN_SYSCALL2(shm_resize,  SYS_SHM_RESIZE, char *, size_t *);
 
 void * shm_obtain(char * path, size_t * size) {
 	return (void *)syscall_shm_obtain(path, size);
 }
 
+void * shm_obtain_ro(char * path, size_t * size) {
+	return (void *)syscall_shm_obtain_ro(path, size);
+}
+
 int shm_release(char * path) {
 	return syscall_shm_release(path);
 }
+
+int shm_resize(char * path, size_t * size) {
+	return syscall_shm_resize(path, size);
+}
@@ -0,0 +1,15 @@
+#include <sys/uio.h>
+#include <errno.h>
+#include <syscall.h>
+#include <syscall_nums.h>
+
+DEFN_SYSCALL3(readv, SYS_READV, int, const struct iovec *, int);
+DEFN_SYSCALL3(writev, SYS_WRITEV, int, const struct iovec *, int);
+
+int readv(int fd, const struct iovec * iov, int count) {
+	__sets_errno(syscall_readv(fd, iov, count));
+}
+
+int writev(int fd, const struct iovec * iov, int count) {
+	__sets_errno(syscall_writev(fd, iov, count));
+}
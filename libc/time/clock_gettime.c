@@ -0,0 +1,10 @@
+#include <time.h>
+#include <errno.h>
+#include <syscall.h>
+#include <syscall_nums.h>
+
+DEFN_SYSCALL2(clock_gettime, SYS_CLOCK_GETTIME, int, void *);
+
+int clock_gettime(clockid_t clk_id, struct timespec * tp) {
+	__sets_errno(syscall_clock_gettime(clk_id, tp));
+}
@@ -155,8 +155,25 @@ struct tm * gmtime_r(const time_t * timep, struct tm * tm) {
 	return localtime_r(timep, tm);
 }
 
+/* Start of the day the last result fell in; most callers (ls, anything
+ * stamping log lines) convert runs of timestamps from the same day, and
+ * the calendar walk above is expensive enough to be worth skipping. */
+static time_t _cached_day_start = -1;
+
 struct tm * localtime(const time_t *timep) {
-	return localtime_r(timep, &_timevalue);
+	if (_cached_day_start != -1 && *timep >= _cached_day_start && *timep < _cached_day_start + SEC_DAY) {
+		long remaining = *timep - _cached_day_start;
+		_timevalue.tm_hour = remaining / 3600;
+		_timevalue.tm_min  = (remaining / 60) % 60;
+		_timevalue.tm_sec  = remaining % 60;
+		return &_timevalue;
+	}
+	if (!localtime_r(timep, &_timevalue)) {
+		_cached_day_start = -1;
+		return NULL;
+	}
+	_cached_day_start = *timep - (_timevalue.tm_hour * 3600 + _timevalue.tm_min * 60 + _timevalue.tm_sec);
+	return &_timevalue;
 }
 
 struct tm *gmtime(const time_t *timep) {
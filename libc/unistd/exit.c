@@ -1,7 +1,9 @@
 #include <unistd.h>
 #include <stdlib.h>
+#include <stdio.h>
 
 void exit(int val) {
 	_handle_atexit();
+	fflush(NULL);
 	_exit(val);
 }
@@ -0,0 +1,11 @@
+#include <fcntl.h>
+#include <syscall.h>
+#include <syscall_nums.h>
+
+DEFN_SYSCALL4(fadvise, SYS_FADVISE, int, int, int, int);
+
+/* Unlike most calls, posix_fadvise returns the error number directly. */
+int posix_fadvise(int fd, off_t offset, off_t len, int advice) {
+	int result = syscall_fadvise(fd, offset, len, advice);
+	return (result < 0) ? -result : 0;
+}
@@ -0,0 +1,15 @@
+#include <unistd.h>
+#include <errno.h>
+#include <syscall.h>
+#include <syscall_nums.h>
+
+DEFN_SYSCALL5(spawn, SYS_SPAWN, const char *, char * const *, char * const *, int *, int);
+
+/*
+ * Combined fork+exec (toaru-specific). fd_map gives the child's
+ * descriptor table: child fd i aliases the caller's fd fd_map[i],
+ * -1 leaves it closed. Pass a NULL map to inherit everything.
+ */
+pid_t spawn(const char * path, char * const argv[], char * const envp[], int * fd_map, int fd_count) {
+	__sets_errno(syscall_spawn(path, argv, envp, fd_map, fd_count));
+}
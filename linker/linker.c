@@ -31,6 +31,8 @@
 
 #include <kernel/elf.h>
 
+#include <toaru/launchtrace.h>
+
 void * (*_malloc)(size_t size) = malloc;
 void (*_free)(void * ptr) = free;
 
@@ -59,6 +61,9 @@ static void free(void * ptr) {
 
 static int __trace_ld = 0;
 
+/* When LD_BIND_NOW is set, resolve all PLT entries at load time. */
+static int _bind_now = 0;
+
 #include <toaru/trace.h>
 
 /*
@@ -81,6 +86,9 @@ static char * last_error = NULL;
 
 static int _target_is_suid = 0;
 
+/* Size (in words) of the per-object symbol Bloom filter. */
+#define ELF_BLOOM_WORDS 64
+
 typedef struct elf_object {
 	FILE * file;
 
@@ -96,6 +104,16 @@ typedef struct elf_object {
 	Elf32_Dyn * dynamic;
 	Elf32_Word * dyn_hash;
 
+	/* PLT bits for lazy binding */
+	Elf32_Word * plt_got;
+	Elf32_Rel * plt_rel;
+
+	/* Hashed symbol lookup, built once in object_postload. */
+	Elf32_Word * hash_bucket;
+	Elf32_Word * hash_chain;
+	Elf32_Word hash_nbucket;
+	Elf32_Word bloom[ELF_BLOOM_WORDS];
+
 	void (*init)(void);
 	void (**init_array)(void);
 	size_t init_array_size;
@@ -323,6 +341,42 @@ static uintptr_t object_load(elf_t * object, uintptr_t base) {
 	return end_addr;
 }
 
+/* Standard ELF symbol hash; matches the precomputed DT_HASH table. */
+static uint32_t elf_hash(const char * name) {
+	uint32_t h = 0, g;
+	while (*name) {
+		h = (h << 4) + (uint8_t)*name++;
+		g = h & 0xF0000000;
+		if (g) h ^= g >> 24;
+		h &= ~g;
+	}
+	return h;
+}
+
+/*
+ * Build the per-object lookup structures: the bucket/chain pointers
+ * into the object's precomputed DT_HASH table, and a small Bloom
+ * filter over every defined symbol name (GNU-hash style) so lookups
+ * for symbols an object doesn't have are rejected without touching
+ * the chains at all - which is the common case when probing a list
+ * of loaded objects.
+ */
+static void object_build_hash(elf_t * object) {
+	if (!object->dyn_hash || !object->dyn_symbol_table) return;
+
+	object->hash_nbucket = object->dyn_hash[0];
+	object->hash_bucket  = &object->dyn_hash[2];
+	object->hash_chain   = &object->dyn_hash[2 + object->hash_nbucket];
+
+	memset(object->bloom, 0, sizeof(object->bloom));
+	for (size_t i = 0; i < object->dyn_symbol_table_size; ++i) {
+		Elf32_Sym * sym = &object->dyn_symbol_table[i];
+		if (!sym->st_shndx) continue;
+		uint32_t h = elf_hash((char *)((uintptr_t)object->dyn_string_table + sym->st_name));
+		object->bloom[(h >> 5) & (ELF_BLOOM_WORDS - 1)] |= (1 << (h & 31)) | (1 << ((h >> 10) & 31));
+	}
+}
+
 /* Perform cleanup after loading */
 static int object_postload(elf_t * object) {
 
@@ -334,6 +388,9 @@ static int object_postload(elf_t * object) {
 		table = object->dynamic;
 		while (table->d_tag) {
 			switch (table->d_tag) {
+				case 3: /* DT_PLTGOT */
+					object->plt_got = (Elf32_Word *)(object->base + table->d_un.d_ptr);
+					break;
 				case 4:
 					object->dyn_hash = (Elf32_Word *)(object->base + table->d_un.d_ptr);
 					object->dyn_symbol_table_size = object->dyn_hash[1];
@@ -353,6 +410,9 @@ static int object_postload(elf_t * object) {
 				case 25: /* DT_INIT_ARRAY - array of constructors */
 					object->init_array = (void (**)(void))(table->d_un.d_ptr + object->base);
 					break;
+				case 23: /* DT_JMPREL - PLT relocations */
+					object->plt_rel = (Elf32_Rel *)(object->base + table->d_un.d_ptr);
+					break;
 				case 27: /* DT_INIT_ARRAYSZ - size of the table of constructors */
 					object->init_array_size = table->d_un.d_val / sizeof(uintptr_t);
 					break;
@@ -377,9 +437,71 @@ static int object_postload(elf_t * object) {
 		}
 	}
 
+	object_build_hash(object);
+
+	/* Point the PLT machinery at the lazy resolver: the first PLT
+	 * entry pushes GOT[1] and jumps through GOT[2]. */
+	extern void _dl_resolve_stub(void);
+	if (object->plt_got && object->plt_rel) {
+		object->plt_got[1] = (Elf32_Word)object;
+		object->plt_got[2] = (Elf32_Word)&_dl_resolve_stub;
+	}
+
 	return 0;
 }
 
+/*
+ * First-call resolver for lazily bound PLT entries. The stub below
+ * hands us the object and the byte offset of the JUMP_SLOT relocation
+ * within its PLT relocation table; we patch the GOT so later calls go
+ * straight through, and return the target for this one.
+ */
+uintptr_t _dl_resolve(elf_t * object, uintptr_t rel_offset) {
+	Elf32_Rel * table = (Elf32_Rel *)((uintptr_t)object->plt_rel + rel_offset);
+	Elf32_Sym * sym = &object->dyn_symbol_table[ELF32_R_SYM(table->r_info)];
+	char * symname = (char *)((uintptr_t)object->dyn_string_table + sym->st_name);
+
+	uintptr_t x;
+	if (hashmap_has(dumb_symbol_table, symname)) {
+		x = (uintptr_t)hashmap_get(dumb_symbol_table, symname);
+	} else if (sym->st_shndx) {
+		x = sym->st_value + object->base;
+	} else {
+		fprintf(stderr, "ld.so: unable to resolve '%s'\n", symname);
+		exit(1);
+	}
+
+	TRACE_LD("Resolved %s to 0x%x on first call", symname, x);
+
+	memcpy((void *)(table->r_offset + object->base), &x, sizeof(uintptr_t));
+	return x;
+}
+
+/*
+ * Entered from a PLT through GOT[2] with the object (GOT[1]) and the
+ * relocation offset on the stack. Calls _dl_resolve, then jumps to
+ * the real target with the two pushed words removed, so the target
+ * sees exactly the frame its caller built. ECX and EDX are preserved
+ * in case the caller holds live values in them at the call.
+ */
+asm (
+	".global _dl_resolve_stub\n"
+	"_dl_resolve_stub:\n"
+	"	pushl %ecx\n"
+	"	pushl %edx\n"
+	"	movl 8(%esp), %eax\n"    /* object */
+	"	movl 12(%esp), %edx\n"   /* relocation offset */
+	"	pushl %edx\n"
+	"	pushl %eax\n"
+	"	call _dl_resolve\n"
+	"	addl $8, %esp\n"
+	"	popl %edx\n"
+	"	popl %ecx\n"
+	"	movl %eax, 4(%esp)\n"    /* replace the offset slot with the target */
+	"	addl $4, %esp\n"         /* drop the object slot */
+	"	ret\n"                   /* 'return' into the target */
+);
+
 /* Whether symbol addresses is needed for a relocation type */
 static int need_symbol_for_type(unsigned char type) {
 	switch(type) {
@@ -431,6 +553,15 @@ static int object_relocate(elf_t * object) {
 				unsigned char type = ELF32_R_TYPE(table->r_info);
 				Elf32_Sym * sym = &object->dyn_symbol_table[symbol];
 
+				/* JUMP_SLOTs bind lazily: leave the slot pointing at the
+				 * PLT push sequence (adjusted for our base) and let the
+				 * resolver stub patch it on first call. */
+				if (type == 7 && !_bind_now && object->plt_got && object->plt_rel) {
+					*((uintptr_t *)(table->r_offset + object->base)) += object->base;
+					table++;
+					continue;
+				}
+
 				/* If we need symbol for this, get it. */
 				char * symname = NULL;
 				uintptr_t x = sym->st_value + object->base;
@@ -516,6 +647,30 @@ static void * object_find_symbol(elf_t * object, const char * symbol_name) {
 		return NULL;
 	}
 
+	if (object->hash_nbucket) {
+		uint32_t h = elf_hash(symbol_name);
+
+		/* Both probe bits must be set or the object can't have it. */
+		Elf32_Word mask = (1 << (h & 31)) | (1 << ((h >> 10) & 31));
+		if ((object->bloom[(h >> 5) & (ELF_BLOOM_WORDS - 1)] & mask) != mask) {
+			last_error = "symbol not found in library";
+			return NULL;
+		}
+
+		/* Walk just this symbol's hash chain; 0 (STN_UNDEF) terminates. */
+		for (Elf32_Word i = object->hash_bucket[h % object->hash_nbucket]; i; i = object->hash_chain[i]) {
+			Elf32_Sym * sym = &object->dyn_symbol_table[i];
+			if (!sym->st_shndx) continue; /* skip undefined entries (imports) */
+			if (!strcmp(symbol_name, (char *)((uintptr_t)object->dyn_string_table + sym->st_name))) {
+				return (void *)(sym->st_value + object->base);
+			}
+		}
+
+		last_error = "symbol not found in library";
+		return NULL;
+	}
+
+	/* No hash table in this object; scan the symbol table directly. */
 	Elf32_Sym * table = object->dyn_symbol_table;
 	size_t i = 0;
 	while (i < object->dyn_symbol_table_size) {
@@ -549,8 +704,10 @@ static void * do_actual_load(const char * filename, elf_t * lib, int flags) {
 
 	/*
 	 * Allocate space to load the library
-	 * This is where we should really be loading things into COW
-	 * but we don't have the functionality available.
+	 * The preload path maps startup libraries copy-on-write from the
+	 * kernel's library cache, but dlopen'd objects land in malloc'd
+	 * memory that is neither page-aligned nor exclusively ours, so
+	 * they still get a private copy.
 	 */
 	uintptr_t load_addr = (uintptr_t)malloc(lib_size);
 	object_load(lib, load_addr);
@@ -636,8 +793,37 @@ static elf_t * preload(hashmap_t * libs, list_t * load_libs, char * lib_name) {
 		end_addr++;
 	}
 
-	/* Load PHDRs */
-	end_addr = object_load(lib, end_addr);
+	/* If an earlier process already read this library in, map its
+	 * pinned image copy-on-write instead of loading it again. */
+	char * cache_args[] = {lib_name, (char *)end_addr};
+	int cached = sysfunc(TOARU_SYS_FUNC_MAPLIB, cache_args);
+	if (cached > 0) {
+		lib->base = end_addr;
+		/* The segments are already in place; walk the phdrs only to
+		 * find the dynamic section. */
+		size_t headers = 0;
+		while (headers < lib->header.e_phnum) {
+			Elf32_Phdr phdr;
+			fseek(lib->file, lib->header.e_phoff + lib->header.e_phentsize * headers, SEEK_SET);
+			fread(&phdr, lib->header.e_phentsize, 1, lib->file);
+			if (phdr.p_type == PT_DYNAMIC) {
+				lib->dynamic = (Elf32_Dyn *)(lib->base + phdr.p_vaddr);
+			}
+			headers++;
+		}
+		end_addr += cached;
+	} else {
+		uintptr_t load_base = end_addr;
+
+		/* Load PHDRs */
+		end_addr = object_load(lib, end_addr);
+
+		/* Offer the pristine image to the kernel cache before any
+		 * relocations touch it. Only root may seed the cache, so for
+		 * everyone else this fails quietly and the copy stays private. */
+		char * share_args[] = {lib_name, (char *)load_base, (char *)(end_addr - load_base)};
+		sysfunc(TOARU_SYS_FUNC_SHARELIB, share_args);
+	}
 
 	/* Extract information */
 	object_postload(lib);
@@ -747,6 +933,14 @@ int main(int argc, char * argv[]) {
 		__trace_ld = 1;
 	}
 
+	/* Escape hatch: resolve everything up front */
+	char * bind_now_env = getenv("LD_BIND_NOW");
+	if ((bind_now_env && (!strcmp(bind_now_env,"1") || !strcmp(bind_now_env,"yes")))) {
+		_bind_now = 1;
+	}
+
+	launchtrace("ld:start");
+
 	/* Initialize hashmaps for symbols, GLOB_DATs, and objects */
 	dumb_symbol_table = hashmap_create(10);
 	glob_dat = hashmap_create(10);
@@ -815,6 +1009,8 @@ nope:
 		free(item);
 	}
 
+	launchtrace("ld:deps-loaded");
+
 	list_t * ctor_libs = list_create();
 	list_t * init_libs = list_create();
 	while ((item = list_dequeue(load_libs))) {
@@ -841,6 +1037,7 @@ nope:
 	TRACE_LD("Relocating main object");
 	object_relocate(main_obj);
 	fclose(main_obj->file);
+	launchtrace("ld:relocated");
 	TRACE_LD("Placing heap at end");
 	while (end_addr & 0xFFF) {
 		end_addr++;
@@ -880,6 +1077,8 @@ nope:
 		main_obj->init();
 	}
 
+	launchtrace("ld:ctors-done");
+
 	main_obj->loaded = 1;
 
 	/* Move heap start (kind of like a weird sbrk) */
@@ -895,6 +1094,7 @@ nope:
 
 	/* Jump to the entry for the main object */
 	TRACE_LD("Jumping to entry point");
+	launchtrace("ld:entry");
 	entry_point_t entry = (entry_point_t)main_obj->header.e_entry;
 	entry(argc-arg_offset,argv+arg_offset,environ);
 
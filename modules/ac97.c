@@ -35,7 +35,10 @@
 /* Bus mastering misc */
 /* Buffer descriptor list constants */
 #define AC97_BDL_LEN              32                    /* Buffer descriptor list length */
-#define AC97_BDL_BUFFER_LEN       0x1000                /* Length of buffer in BDL */
+#define AC97_BDL_BUFFER_LEN       0x1000                /* Maximum length of buffer in BDL */
+#define AC97_PERIOD_DEFAULT       0x400                 /* Default period length in samples */
+#define AC97_PERIOD_MIN           0x100                 /* Shortest allowed period */
+#define AC97_PERIOD_MAX           AC97_BDL_BUFFER_LEN   /* Longest allowed period */
 #define AC97_CL_GET_LENGTH(cl)    ((cl) & 0xFFFF)       /* Decode length from cl */
 #define AC97_CL_SET_LENGTH(cl, v) ((cl) = (v) & 0xFFFF) /* Encode length to cl */
 #define AC97_CL_BUP               ((uint32_t)1 << 30)             /* Buffer underrun policy in cl */
@@ -84,11 +87,15 @@ typedef struct {
 	uint16_t * bufs[AC97_BDL_LEN];  /* Virtual addresses for buffers in BDL */
 	uint32_t bdl_p;
 	uint32_t mask;
+	uint16_t period_len;            /* Samples per period; refills pick this up */
+	uint8_t last_civ;               /* Last current-index we accounted for */
+	uint32_t samples_played;        /* Samples in buffers the hardware has finished */
 } ac97_device_t;
 
 static ac97_device_t _device;
 
 #define AC97_KNOB_PCM_OUT (SND_KNOB_VENDOR + 0)
+#define AC97_KNOB_PERIOD  (SND_KNOB_VENDOR + 1)
 
 static snd_knob_t _knobs[] = {
 	{
@@ -98,11 +105,17 @@ static snd_knob_t _knobs[] = {
 	{
 		"PCM Out",
 		SND_KNOB_VENDOR + 0
+	},
+	{
+		/* Period length in samples, not a scaled volume value */
+		"Period Size",
+		SND_KNOB_VENDOR + 1
 	}
 };
 
 static int ac97_mixer_read(uint32_t knob_id, uint32_t *val);
 static int ac97_mixer_write(uint32_t knob_id, uint32_t val);
+static uint32_t ac97_get_position(snd_device_t * device);
 
 static snd_device_t _snd = {
 	.name            = AC97_SND_NAME,
@@ -115,6 +128,8 @@ static snd_device_t _snd = {
 
 	.mixer_read  = ac97_mixer_read,
 	.mixer_write = ac97_mixer_write,
+
+	.get_position = ac97_get_position,
 };
 
 /* 
@@ -138,9 +153,23 @@ static int irq_handler(struct regs * regs) {
 	if (!sr) return 0;
 
 	if (sr & AC97_X_SR_BCIS) {
+		/* Account every period the hardware has finished since the last
+		 * interrupt; a busy system may coalesce several completions. */
+		uint8_t civ = inportb(_device.nabmbar + AC97_PO_CIV);
+		while (_device.last_civ != civ) {
+			_device.samples_played += AC97_CL_GET_LENGTH(_device.bdl[_device.last_civ].cl);
+			_device.last_civ = (_device.last_civ + 1) % AC97_BDL_LEN;
+		}
+		/* Refill the period two entries ahead of the last valid one; the
+		 * current period length is applied here so tuning the knob takes
+		 * effect without stopping the DMA engine. */
 		size_t f = (_device.lvi + 2) % AC97_BDL_LEN;
-		for (size_t i = 0; i < AC97_BDL_BUFFER_LEN * sizeof(*_device.bufs[0]); i += DIVISION) {
-			snd_request_buf(&_snd, DIVISION, (uint8_t *)_device.bufs[f] + i);
+		uint16_t period = _device.period_len;
+		AC97_CL_SET_LENGTH(_device.bdl[f].cl, period);
+		_device.bdl[f].cl |= AC97_CL_IOC;
+		size_t bytes = period * sizeof(*_device.bufs[0]);
+		for (size_t i = 0; i < bytes; i += DIVISION) {
+			snd_request_buf(&_snd, MIN(DIVISION, bytes - i), (uint8_t *)_device.bufs[f] + i);
 			//switch_task(1);
 		}
 		_device.lvi = (_device.lvi + 1) % AC97_BDL_LEN;
@@ -160,6 +189,21 @@ static int irq_handler(struct regs * regs) {
 	return 1;
 }
 
+/*
+ * Report how far the DMA engine has played, in samples. Completed
+ * periods are accounted in the interrupt handler; progress into the
+ * current period comes from the position-in-current-buffer register.
+ * The result is approximate if an interrupt lands mid-read, which is
+ * fine for the just-in-time writers this is meant for.
+ */
+static uint32_t ac97_get_position(snd_device_t * device) {
+	ac97_device_t * ac97 = device->device;
+	uint8_t civ = inportb(ac97->nabmbar + AC97_PO_CIV);
+	uint16_t picb = inports(ac97->nabmbar + AC97_PO_PICB);
+	uint16_t len = AC97_CL_GET_LENGTH(ac97->bdl[civ].cl);
+	return ac97->samples_played + (len - picb);
+}
+
 /* Currently we just assume right and left are the same */
 static int ac97_mixer_read(uint32_t knob_id, uint32_t *val) {
 	uint16_t tmp;
@@ -187,6 +231,10 @@ static int ac97_mixer_read(uint32_t knob_id, uint32_t *val) {
 			}
 			break;
 
+		case AC97_KNOB_PERIOD:
+			*val = _device.period_len;
+			break;
+
 		default:
 			return -1;
 	}
@@ -226,6 +274,14 @@ static int ac97_mixer_write(uint32_t knob_id, uint32_t val) {
 			break;
 		}
 
+		case AC97_KNOB_PERIOD: {
+			/* Takes effect as entries are refilled; no need to stop DMA */
+			if (val < AC97_PERIOD_MIN) val = AC97_PERIOD_MIN;
+			if (val > AC97_PERIOD_MAX) val = AC97_PERIOD_MAX;
+			_device.period_len = val & ~0x3; /* Whole stereo frames only */
+			break;
+		}
+
 		default:
 			return -1;
 	}
@@ -251,14 +307,16 @@ static int init(void) {
 	/* Default the PCM output to full volume. */
 	outports(_device.nambar + AC97_PCM_OUT_VOLUME, 0x0000);
 
-	/* Allocate our BDL and our buffers */
+	/* Allocate our BDL and our buffers; each buffer is sized for the
+	 * largest period so the length can be tuned without reallocating. */
+	_device.period_len = AC97_PERIOD_DEFAULT;
 	_device.bdl = (void *)kmalloc_p(AC97_BDL_LEN * sizeof(*_device.bdl), &_device.bdl_p);
 	memset(_device.bdl, 0, AC97_BDL_LEN * sizeof(*_device.bdl));
 	for (int i = 0; i < AC97_BDL_LEN; i++) {
 		_device.bufs[i] = (uint16_t *)kmalloc_p(AC97_BDL_BUFFER_LEN * sizeof(*_device.bufs[0]),
 												&_device.bdl[i].pointer);
 		memset(_device.bufs[i], 0, AC97_BDL_BUFFER_LEN * sizeof(*_device.bufs[0]));
-		AC97_CL_SET_LENGTH(_device.bdl[i].cl, AC97_BDL_BUFFER_LEN);
+		AC97_CL_SET_LENGTH(_device.bdl[i].cl, _device.period_len);
 		/* Set all buffers to interrupt */
 		_device.bdl[i].cl |= AC97_CL_IOC;
 
@@ -25,6 +25,30 @@ static int  cdrom_number = 0;
 static uint32_t ata_pci = 0x00000000;
 static list_t * atapi_waiter;
 static int atapi_in_progress = 0;
+static list_t * ata_waiter;
+static volatile int ata_dma_in_progress = 0;
+
+/*
+ * Elevator request queue. Callers queue block requests and sleep; a
+ * worker tasklet services them in ascending-LBA order (wrapping back
+ * to the lowest outstanding request, C-SCAN style) and merges
+ * contiguous requests into single multi-sector transfers.
+ */
+struct ata_request {
+	struct ata_device * dev;
+	uint64_t lba;
+	unsigned int sectors;
+	uint8_t * buf;
+	int write;
+	volatile int done;
+	list_t * wait;  /* The submitter sleeps here until ->done */
+	node_t node;    /* Entry in ata_queue */
+};
+
+static list_t * ata_queue;
+static list_t * ata_queue_wait; /* The worker sleeps here while the queue is empty */
+static spin_lock_t ata_queue_lock = { 0 };
+static uint64_t ata_elevator_pos = 0;
 
 typedef union {
 	uint8_t command_bytes[12];
@@ -44,6 +68,9 @@ typedef struct {
 	uint16_t last;
 } prdt_t;
 
+/* Pages in the busmaster bounce buffer; one PRD entry each. */
+#define ATA_DMA_PAGES 8
+
 struct ata_device {
 	int io_base;
 	int control;
@@ -52,8 +79,8 @@ struct ata_device {
 	ata_identify_t identity;
 	prdt_t * dma_prdt;
 	uintptr_t dma_prdt_phys;
-	uint8_t * dma_start;
-	uintptr_t dma_start_phys;
+	uint8_t * dma_pages[ATA_DMA_PAGES];
+	uintptr_t dma_pages_phys[ATA_DMA_PAGES];
 	uint32_t bar4;
 	uint32_t atapi_lba;
 	uint32_t atapi_sector_size;
@@ -70,9 +97,19 @@ static spin_lock_t ata_lock = { 0 };
 /* TODO support other sector sizes */
 #define ATA_SECTOR_SIZE 512
 
+/* Largest transfer the bounce buffer can hold in one busmaster command. */
+#define ATA_DMA_MAX_SECTORS (ATA_DMA_PAGES * 0x1000 / ATA_SECTOR_SIZE)
+
+/* CD sectors per READ(12) command packet. */
+#define ATAPI_MAX_SECTORS 32
+
 static void ata_device_read_sector(struct ata_device * dev, uint64_t lba, uint8_t * buf);
+static void ata_device_read_sectors(struct ata_device * dev, uint64_t lba, uint8_t * buf, unsigned int sectors);
 static void ata_device_read_sector_atapi(struct ata_device * dev, uint64_t lba, uint8_t * buf);
+static void ata_device_read_sectors_atapi(struct ata_device * dev, uint64_t lba, uint8_t * buf, unsigned int sectors);
 static void ata_device_write_sector_retry(struct ata_device * dev, uint64_t lba, uint8_t * buf);
+static void ata_device_write_sectors_retry(struct ata_device * dev, uint64_t lba, uint8_t * buf, unsigned int sectors);
+static void ata_queue_io(struct ata_device * dev, uint64_t lba, unsigned int sectors, uint8_t * buf, int write);
 static uint32_t read_ata(fs_node_t *node, uint64_t offset, uint32_t size, uint8_t *buffer);
 static uint32_t write_ata(fs_node_t *node, uint64_t offset, uint32_t size, uint8_t *buffer);
 static void     open_ata(fs_node_t *node, unsigned int flags);
@@ -124,7 +161,7 @@ static uint32_t read_ata(fs_node_t *node, uint64_t offset, uint32_t size, uint8_
 		unsigned int prefix_size = (ATA_SECTOR_SIZE - (offset % ATA_SECTOR_SIZE));
 		if (prefix_size > size) prefix_size = size;
 		char * tmp = malloc(ATA_SECTOR_SIZE);
-		ata_device_read_sector(dev, start_block, (uint8_t *)tmp);
+		ata_queue_io(dev, start_block, 1, (uint8_t *)tmp, 0);
 
 		memcpy(buffer, (void *)((uintptr_t)tmp + ((uintptr_t)offset % ATA_SECTOR_SIZE)), prefix_size);
 
@@ -137,7 +174,7 @@ static uint32_t read_ata(fs_node_t *node, uint64_t offset, uint32_t size, uint8_
 	if ((offset + size)  % ATA_SECTOR_SIZE && start_block <= end_block) {
 		unsigned int postfix_size = (offset + size) % ATA_SECTOR_SIZE;
 		char * tmp = malloc(ATA_SECTOR_SIZE);
-		ata_device_read_sector(dev, end_block, (uint8_t *)tmp);
+		ata_queue_io(dev, end_block, 1, (uint8_t *)tmp, 0);
 
 		memcpy((void *)((uintptr_t)buffer + size - postfix_size), tmp, postfix_size);
 
@@ -147,9 +184,11 @@ static uint32_t read_ata(fs_node_t *node, uint64_t offset, uint32_t size, uint8_
 	}
 
 	while (start_block <= end_block) {
-		ata_device_read_sector(dev, start_block, (uint8_t *)((uintptr_t)buffer + x_offset));
-		x_offset += ATA_SECTOR_SIZE;
-		start_block++;
+		unsigned int sectors = end_block - start_block + 1;
+		if (sectors > ATA_DMA_MAX_SECTORS) sectors = ATA_DMA_MAX_SECTORS;
+		ata_queue_io(dev, start_block, sectors, (uint8_t *)((uintptr_t)buffer + x_offset), 0);
+		x_offset += sectors * ATA_SECTOR_SIZE;
+		start_block += sectors;
 	}
 
 	return size;
@@ -200,9 +239,11 @@ static uint32_t read_atapi(fs_node_t *node, uint64_t offset, uint32_t size, uint
 	}
 
 	while (start_block <= end_block) {
-		ata_device_read_sector_atapi(dev, start_block, (uint8_t *)((uintptr_t)buffer + x_offset));
-		x_offset += dev->atapi_sector_size;
-		start_block++;
+		unsigned int sectors = end_block - start_block + 1;
+		if (sectors > ATAPI_MAX_SECTORS) sectors = ATAPI_MAX_SECTORS;
+		ata_device_read_sectors_atapi(dev, start_block, (uint8_t *)((uintptr_t)buffer + x_offset), sectors);
+		x_offset += sectors * dev->atapi_sector_size;
+		start_block += sectors;
 	}
 
 	return size;
@@ -236,12 +277,12 @@ static uint32_t write_ata(fs_node_t *node, uint64_t offset, uint32_t size, uint8
 		unsigned int prefix_size = (ATA_SECTOR_SIZE - (offset % ATA_SECTOR_SIZE));
 
 		char * tmp = malloc(ATA_SECTOR_SIZE);
-		ata_device_read_sector(dev, start_block, (uint8_t *)tmp);
+		ata_queue_io(dev, start_block, 1, (uint8_t *)tmp, 0);
 
 		debug_print(NOTICE, "Writing first block");
 
 		memcpy((void *)((uintptr_t)tmp + ((uintptr_t)offset % ATA_SECTOR_SIZE)), buffer, prefix_size);
-		ata_device_write_sector_retry(dev, start_block, (uint8_t *)tmp);
+		ata_queue_io(dev, start_block, 1, (uint8_t *)tmp, 1);
 
 		free(tmp);
 		x_offset += prefix_size;
@@ -252,22 +293,24 @@ static uint32_t write_ata(fs_node_t *node, uint64_t offset, uint32_t size, uint8
 		unsigned int postfix_size = (offset + size) % ATA_SECTOR_SIZE;
 
 		char * tmp = malloc(ATA_SECTOR_SIZE);
-		ata_device_read_sector(dev, end_block, (uint8_t *)tmp);
+		ata_queue_io(dev, end_block, 1, (uint8_t *)tmp, 0);
 
 		debug_print(NOTICE, "Writing last block");
 
 		memcpy(tmp, (void *)((uintptr_t)buffer + size - postfix_size), postfix_size);
 
-		ata_device_write_sector_retry(dev, end_block, (uint8_t *)tmp);
+		ata_queue_io(dev, end_block, 1, (uint8_t *)tmp, 1);
 
 		free(tmp);
 		end_block--;
 	}
 
 	while (start_block <= end_block) {
-		ata_device_write_sector_retry(dev, start_block, (uint8_t *)((uintptr_t)buffer + x_offset));
-		x_offset += ATA_SECTOR_SIZE;
-		start_block++;
+		unsigned int sectors = end_block - start_block + 1;
+		if (sectors > ATA_DMA_MAX_SECTORS) sectors = ATA_DMA_MAX_SECTORS;
+		ata_queue_io(dev, start_block, sectors, (uint8_t *)((uintptr_t)buffer + x_offset), 1);
+		x_offset += sectors * ATA_SECTOR_SIZE;
+		start_block += sectors;
 	}
 
 	return size;
@@ -370,6 +413,9 @@ static int ata_irq_handler(struct regs *r) {
 	if (atapi_in_progress) {
 		wakeup_queue(atapi_waiter);
 	}
+	if (ata_dma_in_progress) {
+		wakeup_queue(ata_waiter);
+	}
 	irq_ack(14);
 	return 1;
 }
@@ -379,6 +425,9 @@ static int ata_irq_handler_s(struct regs *r) {
 	if (atapi_in_progress) {
 		wakeup_queue(atapi_waiter);
 	}
+	if (ata_dma_in_progress) {
+		wakeup_queue(ata_waiter);
+	}
 	irq_ack(15);
 	return 1;
 }
@@ -421,15 +470,20 @@ static void ata_device_init(struct ata_device * dev) {
 	debug_print(NOTICE, "Sectors (24): %d", dev->identity.sectors_28);
 
 	debug_print(NOTICE, "Setting up DMA...");
-	dev->dma_prdt  = (void *)kvmalloc_p(sizeof(prdt_t) * 1, &dev->dma_prdt_phys);
-	dev->dma_start = (void *)kvmalloc_p(4096, &dev->dma_start_phys);
+	dev->dma_prdt = (void *)kvmalloc_p(sizeof(prdt_t) * ATA_DMA_PAGES, &dev->dma_prdt_phys);
 
 	debug_print(NOTICE, "Putting prdt    at 0x%x (0x%x phys)", dev->dma_prdt, dev->dma_prdt_phys);
-	debug_print(NOTICE, "Putting prdt[0] at 0x%x (0x%x phys)", dev->dma_start, dev->dma_start_phys);
 
-	dev->dma_prdt[0].offset = dev->dma_start_phys;
-	dev->dma_prdt[0].bytes = 512;
-	dev->dma_prdt[0].last = 0x8000;
+	/* The bounce buffer is built from individual pages, one PRD entry
+	 * each, since the heap doesn't promise physical contiguity. */
+	for (int i = 0; i < ATA_DMA_PAGES; ++i) {
+		dev->dma_pages[i] = (void *)kvmalloc_p(0x1000, &dev->dma_pages_phys[i]);
+		dev->dma_prdt[i].offset = dev->dma_pages_phys[i];
+		dev->dma_prdt[i].bytes = 0x1000;
+		dev->dma_prdt[i].last = (i == ATA_DMA_PAGES - 1) ? 0x8000 : 0;
+	}
+
+	debug_print(NOTICE, "Putting prdt[0] at 0x%x (0x%x phys)", dev->dma_pages[0], dev->dma_pages_phys[0]);
 
 	debug_print(NOTICE, "ATA PCI device ID: 0x%x", ata_pci);
 
@@ -620,11 +674,47 @@ static int ata_device_detect(struct ata_device * dev) {
 	return 0;
 }
 
-static void ata_device_read_sector(struct ata_device * dev, uint64_t lba, uint8_t * buf) {
+/**
+ * Size the PRD table for a transfer of the given sector count.
+ * The bounce buffer pages are fixed; only the byte counts and
+ * the end-of-table marker change between transfers.
+ */
+static void ata_dma_prepare_prdt(struct ata_device * dev, unsigned int sectors) {
+	unsigned int bytes = sectors * ATA_SECTOR_SIZE;
+	for (int i = 0; i < ATA_DMA_PAGES && bytes; ++i) {
+		unsigned int chunk = (bytes > 0x1000) ? 0x1000 : bytes;
+		dev->dma_prdt[i].bytes = chunk;
+		bytes -= chunk;
+		dev->dma_prdt[i].last = bytes ? 0 : 0x8000;
+	}
+}
+
+/**
+ * Block until the busmaster engine reports the transfer finished.
+ * The completion interrupt wakes us; the status checks deal with
+ * wakeups from the other channel's traffic.
+ */
+static void ata_dma_wait_complete(struct ata_device * dev) {
+	IRQ_ON;
+	ata_dma_in_progress = 1;
+	while (1) {
+		int status = inportb(dev->bar4 + 0x02);
+		int dstatus = inportb(dev->io_base + ATA_REG_STATUS);
+		if ((status & 0x04) && !(dstatus & ATA_SR_BSY)) {
+			break;
+		}
+		sleep_on(ata_waiter);
+	}
+	ata_dma_in_progress = 0;
+	IRQ_OFF;
+}
+
+static void ata_device_read_sectors(struct ata_device * dev, uint64_t lba, uint8_t * buf, unsigned int sectors) {
 	uint16_t bus = dev->io_base;
 	uint8_t slave = dev->slave;
 
 	if (dev->is_atapi) return;
+	if (sectors > ATA_DMA_MAX_SECTORS) return;
 
 #if 0
 	debug_print(ERROR, "Request to read sector %8x%8x",
@@ -634,17 +724,13 @@ static void ata_device_read_sector(struct ata_device * dev, uint64_t lba, uint8_
 
 	spin_lock(ata_lock);
 
-#if 0
-	int errors = 0;
-try_again:
-#endif
-
 	ata_wait(dev, 0);
 
 	/* Stop */
 	outportb(dev->bar4, 0x00);
 
 	/* Set the PRDT */
+	ata_dma_prepare_prdt(dev, sectors);
 	outportl(dev->bar4 + 0x04, dev->dma_prdt_phys);
 
 	/* Enable error, irq status */
@@ -658,76 +744,58 @@ try_again:
 		uint8_t status = inportb(dev->io_base + ATA_REG_STATUS);
 		if (!(status & ATA_SR_BSY)) break;
 	}
+	IRQ_OFF;
 
 	outportb(bus + ATA_REG_CONTROL, 0x00);
 	outportb(bus + ATA_REG_HDDEVSEL, 0xe0 | slave << 4);
 	ata_io_wait(dev);
 	outportb(bus + ATA_REG_FEATURES, 0x00);
 
-	outportb(bus + ATA_REG_SECCOUNT0, 0);
+	outportb(bus + ATA_REG_SECCOUNT0, (sectors >> 8) & 0xFF);
 	outportb(bus + ATA_REG_LBA0, (lba & 0xff000000) >> 24);
 	outportb(bus + ATA_REG_LBA1, (lba & 0xff00000000) >> 32);
 	outportb(bus + ATA_REG_LBA2, (lba & 0xff0000000000) >> 40);
 
-	outportb(bus + ATA_REG_SECCOUNT0, 1);
+	outportb(bus + ATA_REG_SECCOUNT0, sectors & 0xFF);
 	outportb(bus + ATA_REG_LBA0, (lba & 0x000000ff) >>  0);
 	outportb(bus + ATA_REG_LBA1, (lba & 0x0000ff00) >>  8);
 	outportb(bus + ATA_REG_LBA2, (lba & 0x00ff0000) >> 16);
 
-	//outportb(bus + ATA_REG_COMMAND, ATA_CMD_READ_PIO);
-#if 1
 	while (1) {
 		uint8_t status = inportb(dev->io_base + ATA_REG_STATUS);
 		if (!(status & ATA_SR_BSY) && (status & ATA_SR_DRDY)) break;
 	}
-#endif
 	outportb(bus + ATA_REG_COMMAND, ATA_CMD_READ_DMA_EXT);
 
 	ata_io_wait(dev);
 
 	outportb(dev->bar4, 0x08 | 0x01);
 
-	while (1) {
-		int status = inportb(dev->bar4 + 0x02);
-		int dstatus = inportb(dev->io_base + ATA_REG_STATUS);
-		if (!(status & 0x04)) {
-			continue;
-		}
-		if (!(dstatus & ATA_SR_BSY)) {
-			break;
-		}
-	}
-	IRQ_OFF;
+	ata_dma_wait_complete(dev);
 
-#if 0
-	if (ata_wait(dev, 1)) {
-		debug_print(WARNING, "Error during ATA read of lba block %d", lba);
-		errors++;
-		if (errors > 4) {
-			debug_print(WARNING, "-- Too many errors trying to read this block. Bailing.");
-			spin_unlock(ata_lock);
-			return;
-		}
-		goto try_again;
+	/* Copy from DMA bounce pages to the output buffer. */
+	unsigned int bytes = sectors * ATA_SECTOR_SIZE;
+	for (int i = 0; i < ATA_DMA_PAGES && bytes; ++i) {
+		unsigned int chunk = (bytes > 0x1000) ? 0x1000 : bytes;
+		memcpy(buf + i * 0x1000, dev->dma_pages[i], chunk);
+		bytes -= chunk;
 	}
-#endif
-
-	/* Copy from DMA buffer to output buffer. */
-	memcpy(buf, dev->dma_start, 512);
 
 	/* Inform device we are done. */
 	outportb(dev->bar4 + 0x2, inportb(dev->bar4 + 0x02) | 0x04 | 0x02);
 
-#if 0
-	int size = 256;
-	inportsm(bus,buf,size);
-	ata_wait(dev, 0);
-	outportb(bus + ATA_REG_CONTROL, 0x02);
-#endif
 	spin_unlock(ata_lock);
 }
 
+static void ata_device_read_sector(struct ata_device * dev, uint64_t lba, uint8_t * buf) {
+	ata_device_read_sectors(dev, lba, buf, 1);
+}
+
 static void ata_device_read_sector_atapi(struct ata_device * dev, uint64_t lba, uint8_t * buf) {
+	ata_device_read_sectors_atapi(dev, lba, buf, 1);
+}
+
+static void ata_device_read_sectors_atapi(struct ata_device * dev, uint64_t lba, uint8_t * buf, unsigned int sectors) {
 
 	if (!dev->is_atapi) return;
 
@@ -737,9 +805,18 @@ static void ata_device_read_sector_atapi(struct ata_device * dev, uint64_t lba,
 	outportb(dev->io_base + ATA_REG_HDDEVSEL, 0xA0 | dev->slave << 4);
 	ata_io_wait(dev);
 
+	/*
+	 * The byte count limit caps how much the device hands over per
+	 * DRQ phase. Advertise up to 30 sectors' worth so a multi-sector
+	 * READ(12) drains in a couple of bursts instead of one interrupt
+	 * per sector.
+	 */
+	unsigned int total = sectors * dev->atapi_sector_size;
+	uint16_t limit = (total > 0xF000) ? 0xF000 : total;
+
 	outportb(bus + ATA_REG_FEATURES, 0x00);
-	outportb(bus + ATA_REG_LBA1, dev->atapi_sector_size & 0xFF);
-	outportb(bus + ATA_REG_LBA2, dev->atapi_sector_size >> 8);
+	outportb(bus + ATA_REG_LBA1, limit & 0xFF);
+	outportb(bus + ATA_REG_LBA2, limit >> 8);
 	outportb(bus + ATA_REG_COMMAND, ATA_CMD_PACKET);
 
 	/* poll */
@@ -759,10 +836,10 @@ static void ata_device_read_sector_atapi(struct ata_device * dev, uint64_t lba,
 	command.command_bytes[3] = (lba >> 0x10) & 0xFF;
 	command.command_bytes[4] = (lba >> 0x08) & 0xFF;
 	command.command_bytes[5] = (lba >> 0x00) & 0xFF;
-	command.command_bytes[6] = 0;
-	command.command_bytes[7] = 0;
-	command.command_bytes[8] = 0; /* bit 0 = PMI (0, last sector) */
-	command.command_bytes[9] = 1; /* control */
+	command.command_bytes[6] = (sectors >> 0x18) & 0xFF;
+	command.command_bytes[7] = (sectors >> 0x10) & 0xFF;
+	command.command_bytes[8] = (sectors >> 0x08) & 0xFF;
+	command.command_bytes[9] = (sectors >> 0x00) & 0xFF;
 	command.command_bytes[10] = 0;
 	command.command_bytes[11] = 0;
 
@@ -770,34 +847,119 @@ static void ata_device_read_sector_atapi(struct ata_device * dev, uint64_t lba,
 		outports(bus, command.command_words[i]);
 	}
 
-	/* Wait */
-	sleep_on(atapi_waiter);
+	/* Drain the data phase one DRQ burst at a time */
+	while (total) {
+		sleep_on(atapi_waiter);
+
+		while (1) {
+			uint8_t status = inportb(dev->io_base + ATA_REG_STATUS);
+			if ((status & ATA_SR_ERR)) goto atapi_error_on_read;
+			if (!(status & ATA_SR_BSY) && (status & ATA_SR_DRQ)) break;
+		}
+
+		uint16_t size_to_read = inportb(bus + ATA_REG_LBA2) << 8;
+		size_to_read = size_to_read | inportb(bus + ATA_REG_LBA1);
+
+		if (size_to_read > total) size_to_read = total;
+
+		inportsm(bus,buf,size_to_read/2);
+		buf += size_to_read;
+		total -= size_to_read;
+	}
 
 	atapi_in_progress = 0;
 
 	while (1) {
 		uint8_t status = inportb(dev->io_base + ATA_REG_STATUS);
 		if ((status & ATA_SR_ERR)) goto atapi_error_on_read_setup;
-		if (!(status & ATA_SR_BSY) && (status & ATA_SR_DRQ)) break;
+		if (!(status & ATA_SR_BSY) && (status & ATA_SR_DRDY)) break;
 	}
 
-	uint16_t size_to_read = inportb(bus + ATA_REG_LBA2) << 8;
-	size_to_read = size_to_read | inportb(bus + ATA_REG_LBA1);
+	spin_unlock(ata_lock);
+	return;
+
+atapi_error_on_read:
+	atapi_in_progress = 0;
+atapi_error_on_read_setup:
+	spin_unlock(ata_lock);
+
+}
 
+static void ata_device_write_sectors(struct ata_device * dev, uint64_t lba, uint8_t * buf, unsigned int sectors) {
+	uint16_t bus = dev->io_base;
+	uint8_t slave = dev->slave;
 
-	inportsm(bus,buf,size_to_read/2);
+	if (sectors > ATA_DMA_MAX_SECTORS) return;
+
+	spin_lock(ata_lock);
+
+	ata_wait(dev, 0);
+
+	/* Copy the payload into the DMA bounce pages. */
+	unsigned int bytes = sectors * ATA_SECTOR_SIZE;
+	for (int i = 0; i < ATA_DMA_PAGES && bytes; ++i) {
+		unsigned int chunk = (bytes > 0x1000) ? 0x1000 : bytes;
+		memcpy(dev->dma_pages[i], buf + i * 0x1000, chunk);
+		bytes -= chunk;
+	}
+
+	/* Stop */
+	outportb(dev->bar4, 0x00);
+
+	/* Set the PRDT */
+	ata_dma_prepare_prdt(dev, sectors);
+	outportl(dev->bar4 + 0x04, dev->dma_prdt_phys);
+
+	/* Enable error, irq status */
+	outportb(dev->bar4 + 0x2, inportb(dev->bar4 + 0x02) | 0x04 | 0x02);
+
+	/* set write (memory -> device: direction bit clear) */
+	outportb(dev->bar4, 0x00);
+
+	IRQ_ON;
+	while (1) {
+		uint8_t status = inportb(dev->io_base + ATA_REG_STATUS);
+		if (!(status & ATA_SR_BSY)) break;
+	}
+	IRQ_OFF;
+
+	outportb(bus + ATA_REG_CONTROL, 0x00);
+	outportb(bus + ATA_REG_HDDEVSEL, 0xe0 | slave << 4);
+	ata_io_wait(dev);
+	outportb(bus + ATA_REG_FEATURES, 0x00);
+
+	outportb(bus + ATA_REG_SECCOUNT0, (sectors >> 8) & 0xFF);
+	outportb(bus + ATA_REG_LBA0, (lba & 0xff000000) >> 24);
+	outportb(bus + ATA_REG_LBA1, (lba & 0xff00000000) >> 32);
+	outportb(bus + ATA_REG_LBA2, (lba & 0xff0000000000) >> 40);
+
+	outportb(bus + ATA_REG_SECCOUNT0, sectors & 0xFF);
+	outportb(bus + ATA_REG_LBA0, (lba & 0x000000ff) >>  0);
+	outportb(bus + ATA_REG_LBA1, (lba & 0x0000ff00) >>  8);
+	outportb(bus + ATA_REG_LBA2, (lba & 0x00ff0000) >> 16);
 
 	while (1) {
 		uint8_t status = inportb(dev->io_base + ATA_REG_STATUS);
-		if ((status & ATA_SR_ERR)) goto atapi_error_on_read_setup;
 		if (!(status & ATA_SR_BSY) && (status & ATA_SR_DRDY)) break;
 	}
+	outportb(bus + ATA_REG_COMMAND, ATA_CMD_WRITE_DMA_EXT);
 
-atapi_error_on_read_setup:
-	spin_unlock(ata_lock);
+	ata_io_wait(dev);
 
+	outportb(dev->bar4, 0x01);
+
+	ata_dma_wait_complete(dev);
+
+	/* Inform device we are done. */
+	outportb(dev->bar4 + 0x2, inportb(dev->bar4 + 0x02) | 0x04 | 0x02);
+
+	outportb(bus + ATA_REG_COMMAND, ATA_CMD_CACHE_FLUSH_EXT);
+	ata_wait(dev, 0);
+
+	spin_unlock(ata_lock);
 }
 
+/* PIO fallback, used when the busmaster interface was not available. */
 static void ata_device_write_sector(struct ata_device * dev, uint64_t lba, uint8_t * buf) {
 	uint16_t bus = dev->io_base;
 	uint8_t slave = dev->slave;
@@ -850,17 +1012,165 @@ static int buffer_compare(uint32_t * ptr1, uint32_t * ptr2, size_t size) {
 	return 0;
 }
 
-static void ata_device_write_sector_retry(struct ata_device * dev, uint64_t lba, uint8_t * buf) {
-	uint64_t sectors = dev->identity.sectors_48;
-	if (lba >= sectors) return;
-	uint8_t * read_buf = malloc(ATA_SECTOR_SIZE);
+static void ata_device_write_sectors_retry(struct ata_device * dev, uint64_t lba, uint8_t * buf, unsigned int sectors) {
+	uint64_t total_sectors = dev->identity.sectors_48;
+	if (lba >= total_sectors) return;
+	if (lba + sectors > total_sectors) {
+		sectors = total_sectors - lba;
+	}
+	uint8_t * read_buf = malloc(sectors * ATA_SECTOR_SIZE);
 	do {
-		ata_device_write_sector(dev, lba, buf);
-		ata_device_read_sector(dev, lba, read_buf);
-	} while (buffer_compare((uint32_t *)buf, (uint32_t *)read_buf, ATA_SECTOR_SIZE));
+		if (dev->bar4) {
+			ata_device_write_sectors(dev, lba, buf, sectors);
+		} else {
+			for (unsigned int i = 0; i < sectors; ++i) {
+				ata_device_write_sector(dev, lba + i, buf + i * ATA_SECTOR_SIZE);
+			}
+		}
+		ata_device_read_sectors(dev, lba, read_buf, sectors);
+	} while (buffer_compare((uint32_t *)buf, (uint32_t *)read_buf, sectors * ATA_SECTOR_SIZE));
 	free(read_buf);
 }
 
+static void ata_device_write_sector_retry(struct ata_device * dev, uint64_t lba, uint8_t * buf) {
+	ata_device_write_sectors_retry(dev, lba, buf, 1);
+}
+
+/**
+ * Submit a block request to the elevator queue and sleep until the
+ * worker has completed it. The request lives on the submitter's stack;
+ * the worker is done with it before the final wakeup.
+ */
+static void ata_queue_io(struct ata_device * dev, uint64_t lba, unsigned int sectors, uint8_t * buf, int write) {
+	struct ata_request req;
+
+	req.dev     = dev;
+	req.lba     = lba;
+	req.sectors = sectors;
+	req.buf     = buf;
+	req.write   = write;
+	req.done    = 0;
+	req.wait    = list_create();
+	req.node.value = &req;
+	req.node.prev  = NULL;
+	req.node.next  = NULL;
+	req.node.owner = NULL;
+
+	spin_lock(ata_queue_lock);
+	list_append(ata_queue, &req.node);
+	spin_unlock(ata_queue_lock);
+
+	wakeup_queue(ata_queue_wait);
+
+	while (!req.done) {
+		sleep_on(req.wait);
+	}
+
+	free(req.wait);
+}
+
+/**
+ * Pick the next request to service: the lowest LBA at or beyond the
+ * last serviced position, wrapping back to the lowest outstanding
+ * request when the sweep reaches the end (C-SCAN).
+ * Called with ata_queue_lock held.
+ */
+static node_t * ata_elevator_pick(void) {
+	node_t * best = NULL;
+	node_t * lowest = NULL;
+	foreach(n, ata_queue) {
+		struct ata_request * r = n->value;
+		if (!lowest || r->lba < ((struct ata_request *)lowest->value)->lba) {
+			lowest = n;
+		}
+		if (r->lba >= ata_elevator_pos) {
+			if (!best || r->lba < ((struct ata_request *)best->value)->lba) {
+				best = n;
+			}
+		}
+	}
+	return best ? best : lowest;
+}
+
+/**
+ * The I/O worker. Sleeps until requests are queued, then services them
+ * in elevator order, folding contiguous same-direction requests into a
+ * single transfer up to the DMA bounce buffer size.
+ */
+static void ata_io_thread(void * arg) {
+	struct ata_request * chain[ATA_DMA_MAX_SECTORS];
+
+	while (1) {
+		spin_lock(ata_queue_lock);
+		node_t * picked = ata_elevator_pick();
+		if (!picked) {
+			spin_unlock(ata_queue_lock);
+			sleep_on(ata_queue_wait);
+			continue;
+		}
+		list_delete(ata_queue, picked);
+
+		struct ata_request * head = picked->value;
+		chain[0] = head;
+		unsigned int count = 1;
+		unsigned int total = head->sectors;
+
+		/* Greedily chain requests that continue exactly where the
+		 * previous one ended. */
+		int found = 1;
+		while (found && total < ATA_DMA_MAX_SECTORS) {
+			found = 0;
+			foreach(n, ata_queue) {
+				struct ata_request * r = n->value;
+				if (r->dev == head->dev && r->write == head->write &&
+					r->lba == chain[count-1]->lba + chain[count-1]->sectors &&
+					total + r->sectors <= ATA_DMA_MAX_SECTORS) {
+					list_delete(ata_queue, n);
+					chain[count++] = r;
+					total += r->sectors;
+					found = 1;
+					break;
+				}
+			}
+		}
+		spin_unlock(ata_queue_lock);
+
+		if (count == 1) {
+			/* Nothing merged; transfer straight to the caller's buffer. */
+			if (head->write) {
+				ata_device_write_sectors_retry(head->dev, head->lba, head->buf, head->sectors);
+			} else {
+				ata_device_read_sectors(head->dev, head->lba, head->buf, head->sectors);
+			}
+		} else {
+			uint8_t * span = malloc(total * ATA_SECTOR_SIZE);
+			if (head->write) {
+				unsigned int off = 0;
+				for (unsigned int i = 0; i < count; ++i) {
+					memcpy(span + off, chain[i]->buf, chain[i]->sectors * ATA_SECTOR_SIZE);
+					off += chain[i]->sectors * ATA_SECTOR_SIZE;
+				}
+				ata_device_write_sectors_retry(head->dev, head->lba, span, total);
+			} else {
+				ata_device_read_sectors(head->dev, head->lba, span, total);
+				unsigned int off = 0;
+				for (unsigned int i = 0; i < count; ++i) {
+					memcpy(chain[i]->buf, span + off, chain[i]->sectors * ATA_SECTOR_SIZE);
+					off += chain[i]->sectors * ATA_SECTOR_SIZE;
+				}
+			}
+			free(span);
+		}
+
+		ata_elevator_pos = head->lba + total;
+
+		for (unsigned int i = 0; i < count; ++i) {
+			chain[i]->done = 1;
+			wakeup_queue(chain[i]->wait);
+		}
+	}
+}
+
 static int ata_initialize(void) {
 	/* Detect drives and mount them */
 
@@ -871,6 +1181,11 @@ static int ata_initialize(void) {
 	irq_install_handler(15, ata_irq_handler_s, "ide slave");
 
 	atapi_waiter = list_create();
+	ata_waiter = list_create();
+
+	ata_queue = list_create();
+	ata_queue_wait = list_create();
+	create_kernel_tasklet(ata_io_thread, "[ataio]", NULL);
 
 	ata_device_detect(&ata_primary_master);
 	ata_device_detect(&ata_primary_slave);
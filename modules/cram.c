@@ -0,0 +1,345 @@
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ * This file is part of ToaruOS and is released under the terms
+ * of the NCSA / University of Illinois License - see LICENSE.md
+ *
+ * Compressed RAM disk.
+ *
+ * /dev/cram0 is a block device whose 4KB blocks are stored
+ * compressed on the kernel heap and only while they hold data:
+ * zero blocks cost nothing, and compressible blocks cost their
+ * compressed size. Formatted with a filesystem and mounted over
+ * /tmp, it stretches small-memory targets by roughly the
+ * compression ratio of whatever lands there.
+ *
+ * The compressor is a small byte-oriented LZ (4-byte minimum
+ * matches against a 64KB window, greedy, one-probe hash table) in
+ * the spirit of what zram uses; deflate's bit-packed huffman
+ * coding costs far more CPU per block than it saves in a RAM disk
+ * whose point is memcpy-class speed. Blocks that do not shrink
+ * are stored raw.
+ */
+
+#include <kernel/system.h>
+#include <kernel/logging.h>
+#include <kernel/fs.h>
+#include <kernel/mem.h>
+#include <kernel/module.h>
+#include <kernel/printf.h>
+
+#define CRAM_BLOCK_SIZE 4096
+#define CRAM_LOGICAL_SIZE (64 * 1024 * 1024)
+#define CRAM_BLOCKS (CRAM_LOGICAL_SIZE / CRAM_BLOCK_SIZE)
+
+#define CRAM_MIN_MATCH 4
+#define CRAM_HASH_BITS 12
+
+/* One logical block; data == NULL means the block has never been
+ * written (or was discarded) and reads as zeros. size equal to
+ * CRAM_BLOCK_SIZE marks a raw, incompressible block. */
+struct cram_block {
+	uint8_t * data;
+	uint16_t size;
+};
+
+static struct cram_block * cram_blocks = NULL;
+static spin_lock_t cram_lock = { 0 };
+
+/* Totals for the stats dump */
+static uint32_t cram_used_blocks = 0;
+static uint32_t cram_stored_bytes = 0;
+static uint32_t cram_raw_blocks = 0;
+
+static uint32_t cram_read32(const uint8_t * p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint32_t cram_hash(uint32_t v) {
+	return (uint32_t)(v * 2654435761U) >> (32 - CRAM_HASH_BITS);
+}
+
+/*
+ * Compress src (always one full block) into dst. Output format is a
+ * series of sequences: a token byte with the literal count in the
+ * high nibble and (match length - 4) in the low nibble, either count
+ * extended with 255-run bytes when it hits 15, then the literals,
+ * then a two byte little-endian match offset. The final sequence has
+ * no match. Returns the compressed size, or 0 if the result would
+ * not be smaller than the input.
+ */
+static size_t cram_compress(const uint8_t * src, size_t src_len, uint8_t * dst, size_t dst_max) {
+	uint16_t table[1 << CRAM_HASH_BITS];
+	memset(table, 0xFF, sizeof(table));
+
+	size_t in = 0, out = 0, anchor = 0;
+
+	while (in + CRAM_MIN_MATCH < src_len) {
+		uint32_t h = cram_hash(cram_read32(src + in));
+		size_t cand = table[h];
+		table[h] = in;
+
+		if (cand != 0xFFFF && cand < in && cram_read32(src + cand) == cram_read32(src + in)) {
+			/* Extend the match */
+			size_t len = CRAM_MIN_MATCH;
+			while (in + len < src_len && src[cand + len] == src[in + len]) len++;
+
+			size_t lit = in - anchor;
+			size_t mat = len - CRAM_MIN_MATCH;
+
+			/* Worst case for this sequence: token, both length runs,
+			 * the literals, and the offset. */
+			if (out + 1 + lit / 255 + mat / 255 + lit + 4 >= dst_max) return 0;
+
+			dst[out++] = ((lit < 15 ? lit : 15) << 4) | (mat < 15 ? mat : 15);
+			if (lit >= 15) {
+				size_t rest = lit - 15;
+				while (rest >= 255) { dst[out++] = 255; rest -= 255; }
+				dst[out++] = rest;
+			}
+			memcpy(dst + out, src + anchor, lit);
+			out += lit;
+			dst[out++] = (in - cand) & 0xFF;
+			dst[out++] = ((in - cand) >> 8) & 0xFF;
+			if (mat >= 15) {
+				size_t rest = mat - 15;
+				while (rest >= 255) { dst[out++] = 255; rest -= 255; }
+				dst[out++] = rest;
+			}
+
+			in += len;
+			anchor = in;
+		} else {
+			in++;
+		}
+	}
+
+	/* Trailing literals, in a matchless final sequence */
+	size_t lit = src_len - anchor;
+	if (out + 1 + lit / 255 + lit >= dst_max) return 0;
+	dst[out++] = (lit < 15 ? lit : 15) << 4;
+	if (lit >= 15) {
+		size_t rest = lit - 15;
+		while (rest >= 255) { dst[out++] = 255; rest -= 255; }
+		dst[out++] = rest;
+	}
+	memcpy(dst + out, src + anchor, lit);
+	out += lit;
+
+	return out;
+}
+
+static void cram_decompress(const uint8_t * src, size_t src_len, uint8_t * dst) {
+	size_t in = 0, out = 0;
+
+	while (in < src_len) {
+		uint8_t token = src[in++];
+
+		size_t lit = token >> 4;
+		if (lit == 15) {
+			uint8_t b;
+			do { b = src[in++]; lit += b; } while (b == 255);
+		}
+		memcpy(dst + out, src + in, lit);
+		in += lit;
+		out += lit;
+
+		if (in >= src_len) break; /* Final sequence carries no match */
+
+		size_t offset = src[in] | (src[in+1] << 8);
+		in += 2;
+
+		size_t mat = (token & 0xF) + CRAM_MIN_MATCH;
+		if ((token & 0xF) == 15) {
+			uint8_t b;
+			do { b = src[in++]; mat += b; } while (b == 255);
+		}
+
+		/* Overlapping copies replicate the window byte-by-byte */
+		uint8_t * d = dst + out;
+		const uint8_t * s = d - offset;
+		for (size_t i = 0; i < mat; ++i) d[i] = s[i];
+		out += mat;
+	}
+}
+
+static int cram_block_is_zero(const uint8_t * data) {
+	const uint32_t * p = (const uint32_t *)data;
+	for (size_t i = 0; i < CRAM_BLOCK_SIZE / sizeof(uint32_t); ++i) {
+		if (p[i]) return 0;
+	}
+	return 1;
+}
+
+/* Expand block b into out (a full block's worth of space). */
+static void cram_block_fetch(uint32_t b, uint8_t * out) {
+	struct cram_block * blk = &cram_blocks[b];
+	if (!blk->data) {
+		memset(out, 0, CRAM_BLOCK_SIZE);
+	} else if (blk->size == CRAM_BLOCK_SIZE) {
+		memcpy(out, blk->data, CRAM_BLOCK_SIZE);
+	} else {
+		cram_decompress(blk->data, blk->size, out);
+	}
+}
+
+/* Compress and store a full block's worth of new contents for b. */
+static void cram_block_store(uint32_t b, const uint8_t * data) {
+	struct cram_block * blk = &cram_blocks[b];
+
+	if (blk->data) {
+		cram_used_blocks--;
+		cram_stored_bytes -= blk->size;
+		if (blk->size == CRAM_BLOCK_SIZE) cram_raw_blocks--;
+		free(blk->data);
+		blk->data = NULL;
+		blk->size = 0;
+	}
+
+	if (cram_block_is_zero(data)) return;
+
+	uint8_t tmp[CRAM_BLOCK_SIZE];
+	size_t size = cram_compress(data, CRAM_BLOCK_SIZE, tmp, CRAM_BLOCK_SIZE);
+
+	if (size) {
+		blk->data = malloc(size);
+		memcpy(blk->data, tmp, size);
+		blk->size = size;
+	} else {
+		blk->data = malloc(CRAM_BLOCK_SIZE);
+		memcpy(blk->data, data, CRAM_BLOCK_SIZE);
+		blk->size = CRAM_BLOCK_SIZE;
+		cram_raw_blocks++;
+	}
+	cram_used_blocks++;
+	cram_stored_bytes += blk->size;
+}
+
+static uint32_t read_cram(fs_node_t * node, uint64_t offset, uint32_t size, uint8_t * buffer) {
+	if (offset > node->length) return 0;
+	if (offset + size > node->length) {
+		size = node->length - offset;
+	}
+
+	uint8_t tmp[CRAM_BLOCK_SIZE];
+	uint32_t have = 0;
+
+	spin_lock(cram_lock);
+	while (have < size) {
+		uint32_t b = (offset + have) / CRAM_BLOCK_SIZE;
+		uint32_t off = (offset + have) % CRAM_BLOCK_SIZE;
+		uint32_t chunk = CRAM_BLOCK_SIZE - off;
+		if (chunk > size - have) chunk = size - have;
+
+		cram_block_fetch(b, tmp);
+		memcpy(buffer + have, tmp + off, chunk);
+		have += chunk;
+	}
+	spin_unlock(cram_lock);
+
+	return size;
+}
+
+static uint32_t write_cram(fs_node_t * node, uint64_t offset, uint32_t size, uint8_t * buffer) {
+	if (offset > node->length) return 0;
+	if (offset + size > node->length) {
+		size = node->length - offset;
+	}
+
+	uint8_t tmp[CRAM_BLOCK_SIZE];
+	uint32_t have = 0;
+
+	spin_lock(cram_lock);
+	while (have < size) {
+		uint32_t b = (offset + have) / CRAM_BLOCK_SIZE;
+		uint32_t off = (offset + have) % CRAM_BLOCK_SIZE;
+		uint32_t chunk = CRAM_BLOCK_SIZE - off;
+		if (chunk > size - have) chunk = size - have;
+
+		if (chunk == CRAM_BLOCK_SIZE) {
+			cram_block_store(b, buffer + have);
+		} else {
+			/* Partial block: read-modify-write */
+			cram_block_fetch(b, tmp);
+			memcpy(tmp + off, buffer + have, chunk);
+			cram_block_store(b, tmp);
+		}
+		have += chunk;
+	}
+	spin_unlock(cram_lock);
+
+	return size;
+}
+
+static void open_cram(fs_node_t * node, unsigned int flags) {
+	return;
+}
+
+static void close_cram(fs_node_t * node) {
+	return;
+}
+
+static int ioctl_cram(fs_node_t * node, int request, void * argp) {
+	switch (request) {
+		case 0x4001:
+			/* Discard everything, same request the ramdisk honors */
+			if (current_process->user != 0) {
+				return -EPERM;
+			}
+			spin_lock(cram_lock);
+			for (uint32_t i = 0; i < CRAM_BLOCKS; ++i) {
+				if (cram_blocks[i].data) {
+					free(cram_blocks[i].data);
+					cram_blocks[i].data = NULL;
+					cram_blocks[i].size = 0;
+				}
+			}
+			cram_used_blocks = 0;
+			cram_stored_bytes = 0;
+			cram_raw_blocks = 0;
+			spin_unlock(cram_lock);
+			return 0;
+		default:
+			return -EINVAL;
+	}
+}
+
+/* For the debug shell's `call` command. */
+void cram_stats_dump(fs_node_t * tty) {
+	char tmp[256];
+	sprintf(tmp, "cram0: %d of %d blocks used, %d kB stored for %d kB of data, %d raw\n",
+			(int)cram_used_blocks, CRAM_BLOCKS,
+			(int)(cram_stored_bytes / 1024),
+			(int)(cram_used_blocks * (CRAM_BLOCK_SIZE / 1024)),
+			(int)cram_raw_blocks);
+	write_fs(tty, 0, strlen(tmp), (uint8_t *)tmp);
+}
+
+static fs_node_t * cram_device_create(void) {
+	fs_node_t * fnode = malloc(sizeof(fs_node_t));
+	memset(fnode, 0x00, sizeof(fs_node_t));
+	strcpy(fnode->name, "cram0");
+	fnode->uid = 0;
+	fnode->gid = 0;
+	fnode->mask    = 0660;
+	fnode->length  = CRAM_LOGICAL_SIZE;
+	fnode->flags   = FS_BLOCKDEVICE;
+	fnode->read    = read_cram;
+	fnode->write   = write_cram;
+	fnode->open    = open_cram;
+	fnode->close   = close_cram;
+	fnode->ioctl   = ioctl_cram;
+	return fnode;
+}
+
+static int cram_initialize(void) {
+	cram_blocks = malloc(sizeof(struct cram_block) * CRAM_BLOCKS);
+	memset(cram_blocks, 0, sizeof(struct cram_block) * CRAM_BLOCKS);
+	vfs_mount("/dev/cram0", cram_device_create());
+	debug_print(NOTICE, "Compressed RAM disk mounted at /dev/cram0 (%d MB logical)", CRAM_LOGICAL_SIZE / (1024 * 1024));
+	return 0;
+}
+
+static int cram_finalize(void) {
+	return 0;
+}
+
+MODULE_DEF(cram, cram_initialize, cram_finalize);
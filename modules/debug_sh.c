@@ -419,6 +419,25 @@ static int shell_modules(fs_node_t * tty, int argc, char * argv[]) {
 	return 0;
 }
 
+static int shell_syscall_stats(fs_node_t * tty, int argc, char * argv[]) {
+	if (argc < 2) {
+		fprintf(tty, "syscall_stats [on|off|reset] (currently %s)\n", syscall_stats_enabled ? "on" : "off");
+		return 1;
+	}
+	if (!strcmp(argv[1], "on")) {
+		syscall_stats_reset();
+		syscall_stats_enabled = 1;
+	} else if (!strcmp(argv[1], "off")) {
+		syscall_stats_enabled = 0;
+	} else if (!strcmp(argv[1], "reset")) {
+		syscall_stats_reset();
+	} else {
+		fprintf(tty, "%s: expected on, off, or reset\n", argv[0]);
+		return 1;
+	}
+	return 0;
+}
+
 static int shell_rdtsc(fs_node_t * tty, int argc, char * argv[]) {
 	uint64_t x;
 	asm volatile ("rdtsc" : "=A" (x));
@@ -575,6 +594,57 @@ static int shell_set(fs_node_t * tty, int argc, char * argv[]) {
 	return 0;
 }
 
+static int shell_sched(fs_node_t * tty, int argc, char * argv[]) {
+	fprintf(tty, "run queues:");
+	for (int i = 0; i < PROCESS_PRIORITY_LEVELS; ++i) {
+		fprintf(tty, " %d:%d", i, run_queues[i] ? (int)run_queues[i]->length : 0);
+	}
+	fprintf(tty, "\n");
+	fprintf(tty, "  PID S PRI     UTIME     STIME  SWITCHES    FAULTS NAME\n");
+	foreach(node, process_list) {
+		process_t * proc = node->value;
+		char state = proc->finished ? 'Z' :
+			(proc->suspended ? 'T' :
+				(process_is_ready(proc) ? 'R' : 'S'));
+		fprintf(tty, "%5d %c   %d %9d %9d %9d %9d %s\n",
+				proc->id, state, proc->priority,
+				(int)proc->usage_user, (int)proc->usage_kernel,
+				(int)proc->ctx_switches, (int)proc->page_faults,
+				proc->name);
+	}
+	return 0;
+}
+
+static int shell_locks(fs_node_t * tty, int argc, char * argv[]) {
+	char * buf = malloc(4096);
+	size_t len = spin_debug_dump(buf);
+	write_fs(tty, 0, len, (uint8_t *)buf);
+	free(buf);
+	return 0;
+}
+
+/*
+ * Run a stats dump exported by another module, found through the
+ * module symbol table so we don't grow a hard dependency on it.
+ */
+static int shell_module_dump(fs_node_t * tty, char * symbol, char * what) {
+	void (*dump)(fs_node_t *) = (void (*)(fs_node_t *))(uintptr_t)hashmap_get(modules_get_symbols(), symbol);
+	if (!dump) {
+		fprintf(tty, "%s is not loaded\n", what);
+		return 1;
+	}
+	dump(tty);
+	return 0;
+}
+
+static int shell_ext2_cache(fs_node_t * tty, int argc, char * argv[]) {
+	return shell_module_dump(tty, "ext2_cache_stats_dump", "ext2 module");
+}
+
+static int shell_net_sockets(fs_node_t * tty, int argc, char * argv[]) {
+	return shell_module_dump(tty, "net_socket_stats_dump", "network stack");
+}
+
 static int shell_coax_irq(fs_node_t * tty, int argc, char * argv[]) {
 	if (argc < 2) {
 		fprintf(tty, "coax-irq IRQ\n");
@@ -627,6 +697,8 @@ static struct shell_command shell_commands[] = {
 		"Mount a filesystemp."},
 	{"rdtsc", &shell_rdtsc,
 		"Read the TSC, if available."},
+	{"syscall_stats", &shell_syscall_stats,
+		"Toggle syscall latency accounting (read /proc/syscalls)."},
 	{"mhz", &shell_mhz,
 		"Use TSC to determine clock speed."},
 	{"cursor-off", &shell_cursor_off,
@@ -639,6 +711,14 @@ static struct shell_command shell_commands[] = {
 		"set kcmdline flag"},
 	{"coax-irq", &shell_coax_irq,
 		"force ack an irq"},
+	{"sched", &shell_sched,
+		"Print run queue lengths and per-process CPU ticks."},
+	{"locks", &shell_locks,
+		"Print spinlock contention counters."},
+	{"ext2-cache", &shell_ext2_cache,
+		"Print ext2 block/inode cache statistics."},
+	{"net-sockets", &shell_net_sockets,
+		"Print socket buffer levels."},
 	{NULL, NULL, NULL}
 };
 
@@ -27,6 +27,8 @@ static int tx_index = 0;
 static list_t * net_queue = NULL;
 static spin_lock_t net_queue_lock = { 0 };
 static list_t * rx_wait;
+static list_t * tx_wait;
+static spin_lock_t tx_lock = { 0 };
 
 static uint32_t mmio_read32(uintptr_t addr) {
 	return *((volatile uint32_t*)(addr));
@@ -43,6 +45,8 @@ static uint32_t read_command(uint16_t addr) {
 	return mmio_read32(mem_base + addr);
 }
 
+#define E1000_INTS_RX ((1 << 6) | (1 << 7)) /* RXO, RXT0 */
+
 #define E1000_NUM_RX_DESC 32
 #define E1000_NUM_TX_DESC 8
 
@@ -65,20 +69,62 @@ struct tx_desc {
 	volatile uint16_t special;
 } __attribute__((packed));
 
-static uint8_t * rx_virt[E1000_NUM_RX_DESC];
+#define E1000_RX_BUF_SIZE (8192 + 16)
+#define E1000_RX_POOL_MAX 64
+
+static struct netbuf * rx_bufs[E1000_NUM_RX_DESC];
 static uint8_t * tx_virt[E1000_NUM_TX_DESC];
+static uint8_t tx_submitted[E1000_NUM_TX_DESC];
 static struct rx_desc * rx;
 static struct tx_desc * tx;
 static uintptr_t rx_phys;
 static uintptr_t tx_phys;
 
+static list_t * rx_buf_pool;
+static spin_lock_t rx_buf_pool_lock = { 0 };
+
+/*
+ * Received frames travel up to the network stack by reference; when the
+ * stack is done with one it comes back here and rejoins the pool so the
+ * next descriptor swap doesn't have to hit the heap.
+ */
+static void e1000_rx_release(struct netbuf * nb) {
+	spin_lock(rx_buf_pool_lock);
+	if (rx_buf_pool->length < E1000_RX_POOL_MAX) {
+		list_insert(rx_buf_pool, nb);
+		spin_unlock(rx_buf_pool_lock);
+		return;
+	}
+	spin_unlock(rx_buf_pool_lock);
+	free(nb->eth);
+	free(nb);
+}
+
+static struct netbuf * e1000_rx_alloc(void) {
+	spin_lock(rx_buf_pool_lock);
+	node_t * n = list_dequeue(rx_buf_pool);
+	spin_unlock(rx_buf_pool_lock);
+	if (n) {
+		struct netbuf * nb = n->value;
+		free(n);
+		return nb;
+	}
+	struct netbuf * nb = malloc(sizeof(struct netbuf));
+	uint32_t phys = 0;
+	nb->eth = (void*)kvmalloc_p(E1000_RX_BUF_SIZE, &phys);
+	nb->size = 0;
+	nb->release = e1000_rx_release;
+	nb->extra = (void*)phys;
+	return nb;
+}
+
 static void enqueue_packet(void * buffer) {
 	spin_lock(net_queue_lock);
 	list_insert(net_queue, buffer);
 	spin_unlock(net_queue_lock);
 }
 
-static struct ethernet_packet * dequeue_packet(void) {
+static struct netbuf * dequeue_packet(void) {
 	while (!net_queue->length) {
 		sleep_on(rx_wait);
 	}
@@ -222,6 +268,47 @@ static void read_mac(void) {
 	}
 }
 
+/**
+ * Drain up to `budget` received frames from the ring. Runs from the
+ * [netpoll] tasklet with the RX interrupt masked; returning a full
+ * budget tells the poller to come back for another pass.
+ */
+static int e1000_poll(int budget) {
+	int handled = 0;
+
+	while (handled < budget) {
+		rx_index = read_command(E1000_REG_RXDESCTAIL);
+		if (rx_index == (int)read_command(E1000_REG_RXDESCHEAD)) break;
+		rx_index = (rx_index + 1) % E1000_NUM_RX_DESC;
+		if (!(rx[rx_index].status & 0x01)) break;
+
+		/* Swap a fresh buffer into the descriptor and hand the
+		 * full one up the stack without copying it. */
+		struct netbuf * full = rx_bufs[rx_index];
+		full->size = rx[rx_index].length;
+
+		struct netbuf * fresh = e1000_rx_alloc();
+		rx_bufs[rx_index] = fresh;
+		rx[rx_index].addr = (uint64_t)(uintptr_t)fresh->extra;
+		rx[rx_index].status = 0;
+
+		enqueue_packet(full);
+
+		write_command(E1000_REG_RXDESCTAIL, rx_index);
+		handled++;
+	}
+
+	if (handled) {
+		wakeup_queue(rx_wait);
+	}
+
+	return handled;
+}
+
+static void e1000_irq_enable(void) {
+	write_command(0x00D0, E1000_INTS_RX);
+}
+
 static int irq_handler(struct regs *r) {
 
 	uint32_t status = read_command(0xc0);
@@ -232,50 +319,64 @@ static int irq_handler(struct regs *r) {
 
 	irq_ack(e1000_irq);
 
+	if (status & ((1 << 0) | (1 << 1))) {
+		/* TXDW/TXQE: descriptors came back; wake writers waiting on
+		 * ring space. */
+		wakeup_queue(tx_wait);
+	}
+
 	if (status & 0x04) {
 		/* Start link */
 		debug_print(E1000_LOG_LEVEL, "start link");
 	} else if (status & 0x10) {
 		/* ?? */
-	} else if (status & ((1 << 6) | (1 << 7))) {
-		/* receive packet */
-		do {
-			rx_index = read_command(E1000_REG_RXDESCTAIL);
-			if (rx_index == (int)read_command(E1000_REG_RXDESCHEAD)) return 1;
-			rx_index = (rx_index + 1) % E1000_NUM_RX_DESC;
-			if (rx[rx_index].status & 0x01) {
-				uint8_t * pbuf = (uint8_t *)rx_virt[rx_index];
-				uint16_t  plen = rx[rx_index].length;
-
-				void * packet = malloc(plen);
-				memcpy(packet, pbuf, plen);
-
-				rx[rx_index].status = 0;
-
-				enqueue_packet(packet);
-
-				write_command(E1000_REG_RXDESCTAIL, rx_index);
-			} else {
-				break;
-			}
-		} while (1);
-		wakeup_queue(rx_wait);
+	} else if (status & E1000_INTS_RX) {
+		/* Receive: mask further RX interrupts and let the polling
+		 * tasklet drain the ring. */
+		write_command(0x00D8, E1000_INTS_RX);
+		net_poll_schedule();
 	}
 
 	return 1;
 }
 
-static void send_packet(uint8_t* payload, size_t payload_size) {
+/**
+ * Scatter-gather transmit: each fragment gets its own descriptor, with
+ * End-of-Packet only on the last, so the stack can hand us a header
+ * and a payload without coalescing them first. Descriptors are
+ * reclaimed by Descriptor Done status; if the ring is full we sleep
+ * until the TX interrupt reports completions.
+ */
+static void send_frags(struct netif_frag * frags, int count) {
+	spin_lock(tx_lock);
 	tx_index = read_command(E1000_REG_TXDESCTAIL);
-	debug_print(E1000_LOG_LEVEL,"sending packet 0x%x, %d desc[%d]", payload, payload_size, tx_index);
 
-	memcpy(tx_virt[tx_index], payload, payload_size);
-	tx[tx_index].length = payload_size;
-	tx[tx_index].cmd = CMD_EOP | CMD_IFCS | CMD_RS; //| CMD_RPS;
-	tx[tx_index].status = 0;
+	for (int i = 0; i < count; ++i) {
+		/* Wait for this descriptor to come back from the hardware. */
+		while (tx_submitted[tx_index] && !(tx[tx_index].status & 0x01)) {
+			spin_unlock(tx_lock);
+			sleep_on(tx_wait);
+			spin_lock(tx_lock);
+		}
+
+		debug_print(E1000_LOG_LEVEL,"sending frag 0x%x, %d desc[%d]", frags[i].buf, frags[i].len, tx_index);
+
+		memcpy(tx_virt[tx_index], frags[i].buf, frags[i].len);
+		tx[tx_index].length = frags[i].len;
+		tx[tx_index].cmd = CMD_IFCS | CMD_RS | ((i == count - 1) ? CMD_EOP : 0);
+		tx[tx_index].status = 0;
+		tx_submitted[tx_index] = 1;
+
+		tx_index = (tx_index + 1) % E1000_NUM_TX_DESC;
+	}
 
-	tx_index = (tx_index + 1) % E1000_NUM_TX_DESC;
 	write_command(E1000_REG_TXDESCTAIL, tx_index);
+	spin_unlock(tx_lock);
+}
+
+static void send_packet(uint8_t* payload, size_t payload_size) {
+	struct netif_frag frag = { payload, payload_size };
+	send_frags(&frag, 1);
 }
 
 static void init_rx(void) {
@@ -391,6 +492,7 @@ static void e1000_init(void * data, char * name) {
 
 	net_queue = list_create();
 	rx_wait = list_create();
+	tx_wait = list_create();
 
 	e1000_irq = pci_get_interrupt(e1000_device_pci);
 
@@ -431,6 +533,8 @@ static void e1000_init(void * data, char * name) {
 	debug_print(E1000_LOG_LEVEL,"e1000 done. has_eeprom = %d, link is up = %d, irq=%d", has_eeprom, link_is_up, e1000_irq);
 
 	init_netif_funcs(get_mac, dequeue_packet, send_packet, "Intel E1000");
+	net_poll_install(e1000_poll, e1000_irq_enable);
+	net_install_sendv(send_frags);
 }
 
 static int init(void) {
@@ -451,9 +555,12 @@ static int init(void) {
 
 	rx = (void*)kvmalloc_p(sizeof(struct rx_desc) * E1000_NUM_RX_DESC + 16, &rx_phys);
 
+	rx_buf_pool = list_create();
+
 	for (int i = 0; i < E1000_NUM_RX_DESC; ++i) {
-		rx_virt[i] = (void*)kvmalloc_p(8192 + 16, (uint32_t *)&rx[i].addr);
-		debug_print(E1000_LOG_LEVEL, "rx[%d] 0x%x → 0x%x", i, rx_virt[i], (uint32_t)rx[i].addr);
+		rx_bufs[i] = e1000_rx_alloc();
+		rx[i].addr = (uint64_t)(uintptr_t)rx_bufs[i]->extra;
+		debug_print(E1000_LOG_LEVEL, "rx[%d] 0x%x → 0x%x", i, rx_bufs[i]->eth, (uint32_t)rx[i].addr);
 		rx[i].status = 0;
 	}
 
@@ -13,6 +13,9 @@
 #include <kernel/printf.h>
 #include <kernel/tokenize.h>
 
+#include <toaru/list.h>
+#include <toaru/hashmap.h>
+
 #define EXT2_BGD_BLOCK 2
 
 #define E_SUCCESS   0
@@ -41,6 +44,26 @@ typedef struct {
 	ext2_disk_cache_entry_t * disk_cache;          /* Dynamically allocated array of cache entries */
 	unsigned int              cache_entries;       /* Size of ->disk_cache */
 	unsigned int              cache_time;          /* "timer" that increments with each cache read/write */
+	hashmap_t               * cache_map;           /* block_no -> cache index + 1, O(1) hit lookup */
+	list_t                  * cache_lru;           /* Entry recency; head is the eviction candidate */
+	node_t                  * cache_lru_nodes;     /* One list node per cache entry, indexed alongside ->disk_cache */
+	unsigned int            * flush_queue;         /* Scratch space for the flusher thread's sorted batches */
+
+	hashmap_t               * inode_cache;         /* inode_no -> refcounted inode entry */
+	list_t                  * icache_unused;       /* Zero-reference entries, oldest first */
+	spin_lock_t               icache_lock;         /* Protects ->inode_cache and ->icache_unused */
+
+	uint8_t                ** bitmap_cache;        /* Per-group block bitmaps, loaded on first allocation */
+	spin_lock_t               balloc_lock;         /* Serializes block allocation */
+
+	hashmap_t               * dir_index;           /* dir inode_no -> name index */
+	list_t                  * dirindex_lru;        /* Index recency; head is the eviction candidate */
+	spin_lock_t               dindex_lock;         /* Protects ->dir_index and all index contents */
+
+	list_t                  * readahead_wait;      /* The read-ahead thread sleeps here between requests */
+	uint32_t                  readahead_inode;     /* Pending read-ahead request: inode number (0 = no request) */
+	uint32_t                  readahead_start;     /* Pending read-ahead request: first inode block */
+	uint32_t                  readahead_count;     /* Pending read-ahead request: number of blocks */
 
 	spin_lock_t               lock;                /* Synchronization lock point */
 
@@ -55,6 +78,45 @@ typedef struct {
 
 #define EXT2_FLAG_NOCACHE 0x0001
 
+#define EXT2_FLUSH_INTERVAL 2 /* Seconds between flusher thread passes */
+#define EXT2_FLUSH_MIN_AGE  1 /* Seconds a block stays dirty before write-back, to coalesce rewrites */
+
+#define EXT2_READAHEAD_BLOCKS 16 /* How many blocks to prefetch ahead of a sequential reader */
+
+#define EXT2_ICACHE_MAX_UNUSED 128 /* Zero-reference inodes kept around for re-stats */
+
+/*
+ * Inode cache entry. The inode data is inline and variably sized
+ * (this->inode_size bytes, of which ext2_inodetable_t is only the
+ * beginning), so it has to be the last member; an entry is recovered
+ * from an inode pointer by backing up over the header.
+ */
+typedef struct {
+	uint32_t inode_no;
+	int      refs;
+	node_t   lru_node; /* On ->icache_unused while refs == 0 */
+	ext2_inodetable_t inode;
+} ext2_icache_entry_t;
+
+#define icache_header_size ((uintptr_t)&(((ext2_icache_entry_t *)0)->inode))
+#define icache_entry_from_inode(i) ((ext2_icache_entry_t *)((uintptr_t)(i) - icache_header_size))
+
+#define EXT2_DIRINDEX_MAX 32 /* Directories with in-memory name indexes */
+
+/*
+ * Per-directory name index: maps entry names to inode numbers so
+ * lookups in big directories skip the linear block scan. Built as a
+ * side effect of the first full scan in finddir and kept coherent by
+ * create_entry and unlink; `complete` stays 0 until the building scan
+ * finishes, since a partial index can't answer negative lookups.
+ */
+typedef struct {
+	uint32_t    inode_no;
+	int         complete;
+	hashmap_t * names;    /* entry name -> inode number */
+	node_t      lru_node;
+} ext2_dirindex_t;
+
 /*
  * These macros were used in the original toaru ext2 driver.
  * They make referring to some of the core parts of the drive a bit easier.
@@ -72,13 +134,29 @@ typedef struct {
 #define BLOCKBYTE(n) (bg_buffer[((n) >> 3)])
 #define SETBIT(n)    (1 << (((n) % 8)))
 
+/*
+ * Cache counters, aggregated across mounted instances. Exported (and
+ * not static) so the debug shell's ext2-cache command can find them
+ * and ext2_cache_stats_dump through the module symbol table.
+ */
+unsigned long ext2_cache_hits = 0;
+unsigned long ext2_cache_misses = 0;
+unsigned long ext2_cache_evictions = 0;
+unsigned long ext2_icache_hits = 0;
+unsigned long ext2_icache_misses = 0;
+
+/* Mounted instances, for per-mount occupancy in the stats dump */
+static list_t * ext2_instances = NULL;
+
 static uint32_t node_from_file(ext2_fs_t * this, ext2_inodetable_t *inode, ext2_dir_t *direntry,  fs_node_t *fnode);
 static uint32_t ext2_root(ext2_fs_t * this, ext2_inodetable_t *inode, fs_node_t *fnode);
 static ext2_inodetable_t * read_inode(ext2_fs_t * this, uint32_t inode);
+static void put_inode(ext2_fs_t * this, ext2_inodetable_t * inode);
 static void refresh_inode(ext2_fs_t * this, ext2_inodetable_t * inodet,  uint32_t inode);
 static int write_inode(ext2_fs_t * this, ext2_inodetable_t *inode, uint32_t index);
 static fs_node_t * finddir_ext2(fs_node_t *node, char *name);
-static unsigned int allocate_block(ext2_fs_t * this);
+static unsigned int allocate_block(ext2_fs_t * this, unsigned int goal);
+static int cache_flush_dirty(ext2_fs_t * this, unsigned int ent_no);
 
 /**
  * ext2->get_cache_time Increment and return the current cache time
@@ -89,6 +167,60 @@ static unsigned int get_cache_time(ext2_fs_t * this) {
 	return this->cache_time++;
 }
 
+
+/**
+ * ext2->cache_lookup Find a block in the cache map.
+ *
+ * Must be called with the filesystem lock held.
+ *
+ * @param block_no Block to look for
+ * @returns Cache index, or (unsigned int)-1 on a miss
+ */
+static unsigned int cache_lookup(ext2_fs_t * this, unsigned int block_no) {
+	uintptr_t idx = (uintptr_t)hashmap_get(this->cache_map, (void *)(uintptr_t)block_no);
+	if (!idx) return (unsigned int)-1;
+	return idx - 1;
+}
+
+/**
+ * ext2->cache_touch Mark a cache entry as most recently used.
+ */
+static void cache_touch(ext2_fs_t * this, unsigned int ent_no) {
+	list_delete(this->cache_lru, &this->cache_lru_nodes[ent_no]);
+	list_append(this->cache_lru, &this->cache_lru_nodes[ent_no]);
+}
+
+/**
+ * ext2->cache_evict_oldest Make room in the cache.
+ *
+ * Takes the least recently used entry off the recency list,
+ * flushes it if it was dirty, and unmaps its old block.
+ * The caller refills it and must then call cache_assign.
+ *
+ * @returns The index of the reclaimed entry
+ */
+static unsigned int cache_evict_oldest(ext2_fs_t * this) {
+	node_t * lru = list_dequeue(this->cache_lru);
+	unsigned int ent_no = (uintptr_t)lru->value;
+	if (DC[ent_no].block_no) {
+		ext2_cache_evictions++;
+		hashmap_remove(this->cache_map, (void *)(uintptr_t)DC[ent_no].block_no);
+	}
+	if (DC[ent_no].dirty) {
+		cache_flush_dirty(this, ent_no);
+	}
+	return ent_no;
+}
+
+/**
+ * ext2->cache_assign Bind a reclaimed entry to a new block.
+ */
+static void cache_assign(ext2_fs_t * this, unsigned int ent_no, unsigned int block_no) {
+	DC[ent_no].block_no = block_no;
+	hashmap_set(this->cache_map, (void *)(uintptr_t)block_no, (void *)(uintptr_t)(ent_no + 1));
+	list_append(this->cache_lru, &this->cache_lru_nodes[ent_no]);
+}
+
 /**
  * ext2->cache_flush_dirty Flush dirty cache entry to the disk.
  *
@@ -142,39 +274,29 @@ static int read_block(ext2_fs_t * this, unsigned int block_no, uint8_t * buf) {
 		return E_SUCCESS;
 	}
 
-	/*
-	 * Search the cache for this entry
-	 * We'll look for the oldest entry, too.
-	 */
-	int oldest = -1;
-	unsigned int oldest_age = UINT32_MAX;
-	for (unsigned int i = 0; i < this->cache_entries; ++i) {
-		if (DC[i].block_no == block_no) {
-			/* We found it! Update usage times */
-			DC[i].last_use = get_cache_time(this);
-			/* Read the block */
-			memcpy(buf, DC[i].block, this->block_size);
-			/* Release the lock */
-			spin_unlock(this->lock);
-			/* Success! */
-			return E_SUCCESS;
-		}
-		if (DC[i].last_use < oldest_age) {
-			/* We found an older block, remember this. */
-			oldest = i;
-			oldest_age = DC[i].last_use;
-		}
+	/* O(1) lookup in the cache map */
+	unsigned int i = cache_lookup(this, block_no);
+
+	if (i != (unsigned int)-1) {
+		/* We found it! Update usage times */
+		ext2_cache_hits++;
+		DC[i].last_use = get_cache_time(this);
+		cache_touch(this, i);
+		/* Read the block */
+		memcpy(buf, DC[i].block, this->block_size);
+		/* Release the lock */
+		spin_unlock(this->lock);
+		/* Success! */
+		return E_SUCCESS;
 	}
 
 	/*
 	 * At this point, we did not find this block in the cache.
-	 * We are going to replace the oldest entry with this new one.
+	 * Recycle the least recently used entry (flushing it out
+	 * to disk first if it was dirty).
 	 */
-
-	/* We'll start by flushing the block if it was dirty. */
-	if (DC[oldest].dirty) {
-		cache_flush_dirty(this, oldest);
-	}
+	ext2_cache_misses++;
+	unsigned int oldest = cache_evict_oldest(this);
 
 	/* Then we'll read the new one */
 	read_fs(this->block_device, block_no * this->block_size, this->block_size, (uint8_t *)DC[oldest].block);
@@ -183,7 +305,7 @@ static int read_block(ext2_fs_t * this, unsigned int block_no, uint8_t * buf) {
 	memcpy(buf, DC[oldest].block, this->block_size);
 
 	/* And update the cache entry to point to the new block */
-	DC[oldest].block_no = block_no;
+	cache_assign(this, oldest, block_no);
 	DC[oldest].last_use = get_cache_time(this);
 	DC[oldest].dirty = 0;
 
@@ -218,35 +340,31 @@ static int write_block(ext2_fs_t * this, unsigned int block_no, uint8_t *buf) {
 	}
 
 	/* Find the entry in the cache */
-	int oldest = -1;
-	unsigned int oldest_age = UINT32_MAX;
-	for (unsigned int i = 0; i < this->cache_entries; ++i) {
-		if (DC[i].block_no == block_no) {
-			/* We found it. Update the cache entry */
-			DC[i].last_use = get_cache_time(this);
+	unsigned int i = cache_lookup(this, block_no);
+	if (i != (unsigned int)-1) {
+		/* We found it. Update the cache entry */
+		ext2_cache_hits++;
+		DC[i].last_use = get_cache_time(this);
+		cache_touch(this, i);
+		if (!DC[i].dirty) {
 			DC[i].dirty = 1;
-			memcpy(DC[i].block, buf, this->block_size);
-			spin_unlock(this->lock);
-			return E_SUCCESS;
-		}
-		if (DC[i].last_use < oldest_age) {
-			/* Keep track of the oldest entry */
-			oldest = i;
-			oldest_age = DC[i].last_use;
+			DC[i].dirty_since = timer_ticks;
 		}
+		memcpy(DC[i].block, buf, this->block_size);
+		spin_unlock(this->lock);
+		return E_SUCCESS;
 	}
 
 	/* We did not find this element in the cache, so make room. */
-	if (DC[oldest].dirty) {
-		/* Flush the oldest entry */
-		cache_flush_dirty(this, oldest);
-	}
+	ext2_cache_misses++;
+	unsigned int oldest = cache_evict_oldest(this);
 
 	/* Update the entry */
 	memcpy(DC[oldest].block, buf, this->block_size);
-	DC[oldest].block_no = block_no;
+	cache_assign(this, oldest, block_no);
 	DC[oldest].last_use = get_cache_time(this);
 	DC[oldest].dirty = 1;
+	DC[oldest].dirty_since = timer_ticks;
 
 	/* Release the lock */
 	spin_unlock(this->lock);
@@ -274,6 +392,56 @@ static unsigned int ext2_sync(ext2_fs_t * this) {
 	return 0;
 }
 
+/**
+ * ext2->ext2_flush_thread Background write-back of dirty cache entries.
+ *
+ * Wakes up every EXT2_FLUSH_INTERVAL seconds and writes out blocks that
+ * have been dirty for at least EXT2_FLUSH_MIN_AGE seconds, sorted by
+ * block number so the device sees mostly-sequential writes. Entries
+ * dirtied more recently are left alone so that rapid rewrites of the
+ * same block (bitmap and inode table updates, mostly) coalesce into a
+ * single device write. Eviction in cache_evict_oldest still flushes
+ * synchronously, but with this running it should rarely find anything
+ * dirty to flush.
+ */
+static void ext2_flush_thread(void * arg) {
+	ext2_fs_t * this = arg;
+
+	while (1) {
+		unsigned long s, ss;
+		relative_time(EXT2_FLUSH_INTERVAL, 0, &s, &ss);
+		sleep_until((process_t *)current_process, s, ss);
+		switch_task(0);
+
+		spin_lock(this->lock);
+
+		/* Collect entries that have been dirty long enough. */
+		unsigned int count = 0;
+		for (unsigned int i = 0; i < this->cache_entries; ++i) {
+			if (DC[i].dirty && timer_ticks - DC[i].dirty_since >= EXT2_FLUSH_MIN_AGE) {
+				this->flush_queue[count++] = i;
+			}
+		}
+
+		/* Insertion sort the batch by block number. */
+		for (unsigned int i = 1; i < count; ++i) {
+			unsigned int e = this->flush_queue[i];
+			unsigned int j = i;
+			while (j > 0 && DC[this->flush_queue[j-1]].block_no > DC[e].block_no) {
+				this->flush_queue[j] = this->flush_queue[j-1];
+				j--;
+			}
+			this->flush_queue[j] = e;
+		}
+
+		for (unsigned int i = 0; i < count; ++i) {
+			cache_flush_dirty(this, this->flush_queue[i]);
+		}
+
+		spin_unlock(this->lock);
+	}
+}
+
 /**
  * ext2->set_block_number Set the "real" block number for a given "inode" block number.
  *
@@ -297,7 +465,7 @@ static unsigned int set_block_number(ext2_fs_t * this, ext2_inodetable_t * inode
 	} else if (iblock < EXT2_DIRECT_BLOCKS + p) {
 		/* XXX what if inode->block[EXT2_DIRECT_BLOCKS] isn't set? */
 		if (!inode->block[EXT2_DIRECT_BLOCKS]) {
-			unsigned int block_no = allocate_block(this);
+			unsigned int block_no = allocate_block(this, rblock);
 			if (!block_no) return E_NOSPACE;
 			inode->block[EXT2_DIRECT_BLOCKS] = block_no;
 			write_inode(this, inode, inode_no);
@@ -317,7 +485,7 @@ static unsigned int set_block_number(ext2_fs_t * this, ext2_inodetable_t * inode
 		d = b - c * p;
 
 		if (!inode->block[EXT2_DIRECT_BLOCKS+1]) {
-			unsigned int block_no = allocate_block(this);
+			unsigned int block_no = allocate_block(this, rblock);
 			if (!block_no) return E_NOSPACE;
 			inode->block[EXT2_DIRECT_BLOCKS+1] = block_no;
 			write_inode(this, inode, inode_no);
@@ -327,7 +495,7 @@ static unsigned int set_block_number(ext2_fs_t * this, ext2_inodetable_t * inode
 		read_block(this, inode->block[EXT2_DIRECT_BLOCKS + 1], (uint8_t *)tmp);
 
 		if (!((uint32_t *)tmp)[c]) {
-			unsigned int block_no = allocate_block(this);
+			unsigned int block_no = allocate_block(this, rblock);
 			if (!block_no) goto no_space_free;
 			((uint32_t *)tmp)[c] = block_no;
 			write_block(this, inode->block[EXT2_DIRECT_BLOCKS + 1], (uint8_t *)tmp);
@@ -351,7 +519,7 @@ static unsigned int set_block_number(ext2_fs_t * this, ext2_inodetable_t * inode
 		g = e - f * p;
 
 		if (!inode->block[EXT2_DIRECT_BLOCKS+2]) {
-			unsigned int block_no = allocate_block(this);
+			unsigned int block_no = allocate_block(this, rblock);
 			if (!block_no) return E_NOSPACE;
 			inode->block[EXT2_DIRECT_BLOCKS+2] = block_no;
 			write_inode(this, inode, inode_no);
@@ -361,7 +529,7 @@ static unsigned int set_block_number(ext2_fs_t * this, ext2_inodetable_t * inode
 		read_block(this, inode->block[EXT2_DIRECT_BLOCKS + 2], (uint8_t *)tmp);
 
 		if (!((uint32_t *)tmp)[d]) {
-			unsigned int block_no = allocate_block(this);
+			unsigned int block_no = allocate_block(this, rblock);
 			if (!block_no) goto no_space_free;
 			((uint32_t *)tmp)[d] = block_no;
 			write_block(this, inode->block[EXT2_DIRECT_BLOCKS + 2], (uint8_t *)tmp);
@@ -371,7 +539,7 @@ static unsigned int set_block_number(ext2_fs_t * this, ext2_inodetable_t * inode
 		read_block(this, nblock, (uint8_t *)tmp);
 
 		if (!((uint32_t *)tmp)[f]) {
-			unsigned int block_no = allocate_block(this);
+			unsigned int block_no = allocate_block(this, rblock);
 			if (!block_no) goto no_space_free;
 			((uint32_t *)tmp)[f] = block_no;
 			write_block(this, nblock, (uint8_t *)tmp);
@@ -484,35 +652,100 @@ static int write_inode(ext2_fs_t * this, ext2_inodetable_t *inode, uint32_t inde
 	return E_SUCCESS;
 }
 
-static unsigned int allocate_block(ext2_fs_t * this) {
-	unsigned int block_no     = 0;
-	unsigned int block_offset = 0;
-	unsigned int group        = 0;
-	uint8_t * bg_buffer = malloc(this->block_size);
+/**
+ * ext2->get_bitmap Get the cached block bitmap for a group.
+ *
+ * Loaded from disk on first use and kept in memory after that;
+ * updates are pushed back out through write_block, so the regular
+ * flusher batches bitmap writes like any other dirty block.
+ *
+ * Must be called with the allocation lock held.
+ */
+static uint8_t * get_bitmap(ext2_fs_t * this, unsigned int group) {
+	if (!this->bitmap_cache[group]) {
+		this->bitmap_cache[group] = malloc(this->block_size);
+		read_block(this, BGD[group].block_bitmap, this->bitmap_cache[group]);
+	}
+	return this->bitmap_cache[group];
+}
+
+/**
+ * ext2->find_free_in_group Pick a free block out of one group's bitmap.
+ *
+ * `start` is the in-group offset to continue from (0 for don't-care).
+ * If the start bit itself is taken, we look for a fully free byte of
+ * the bitmap first - an eight-block window - before settling for any
+ * free bit, so a sequential writer claims a contiguous run instead of
+ * plugging single-block holes left by deleted files.
+ *
+ * @returns In-group block offset, or -1 if the group is full
+ */
+static int find_free_in_group(ext2_fs_t * this, unsigned int group, unsigned int start) {
+	if (BGD[group].free_blocks_count == 0) return -1;
+
+	unsigned int bits = SB->blocks_per_group;
+	if ((group + 1) * SB->blocks_per_group > SB->blocks_count) {
+		bits = SB->blocks_count - group * SB->blocks_per_group;
+	}
+	if (start >= bits) start = 0;
+
+	uint8_t * bg_buffer = get_bitmap(this, group);
+
+	/* The block right after the last one we allocated keeps the file
+	 * contiguous; take it if it's free. */
+	if (start && !BLOCKBIT(start)) return start;
+
+	/* Otherwise open a fresh window. */
+	for (unsigned int i = start / 8; i < bits / 8; ++i) {
+		if (bg_buffer[i] == 0) return i * 8;
+	}
+
+	/* No window; take whatever is left. */
+	for (unsigned int i = 0; i < bits; ++i) {
+		if (!BLOCKBIT(i)) return i;
+	}
+
+	return -1;
+}
+
+/**
+ * ext2->allocate_block Allocate a block, preferably at or near `goal`.
+ *
+ * @param goal Block number to continue from, or 0 for don't-care
+ * @returns The allocated block number, or 0 if the disk is full
+ */
+static unsigned int allocate_block(ext2_fs_t * this, unsigned int goal) {
+	unsigned int block_no = 0;
+	unsigned int group    = 0;
+
+	spin_lock(this->balloc_lock);
+
+	if (goal >= SB->blocks_count) goal = 0;
+	unsigned int goal_group = goal / SB->blocks_per_group;
 
+	/* Start in the goal's group and wrap around the rest. */
 	for (unsigned int i = 0; i < BGDS; ++i) {
-		if (BGD[i].free_blocks_count > 0) {
-			read_block(this, BGD[i].block_bitmap, (uint8_t *)bg_buffer);
-			while (BLOCKBIT(block_offset)) {
-				++block_offset;
-			}
-			block_no = block_offset + SB->blocks_per_group * i;
-			group = i;
+		unsigned int g = (goal_group + i) % BGDS;
+		unsigned int start = (i == 0) ? goal % SB->blocks_per_group : 0;
+		int offset = find_free_in_group(this, g, start);
+		if (offset >= 0) {
+			uint8_t * bg_buffer = get_bitmap(this, g);
+			BLOCKBYTE(offset) |= SETBIT(offset);
+			write_block(this, BGD[g].block_bitmap, bg_buffer);
+			block_no = offset + SB->blocks_per_group * g;
+			group = g;
 			break;
 		}
 	}
 
 	if (!block_no) {
 		debug_print(CRITICAL, "No available blocks, disk is out of space!");
-		free(bg_buffer);
+		spin_unlock(this->balloc_lock);
 		return 0;
 	}
 
 	debug_print(WARNING, "allocating block #%d (group %d)", block_no, group);
 
-	BLOCKBYTE(block_offset) |= SETBIT(block_offset);
-	write_block(this, BGD[group].block_bitmap, (uint8_t *)bg_buffer);
-
 	BGD[group].free_blocks_count--;
 	for (int i = 0; i < this->bgd_block_span; ++i) {
 		write_block(this, this->bgd_offset + i, (uint8_t *)((uint32_t)BGD + this->block_size * i));
@@ -521,10 +754,13 @@ static unsigned int allocate_block(ext2_fs_t * this) {
 	SB->free_blocks_count--;
 	rewrite_superblock(this);
 
-	memset(bg_buffer, 0x00, this->block_size);
-	write_block(this, block_no, bg_buffer);
+	spin_unlock(this->balloc_lock);
 
-	free(bg_buffer);
+	/* Zero out the new block */
+	uint8_t * empty = malloc(this->block_size);
+	memset(empty, 0x00, this->block_size);
+	write_block(this, block_no, empty);
+	free(empty);
 
 	return block_no;
 
@@ -541,7 +777,19 @@ static unsigned int allocate_block(ext2_fs_t * this) {
  */
 static int allocate_inode_block(ext2_fs_t * this, ext2_inodetable_t * inode, unsigned int inode_no, unsigned int block) {
 	debug_print(NOTICE, "Allocating block #%d for inode #%d", block, inode_no);
-	unsigned int block_no = allocate_block(this);
+
+	/* Continue right after the file's last block so sequential writes
+	 * come out contiguous; new files start in their inode's group. */
+	unsigned int goal = 0;
+	if (block > 0) {
+		unsigned int last = get_block_number(this, inode, block - 1);
+		if (last) goal = last + 1;
+	}
+	if (!goal) {
+		goal = ((inode_no - 1) / this->inodes_per_group) * SB->blocks_per_group;
+	}
+
+	unsigned int block_no = allocate_block(this, goal);
 
 	if (!block_no) return E_NOSPACE;
 
@@ -605,6 +853,107 @@ static unsigned int inode_write_block(ext2_fs_t * this, ext2_inodetable_t * inod
 	return real_block;
 }
 
+/**
+ * ext2->dirindex_lookup Look a name up in a directory's index.
+ *
+ * @returns The inode number, 0 for an indexed miss, or (uint32_t)-1
+ *          if this directory has no usable index yet.
+ */
+static uint32_t dirindex_lookup(ext2_fs_t * this, uint32_t dir_ino, char * name) {
+	if (!this->dir_index) return (uint32_t)-1;
+
+	spin_lock(this->dindex_lock);
+	ext2_dirindex_t * index = hashmap_get(this->dir_index, (void *)(uintptr_t)dir_ino);
+	if (!index || !index->complete) {
+		spin_unlock(this->dindex_lock);
+		return (uint32_t)-1;
+	}
+	list_delete(this->dirindex_lru, &index->lru_node);
+	list_append(this->dirindex_lru, &index->lru_node);
+	uint32_t out = (uint32_t)(uintptr_t)hashmap_get(index->names, name);
+	spin_unlock(this->dindex_lock);
+	return out;
+}
+
+/**
+ * ext2->dirindex_start Begin building an index for a directory.
+ *
+ * Makes room by evicting the least recently used index if needed.
+ * The builder fills ->names via dirindex_add and then marks the
+ * index complete with dirindex_finish.
+ *
+ * @returns The new index, or NULL if one already exists (or indexing
+ *          is disabled) and the scan should proceed without building.
+ */
+static ext2_dirindex_t * dirindex_start(ext2_fs_t * this, uint32_t dir_ino) {
+	if (!this->dir_index) return NULL;
+
+	spin_lock(this->dindex_lock);
+	if (hashmap_get(this->dir_index, (void *)(uintptr_t)dir_ino)) {
+		spin_unlock(this->dindex_lock);
+		return NULL;
+	}
+
+	if (this->dirindex_lru->length >= EXT2_DIRINDEX_MAX) {
+		node_t * node = list_dequeue(this->dirindex_lru);
+		ext2_dirindex_t * victim = node->value;
+		if (victim->complete) {
+			hashmap_remove(this->dir_index, (void *)(uintptr_t)victim->inode_no);
+			hashmap_free(victim->names);
+			free(victim->names);
+			free(victim);
+		} else {
+			/* Someone is still building it; put it back and carry on. */
+			list_append(this->dirindex_lru, node);
+		}
+	}
+
+	ext2_dirindex_t * index = malloc(sizeof(ext2_dirindex_t));
+	index->inode_no = dir_ino;
+	index->complete = 0;
+	index->names = hashmap_create(64);
+	memset(&index->lru_node, 0, sizeof(node_t));
+	index->lru_node.value = index;
+	hashmap_set(this->dir_index, (void *)(uintptr_t)dir_ino, index);
+	list_append(this->dirindex_lru, &index->lru_node);
+	spin_unlock(this->dindex_lock);
+	return index;
+}
+
+static void dirindex_finish(ext2_fs_t * this, ext2_dirindex_t * index) {
+	spin_lock(this->dindex_lock);
+	index->complete = 1;
+	spin_unlock(this->dindex_lock);
+}
+
+/**
+ * ext2->dirindex_add Record a name in a directory's index, if it has one.
+ */
+static void dirindex_add(ext2_fs_t * this, uint32_t dir_ino, char * name, uint32_t ino) {
+	if (!this->dir_index) return;
+
+	spin_lock(this->dindex_lock);
+	ext2_dirindex_t * index = hashmap_get(this->dir_index, (void *)(uintptr_t)dir_ino);
+	if (index) {
+		hashmap_set(index->names, name, (void *)(uintptr_t)ino);
+	}
+	spin_unlock(this->dindex_lock);
+}
+
+/**
+ * ext2->dirindex_remove Drop a name from a directory's index, if it has one.
+ */
+static void dirindex_remove(ext2_fs_t * this, uint32_t dir_ino, char * name) {
+	if (!this->dir_index) return;
+
+	spin_lock(this->dindex_lock);
+	ext2_dirindex_t * index = hashmap_get(this->dir_index, (void *)(uintptr_t)dir_ino);
+	if (index) {
+		hashmap_remove(index->names, name);
+	}
+	spin_unlock(this->dindex_lock);
+}
+
 /**
  * ext2->create_entry
  *
@@ -616,6 +965,7 @@ static int create_entry(fs_node_t * parent, char * name, uint32_t inode) {
 	ext2_inodetable_t * pinode = read_inode(this,parent->inode);
 	if (((pinode->mode & EXT2_S_IFDIR) == 0) || (name == NULL)) {
 		debug_print(WARNING, "Attempted to allocate an inode in a parent that was not a directory.");
+		put_inode(this, pinode);
 		return E_BADPARENT;
 	}
 
@@ -699,6 +1049,7 @@ static int create_entry(fs_node_t * parent, char * name, uint32_t inode) {
 		if (dir_offset + rec_len >= this->block_size) {
 			debug_print(WARNING, "Need to allocate more space, bail!");
 			free(block);
+			put_inode(this, pinode);
 			return E_NOSPACE;
 		} else {
 			unsigned int sreclen = previous->name_len + sizeof(ext2_dir_t);
@@ -723,8 +1074,10 @@ static int create_entry(fs_node_t * parent, char * name, uint32_t inode) {
 
 	inode_write_block(this, pinode, parent->inode, block_nr, block);
 
+	dirindex_add(this, parent->inode, name, inode);
+
 	free(block);
-	free(pinode);
+	put_inode(this, pinode);
 
 
 	return E_NOSPACE;
@@ -843,14 +1196,14 @@ static int mkdir_ext2(fs_node_t * parent, char * name, uint16_t permission) {
 
 	inode_write_block(this, inode, inode_no, 0, tmp);
 
-	free(inode);
+	put_inode(this, inode);
 	free(tmp);
 
 	/* Update parent link count */
 	ext2_inodetable_t * pinode = read_inode(this, parent->inode);
 	pinode->links_count++;
 	write_inode(this, pinode, parent->inode);
-	free(pinode);
+	put_inode(this, pinode);
 
 	/* Update directory count in block group descriptor */
 	uint32_t group = inode_no / this->inodes_per_group;
@@ -919,7 +1272,7 @@ static int create_ext2(fs_node_t * parent, char * name, uint16_t permission) {
 	/* Now append the entry to the parent */
 	create_entry(parent, name, inode_no);
 
-	free(inode);
+	put_inode(this, inode);
 
 	ext2_sync(this);
 
@@ -934,6 +1287,7 @@ static int chmod_ext2(fs_node_t * node, int mode) {
 	inode->mode = (inode->mode & 0xFFFFF000) | mode;
 
 	write_inode(this, inode, node->inode);
+	put_inode(this, inode);
 
 	ext2_sync(this);
 
@@ -985,16 +1339,43 @@ static ext2_dir_t * direntry_ext2(ext2_fs_t * this, ext2_inodetable_t * inode, u
 static fs_node_t * finddir_ext2(fs_node_t *node, char *name) {
 
 	ext2_fs_t * this = (ext2_fs_t *)node->device;
+	ext2_inodetable_t *inode;
+	ext2_dir_t *direntry = NULL;
 
-	ext2_inodetable_t *inode = read_inode(this,node->inode);
+	/* An indexed directory answers without touching its entry blocks. */
+	uint32_t indexed = dirindex_lookup(this, node->inode, name);
+	if (indexed == 0) return NULL;
+	if (indexed != (uint32_t)-1) {
+		direntry = malloc(sizeof(ext2_dir_t) + strlen(name));
+		direntry->inode = indexed;
+		direntry->name_len = strlen(name);
+		memcpy(direntry->name, name, strlen(name));
+
+		fs_node_t *outnode = malloc(sizeof(fs_node_t));
+		memset(outnode, 0, sizeof(fs_node_t));
+
+		inode = read_inode(this, direntry->inode);
+		if (!node_from_file(this, inode, direntry, outnode)) {
+			debug_print(CRITICAL, "Oh dear. Couldn't allocate the outnode?");
+		}
+
+		free(direntry);
+		put_inode(this, inode);
+		return outnode;
+	}
+
+	inode = read_inode(this,node->inode);
 	assert(inode->mode & EXT2_S_IFDIR);
 	uint8_t * block = malloc(this->block_size);
-	ext2_dir_t *direntry = NULL;
 	uint8_t block_nr = 0;
 	inode_read_block(this, inode, block_nr, block);
 	uint32_t dir_offset = 0;
 	uint32_t total_offset = 0;
 
+	/* No index yet; this scan builds one as a side effect, which means
+	 * walking the whole directory even after the name turns up. */
+	ext2_dirindex_t * building = dirindex_start(this, node->inode);
+
 	while (total_offset < inode->size) {
 		if (dir_offset >= this->block_size) {
 			block_nr++;
@@ -1003,7 +1384,7 @@ static fs_node_t * finddir_ext2(fs_node_t *node, char *name) {
 		}
 		ext2_dir_t *d_ent = (ext2_dir_t *)((uintptr_t)block + dir_offset);
 
-		if (d_ent->inode == 0 || strlen(name) != d_ent->name_len) {
+		if (d_ent->inode == 0 || (!building && strlen(name) != d_ent->name_len)) {
 			dir_offset += d_ent->rec_len;
 			total_offset += d_ent->rec_len;
 
@@ -1013,18 +1394,26 @@ static fs_node_t * finddir_ext2(fs_node_t *node, char *name) {
 		char *dname = malloc(sizeof(char) * (d_ent->name_len + 1));
 		memcpy(dname, &(d_ent->name), d_ent->name_len);
 		dname[d_ent->name_len] = '\0';
-		if (!strcmp(dname, name)) {
-			free(dname);
+		if (building) {
+			dirindex_add(this, node->inode, dname, d_ent->inode);
+		}
+		if (!direntry && !strcmp(dname, name)) {
 			direntry = malloc(d_ent->rec_len);
 			memcpy(direntry, d_ent, d_ent->rec_len);
-			break;
+			if (!building) {
+				free(dname);
+				break;
+			}
 		}
 		free(dname);
 
 		dir_offset += d_ent->rec_len;
 		total_offset += d_ent->rec_len;
 	}
-	free(inode);
+	if (building) {
+		dirindex_finish(this, building);
+	}
+	put_inode(this, inode);
 	if (!direntry) {
 		free(block);
 		return NULL;
@@ -1039,7 +1428,7 @@ static fs_node_t * finddir_ext2(fs_node_t *node, char *name) {
 	}
 
 	free(direntry);
-	free(inode);
+	put_inode(this, inode);
 	free(block);
 	return outnode;
 }
@@ -1085,8 +1474,8 @@ static int unlink_ext2(fs_node_t * node, char * name) {
 		dir_offset += d_ent->rec_len;
 		total_offset += d_ent->rec_len;
 	}
-	free(inode);
 	if (!direntry) {
+		put_inode(this, inode);
 		free(block);
 		return -ENOENT;
 	}
@@ -1094,6 +1483,8 @@ static int unlink_ext2(fs_node_t * node, char * name) {
 	direntry->inode = 0;
 
 	inode_write_block(this, inode, node->inode, block_nr, block);
+	dirindex_remove(this, node->inode, name);
+	put_inode(this, inode);
 	free(block);
 
 	ext2_sync(this);
@@ -1125,18 +1516,134 @@ static void refresh_inode(ext2_fs_t * this, ext2_inodetable_t * inodet,  uint32_
 
 /**
  * read_inode
+ *
+ * Returns a reference to the cached copy of an inode, reading it from
+ * the inode table on a miss. The pointer is shared between everyone
+ * holding a reference, so changes pushed out with write_inode are
+ * visible to all of them; release it with put_inode, not free.
  */
 static ext2_inodetable_t * read_inode(ext2_fs_t * this, uint32_t inode) {
-	ext2_inodetable_t *inodet   = malloc(this->inode_size);
-	refresh_inode(this, inodet, inode);
-	return inodet;
+	if (!this->inode_cache) {
+		/* nocache: every caller gets a private copy */
+		ext2_inodetable_t *inodet = malloc(this->inode_size);
+		refresh_inode(this, inodet, inode);
+		return inodet;
+	}
+
+	spin_lock(this->icache_lock);
+	ext2_icache_entry_t * entry = hashmap_get(this->inode_cache, (void *)(uintptr_t)inode);
+	if (entry) {
+		if (entry->refs == 0) {
+			list_delete(this->icache_unused, &entry->lru_node);
+		}
+		entry->refs++;
+		ext2_icache_hits++;
+		spin_unlock(this->icache_lock);
+		return &entry->inode;
+	}
+	ext2_icache_misses++;
+	spin_unlock(this->icache_lock);
+
+	/* Miss; read the inode without holding the cache lock. */
+	entry = malloc(icache_header_size + this->inode_size);
+	entry->inode_no = inode;
+	entry->refs = 1;
+	memset(&entry->lru_node, 0, sizeof(node_t));
+	entry->lru_node.value = entry;
+	refresh_inode(this, &entry->inode, inode);
+
+	spin_lock(this->icache_lock);
+	ext2_icache_entry_t * raced = hashmap_get(this->inode_cache, (void *)(uintptr_t)inode);
+	if (raced) {
+		/* Someone else cached it while we were reading; use theirs. */
+		if (raced->refs == 0) {
+			list_delete(this->icache_unused, &raced->lru_node);
+		}
+		raced->refs++;
+		spin_unlock(this->icache_lock);
+		free(entry);
+		return &raced->inode;
+	}
+	hashmap_set(this->inode_cache, (void *)(uintptr_t)inode, entry);
+	spin_unlock(this->icache_lock);
+	return &entry->inode;
+}
+
+/**
+ * put_inode
+ *
+ * Drop a reference from read_inode. Entries nobody holds go onto a
+ * small unused list so the next stat of the same inode is still a
+ * cache hit; the oldest one is evicted when the list overflows.
+ */
+static void put_inode(ext2_fs_t * this, ext2_inodetable_t * inode) {
+	if (!this->inode_cache) {
+		free(inode);
+		return;
+	}
+
+	ext2_icache_entry_t * entry = icache_entry_from_inode(inode);
+	spin_lock(this->icache_lock);
+	entry->refs--;
+	if (entry->refs == 0) {
+		list_append(this->icache_unused, &entry->lru_node);
+		if (this->icache_unused->length > EXT2_ICACHE_MAX_UNUSED) {
+			node_t * node = list_dequeue(this->icache_unused);
+			ext2_icache_entry_t * victim = node->value;
+			hashmap_remove(this->inode_cache, (void *)(uintptr_t)victim->inode_no);
+			spin_unlock(this->icache_lock);
+			free(victim);
+			return;
+		}
+	}
+	spin_unlock(this->icache_lock);
+}
+
+/**
+ * ext2->ext2_readahead_thread Prefetch blocks ahead of sequential readers.
+ *
+ * Sleeps until read_ext2 detects a sequential access pattern and posts a
+ * request, then pulls the requested inode blocks through the block cache
+ * so the reader's next call is a cache hit. Only the most recent request
+ * is kept; if the reader has moved on, stale prefetches are dropped
+ * rather than queued. Reading through inode_read_block means the fetched
+ * blocks land in the regular cache with normal LRU treatment.
+ */
+static void ext2_readahead_thread(void * arg) {
+	ext2_fs_t * this = arg;
+
+	while (1) {
+		sleep_on(this->readahead_wait);
+
+		while (1) {
+			spin_lock(this->lock);
+			uint32_t inode_no = this->readahead_inode;
+			uint32_t start    = this->readahead_start;
+			uint32_t count    = this->readahead_count;
+			this->readahead_inode = 0;
+			spin_unlock(this->lock);
+
+			if (!inode_no) break;
+
+			ext2_inodetable_t * inode = read_inode(this, inode_no);
+			uint8_t * buf = malloc(this->block_size);
+			for (uint32_t i = 0; i < count; ++i) {
+				inode_read_block(this, inode, start + i, buf);
+			}
+			free(buf);
+			put_inode(this, inode);
+		}
+	}
 }
 
 static uint32_t read_ext2(fs_node_t *node, uint64_t offset, uint32_t size, uint8_t *buffer) {
 	ext2_fs_t * this = (ext2_fs_t *)node->device;
 	ext2_inodetable_t * inode = read_inode(this, node->inode);
 	uint32_t end;
-	if (inode->size == 0) return 0;
+	if (inode->size == 0) {
+		put_inode(this, inode);
+		return 0;
+	}
 	if (offset + size > inode->size) {
 		end = inode->size;
 	} else {
@@ -1147,6 +1654,24 @@ static uint32_t read_ext2(fs_node_t *node, uint64_t offset, uint32_t size, uint8
 	uint32_t end_size     = end - end_block * this->block_size;
 	uint32_t size_to_read = end - offset;
 
+	if (DC && offset && offset == node->last_read_offset) {
+		/* This read picks up where the last one ended; assume a streaming
+		 * reader and post a prefetch of the blocks after this read. */
+		uint32_t next_block  = (end + this->block_size - 1) / this->block_size;
+		uint32_t total_blocks = (inode->size + this->block_size - 1) / this->block_size;
+		if (next_block < total_blocks) {
+			uint32_t count = total_blocks - next_block;
+			if (count > EXT2_READAHEAD_BLOCKS) count = EXT2_READAHEAD_BLOCKS;
+			spin_lock(this->lock);
+			this->readahead_inode = node->inode;
+			this->readahead_start = next_block;
+			this->readahead_count = count;
+			spin_unlock(this->lock);
+			wakeup_queue(this->readahead_wait);
+		}
+	}
+	node->last_read_offset = end;
+
 	uint8_t * buf = malloc(this->block_size);
 	if (start_block == end_block) {
 		inode_read_block(this, inode, start_block, buf);
@@ -1168,7 +1693,7 @@ static uint32_t read_ext2(fs_node_t *node, uint64_t offset, uint32_t size, uint8
 			memcpy(buffer + this->block_size * blocks_read - (offset % this->block_size), buf, end_size);
 		}
 	}
-	free(inode);
+	put_inode(this, inode);
 	free(buf);
 	return size_to_read;
 }
@@ -1224,7 +1749,7 @@ static uint32_t write_ext2(fs_node_t *node, uint64_t offset, uint32_t size, uint
 	ext2_inodetable_t * inode = read_inode(this, node->inode);
 
 	uint32_t rv = write_inode_buffer(this, inode, node->inode, offset, size, buffer);
-	free(inode);
+	put_inode(this, inode);
 	return rv;
 }
 
@@ -1233,6 +1758,16 @@ static void truncate_ext2(fs_node_t * node) {
 	ext2_inodetable_t * inode = read_inode(this,node->inode);
 	inode->size = 0;
 	write_inode(this, inode, node->inode);
+	put_inode(this, inode);
+}
+
+static int fsync_ext2(fs_node_t * node) {
+	ext2_fs_t * this = node->device;
+
+	/* Writes land in the dirty block cache and normally wait for the
+	 * flusher; this pushes everything out now. */
+	ext2_sync(this);
+	return 0;
 }
 
 static void open_ext2(fs_node_t *node, unsigned int flags) {
@@ -1255,7 +1790,7 @@ static struct dirent * readdir_ext2(fs_node_t *node, uint32_t index) {
 	assert(inode->mode & EXT2_S_IFDIR);
 	ext2_dir_t *direntry = direntry_ext2(this, inode, node->inode, index);
 	if (!direntry) {
-		free(inode);
+		put_inode(this, inode);
 		return NULL;
 	}
 	struct dirent *dirent = malloc(sizeof(struct dirent));
@@ -1263,10 +1798,61 @@ static struct dirent * readdir_ext2(fs_node_t *node, uint32_t index) {
 	dirent->name[direntry->name_len] = '\0';
 	dirent->ino = direntry->inode;
 	free(direntry);
-	free(inode);
+	put_inode(this, inode);
 	return dirent;
 }
 
+/**
+ * readdir_n_ext2
+ *
+ * Bulk readdir: walk the directory blocks once and fill as many
+ * entries as fit, instead of re-parsing from the start of the
+ * directory for every single index like readdir_ext2 does.
+ */
+static int readdir_n_ext2(fs_node_t *node, uint32_t index, struct dirent * out, int count) {
+
+	ext2_fs_t * this = (ext2_fs_t *)node->device;
+
+	ext2_inodetable_t *inode = read_inode(this, node->inode);
+	assert(inode->mode & EXT2_S_IFDIR);
+
+	uint8_t *block = malloc(this->block_size);
+	uint8_t block_nr = 0;
+	inode_read_block(this, inode, block_nr, block);
+	uint32_t dir_offset = 0;
+	uint32_t total_offset = 0;
+	uint32_t dir_index = 0;
+	int stored = 0;
+
+	while (total_offset < inode->size && stored < count) {
+		ext2_dir_t *d_ent = (ext2_dir_t *)((uintptr_t)block + dir_offset);
+
+		if (d_ent->inode != 0 && dir_index >= index) {
+			memcpy(&out[stored].name, &d_ent->name, d_ent->name_len);
+			out[stored].name[d_ent->name_len] = '\0';
+			out[stored].ino = d_ent->inode;
+			stored++;
+		}
+
+		dir_offset += d_ent->rec_len;
+		total_offset += d_ent->rec_len;
+
+		if (d_ent->inode) {
+			dir_index++;
+		}
+
+		if (dir_offset >= this->block_size) {
+			block_nr++;
+			dir_offset -= this->block_size;
+			inode_read_block(this, inode, block_nr, block);
+		}
+	}
+
+	free(block);
+	put_inode(this, inode);
+	return stored;
+}
+
 static int symlink_ext2(fs_node_t * parent, char * target, char * name) {
 	if (!name) return -EINVAL;
 
@@ -1334,7 +1920,7 @@ static int symlink_ext2(fs_node_t * parent, char * target, char * name) {
 	if (!embedded) {
 		write_inode_buffer(parent->device, inode, inode_no, 0, target_len, (uint8_t *)target);
 	}
-	free(inode);
+	put_inode(this, inode);
 
 	ext2_sync(this);
 
@@ -1356,7 +1942,7 @@ static int readlink_ext2(fs_node_t * node, char * buf, size_t size) {
 		buf[read_size] = '\0';
 	}
 
-	free(inode);
+	put_inode(this, inode);
 	return read_size;
 }
 
@@ -1381,7 +1967,7 @@ static uint32_t node_from_file(ext2_fs_t * this, ext2_inodetable_t *inode, ext2_
 	/* File Flags */
 	fnode->flags = 0;
 	if ((inode->mode & EXT2_S_IFREG) == EXT2_S_IFREG) {
-		fnode->flags   |= FS_FILE;
+		fnode->flags   |= FS_FILE | FS_CACHEABLE;
 		fnode->read     = read_ext2;
 		fnode->write    = write_ext2;
 		fnode->create   = NULL;
@@ -1393,10 +1979,11 @@ static uint32_t node_from_file(ext2_fs_t * this, ext2_inodetable_t *inode, ext2_
 		fnode->truncate = truncate_ext2;
 	}
 	if ((inode->mode & EXT2_S_IFDIR) == EXT2_S_IFDIR) {
-		fnode->flags   |= FS_DIRECTORY;
+		fnode->flags   |= FS_DIRECTORY | FS_CACHEABLE;
 		fnode->create   = create_ext2;
 		fnode->mkdir    = mkdir_ext2;
 		fnode->readdir  = readdir_ext2;
+		fnode->readdir_n = readdir_n_ext2;
 		fnode->finddir  = finddir_ext2;
 		fnode->unlink   = unlink_ext2;
 		fnode->write    = NULL;
@@ -1429,9 +2016,11 @@ static uint32_t node_from_file(ext2_fs_t * this, ext2_inodetable_t *inode, ext2_
 	debug_print(INFO, "file a/m/c times are %d/%d/%d", fnode->atime, fnode->mtime, fnode->ctime);
 
 	fnode->chmod   = chmod_ext2;
+	fnode->fsync   = fsync_ext2;
 	fnode->open    = open_ext2;
 	fnode->close   = close_ext2;
 	fnode->ioctl   = NULL;
+	fnode->last_read_offset = 0;
 	return 1;
 }
 
@@ -1488,18 +2077,21 @@ static uint32_t ext2_root(ext2_fs_t * this, ext2_inodetable_t *inode, fs_node_t
 	fnode->mtime   = inode->mtime;
 	fnode->ctime   = inode->ctime;
 
-	fnode->flags |= FS_DIRECTORY;
+	fnode->flags |= FS_DIRECTORY | FS_CACHEABLE;
 	fnode->read    = NULL;
 	fnode->write   = NULL;
 	fnode->chmod   = chmod_ext2;
+	fnode->fsync   = fsync_ext2;
 	fnode->open    = open_ext2;
 	fnode->close   = close_ext2;
 	fnode->readdir = readdir_ext2;
+	fnode->readdir_n = readdir_n_ext2;
 	fnode->finddir = finddir_ext2;
 	fnode->ioctl   = NULL;
 	fnode->create  = create_ext2;
 	fnode->mkdir   = mkdir_ext2;
 	fnode->unlink  = unlink_ext2;
+	fnode->last_read_offset = 0;
 	return 1;
 }
 
@@ -1529,10 +2121,11 @@ static fs_node_t * mount_ext2(fs_node_t * block_device, int flags) {
 		this->inode_size = 128;
 	}
 	this->block_size = 1024 << SB->log_block_size;
-	this->cache_entries = 10240;
-	if (this->block_size > 2048) {
-		this->cache_entries /= 4;
-	}
+	/* Size the cache to roughly 1/16th of system memory,
+	 * within sane bounds, rather than a fixed count. */
+	this->cache_entries = (memory_total() * 1024 / 16) / this->block_size;
+	if (this->cache_entries > 10240) this->cache_entries = 10240;
+	if (this->cache_entries < 1024)  this->cache_entries = 1024;
 	debug_print(INFO, "bs=%d, cache entries=%d", this->block_size, this->cache_entries);
 	this->pointers_per_block = this->block_size / 4;
 	debug_print(INFO, "Log block size = %d -> %d", SB->log_block_size, this->block_size);
@@ -1547,16 +2140,31 @@ static fs_node_t * mount_ext2(fs_node_t * block_device, int flags) {
 		DC = malloc(sizeof(ext2_disk_cache_entry_t) * this->cache_entries);
 		this->cache_data = malloc(this->block_size * this->cache_entries);
 		memset(this->cache_data, 0, this->block_size * this->cache_entries);
+		this->cache_map = hashmap_create_int(1024);
+		this->cache_lru = list_create();
+		this->cache_lru_nodes = malloc(sizeof(node_t) * this->cache_entries);
+		memset(this->cache_lru_nodes, 0, sizeof(node_t) * this->cache_entries);
+		this->flush_queue = malloc(sizeof(unsigned int) * this->cache_entries);
 		for (uint32_t i = 0; i < this->cache_entries; ++i) {
 			DC[i].block_no = 0;
 			DC[i].dirty = 0;
+			DC[i].dirty_since = 0;
 			DC[i].last_use = 0;
 			DC[i].block = this->cache_data + i * this->block_size;
+			this->cache_lru_nodes[i].value = (void *)(uintptr_t)i;
+			list_append(this->cache_lru, &this->cache_lru_nodes[i]);
 			if (i % 128 == 0) {
 				debug_print(INFO, "Allocated cache block #%d", i+1);
 			}
 		}
 		debug_print(INFO, "Allocated cache.");
+		this->inode_cache = hashmap_create_int(256);
+		this->icache_unused = list_create();
+		this->dir_index = hashmap_create_int(64);
+		this->dirindex_lru = list_create();
+		create_kernel_tasklet(ext2_flush_thread, "[ext2flush]", this);
+		this->readahead_wait = list_create();
+		create_kernel_tasklet(ext2_readahead_thread, "[ext2ra]", this);
 	} else {
 		DC = NULL;
 		debug_print(NOTICE, "ext2 cache is disabled (nocache)");
@@ -1578,6 +2186,10 @@ static fs_node_t * mount_ext2(fs_node_t * block_device, int flags) {
 		read_block(this, this->bgd_offset + i, (uint8_t *)((uint32_t)BGD + this->block_size * i));
 	}
 
+	/* Block bitmaps load into this lazily, as groups see allocations */
+	this->bitmap_cache = malloc(sizeof(uint8_t *) * BGDS);
+	memset(this->bitmap_cache, 0, sizeof(uint8_t *) * BGDS);
+
 #ifdef DEBUG_BLOCK_DESCRIPTORS
 	char * bg_buffer = malloc(this->block_size * sizeof(char));
 	for (uint32_t i = 0; i < BGDS; ++i) {
@@ -1612,10 +2224,48 @@ static fs_node_t * mount_ext2(fs_node_t * block_device, int flags) {
 	if (!ext2_root(this, root_inode, RN)) {
 		return NULL;
 	}
+	put_inode(this, root_inode);
+
+	if (!ext2_instances) ext2_instances = list_create();
+	list_insert(ext2_instances, this);
+
 	debug_print(NOTICE, "Mounted EXT2 disk, root VFS node is at 0x%x", RN);
 	return RN;
 }
 
+/*
+ * Dump cache statistics to a TTY. The debug shell calls this through
+ * the module symbol table (see ext2-cache there), so it doesn't have
+ * to depend on this module being loaded.
+ */
+void ext2_cache_stats_dump(fs_node_t * tty) {
+	fprintf(tty, "block cache: %d hits, %d misses, %d evictions\n",
+			(int)ext2_cache_hits, (int)ext2_cache_misses, (int)ext2_cache_evictions);
+	fprintf(tty, "inode cache: %d hits, %d misses\n",
+			(int)ext2_icache_hits, (int)ext2_icache_misses);
+	if (!ext2_instances) return;
+	foreach(node, ext2_instances) {
+		ext2_fs_t * this = node->value;
+		if (!DC) {
+			fprintf(tty, "%s: cache disabled\n", this->block_device->name);
+			continue;
+		}
+		unsigned int resident = 0;
+		unsigned int dirty = 0;
+		spin_lock(this->lock);
+		for (unsigned int i = 0; i < this->cache_entries; ++i) {
+			if (DC[i].block_no) resident++;
+			if (DC[i].dirty) dirty++;
+		}
+		spin_unlock(this->lock);
+		fprintf(tty, "%s: %d/%d blocks resident (%d kB), %d dirty, %d idle inode entries\n",
+				this->block_device->name,
+				resident, this->cache_entries,
+				resident * this->block_size / 1024, dirty,
+				this->icache_unused ? (int)this->icache_unused->length : 0);
+	}
+}
+
 fs_node_t * ext2_fs_mount(char * device, char * mount_path) {
 
 	char * arg = strdup(device);
@@ -1,51 +1,588 @@
-/*
- * Experimental Intel High-Definition Audio "driver"
+/* vim: tabstop=4 shiftwidth=4 noexpandtab
+ * This file is part of ToaruOS and is released under the terms
+ * of the NCSA / University of Illinois License - see LICENSE.md
+ *
+ * Driver for Intel High Definition Audio controllers.
+ *
+ * Output-only: brings up the CORB/RIRB command interface, walks the
+ * codec graph to find a DAC wired to an output pin, and runs the
+ * first output stream as a ring of period buffers refilled from the
+ * snd mixer on per-buffer completion interrupts, with the DMA
+ * position buffer reported back for just-in-time mixing.
+ *
+ * See the Intel High Definition Audio Specification, rev 1.0a.
  */
 
+#include <kernel/logging.h>
+#include <kernel/mem.h>
 #include <kernel/module.h>
+#include <kernel/mod/snd.h>
 #include <kernel/printf.h>
 #include <kernel/pci.h>
-#include <kernel/mod/shell.h>
+#include <kernel/system.h>
+
+/* Global controller registers */
+#define HDA_REG_GCAP      0x00
+#define HDA_REG_GCTL      0x08
+#define HDA_REG_WAKEEN    0x0C
+#define HDA_REG_STATESTS  0x0E
+#define HDA_REG_INTCTL    0x20
+#define HDA_REG_INTSTS    0x24
+
+/* Command output ring buffer */
+#define HDA_REG_CORBLBASE 0x40
+#define HDA_REG_CORBUBASE 0x44
+#define HDA_REG_CORBWP    0x48
+#define HDA_REG_CORBRP    0x4A
+#define HDA_REG_CORBCTL   0x4C
+#define HDA_REG_CORBSIZE  0x4E
+
+/* Response input ring buffer */
+#define HDA_REG_RIRBLBASE 0x50
+#define HDA_REG_RIRBUBASE 0x54
+#define HDA_REG_RIRBWP    0x58
+#define HDA_REG_RINTCNT   0x5A
+#define HDA_REG_RIRBCTL   0x5C
+#define HDA_REG_RIRBSTS   0x5D
+#define HDA_REG_RIRBSIZE  0x5E
+
+/* DMA position buffer */
+#define HDA_REG_DPLBASE   0x70
+#define HDA_REG_DPUBASE   0x74
+
+/* Stream descriptors; inputs first, then outputs */
+#define HDA_REG_SD_BASE   0x80
+#define HDA_SD_SIZE       0x20
+#define HDA_SD_CTL        0x00
+#define HDA_SD_STS        0x03
+#define HDA_SD_LPIB       0x04
+#define HDA_SD_CBL        0x08
+#define HDA_SD_LVI        0x0C
+#define HDA_SD_FMT        0x12
+#define HDA_SD_BDPL       0x18
+#define HDA_SD_BDPU       0x1C
+
+#define HDA_GCTL_CRST     (1 << 0)
+#define HDA_SD_CTL_SRST   (1 << 0)
+#define HDA_SD_CTL_RUN    (1 << 1)
+#define HDA_SD_CTL_IOCE   (1 << 2)
+#define HDA_SD_STS_BCIS   (1 << 2)
+#define HDA_INTCTL_GIE    ((uint32_t)1 << 31)
+
+/* Codec verbs (pre-shifted into the low 20 bits of a command) */
+#define HDA_VERB_GET_PARAM       0xF0000
+#define HDA_VERB_GET_CONN_ENTRY  0xF0200
+#define HDA_VERB_GET_CONFIG      0xF1C00
+#define HDA_VERB_SET_CONN_SELECT 0x70100
+#define HDA_VERB_SET_POWER       0x70500
+#define HDA_VERB_SET_STREAM      0x70600
+#define HDA_VERB_SET_PIN_CTL     0x70700
+#define HDA_VERB_SET_EAPD        0x70C00
+#define HDA_VERB_SET_FORMAT      0x20000
+#define HDA_VERB_SET_AMP         0x30000
+
+/* Codec parameters */
+#define HDA_PARAM_NODE_COUNT     0x04
+#define HDA_PARAM_FG_TYPE        0x05
+#define HDA_PARAM_WIDGET_CAPS    0x09
+#define HDA_PARAM_PIN_CAPS       0x0C
+#define HDA_PARAM_CONN_LIST_LEN  0x0E
+#define HDA_PARAM_OUT_AMP_CAPS   0x12
+
+#define HDA_WIDGET_DAC           0x0
+#define HDA_WIDGET_PIN           0x4
+
+/* 48kHz, 16-bit, 2 channel */
+#define HDA_FORMAT_48K16S        0x0011
+#define HDA_STREAM_TAG           1
+
+/* Ring of period buffers for the output stream */
+#define HDA_BDL_LEN              8
+#define HDA_BUFFER_LEN           0x1000 /* In bytes */
+
+/* snd values */
+#define HDA_SND_NAME "Intel HD Audio"
+#define HDA_PLAYBACK_SPEED 48000
+#define HDA_PLAYBACK_FORMAT SND_FORMAT_L16SLE
+
+/* An entry in the buffer descriptor list */
+typedef struct {
+	uint32_t addr_low;
+	uint32_t addr_high;
+	uint32_t length;
+	uint32_t ioc;
+} __attribute__((packed)) hda_bdl_entry_t;
 
 struct hda_device {
 	uint32_t pci_device;
+	uintptr_t mmio;            /* Register base (identity mapped) */
+	size_t irq;
+
+	uint32_t * corb;           /* Command output ring */
+	volatile uint32_t * rirb;  /* Response input ring */
+	uintptr_t corb_phys;
+	uintptr_t rirb_phys;
+	int corb_entries;
+	int rirb_entries;
+	int rirb_rp;               /* Our read pointer into the RIRB */
+
+	int codec;                 /* Address of the codec we drive */
+	int afg;                   /* Audio function group node */
+	int dac;                   /* Output converter node */
+	int pin;                   /* Output pin node */
+	uint32_t amp_steps;        /* Gain steps of the DAC output amp */
+	uint32_t volume;           /* Cached master volume knob value */
+
+	int stream;                /* Index of our (first output) stream */
+	uintptr_t sd_base;         /* Register base of that stream */
+	hda_bdl_entry_t * bdl;
+	uintptr_t bdl_phys;
+	uint16_t * bufs[HDA_BDL_LEN];
+	volatile uint32_t * dma_pos;
+	uintptr_t dma_pos_phys;
+	uint8_t last_index;        /* Last period we refilled behind */
+	uint32_t samples_played;   /* Samples in periods the hardware finished */
 };
 
 static struct hda_device _device;
 
-static void find_hda(uint32_t device, uint16_t vendorid, uint16_t deviceid, void * extra) {
+static snd_knob_t _knobs[] = {
+	{
+		"Master",
+		SND_KNOB_MASTER
+	}
+};
+
+static int hda_mixer_read(uint32_t knob_id, uint32_t *val);
+static int hda_mixer_write(uint32_t knob_id, uint32_t val);
+static uint32_t hda_get_position(snd_device_t * device);
+
+static snd_device_t _snd = {
+	.name            = HDA_SND_NAME,
+	.device          = &_device,
+	.playback_speed  = HDA_PLAYBACK_SPEED,
+	.playback_format = HDA_PLAYBACK_FORMAT,
+
+	.knobs     = _knobs,
+	.num_knobs = 1,
+
+	.mixer_read  = hda_mixer_read,
+	.mixer_write = hda_mixer_write,
+
+	.get_position = hda_get_position,
+};
+
+static uint8_t hda_read8(uintptr_t off) {
+	return *(volatile uint8_t *)(_device.mmio + off);
+}
+static uint16_t hda_read16(uintptr_t off) {
+	return *(volatile uint16_t *)(_device.mmio + off);
+}
+static uint32_t hda_read32(uintptr_t off) {
+	return *(volatile uint32_t *)(_device.mmio + off);
+}
+static void hda_write8(uintptr_t off, uint8_t val) {
+	*(volatile uint8_t *)(_device.mmio + off) = val;
+}
+static void hda_write16(uintptr_t off, uint16_t val) {
+	*(volatile uint16_t *)(_device.mmio + off) = val;
+}
+static void hda_write32(uintptr_t off, uint32_t val) {
+	*(volatile uint32_t *)(_device.mmio + off) = val;
+}
 
+static void find_hda(uint32_t device, uint16_t vendorid, uint16_t deviceid, void * extra) {
 	struct hda_device * hda = extra;
 
-	if ((vendorid == 0x8086) && (deviceid == 0x2668)) {
+	/* Multimedia / audio device (class 04, subclass 03) */
+	if (pci_read_field(device, PCI_CLASS, 1) == 0x04 &&
+		pci_read_field(device, PCI_SUBCLASS, 1) == 0x03) {
 		hda->pci_device = device;
 	}
-
 }
 
-DEFINE_SHELL_FUNCTION(hda_test, "[debug] Intel HDA experiments") {
+/*
+ * Push one command into the CORB and spin for its response in the
+ * RIRB. Only used at setup time, so a bounded busy wait is fine.
+ */
+static uint32_t hda_codec_command(int codec, int nid, uint32_t payload) {
+	uint16_t wp = hda_read16(HDA_REG_CORBWP) & 0xFF;
+	wp = (wp + 1) % _device.corb_entries;
+	_device.corb[wp] = ((uint32_t)codec << 28) | ((uint32_t)nid << 20) | payload;
+	hda_write16(HDA_REG_CORBWP, wp);
 
-	if (!_device.pci_device) {
-		fprintf(tty, "No HDA device found.\n");
-		return 1;
+	for (int timeout = 0; timeout < 1000000; timeout++) {
+		uint16_t rirb_wp = hda_read16(HDA_REG_RIRBWP) & 0xFF;
+		while (_device.rirb_rp != rirb_wp) {
+			_device.rirb_rp = (_device.rirb_rp + 1) % _device.rirb_entries;
+			uint32_t resp    = _device.rirb[_device.rirb_rp * 2];
+			uint32_t resp_ex = _device.rirb[_device.rirb_rp * 2 + 1];
+			if (resp_ex & (1 << 4)) continue; /* Unsolicited; not ours */
+			return resp;
+		}
 	}
-	fprintf(tty, "HDA audio device is at 0x%x.\n", _device.pci_device);
 
+	debug_print(WARNING, "[hda] codec %d nid %d verb 0x%x timed out", codec, nid, payload);
 	return 0;
 }
 
+static uint32_t hda_get_param(int nid, uint32_t param) {
+	return hda_codec_command(_device.codec, nid, HDA_VERB_GET_PARAM | param);
+}
+
+/*
+ * Walk the codec graph: find the audio function group, then a DAC
+ * and an output-capable pin whose connection list reaches that DAC.
+ */
+static int hda_discover_path(int codec) {
+	_device.codec = codec;
+
+	uint32_t root = hda_get_param(0, HDA_PARAM_NODE_COUNT);
+	int fg_start = (root >> 16) & 0xFF;
+	int fg_count = root & 0xFF;
+
+	_device.afg = 0;
+	for (int fg = fg_start; fg < fg_start + fg_count; fg++) {
+		if ((hda_get_param(fg, HDA_PARAM_FG_TYPE) & 0x7F) == 0x01) {
+			_device.afg = fg;
+			break;
+		}
+	}
+	if (!_device.afg) return 0;
+
+	uint32_t sub = hda_get_param(_device.afg, HDA_PARAM_NODE_COUNT);
+	int w_start = (sub >> 16) & 0xFF;
+	int w_count = sub & 0xFF;
+
+	/* Collect DACs and pick the most plausible output pin */
+	int dacs[16];
+	int n_dacs = 0;
+	int pin = 0;
+	int pin_rank = -1;
+
+	for (int nid = w_start; nid < w_start + w_count; nid++) {
+		uint32_t caps = hda_get_param(nid, HDA_PARAM_WIDGET_CAPS);
+		int type = (caps >> 20) & 0xF;
+		if (type == HDA_WIDGET_DAC && n_dacs < 16) {
+			dacs[n_dacs++] = nid;
+		} else if (type == HDA_WIDGET_PIN) {
+			if (!(hda_get_param(nid, HDA_PARAM_PIN_CAPS) & (1 << 4))) continue; /* Not output capable */
+			uint32_t config = hda_codec_command(codec, nid, HDA_VERB_GET_CONFIG);
+			int device = (config >> 20) & 0xF;
+			/* Prefer speaker, then line out, then headphone */
+			int rank = (device == 0x1) ? 3 : (device == 0x0) ? 2 : (device == 0x2) ? 1 : 0;
+			if (rank > pin_rank) {
+				pin_rank = rank;
+				pin = nid;
+			}
+		}
+	}
+	if (!n_dacs || !pin) return 0;
+
+	/* Find a DAC in the pin's connection list */
+	int conn_len = hda_get_param(pin, HDA_PARAM_CONN_LIST_LEN) & 0x7F;
+	for (int i = 0; i < conn_len; i++) {
+		/* Short-form entries, four per response */
+		uint32_t entries = hda_codec_command(codec, pin, HDA_VERB_GET_CONN_ENTRY | (i & ~0x3));
+		int conn = (entries >> ((i & 0x3) * 8)) & 0xFF;
+		for (int d = 0; d < n_dacs; d++) {
+			if (conn == dacs[d]) {
+				_device.dac = conn;
+				_device.pin = pin;
+				hda_codec_command(codec, pin, HDA_VERB_SET_CONN_SELECT | i);
+				return 1;
+			}
+		}
+	}
+
+	/* No direct route; take the first DAC and hope the default
+	 * connection gets there (common on simple codecs) */
+	_device.dac = dacs[0];
+	_device.pin = pin;
+	return 1;
+}
+
+/*
+ * Refill every period the hardware has moved past, reading fresh
+ * samples from the mixer. Called per-completion from the IRQ handler;
+ * catches up if completions coalesced under load.
+ */
+static void hda_refill(void) {
+	uint32_t pos = _device.dma_pos[_device.stream * 2];
+	uint8_t cur = (pos / HDA_BUFFER_LEN) % HDA_BDL_LEN;
+	while (_device.last_index != cur) {
+		snd_request_buf(&_snd, HDA_BUFFER_LEN, (uint8_t *)_device.bufs[_device.last_index]);
+		_device.samples_played += HDA_BUFFER_LEN / sizeof(uint16_t);
+		_device.last_index = (_device.last_index + 1) % HDA_BDL_LEN;
+	}
+}
+
+static int irq_handler(struct regs * regs) {
+	uint32_t intsts = hda_read32(HDA_REG_INTSTS);
+	if (!(intsts & (1 << _device.stream))) return 0;
+
+	uint8_t sts = hda_read8(_device.sd_base + HDA_SD_STS);
+	if (sts & HDA_SD_STS_BCIS) {
+		hda_refill();
+	}
+	hda_write8(_device.sd_base + HDA_SD_STS, sts);
+
+	irq_ack(_device.irq);
+	return 1;
+}
+
+/*
+ * Playback position in samples from the controller's DMA position
+ * buffer; completed periods plus progress into the current one.
+ */
+static uint32_t hda_get_position(snd_device_t * device) {
+	struct hda_device * hda = device->device;
+	uint32_t pos = hda->dma_pos[hda->stream * 2];
+	return hda->samples_played + (pos % HDA_BUFFER_LEN) / sizeof(uint16_t);
+}
+
+static int hda_mixer_read(uint32_t knob_id, uint32_t *val) {
+	switch (knob_id) {
+		case SND_KNOB_MASTER:
+			*val = _device.volume;
+			return 0;
+		default:
+			return -1;
+	}
+}
+
+static int hda_mixer_write(uint32_t knob_id, uint32_t val) {
+	switch (knob_id) {
+		case SND_KNOB_MASTER: {
+			_device.volume = val;
+			/* Map the knob onto the DAC's output amp steps; zero mutes */
+			uint32_t payload;
+			if (val == 0) {
+				payload = 0xb080; /* Output, both channels, mute */
+			} else {
+				uint32_t gain = (uint32_t)(((uint64_t)val * _device.amp_steps) / 0xFFFFFFFFUL);
+				payload = 0xb000 | gain;
+			}
+			hda_codec_command(_device.codec, _device.dac, HDA_VERB_SET_AMP | payload);
+			hda_codec_command(_device.codec, _device.pin, HDA_VERB_SET_AMP | payload);
+			return 0;
+		}
+		default:
+			return -1;
+	}
+}
+
+static int hda_reset_controller(void) {
+	/* Pull the controller through reset */
+	hda_write32(HDA_REG_GCTL, 0);
+	for (int i = 0; i < 1000000 && (hda_read32(HDA_REG_GCTL) & HDA_GCTL_CRST); i++);
+	hda_write32(HDA_REG_GCTL, HDA_GCTL_CRST);
+	for (int i = 0; i < 1000000; i++) {
+		if (hda_read32(HDA_REG_GCTL) & HDA_GCTL_CRST) break;
+	}
+	if (!(hda_read32(HDA_REG_GCTL) & HDA_GCTL_CRST)) {
+		debug_print(WARNING, "[hda] controller did not come out of reset");
+		return 0;
+	}
+	/* Give the codecs time to announce themselves */
+	for (int i = 0; i < 1000000 && !hda_read16(HDA_REG_STATESTS); i++);
+	return 1;
+}
+
+static void hda_setup_corb_rirb(void) {
+	/* Stop both DMA engines while we program them */
+	hda_write8(HDA_REG_CORBCTL, 0);
+	hda_write8(HDA_REG_RIRBCTL, 0);
+
+	/* Pick the largest rings the controller supports */
+	uint8_t szcap = hda_read8(HDA_REG_CORBSIZE) >> 4;
+	if (szcap & 0x4) {
+		_device.corb_entries = 256;
+		hda_write8(HDA_REG_CORBSIZE, 0x2);
+	} else if (szcap & 0x2) {
+		_device.corb_entries = 16;
+		hda_write8(HDA_REG_CORBSIZE, 0x1);
+	} else {
+		_device.corb_entries = 2;
+		hda_write8(HDA_REG_CORBSIZE, 0x0);
+	}
+	szcap = hda_read8(HDA_REG_RIRBSIZE) >> 4;
+	if (szcap & 0x4) {
+		_device.rirb_entries = 256;
+		hda_write8(HDA_REG_RIRBSIZE, 0x2);
+	} else if (szcap & 0x2) {
+		_device.rirb_entries = 16;
+		hda_write8(HDA_REG_RIRBSIZE, 0x1);
+	} else {
+		_device.rirb_entries = 2;
+		hda_write8(HDA_REG_RIRBSIZE, 0x0);
+	}
+
+	_device.corb = (void *)kvmalloc_p(_device.corb_entries * sizeof(uint32_t), &_device.corb_phys);
+	memset(_device.corb, 0, _device.corb_entries * sizeof(uint32_t));
+	_device.rirb = (void *)kvmalloc_p(_device.rirb_entries * sizeof(uint64_t), &_device.rirb_phys);
+	memset((void *)_device.rirb, 0, _device.rirb_entries * sizeof(uint64_t));
+
+	hda_write32(HDA_REG_CORBLBASE, _device.corb_phys);
+	hda_write32(HDA_REG_CORBUBASE, 0);
+	hda_write32(HDA_REG_RIRBLBASE, _device.rirb_phys);
+	hda_write32(HDA_REG_RIRBUBASE, 0);
+
+	/* Reset the read/write pointers */
+	hda_write16(HDA_REG_CORBRP, 1 << 15);
+	for (int i = 0; i < 1000000 && !(hda_read16(HDA_REG_CORBRP) & (1 << 15)); i++);
+	hda_write16(HDA_REG_CORBRP, 0);
+	hda_write16(HDA_REG_CORBWP, 0);
+	hda_write16(HDA_REG_RIRBWP, 1 << 15);
+	_device.rirb_rp = 0;
+
+	hda_write16(HDA_REG_RINTCNT, 1);
+
+	/* Run; we poll the RIRB rather than taking response interrupts */
+	hda_write8(HDA_REG_CORBCTL, (1 << 1));
+	hda_write8(HDA_REG_RIRBCTL, (1 << 1));
+}
+
+static void hda_setup_codec(void) {
+	int codec = _device.codec;
+
+	/* Wake everything on the path */
+	hda_codec_command(codec, _device.afg, HDA_VERB_SET_POWER | 0);
+	hda_codec_command(codec, _device.dac, HDA_VERB_SET_POWER | 0);
+	hda_codec_command(codec, _device.pin, HDA_VERB_SET_POWER | 0);
+
+	/* Converter: our format, bound to our stream, channel 0 */
+	hda_codec_command(codec, _device.dac, HDA_VERB_SET_FORMAT | HDA_FORMAT_48K16S);
+	hda_codec_command(codec, _device.dac, HDA_VERB_SET_STREAM | (HDA_STREAM_TAG << 4));
+
+	/* Unmute output amps at 0dB (the amp cap offset) */
+	uint32_t amp_caps = hda_get_param(_device.dac, HDA_PARAM_OUT_AMP_CAPS);
+	_device.amp_steps = (amp_caps >> 8) & 0x7F;
+	hda_codec_command(codec, _device.dac, HDA_VERB_SET_AMP | 0xb000 | _device.amp_steps);
+	hda_codec_command(codec, _device.pin, HDA_VERB_SET_AMP | 0xb000 | _device.amp_steps);
+	_device.volume = 0xFFFFFFFF;
+
+	/* Turn the pin on */
+	hda_codec_command(codec, _device.pin, HDA_VERB_SET_PIN_CTL | 0x40); /* Output enable */
+	hda_codec_command(codec, _device.pin, HDA_VERB_SET_EAPD | 0x2);     /* EAPD on, for laptops */
+}
+
+static void hda_setup_stream(void) {
+	uint16_t gcap = hda_read16(HDA_REG_GCAP);
+	int iss = (gcap >> 8) & 0xF;
+
+	/* First output stream descriptor follows the input ones */
+	_device.stream = iss;
+	_device.sd_base = HDA_REG_SD_BASE + _device.stream * HDA_SD_SIZE;
+
+	/* Reset the stream */
+	hda_write8(_device.sd_base + HDA_SD_CTL, HDA_SD_CTL_SRST);
+	for (int i = 0; i < 1000000 && !(hda_read8(_device.sd_base + HDA_SD_CTL) & HDA_SD_CTL_SRST); i++);
+	hda_write8(_device.sd_base + HDA_SD_CTL, 0);
+	for (int i = 0; i < 1000000 && (hda_read8(_device.sd_base + HDA_SD_CTL) & HDA_SD_CTL_SRST); i++);
+
+	/* Build the buffer descriptor list, interrupting every period */
+	_device.bdl = (void *)kvmalloc_p(HDA_BDL_LEN * sizeof(hda_bdl_entry_t), &_device.bdl_phys);
+	memset(_device.bdl, 0, HDA_BDL_LEN * sizeof(hda_bdl_entry_t));
+	for (int i = 0; i < HDA_BDL_LEN; i++) {
+		uintptr_t phys;
+		_device.bufs[i] = (uint16_t *)kvmalloc_p(HDA_BUFFER_LEN, &phys);
+		memset(_device.bufs[i], 0, HDA_BUFFER_LEN);
+		_device.bdl[i].addr_low = phys;
+		_device.bdl[i].addr_high = 0;
+		_device.bdl[i].length = HDA_BUFFER_LEN;
+		_device.bdl[i].ioc = 1;
+	}
+	_device.last_index = 0;
+
+	hda_write32(_device.sd_base + HDA_SD_BDPL, _device.bdl_phys);
+	hda_write32(_device.sd_base + HDA_SD_BDPU, 0);
+	hda_write32(_device.sd_base + HDA_SD_CBL, HDA_BDL_LEN * HDA_BUFFER_LEN);
+	hda_write16(_device.sd_base + HDA_SD_LVI, HDA_BDL_LEN - 1);
+	hda_write16(_device.sd_base + HDA_SD_FMT, HDA_FORMAT_48K16S);
+
+	/* DMA position buffer so we can see where the engine is */
+	_device.dma_pos = (void *)kvmalloc_p(0x1000, &_device.dma_pos_phys);
+	memset((void *)_device.dma_pos, 0, 0x1000);
+	hda_write32(HDA_REG_DPUBASE, 0);
+	hda_write32(HDA_REG_DPLBASE, _device.dma_pos_phys | 1);
+
+	/* Tag the stream, enable completion interrupts, and go */
+	hda_write32(HDA_REG_INTCTL, HDA_INTCTL_GIE | (1 << _device.stream));
+	hda_write32(_device.sd_base + HDA_SD_CTL,
+			((uint32_t)HDA_STREAM_TAG << 20) | HDA_SD_CTL_IOCE | HDA_SD_CTL_RUN);
+}
+
 static int init(void) {
-	BIND_SHELL_FUNCTION(hda_test);
+	debug_print(NOTICE, "Initializing Intel HDA");
 	pci_scan(&find_hda, -1, &_device);
 	if (!_device.pci_device) {
 		return 1;
 	}
+
+	/* Register space is memory mapped through BAR0 */
+	uint32_t mem_base = pci_read_field(_device.pci_device, PCI_BAR0, 4) & 0xFFFFFFF0;
+	for (size_t x = 0; x < 0x4000; x += 0x1000) {
+		uintptr_t addr = (mem_base & 0xFFFFF000) + x;
+		dma_frame(get_page(addr, 1, kernel_directory), 1, 1, addr);
+	}
+	_device.mmio = mem_base;
+
+	/* Enable bus mastering and memory space */
+	pci_write_field(_device.pci_device, PCI_COMMAND, 2, 0x6);
+
+	if (!hda_reset_controller()) {
+		return 1;
+	}
+
+	hda_setup_corb_rirb();
+
+	/* Find a codec with a usable output path */
+	uint16_t statests = hda_read16(HDA_REG_STATESTS);
+	int found = 0;
+	for (int codec = 0; codec < 15; codec++) {
+		if ((statests & (1 << codec)) && hda_discover_path(codec)) {
+			found = 1;
+			break;
+		}
+	}
+	if (!found) {
+		debug_print(WARNING, "[hda] no codec with a usable output path");
+		return 1;
+	}
+	debug_print(NOTICE, "[hda] codec %d: afg %d, dac %d, pin %d",
+			_device.codec, _device.afg, _device.dac, _device.pin);
+
+	_device.irq = pci_get_interrupt(_device.pci_device);
+	irq_install_handler(_device.irq, irq_handler, "hda");
+
+	hda_setup_codec();
+	hda_setup_stream();
+
+	snd_register(&_snd);
+
+	debug_print(NOTICE, "Intel HDA initialized successfully");
 	return 0;
 }
 
 static int fini(void) {
+	if (_device.mmio) {
+		/* Stop the stream and the command rings */
+		hda_write32(_device.sd_base + HDA_SD_CTL, 0);
+		hda_write32(HDA_REG_INTCTL, 0);
+		hda_write8(HDA_REG_CORBCTL, 0);
+		hda_write8(HDA_REG_RIRBCTL, 0);
+		snd_unregister(&_snd);
+		for (int i = 0; i < HDA_BDL_LEN; i++) {
+			free(_device.bufs[i]);
+		}
+		free(_device.bdl);
+		free(_device.corb);
+		free((void *)_device.rirb);
+		free((void *)_device.dma_pos);
+	}
 	return 0;
 }
 
 MODULE_DEF(hda, init, fini);
-MODULE_DEPENDS(debugshell);
+MODULE_DEPENDS(snd);
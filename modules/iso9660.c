@@ -31,6 +31,8 @@ typedef struct {
 	uint32_t block_size;
 	hashmap_t * cache;
 	list_t * lru;
+	hashmap_t * extent_cache; /* directory extent start sector -> contents */
+	list_t * extent_lru;
 } iso_9660_fs_t;
 
 typedef struct {
@@ -167,6 +169,48 @@ static void read_sector(iso_9660_fs_t * this, uint32_t sector_id, char * buffer)
 	}
 }
 
+#define EXTENT_CACHE_SIZE 16
+
+/*
+ * Fetch a directory's full extent in one request to the block device
+ * rather than a 2KB read per sector, and keep whole extents cached so
+ * walking back through a directory doesn't go to the device at all.
+ * With the cache enabled the returned buffer belongs to the cache;
+ * *should_free tells the caller whether it owns the memory.
+ */
+static uint8_t * read_directory_extent(iso_9660_fs_t * this, iso_9660_directory_entry_t * root_entry, int * should_free) {
+	uint32_t start  = root_entry->extent_start_LSB;
+	size_t  length  = root_entry->extent_length_LSB;
+	size_t  sectors = (length + this->block_size - 1) / this->block_size;
+
+	if (this->extent_cache) {
+		void * key = (void *)start;
+		*should_free = 0;
+		if (hashmap_has(this->extent_cache, key)) {
+			node_t * me = list_find(this->extent_lru, key);
+			list_delete(this->extent_lru, me);
+			list_append(this->extent_lru, me);
+			return hashmap_get(this->extent_cache, key);
+		}
+		if (this->extent_lru->length > EXTENT_CACHE_SIZE) {
+			node_t * l = list_dequeue(this->extent_lru);
+			free(hashmap_get(this->extent_cache, l->value));
+			hashmap_remove(this->extent_cache, l->value);
+			free(l);
+		}
+		uint8_t * data = malloc(sectors * this->block_size);
+		read_fs(this->block_device, start * this->block_size, sectors * this->block_size, data);
+		hashmap_set(this->extent_cache, key, data);
+		list_insert(this->extent_lru, key);
+		return data;
+	}
+
+	*should_free = 1;
+	uint8_t * data = malloc(sectors * this->block_size);
+	read_fs(this->block_device, start * this->block_size, sectors * this->block_size, data);
+	return data;
+}
+
 static void inplace_lower(char * string) {
 	while (*string) {
 		if (*string >= 'A' && *string <= 'Z') {
@@ -208,20 +252,9 @@ static struct dirent * readdir_iso(fs_node_t *node, uint32_t index) {
 
 	debug_print(INFO, "[iso] Reading directory for readdir; sector = %d, offset = %d", node->inode, node->impl);
 
-	uint8_t * root_data = malloc(root_entry->extent_length_LSB);
-	uint8_t * offset = root_data;
-	size_t sector_offset = 0;
-	size_t length_to_read = root_entry->extent_length_LSB;
-	while (length_to_read) {
-		read_sector(this, root_entry->extent_start_LSB + sector_offset, (char*)offset);
-		if (length_to_read >= this->block_size) {
-			offset += this->block_size;
-			sector_offset += 1;
-			length_to_read -= this->block_size;
-		} else {
-			break;
-		}
-	}
+	int should_free = 0;
+	uint8_t * root_data = read_directory_extent(this, root_entry, &should_free);
+	uint8_t * offset;
 
 	debug_print(INFO, "[iso] Done, want index = %d", index);
 
@@ -263,7 +296,7 @@ try_again:
 	dirent = NULL;
 
 cleanup:
-	free(root_data);
+	if (should_free) free(root_data);
 	free(buffer);
 	free(out);
 	return dirent;
@@ -296,23 +329,11 @@ static fs_node_t * finddir_iso(fs_node_t *node, char *name) {
 	read_sector(this, node->inode, buffer);
 	iso_9660_directory_entry_t * root_entry = (iso_9660_directory_entry_t *)(buffer + node->impl);
 
-	uint8_t * root_data = malloc(root_entry->extent_length_LSB);
-	uint8_t * offset = root_data;
-	size_t sector_offset = 0;
-	size_t length_to_read = root_entry->extent_length_LSB;
-	while (length_to_read) {
-		read_sector(this, root_entry->extent_start_LSB + sector_offset, (char*)offset);
-		if (length_to_read >= this->block_size) {
-			offset += this->block_size;
-			sector_offset += 1;
-			length_to_read -= this->block_size;
-		} else {
-			break;
-		}
-	}
+	int should_free = 0;
+	uint8_t * root_data = read_directory_extent(this, root_entry, &should_free);
 
 	/* Examine directory */
-	offset = root_data;
+	uint8_t * offset = root_data;
 
 	fs_node_t * out = malloc(sizeof(fs_node_t));
 	while (1) {
@@ -342,7 +363,7 @@ try_next_finddir:
 	out = NULL;
 
 cleanup:
-	free(root_data);
+	if (should_free) free(root_data);
 	free(buffer);
 	return out;
 }
@@ -384,11 +405,11 @@ static void file_from_dir_entry(iso_9660_fs_t * this, size_t sector, iso_9660_di
 	fs->mask = 0555;
 	fs->nlink = 0; /* Unsupported */
 	if (dir->flags & FLAG_DIRECTORY) {
-		fs->flags = FS_DIRECTORY;
+		fs->flags = FS_DIRECTORY | FS_CACHEABLE;
 		fs->readdir = readdir_iso;
 		fs->finddir = finddir_iso;
 	} else {
-		fs->flags = FS_FILE;
+		fs->flags = FS_FILE | FS_CACHEABLE;
 		fs->read = read_iso;
 	}
 	/* Other things not supported */
@@ -434,8 +455,11 @@ static fs_node_t * iso_fs_mount(char * device, char * mount_path) {
 	if (cache) {
 		this->cache = hashmap_create_int(10);
 		this->lru = list_create();
+		this->extent_cache = hashmap_create_int(10);
+		this->extent_lru = list_create();
 	} else {
 		this->cache = NULL;
+		this->extent_cache = NULL;
 	}
 
 	/* Probably want to put a block cache on this like EXT2 driver does; or do that in the ATAPI layer... */
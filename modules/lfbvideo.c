@@ -46,15 +46,36 @@ static pid_t display_change_recipient = 0;
 /* Driver-specific modesetting function */
 static void (*lfb_resolution_impl)(uint16_t,uint16_t) = NULL;
 
+/* How much video memory is actually mapped; runtime mode sets must
+ * fit within this or the compositor would write past the mapping. */
+static size_t lfb_memsize = 0;
+
+/* Cursor plane hooks; display drivers with a hardware cursor install
+ * these (eg. the VirtualBox guest additions) and the ioctls below
+ * report -EINVAL otherwise so callers fall back to software. */
+int (*lfb_cursor_image_impl)(struct vid_cursor * cursor) = NULL;
+int (*lfb_cursor_move_impl)(struct vid_cursor_pos * pos) = NULL;
+
+/* Accelerated damage-update hook; the VMware backend implements this
+ * with its command FIFO. -EINVAL means updates are implicit. */
+int (*lfb_update_impl)(struct vid_update * update) = NULL;
+
 /* Called by ioctl on /dev/fb0 */
-void lfb_set_resolution(uint16_t x, uint16_t y) {
-	if (lfb_resolution_impl) {
-		lfb_resolution_impl(x,y);
-		if (display_change_recipient) {
-			send_signal(display_change_recipient, SIGWINEVENT, 1);
-			debug_print(WARNING, "Telling %d to SIGWINEVENT", display_change_recipient);
-		}
+int lfb_set_resolution(uint16_t x, uint16_t y) {
+	if (!lfb_resolution_impl) {
+		/* This driver can't modeset at runtime. */
+		return -EINVAL;
+	}
+	if (lfb_memsize && (size_t)x * y * 4 > lfb_memsize) {
+		debug_print(WARNING, "Rejecting %dx%d mode set; needs more than 0x%x bytes of video memory", x, y, lfb_memsize);
+		return -EINVAL;
 	}
+	lfb_resolution_impl(x,y);
+	if (display_change_recipient) {
+		send_signal(display_change_recipient, SIGWINEVENT, 1);
+		debug_print(WARNING, "Telling %d to SIGWINEVENT", display_change_recipient);
+	}
+	return 0;
 }
 
 /**
@@ -96,12 +117,32 @@ static int ioctl_vid(fs_node_t * node, int request, void * argp) {
 		case IO_VID_SET:
 			/* Initiate mode setting */
 			validate(argp);
-			lfb_set_resolution(((struct vid_size *)argp)->width, ((struct vid_size *)argp)->height);
-			return 0;
+			return lfb_set_resolution(((struct vid_size *)argp)->width, ((struct vid_size *)argp)->height);
 		case IO_VID_DRIVER:
 			validate(argp);
 			memcpy(argp, lfb_driver_name, strlen(lfb_driver_name));
 			return 0;
+		case IO_VID_CURSOR:
+			/* Set the cursor plane image */
+			validate(argp);
+			if (!lfb_cursor_image_impl) {
+				return -EINVAL;
+			}
+			return lfb_cursor_image_impl((struct vid_cursor *)argp);
+		case IO_VID_UPDATE:
+			/* Present a damaged framebuffer region */
+			validate(argp);
+			if (!lfb_update_impl) {
+				return -EINVAL;
+			}
+			return lfb_update_impl((struct vid_update *)argp);
+		case IO_VID_CURSOR_MOVE:
+			/* Move (or hide) the cursor plane */
+			validate(argp);
+			if (!lfb_cursor_move_impl) {
+				return -EINVAL;
+			}
+			return lfb_cursor_move_impl((struct vid_cursor_pos *)argp);
 		case IO_VID_REINIT:
 			if (current_process->user != 0) {
 				return -EPERM;
@@ -260,6 +301,23 @@ static struct procfs_entry framebuffer_entry = {
 	framebuffer_func,
 };
 
+/**
+ * Map a linear framebuffer with write-combining attributes.
+ *
+ * paging_install programs PAT entry 7 (selected by pat|pcd|pwt) to
+ * Write-Combining, so streaming blits to the LFB go through the WC
+ * buffers instead of taking an uncached bus cycle per pixel.
+ */
+static void lfb_map_wc(uintptr_t addr, size_t size) {
+	for (uintptr_t i = addr; i <= addr + size; i += 0x1000) {
+		page_t * p = get_page(i, 1, kernel_directory);
+		dma_frame(p, 0, 1, i);
+		p->pat = 1;
+		p->writethrough = 1;
+		p->cachedisable = 1;
+	}
+}
+
 /* Install framebuffer device */
 static void finalize_graphics(const char * driver) {
 	lfb_driver_name = driver;
@@ -341,14 +399,7 @@ static void graphics_install_bochs(uint16_t resolution_x, uint16_t resolution_y)
 	}
 
 	/* Enable the higher memory */
-	uintptr_t fb_offset = (uintptr_t)lfb_vid_memory;
-	for (uintptr_t i = fb_offset; i <= fb_offset + 0xFF0000; i += 0x1000) {
-		page_t * p = get_page(i, 1, kernel_directory);
-		dma_frame(p, 0, 1, i);
-		p->pat = 1;
-		p->writethrough = 1;
-		p->cachedisable = 1;
-	}
+	lfb_map_wc((uintptr_t)lfb_vid_memory, 0xFF0000);
 
 	outports(0x1CE, 0x0a);
 	i = inports(0x1CF);
@@ -358,9 +409,10 @@ static void graphics_install_bochs(uint16_t resolution_x, uint16_t resolution_y)
 		vid_memsize = inportl(0x1CF);
 	}
 	debug_print(WARNING, "Video memory size is 0x%x", vid_memsize);
-	for (uintptr_t i = (uintptr_t)lfb_vid_memory; i <= (uintptr_t)lfb_vid_memory + vid_memsize; i += 0x1000) {
-		dma_frame(get_page(i, 1, kernel_directory), 0, 1, i);
-	}
+	/* The full VRAM needs the same WC attributes as the visible pages,
+	 * or panning into the virtual height falls off the fast path. */
+	lfb_map_wc((uintptr_t)lfb_vid_memory, vid_memsize);
+	lfb_memsize = vid_memsize;
 
 	finalize_graphics("bochs");
 }
@@ -380,13 +432,7 @@ static void graphics_install_preset(uint16_t w, uint16_t h) {
 
 	debug_print(WARNING, "Mode was set by bootloader: %dx%d bpp should be 32, framebuffer is at 0x%x", w, h, (uintptr_t)lfb_vid_memory);
 
-	for (uintptr_t i = (uintptr_t)lfb_vid_memory; i <= (uintptr_t)lfb_vid_memory + w * h * 4; i += 0x1000) {
-		page_t * p = get_page(i, 1, kernel_directory);
-		dma_frame(p, 0, 1, i);
-		p->pat = 1;
-		p->writethrough = 1;
-		p->cachedisable = 1;
-	}
+	lfb_map_wc((uintptr_t)lfb_vid_memory, w * h * 4);
 	finalize_graphics("preset");
 }
 
@@ -421,13 +467,7 @@ mem_found:
 	lfb_resolution_s = w * 4;
 	lfb_resolution_b = 32;
 
-	for (uintptr_t i = (uintptr_t)lfb_vid_memory; i <= (uintptr_t)lfb_vid_memory + w * h * 4; i += 0x1000) {
-		page_t * p = get_page(i, 1, kernel_directory);
-		dma_frame(p, 0, 1, i);
-		p->pat = 1;
-		p->writethrough = 1;
-		p->cachedisable = 1;
-	}
+	lfb_map_wc((uintptr_t)lfb_vid_memory, w * h * 4);
 	finalize_graphics("kludge");
 }
 
@@ -443,6 +483,19 @@ mem_found:
 #define SVGA_REG_BITS_PER_PIXEL 7
 #define SVGA_REG_BYTES_PER_LINE 12
 #define SVGA_REG_FB_START 13
+#define SVGA_REG_MEM_START 18
+#define SVGA_REG_MEM_SIZE 19
+#define SVGA_REG_CONFIG_DONE 20
+#define SVGA_REG_SYNC 21
+#define SVGA_REG_BUSY 22
+
+#define SVGA_CMD_UPDATE 1
+
+/* Control words at the start of FIFO memory */
+#define SVGA_FIFO_MIN 0
+#define SVGA_FIFO_MAX 1
+#define SVGA_FIFO_NEXT_CMD 2
+#define SVGA_FIFO_STOP 3
 
 static uint32_t vmware_io = 0;
 
@@ -465,6 +518,64 @@ static uint32_t vmware_read(int reg) {
 	return inportl(SVGA_IO_MUL * SVGA_VALUE_PORT + SVGA_IO_BASE);
 }
 
+static volatile uint32_t * vmware_fifo = NULL;
+static spin_lock_t vmware_fifo_lock = { 0 };
+
+static void vmware_fifo_push(uint32_t word) {
+	volatile uint32_t * fifo = vmware_fifo;
+	uint32_t next = fifo[SVGA_FIFO_NEXT_CMD] + 4;
+	if (next >= fifo[SVGA_FIFO_MAX]) {
+		next = fifo[SVGA_FIFO_MIN];
+	}
+	while (next == fifo[SVGA_FIFO_STOP]) {
+		/* FIFO is full; kick the device and wait for it to drain */
+		vmware_write(SVGA_REG_SYNC, 1);
+		while (vmware_read(SVGA_REG_BUSY));
+	}
+	fifo[fifo[SVGA_FIFO_NEXT_CMD] / 4] = word;
+	fifo[SVGA_FIFO_NEXT_CMD] = next;
+}
+
+/* Queue an UPDATE command so the host presents just this rectangle
+ * instead of tracing every framebuffer write. */
+static int vmware_update_rect(struct vid_update * update) {
+	spin_lock(vmware_fifo_lock);
+	vmware_fifo_push(SVGA_CMD_UPDATE);
+	vmware_fifo_push(update->x);
+	vmware_fifo_push(update->y);
+	vmware_fifo_push(update->width);
+	vmware_fifo_push(update->height);
+	spin_unlock(vmware_fifo_lock);
+	return 0;
+}
+
+static void vmware_fifo_init(void) {
+	uint32_t fifo_phys = vmware_read(SVGA_REG_MEM_START);
+	uint32_t fifo_size = vmware_read(SVGA_REG_MEM_SIZE);
+
+	if (!fifo_phys || fifo_size <= 16) {
+		debug_print(WARNING, "vmware device has no usable FIFO; updates will be implicit");
+		return;
+	}
+
+	/* Device-visible control memory; identity map it uncached */
+	for (uintptr_t i = fifo_phys; i <= fifo_phys + fifo_size; i += 0x1000) {
+		page_t * p = get_page(i, 1, kernel_directory);
+		dma_frame(p, 0, 1, i);
+		p->cachedisable = 1;
+	}
+
+	vmware_fifo = (volatile uint32_t *)fifo_phys;
+	vmware_fifo[SVGA_FIFO_MIN] = 16;
+	vmware_fifo[SVGA_FIFO_MAX] = fifo_size;
+	vmware_fifo[SVGA_FIFO_NEXT_CMD] = 16;
+	vmware_fifo[SVGA_FIFO_STOP] = 16;
+	vmware_write(SVGA_REG_CONFIG_DONE, 1);
+
+	lfb_update_impl = &vmware_update_rect;
+	debug_print(WARNING, "vmware FIFO at 0x%x (0x%x bytes); accelerated updates enabled", fifo_phys, fifo_size);
+}
+
 static void vmware_set_resolution(uint16_t w, uint16_t h) {
 	vmware_write(SVGA_REG_ENABLE, 0);
 	vmware_write(SVGA_REG_ID, 0);
@@ -503,14 +614,10 @@ static void graphics_install_vmware(uint16_t w, uint16_t h) {
 
 	lfb_vid_memory = (uint8_t *)fb_addr;
 
-	uintptr_t fb_offset = (uintptr_t)lfb_vid_memory;
-	for (uintptr_t i = fb_offset; i <= fb_offset + fb_size; i += 0x1000) {
-		page_t * p = get_page(i, 1, kernel_directory);
-		dma_frame(p, 0, 1, i);
-		p->pat = 1;
-		p->writethrough = 1;
-		p->cachedisable = 1;
-	}
+	lfb_map_wc((uintptr_t)lfb_vid_memory, fb_size);
+	lfb_memsize = fb_size;
+
+	vmware_fifo_init();
 
 	finalize_graphics("vmware");
 }
@@ -21,7 +21,55 @@ static uint32_t _dns_server;
 static hashmap_t *_tcp_sockets = NULL;
 static hashmap_t *_udp_sockets = NULL;
 
-static void parse_dns_response(fs_node_t * tty, void * last_packet);
+struct udp_datagram {
+	uint32_t source_ip;
+	uint16_t source_port;
+	size_t   size;
+	uint8_t  data[];
+};
+
+static struct socket * _dns_socket = NULL;
+
+#define DNS_MAX_TTL      86400 /* Cap on how long we'll trust a record, in seconds */
+#define DNS_NEGATIVE_TTL 60    /* How long to remember a name that didn't resolve */
+
+struct dns_entry {
+	uint32_t addr;
+	unsigned long expires; /* timer_ticks deadline; 0 = pinned forever */
+	int negative;          /* The name didn't resolve; addr is meaningless */
+};
+
+static void dns_cache_store(char * name, uint32_t addr, uint32_t ttl, int negative) {
+	struct dns_entry * entry = malloc(sizeof(struct dns_entry));
+	entry->addr = addr;
+	if (ttl > DNS_MAX_TTL) ttl = DNS_MAX_TTL;
+	entry->expires = ttl ? (timer_ticks + ttl) : 0;
+	entry->negative = negative;
+	struct dns_entry * old = hashmap_set(dns_cache, name, entry);
+	if (old) free(old);
+}
+
+/**
+ * Consult the cache before going to the wire. Returns 1 on a live
+ * positive hit (filling *addr), -1 on a live negative hit, 0 on a
+ * miss. Expired entries are evicted on the way through.
+ */
+static int dns_cache_lookup(char * name, uint32_t * addr) {
+	struct dns_entry * entry = hashmap_get(dns_cache, name);
+	if (!entry) return 0;
+	if (entry->expires && timer_ticks > entry->expires) {
+		hashmap_remove(dns_cache, name);
+		free(entry);
+		return 0;
+	}
+	if (entry->negative) return -1;
+	*addr = entry->addr;
+	return 1;
+}
+
+static void parse_dns_response(fs_node_t * tty, void * dns_payload);
+static int net_send_ip(struct socket *socket, int proto, void * head, uint32_t head_size, void * payload, uint32_t payload_size);
+uint16_t next_ephemeral_port(void);
 static size_t write_dns_packet(uint8_t * buffer, size_t queries_len, uint8_t * queries);
 size_t write_dhcp_request(uint8_t * buffer, uint8_t * ip);
 static size_t write_arp_request(uint8_t * buffer, uint32_t ip);
@@ -30,7 +78,123 @@ static uint8_t _gateway[6] = {255,255,255,255,255,255};
 
 static struct netif _netif = {0};
 
+#define NEIGHBOR_TTL         600 /* Seconds a resolved entry stays fresh */
+#define NEIGHBOR_RETRY       1   /* Minimum seconds between ARP requests for one host */
+#define NEIGHBOR_PENDING_MAX 16  /* Frames parked per unresolved entry */
+
+/*
+ * Neighbor cache: one entry per next-hop IP. Frames for unresolved
+ * hops are parked on the entry and flushed when the ARP reply lands,
+ * so the steady-state send path is a single hash probe.
+ */
+struct neighbor {
+	uint32_t ip;
+	uint8_t  mac[6];
+	int      resolved;
+	unsigned long expires;   /* timer_ticks deadline on reachability */
+	unsigned long last_sent; /* Last time we asked, to rate-limit ARP */
+	list_t * pending;        /* struct pending_frames awaiting this answer */
+};
+
+struct pending_frame {
+	size_t size;
+	uint8_t data[]; /* Complete frame; destination patched at flush */
+};
+
+static hashmap_t * _neighbors = NULL;
+static spin_lock_t _neighbors_lock = { 0 };
+
+/* One-entry routing decision cache: most traffic goes to one place. */
+static uint32_t _route_last_dest = 0;
+static uint32_t _route_last_hop  = 0;
+
+static uint32_t net_route(uint32_t dest) {
+	if (dest == _route_last_dest && _route_last_hop) return _route_last_hop;
+	uint32_t hop;
+	if (_netif.netmask && !((dest ^ _netif.source) & _netif.netmask)) {
+		hop = dest; /* On our subnet; talk directly */
+	} else {
+		hop = _netif.gateway;
+	}
+	_route_last_dest = dest;
+	_route_last_hop  = hop;
+	return hop;
+}
+
+static void net_arp_ask(uint32_t ip) {
+	void * tmp = malloc(1024);
+	size_t packet_size = write_arp_request(tmp, ip);
+	_netif.send_packet(tmp, packet_size);
+	free(tmp);
+}
+
+/* Call with _neighbors_lock held. */
+static struct neighbor * neighbor_find(uint32_t ip) {
+	struct neighbor * n = hashmap_get(_neighbors, (void *)ip);
+	if (!n) {
+		n = malloc(sizeof(struct neighbor));
+		n->ip = ip;
+		n->resolved = 0;
+		n->expires = 0;
+		n->last_sent = 0;
+		n->pending = list_create();
+		hashmap_set(_neighbors, (void *)ip, n);
+	}
+	if (n->resolved && timer_ticks > n->expires) {
+		/* Stale; go ask again. */
+		n->resolved = 0;
+	}
+	return n;
+}
+
+static void neighbor_learn(uint32_t ip, uint8_t * mac) {
+	spin_lock(_neighbors_lock);
+	struct neighbor * n = neighbor_find(ip);
+	memcpy(n->mac, mac, 6);
+	n->resolved = 1;
+	n->expires = timer_ticks + NEIGHBOR_TTL;
+
+	/* Flush whatever was waiting on this answer. */
+	while (n->pending->length) {
+		node_t * node = list_dequeue(n->pending);
+		struct pending_frame * frame = node->value;
+		struct ethernet_packet * eth = (struct ethernet_packet *)frame->data;
+		memcpy(eth->destination, mac, 6);
+		spin_unlock(_neighbors_lock);
+		_netif.send_packet(frame->data, frame->size);
+		spin_lock(_neighbors_lock);
+		free(frame);
+		free(node);
+	}
+	spin_unlock(_neighbors_lock);
+}
+
 static int tasklet_pid = 0;
+static int rto_tasklet_pid = 0;
+
+#define UDP_QUEUE_MAX   64 /* Datagrams a UDP socket will hold before dropping */
+
+
+#define TCP_MAX_WINDOW  0x8000 /* Socket receive ring size; advertised window is its free space */
+#define TCP_LOW_WATER   (TCP_MAX_WINDOW / 4) /* Advertise a zero window below this much free space */
+#define TCP_OOO_MAX     32     /* Out-of-order segments held per socket before we drop */
+#define TCP_RTO_START   1      /* Initial retransmission timeout, seconds; doubles per retry */
+#define TCP_MAX_RETRIES 8      /* Retransmissions of a segment before the connection is dropped */
+#define TCP_MSS         1460   /* Ethernet MTU minus the IP and TCP headers */
+
+/* A retained copy of a sequence-space-consuming segment. Lives on the
+ * unacked list until the peer acknowledges it, or on the out-of-order
+ * reassembly queue until the gap before it is filled. */
+struct tcp_segment {
+	uint32_t seq;
+	uint32_t len;
+	uint16_t flags;
+	unsigned long sent_at; /* timer_ticks at last (re)transmission */
+	int retries;
+	uint8_t payload[];
+};
+
+static void tcp_rto_thread(void * arg);
 
 uint32_t get_primary_dns(void);
 
@@ -105,6 +269,11 @@ void init_netif_funcs(get_mac_func mac_func, get_packet_func get_func, send_pack
 		tasklet_pid = create_kernel_tasklet(net_handler, "[net]", NULL);
 		debug_print(NOTICE, "Network worker tasklet started with pid %d", tasklet_pid);
 	}
+
+	if (!rto_tasklet_pid) {
+		rto_tasklet_pid = create_kernel_tasklet(tcp_rto_thread, "[tcprto]", NULL);
+		debug_print(NOTICE, "TCP retransmission tasklet started with pid %d", rto_tasklet_pid);
+	}
 }
 
 struct netif * get_default_network_interface(void) {
@@ -151,67 +320,73 @@ void ip_ntoa(uint32_t src_addr, char * out) {
 		(src_addr & 0xFF));
 }
 
-uint16_t calculate_ipv4_checksum(struct ipv4_packet * p) {
-	uint32_t sum = 0;
-	uint16_t * s = (uint16_t *)p;
-
-	/* TODO: Checksums for options? */
-	for (int i = 0; i < 10; ++i) {
-		sum += ntohs(s[i]);
+/**
+ * One's-complement sum of a byte range, accumulated a 32-bit word at a
+ * time into a 64-bit total with the carries folded once at the end. The
+ * Internet checksum is endian-neutral, so the words are added in memory
+ * order and the caller swaps the folded result once instead of per
+ * word. `sum` chains ranges together; odd-length ranges only work as
+ * the final piece.
+ */
+static uint32_t checksum_partial(const void * data, size_t len, uint32_t sum) {
+	const uint8_t * p = data;
+	uint64_t acc = sum;
+
+	while (len >= 16) {
+		acc += *(const uint32_t *)(p + 0);
+		acc += *(const uint32_t *)(p + 4);
+		acc += *(const uint32_t *)(p + 8);
+		acc += *(const uint32_t *)(p + 12);
+		p += 16;
+		len -= 16;
 	}
-
-	if (sum > 0xFFFF) {
-		sum = (sum >> 16) + (sum & 0xFFFF);
+	while (len >= 4) {
+		acc += *(const uint32_t *)p;
+		p += 4;
+		len -= 4;
 	}
-
-	return ~(sum & 0xFFFF) & 0xFFFF;
-}
-
-uint16_t calculate_tcp_checksum(struct tcp_check_header * p, struct tcp_header * h, void * d, size_t payload_size) {
-	uint32_t sum = 0;
-	uint16_t * s = (uint16_t *)p;
-
-	/* TODO: Checksums for options? */
-	for (int i = 0; i < 6; ++i) {
-		sum += ntohs(s[i]);
-		if (sum > 0xFFFF) {
-			sum = (sum >> 16) + (sum & 0xFFFF);
-		}
+	if (len >= 2) {
+		acc += *(const uint16_t *)p;
+		p += 2;
+		len -= 2;
 	}
-
-	s = (uint16_t *)h;
-	for (int i = 0; i < 10; ++i) {
-		sum += ntohs(s[i]);
-		if (sum > 0xFFFF) {
-			sum = (sum >> 16) + (sum & 0xFFFF);
-		}
+	if (len) {
+		/* Trailing byte, padded with zero */
+		acc += *p;
 	}
 
-	uint16_t d_words = payload_size / 2;
-
-	s = (uint16_t *)d;
-	for (unsigned int i = 0; i < d_words; ++i) {
-		sum += ntohs(s[i]);
-		if (sum > 0xFFFF) {
-			sum = (sum >> 16) + (sum & 0xFFFF);
-		}
+	while (acc >> 16) {
+		acc = (acc & 0xFFFF) + (acc >> 16);
 	}
 
-	if (d_words * 2 != payload_size) {
-		uint8_t * t = (uint8_t *)d;
-		uint8_t tmp[2];
-		tmp[0] = t[d_words * sizeof(uint16_t)];
-		tmp[1] = 0;
+	return acc;
+}
+
+uint16_t calculate_ipv4_checksum(struct ipv4_packet * p) {
+	/* TODO: Checksums for options? */
+	return ~ntohs(checksum_partial(p, 20, 0)) & 0xFFFF;
+}
 
-		uint16_t * f = (uint16_t *)tmp;
+uint16_t calculate_tcp_checksum(struct tcp_check_header * p, struct tcp_header * h, void * d, size_t payload_size) {
+	/* TODO: Checksums for options? */
+	uint32_t sum = checksum_partial(p, sizeof(struct tcp_check_header), 0);
+	sum = checksum_partial(h, sizeof(struct tcp_header), sum);
+	sum = checksum_partial(d, payload_size, sum);
+	return ~ntohs(sum) & 0xFFFF;
+}
 
-		sum += ntohs(f[0]);
-		if (sum > 0xFFFF) {
-			sum = (sum >> 16) + (sum & 0xFFFF);
-		}
+/**
+ * Incrementally update a checksum after rewriting a single 16-bit
+ * header field (RFC 1624: HC' = ~(~HC + ~m + m')), so touching one
+ * field doesn't cost a pass over the whole header. All three values
+ * are in network order, as stored in the header.
+ */
+uint16_t checksum_update(uint16_t check, uint16_t old_field, uint16_t new_field) {
+	uint32_t sum = (uint16_t)~check + (uint16_t)~old_field + new_field;
+	while (sum >> 16) {
+		sum = (sum & 0xFFFF) + (sum >> 16);
 	}
-
-	return ~(sum & 0xFFFF) & 0xFFFF;
+	return ~sum & 0xFFFF;
 }
 
 static struct dirent * readdir_netfs(fs_node_t *node, uint32_t index) {
@@ -402,11 +577,11 @@ static void socket_alert_waiters(struct socket * sock) {
 static int socket_check(fs_node_t * node) {
 	struct socket * sock = node->device;
 
-	if (sock->bytes_available) {
+	if (ring_buffer_unread(sock->rx_ring) > 0) {
 		return 0;
 	}
 
-	if (sock->packet_queue->length > 0) {
+	if (sock->status == 1) {
 		return 0;
 	}
 
@@ -420,10 +595,64 @@ static int socket_wait(fs_node_t * node, void * process) {
 		list_insert(sock->alert_waiters, process);
 	}
 
-	list_insert(((process_t *)process)->node_waits, sock);
+	process_wait_node_insert((process_t *)process, sock);
+	return 0;
+}
+
+static struct socket * net_open_udp(void) {
+	struct socket * sock = net_open(SOCK_DGRAM);
+	sock->proto_sock.udp_socket.packets = list_create();
+	sock->proto_sock.udp_socket.packet_wait = list_create();
+	sock->alert_waiters = list_create();
+	return sock;
+}
+
+static int net_udp_bind(struct socket * sock, uint16_t port) {
+	if (hashmap_has(_udp_sockets, (void *)(uintptr_t)port)) {
+		return -EADDRINUSE;
+	}
+	hashmap_set(_udp_sockets, (void *)(uintptr_t)port, sock);
+	sock->port_recv = port;
 	return 0;
 }
 
+static int net_send_udp(struct socket * socket, uint32_t dest_ip, uint16_t dest_port, uint8_t * payload, size_t payload_size) {
+	if (!socket->port_recv) {
+		/* Unbound; sending binds us to an ephemeral port so the
+		 * response has somewhere to land. */
+		net_udp_bind(socket, next_ephemeral_port());
+	}
+
+	struct udp_packet udp;
+	udp.source_port = htons(socket->port_recv);
+	udp.destination_port = htons(dest_port);
+	udp.length = htons(sizeof(struct udp_packet) + payload_size);
+	udp.checksum = 0; /* Optional over IPv4 */
+
+	socket->ip = dest_ip;
+	return net_send_ip(socket, IPV4_PROT_UDP, &udp, sizeof(struct udp_packet), payload, payload_size);
+}
+
+/**
+ * Pull one datagram off a UDP socket, blocking until one arrives or
+ * the socket is closed (NULL). The caller owns the result.
+ */
+static struct udp_datagram * net_recv_udp(struct socket * socket) {
+	while (1) {
+		spin_lock(socket->packet_queue_lock);
+		if (socket->proto_sock.udp_socket.packets->length) {
+			node_t * n = list_dequeue(socket->proto_sock.udp_socket.packets);
+			spin_unlock(socket->packet_queue_lock);
+			struct udp_datagram * dgram = n->value;
+			free(n);
+			return dgram;
+		}
+		spin_unlock(socket->packet_queue_lock);
+		if (socket->status == 1) return NULL;
+		sleep_on(socket->proto_sock.udp_socket.packet_wait);
+	}
+}
+
 static uint32_t socket_read(fs_node_t * node, uint64_t offset, uint32_t size, uint8_t * buffer) {
 	/* Sleep until we have something to receive */
 #if 0
@@ -466,16 +695,158 @@ fs_node_t * socket_ipv4_tcp_create(uint32_t dest, uint16_t target_port, uint16_t
 
 }
 
+static uint32_t udp_socket_read(fs_node_t * node, uint64_t offset, uint32_t size, uint8_t * buffer) {
+	struct socket * socket = node->device;
+	struct udp_datagram * dgram = net_recv_udp(socket);
+	if (!dgram) return 0;
+	size_t out = MIN(size, dgram->size);
+	memcpy(buffer, dgram->data, out);
+	/* Datagram semantics: whatever didn't fit is gone. */
+	free(dgram);
+	return out;
+}
+
+static uint32_t udp_socket_write(fs_node_t * node, uint64_t offset, uint32_t size, uint8_t * buffer) {
+	struct socket * socket = node->device;
+	if (!socket->ip || !socket->port_dest) {
+		/* No peer on record; use sendto(). */
+		return -EINVAL;
+	}
+	net_send_udp(socket, socket->ip, socket->port_dest, buffer, size);
+	return size;
+}
+
+static int udp_socket_check(fs_node_t * node) {
+	struct socket * sock = node->device;
+
+	if (sock->proto_sock.udp_socket.packets->length) {
+		return 0;
+	}
+
+	if (sock->status == 1) {
+		return 0;
+	}
+
+	return 1;
+}
+
+static void udp_socket_close(fs_node_t * node) {
+	struct socket * sock = node->device;
+	sock->status = 1;
+	if (sock->port_recv) {
+		hashmap_remove(_udp_sockets, (void *)(uintptr_t)sock->port_recv);
+	}
+	wakeup_queue(sock->proto_sock.udp_socket.packet_wait);
+	socket_alert_waiters(sock);
+	spin_lock(sock->packet_queue_lock);
+	while (sock->proto_sock.udp_socket.packets->length) {
+		node_t * n = list_dequeue(sock->proto_sock.udp_socket.packets);
+		free(n->value);
+		free(n);
+	}
+	spin_unlock(sock->packet_queue_lock);
+}
+
+static fs_node_t * netsock_socket(int domain, int type, int protocol) {
+	if (domain != AF_INET) return NULL;
+	if (type != SOCK_DGRAM) return NULL; /* TCP still rides /dev/net/<host>:<port> */
+	if (!_udp_sockets) return NULL; /* Interface not up yet */
+
+	struct socket * sock = net_open_udp();
+
+	fs_node_t * fnode = malloc(sizeof(fs_node_t));
+	memset(fnode, 0x00, sizeof(fs_node_t));
+	strcpy(fnode->name, "[udp]");
+	fnode->mask = 0666;
+	fnode->flags   = FS_CHARDEVICE;
+	fnode->read    = udp_socket_read;
+	fnode->write   = udp_socket_write;
+	fnode->close   = udp_socket_close;
+	fnode->device  = sock;
+	fnode->selectcheck = udp_socket_check;
+	fnode->selectwait = socket_wait;
+	return fnode;
+}
+
+static int netsock_bind(fs_node_t * node, const struct sockaddr * addr, size_t addrlen) {
+	if (node->read != udp_socket_read) return -EINVAL;
+	if (!addr || addrlen < sizeof(struct sockaddr_in)) return -EINVAL;
+	struct socket * sock = node->device;
+	if (sock->port_recv) return -EINVAL; /* Already bound */
+
+	const struct sockaddr_in * sin = (const struct sockaddr_in *)addr;
+	uint16_t port = ntohs(sin->sin_port);
+	if (!port) port = next_ephemeral_port();
+
+	return net_udp_bind(sock, port);
+}
+
+static int netsock_sendto(fs_node_t * node, const void * buf, size_t len, const struct sockaddr * addr, size_t addrlen) {
+	if (node->read != udp_socket_read) return -EINVAL;
+	struct socket * sock = node->device;
+
+	uint32_t dest_ip;
+	uint16_t dest_port;
+	if (addr) {
+		if (addrlen < sizeof(struct sockaddr_in)) return -EINVAL;
+		const struct sockaddr_in * sin = (const struct sockaddr_in *)addr;
+		dest_ip = ntohl(sin->sin_addr.s_addr);
+		dest_port = ntohs(sin->sin_port);
+		/* Remember the peer so plain write() works afterwards. */
+		sock->port_dest = dest_port;
+	} else {
+		if (!sock->ip || !sock->port_dest) return -EINVAL;
+		dest_ip = sock->ip;
+		dest_port = sock->port_dest;
+	}
+
+	net_send_udp(sock, dest_ip, dest_port, (uint8_t *)buf, len);
+	return len;
+}
+
+static int netsock_recvfrom(fs_node_t * node, void * buf, size_t len, struct sockaddr * addr, size_t * addrlen) {
+	if (node->read != udp_socket_read) return -EINVAL;
+	struct socket * sock = node->device;
+
+	struct udp_datagram * dgram = net_recv_udp(sock);
+	if (!dgram) return 0;
+
+	size_t out = MIN(len, dgram->size);
+	memcpy(buf, dgram->data, out);
+
+	if (addr && addrlen && *addrlen >= sizeof(struct sockaddr_in)) {
+		struct sockaddr_in * sin = (struct sockaddr_in *)addr;
+		sin->sin_family = AF_INET;
+		sin->sin_port = htons(dgram->source_port);
+		sin->sin_addr.s_addr = htonl(dgram->source_ip);
+		memset(sin->sin_zero, 0, sizeof(sin->sin_zero));
+		*addrlen = sizeof(struct sockaddr_in);
+	}
+
+	free(dgram);
+	return out;
+}
+
+static struct netsock_ops udp_netsock_ops = {
+	.socket   = netsock_socket,
+	.bind     = netsock_bind,
+	.sendto   = netsock_sendto,
+	.recvfrom = netsock_recvfrom,
+};
+
 static int gethost(char * name, uint32_t * ip) {
 	if (is_ip(name)) {
 		debug_print(WARNING, "   IP: %x", ip_aton(name));
 		*ip = ip_aton(name);
 		return 0;
 	} else {
-		if (hashmap_has(dns_cache, name)) {
-			*ip = ip_aton(hashmap_get(dns_cache, name));
-			debug_print(WARNING, "   In Cache: %s → %x", name, ip);
+		int cached = dns_cache_lookup(name, ip);
+		if (cached == 1) {
+			debug_print(WARNING, "   In Cache: %s → %x", name, *ip);
 			return 0;
+		} else if (cached == -1) {
+			debug_print(WARNING, "   Negative cache hit: %s doesn't resolve", name);
+			return 1;
 		} else {
 			debug_print(WARNING, "   Not in cache: %s", name);
 			debug_print(WARNING, "   Still needs look up.");
@@ -503,17 +874,24 @@ static int gethost(char * name, uint32_t * ip) {
 			size_t packet_size = write_dns_packet(tmp, c + 4, (uint8_t *)queries);
 			free(queries);
 
-			_netif.send_packet(tmp, packet_size);
+			net_send_udp(_dns_socket, _dns_server, 53, tmp, packet_size);
 			free(tmp);
 
 			/* wait for response */
 			if (current_process->id != tasklet_pid) {
-				sleep_on(dns_waiters);
+				struct udp_datagram * dgram = net_recv_udp(_dns_socket);
+				if (dgram) {
+					parse_dns_response(debug_file, dgram->data);
+					free(dgram);
+				}
 			}
-			if (hashmap_has(dns_cache, name)) {
-				*ip = ip_aton(hashmap_get(dns_cache, name));
-				debug_print(WARNING, "   Now in cache: %s → %x", name, ip);
+			cached = dns_cache_lookup(name, ip);
+			if (cached == 1) {
+				debug_print(WARNING, "   Now in cache: %s → %x", name, *ip);
 				return 0;
+			} else if (cached == -1) {
+				debug_print(WARNING, "   Server says %s doesn't resolve", name);
+				return 1;
 			} else {
 				if (current_process->id == tasklet_pid) {
 					debug_print(WARNING, "Query hasn't returned yet, but we're in the network thread, so we need to yield.");
@@ -527,15 +905,32 @@ static int gethost(char * name, uint32_t * ip) {
 }
 
 static int net_send_tcp(struct socket *socket, uint16_t flags, uint8_t * payload, uint32_t payload_size);
+static void tcp_tx_flush(struct socket * socket);
 
 static void socket_close(fs_node_t * node) {
 	debug_print(WARNING, "Closing socket");
 	struct socket * sock = node->device;
 	if (sock->status == 1) return; /* already closed */
+	tcp_tx_flush(sock); /* Anything still coalesced goes out before the FIN */
 	net_send_tcp(sock, TCP_FLAGS_ACK | TCP_FLAGS_FIN, NULL, 0);
 	sock->status = 2;
 }
 
+static int ioctl_socket(fs_node_t * node, int request, void * argp) {
+	struct socket * sock = node->device;
+	switch (request) {
+		case 0x5001: {
+			/* TCP_NODELAY: disable Nagle coalescing for this socket. */
+			sock->proto_sock.tcp_socket.nodelay = argp ? !!*(int *)argp : 1;
+			if (sock->proto_sock.tcp_socket.nodelay) {
+				tcp_tx_flush(sock);
+			}
+			return 0;
+		}
+	}
+	return -1;
+}
+
 /* TODO: socket_close - TCP close; UDP... just clean us up */
 /* TODO: socket_open - idk, whatever */
 
@@ -565,6 +960,7 @@ static fs_node_t * finddir_netfs(fs_node_t * node, char * name) {
 	fnode->read    = socket_read;
 	fnode->write   = socket_write;
 	fnode->close   = socket_close;
+	fnode->ioctl   = ioctl_socket;
 	fnode->device  = (void *)net_open(SOCK_STREAM);
 	fnode->selectcheck = socket_check;
 	fnode->selectwait = socket_wait;
@@ -589,60 +985,12 @@ static int ioctl_netfs(fs_node_t * node, int request, void * argp) {
 	return 0;
 }
 
+/**
+ * Write just the DNS message; the UDP socket layer takes care of the
+ * ethernet/IP/UDP framing when this gets sent.
+ */
 static size_t write_dns_packet(uint8_t * buffer, size_t queries_len, uint8_t * queries) {
 	size_t offset = 0;
-	size_t payload_size = sizeof(struct dns_packet) + queries_len;
-
-	/* Then, let's write an ethernet frame */
-	struct ethernet_packet eth_out = {
-		.source = { _netif.hwaddr[0], _netif.hwaddr[1], _netif.hwaddr[2],
-		            _netif.hwaddr[3], _netif.hwaddr[4], _netif.hwaddr[5] },
-		.destination = BROADCAST_MAC,
-		.type = htons(0x0800),
-	};
-
-	memcpy(&buffer[offset], &eth_out, sizeof(struct ethernet_packet));
-	offset += sizeof(struct ethernet_packet);
-
-	/* Prepare the IPv4 header */
-	uint16_t _length = htons(sizeof(struct ipv4_packet) + sizeof(struct udp_packet) + payload_size);
-	uint16_t _ident  = htons(1);
-
-	struct ipv4_packet ipv4_out = {
-		.version_ihl = ((0x4 << 4) | (0x5 << 0)), /* 4 = ipv4, 5 = no options */
-		.dscp_ecn = 0, /* not setting either of those */
-		.length = _length,
-		.ident = _ident,
-		.flags_fragment = 0,
-		.ttl = 0x40,
-		.protocol = IPV4_PROT_UDP,
-		.checksum = 0, /* fill this in later */
-		.source = htonl(_netif.source),
-		.destination = htonl(_dns_server),
-	};
-
-	uint16_t checksum = calculate_ipv4_checksum(&ipv4_out);
-	ipv4_out.checksum = htons(checksum);
-
-	memcpy(&buffer[offset], &ipv4_out, sizeof(struct ipv4_packet));
-	offset += sizeof(struct ipv4_packet);
-
-	uint16_t _udp_source = htons(50053); /* Use an ephemeral port */
-	uint16_t _udp_destination = htons(53);
-	uint16_t _udp_length = htons(sizeof(struct udp_packet) + payload_size);
-
-	/* Now let's build a UDP packet */
-	struct udp_packet udp_out = {
-		.source_port = _udp_source,
-		.destination_port = _udp_destination,
-		.length = _udp_length,
-		.checksum = 0,
-	};
-
-	/* XXX calculate checksum here */
-
-	memcpy(&buffer[offset], &udp_out, sizeof(struct udp_packet));
-	offset += sizeof(struct udp_packet);
 
 	/* DNS header */
 	struct dns_packet dns_out = {
@@ -663,85 +1011,578 @@ static size_t write_dns_packet(uint8_t * buffer, size_t queries_len, uint8_t * q
 	return offset;
 }
 
-static int net_send_ether(struct socket *socket, struct netif* netif, uint16_t ether_type, void* payload, uint32_t payload_size) {
-	struct ethernet_packet *eth = malloc(sizeof(struct ethernet_packet) + payload_size);
-	memcpy(eth->source, netif->hwaddr, sizeof(eth->source));
-	//memset(eth->destination, 0xFF, sizeof(eth->destination));
-	memcpy(eth->destination, _gateway, sizeof(_gateway));
-	eth->type = htons(ether_type);
+/*
+ * Packet capture: /dev/pcap taps every frame the stack receives or
+ * transmits, runs it through an optional classic-BPF filter, and frames
+ * the survivors in standard pcap format so userspace can just
+ * `cp /dev/pcap trace.pcap` and open the result in wireshark. The taps
+ * cost one predicted-untaken branch per packet while nobody has the
+ * device open.
+ */
 
-	if (payload_size) {
-		memcpy(eth->payload, payload, payload_size);
+#define PCAP_SNAPLEN   2048
+#define PCAP_RING_SIZE 0x40000
+
+#define PCAP_MAGIC     0xa1b2c3d4
+#define PCAP_LINKTYPE_ETHERNET 1
+
+struct pcap_file_header {
+	uint32_t magic;
+	uint16_t version_major;
+	uint16_t version_minor;
+	int32_t  thiszone;
+	uint32_t sigfigs;
+	uint32_t snaplen;
+	uint32_t network;
+} __attribute__((packed));
+
+struct pcap_record_header {
+	uint32_t ts_sec;
+	uint32_t ts_usec;
+	uint32_t incl_len; /* bytes saved in the file */
+	uint32_t orig_len; /* bytes on the wire */
+} __attribute__((packed));
+
+/* Classic BPF instruction, same layout tcpdump -dd emits. */
+struct bpf_insn {
+	uint16_t code;
+	uint8_t  jt;
+	uint8_t  jf;
+	uint32_t k;
+};
+
+#define BPF_CLASS(code) ((code) & 0x07)
+#define   BPF_LD   0x00
+#define   BPF_LDX  0x01
+#define   BPF_ST   0x02
+#define   BPF_STX  0x03
+#define   BPF_ALU  0x04
+#define   BPF_JMP  0x05
+#define   BPF_RET  0x06
+#define   BPF_MISC 0x07
+#define BPF_SIZE(code) ((code) & 0x18)
+#define   BPF_W 0x00
+#define   BPF_H 0x08
+#define   BPF_B 0x10
+#define BPF_MODE(code) ((code) & 0xe0)
+#define   BPF_IMM 0x00
+#define   BPF_ABS 0x20
+#define   BPF_IND 0x40
+#define   BPF_MEM 0x60
+#define   BPF_LEN 0x80
+#define   BPF_MSH 0xa0
+#define BPF_OP(code) ((code) & 0xf0)
+#define   BPF_ADD 0x00
+#define   BPF_SUB 0x10
+#define   BPF_MUL 0x20
+#define   BPF_DIV 0x30
+#define   BPF_OR  0x40
+#define   BPF_AND 0x50
+#define   BPF_LSH 0x60
+#define   BPF_RSH 0x70
+#define   BPF_NEG 0x80
+#define   BPF_JA  0x00
+#define   BPF_JEQ 0x10
+#define   BPF_JGT 0x20
+#define   BPF_JGE 0x30
+#define   BPF_JSET 0x40
+#define BPF_SRC(code) ((code) & 0x08)
+#define   BPF_K 0x00
+#define   BPF_X 0x08
+#define BPF_RVAL(code) ((code) & 0x18)
+#define   BPF_A 0x10
+
+#define BPF_MEMWORDS 16
+#define BPF_MAXINSNS 256
+
+/* ioctl(fd, 0x5002, &args) on /dev/pcap: install (or clear) a filter. */
+struct pcap_filter_args {
+	uint32_t count;
+	struct bpf_insn * filter;
+};
+
+/* ioctl(fd, 0x5003, &stats) on /dev/pcap. */
+struct pcap_stats {
+	uint32_t captured; /* matched the filter and fit in the ring */
+	uint32_t dropped;  /* matched the filter but the ring was full */
+};
+
+static ring_buffer_t * pcap_ring = NULL;
+static volatile int pcap_active = 0;
+static int pcap_opens = 0;
+static spin_lock_t pcap_lock = { 0 };
+static uint32_t pcap_captured = 0;
+static uint32_t pcap_dropped = 0;
+static struct bpf_insn * pcap_prog = NULL;
+static int pcap_prog_len = 0;
+
+/*
+ * Run a classic BPF program over a captured frame. Returns the number
+ * of bytes to keep, 0 to reject. Out-of-range loads reject the packet,
+ * same as the canonical interpreter.
+ */
+static uint32_t bpf_run(struct bpf_insn * prog, int len, uint8_t * pkt, uint32_t caplen, uint32_t origlen) {
+	uint32_t A = 0, X = 0;
+	uint32_t M[BPF_MEMWORDS] = { 0 };
+
+	for (int pc = 0; pc < len; ++pc) {
+		struct bpf_insn * i = &prog[pc];
+		uint32_t k = i->k;
+		switch (BPF_CLASS(i->code)) {
+			case BPF_LD:
+				switch (BPF_MODE(i->code)) {
+					case BPF_IMM: A = k; break;
+					case BPF_LEN: A = origlen; break;
+					case BPF_MEM: A = M[k % BPF_MEMWORDS]; break;
+					case BPF_IND: k += X; /* fall through */
+					case BPF_ABS:
+						switch (BPF_SIZE(i->code)) {
+							case BPF_W:
+								if (k > caplen || caplen - k < 4) return 0;
+								A = (pkt[k] << 24) | (pkt[k+1] << 16) | (pkt[k+2] << 8) | pkt[k+3];
+								break;
+							case BPF_H:
+								if (k > caplen || caplen - k < 2) return 0;
+								A = (pkt[k] << 8) | pkt[k+1];
+								break;
+							case BPF_B:
+								if (k >= caplen) return 0;
+								A = pkt[k];
+								break;
+						}
+						break;
+					default: return 0;
+				}
+				break;
+			case BPF_LDX:
+				switch (BPF_MODE(i->code)) {
+					case BPF_IMM: X = k; break;
+					case BPF_LEN: X = origlen; break;
+					case BPF_MEM: X = M[k % BPF_MEMWORDS]; break;
+					case BPF_MSH: /* 4 * (ip header length) trick */
+						if (k >= caplen) return 0;
+						X = (pkt[k] & 0x0F) << 2;
+						break;
+					default: return 0;
+				}
+				break;
+			case BPF_ST:  M[k % BPF_MEMWORDS] = A; break;
+			case BPF_STX: M[k % BPF_MEMWORDS] = X; break;
+			case BPF_ALU: {
+				uint32_t src = (BPF_SRC(i->code) == BPF_X) ? X : k;
+				switch (BPF_OP(i->code)) {
+					case BPF_ADD: A += src; break;
+					case BPF_SUB: A -= src; break;
+					case BPF_MUL: A *= src; break;
+					case BPF_DIV: if (!src) return 0; A /= src; break;
+					case BPF_OR:  A |= src; break;
+					case BPF_AND: A &= src; break;
+					case BPF_LSH: A <<= (src & 31); break;
+					case BPF_RSH: A >>= (src & 31); break;
+					case BPF_NEG: A = -A; break;
+					default: return 0;
+				}
+				break;
+			}
+			case BPF_JMP: {
+				uint32_t src = (BPF_SRC(i->code) == BPF_X) ? X : k;
+				int taken;
+				switch (BPF_OP(i->code)) {
+					case BPF_JA: pc += k; continue;
+					case BPF_JEQ:  taken = (A == src); break;
+					case BPF_JGT:  taken = (A >  src); break;
+					case BPF_JGE:  taken = (A >= src); break;
+					case BPF_JSET: taken = !!(A & src); break;
+					default: return 0;
+				}
+				pc += taken ? i->jt : i->jf;
+				break;
+			}
+			case BPF_RET:
+				return (BPF_RVAL(i->code) == BPF_A) ? A : k;
+			case BPF_MISC:
+				if (BPF_OP(i->code) == 0x00) { X = A; }       /* TAX */
+				else if (BPF_OP(i->code) == 0x80) { A = X; }  /* TXA */
+				else return 0;
+				break;
+		}
 	}
 
-	netif->send_packet((uint8_t*)eth, sizeof(struct ethernet_packet) + payload_size);
+	return 0;
+}
 
-	free(eth);
+/*
+ * Sanity-check a filter before installing it: all jumps must land
+ * inside the program and every path must end in a RET. Anything the
+ * interpreter would reject at runtime (bad loads, divide by zero)
+ * just drops the packet, so we only need termination here.
+ */
+static int bpf_validate(struct bpf_insn * prog, int len) {
+	if (len < 1 || len > BPF_MAXINSNS) return 0;
+	for (int pc = 0; pc < len; ++pc) {
+		struct bpf_insn * i = &prog[pc];
+		if (BPF_CLASS(i->code) == BPF_JMP) {
+			if (BPF_OP(i->code) == BPF_JA) {
+				if (i->k >= (uint32_t)(len - pc - 1)) return 0;
+			} else {
+				if (pc + 1 + i->jt >= len) return 0;
+				if (pc + 1 + i->jf >= len) return 0;
+			}
+		}
+	}
+	if (BPF_CLASS(prog[len-1].code) != BPF_RET) return 0;
+	return 1;
+}
+
+/*
+ * Feed one frame to the capture ring. `caplen` is how much of it we can
+ * actually see (taps hand us at most PCAP_SNAPLEN bytes), `origlen` is
+ * what was on the wire. A full ring drops the record and counts it
+ * rather than stalling the stack.
+ */
+static void pcap_capture(uint8_t * frame, uint32_t caplen, uint32_t origlen) {
+	spin_lock(pcap_lock);
+
+	if (!pcap_active) {
+		spin_unlock(pcap_lock);
+		return;
+	}
+
+	uint32_t keep = caplen;
+	if (pcap_prog) {
+		uint32_t want = bpf_run(pcap_prog, pcap_prog_len, frame, caplen, origlen);
+		if (!want) {
+			spin_unlock(pcap_lock);
+			return;
+		}
+		if (want < keep) keep = want;
+	}
+
+	struct pcap_record_header rec;
+	rec.ts_sec   = now();
+	rec.ts_usec  = timer_subticks * 1000;
+	rec.incl_len = keep;
+	rec.orig_len = origlen;
+
+	if (ring_buffer_available(pcap_ring) < sizeof(rec) + keep) {
+		pcap_dropped++;
+		spin_unlock(pcap_lock);
+		return;
+	}
+
+	ring_buffer_write(pcap_ring, sizeof(rec), (uint8_t *)&rec);
+	ring_buffer_write(pcap_ring, keep, frame);
+	pcap_captured++;
+
+	spin_unlock(pcap_lock);
+}
+
+static uint32_t read_pcap(fs_node_t * node, uint64_t offset, uint32_t size, uint8_t * buffer) {
+	/* Stream semantics; the offset is meaningless. */
+	return ring_buffer_read(pcap_ring, size, buffer);
+}
+
+static int pcap_check(fs_node_t * node) {
+	return (ring_buffer_unread(pcap_ring) > 0) ? 0 : 1;
+}
+
+static int pcap_wait(fs_node_t * node, void * process) {
+	ring_buffer_select_wait(pcap_ring, process);
+	return 0;
+}
+
+static void open_pcap(fs_node_t * node, unsigned int flags) {
+	spin_lock(pcap_lock);
+	if (!pcap_opens++) {
+		/* First reader: drop whatever a previous session left behind
+		 * and start the stream with a fresh file header. */
+		uint8_t scratch[64];
+		while (ring_buffer_unread(pcap_ring)) {
+			ring_buffer_read(pcap_ring, sizeof(scratch), scratch);
+		}
+		pcap_captured = 0;
+		pcap_dropped = 0;
+		struct pcap_file_header hdr = {
+			.magic = PCAP_MAGIC,
+			.version_major = 2,
+			.version_minor = 4,
+			.thiszone = 0,
+			.sigfigs = 0,
+			.snaplen = PCAP_SNAPLEN,
+			.network = PCAP_LINKTYPE_ETHERNET,
+		};
+		ring_buffer_write(pcap_ring, sizeof(hdr), (uint8_t *)&hdr);
+		pcap_active = 1;
+	}
+	spin_unlock(pcap_lock);
+}
+
+static void close_pcap(fs_node_t * node) {
+	spin_lock(pcap_lock);
+	if (!--pcap_opens) {
+		pcap_active = 0;
+		if (pcap_prog) {
+			free(pcap_prog);
+			pcap_prog = NULL;
+			pcap_prog_len = 0;
+		}
+		debug_print(NOTICE, "pcap session over: %d captured, %d dropped", pcap_captured, pcap_dropped);
+	}
+	spin_unlock(pcap_lock);
+}
+
+static int ioctl_pcap(fs_node_t * node, int request, void * argp) {
+	switch (request) {
+		case 0x5002: {
+			/* Install a filter; count of 0 clears it. */
+			struct pcap_filter_args * args = argp;
+			struct bpf_insn * prog = NULL;
+			int len = 0;
+			if (args && args->count) {
+				if (!bpf_validate(args->filter, args->count)) return -EINVAL;
+				len = args->count;
+				prog = malloc(len * sizeof(struct bpf_insn));
+				memcpy(prog, args->filter, len * sizeof(struct bpf_insn));
+			}
+			spin_lock(pcap_lock);
+			struct bpf_insn * old = pcap_prog;
+			pcap_prog = prog;
+			pcap_prog_len = len;
+			spin_unlock(pcap_lock);
+			if (old) free(old);
+			return 0;
+		}
+		case 0x5003: {
+			struct pcap_stats * stats = argp;
+			if (!stats) return -EINVAL;
+			spin_lock(pcap_lock);
+			stats->captured = pcap_captured;
+			stats->dropped = pcap_dropped;
+			spin_unlock(pcap_lock);
+			return 0;
+		}
+	}
+	return -1;
+}
+
+static fs_node_t * pcap_create(void) {
+	pcap_ring = ring_buffer_create(PCAP_RING_SIZE);
+
+	fs_node_t * fnode = malloc(sizeof(fs_node_t));
+	memset(fnode, 0x00, sizeof(fs_node_t));
+	fnode->inode = 0;
+	strcpy(fnode->name, "pcap");
+	fnode->mask = 0600;
+	fnode->flags   = FS_CHARDEVICE;
+	fnode->open    = open_pcap;
+	fnode->close   = close_pcap;
+	fnode->read    = read_pcap;
+	fnode->ioctl   = ioctl_pcap;
+	fnode->selectcheck = pcap_check;
+	fnode->selectwait  = pcap_wait;
+	fnode->nlink   = 1;
+	return fnode;
+}
+
+static send_frags_func _send_frags = NULL;
+
+void net_install_sendv(send_frags_func send_frags) {
+	_send_frags = send_frags;
+}
+
+/**
+ * Hand a frame to the driver as a list of fragments. Drivers with
+ * scatter-gather transmit take them as-is; for the rest we coalesce
+ * into a single buffer here.
+ */
+static void net_sendv(struct netif_frag * frags, int count) {
+	if (__builtin_expect(pcap_active, 0)) {
+		/* The TX tap sees fragments; linearize up to the snap length
+		 * for the filter. Only paid while a capture is running. */
+		size_t total = 0;
+		for (int i = 0; i < count; ++i) {
+			total += frags[i].len;
+		}
+		uint8_t * snap = malloc(total > PCAP_SNAPLEN ? PCAP_SNAPLEN : total);
+		size_t offset = 0;
+		for (int i = 0; i < count && offset < PCAP_SNAPLEN; ++i) {
+			size_t chunk = frags[i].len;
+			if (offset + chunk > PCAP_SNAPLEN) chunk = PCAP_SNAPLEN - offset;
+			memcpy(snap + offset, frags[i].buf, chunk);
+			offset += chunk;
+		}
+		pcap_capture(snap, offset, total);
+		free(snap);
+	}
+
+	if (_send_frags) {
+		_send_frags(frags, count);
+		return;
+	}
+
+	size_t total = 0;
+	for (int i = 0; i < count; ++i) {
+		total += frags[i].len;
+	}
+
+	uint8_t * tmp = malloc(total);
+	size_t offset = 0;
+	for (int i = 0; i < count; ++i) {
+		memcpy(tmp + offset, frags[i].buf, frags[i].len);
+		offset += frags[i].len;
+	}
+
+	_netif.send_packet(tmp, total);
+	free(tmp);
+}
+
+#define NET_MAX_FRAGS 8
+
+static int net_send_ether(struct socket *socket, struct netif* netif, uint16_t ether_type, uint32_t dest_ip, struct netif_frag * frags, int count) {
+	struct ethernet_packet eth;
+	memcpy(eth.source, netif->hwaddr, sizeof(eth.source));
+	eth.type = htons(ether_type);
+
+	uint32_t payload_size = 0;
+	for (int i = 0; i < count; ++i) {
+		payload_size += frags[i].len;
+	}
+
+	uint32_t hop = dest_ip ? net_route(dest_ip) : 0;
+	if (!hop) {
+		/* No route yet (pre-DHCP); fall back on the old broadcast MAC. */
+		memcpy(eth.destination, _gateway, sizeof(_gateway));
+	} else {
+		spin_lock(_neighbors_lock);
+		struct neighbor * n = neighbor_find(hop);
+		if (n->resolved) {
+			memcpy(eth.destination, n->mac, sizeof(eth.destination));
+			spin_unlock(_neighbors_lock);
+		} else {
+			/* Park the frame on the entry and (re)ask for the MAC;
+			 * neighbor_learn() sends it when the reply arrives. This
+			 * is the one place the fragments get coalesced - the
+			 * caller's buffers do not outlive the call. */
+			if (n->pending->length < NEIGHBOR_PENDING_MAX) {
+				struct pending_frame * frame = malloc(sizeof(struct pending_frame) + sizeof(struct ethernet_packet) + payload_size);
+				frame->size = sizeof(struct ethernet_packet) + payload_size;
+				struct ethernet_packet * out = (struct ethernet_packet *)frame->data;
+				memcpy(out->source, netif->hwaddr, sizeof(out->source));
+				memcpy(out->destination, _gateway, sizeof(out->destination));
+				out->type = htons(ether_type);
+				size_t offset = 0;
+				for (int i = 0; i < count; ++i) {
+					memcpy(out->payload + offset, frags[i].buf, frags[i].len);
+					offset += frags[i].len;
+				}
+				list_insert(n->pending, frame);
+			}
+			int ask = (timer_ticks - n->last_sent >= NEIGHBOR_RETRY);
+			if (ask) n->last_sent = timer_ticks;
+			spin_unlock(_neighbors_lock);
+			if (ask) net_arp_ask(hop);
+			return 1;
+		}
+	}
+
+	/* The headers and the payload go down as separate fragments; no
+	 * coalescing copy unless the driver needs one. */
+	struct netif_frag out_frags[NET_MAX_FRAGS + 1];
+	out_frags[0].buf = (uint8_t *)&eth;
+	out_frags[0].len = sizeof(struct ethernet_packet);
+	int out_count = 1;
+	for (int i = 0; i < count && out_count <= NET_MAX_FRAGS; ++i) {
+		if (!frags[i].len) continue;
+		out_frags[out_count++] = frags[i];
+	}
+	net_sendv(out_frags, out_count);
 
 	return 1; // yolo
 }
 
-static int net_send_ip(struct socket *socket, int proto, void* payload, uint32_t payload_size) {
-	struct ipv4_packet *ipv4 = malloc(sizeof(struct ipv4_packet) + payload_size);
+/*
+ * Wrap a transport header and its payload in an IPv4 header and hand
+ * the three pieces down as fragments. Nothing is merged here; the
+ * transport header stays separate from the caller's payload buffer
+ * all the way to the driver.
+ */
+static int net_send_ip(struct socket *socket, int proto, void * head, uint32_t head_size, void * payload, uint32_t payload_size) {
+	struct ipv4_packet ipv4;
 
-	uint16_t _length = htons(sizeof(struct ipv4_packet) + payload_size);
+	uint16_t _length = htons(sizeof(struct ipv4_packet) + head_size + payload_size);
 	uint16_t _ident  = htons(1);
 
-	ipv4->version_ihl = ((0x4 << 4) | (0x5 << 0)); /* 4 = ipv4, 5 = no options */
-	ipv4->dscp_ecn = 0; /* not setting either of those */
-	ipv4->length = _length;
-	ipv4->ident = _ident;
-	ipv4->flags_fragment = 0;
-	ipv4->ttl = 0x40;
-	ipv4->protocol = proto;
-	ipv4->checksum = 0; // Fill in later */
-	ipv4->source = htonl(_netif.source),
-	ipv4->destination = htonl(socket->ip);
+	ipv4.version_ihl = ((0x4 << 4) | (0x5 << 0)); /* 4 = ipv4, 5 = no options */
+	ipv4.dscp_ecn = 0; /* not setting either of those */
+	ipv4.length = _length;
+	ipv4.ident = _ident;
+	ipv4.flags_fragment = 0;
+	ipv4.ttl = 0x40;
+	ipv4.protocol = proto;
+	ipv4.checksum = 0; // Fill in later */
+	ipv4.source = htonl(_netif.source),
+	ipv4.destination = htonl(socket->ip);
 
-	uint16_t checksum = calculate_ipv4_checksum(ipv4);
-	ipv4->checksum = htons(checksum);
+	uint16_t checksum = calculate_ipv4_checksum(&ipv4);
+	ipv4.checksum = htons(checksum);
 
 	if (proto == IPV4_PROT_TCP) {
 		// Need to calculate TCP checksum
 		struct tcp_check_header check_hd = {
-			.source = ipv4->source,
-			.destination = ipv4->destination,
+			.source = ipv4.source,
+			.destination = ipv4.destination,
 			.zeros = 0,
 			.protocol = 6,
-			.tcp_len = htons(payload_size),
+			.tcp_len = htons(head_size + payload_size),
 		};
 
-		// debug_print(WARNING, "net_send_ip: Payload size: %d\n", payload_size);
-		struct tcp_header* tcp_hdr = (struct tcp_header*)payload;
-		// debug_print(WARNING, "net_send_ip: Header len htons: %d\n", TCP_HEADER_LENGTH_FLIPPED(tcp_hdr));
-		size_t orig_payload_size = payload_size - TCP_HEADER_LENGTH_FLIPPED(tcp_hdr);
-
-		uint16_t chk = calculate_tcp_checksum(&check_hd, tcp_hdr, tcp_hdr->payload, orig_payload_size);
+		struct tcp_header* tcp_hdr = (struct tcp_header*)head;
+		uint16_t chk = calculate_tcp_checksum(&check_hd, tcp_hdr, payload, payload_size);
 		tcp_hdr->checksum = htons(chk);
 	}
 
-	if (payload) {
-		memcpy(ipv4->payload, payload, payload_size);
-		free(payload);
-	}
-
 	// TODO: netif should not be a global thing. But the route should be looked up here and a netif object created/returned
-	int out = net_send_ether(socket, &_netif, ETHERNET_TYPE_IPV4, ipv4, sizeof(struct ipv4_packet) + payload_size);
-	free(ipv4);
-	return out;
+	struct netif_frag frags[3] = {
+		{ (uint8_t *)&ipv4, sizeof(struct ipv4_packet) },
+		{ head, head_size },
+		{ payload, payload_size },
+	};
+	return net_send_ether(socket, &_netif, ETHERNET_TYPE_IPV4, socket->ip, frags, payload_size ? 3 : 2);
 }
 
-static int net_send_tcp(struct socket *socket, uint16_t flags, uint8_t * payload, uint32_t payload_size) {
-	struct tcp_header *tcp = malloc(sizeof(struct tcp_header) + payload_size);
+/**
+ * How much more data we can buffer for this socket; advertised to the
+ * peer so it stops sending before the receive ring overflows. Below
+ * the low watermark we advertise zero rather than dribble out tiny
+ * windows - the reader reopens it once it has drained some room.
+ */
+static uint16_t tcp_rx_window(struct socket * socket) {
+	size_t avail = ring_buffer_available(socket->rx_ring);
+	if (avail < TCP_LOW_WATER) return 0;
+	return (avail > TCP_MAX_WINDOW) ? TCP_MAX_WINDOW : avail;
+}
+
+/**
+ * Emit a single TCP segment with an explicit sequence number. Does not
+ * touch seq_no, so the retransmission path can resend old segments.
+ */
+static int net_send_tcp_segment(struct socket *socket, uint16_t flags, uint32_t seq, uint8_t * payload, uint32_t payload_size) {
+	struct tcp_header tcp;
+
+	tcp.source_port = htons(socket->port_recv);
+	tcp.destination_port = htons(socket->port_dest);
+	tcp.seq_number = htonl(seq);
+	tcp.ack_number = flags & (TCP_FLAGS_ACK) ? htonl(socket->proto_sock.tcp_socket.ack_no) : 0;
+	tcp.flags = htons(0x5000 ^ (flags & 0xFF));
+	tcp.window_size = htons(tcp_rx_window(socket));
+	tcp.checksum = 0; // Fill in later
+	tcp.urgent = 0;
+
+	return net_send_ip(socket, IPV4_PROT_TCP, &tcp, sizeof(struct tcp_header), payload, payload_size);
+}
 
-	tcp->source_port = htons(socket->port_recv);
-	tcp->destination_port = htons(socket->port_dest);
-	tcp->seq_number = htonl(socket->proto_sock.tcp_socket.seq_no);
-	tcp->ack_number = flags & (TCP_FLAGS_ACK) ? htonl(socket->proto_sock.tcp_socket.ack_no) : 0;
-	tcp->flags = htons(0x5000 ^ (flags & 0xFF));
-	tcp->window_size = htons(1548-54);
-	tcp->checksum = 0; // Fill in later
-	tcp->urgent = 0;
+static int net_send_tcp(struct socket *socket, uint16_t flags, uint8_t * payload, uint32_t payload_size) {
+	uint32_t seq = socket->proto_sock.tcp_socket.seq_no;
 
 	if ((flags & 0xff) == TCP_FLAGS_SYN) {
 		// If only SYN set, expected ACK will be 1 despite no payload
@@ -750,11 +1591,204 @@ static int net_send_tcp(struct socket *socket, uint16_t flags, uint8_t * payload
 		socket->proto_sock.tcp_socket.seq_no += payload_size;
 	}
 
-	if (payload) {
-		memcpy(tcp->payload, payload, payload_size);
+	/* Retain a copy of anything that consumes sequence space so the
+	 * retransmission thread can resend it if it goes unacknowledged. */
+	if (socket->proto_sock.tcp_socket.unacked &&
+		(payload_size || (flags & (TCP_FLAGS_SYN | TCP_FLAGS_FIN)))) {
+		struct tcp_segment * seg = malloc(sizeof(struct tcp_segment) + payload_size);
+		seg->seq = seq;
+		seg->len = payload_size;
+		seg->flags = flags;
+		seg->sent_at = timer_ticks;
+		seg->retries = 0;
+		if (payload_size) {
+			memcpy(seg->payload, payload, payload_size);
+		}
+		spin_lock(socket->packet_queue_lock);
+		list_insert(socket->proto_sock.tcp_socket.unacked, seg);
+		spin_unlock(socket->packet_queue_lock);
+	}
+
+	return net_send_tcp_segment(socket, flags, seq, payload, payload_size);
+}
+
+static int tcp_in_flight(struct socket * socket) {
+	list_t * unacked = socket->proto_sock.tcp_socket.unacked;
+	if (!unacked) return 0;
+	spin_lock(socket->packet_queue_lock);
+	int out = unacked->length > 0;
+	spin_unlock(socket->packet_queue_lock);
+	return out;
+}
+
+/**
+ * Send whatever is sitting in the coalescing buffer as one segment.
+ */
+static void tcp_tx_flush(struct socket * socket) {
+	struct tcp_socket * tcp = &socket->proto_sock.tcp_socket;
+	if (!tcp->tx_buf) return;
+
+	spin_lock(socket->tx_lock);
+	size_t len = tcp->tx_len;
+	if (!len) {
+		spin_unlock(socket->tx_lock);
+		return;
+	}
+	/* Copy out under the lock so a concurrent writer can't scribble on
+	 * the segment while the driver is looking at it. */
+	uint8_t * chunk = malloc(len);
+	memcpy(chunk, tcp->tx_buf, len);
+	tcp->tx_len = 0;
+	spin_unlock(socket->tx_lock);
+
+	net_send_tcp(socket, TCP_FLAGS_ACK | TCP_FLAGS_PSH, chunk, len);
+	free(chunk);
+}
+
+/**
+ * Acknowledge received data. If a coalesced write is waiting for Nagle
+ * clearance, the ACK rides on it instead of going out as an empty
+ * segment.
+ */
+static void tcp_send_ack(struct socket * socket) {
+	struct tcp_socket * tcp = &socket->proto_sock.tcp_socket;
+	if (tcp->tx_buf && tcp->tx_len) {
+		tcp_tx_flush(socket);
+		return;
+	}
+	net_send_tcp(socket, TCP_FLAGS_ACK, NULL, 0);
+}
+
+/**
+ * Drop everything the peer has acknowledged from the unacked list.
+ */
+static void tcp_process_ack(struct socket * socket, uint32_t ack) {
+	list_t * unacked = socket->proto_sock.tcp_socket.unacked;
+	if (!unacked) return;
+	spin_lock(socket->packet_queue_lock);
+	while (unacked->length) {
+		struct tcp_segment * seg = unacked->head->value;
+		uint32_t seg_end = seg->seq + seg->len + ((seg->flags & (TCP_FLAGS_SYN | TCP_FLAGS_FIN)) ? 1 : 0);
+		if ((int32_t)(ack - seg_end) < 0) break;
+		node_t * n = list_dequeue(unacked);
+		free(n->value);
+		free(n);
+	}
+	spin_unlock(socket->packet_queue_lock);
+}
+
+/**
+ * Copy received payload into the socket's receive ring, where it waits
+ * for a userspace recv(). The caller has already checked that the ring
+ * has room - we never advertise a window bigger than our free space,
+ * so a cooperating peer can't overrun it, and anything beyond it gets
+ * dropped for the retransmit to deliver.
+ */
+static void tcp_deliver(struct socket * socket, uint8_t * payload, size_t size) {
+	ring_buffer_write(socket->rx_ring, size, payload);
+}
+
+/**
+ * Stash a segment that arrived ahead of ack_no for later reassembly.
+ * The queue is small and unsorted; the drain pass scans it.
+ */
+static void tcp_ooo_insert(struct socket * socket, uint32_t seq, uint8_t * payload, uint32_t len) {
+	list_t * queue = socket->proto_sock.tcp_socket.ooo_queue;
+	if (!queue || queue->length >= TCP_OOO_MAX) return;
+	foreach(n, queue) {
+		struct tcp_segment * seg = n->value;
+		if (seg->seq == seq) return; /* retransmit of something we already hold */
+	}
+	struct tcp_segment * seg = malloc(sizeof(struct tcp_segment) + len);
+	seg->seq = seq;
+	seg->len = len;
+	seg->flags = 0;
+	seg->sent_at = 0;
+	seg->retries = 0;
+	memcpy(seg->payload, payload, len);
+	list_insert(queue, seg);
+}
+
+/**
+ * Deliver queued segments that have become contiguous with ack_no.
+ */
+static void tcp_ooo_drain(struct socket * socket) {
+	list_t * queue = socket->proto_sock.tcp_socket.ooo_queue;
+	if (!queue) return;
+	int progressed = 1;
+	while (progressed) {
+		progressed = 0;
+		foreach(n, queue) {
+			struct tcp_segment * seg = n->value;
+			if (seg->seq == socket->proto_sock.tcp_socket.ack_no) {
+				if (ring_buffer_available(socket->rx_ring) < seg->len) {
+					/* No room; keep it queued and wait for the
+					 * retransmit to drive another drain pass. */
+					return;
+				}
+				tcp_deliver(socket, seg->payload, seg->len);
+				socket->proto_sock.tcp_socket.ack_no = seg->seq + seg->len;
+				list_delete(queue, n);
+				free(seg);
+				free(n);
+				progressed = 1;
+				break;
+			}
+			if ((int32_t)(socket->proto_sock.tcp_socket.ack_no - (seg->seq + seg->len)) >= 0) {
+				/* Entirely behind us now; drop it. */
+				list_delete(queue, n);
+				free(seg);
+				free(n);
+				progressed = 1;
+				break;
+			}
+		}
 	}
+}
+
+/**
+ * Retransmission timer. Checks the oldest unacknowledged segment of
+ * every TCP socket once a second and resends it when its timeout (one
+ * second, doubling per retry) has elapsed; gives up on the connection
+ * after TCP_MAX_RETRIES attempts.
+ */
+static void tcp_rto_thread(void * arg) {
+	while (1) {
+		unsigned long s, ss;
+		relative_time(TCP_RTO_START, 0, &s, &ss);
+		sleep_until((process_t *)current_process, s, ss);
+		switch_task(0);
 
-	return net_send_ip(socket, IPV4_PROT_TCP, tcp, sizeof(struct tcp_header) + payload_size);
+		if (!_tcp_sockets) continue;
+
+		list_t * sockets = hashmap_values(_tcp_sockets);
+		foreach(n, sockets) {
+			struct socket * socket = n->value;
+			struct tcp_socket * tcp = &socket->proto_sock.tcp_socket;
+			if (socket->status == 1 || !tcp->unacked) continue;
+
+			spin_lock(socket->packet_queue_lock);
+			if (tcp->unacked->length) {
+				struct tcp_segment * seg = tcp->unacked->head->value;
+				int backoff = (seg->retries > 5) ? 5 : seg->retries;
+				if (timer_ticks - seg->sent_at >= (unsigned long)(TCP_RTO_START << backoff)) {
+					if (seg->retries >= TCP_MAX_RETRIES) {
+						debug_print(WARNING, "tcp: seq %d dead after %d retries, closing socket", seg->seq, seg->retries);
+						spin_unlock(socket->packet_queue_lock);
+						net_close(socket);
+						continue;
+					}
+					seg->retries++;
+					seg->sent_at = timer_ticks;
+					debug_print(WARNING, "tcp: retransmitting seq %d (%d bytes, attempt %d)", seg->seq, seg->len, seg->retries);
+					net_send_tcp_segment(socket, seg->flags, seg->seq, seg->len ? seg->payload : NULL, seg->len);
+				}
+			}
+			spin_unlock(socket->packet_queue_lock);
+		}
+		list_free(sockets);
+		free(sockets);
+	}
 }
 
 struct socket* net_open(uint32_t type) {
@@ -769,77 +1803,118 @@ struct socket* net_open(uint32_t type) {
 int net_close(struct socket* socket) {
 	// socket->is_connected;
 	socket->status = 1; /* Disconnected */
-	wakeup_queue(socket->packet_wait);
+	ring_buffer_interrupt(socket->rx_ring);
 	socket_alert_waiters(socket);
 	return 1;
 }
 
-int net_send(struct socket* socket, uint8_t* payload, size_t payload_size, int flags) {
-	return net_send_tcp(socket, TCP_FLAGS_ACK | TCP_FLAGS_PSH, payload, payload_size);
+/*
+ * Dump per-socket buffer levels to a TTY. The debug shell calls this
+ * through the module symbol table (see net-sockets there), so it does
+ * not have to depend on the network stack being loaded.
+ */
+void net_socket_stats_dump(fs_node_t * tty) {
+	if (_tcp_sockets) {
+		list_t * keys = hashmap_keys(_tcp_sockets);
+		foreach(_key, keys) {
+			struct socket * sock = hashmap_get(_tcp_sockets, _key->value);
+			if (!sock) continue;
+			struct tcp_socket * tcp = &sock->proto_sock.tcp_socket;
+			fprintf(tty, "tcp %d -> %d status %d rx %d/%d tx pending %d unacked %d ooo %d\n",
+					sock->port_recv, sock->port_dest, sock->status,
+					ring_buffer_unread(sock->rx_ring), sock->rx_ring->size,
+					tcp->tx_len,
+					tcp->unacked ? (int)tcp->unacked->length : 0,
+					tcp->ooo_queue ? (int)tcp->ooo_queue->length : 0);
+		}
+		list_free(keys);
+		free(keys);
+	}
+	if (_udp_sockets) {
+		list_t * keys = hashmap_keys(_udp_sockets);
+		foreach(_key, keys) {
+			struct socket * sock = hashmap_get(_udp_sockets, _key->value);
+			if (!sock) continue;
+			fprintf(tty, "udp %d queued datagrams %d\n",
+					sock->port_recv,
+					sock->proto_sock.udp_socket.packets ? (int)sock->proto_sock.udp_socket.packets->length : 0);
+		}
+		list_free(keys);
+		free(keys);
+	}
 }
 
-size_t net_recv(struct socket* socket, uint8_t* buffer, size_t len) {
-	tcpdata_t *tcpdata = NULL;
-	node_t *node = NULL;
-
-	debug_print(INFO, "0x%x [socket]", socket);
-
-	size_t offset = 0;
-	size_t size_to_read = 0;
+/**
+ * Queue stream data for transmission. Full segments go straight out;
+ * short tails are coalesced in the socket's transmit buffer and only
+ * sent immediately when nothing is in flight (or the socket has opted
+ * out with TCP_NODELAY) - otherwise they wait for more data, an ACK,
+ * or a piggyback opportunity, so a run of small writes costs one
+ * segment instead of one per write.
+ */
+int net_send(struct socket* socket, uint8_t* payload, size_t payload_size, int flags) {
+	struct tcp_socket * tcp = &socket->proto_sock.tcp_socket;
+	size_t total = payload_size;
 
-	do {
+	if (!tcp->tx_buf) {
+		return net_send_tcp(socket, TCP_FLAGS_ACK | TCP_FLAGS_PSH, payload, payload_size);
+	}
 
-	if (socket->bytes_available) {
-		tcpdata = socket->current_packet;
+	/* Anything already pending has to go first to keep the stream in
+	 * order; if this write tops it up to a full segment, flush now. */
+	spin_lock(socket->tx_lock);
+	if (tcp->tx_len && tcp->tx_len + payload_size >= TCP_MSS) {
+		size_t take = TCP_MSS - tcp->tx_len;
+		memcpy(tcp->tx_buf + tcp->tx_len, payload, take);
+		tcp->tx_len = TCP_MSS;
+		payload += take;
+		payload_size -= take;
+		spin_unlock(socket->tx_lock);
+		tcp_tx_flush(socket);
 	} else {
-		spin_lock(socket->packet_queue_lock);
-		do {
-			if (socket->packet_queue->length > 0) {
-				node = list_dequeue(socket->packet_queue);
-				spin_unlock(socket->packet_queue_lock);
-				break;
-			} else {
-				if (socket->status == 1) {
-					spin_unlock(socket->packet_queue_lock);
-					debug_print(WARNING, "Socket closed, done reading.");
-					return 0;
-				}
-				spin_unlock(socket->packet_queue_lock);
-				sleep_on(socket->packet_wait);
-				spin_lock(socket->packet_queue_lock);
-			}
-		} while (1);
+		spin_unlock(socket->tx_lock);
+	}
 
-		tcpdata = node->value;
-		socket->bytes_available = tcpdata->payload_size;
-		socket->bytes_read = 0;
-		free(node);
+	/* Full segments bypass the coalescing buffer entirely. */
+	while (payload_size >= TCP_MSS) {
+		net_send_tcp(socket, TCP_FLAGS_ACK | TCP_FLAGS_PSH, payload, TCP_MSS);
+		payload += TCP_MSS;
+		payload_size -= TCP_MSS;
 	}
 
-	size_to_read = MIN(len, socket->bytes_available);
+	if (payload_size) {
+		spin_lock(socket->tx_lock);
+		memcpy(tcp->tx_buf + tcp->tx_len, payload, payload_size);
+		tcp->tx_len += payload_size;
+		spin_unlock(socket->tx_lock);
 
-	if (tcpdata->payload != 0) {
-		memcpy(buffer + offset, tcpdata->payload + socket->bytes_read, size_to_read);
+		if (tcp->nodelay || !tcp_in_flight(socket)) {
+			tcp_tx_flush(socket);
+		}
 	}
 
-	offset += size_to_read;
+	return total;
+}
 
-	if (size_to_read < socket->bytes_available) {
-		socket->bytes_available -= size_to_read;
-		socket->bytes_read += size_to_read;
-		socket->current_packet = tcpdata;
-	} else {
-		socket->bytes_available = 0;
-		socket->current_packet = NULL;
-		free(tcpdata->payload);
-		free(tcpdata);
+size_t net_recv(struct socket* socket, uint8_t* buffer, size_t len) {
+	debug_print(INFO, "0x%x [socket]", socket);
+
+	if (socket->status == 1 && !ring_buffer_unread(socket->rx_ring)) {
+		debug_print(WARNING, "Socket closed, done reading.");
+		return 0;
 	}
 
+	uint16_t window_before = tcp_rx_window(socket);
 
-	} while (!size_to_read);
+	size_t collected = ring_buffer_read(socket->rx_ring, len, buffer);
 
+	/* If we had the receive window closed, reopening it is news the
+	 * peer is waiting on - send a window update. */
+	if (socket->status != 1 && window_before == 0 && tcp_rx_window(socket) > 0) {
+		tcp_send_ack(socket);
+	}
 
-	return size_to_read;
+	return collected;
 }
 
 static void net_handle_tcp(struct tcp_header * tcp, size_t length) {
@@ -868,11 +1943,14 @@ static void net_handle_tcp(struct tcp_header * tcp, size_t length) {
 			return;
 		}
 
-		if (socket->proto_sock.tcp_socket.seq_no != ntohl(tcp->ack_number)) {
-			// Drop packet
-			debug_print(WARNING, "Dropping packet. Expected ack: %d | Got ack: %d",
-					socket->proto_sock.tcp_socket.seq_no, ntohl(tcp->ack_number));
-			return;
+		if (htons(tcp->flags) & TCP_FLAGS_ACK) {
+			/* Retire whatever this acknowledges from the retransmit
+			 * queue; if that empties it, release any coalesced write
+			 * that Nagle was holding back. */
+			tcp_process_ack(socket, ntohl(tcp->ack_number));
+			if (!tcp_in_flight(socket)) {
+				tcp_tx_flush(socket);
+			}
 		}
 
 		if ((htons(tcp->flags) & TCP_FLAGS_SYN) && (htons(tcp->flags) & TCP_FLAGS_ACK)) {
@@ -885,56 +1963,56 @@ static void net_handle_tcp(struct tcp_header * tcp, size_t length) {
 			net_close(socket);
 			return;
 		} else {
-			// Store a copy of the layer 5 data for a userspace recv() call
-			tcpdata_t *tcpdata = malloc(sizeof(tcpdata_t));
-			tcpdata->payload_size = length - TCP_HEADER_LENGTH_FLIPPED(tcp);
+			uint32_t seg_seq = ntohl(tcp->seq_number);
 
-			if (tcpdata->payload_size == 0) {
+			if (data_length == 0) {
 				if (htons(tcp->flags) & TCP_FLAGS_FIN) {
 					/* We should make sure we finish sending before closing. */
 					debug_print(WARNING, "net_handle_tcp: Received FIN - socket closing with SYNACK");
-					socket->proto_sock.tcp_socket.ack_no = ntohl(tcp->seq_number) + data_length + 1;
+					socket->proto_sock.tcp_socket.ack_no = seg_seq + 1;
 					net_send_tcp(socket, TCP_FLAGS_ACK | TCP_FLAGS_FIN, NULL, 0);
 					wakeup_queue(socket->proto_sock.tcp_socket.is_connected);
 					net_close(socket);
 				}
-				free(tcpdata);
 				return;
 			}
 
-			// debug_print(WARNING, "net_handle_tcp: payload length: %d\n",  length);
-			// debug_print(WARNING, "net_handle_tcp: flipped tcp flags hdr len: %d\n",  TCP_HEADER_LENGTH_FLIPPED(tcp));
-			// debug_print(WARNING, "net_handle_tcp: tcpdata->payload_size: %d\n", tcpdata->payload_size);
-
-			if (tcpdata->payload_size > 0) {
-				tcpdata->payload = malloc(tcpdata->payload_size);
-				memcpy(tcpdata->payload, tcp->payload, tcpdata->payload_size);
-			} else {
-				tcpdata->payload = NULL;
+			if (seg_seq != socket->proto_sock.tcp_socket.ack_no) {
+				/* Not the segment we're waiting for. If it's ahead of us
+				 * and within the window, hold it for reassembly instead
+				 * of forcing the peer to resend the whole run; either
+				 * way, re-advertise what we expect (a duplicate ACK). */
+				if ((int32_t)(seg_seq - socket->proto_sock.tcp_socket.ack_no) > 0 &&
+					(uint32_t)(seg_seq - socket->proto_sock.tcp_socket.ack_no) < TCP_MAX_WINDOW) {
+					tcp_ooo_insert(socket, seg_seq, tcp->payload, data_length);
+				}
+				tcp_send_ack(socket);
+				return;
 			}
 
-			socket->proto_sock.tcp_socket.ack_no = ntohl(tcp->seq_number) + data_length;
-
-			if ((htons(tcp->flags) & TCP_FLAGS_SYN) && (htons(tcp->flags) & TCP_FLAGS_ACK) && data_length == 0) {
-				socket->proto_sock.tcp_socket.ack_no += 1;
+			if (ring_buffer_available(socket->rx_ring) < data_length) {
+				/* The ring is full - the reader has fallen behind.
+				 * Drop the segment without acknowledging it; the
+				 * retransmit will find room once recv() drains us,
+				 * and the zero window tells the peer to back off. */
+				tcp_send_ack(socket);
+				return;
 			}
 
-			socket->proto_sock.tcp_socket.ack_no = ntohl(tcp->seq_number) + tcpdata->payload_size;
+			tcp_deliver(socket, tcp->payload, data_length);
+			socket->proto_sock.tcp_socket.ack_no = seg_seq + data_length;
 
-			spin_lock(socket->packet_queue_lock);
-			list_insert(socket->packet_queue, tcpdata);
-			spin_unlock(socket->packet_queue_lock);
-
-			// Send acknowledgement of receiving data
-			net_send_tcp(socket, TCP_FLAGS_ACK, NULL, 0);
+			/* Pull in anything now contiguous from the reassembly
+			 * queue, then acknowledge the whole run at once. */
+			tcp_ooo_drain(socket);
+			tcp_send_ack(socket);
 
-			wakeup_queue(socket->packet_wait);
 			socket_alert_waiters(socket);
 
 			if (htons(tcp->flags) & TCP_FLAGS_FIN) {
 				/* We should make sure we finish sending before closing. */
 				debug_print(WARNING, "net_handle_tcp: Received FIN - socket closing with SYNACK");
-				socket->proto_sock.tcp_socket.ack_no = ntohl(tcp->seq_number) + data_length + 1;
+				socket->proto_sock.tcp_socket.ack_no += 1;
 				net_send_tcp(socket, TCP_FLAGS_ACK | TCP_FLAGS_FIN, NULL, 0);
 				wakeup_queue(socket->proto_sock.tcp_socket.is_connected);
 				net_close(socket);
@@ -945,17 +2023,7 @@ static void net_handle_tcp(struct tcp_header * tcp, size_t length) {
 	}
 }
 
-static void net_handle_udp(struct udp_packet * udp, size_t length) {
-
-	// size_t data_length = length - sizeof(struct tcp_header);
-	debug_print(WARNING, "UDP response!");
-
-	/* Short-circuit DNS */
-	if (ntohs(udp->source_port) == 53) {
-		debug_print(WARNING, "UDP response to DNS query!");
-		parse_dns_response(debug_file, udp);
-		return;
-	}
+static void net_handle_udp(struct udp_packet * udp, size_t length, uint32_t source_ip) {
 
 	if (ntohs(udp->source_port) == 67) {
 		debug_print(WARNING, "UDP response to DHCP!");
@@ -970,14 +2038,35 @@ static void net_handle_udp(struct udp_packet * udp, size_t length) {
 		return;
 	}
 
-	/* Find socket */
-	if (hashmap_has(_udp_sockets, (void *)ntohs(udp->source_port))) {
-		/* Do the thing */
+	/* Deliver to whoever is bound to the destination port. */
+	struct socket * socket = hashmap_get(_udp_sockets, (void *)(uintptr_t)ntohs(udp->destination_port));
+	if (!socket) {
+		debug_print(INFO, "UDP to port %d with nobody listening", ntohs(udp->destination_port));
+		return;
+	}
 
-	} else {
-		/* ??? */
+	size_t data_length = length - sizeof(struct udp_packet);
+
+	spin_lock(socket->packet_queue_lock);
+	if (socket->proto_sock.udp_socket.packets->length >= UDP_QUEUE_MAX) {
+		/* Reader has fallen behind; UDP is allowed to drop. */
+		spin_unlock(socket->packet_queue_lock);
+		return;
 	}
+	spin_unlock(socket->packet_queue_lock);
+
+	struct udp_datagram * dgram = malloc(sizeof(struct udp_datagram) + data_length);
+	dgram->source_ip = ntohl(source_ip);
+	dgram->source_port = ntohs(udp->source_port);
+	dgram->size = data_length;
+	memcpy(dgram->data, udp->payload, data_length);
 
+	spin_lock(socket->packet_queue_lock);
+	list_insert(socket->proto_sock.udp_socket.packets, dgram);
+	spin_unlock(socket->packet_queue_lock);
+
+	wakeup_queue(socket->proto_sock.udp_socket.packet_wait);
+	socket_alert_waiters(socket);
 }
 
 static void net_handle_ipv4(struct ipv4_packet * ipv4) {
@@ -987,7 +2076,7 @@ static void net_handle_ipv4(struct ipv4_packet * ipv4) {
 			net_handle_tcp((struct tcp_header *)ipv4->payload, ntohs(ipv4->length) - sizeof(struct ipv4_packet));
 			break;
 		case IPV4_PROT_UDP:
-			net_handle_udp((struct udp_packet *)ipv4->payload, ntohs(ipv4->length) - sizeof(struct ipv4_packet));
+			net_handle_udp((struct udp_packet *)ipv4->payload, ntohs(ipv4->length) - sizeof(struct ipv4_packet), ipv4->source);
 			break;
 		default:
 			/* XXX */
@@ -995,10 +2084,71 @@ static void net_handle_ipv4(struct ipv4_packet * ipv4) {
 	}
 }
 
-static struct ethernet_packet* net_receive(void) {
-	struct ethernet_packet *eth = _netif.get_packet();
+static void netbuf_wrap_release(struct netbuf * nb) {
+	free(nb->eth);
+	free(nb);
+}
 
-	return eth;
+/**
+ * Wrap a heap-allocated frame in a netbuf for drivers that still copy
+ * out of their rings; `release` just frees both allocations.
+ */
+struct netbuf * netbuf_wrap(struct ethernet_packet * eth, size_t size) {
+	struct netbuf * nb = malloc(sizeof(struct netbuf));
+	nb->eth = eth;
+	nb->size = size;
+	nb->release = netbuf_wrap_release;
+	nb->extra = NULL;
+	return nb;
+}
+
+#define NET_POLL_BUDGET 16
+
+static netif_poll_func _poll_func = NULL;
+static netif_irq_enable_func _poll_irq_enable = NULL;
+static list_t * net_poll_wait = NULL;
+static volatile int net_poll_pending = 0;
+
+/**
+ * Interrupt-mitigated receive: a driver masks its RX interrupt in its
+ * handler and calls net_poll_schedule(); this tasklet then drains the
+ * ring in budgeted batches, so a line-rate burst costs one interrupt
+ * plus scheduled work instead of an interrupt per frame. The driver's
+ * interrupt is only re-enabled once a poll pass finds the ring empty.
+ */
+static void net_poll_thread(void * data, char * name) {
+	while (1) {
+		while (!net_poll_pending) {
+			sleep_on(net_poll_wait);
+		}
+		net_poll_pending = 0;
+		while (_poll_func(NET_POLL_BUDGET) == NET_POLL_BUDGET) {
+			/* Full batch; the ring may still have frames - let
+			 * someone else run before the next pass. */
+			switch_task(1);
+		}
+		_poll_irq_enable();
+	}
+}
+
+void net_poll_install(netif_poll_func poll, netif_irq_enable_func irq_enable) {
+	_poll_func = poll;
+	_poll_irq_enable = irq_enable;
+	if (!net_poll_wait) {
+		net_poll_wait = list_create();
+		create_kernel_tasklet(net_poll_thread, "[netpoll]", NULL);
+	}
+}
+
+void net_poll_schedule(void) {
+	net_poll_pending = 1;
+	wakeup_queue(net_poll_wait);
+}
+
+static struct netbuf * net_receive(void) {
+	struct netbuf *nb = _netif.get_packet();
+
+	return nb;
 }
 
 int net_connect(struct socket* socket, uint32_t dest_ip, uint16_t dest_port) {
@@ -1013,9 +2163,13 @@ int net_connect(struct socket* socket, uint32_t dest_ip, uint16_t dest_port) {
 	socket->proto_sock.tcp_socket.seq_no = 0;
 	socket->proto_sock.tcp_socket.ack_no = 0;
 	socket->proto_sock.tcp_socket.status = 0;
+	socket->proto_sock.tcp_socket.unacked = list_create();
+	socket->proto_sock.tcp_socket.ooo_queue = list_create();
+	socket->proto_sock.tcp_socket.tx_buf = malloc(TCP_MSS);
+	socket->proto_sock.tcp_socket.tx_len = 0;
+	socket->proto_sock.tcp_socket.nodelay = 0;
 
-	socket->packet_queue = list_create();
-	socket->packet_wait = list_create();
+	socket->rx_ring = ring_buffer_create(TCP_MAX_WINDOW);
 	socket->alert_waiters = list_create();
 
 	socket->ip = dest_ip; //ip_aton("10.255.50.206");
@@ -1042,7 +2196,8 @@ static void placeholder_dhcp(void) {
 	free(tmp);
 
 	while (1) {
-		struct ethernet_packet * eth = (struct ethernet_packet *)_netif.get_packet();
+		struct netbuf * nb = _netif.get_packet();
+		struct ethernet_packet * eth = nb->eth;
 		uint16_t eth_type = ntohs(eth->type);
 
 		debug_print(NOTICE, "Ethernet II, Src: (%2x:%2x:%2x:%2x:%2x:%2x), Dst: (%2x:%2x:%2x:%2x:%2x:%2x) [type=%4x])",
@@ -1054,7 +2209,7 @@ static void placeholder_dhcp(void) {
 
 		if (eth_type != 0x0800) {
 			debug_print(WARNING, "ARP packet while waiting for DHCP...");
-			free(eth);
+			nb->release(nb);
 			continue;
 		}
 
@@ -1076,7 +2231,7 @@ static void placeholder_dhcp(void) {
 		if (ipv4->protocol != IPV4_PROT_UDP) {
 			debug_print(WARNING, "Protocol: %d", ipv4->protocol);
 			debug_print(WARNING, "Bad packet...");
-			free(eth);
+			nb->release(nb);
 			continue;
 		}
 
@@ -1091,7 +2246,7 @@ static void placeholder_dhcp(void) {
 		if (dst_port != 68) {
 			debug_print(WARNING, "Destination port: %d", dst_port);
 			debug_print(WARNING, "Bad packet...");
-			free(eth);
+			nb->release(nb);
 			continue;
 		}
 
@@ -1125,6 +2280,8 @@ static void placeholder_dhcp(void) {
 				_dns_server = dnsaddr;
 			} else if (type == 3) {
 				_netif.gateway = ntohl(*(uint32_t *)data);
+			} else if (type == 1) {
+				_netif.netmask = ntohl(*(uint32_t *)data);
 			}
 
 			j += 2 + len;
@@ -1137,7 +2294,7 @@ static void placeholder_dhcp(void) {
 		_netif.send_packet(tmp, packet_size);
 		free(tmp);
 
-		free(eth);
+		nb->release(nb);
 
 		break;
 	}
@@ -1285,6 +2442,11 @@ static void net_handle_arp(struct ethernet_packet * eth) {
 		arp->target_ha[5],
 		target_ip);
 
+	/* Either way, the sender just told us who they are. */
+	if (ntohl(arp->sender_ip)) {
+		neighbor_learn(ntohl(arp->sender_ip), arp->sender_ha);
+	}
+
 	if (ntohs(arp->oper) == 1) {
 
 		if (ntohl(arp->target_ip) == _netif.source) {
@@ -1321,6 +2483,8 @@ void net_handler(void * data, char * name) {
 	/* Network Packet Handler*/
 	_netif.extra = NULL;
 
+	_neighbors = hashmap_create_int(0xFF);
+
 	_dns_server = ip_aton("10.0.2.3");
 
 	placeholder_dhcp();
@@ -1330,10 +2494,22 @@ void net_handler(void * data, char * name) {
 	_tcp_sockets = hashmap_create_int(0xFF);
 	_udp_sockets = hashmap_create_int(0xFF);
 
+	/* The resolver rides the same UDP path userspace gets. */
+	_dns_socket = net_open_udp();
+	net_udp_bind(_dns_socket, 50053);
+
+	netsock_ops = &udp_netsock_ops;
+
 	while (1) {
-		struct ethernet_packet * eth = net_receive();
+		struct netbuf * nb = net_receive();
 
-		if (!eth) continue;
+		if (!nb) continue;
+
+		struct ethernet_packet * eth = nb->eth;
+
+		if (__builtin_expect(pcap_active, 0)) {
+			pcap_capture((uint8_t *)eth, nb->size > PCAP_SNAPLEN ? PCAP_SNAPLEN : nb->size, nb->size);
+		}
 
 		switch (ntohs(eth->type)) {
 			case ETHERNET_TYPE_IPV4:
@@ -1344,7 +2520,7 @@ void net_handler(void * data, char * name) {
 				break;
 		}
 
-		free(eth);
+		nb->release(nb);
 	}
 }
 
@@ -1554,21 +2730,22 @@ size_t write_dhcp_request(uint8_t * buffer, uint8_t * ip) {
 }
 
 
-static void parse_dns_response(fs_node_t * tty, void * last_packet) {
-	struct udp_packet * udp = (struct udp_packet *)last_packet;
-	uint16_t src_port = ntohs(udp->source_port);
-	uint16_t dst_port = ntohs(udp->destination_port);
-	uint16_t udp_len  = ntohs(udp->length);
-
-	fprintf(tty, "UDP [%d → %d] length=%d bytes\n",
-			src_port, dst_port, udp_len);
-
-	struct dns_packet * dns = (struct dns_packet *)udp->payload;
+static void parse_dns_response(fs_node_t * tty, void * dns_payload) {
+	struct dns_packet * dns = (struct dns_packet *)dns_payload;
 	uint16_t dns_questions = ntohs(dns->questions);
 	uint16_t dns_answers   = ntohs(dns->answers);
 	fprintf(tty, "DNS - %d queries, %d answers\n",
 			dns_questions, dns_answers);
 
+	if ((ntohs(dns->flags) & 0xF) == 3 && dns_questions) {
+		/* NXDOMAIN - remember that the name doesn't resolve for a
+		 * while so repeat lookups don't hit the wire. */
+		char qname[1024];
+		dns_name_to_normal_name(dns, sizeof(struct dns_packet), qname);
+		debug_print(WARNING, "DNS says [%s] doesn't exist", qname);
+		dns_cache_store(qname, 0, DNS_NEGATIVE_TTL, 1);
+	}
+
 	fprintf(tty, "Queries:\n");
 	int offset = sizeof(struct dns_packet);
 	int queries = 0;
@@ -1592,7 +2769,8 @@ static void parse_dns_response(fs_node_t * tty, void * last_packet) {
 		fprintf(tty, " - Type: %4x %4x; ", ntohs(d[0]), ntohs(d[1]));
 		offset += 4;
 		uint32_t * t = (uint32_t *)&bytes[offset];
-		fprintf(tty, "TTL: %d; ", ntohl(t[0]));
+		uint32_t ttl = ntohl(t[0]);
+		fprintf(tty, "TTL: %d; ", ttl);
 		offset += 4;
 		uint16_t * l = (uint16_t *)&bytes[offset];
 		int _l = ntohs(l[0]);
@@ -1603,10 +2781,8 @@ static void parse_dns_response(fs_node_t * tty, void * last_packet) {
 			char ip[16];
 			ip_ntoa(ntohl(i[0]), ip);
 			fprintf(tty, " Address: %s\n", ip);
-			debug_print(NOTICE, "Domain [%s] maps to [%s]", buf, ip);
-			if (!hashmap_has(dns_cache, buf)) {
-				hashmap_set(dns_cache, buf, strdup(ip));
-			}
+			debug_print(NOTICE, "Domain [%s] maps to [%s] for %ds", buf, ip, ttl);
+			dns_cache_store(buf, ntohl(i[0]), ttl, 0);
 		} else {
 			if (ntohs(d[0]) == 5) {
 				fprintf(tty, "CNAME: ");
@@ -1620,12 +2796,10 @@ static void parse_dns_response(fs_node_t * tty, void * last_packet) {
 				if (gethost(buffer,&addr) == 2) {
 					debug_print(WARNING,"Can't provide a response yet, but going to query again in a moment.");
 				} else {
-					if (!hashmap_has(dns_cache, buf)) {
-						char ip[16];
-						ip_ntoa(addr, ip);
-						hashmap_set(dns_cache, buf, strdup(ip));
-						fprintf(tty, "resolves to %s\n", ip);
-					}
+					char ip[16];
+					ip_ntoa(addr, ip);
+					dns_cache_store(buf, addr, ttl, 0);
+					fprintf(tty, "resolves to %s\n", ip);
 				}
 			} else {
 				fprintf(tty, "dunno\n");
@@ -1655,19 +2829,23 @@ static fs_node_t * netfs_create(void) {
 static int init(void) {
 	dns_cache = hashmap_create(10);
 
-	hashmap_set(dns_cache, "dakko.us", strdup("104.131.140.26"));
-	hashmap_set(dns_cache, "toaruos.org", strdup("104.131.140.26"));
-	hashmap_set(dns_cache, "www.toaruos.org", strdup("104.131.140.26"));
-	hashmap_set(dns_cache, "www.yelp.com", strdup("104.16.57.23"));
-	hashmap_set(dns_cache, "s3-media2.fl.yelpcdn.com", strdup("199.27.79.175"));
-	hashmap_set(dns_cache, "forum.osdev.org", strdup("173.255.206.39"));
-	hashmap_set(dns_cache, "wolfgun.puckipedia.com", strdup("104.47.147.203"));
-	hashmap_set(dns_cache, "irc.freenode.net", strdup("91.217.189.42"));
-	hashmap_set(dns_cache, "i.imgur.com", strdup("23.235.47.193"));
+	/* Pinned entries (TTL 0 never expires). */
+	dns_cache_store("dakko.us", ip_aton("104.131.140.26"), 0, 0);
+	dns_cache_store("toaruos.org", ip_aton("104.131.140.26"), 0, 0);
+	dns_cache_store("www.toaruos.org", ip_aton("104.131.140.26"), 0, 0);
+	dns_cache_store("www.yelp.com", ip_aton("104.16.57.23"), 0, 0);
+	dns_cache_store("s3-media2.fl.yelpcdn.com", ip_aton("199.27.79.175"), 0, 0);
+	dns_cache_store("forum.osdev.org", ip_aton("173.255.206.39"), 0, 0);
+	dns_cache_store("wolfgun.puckipedia.com", ip_aton("104.47.147.203"), 0, 0);
+	dns_cache_store("irc.freenode.net", ip_aton("91.217.189.42"), 0, 0);
+	dns_cache_store("i.imgur.com", ip_aton("23.235.47.193"), 0, 0);
 
 	/* /dev/net/{domain|ip}/{protocol}/{port} */
 	vfs_mount("/dev/net", netfs_create());
 
+	/* Capture tap; see pcap_create. */
+	vfs_mount("/dev/pcap", pcap_create());
+
 	return 0;
 }
 
@@ -10,6 +10,7 @@
 #include <kernel/logging.h>
 
 #include <sys/ioctl.h>
+#include <sys/uio.h>
 
 #define MAX_PACKET_SIZE 1024
 
@@ -23,12 +24,14 @@ typedef struct packet_exchange {
 	char * name;
 	char fresh;
 	spin_lock_t lock;
+	spin_lock_t write_lock;
 	fs_node_t * server_pipe;
 	list_t * clients;
 } pex_ex_t;
 
 typedef struct packet_client {
 	pex_ex_t * parent;
+	spin_lock_t write_lock;
 	fs_node_t * pipe;
 } pex_client_t;
 
@@ -44,50 +47,70 @@ typedef struct server_write_header {
 	uint8_t data[];
 } header_t;
 
-static void receive_packet(fs_node_t * socket, packet_t ** out) {
-	packet_t tmp;
-	read_fs(socket, 0, sizeof(struct packet), (uint8_t *)&tmp);
-	*out = malloc(tmp.size + sizeof(struct packet));
-	memcpy(*out, &tmp, sizeof(struct packet));
+/*
+ * Read one packet off a pipe and discard its payload; used when the
+ * reader's buffer is too small to hold the packet.
+ */
+static void drain_packet(fs_node_t * socket, size_t size) {
+	uint8_t * scratch = malloc(size);
+	read_fs(socket, 0, size, scratch);
+	free(scratch);
+}
 
-	if (tmp.size) {
-		read_fs(socket, 0, tmp.size, (uint8_t *)(*out)->data);
+static size_t iov_total(int count, const struct iovec * iov) {
+	size_t size = 0;
+	for (int i = 0; i < count; ++i) {
+		size += iov[i].iov_len;
 	}
+	return size;
 }
 
-static void send_to_server(pex_ex_t * p, pex_client_t * c, size_t size, void * data) {
-	size_t p_size = size + sizeof(struct packet);
-	packet_t * packet = malloc(p_size);
-
-	packet->source = c;
-	packet->size = size;
-
-	if (size) {
-		memcpy(packet->data, data, size);
+/*
+ * Packets are written to the underlying pipe as a header followed by
+ * the payload segments straight out of the caller's buffers, rather
+ * than being coalesced into a temporary allocation first. The write
+ * lock keeps the pieces contiguous when several writers share the
+ * pipe.
+ */
+static void send_to_server(pex_ex_t * p, pex_client_t * c, int count, const struct iovec * iov) {
+	packet_t header;
+	header.source = c;
+	header.size = iov_total(count, iov);
+
+	spin_lock(p->write_lock);
+	write_fs(p->server_pipe, 0, sizeof(struct packet), (uint8_t *)&header);
+	for (int i = 0; i < count; ++i) {
+		if (iov[i].iov_len) {
+			write_fs(p->server_pipe, 0, iov[i].iov_len, iov[i].iov_base);
+		}
 	}
-
-	write_fs(p->server_pipe, 0, p_size, (uint8_t *)packet);
-
-	free(packet);
+	spin_unlock(p->write_lock);
 }
 
-static int send_to_client(pex_ex_t * p, pex_client_t * c, size_t size, void * data) {
+static int send_to_client(pex_ex_t * p, pex_client_t * c, int count, const struct iovec * iov) {
+	size_t size = iov_total(count, iov);
 	size_t p_size = size + sizeof(struct packet);
+	packet_t header;
+
+	spin_lock(c->write_lock);
 
 	/* Verify there is space on the client */
 	if (pipe_unsize(c->pipe) < (int)p_size) {
+		spin_unlock(c->write_lock);
 		return -1;
 	}
 
-	packet_t * packet = malloc(p_size);
-
-	memcpy(packet->data, data, size);
-	packet->source = NULL;
-	packet->size = size;
+	header.source = NULL;
+	header.size = size;
 
-	write_fs(c->pipe, 0, p_size, (uint8_t *)packet);
+	write_fs(c->pipe, 0, sizeof(struct packet), (uint8_t *)&header);
+	for (int i = 0; i < count; ++i) {
+		if (iov[i].iov_len) {
+			write_fs(c->pipe, 0, iov[i].iov_len, iov[i].iov_base);
+		}
+	}
 
-	free(packet);
+	spin_unlock(c->write_lock);
 	return size;
 }
 
@@ -95,6 +118,7 @@ static pex_client_t * create_client(pex_ex_t * p) {
 	pex_client_t * out = malloc(sizeof(pex_client_t));
 	out->parent = p;
 	out->pipe = make_pipe(4096);
+	spin_init(out->write_lock);
 	return out;
 }
 
@@ -102,21 +126,22 @@ static uint32_t read_server(fs_node_t * node, uint64_t offset, uint32_t size, ui
 	pex_ex_t * p = (pex_ex_t *)node->device;
 	debug_print(INFO, "[pex] server read(...)");
 
-	packet_t * packet;
-
-	receive_packet(p->server_pipe, &packet);
+	packet_t header;
+	read_fs(p->server_pipe, 0, sizeof(struct packet), (uint8_t *)&header);
 
-	debug_print(INFO, "Server recevied packet of size %d, was waiting for at most %d", packet->size, size);
+	debug_print(INFO, "Server recevied packet of size %d, was waiting for at most %d", header.size, size);
 
-	if (packet->size + sizeof(packet_t) > size) {
+	if (header.size + sizeof(packet_t) > size) {
+		if (header.size) drain_packet(p->server_pipe, header.size);
 		return -1;
 	}
 
-	memcpy(buffer, packet, packet->size + sizeof(packet_t));
-	uint32_t out = packet->size + sizeof(packet_t);
+	memcpy(buffer, &header, sizeof(struct packet));
+	if (header.size) {
+		read_fs(p->server_pipe, 0, header.size, buffer + sizeof(struct packet));
+	}
 
-	free(packet);
-	return out;
+	return header.size + sizeof(packet_t);
 }
 
 static uint32_t write_server(fs_node_t * node, uint64_t offset, uint32_t size, uint8_t * buffer) {
@@ -129,12 +154,14 @@ static uint32_t write_server(fs_node_t * node, uint64_t offset, uint32_t size, u
 		return -1;
 	}
 
+	struct iovec iov = { head->data, size - sizeof(header_t) };
+
 	if (head->target == NULL) {
 		/* Brodcast packet */
 		spin_lock(p->lock);
 		foreach(f, p->clients) {
 			debug_print(INFO, "Sending to client 0x%x", f->value);
-			send_to_client(p, (pex_client_t *)f->value, size - sizeof(header_t), head->data);
+			send_to_client(p, (pex_client_t *)f->value, 1, &iov);
 		}
 		spin_unlock(p->lock);
 		debug_print(INFO, "Done broadcasting to clients.");
@@ -144,7 +171,52 @@ static uint32_t write_server(fs_node_t * node, uint64_t offset, uint32_t size, u
 		return -1;
 	}
 
-	return send_to_client(p, head->target, size - sizeof(header_t), head->data);
+	return send_to_client(p, head->target, 1, &iov);
+}
+
+/*
+ * Gathering write from the server: the routing header is carried in
+ * the first segment, the payload in the rest, so pex_send can hand
+ * down its header and the caller's buffer without a merge copy.
+ */
+static uint32_t writev_server(fs_node_t * node, uint64_t offset, int count, const struct iovec * iov) {
+	pex_ex_t * p = (pex_ex_t *)node->device;
+
+	if (count < 1 || count > UIO_MAXIOV || iov[0].iov_len < sizeof(header_t)) {
+		return -1;
+	}
+
+	header_t * head = (header_t *)iov[0].iov_base;
+	size_t total = iov_total(count, iov);
+
+	if (total - sizeof(header_t) > MAX_PACKET_SIZE) {
+		return -1;
+	}
+
+	/* Strip the routing header from the first segment */
+	struct iovec payload[UIO_MAXIOV];
+	payload[0].iov_base = head->data;
+	payload[0].iov_len  = iov[0].iov_len - sizeof(header_t);
+	for (int i = 1; i < count; ++i) {
+		payload[i] = iov[i];
+	}
+
+	if (head->target == NULL) {
+		spin_lock(p->lock);
+		foreach(f, p->clients) {
+			send_to_client(p, (pex_client_t *)f->value, count, payload);
+		}
+		spin_unlock(p->lock);
+		return total;
+	} else if (head->target->parent != p) {
+		debug_print(WARNING, "[pex] Invalid packet from server? (pid=%d)", current_process->id);
+		return -1;
+	}
+
+	if (send_to_client(p, head->target, count, payload) < 0) {
+		return -1;
+	}
+	return total;
 }
 
 static int ioctl_server(fs_node_t * node, int request, void * argp) {
@@ -167,22 +239,22 @@ static uint32_t read_client(fs_node_t * node, uint64_t offset, uint32_t size, ui
 
 	debug_print(INFO, "[pex] client read(...)");
 
-	packet_t * packet;
-
-	receive_packet(c->pipe, &packet);
+	packet_t header;
+	read_fs(c->pipe, 0, sizeof(struct packet), (uint8_t *)&header);
 
-	if (packet->size > size) {
-		debug_print(WARNING, "[pex] Client is not reading enough bytes to hold packet of size %d", packet->size);
+	if (header.size > size) {
+		debug_print(WARNING, "[pex] Client is not reading enough bytes to hold packet of size %d", header.size);
+		drain_packet(c->pipe, header.size);
 		return -1;
 	}
 
-	memcpy(buffer, &packet->data, packet->size);
-	uint32_t out = packet->size;
+	if (header.size) {
+		read_fs(c->pipe, 0, header.size, buffer);
+	}
 
-	debug_print(INFO, "[pex] Client received packet of size %d", packet->size);
+	debug_print(INFO, "[pex] Client received packet of size %d", header.size);
 
-	free(packet);
-	return out;
+	return header.size;
 }
 
 static uint32_t write_client(fs_node_t * node, uint64_t offset, uint32_t size, uint8_t * buffer) {
@@ -200,11 +272,31 @@ static uint32_t write_client(fs_node_t * node, uint64_t offset, uint32_t size, u
 	}
 
 	debug_print(INFO, "Sending packet of size %d to parent", size);
-	send_to_server(c->parent, c, size, buffer);
+	struct iovec iov = { buffer, size };
+	send_to_server(c->parent, c, 1, &iov);
 
 	return size;
 }
 
+static uint32_t writev_client(fs_node_t * node, uint64_t offset, int count, const struct iovec * iov) {
+	pex_client_t * c = (pex_client_t *)node->inode;
+	if (c->parent != node->device) {
+		debug_print(WARNING, "[pex] Invalid device endpoint on client write?");
+		return -1;
+	}
+
+	if (count > UIO_MAXIOV) return -1;
+
+	size_t total = iov_total(count, iov);
+	if (total > MAX_PACKET_SIZE) {
+		debug_print(WARNING, "Size of %d is too big.", total);
+		return -1;
+	}
+
+	send_to_server(c->parent, c, count, iov);
+	return total;
+}
+
 static int ioctl_client(fs_node_t * node, int request, void * argp) {
 	pex_client_t * c = (pex_client_t *)node->inode;
 
@@ -232,9 +324,7 @@ static void close_client(fs_node_t * node) {
 
 	spin_unlock(p->lock);
 
-	char tmp[1];
-
-	send_to_server(p, c, 0, tmp);
+	send_to_server(p, c, 0, NULL);
 
 	free(c);
 }
@@ -268,6 +358,7 @@ static void open_pex(fs_node_t * node, unsigned int flags) {
 		/* Set up the server side */
 		node->read   = read_server;
 		node->write  = write_server;
+		node->writev = writev_server;
 		node->ioctl  = ioctl_server;
 		node->selectcheck = check_server;
 		node->selectwait  = wait_server;
@@ -279,6 +370,7 @@ static void open_pex(fs_node_t * node, unsigned int flags) {
 
 		node->read  = read_client;
 		node->write = write_client;
+		node->writev = writev_client;
 		node->ioctl = ioctl_client;
 		node->close = close_client;
 
@@ -356,6 +448,7 @@ static fs_node_t * file_from_pex(pex_ex_t * pex) {
 	fnode->open    = open_pex;
 	fnode->read    = read_server;
 	fnode->write   = write_server;
+	fnode->writev  = writev_server;
 	return fnode;
 }
 
@@ -407,6 +500,7 @@ static int create_packetfs(fs_node_t *parent, char *name, uint16_t permission) {
 	new_exchange->server_pipe = make_pipe(4096);
 
 	spin_init(new_exchange->lock);
+	spin_init(new_exchange->write_lock);
 	/* XXX Create exchange server pipe */
 
 	list_insert(p->exchanges, new_exchange);
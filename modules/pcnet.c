@@ -17,6 +17,8 @@
 static list_t * net_queue = NULL;
 static spin_lock_t net_queue_lock = { 0 };
 static list_t * rx_wait;
+static list_t * tx_wait;
+static spin_lock_t tx_lock = { 0 };
 
 static uint32_t pcnet_device_pci = 0x00000000;
 static uint32_t pcnet_io_base = 0;
@@ -29,12 +31,10 @@ static uint8_t *pcnet_buffer_virt;
 
 static uint8_t * pcnet_rx_de_start;
 static uint8_t * pcnet_tx_de_start;
-static uint8_t * pcnet_rx_start;
 static uint8_t * pcnet_tx_start;
 
 static uint32_t pcnet_rx_de_phys;
 static uint32_t pcnet_tx_de_phys;
-static uint32_t pcnet_rx_phys;
 static uint32_t pcnet_tx_phys;
 
 static int pcnet_rx_buffer_id = 0;
@@ -44,6 +44,13 @@ static int pcnet_tx_buffer_id = 0;
 #define PCNET_BUFFER_SIZE 1548
 #define PCNET_RX_COUNT 32
 #define PCNET_TX_COUNT 8
+#define PCNET_RX_POOL_MAX 64
+
+/* Driver-owned receive buffers, one per descriptor, swapped out whole
+ * when a frame is handed up so the ring never waits on the stack. */
+static struct netbuf * rx_bufs[PCNET_RX_COUNT];
+static list_t * rx_buf_pool;
+static spin_lock_t rx_buf_pool_lock = { 0 };
 
 static void find_pcnet(uint32_t device, uint16_t vendorid, uint16_t deviceid, void * extra) {
 	if ((vendorid == 0x1022) && (deviceid == 0x2000)) {
@@ -106,13 +113,12 @@ static int next_rx_index(int current_rx_index) {
 	return out;
 }
 
-static void init_descriptor(int index, int is_tx) {
+static void init_descriptor(int index, int is_tx, uint32_t buf_phys) {
 	uint8_t * de_table = is_tx ? pcnet_tx_de_start : pcnet_rx_de_start;
 
 	memset(&de_table[index * PCNET_DE_SIZE], 0, PCNET_DE_SIZE);
 
-	uint32_t buf_addr = is_tx ? pcnet_tx_phys : pcnet_rx_phys;
-	*(uint32_t *)&de_table[index * PCNET_DE_SIZE] = buf_addr + index * PCNET_BUFFER_SIZE;
+	*(uint32_t *)&de_table[index * PCNET_DE_SIZE] = buf_phys;
 
 	uint16_t bcnt = (uint16_t)(-PCNET_BUFFER_SIZE);
 	bcnt &= 0x0FFF;
@@ -124,13 +130,47 @@ static void init_descriptor(int index, int is_tx) {
 	}
 }
 
+/*
+ * Released frames rejoin the buffer pool so the next descriptor swap
+ * doesn't have to hit the heap.
+ */
+static void pcnet_rx_release(struct netbuf * nb) {
+	spin_lock(rx_buf_pool_lock);
+	if (rx_buf_pool->length < PCNET_RX_POOL_MAX) {
+		list_insert(rx_buf_pool, nb);
+		spin_unlock(rx_buf_pool_lock);
+		return;
+	}
+	spin_unlock(rx_buf_pool_lock);
+	free(nb->eth);
+	free(nb);
+}
+
+static struct netbuf * pcnet_rx_alloc(void) {
+	spin_lock(rx_buf_pool_lock);
+	node_t * n = list_dequeue(rx_buf_pool);
+	spin_unlock(rx_buf_pool_lock);
+	if (n) {
+		struct netbuf * nb = n->value;
+		free(n);
+		return nb;
+	}
+	struct netbuf * nb = malloc(sizeof(struct netbuf));
+	uintptr_t phys = 0;
+	nb->eth = (void*)kvmalloc_p(PCNET_BUFFER_SIZE, &phys);
+	nb->size = 0;
+	nb->release = pcnet_rx_release;
+	nb->extra = (void*)phys;
+	return nb;
+}
+
 static void enqueue_packet(void * buffer) {
 	spin_lock(net_queue_lock);
 	list_insert(net_queue, buffer);
 	spin_unlock(net_queue_lock);
 }
 
-static struct ethernet_packet * dequeue_packet(void) {
+static struct netbuf * dequeue_packet(void) {
 	while (!net_queue->length) {
 		sleep_on(rx_wait);
 	}
@@ -148,51 +188,122 @@ static uint8_t* pcnet_get_mac() {
 	return mac;
 }
 
-static void pcnet_send_packet(uint8_t* payload, size_t payload_size) {
-	if (!driver_owns(pcnet_tx_de_start, pcnet_tx_buffer_id)) {
-		/* sleep? */
-		debug_print(ERROR, "No transmit descriptors available. Bailing.");
+/**
+ * Scatter-gather transmit: each fragment takes a descriptor, with STP
+ * on the first and ENP on the last. Ownership is granted in reverse so
+ * the card can't start fetching a half-built chain; if the ring is
+ * full we sleep until a transmit interrupt reports completions.
+ */
+static void pcnet_send_frags(struct netif_frag * frags, int count) {
+	if (count > PCNET_TX_COUNT) {
+		debug_print(ERROR, "Too many fragments; max is %d, got %d", PCNET_TX_COUNT, count);
 		return;
 	}
-	if (payload_size > PCNET_BUFFER_SIZE) {
-		debug_print(ERROR, "Packet too big; max is %d, got %d", PCNET_BUFFER_SIZE, payload_size);
-		return;
+
+	spin_lock(tx_lock);
+
+	int first_tx = pcnet_tx_buffer_id;
+	int idx = first_tx;
+	for (int i = 0; i < count; ++i) {
+		while (!driver_owns(pcnet_tx_de_start, idx)) {
+			spin_unlock(tx_lock);
+			sleep_on(tx_wait);
+			spin_lock(tx_lock);
+		}
+		if (frags[i].len > PCNET_BUFFER_SIZE) {
+			debug_print(ERROR, "Fragment too big; max is %d, got %d", PCNET_BUFFER_SIZE, frags[i].len);
+			spin_unlock(tx_lock);
+			return;
+		}
+		uint8_t * de = &pcnet_tx_de_start[idx * PCNET_DE_SIZE];
+		memcpy((void *)(pcnet_tx_start + idx * PCNET_BUFFER_SIZE), frags[i].buf, frags[i].len);
+
+		uint16_t bcnt = (uint16_t)(-frags[i].len);
+		bcnt &= 0x0FFF;
+		bcnt |= 0xF000;
+		*(uint16_t *)&de[4] = bcnt;
+
+		de[7] = (i == 0 ? 0x02 : 0) | (i == count - 1 ? 0x01 : 0);
+
+		idx = next_tx_index(idx);
 	}
-	memcpy((void *)(pcnet_tx_start + pcnet_tx_buffer_id * PCNET_BUFFER_SIZE), payload, payload_size);
 
-	pcnet_tx_de_start[pcnet_tx_buffer_id * PCNET_DE_SIZE + 7] |= 0x3;
+	for (int i = count - 1; i >= 0; --i) {
+		int d = first_tx;
+		for (int j = 0; j < i; ++j) d = next_tx_index(d);
+		pcnet_tx_de_start[d * PCNET_DE_SIZE + 7] |= 0x80;
+	}
 
-	uint16_t bcnt = (uint16_t)(-payload_size);
-	bcnt &= 0x0FFF;
-	bcnt |= 0xF000;
-	*(uint16_t *)&pcnet_tx_de_start[pcnet_tx_buffer_id * PCNET_DE_SIZE + 4] = bcnt;
+	pcnet_tx_buffer_id = idx;
 
-	pcnet_tx_de_start[pcnet_tx_buffer_id * PCNET_DE_SIZE + 7] |= 0x80;
+	write_csr32(0, read_csr32(0) | (1 << 3)); /* TDMD */
 
-	write_csr32(0, read_csr32(0) | (1 << 3));
+	spin_unlock(tx_lock);
+}
 
-	pcnet_tx_buffer_id = next_tx_index(pcnet_tx_buffer_id);
+static void pcnet_send_packet(uint8_t* payload, size_t payload_size) {
+	struct netif_frag frag = { payload, payload_size };
+	pcnet_send_frags(&frag, 1);
 }
 
-static int pcnet_irq_handler(struct regs *r) {
+/**
+ * Drain up to `budget` received frames from the descriptor ring. Runs
+ * from the [netpoll] tasklet with receive interrupts disabled.
+ */
+static int pcnet_poll(int budget) {
+	int handled = 0;
+
+	while (handled < budget && driver_owns(pcnet_rx_de_start, pcnet_rx_buffer_id)) {
+		uint8_t * de = &pcnet_rx_de_start[pcnet_rx_buffer_id * PCNET_DE_SIZE];
+
+		if (de[7] & 0x40) {
+			/* Errored frame: give the same buffer straight back. */
+			debug_print(WARNING, "rx error in descriptor %d", pcnet_rx_buffer_id);
+		} else {
+			/* Swap a fresh buffer into the descriptor and hand the
+			 * full one up the stack without copying it. */
+			struct netbuf * full = rx_bufs[pcnet_rx_buffer_id];
+			full->size = *(uint16_t *)&de[8] & 0x0FFF;
+
+			struct netbuf * fresh = pcnet_rx_alloc();
+			rx_bufs[pcnet_rx_buffer_id] = fresh;
+			*(uint32_t *)&de[0] = (uint32_t)(uintptr_t)fresh->extra;
+
+			enqueue_packet(full);
+		}
 
-	write_csr32(0, read_csr32(0) | 0x0400);
-	irq_ack(pcnet_irq);
+		de[7] = 0x80;
+
+		pcnet_rx_buffer_id = next_rx_index(pcnet_rx_buffer_id);
+		handled++;
+	}
 
-	while (driver_owns(pcnet_rx_de_start, pcnet_rx_buffer_id)) {
-		uint16_t plen = *(uint16_t *)&pcnet_rx_de_start[pcnet_rx_buffer_id * PCNET_DE_SIZE + 8];
+	if (handled) {
+		wakeup_queue(rx_wait);
+	}
+
+	return handled;
+}
 
-		void * pbuf = (void *)(pcnet_rx_start + pcnet_rx_buffer_id * PCNET_BUFFER_SIZE);
+static void pcnet_irq_enable(void) {
+	write_csr32(0, read_csr32(0) | 0x0040); /* IENA */
+}
 
-		void * packet = malloc(plen);
-		memcpy(packet, pbuf, plen);
-		pcnet_rx_de_start[pcnet_rx_buffer_id * PCNET_DE_SIZE + 7] = 0x80;
+static int pcnet_irq_handler(struct regs *r) {
+	uint32_t csr0 = read_csr32(0);
 
-		enqueue_packet(packet);
+	/* Acknowledge, and drop IENA so the polling tasklet can drain the
+	 * ring without taking an interrupt per frame. */
+	write_csr32(0, (csr0 & ~0x0040) | 0x0400);
+	irq_ack(pcnet_irq);
 
-		pcnet_rx_buffer_id = next_rx_index(pcnet_rx_buffer_id);
+	if (csr0 & 0x0200) {
+		/* TINT: descriptors came back; wake writers waiting on ring
+		 * space. */
+		wakeup_queue(tx_wait);
 	}
-	wakeup_queue(rx_wait);
+
+	net_poll_schedule();
 
 	return 1;
 }
@@ -259,21 +370,22 @@ static void pcnet_init(void * data, char * name) {
 
 	pcnet_rx_de_start = pcnet_buffer_virt + 28;
 	pcnet_tx_de_start = pcnet_rx_de_start + PCNET_RX_COUNT * PCNET_DE_SIZE;
-	pcnet_rx_start    = pcnet_tx_de_start + PCNET_TX_COUNT * PCNET_DE_SIZE;
-	pcnet_tx_start    = pcnet_rx_start + PCNET_RX_COUNT * PCNET_BUFFER_SIZE;
+	pcnet_tx_start    = pcnet_tx_de_start + PCNET_TX_COUNT * PCNET_DE_SIZE;
 
 	pcnet_rx_de_phys  = virt_to_phys(pcnet_rx_de_start);
 	pcnet_tx_de_phys  = virt_to_phys(pcnet_tx_de_start);
-	pcnet_rx_phys     = virt_to_phys(pcnet_rx_start);
 	pcnet_tx_phys     = virt_to_phys(pcnet_tx_start);
 
-	/* set up descriptors */
+	/* set up descriptors; receive buffers come from the netbuf pool so
+	 * they can be handed up the stack and swapped without a copy */
+	rx_buf_pool = list_create();
 	for (int i = 0; i < PCNET_RX_COUNT; i++) {
-		init_descriptor(i, 0);
+		rx_bufs[i] = pcnet_rx_alloc();
+		init_descriptor(i, 0, (uint32_t)(uintptr_t)rx_bufs[i]->extra);
 	}
 
 	for (int i = 0; i < PCNET_TX_COUNT; i++) {
-		init_descriptor(i, 1);
+		init_descriptor(i, 1, pcnet_tx_phys + i * PCNET_BUFFER_SIZE);
 	}
 
 	/* Set up device configuration structure */
@@ -305,6 +417,7 @@ static void pcnet_init(void * data, char * name) {
 	/* Configure network */
 	net_queue = list_create();
 	rx_wait = list_create();
+	tx_wait = list_create();
 
 	write_csr32(1, 0xFFFF & pcnet_buffer_phys);
 	write_csr32(2, 0xFFFF & (pcnet_buffer_phys >> 16));
@@ -346,6 +459,8 @@ static void pcnet_init(void * data, char * name) {
 	debug_print(NOTICE, "Card start.");
 
 	init_netif_funcs(pcnet_get_mac, dequeue_packet, pcnet_send_packet, "AMD PCnet FAST II/III");
+	net_poll_install(pcnet_poll, pcnet_irq_enable);
+	net_install_sendv(pcnet_send_frags);
 
 }
 
@@ -359,7 +474,8 @@ static int init(void) {
 
 	/* Initialize ring buffers */
 	debug_print(WARNING, "Request a large continuous chunk of memory.");
-	/* This fits 32x1548 (rx) + 8x1548 (tx) + 32x16 (rx DE) + 8x16 (tx DE) */
+	/* This fits the init block + 8x1548 (tx) + 32x16 (rx DE) + 8x16 (tx DE);
+	 * rx buffers live in separately-allocated netbufs */
 	pcnet_buffer_virt = (void*)kvmalloc_p(0x10000, &pcnet_buffer_phys);
 
 	create_kernel_tasklet(pcnet_init, "[pcnet]", NULL);
@@ -12,6 +12,8 @@
 #include <kernel/module.h>
 #include <kernel/multiboot.h>
 #include <kernel/pci.h>
+#include <kernel/procdata.h>
+#include <kernel/bootmarks.h>
 #include <kernel/mod/procfs.h>
 
 #define PROCFS_STANDARD_ENTRIES (sizeof(std_entries) / sizeof(struct procfs_entry))
@@ -162,6 +164,7 @@ static uint32_t proc_status_func(fs_node_t *node, uint64_t offset, uint32_t size
 			"State:\t%c\n" /* yeah, do this at some point */
 			"Tgid:\t%d\n" /* group ? group : pid */
 			"Pid:\t%d\n" /* pid */
+			"Start:\t%d.%6d\n" /* exec timestamp; launch-profile anchors its waterfall here */
 			"PPid:\t%d\n" /* parent pid */
 			"Pgid:\t%d\n" /* progress group id */
 			"Sid:\t%d\n" /* session id */
@@ -178,11 +181,16 @@ static uint32_t proc_status_func(fs_node_t *node, uint64_t offset, uint32_t size
 			"VmSize:\t %d kB\n"
 			"RssShmem:\t %d kB\n"
 			"MemPermille:\t %d\n"
+			"Utime:\t%d\n"
+			"Stime:\t%d\n"
+			"CtxSwitches:\t%d\n"
+			"PageFaults:\t%d\n"
 			,
 			name,
 			state,
 			proc->group ? proc->group : proc->id,
 			proc->id,
+			(int)proc->start.tv_sec, (int)proc->start.tv_usec,
 			parent ? parent->id : 0,
 			proc->job,
 			proc->session,
@@ -196,7 +204,9 @@ static uint32_t proc_status_func(fs_node_t *node, uint64_t offset, uint32_t size
 			proc->syscall_registers ? proc->syscall_registers->edi : 0,
 			proc->syscall_registers ? proc->syscall_registers->useresp : 0,
 			proc->cmdline ? proc->cmdline[0] : "(none)",
-			mem_usage, shm_usage, mem_permille
+			mem_usage, shm_usage, mem_permille,
+			(int)proc->usage_user, (int)proc->usage_kernel,
+			(int)proc->ctx_switches, (int)proc->page_faults
 			);
 
 	size_t _bsize = strlen(buf);
@@ -207,9 +217,298 @@ static uint32_t proc_status_func(fs_node_t *node, uint64_t offset, uint32_t size
 	return size;
 }
 
+static uint32_t proc_status_bin_func(fs_node_t *node, uint64_t offset, uint32_t size, uint8_t *buffer) {
+	/* One-entry cache; rebuilding the memory usage counts means
+	 * walking the page directory, so don't do it more than once
+	 * per tick for the same process. */
+	static struct procfs_status_bin cached;
+	static unsigned long cached_tick = (unsigned long)-1;
+	static int cached_pid = -1;
+
+	process_t * proc = process_from_pid(node->inode);
+
+	if (!proc) {
+		/* wat */
+		return 0;
+	}
+
+	if (cached_pid != (int)node->inode || cached_tick != timer_ticks) {
+		process_t * parent = process_get_parent(proc);
+
+		struct procfs_status_bin fresh;
+		memset(&fresh, 0, sizeof(fresh));
+		fresh.version = PROCFS_BIN_VERSION;
+		fresh.generation = cached.generation;
+		fresh.pid   = proc->id;
+		fresh.ppid  = parent ? parent->id : 0;
+		fresh.tgid  = proc->group ? proc->group : proc->id;
+		fresh.pgid  = proc->job;
+		fresh.sid   = proc->session;
+		fresh.uid   = proc->user;
+		fresh.state = proc->finished ? 'Z' :
+			(proc->suspended ? 'T' :
+				(process_is_ready(proc) ? 'R' : 'S'));
+		fresh.vm_size_kb  = calculate_memory_usage(proc->thread.page_directory) * 4;
+		fresh.shm_size_kb = calculate_shm_resident(proc->thread.page_directory) * 4;
+		fresh.mem_permille = 1000 * (fresh.vm_size_kb + fresh.shm_size_kb) / memory_total();
+		fresh.utime_ms    = proc->usage_user;
+		fresh.stime_ms    = proc->usage_kernel;
+		fresh.switches    = proc->ctx_switches;
+		fresh.faults      = proc->page_faults;
+
+		char * name = proc->name + strlen(proc->name) - 1;
+		while (1) {
+			if (*name == '/') {
+				name++;
+				break;
+			}
+			if (name == proc->name) break;
+			name--;
+		}
+		size_t name_len = strlen(name);
+		if (name_len > sizeof(fresh.name) - 1) name_len = sizeof(fresh.name) - 1;
+		memcpy(fresh.name, name, name_len);
+
+		if (cached_pid != (int)node->inode || memcmp(&fresh, &cached, sizeof(fresh))) {
+			fresh.generation++;
+		}
+		memcpy(&cached, &fresh, sizeof(cached));
+		cached_pid = (int)node->inode;
+		cached_tick = timer_ticks;
+	}
+
+	size_t _bsize = sizeof(cached);
+	if (offset > _bsize) return 0;
+	if (size > _bsize - offset) size = _bsize - offset;
+
+	memcpy(buffer, (uint8_t *)&cached + offset, size);
+	return size;
+}
+
+/* FNV-1a over the record payload; doubles as the generation field so
+ * pollers can skip unchanged snapshots without us caching anything. */
+static uint32_t procfs_bin_checksum(uint8_t * data, size_t len) {
+	uint32_t hash = 0x811c9dc5;
+	for (size_t i = 0; i < len; ++i) {
+		hash ^= data[i];
+		hash *= 0x01000193;
+	}
+	return hash;
+}
+
+static uint32_t proc_fd_func(fs_node_t *node, uint64_t offset, uint32_t size, uint8_t *buffer) {
+	process_t * proc = process_from_pid(node->inode);
+
+	if (!proc || !proc->fds) {
+		return 0;
+	}
+
+	fd_table_t * fds = proc->fds;
+	char * buf = malloc((fds->length + 1) * 320);
+	unsigned int soffset = 0;
+
+	for (unsigned int i = 0; i < fds->length; ++i) {
+		if (!fds->entries[i]) continue;
+		soffset += sprintf(&buf[soffset], "%d\tmode 0x%x\toffset %d\t%s\n",
+				i, fds->modes[i], (int)fds->offsets[i], fds->entries[i]->name);
+	}
+
+	size_t _bsize = soffset;
+	if (offset > _bsize) {
+		free(buf);
+		return 0;
+	}
+	if (size > _bsize - offset) size = _bsize - offset;
+
+	memcpy(buffer, buf + offset, size);
+	free(buf);
+	return size;
+}
+
+static uint32_t proc_fd_bin_func(fs_node_t *node, uint64_t offset, uint32_t size, uint8_t *buffer) {
+	process_t * proc = process_from_pid(node->inode);
+
+	if (!proc || !proc->fds) {
+		return 0;
+	}
+
+	fd_table_t * fds = proc->fds;
+	uint8_t * buf = malloc(sizeof(struct procfs_fd_bin) + fds->length * sizeof(struct procfs_fd_bin_entry));
+	struct procfs_fd_bin * header = (struct procfs_fd_bin *)buf;
+	struct procfs_fd_bin_entry * entries = (struct procfs_fd_bin_entry *)(header + 1);
+
+	header->version = PROCFS_BIN_VERSION;
+	header->count = 0;
+
+	for (unsigned int i = 0; i < fds->length; ++i) {
+		if (!fds->entries[i]) continue;
+		struct procfs_fd_bin_entry * e = &entries[header->count++];
+		memset(e, 0, sizeof(*e));
+		e->fd = i;
+		e->mode = fds->modes[i];
+		e->node_flags = fds->entries[i]->flags;
+		e->offset_lo = (uint32_t)fds->offsets[i];
+		e->offset_hi = (uint32_t)(fds->offsets[i] >> 32);
+		size_t name_len = strlen(fds->entries[i]->name);
+		if (name_len > sizeof(e->name) - 1) name_len = sizeof(e->name) - 1;
+		memcpy(e->name, fds->entries[i]->name, name_len);
+	}
+
+	header->generation = procfs_bin_checksum((uint8_t *)entries, header->count * sizeof(*entries));
+
+	size_t _bsize = sizeof(*header) + header->count * sizeof(*entries);
+	if (offset > _bsize) {
+		free(buf);
+		return 0;
+	}
+	if (size > _bsize - offset) size = _bsize - offset;
+
+	memcpy(buffer, buf + offset, size);
+	free(buf);
+	return size;
+}
+
+/*
+ * Walk a page directory and coalesce present user pages into regions
+ * of identical flags. With `out` NULL this just counts regions, so
+ * callers size a buffer with one pass and fill it with a second.
+ */
+static size_t maps_walk(page_directory_t * src, struct procfs_maps_bin_entry * out, size_t max) {
+	size_t count = 0;
+	uint32_t start = 0;
+	uint32_t pages = 0;
+	uint32_t flags = 0;
+	int active = 0;
+
+	for (uint32_t i = 0; i < 1024; ++i) {
+		if (!src->tables[i] || (uintptr_t)src->tables[i] == (uintptr_t)0xFFFFFFFF ||
+			kernel_directory->tables[i] == src->tables[i]) {
+			if (active) {
+				if (out && count < max) {
+					out[count].start = start;
+					out[count].end   = start + pages * 0x1000;
+					out[count].pages = pages;
+					out[count].flags = flags;
+				}
+				count++;
+				active = 0;
+			}
+			continue;
+		}
+		for (int j = 0; j < 1024; ++j) {
+			page_t * page = &src->tables[i]->pages[j];
+			uint32_t addr = (i * 1024 + j) * 0x1000;
+			uint32_t page_flags = 0;
+			if (page->frame) {
+				if (page->rw)  page_flags |= PROCFS_MAP_WRITE;
+				if (page->cow) page_flags |= PROCFS_MAP_COW;
+				if (addr >= SHM_START) page_flags |= PROCFS_MAP_SHM;
+			}
+			if (active && (!page->frame || page_flags != flags)) {
+				if (out && count < max) {
+					out[count].start = start;
+					out[count].end   = start + pages * 0x1000;
+					out[count].pages = pages;
+					out[count].flags = flags;
+				}
+				count++;
+				active = 0;
+			}
+			if (!page->frame) continue;
+			if (!active) {
+				start = addr;
+				pages = 0;
+				flags = page_flags;
+				active = 1;
+			}
+			pages++;
+		}
+	}
+
+	if (active) {
+		if (out && count < max) {
+			out[count].start = start;
+			out[count].end   = start + pages * 0x1000;
+			out[count].pages = pages;
+			out[count].flags = flags;
+		}
+		count++;
+	}
+
+	return count;
+}
+
+static uint32_t proc_maps_func(fs_node_t *node, uint64_t offset, uint32_t size, uint8_t *buffer) {
+	process_t * proc = process_from_pid(node->inode);
+
+	if (!proc) {
+		return 0;
+	}
+
+	size_t count = maps_walk(proc->thread.page_directory, NULL, 0);
+	struct procfs_maps_bin_entry * regions = malloc(count * sizeof(struct procfs_maps_bin_entry));
+	count = maps_walk(proc->thread.page_directory, regions, count);
+
+	char * buf = malloc((count + 1) * 96);
+	unsigned int soffset = 0;
+	for (size_t i = 0; i < count; ++i) {
+		soffset += sprintf(&buf[soffset], "0x%x-0x%x %c%c%c %d kB\n",
+				regions[i].start, regions[i].end,
+				(regions[i].flags & PROCFS_MAP_WRITE) ? 'w' : 'r',
+				(regions[i].flags & PROCFS_MAP_COW)   ? 'c' : '-',
+				(regions[i].flags & PROCFS_MAP_SHM)   ? 's' : '-',
+				regions[i].pages * 4);
+	}
+	free(regions);
+
+	size_t _bsize = soffset;
+	if (offset > _bsize) {
+		free(buf);
+		return 0;
+	}
+	if (size > _bsize - offset) size = _bsize - offset;
+
+	memcpy(buffer, buf + offset, size);
+	free(buf);
+	return size;
+}
+
+static uint32_t proc_maps_bin_func(fs_node_t *node, uint64_t offset, uint32_t size, uint8_t *buffer) {
+	process_t * proc = process_from_pid(node->inode);
+
+	if (!proc) {
+		return 0;
+	}
+
+	size_t count = maps_walk(proc->thread.page_directory, NULL, 0);
+	uint8_t * buf = malloc(sizeof(struct procfs_maps_bin) + count * sizeof(struct procfs_maps_bin_entry));
+	struct procfs_maps_bin * header = (struct procfs_maps_bin *)buf;
+	struct procfs_maps_bin_entry * entries = (struct procfs_maps_bin_entry *)(header + 1);
+
+	header->version = PROCFS_BIN_VERSION;
+	header->count = maps_walk(proc->thread.page_directory, entries, count);
+	header->generation = procfs_bin_checksum((uint8_t *)entries, header->count * sizeof(*entries));
+
+	size_t _bsize = sizeof(*header) + header->count * sizeof(*entries);
+	if (offset > _bsize) {
+		free(buf);
+		return 0;
+	}
+	if (size > _bsize - offset) size = _bsize - offset;
+
+	memcpy(buffer, buf + offset, size);
+	free(buf);
+	return size;
+}
+
 static struct procfs_entry procdir_entries[] = {
 	{1, "cmdline", proc_cmdline_func},
 	{2, "status",  proc_status_func},
+	{3, "status_bin", proc_status_bin_func},
+	{4, "fd",      proc_fd_func},
+	{5, "fd_bin",  proc_fd_bin_func},
+	{6, "maps",    proc_maps_func},
+	{7, "maps_bin", proc_maps_bin_func},
 };
 
 static struct dirent * readdir_procfs_procdir(fs_node_t *node, uint32_t index) {
@@ -333,6 +632,22 @@ static uint32_t meminfo_func(fs_node_t *node, uint64_t offset, uint32_t size, ui
 		"KHeapUse: %d kB\n"
 		, total, free, kheap);
 
+	if (swap_active()) {
+		sprintf(buf + strlen(buf),
+			"SwapTotal: %d kB\n"
+			"SwapFree: %d kB\n"
+			"SwapOut: %d\n"
+			"SwapIn: %d\n"
+			"SwapScanned: %d\n"
+			"SwapPasses: %d\n"
+			, (unsigned int)(swap_slots_total * 4)
+			, (unsigned int)((swap_slots_total - swap_slots_used) * 4)
+			, (unsigned int)swap_pages_out
+			, (unsigned int)swap_pages_in
+			, (unsigned int)swap_pages_scanned
+			, (unsigned int)swap_passes);
+	}
+
 	size_t _bsize = strlen(buf);
 	if (offset > _bsize) return 0;
 	if (size > _bsize - offset) size = _bsize - offset;
@@ -341,6 +656,32 @@ static uint32_t meminfo_func(fs_node_t *node, uint64_t offset, uint32_t size, ui
 	return size;
 }
 
+static uint32_t meminfo_bin_func(fs_node_t *node, uint64_t offset, uint32_t size, uint8_t *buffer) {
+	static struct procfs_meminfo_bin cached = { PROCFS_BIN_VERSION, 0, 0, 0, 0 };
+	static unsigned long cached_tick = (unsigned long)-1;
+
+	if (cached_tick != timer_ticks) {
+		unsigned int total = memory_total();
+		unsigned int free  = total - memory_use();
+		unsigned int kheap = (heap_end - kernel_heap_alloc_point) / 1024;
+
+		if (total != cached.total_kb || free != cached.free_kb || kheap != cached.kheap_kb) {
+			cached.total_kb = total;
+			cached.free_kb  = free;
+			cached.kheap_kb = kheap;
+			cached.generation++;
+		}
+		cached_tick = timer_ticks;
+	}
+
+	size_t _bsize = sizeof(cached);
+	if (offset > _bsize) return 0;
+	if (size > _bsize - offset) size = _bsize - offset;
+
+	memcpy(buffer, (uint8_t *)&cached + offset, size);
+	return size;
+}
+
 static uint32_t pat_func(fs_node_t *node, uint64_t offset, uint32_t size, uint8_t *buffer) {
 	char buf[1024];
 
@@ -407,6 +748,24 @@ static uint32_t uptime_func(fs_node_t *node, uint64_t offset, uint32_t size, uin
 	return size;
 }
 
+static uint32_t uptime_bin_func(fs_node_t *node, uint64_t offset, uint32_t size, uint8_t *buffer) {
+	/* The uptime changes on every tick, so the tick count doubles
+	 * as the generation */
+	struct procfs_uptime_bin out = {
+		PROCFS_BIN_VERSION,
+		timer_ticks,
+		timer_ticks,
+		timer_subticks,
+	};
+
+	size_t _bsize = sizeof(out);
+	if (offset > _bsize) return 0;
+	if (size > _bsize - offset) size = _bsize - offset;
+
+	memcpy(buffer, (uint8_t *)&out + offset, size);
+	return size;
+}
+
 static uint32_t cmdline_func(fs_node_t *node, uint64_t offset, uint32_t size, uint8_t *buffer) {
 	char buf[1024];
 	extern char * cmdline;
@@ -689,6 +1048,211 @@ static uint32_t pci_func(fs_node_t *node, uint64_t offset, uint32_t size, uint8_
 	return size;
 }
 
+static uint32_t profile_func(fs_node_t *node, uint64_t offset, uint32_t size, uint8_t *buffer) {
+	/* Samples are drained as a stream; the file offset does not apply. */
+	return profile_fetch(buffer, size);
+}
+
+static uint32_t profile_write_func(fs_node_t *node, uint64_t offset, uint32_t size, uint8_t *buffer) {
+	char tmp[32];
+	if (size > sizeof(tmp) - 1) size = sizeof(tmp) - 1;
+	memcpy(tmp, buffer, size);
+	tmp[size] = '\0';
+	profile_set_interval(atoi(tmp));
+	return size;
+}
+
+extern char kernel_symbols_start[];
+extern char kernel_symbols_end[];
+
+typedef struct {
+	uintptr_t addr;
+	char name[];
+} kernel_symbol_t;
+
+static uint32_t ksym_func(fs_node_t *node, uint64_t offset, uint32_t size, uint8_t *buffer) {
+	size_t count = 0;
+	kernel_symbol_t * k = (kernel_symbol_t *)&kernel_symbols_start;
+	while ((uintptr_t)k < (uintptr_t)&kernel_symbols_end) {
+		count++;
+		k = (kernel_symbol_t *)((uintptr_t)k + sizeof *k + strlen(k->name) + 1);
+	}
+
+	char * buf = malloc(count * 64);
+	unsigned int soffset = 0;
+	k = (kernel_symbol_t *)&kernel_symbols_start;
+	while ((uintptr_t)k < (uintptr_t)&kernel_symbols_end) {
+		soffset += sprintf(&buf[soffset], "0x%x %s\n", (uintptr_t)k->addr, k->name);
+		k = (kernel_symbol_t *)((uintptr_t)k + sizeof *k + strlen(k->name) + 1);
+	}
+
+	size_t _bsize = soffset;
+	if (offset > _bsize) {
+		free(buf);
+		return 0;
+	}
+	if (size > _bsize - offset) size = _bsize - offset;
+
+	memcpy(buffer, buf + offset, size);
+	free(buf);
+	return size;
+}
+
+static uint32_t syscalls_func(fs_node_t *node, uint64_t offset, uint32_t size, uint8_t *buffer) {
+	char * buf = malloc(num_syscalls * 512);
+	unsigned int soffset = 0;
+
+	soffset += sprintf(&buf[soffset], "enabled: %d\n", syscall_stats_enabled);
+	for (uint32_t i = 0; i < num_syscalls; ++i) {
+		struct syscall_stats * s = &syscall_stats[i];
+		if (!s->count) continue;
+		soffset += sprintf(&buf[soffset], "%s %d",
+				syscall_names[i] ? syscall_names[i] : "?",
+				(uint32_t)s->count);
+		for (int b = 0; b < SYSCALL_STAT_BUCKETS; ++b) {
+			if (s->buckets[b]) {
+				soffset += sprintf(&buf[soffset], " %d:%d", b, s->buckets[b]);
+			}
+		}
+		soffset += sprintf(&buf[soffset], "\n");
+	}
+
+	size_t _bsize = soffset;
+	if (offset > _bsize) {
+		free(buf);
+		return 0;
+	}
+	if (size > _bsize - offset) size = _bsize - offset;
+
+	memcpy(buffer, buf + offset, size);
+	free(buf);
+	return size;
+}
+
+static uint32_t trace_func(fs_node_t *node, uint64_t offset, uint32_t size, uint8_t *buffer) {
+	/* Events are drained as a stream; the file offset does not apply. */
+	return trace_fetch(buffer, size);
+}
+
+static uint32_t trace_write_func(fs_node_t *node, uint64_t offset, uint32_t size, uint8_t *buffer) {
+	char tmp[32];
+	if (size > sizeof(tmp) - 1) size = sizeof(tmp) - 1;
+	memcpy(tmp, buffer, size);
+	tmp[size] = '\0';
+	trace_enabled = !!atoi(tmp);
+	return size;
+}
+
+#define KLOG_DUMP_SIZE 0xC000
+
+static uint32_t klog_func(fs_node_t *node, uint64_t offset, uint32_t size, uint8_t *buffer) {
+	char * buf = malloc(KLOG_DUMP_SIZE);
+	size_t _bsize = klog_dump(buf, KLOG_DUMP_SIZE);
+
+	if (offset > _bsize) {
+		free(buf);
+		return 0;
+	}
+	if (size > _bsize - offset) size = _bsize - offset;
+
+	memcpy(buffer, buf + offset, size);
+	free(buf);
+	return size;
+}
+
+#define BOOTMARKS_DUMP_SIZE 0x3000
+
+static uint32_t bootmarks_func(fs_node_t *node, uint64_t offset, uint32_t size, uint8_t *buffer) {
+	char * buf = malloc(BOOTMARKS_DUMP_SIZE);
+	size_t _bsize = bootmarks_dump(buf, BOOTMARKS_DUMP_SIZE);
+
+	if (offset > _bsize) {
+		free(buf);
+		return 0;
+	}
+	if (size > _bsize - offset) size = _bsize - offset;
+
+	memcpy(buffer, buf + offset, size);
+	free(buf);
+	return size;
+}
+
+static uint32_t cpu_func(fs_node_t *node, uint64_t offset, uint32_t size, uint8_t *buffer) {
+	char buf[512];
+
+	/* Idle time is whatever got charged to the idle task; everything
+	 * else was real work. There is no hypervisor interface to ask
+	 * about stolen time here, so we don't report it. */
+	unsigned long total_ms = timer_ticks * 1000 + timer_subticks;
+	unsigned long idle_ms  = kernel_idle_task ?
+		(kernel_idle_task->usage_user + kernel_idle_task->usage_kernel) : 0;
+
+	sprintf(buf,
+			"TotalMsec:\t%d\n"
+			"IdleMsec:\t%d\n"
+			"CtxSwitches:\t%d\n"
+			"PageFaults:\t%d\n"
+			,
+			(int)total_ms,
+			(int)idle_ms,
+			(int)total_ctx_switches,
+			(int)total_page_faults
+			);
+
+	size_t _bsize = strlen(buf);
+	if (offset > _bsize) return 0;
+	if (size > _bsize - offset) size = _bsize - offset;
+
+	memcpy(buffer, buf + offset, size);
+	return size;
+}
+
+static uint32_t spinlocks_func(fs_node_t *node, uint64_t offset, uint32_t size, uint8_t *buffer) {
+	char * buf = malloc(4096);
+	size_t _bsize = spin_debug_dump(buf);
+
+	if (offset > _bsize) {
+		free(buf);
+		return 0;
+	}
+	if (size > _bsize - offset) size = _bsize - offset;
+
+	memcpy(buffer, buf + offset, size);
+	free(buf);
+	return size;
+}
+
+static uint32_t heap_func(fs_node_t *node, uint64_t offset, uint32_t size, uint8_t *buffer) {
+	char * buf = malloc(8192);
+	size_t _bsize = heap_debug_dump(buf);
+
+	if (offset > _bsize) {
+		free(buf);
+		return 0;
+	}
+	if (size > _bsize - offset) size = _bsize - offset;
+
+	memcpy(buffer, buf + offset, size);
+	free(buf);
+	return size;
+}
+
+#define BOOTOPENS_DUMP_SIZE 16384
+static uint32_t bootopens_func(fs_node_t *node, uint64_t offset, uint32_t size, uint8_t *buffer) {
+	char * buf = malloc(BOOTOPENS_DUMP_SIZE);
+	size_t _bsize = vfs_bootopens_dump(buf, BOOTOPENS_DUMP_SIZE);
+
+	if (offset > _bsize) {
+		free(buf);
+		return 0;
+	}
+	if (size > _bsize - offset) size = _bsize - offset;
+
+	memcpy(buffer, buf + offset, size);
+	free(buf);
+	return size;
+}
+
 static struct procfs_entry std_entries[] = {
 	{-1, "cpuinfo",  cpuinfo_func},
 	{-2, "meminfo",  meminfo_func},
@@ -703,6 +1267,18 @@ static struct procfs_entry std_entries[] = {
 	{-11,"irq",      irq_func},
 	{-12,"pat",      pat_func},
 	{-13,"pci",      pci_func},
+	{-14,"profile",  profile_func},
+	{-15,"ksym",     ksym_func},
+	{-16,"syscalls", syscalls_func},
+	{-17,"trace",    trace_func},
+	{-18,"klog",     klog_func},
+	{-19,"meminfo_bin", meminfo_bin_func},
+	{-20,"uptime_bin",  uptime_bin_func},
+	{-21,"cpu",      cpu_func},
+	{-22,"bootmarks", bootmarks_func},
+	{-23,"spinlocks", spinlocks_func},
+	{-24,"heap",     heap_func},
+	{-25,"bootopens", bootopens_func},
 };
 
 static list_t * extended_entries = NULL;
@@ -861,6 +1437,16 @@ static fs_node_t * finddir_procfs_root(fs_node_t * node, char * name) {
 	for (unsigned int i = 0; i < PROCFS_STANDARD_ENTRIES; ++i) {
 		if (!strcmp(name, std_entries[i].name)) {
 			fs_node_t * out = procfs_generic_create(std_entries[i].name, std_entries[i].func);
+			if (std_entries[i].func == profile_func) {
+				/* The sampling interval is set by writing to this node. */
+				out->write = profile_write_func;
+				out->mask  = 0644;
+			}
+			if (std_entries[i].func == trace_func) {
+				/* Tracing is enabled or disabled by writing 1 or 0. */
+				out->write = trace_write_func;
+				out->mask  = 0644;
+			}
 			return out;
 		}
 	}
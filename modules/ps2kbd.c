@@ -16,12 +16,38 @@
 #include <kernel/pipe.h>
 #include <kernel/process.h>
 #include <kernel/module.h>
+#include <kernel/workqueue.h>
+
+#include <toaru/kbd.h>
 
 #define KEY_DEVICE  0x60
 #define KEY_PENDING 0x64
 #define KEY_IRQ     1
 
+#define KBD_RING_SIZE 64
+
+#define EVENTS_IN_PIPE 128
+#define EVENT_DISCARD_POINT 32
+
 static fs_node_t * keyboard_pipe;
+static fs_node_t * keyboard_event_pipe;
+
+/* Translation state for the event device: scancodes are parsed
+ * exactly once, here, instead of by every reader of the raw pipe. */
+static key_event_state_t kbd_state = {0};
+
+/* Scancodes land here in interrupt context and get pushed into the
+ * pipe by the work queue; the pipe write takes locks and wakes
+ * readers, which is too much for the handler itself. The interrupt
+ * timestamp rides along so translated events carry arrival time,
+ * not drain time. */
+struct kbd_ring_entry {
+	uint8_t scancode;
+	uint32_t timestamp;
+};
+static struct kbd_ring_entry kbd_ring[KBD_RING_SIZE];
+static volatile unsigned int kbd_produced = 0;
+static volatile unsigned int kbd_drained = 0;
 
 /*
  * Wait on the keyboard.
@@ -30,6 +56,29 @@ static void keyboard_wait(void) {
 	while(inportb(KEY_PENDING) & 2);
 }
 
+/*
+ * Bottom half: drain buffered scancodes into the device pipe.
+ */
+static void keyboard_bottom_half(void * arg) {
+	while (kbd_drained != kbd_produced) {
+		struct kbd_ring_entry entry = kbd_ring[kbd_drained % KBD_RING_SIZE];
+		kbd_drained++;
+		write_fs(keyboard_pipe, 0, 1, &entry.scancode);
+
+		/* Translate once, here; 0xE0 prefixes produce no event yet. */
+		key_event_t event;
+		kbd_scancode(&kbd_state, entry.scancode, &event);
+		if (event.action) {
+			event.timestamp = entry.timestamp;
+			key_event_t bitbucket;
+			while (pipe_size(keyboard_event_pipe) > (int)(EVENT_DISCARD_POINT * sizeof(event))) {
+				read_fs(keyboard_event_pipe, 0, sizeof(event), (uint8_t *)&bitbucket);
+			}
+			write_fs(keyboard_event_pipe, 0, sizeof(event), (uint8_t *)&event);
+		}
+	}
+}
+
 /*
  * Keyboard interrupt callback
  */
@@ -37,8 +86,14 @@ static int keyboard_handler(struct regs *r) {
 	unsigned char scancode;
 	if (inportb(KEY_PENDING) & 0x01) {
 		scancode = inportb(KEY_DEVICE);
-
-		write_fs(keyboard_pipe, 0, 1, (uint8_t []){scancode});
+		random_feed_entropy(scancode);
+
+		if (kbd_produced - kbd_drained < KBD_RING_SIZE) {
+			kbd_ring[kbd_produced % KBD_RING_SIZE].scancode = scancode;
+			kbd_ring[kbd_produced % KBD_RING_SIZE].timestamp = timer_ticks * 1000 + timer_subticks;
+			kbd_produced++;
+		}
+		workqueue_schedule_prio(keyboard_bottom_half, NULL, WORKQUEUE_PRIORITY_HIGH);
 	}
 
 	irq_ack(KEY_IRQ);
@@ -59,6 +114,14 @@ static int keyboard_install(void) {
 
 	vfs_mount("/dev/kbd", keyboard_pipe);
 
+	/* Translated key events with timestamps, for readers that would
+	 * otherwise re-run the scancode state machine themselves */
+	keyboard_event_pipe = make_pipe(sizeof(key_event_t) * EVENTS_IN_PIPE);
+
+	keyboard_event_pipe->flags = FS_CHARDEVICE;
+
+	vfs_mount("/dev/kbdev", keyboard_event_pipe);
+
 	/* Install the interrupt handler */
 	irq_install_handler(KEY_IRQ, keyboard_handler, "ps2 kbd");
 
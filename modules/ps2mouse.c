@@ -81,6 +81,7 @@ static int mouse_handler(struct regs *r) {
 			break;
 		}
 		int8_t mouse_in = inportb(MOUSE_PORT);
+		random_feed_entropy((uint8_t)mouse_in);
 		switch (mouse_cycle) {
 			case 0:
 				mouse_byte[0] = mouse_in;
@@ -126,6 +127,7 @@ finish_packet:
 		packet.x_difference = x;
 		packet.y_difference = y;
 		packet.buttons = 0;
+		packet.timestamp = timer_ticks * 1000 + timer_subticks;
 		if (mouse_byte[0] & 0x01) {
 			packet.buttons |= LEFT_CLICK;
 		}
@@ -150,7 +152,10 @@ finish_packet:
 		}
 		write_fs(mouse_pipe, 0, sizeof(packet), (uint8_t *)&packet);
 read_next:
-		break;
+		/* Keep draining while the controller has more mouse bytes, so a
+		 * fast-moving mouse batches several packets into one interrupt's
+		 * worth of pipe writes instead of waking the reader per byte. */
+		status = inportb(MOUSE_STATUS);
 	}
 	irq_ack(MOUSE_IRQ);
 	return 1;
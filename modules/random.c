@@ -5,6 +5,14 @@
  *
  * Provides access to the kernel RNG
  *
+ * ChaCha20-based generator keyed from the kernel entropy pool
+ * (interrupt timing jitter fed by the timer and PS/2 drivers).
+ * Output is produced a buffer at a time and served with memcpy;
+ * after each batch the generator rekeys itself from the front of
+ * that batch and wipes it (fast key erasure), so compromising the
+ * state later never reveals output already handed out. The key is
+ * additionally stirred from the entropy pool whenever new events
+ * have accumulated or enough output has been drawn.
  */
 
 #include <kernel/system.h>
@@ -12,16 +20,90 @@
 #include <kernel/fs.h>
 #include <kernel/module.h>
 
+#define CHACHA_ROUNDS   20
+#define RANDOM_BUFFER   1024
+#define RESEED_BYTES    (1024 * 1024)
+
+static uint32_t chacha_input[16];
+static uint8_t  random_buffer[RANDOM_BUFFER];
+static size_t   random_pos = RANDOM_BUFFER; /* Start exhausted */
+static unsigned long bytes_since_reseed = 0;
+static unsigned long last_entropy_events = 0;
+static spin_lock_t random_lock = { 0 };
+
+#define ROTL(v,n) (((v) << (n)) | ((v) >> (32 - (n))))
+#define QR(a,b,c,d) \
+	a += b; d ^= a; d = ROTL(d,16); \
+	c += d; b ^= c; b = ROTL(b,12); \
+	a += b; d ^= a; d = ROTL(d, 8); \
+	c += d; b ^= c; b = ROTL(b, 7);
+
+static void chacha_block(uint32_t out[16]) {
+	uint32_t x[16];
+	memcpy(x, chacha_input, sizeof(x));
+	for (int i = 0; i < CHACHA_ROUNDS; i += 2) {
+		QR(x[0], x[4], x[ 8], x[12]);
+		QR(x[1], x[5], x[ 9], x[13]);
+		QR(x[2], x[6], x[10], x[14]);
+		QR(x[3], x[7], x[11], x[15]);
+		QR(x[0], x[5], x[10], x[15]);
+		QR(x[1], x[6], x[11], x[12]);
+		QR(x[2], x[7], x[ 8], x[13]);
+		QR(x[3], x[4], x[ 9], x[14]);
+	}
+	for (int i = 0; i < 16; ++i) {
+		out[i] = x[i] + chacha_input[i];
+	}
+	chacha_input[12]++;
+	if (!chacha_input[12]) chacha_input[13]++;
+}
+
+/* Fold the kernel entropy pool into the key words */
+static void random_stir(void) {
+	random_entropy_fetch(&chacha_input[4], 8);
+	last_entropy_events = entropy_events;
+	bytes_since_reseed = 0;
+}
+
+/*
+ * Generate a fresh buffer of output, then rekey from the first 64
+ * bytes of it and serve the rest. The served region is wiped behind
+ * the reader in read_random, so nothing recoverable stays around.
+ */
+static void random_refill(void) {
+	if (entropy_events != last_entropy_events || bytes_since_reseed > RESEED_BYTES) {
+		random_stir();
+	}
+	for (size_t i = 0; i < RANDOM_BUFFER; i += 64) {
+		chacha_block((uint32_t *)&random_buffer[i]);
+	}
+	memcpy(&chacha_input[4], random_buffer, 32); /* Rekey */
+	memset(random_buffer, 0, 64);
+	random_pos = 64;
+	bytes_since_reseed += RANDOM_BUFFER;
+}
+
 static uint32_t read_random(fs_node_t *node, uint64_t offset, uint32_t size, uint8_t *buffer) {
 	uint32_t s = 0;
+	spin_lock(random_lock);
 	while (s < size) {
-		buffer[s] = krand() % 0xFF;
-		s++;
+		if (random_pos >= RANDOM_BUFFER) random_refill();
+		size_t chunk = RANDOM_BUFFER - random_pos;
+		if (chunk > size - s) chunk = size - s;
+		memcpy(buffer + s, &random_buffer[random_pos], chunk);
+		memset(&random_buffer[random_pos], 0, chunk);
+		random_pos += chunk;
+		s += chunk;
 	}
+	spin_unlock(random_lock);
 	return size;
 }
 
 static uint32_t write_random(fs_node_t *node, uint64_t offset, uint32_t size, uint8_t *buffer) {
+	/* Writes are credited to the entropy pool; anyone may contribute */
+	for (uint32_t i = 0; i + 3 < size; i += 4) {
+		random_feed_entropy(*(uint32_t *)(buffer + i));
+	}
 	return size;
 }
 
@@ -40,7 +122,7 @@ static fs_node_t * random_device_create(void) {
 	strcpy(fnode->name, "random");
 	fnode->uid = 0;
 	fnode->gid = 0;
-	fnode->mask = 0444;
+	fnode->mask = 0666;
 	fnode->length  = 1024;
 	fnode->flags   = FS_CHARDEVICE;
 	fnode->read    = read_random;
@@ -54,6 +136,18 @@ static fs_node_t * random_device_create(void) {
 }
 
 static int random_initialize(void) {
+	/* "expand 32-byte k", then key/counter/nonce from whatever the
+	 * pool has gathered by now plus boot-time values */
+	chacha_input[0] = 0x61707865;
+	chacha_input[1] = 0x3320646e;
+	chacha_input[2] = 0x79622d32;
+	chacha_input[3] = 0x6b206574;
+	chacha_input[14] = now();
+	chacha_input[15] = (uint32_t)(uintptr_t)&random_initialize;
+	random_feed_entropy(timer_ticks);
+	random_feed_entropy(memory_use());
+	random_stir();
+
 	vfs_mount("/dev/random", random_device_create());
 	vfs_mount("/dev/urandom", random_device_create());
 	return 0;
@@ -50,27 +50,33 @@ static uint8_t * rtl_rx_buffer;
 static uint8_t * rtl_tx_buffer[5];
 static uint8_t mac[6];
 
-static uint8_t * last_packet = NULL;
-
 static uintptr_t rtl_rx_phys;
 static uintptr_t rtl_tx_phys[5];
 
 static uint32_t cur_rx = 0;
 static int dirty_tx = 0;
 static int next_tx = 0;
+static int free_tx = 4; /* The card has four transmit descriptors */
 
 static list_t * rx_wait;
+static list_t * tx_wait;
 
 static spin_lock_t _lock;
 static int next_tx_buf(void) {
 	int out;
-	spin_lock(_lock);
-	out = next_tx;
-	next_tx++;
-	if (next_tx == 4) {
-		next_tx = 0;
+	for (;;) {
+		spin_lock(_lock);
+		if (free_tx > 0) {
+			free_tx--;
+			out = next_tx;
+			next_tx = (next_tx + 1) & 3;
+			spin_unlock(_lock);
+			break;
+		}
+		spin_unlock(_lock);
+		/* All four descriptors are in flight; wait for a completion. */
+		sleep_on(tx_wait);
 	}
-	spin_unlock(_lock);
 	return out;
 }
 
@@ -81,7 +87,7 @@ void* rtl_dequeue() {
 
 	spin_lock(net_queue_lock);
 	node_t * n = list_dequeue(net_queue);
-	void* value = (struct ethernet_packet *)n->value;
+	void* value = n->value;
 	free(n);
 	spin_unlock(net_queue_lock);
 
@@ -107,64 +113,164 @@ void rtl_send_packet(uint8_t* payload, size_t payload_size) {
 	outportl(rtl_iobase + RTL_PORT_TXSTAT + 4 * my_tx, payload_size);
 }
 
-struct ethernet_packet* rtl_get_packet(void) {
-	return (struct ethernet_packet*)rtl_dequeue();
+struct netbuf* rtl_get_packet(void) {
+	/* Frames are handed up in place from the receive ring; the release
+	 * callback returns the ring space to the card. */
+	return (struct netbuf *)rtl_dequeue();
 }
 
-static int rtl_irq_handler(struct regs *r) {
-	uint16_t status = inports(rtl_iobase + RTL_PORT_ISR);
-	if (!status) {
-		return 0;
+#define RTL_INTS_RX (0x01 | 0x02 | 0x10 | 0x20 | 0x40)
+#define RTL_INTS_ALL (0x8000 | 0x4000 | RTL_INTS_RX | 0x08 | 0x04)
+
+/* Outstanding receive ring segments. Each frame handed up to the stack
+ * holds a slot describing where the ring read pointer should move once
+ * that frame has been consumed. */
+#define RTL_RX_SLOTS 64
+
+struct rtl_rx_slot {
+	uint32_t next_rx; /* cur_rx after the packet this slot covers */
+	int released;
+};
+
+static struct rtl_rx_slot rx_slots[RTL_RX_SLOTS];
+static unsigned int rx_slot_head = 0;
+static unsigned int rx_slot_tail = 0;
+static int rx_stalled = 0;
+static spin_lock_t rx_slot_lock = { 0 };
+
+/**
+ * Advance CAPR through the contiguous prefix of released slots. The
+ * card only understands monotonic ring order, so an out-of-order
+ * release just marks its slot and waits for the older ones.
+ *
+ * Call with rx_slot_lock held.
+ */
+static void rtl_rx_advance(void) {
+	int any = 0;
+	uint32_t next_rx = 0;
+	while (rx_slot_tail != rx_slot_head && rx_slots[rx_slot_tail % RTL_RX_SLOTS].released) {
+		next_rx = rx_slots[rx_slot_tail % RTL_RX_SLOTS].next_rx;
+		rx_slot_tail++;
+		any = 1;
 	}
-	outports(rtl_iobase + RTL_PORT_ISR, status);
+	if (any) {
+		outports(rtl_iobase + RTL_PORT_RXPTR, (next_rx - 16) & 0xFFFF);
+		if (rx_stalled) {
+			rx_stalled = 0;
+			net_poll_schedule();
+		}
+	}
+}
 
-	irq_ack(rtl_irq);
+static void rtl_rx_release(struct netbuf * nb) {
+	unsigned int slot = (unsigned int)(uintptr_t)nb->extra;
+	spin_lock(rx_slot_lock);
+	rx_slots[slot % RTL_RX_SLOTS].released = 1;
+	rtl_rx_advance();
+	spin_unlock(rx_slot_lock);
+	free(nb);
+}
 
-	if (status & 0x01 || status & 0x02) {
-		/* Receive */
-		while((inportb(rtl_iobase + RTL_PORT_CMD) & 0x01) == 0) {
-			int offset = cur_rx % 0x2000;
+/**
+ * Drain up to `budget` frames from the receive ring. Runs from the
+ * [netpoll] tasklet with the RX interrupt sources masked.
+ */
+static int rtl_poll(int budget) {
+	int handled = 0;
+
+	while (handled < budget) {
+		spin_lock(rx_slot_lock);
+		int full = (rx_slot_head - rx_slot_tail) == RTL_RX_SLOTS;
+		if (full) rx_stalled = 1;
+		spin_unlock(rx_slot_lock);
+		if (full) break; /* Every slot is outstanding; a release reschedules us */
+
+		/* CAPR lags behind unreleased frames, so the buffer-empty bit
+		 * in the command register is useless here; compare against the
+		 * card's write offset instead. */
+		int offset = cur_rx % 0x2000;
+		if (offset == inports(rtl_iobase + RTL_PORT_RXADDR) % 0x2000) break;
+
+		uint32_t * buf_start = (uint32_t *)((uintptr_t)rtl_rx_buffer + offset);
+		uint32_t rx_status = buf_start[0];
+		int rx_size = rx_status >> 16;
+
+		if (rx_size == 0xfff0) break; /* DMA of this packet is still in progress */
+
+		uint32_t next_rx = (cur_rx + rx_size + 4 + 3) & ~3;
+
+		spin_lock(rx_slot_lock);
+		struct rtl_rx_slot * slot = &rx_slots[rx_slot_head % RTL_RX_SLOTS];
+		unsigned int slot_id = rx_slot_head++;
+		slot->next_rx = next_rx;
+		slot->released = 0;
+		spin_unlock(rx_slot_lock);
+
+		if (rx_status & (0x0020 | 0x0010 | 0x0004 | 0x0002)) {
+			debug_print(WARNING, "rx error :(");
+			spin_lock(rx_slot_lock);
+			slot->released = 1;
+			rtl_rx_advance();
+			spin_unlock(rx_slot_lock);
+		} else {
+			/* WRAP mode keeps every frame contiguous - a frame near the
+			 * end of the 8K ring spills into the slack after it - so it
+			 * can be handed up straight from the ring with no copy. */
+			struct netbuf * nb = malloc(sizeof(struct netbuf));
+			nb->eth = (struct ethernet_packet *)&buf_start[1];
+			nb->size = rx_size;
+			nb->release = rtl_rx_release;
+			nb->extra = (void *)(uintptr_t)slot_id;
+			rtl_enqueue(nb);
+		}
 
-#if 0
-			uint16_t buf_addr = inports(rtl_iobase + RTL_PORT_RXADDR);
-			uint16_t buf_ptr  = inports(rtl_iobase + RTL_PORT_RXPTR);
-			uint8_t  cmd      = inportb(rtl_iobase + RTL_PORT_CMD);
-#endif
+		cur_rx = next_rx;
+		handled++;
+	}
 
-			uint32_t * buf_start = (uint32_t *)((uintptr_t)rtl_rx_buffer + offset);
-			uint32_t rx_status = buf_start[0];
-			int rx_size = rx_status >> 16;
+	if (handled) {
+		wakeup_queue(rx_wait);
+	}
 
-			if (rx_status & (0x0020 | 0x0010 | 0x0004 | 0x0002)) {
-				debug_print(WARNING, "rx error :(");
-			} else {
-				uint8_t * buf_8 = (uint8_t *)&(buf_start[1]);
+	return handled;
+}
 
-				last_packet = malloc(rx_size);
+static void rtl_irq_enable(void) {
+	outports(rtl_iobase + RTL_PORT_IMR, RTL_INTS_ALL);
+}
 
-				uintptr_t packet_end = (uintptr_t)buf_8 + rx_size;
-				if (packet_end > (uintptr_t)rtl_rx_buffer + 0x2000) {
-					size_t s = ((uintptr_t)rtl_rx_buffer + 0x2000) - (uintptr_t)buf_8;
-					memcpy(last_packet, buf_8, s);
-					memcpy((void *)((uintptr_t)last_packet + s), rtl_rx_buffer, rx_size - s);
-				} else {
-					memcpy(last_packet, buf_8, rx_size);
-				}
+static int rtl_irq_handler(struct regs *r) {
+	uint16_t status = inports(rtl_iobase + RTL_PORT_ISR);
+	if (!status) {
+		return 0;
+	}
+	outports(rtl_iobase + RTL_PORT_ISR, status);
 
-				rtl_enqueue(last_packet);
-			}
+	irq_ack(rtl_irq);
 
-			cur_rx = (cur_rx + rx_size + 4 + 3) & ~3;
-			outports(rtl_iobase + RTL_PORT_RXPTR, cur_rx - 16);
-		}
-		wakeup_queue(rx_wait);
+	if (status & 0x01 || status & 0x02) {
+		/* Receive: mask the RX interrupt sources and let the polling
+		 * tasklet drain the ring. */
+		outports(rtl_iobase + RTL_PORT_IMR, RTL_INTS_ALL & ~RTL_INTS_RX);
+		net_poll_schedule();
 	}
 
 	if (status & 0x08 || status & 0x04) {
-		unsigned int i = inportl(rtl_iobase + RTL_PORT_TXSTAT + 4 * dirty_tx);
-		(void)i;
-		dirty_tx++;
-		if (dirty_tx == 5) dirty_tx = 0;
+		/* Walk the completed descriptors in order; the card sets OWN in
+		 * the status word once the DMA to its FIFO has finished. */
+		int reclaimed = 0;
+		spin_lock(_lock);
+		while (free_tx < 4) {
+			uint32_t tsd = inportl(rtl_iobase + RTL_PORT_TXSTAT + 4 * dirty_tx);
+			if (!(tsd & 0x2000)) break; /* Still being fetched */
+			dirty_tx = (dirty_tx + 1) & 3;
+			free_tx++;
+			reclaimed = 1;
+		}
+		spin_unlock(_lock);
+		if (reclaimed) {
+			wakeup_queue(tx_wait);
+		}
 	}
 
 	return 1;
@@ -323,6 +429,7 @@ int init_rtl(void) {
 		debug_print(NOTICE, "RTL iobase: 0x%x\n", rtl_iobase);
 
 		rx_wait = list_create();
+		tx_wait = list_create();
 
 		debug_print(NOTICE, "Determining mac address...\n");
 		for (int i = 0; i < 6; ++i) {
@@ -381,6 +488,7 @@ int init_rtl(void) {
 		debug_print(NOTICE, "Configuring receive buffer.\n");
 		outportl(rtl_iobase + RTL_PORT_RCR,
 			(0)       | /* 8K receive */
+			0x80      | /* no wrap: spill past the ring end into the slack */
 			0x08      | /* broadcast */
 			0x01        /* all physical */
 		);
@@ -395,6 +503,7 @@ int init_rtl(void) {
 
 		debug_print(NOTICE, "Initializing netif functions\n");
 		init_netif_funcs(rtl_get_mac, rtl_get_packet, rtl_send_packet, "RTL8139");
+		net_poll_install(rtl_poll, rtl_irq_enable);
 
 		debug_print(NOTICE, "Back from starting the worker thread.\n");
 	} else {
@@ -5,6 +5,13 @@
  *
  * Serial communication device
  *
+ * Interrupt-driven on both sides: writers enqueue into a per-port
+ * ring and the transmit-holding-register-empty interrupt pushes a
+ * FIFO's worth of bytes at a time, so a process (or the kernel log
+ * drain) writing to a serial console never spins on the line rate.
+ * Received bytes land in a ring from the interrupt handler and a
+ * tasklet feeds them to the TTY layer; when the ring passes its
+ * high watermark RTS is dropped until the reader catches up.
  */
 
 #include <kernel/system.h>
@@ -15,6 +22,7 @@
 #include <kernel/module.h>
 #include <kernel/pty.h>
 #include <kernel/printf.h>
+#include <kernel/process.h>
 
 #define SERIAL_PORT_A 0x3F8
 #define SERIAL_PORT_B 0x2F8
@@ -24,11 +32,48 @@
 #define SERIAL_IRQ_AC 4
 #define SERIAL_IRQ_BD 3
 
+#define SERIAL_FIFO_DEPTH 16
+#define SERIAL_TX_BUFFER  4096
+#define SERIAL_RX_BUFFER  1024
+#define SERIAL_RX_HIGH    (SERIAL_RX_BUFFER - 128)
+#define SERIAL_RX_LOW     (SERIAL_RX_BUFFER / 4)
+
+/* Modem control: DTR and OUT2 always; RTS dropped to throttle */
+#define SERIAL_MCR_READY    0x0B
+#define SERIAL_MCR_THROTTLE 0x09
+
+/* Interrupt enable: received data, plus THR empty while draining */
+#define SERIAL_IER_RX    0x01
+#define SERIAL_IER_RX_TX 0x03
+
 static pty_t * _serial_port_pty_a = NULL;
 static pty_t * _serial_port_pty_b = NULL;
 static pty_t * _serial_port_pty_c = NULL;
 static pty_t * _serial_port_pty_d = NULL;
 
+/*
+ * Ring indices are free-running; `write - read` is the fill level.
+ * The interrupt handler owns the TX read side and the RX write side,
+ * process context owns the other two, so no locking beyond IRQ_OFF
+ * around the enqueue is needed.
+ */
+struct serial_state {
+	int port;
+	uint8_t tx_buf[SERIAL_TX_BUFFER];
+	volatile unsigned int tx_read;
+	volatile unsigned int tx_write;
+	uint8_t rx_buf[SERIAL_RX_BUFFER];
+	volatile unsigned int rx_read;
+	volatile unsigned int rx_write;
+	volatile int rx_throttled;
+	unsigned long tx_dropped;
+};
+
+static struct serial_state state_a = { SERIAL_PORT_A, {0}, 0, 0, {0}, 0, 0, 0, 0 };
+static struct serial_state state_b = { SERIAL_PORT_B, {0}, 0, 0, {0}, 0, 0, 0, 0 };
+static struct serial_state state_c = { SERIAL_PORT_C, {0}, 0, 0, {0}, 0, 0, 0, 0 };
+static struct serial_state state_d = { SERIAL_PORT_D, {0}, 0, 0, {0}, 0, 0, 0, 0 };
+
 static pty_t ** pty_for_port(int port) {
 	switch (port) {
 		case SERIAL_PORT_A: return &_serial_port_pty_a;
@@ -39,72 +84,143 @@ static pty_t ** pty_for_port(int port) {
 	__builtin_unreachable();
 }
 
-static int serial_rcvd(int device) {
-	return inportb(device + 5) & 1;
+static struct serial_state * state_for_port(int port) {
+	switch (port) {
+		case SERIAL_PORT_A: return &state_a;
+		case SERIAL_PORT_B: return &state_b;
+		case SERIAL_PORT_C: return &state_c;
+		case SERIAL_PORT_D: return &state_d;
+	}
+	__builtin_unreachable();
 }
 
-static char serial_recv(int device) {
-	while (serial_rcvd(device) == 0) ;
-	return inportb(device);
+/* Push up to one FIFO's worth of pending bytes; caller has
+ * interrupts off. Disables the THRE interrupt when the ring runs
+ * dry so an idle line stops interrupting. */
+static void serial_tx_burst(struct serial_state * s) {
+	if (!(inportb(s->port + 5) & 0x20)) return;
+	int burst = SERIAL_FIFO_DEPTH;
+	while (burst-- && s->tx_read != s->tx_write) {
+		outportb(s->port, s->tx_buf[s->tx_read % SERIAL_TX_BUFFER]);
+		s->tx_read++;
+	}
+	if (s->tx_read == s->tx_write) {
+		outportb(s->port + 1, SERIAL_IER_RX);
+	}
 }
 
-static int serial_transmit_empty(int device) {
-	return inportb(device + 5) & 0x20;
+/* Interrupt-side service for one port: drain the receive FIFO into
+ * the ring (throttling with RTS when it fills) and refill the
+ * transmit FIFO. */
+static void serial_service(struct serial_state * s) {
+	while (inportb(s->port + 5) & 0x01) {
+		uint8_t c = inportb(s->port);
+		if (s->rx_write - s->rx_read < SERIAL_RX_BUFFER) {
+			s->rx_buf[s->rx_write % SERIAL_RX_BUFFER] = c;
+			s->rx_write++;
+		}
+	}
+	if (!s->rx_throttled && s->rx_write - s->rx_read >= SERIAL_RX_HIGH) {
+		outportb(s->port + 4, SERIAL_MCR_THROTTLE);
+		s->rx_throttled = 1;
+	}
+	serial_tx_burst(s);
 }
 
-static void serial_send(int device, char out) {
-	while (serial_transmit_empty(device) == 0);
-	outportb(device, out);
+static int serial_pending(int port) {
+	/* IIR bit 0 is *clear* when this port has an interrupt pending */
+	return !(inportb(port + 2) & 0x01);
 }
 
 static int serial_handler_ac(struct regs *r) {
-	char serial;
-	int  port = 0;
-	if (inportb(SERIAL_PORT_A+1) & 0x01) {
-		port = SERIAL_PORT_A;
-	} else {
-		port = SERIAL_PORT_C;
-	}
-	serial = serial_recv(port);
+	if (serial_pending(SERIAL_PORT_A)) serial_service(&state_a);
+	if (serial_pending(SERIAL_PORT_C)) serial_service(&state_c);
 	irq_ack(SERIAL_IRQ_AC);
-	tty_input_process(*pty_for_port(port), serial);
 	return 1;
 }
 
 static int serial_handler_bd(struct regs *r) {
-	char serial;
-	int  port = 0;
-	debug_print(NOTICE, "Received something on secondary port");
-	if (inportb(SERIAL_PORT_B+1) & 0x01) {
-		port = SERIAL_PORT_B;
-	} else {
-		port = SERIAL_PORT_D;
-	}
-	serial = serial_recv(port);
+	if (serial_pending(SERIAL_PORT_B)) serial_service(&state_b);
+	if (serial_pending(SERIAL_PORT_D)) serial_service(&state_d);
 	irq_ack(SERIAL_IRQ_BD);
-	tty_input_process(*pty_for_port(port), serial);
 	return 1;
 }
 
+/*
+ * Feed buffered input to the TTY layer from process context, where
+ * canonical-mode processing is free to take its time. Un-throttles
+ * the line once the ring drains below the low watermark.
+ */
+static void serial_rx_drain(void * data, char * name) {
+	struct serial_state * states[] = { &state_a, &state_b, &state_c, &state_d };
+	while (1) {
+		for (int i = 0; i < 4; ++i) {
+			struct serial_state * s = states[i];
+			while (s->rx_read != s->rx_write) {
+				uint8_t c = s->rx_buf[s->rx_read % SERIAL_RX_BUFFER];
+				s->rx_read++;
+				tty_input_process(*pty_for_port(s->port), c);
+			}
+			if (s->rx_throttled && s->rx_write - s->rx_read < SERIAL_RX_LOW) {
+				IRQ_OFF;
+				outportb(s->port + 4, SERIAL_MCR_READY);
+				s->rx_throttled = 0;
+				IRQ_RES;
+			}
+		}
+		unsigned long s, ss;
+		relative_time(0, 10, &s, &ss);
+		sleep_until((process_t *)current_process, s, ss);
+		switch_task(0);
+	}
+}
+
+static void serial_send_buffered(struct serial_state * s, uint8_t c) {
+	while (s->tx_write - s->tx_read >= SERIAL_TX_BUFFER) {
+		if (klog_in_drain) {
+			/* Logging must never stall on a saturated console */
+			s->tx_dropped++;
+			return;
+		}
+		/* If interrupts are off (panic path) the THRE interrupt can
+		 * never drain the ring for us, so push the FIFO ourselves. */
+		if (inportb(s->port + 5) & 0x20) {
+			IRQ_OFF;
+			serial_tx_burst(s);
+			IRQ_RES;
+			continue;
+		}
+		switch_task(1);
+	}
+	IRQ_OFF;
+	s->tx_buf[s->tx_write % SERIAL_TX_BUFFER] = c;
+	s->tx_write++;
+	/* Arm the THRE interrupt and prime the FIFO if the line is idle */
+	outportb(s->port + 1, SERIAL_IER_RX_TX);
+	serial_tx_burst(s);
+	IRQ_RES;
+}
+
 static void serial_enable(int port) {
 	outportb(port + 1, 0x00); /* Disable interrupts */
 	outportb(port + 3, 0x80); /* Enable divisor mode */
 	outportb(port + 0, 0x01); /* Div Low:  01 Set the port to 115200 bps */
 	outportb(port + 1, 0x00); /* Div High: 00 */
 	outportb(port + 3, 0x03); /* Disable divisor mode, set parity */
-	outportb(port + 2, 0xC7); /* Enable FIFO and clear */
-	outportb(port + 4, 0x0B); /* Enable interrupts */
-	outportb(port + 1, 0x01); /* Enable interrupts */
+	outportb(port + 2, 0xC7); /* Enable FIFO, clear, 14-byte trigger */
+	outportb(port + 4, SERIAL_MCR_READY);
+	outportb(port + 1, SERIAL_IER_RX);
 }
 
 static int have_installed_ac = 0;
 static int have_installed_bd = 0;
+static int have_installed_drain = 0;
 
 static void serial_write_out(pty_t * pty, uint8_t c) {
-	if (pty == _serial_port_pty_a) serial_send(SERIAL_PORT_A, c);
-	if (pty == _serial_port_pty_b) serial_send(SERIAL_PORT_B, c);
-	if (pty == _serial_port_pty_c) serial_send(SERIAL_PORT_C, c);
-	if (pty == _serial_port_pty_d) serial_send(SERIAL_PORT_D, c);
+	if (pty == _serial_port_pty_a) serial_send_buffered(&state_a, c);
+	if (pty == _serial_port_pty_b) serial_send_buffered(&state_b, c);
+	if (pty == _serial_port_pty_c) serial_send_buffered(&state_c, c);
+	if (pty == _serial_port_pty_d) serial_send_buffered(&state_d, c);
 }
 
 #define DEV_PATH "/dev/"
@@ -140,6 +256,11 @@ static fs_node_t * serial_device_create(int port) {
 		}
 	}
 
+	if (!have_installed_drain) {
+		create_kernel_tasklet(serial_rx_drain, "[serial]", NULL);
+		have_installed_drain = 1;
+	}
+
 	return pty->slave;
 }
 
@@ -32,6 +32,7 @@ static void snd_dsp_close(fs_node_t * node);
 static int snd_mixer_ioctl(fs_node_t * node, int request, void * argp);
 static void snd_mixer_open(fs_node_t * node, unsigned int flags);
 static void snd_mixer_close(fs_node_t * node);
+static snd_device_t * snd_main_device(void);
 
 static spin_lock_t _devices_lock;
 
@@ -62,6 +63,7 @@ struct dsp_node {
 	ring_buffer_t * rb;
 	size_t samples;
 	size_t written;
+	size_t underruns;
 	int realtime;
 };
 
@@ -88,6 +90,7 @@ snd_register_cleanup:
 int snd_unregister(snd_device_t * device) {
 	int rv = 0;
 
+	spin_lock(_devices_lock);
 	node_t * node = list_find(&_devices, device);
 	if (!node) {
 		debug_print(WARNING, "[snd] attempted to unregister %s, "
@@ -126,6 +129,15 @@ static int snd_dsp_ioctl(fs_node_t * node, int request, void * argp) {
 		dsp->realtime = 1;
 	} else if (request == 5) {
 		return dsp->samples;
+	} else if (request == 6) {
+		/* Samples this stream failed to supply in time */
+		return dsp->underruns;
+	} else if (request == 7) {
+		/* Device playback DMA position in samples, if it reports one */
+		snd_device_t * device = snd_main_device();
+		if (device && device->get_position) {
+			return device->get_position(device);
+		}
 	}
 	return -1;
 }
@@ -138,9 +150,13 @@ static void snd_dsp_open(fs_node_t * node, unsigned int flags) {
 	/* Allocate a buffer for the node and keep a reference for ourselves */
 
 	struct dsp_node * dsp = malloc(sizeof(struct dsp_node));
-	dsp->rb = ring_buffer_create(SND_BUF_SIZE);
+	/* One writer (the opening process) and one reader (the device IRQ
+	 * mixer) per ring, so the lockless SPSC mode is safe here and keeps
+	 * the IRQ path from ever touching a spinlock. */
+	dsp->rb = ring_buffer_create_unlocked(SND_BUF_SIZE);
 	dsp->samples = 0;
 	dsp->written = 0;
+	dsp->underruns = 0;
 	dsp->realtime = 0;
 	node->device = dsp;
 	spin_lock(_buffers_lock);
@@ -238,14 +254,24 @@ int snd_request_buf(snd_device_t * device, uint32_t size, uint8_t *buffer) {
 
 	memset(buffer, 0, size);
 
+	/* The rings themselves are single-producer/single-consumer and are
+	 * read without locks; this lock only guards the list of open streams
+	 * against open/close. */
 	spin_lock(_buffers_lock);
 	foreach(buf_node, &_buffers) {
 		struct dsp_node * dsp = buf_node->value;
 		ring_buffer_t * buf = dsp->rb;
 		/* ~0x3 is to ensure we don't read partial samples or just a single channel */
 		size_t bytes_left = MIN(ring_buffer_unread(buf) & ~0x3, size);
+		if (bytes_left < size && (bytes_left || dsp->realtime)) {
+			/* The stream couldn't cover this request; a partial fill is
+			 * always an underrun, an empty ring only counts for realtime
+			 * streams since other writers may just be done playing. */
+			dsp->underruns += (size - bytes_left) / 4;
+		}
 		int16_t * adding_ptr = (int16_t *) buffer;
 		while (bytes_left) {
+			/* Mix one fixed-size frame at a time */
 			size_t this_read_size = MIN(bytes_left, sizeof(tmp_buf));
 			ring_buffer_read(buf, this_read_size, (uint8_t *)tmp_buf);
 			dsp->samples += this_read_size / 4; /* 16 bits, 2 channels */
@@ -254,11 +280,12 @@ int snd_request_buf(snd_device_t * device, uint32_t size, uint8_t *buffer) {
 			 * cause awful clipping. This is kind of a hack since it would probably be
 			 * better to just use some kind of compressor.
 			 */
-			for (size_t i = 0; i < N_ELEMENTS(tmp_buf); i++) {
-				tmp_buf[i] /= 2;
-			}
 			for (size_t i = 0; i < this_read_size / sizeof(*adding_ptr); i++) {
-				adding_ptr[i] += tmp_buf[i];
+				int32_t sum = (int32_t)adding_ptr[i] + (int32_t)(tmp_buf[i] / 2);
+				/* Saturate instead of wrapping when sources still clip */
+				if (sum >  32767) sum =  32767;
+				if (sum < -32768) sum = -32768;
+				adding_ptr[i] = sum;
 			}
 			adding_ptr += this_read_size / sizeof(*adding_ptr);
 			bytes_left -= this_read_size;
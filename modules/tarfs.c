@@ -16,14 +16,30 @@
 
 #include <toaru/list.h>
 #include <toaru/hashmap.h>
+#include <toaru/tree.h>
 
 #define TARFS_LOG_LEVEL WARNING
 
 struct tarfs {
 	fs_node_t * device;
 	unsigned int length;
+	tree_t * index;       /* Directory tree of tar_entry, built at mount */
 };
 
+/*
+ * One archive member in the mount-time index. Lookups walk the tree
+ * instead of re-scanning headers from the start of the archive, and
+ * reads seek straight to the recorded offset.
+ */
+struct tar_entry {
+	char * name;          /* path component */
+	unsigned int offset;  /* header offset, or TAR_NO_HEADER */
+	char type;            /* ustar type byte */
+};
+
+/* Directories implied by their children but missing their own header */
+#define TAR_NO_HEADER 0xFFFFFFFF
+
 struct ustar {
 	char filename[100];
 	char mode[8];
@@ -105,7 +121,7 @@ static unsigned int round_to_512(unsigned int i) {
 }
 
 static int ustar_from_offset(struct tarfs * self, unsigned int offset, struct ustar * out);
-static fs_node_t * file_from_ustar(struct tarfs * self, struct ustar * file, unsigned int offset);
+static fs_node_t * file_from_entry(struct tarfs * self, tree_node_t * tnode);
 
 #ifndef strncat
 static char * strncat(char *dest, const char *src, size_t n) {
@@ -125,94 +141,75 @@ static char * strncat(char *dest, const char *src, size_t n) {
 }
 #endif
 
-static int count_slashes(char * string) {
-	int i = 0;
-	char * s = strstr(string, "/");
-	while (s) {
-		if (*(s+1) == '\0') return i;
-		i++;
-		s = strstr(s+1,"/");
+static tree_node_t * tar_index_child(tree_node_t * dir, char * name) {
+	foreach(child, dir->children) {
+		tree_node_t * tchild = (tree_node_t *)child->value;
+		struct tar_entry * entry = (struct tar_entry *)tchild->value;
+		if (!strcmp(entry->name, name)) return tchild;
 	}
-	return i;
+	return NULL;
 }
 
-static struct dirent * readdir_tar_root(fs_node_t *node, uint32_t index) {
-	if (index == 0) {
-		struct dirent * out = malloc(sizeof(struct dirent));
-		memset(out, 0x00, sizeof(struct dirent));
-		out->ino = 0;
-		strcpy(out->name, ".");
-		return out;
-	}
-
-	if (index == 1) {
-		struct dirent * out = malloc(sizeof(struct dirent));
-		memset(out, 0x00, sizeof(struct dirent));
-		out->ino = 0;
-		strcpy(out->name, "..");
-		return out;
-	}
-
-	index -= 2;
+/*
+ * Walk the archive once at mount and record every header in a
+ * directory tree keyed on path components. This is the only
+ * beginning-to-end scan tarfs ever does; lookups afterwards touch
+ * just the directories on their path.
+ */
+static void tar_index_build(struct tarfs * self) {
+	self->index = tree_create();
+	struct tar_entry * root = malloc(sizeof(struct tar_entry));
+	root->name   = "";
+	root->offset = TAR_NO_HEADER;
+	root->type   = '5';
+	tree_set_root(self->index, root);
 
-	struct tarfs * self = node->device;
-	/* Go through each file and pick the ones are at the root */
-	/* Root files will have no /, so this is easy */
 	unsigned int offset = 0;
 	struct ustar * file = malloc(sizeof(struct ustar));
 	while (offset < self->length) {
-		int status = ustar_from_offset(self, offset, file);
-
-		if (!status) {
-			free(file);
-			return NULL;
-		}
+		if (!ustar_from_offset(self, offset, file)) break;
 
 		char filename_workspace[256];
-
 		memset(filename_workspace, 0, 256);
 		strncat(filename_workspace, file->prefix, 155);
 		strncat(filename_workspace, file->filename, 100);
 
-		if (!count_slashes(filename_workspace)) {
-			char * slash = strstr(filename_workspace,"/");
-			if (slash) *slash = '\0'; /* remove trailing slash */
-			if (strlen(filename_workspace)) {
-				if (index == 0) {
-					struct dirent * out = malloc(sizeof(struct dirent));
-					memset(out, 0x00, sizeof(struct dirent));
-					out->ino = offset;
-					strcpy(out->name, filename_workspace);
-					free(file);
-					return out;
-				} else {
-					index--;
-				}
+		char * parts[64];
+		int count = tokenize(filename_workspace, "/", parts);
+
+		tree_node_t * dir = self->index->root;
+		for (int i = 0; dir && i < count; ++i) {
+			tree_node_t * next = tar_index_child(dir, parts[i]);
+			if (!next) {
+				struct tar_entry * entry = malloc(sizeof(struct tar_entry));
+				entry->name   = strdup(parts[i]);
+				/* Parents listed out of order get their header later */
+				entry->offset = (i == count - 1) ? offset : TAR_NO_HEADER;
+				entry->type   = (i == count - 1) ? file->type[0] : '5';
+				next = tree_node_insert_child(self->index, dir, entry);
+			} else if (i == count - 1) {
+				struct tar_entry * entry = (struct tar_entry *)next->value;
+				entry->offset = offset;
+				entry->type   = file->type[0];
 			}
+			dir = next;
 		}
 
 		offset += 512;
 		offset += round_to_512(interpret_size(file));
-
 	}
-
 	free(file);
-	return NULL;
 }
 
 static uint32_t read_tarfs(fs_node_t * node, uint64_t offset, uint32_t size, uint8_t * buffer) {
 	struct tarfs * self = node->device;
-	struct ustar * file = malloc(sizeof(struct ustar));
-	ustar_from_offset(self, node->inode, file);
-	size_t file_size = interpret_size(file);
+	size_t file_size = node->length;
 
 	if (offset > file_size) return 0;
 	if (offset + size > file_size) {
 		size = file_size - offset;
 	}
 
-	free(file);
-
 	return read_fs(self->device, offset + node->inode + 512, size, buffer);
 }
 
@@ -235,109 +232,35 @@ static struct dirent * readdir_tarfs(fs_node_t *node, uint32_t index) {
 
 	index -= 2;
 
-	struct tarfs * self = node->device;
-
-	/* Go through each file and pick the ones are at the root */
-	/* Root files will have no /, so this is easy */
-	unsigned int offset = node->inode;
-
-	/* Read myself */
-	struct ustar * file = malloc(sizeof(struct ustar));
-	int status = ustar_from_offset(self, node->inode, file);
-	char my_filename[256];
-
-	/* Figure out my own filename, with forward slash */
-	memset(my_filename, 0, 256);
-	strncat(my_filename, file->prefix, 155);
-	strncat(my_filename, file->filename, 100);
-
-	while (offset < self->length) {
-		ustar_from_offset(self, offset, file);
-
-		if (!status) {
-			free(file);
-			return NULL;
+	tree_node_t * tnode = (tree_node_t *)node->impl;
+	uint32_t i = 0;
+
+	foreach(child, tnode->children) {
+		if (i == index) {
+			tree_node_t * tchild = (tree_node_t *)child->value;
+			struct tar_entry * entry = (struct tar_entry *)tchild->value;
+			struct dirent * out = malloc(sizeof(struct dirent));
+			memset(out, 0x00, sizeof(struct dirent));
+			out->ino = entry->offset;
+			strcpy(out->name, entry->name);
+			return out;
 		}
-
-		char filename_workspace[256];
-		memset(filename_workspace, 0, 256);
-		strncat(filename_workspace, file->prefix, 155);
-		strncat(filename_workspace, file->filename, 100);
-
-		if (startswith(filename_workspace, my_filename)) {
-			if (!count_slashes(filename_workspace + strlen(my_filename))) {
-				if (strlen(filename_workspace + strlen(my_filename))) {
-					if (index == 0) {
-						char * slash = strstr(filename_workspace+strlen(my_filename),"/");
-						if (slash) *slash = '\0'; /* remove trailing slash */
-						struct dirent * out = malloc(sizeof(struct dirent));
-						memset(out, 0x00, sizeof(struct dirent));
-						out->ino = offset;
-						strcpy(out->name, filename_workspace+strlen(my_filename));
-						free(file);
-						return out;
-					} else {
-						index--;
-					}
-				}
-			}
-		}
-
-		offset += 512;
-		offset += round_to_512(interpret_size(file));
+		++i;
 	}
 
-	free(file);
 	return NULL;
 }
 
 static fs_node_t * finddir_tarfs(fs_node_t *node, char *name) {
-	struct tarfs * self = node->device;
-
-	/* find my own filename */
-	struct ustar * file = malloc(sizeof(struct ustar));
-	ustar_from_offset(self, node->inode, file);
-
-	char my_filename[256];
-	/* Figure out my own filename, with forward slash */
-	memset(my_filename, 0, 256);
-	strncat(my_filename, file->prefix, 155);
-	strncat(my_filename, file->filename, 100);
-
-	/* Append name */
-	strncat(my_filename, name, strlen(name));
-	if (strlen(my_filename) > 255) {
-		debug_print(CRITICAL, "what");
-	}
-
-	unsigned int offset = node->inode;
-	while (offset < self->length) {
-		int status = ustar_from_offset(self, offset, file);
-
-		if (!status) {
-			free(file);
-			return NULL;
-		}
-
-		char filename_workspace[256];
-		memset(filename_workspace, 0, 256);
-		strncat(filename_workspace, file->prefix, 155);
-		strncat(filename_workspace, file->filename, 100);
+	if (!name) return NULL;
 
-		if (filename_workspace[strlen(filename_workspace)-1] == '/') {
-			filename_workspace[strlen(filename_workspace)-1] = '\0';
-		}
-		if (!strcmp(filename_workspace, my_filename)) {
-			return file_from_ustar(self, file, offset);
-		}
-
-		offset += 512;
-		offset += round_to_512(interpret_size(file));
-	}
+	struct tarfs * self = node->device;
+	tree_node_t * tnode = (tree_node_t *)node->impl;
 
+	tree_node_t * child = tar_index_child(tnode, name);
+	if (!child) return NULL;
 
-	free(file);
-	return NULL;
+	return file_from_entry(self, child);
 }
 
 static int readlink_tarfs(fs_node_t * node, char * buf, size_t size) {
@@ -360,14 +283,26 @@ static int readlink_tarfs(fs_node_t * node, char * buf, size_t size) {
 
 }
 
-static fs_node_t * file_from_ustar(struct tarfs * self, struct ustar * file, unsigned int offset) {
+static fs_node_t * file_from_entry(struct tarfs * self, tree_node_t * tnode) {
+	struct tar_entry * entry = (struct tar_entry *)tnode->value;
 	fs_node_t * fs = malloc(sizeof(fs_node_t));
 	memset(fs, 0, sizeof(fs_node_t));
 	fs->device = self;
-	fs->inode  = offset;
-	fs->impl   = 0;
-	char filename_workspace[256];
-	memcpy(fs->name, filename_workspace, strlen(filename_workspace)+1);
+	fs->inode  = entry->offset;
+	fs->impl   = (uint32_t)tnode;
+	strcpy(fs->name, entry->name);
+
+	if (entry->offset == TAR_NO_HEADER) {
+		/* Directory implied by its children; no header to read */
+		fs->mask = 0555;
+		fs->flags = FS_DIRECTORY | FS_CACHEABLE;
+		fs->readdir = readdir_tarfs;
+		fs->finddir = finddir_tarfs;
+		return fs;
+	}
+
+	struct ustar * file = malloc(sizeof(struct ustar));
+	ustar_from_offset(self, entry->offset, file);
 
 	fs->uid = interpret_uid(file);
 	fs->gid = interpret_gid(file);
@@ -376,7 +311,7 @@ static fs_node_t * file_from_ustar(struct tarfs * self, struct ustar * file, uns
 	fs->nlink = 0; /* Unsupported */
 	fs->flags = FS_FILE;
 	if (file->type[0] == '5') {
-		fs->flags = FS_DIRECTORY;
+		fs->flags = FS_DIRECTORY | FS_CACHEABLE;
 		fs->readdir = readdir_tarfs;
 		fs->finddir = finddir_tarfs;
 	} else if (file->type[0] == '1') {
@@ -386,7 +321,7 @@ static fs_node_t * file_from_ustar(struct tarfs * self, struct ustar * file, uns
 		fs->flags = FS_SYMLINK;
 		fs->readlink = readlink_tarfs;
 	} else {
-		fs->flags = FS_FILE;
+		fs->flags = FS_FILE | FS_CACHEABLE;
 		fs->read = read_tarfs;
 	}
 	free(file);
@@ -399,42 +334,6 @@ static fs_node_t * file_from_ustar(struct tarfs * self, struct ustar * file, uns
 	return fs;
 }
 
-static fs_node_t * finddir_tar_root(fs_node_t *node, char *name) {
-	struct tarfs * self = node->device;
-
-	unsigned int offset = 0;
-	struct ustar * file = malloc(sizeof(struct ustar));
-	while (offset < self->length) {
-		int status = ustar_from_offset(self, offset, file);
-
-		if (!status) {
-			free(file);
-			return NULL;
-		}
-
-		char filename_workspace[256];
-		memset(filename_workspace, 0, 256);
-		strncat(filename_workspace, file->prefix, 155);
-		strncat(filename_workspace, file->filename, 100);
-
-		if (count_slashes(filename_workspace)) {
-			/* skip */
-		} else {
-			char * slash = strstr(filename_workspace,"/");
-			if (slash) *slash = '\0';
-			if (!strcmp(filename_workspace, name)) {
-				return file_from_ustar(self, file, offset);
-			}
-		}
-
-		offset += 512;
-		offset += round_to_512(interpret_size(file));
-	}
-
-	free(file);
-	return NULL;
-}
-
 static int ustar_from_offset(struct tarfs * self, unsigned int offset, struct ustar * out) {
 	read_fs(self->device, offset, sizeof(struct ustar), (unsigned char*)out);
 	if (out->ustar[0] != 'u' ||
@@ -470,6 +369,8 @@ static fs_node_t * tar_mount(char * device, char * mount_path) {
 	self->device = dev;
 	self->length = dev->length;
 
+	tar_index_build(self);
+
 	fs_node_t * root = malloc(sizeof(fs_node_t));
 	memset(root, 0, sizeof(fs_node_t));
 
@@ -477,10 +378,11 @@ static fs_node_t * tar_mount(char * device, char * mount_path) {
 	root->gid     = 0;
 	root->length  = 0;
 	root->mask    = 0555;
-	root->readdir = readdir_tar_root;
-	root->finddir = finddir_tar_root;
-	root->flags   = FS_DIRECTORY;
+	root->readdir = readdir_tarfs;
+	root->finddir = finddir_tarfs;
+	root->flags   = FS_DIRECTORY | FS_CACHEABLE;
 	root->device  = self;
+	root->impl    = (uint32_t)self->index->root;
 
 	return root;
 }
@@ -16,6 +16,15 @@
 /* 4KB */
 #define BLOCKSIZE 0x1000
 
+/*
+ * File contents are indexed ext2-style: t->blocks is a small table of
+ * groups, and each group is a page's worth of frame numbers (4 MB of
+ * file data). Appending allocates one frame and, every 4 MB, one new
+ * group; only the group table itself is ever realloc'd, so growing a
+ * large file never copies existing data or block pointers.
+ */
+#define TMPFS_PTRS_PER_GROUP (BLOCKSIZE / sizeof(uint32_t))
+
 #define TMPFS_TYPE_FILE 1
 #define TMPFS_TYPE_DIR  2
 #define TMPFS_TYPE_LINK 3
@@ -45,7 +54,7 @@ static struct tmpfs_file * tmpfs_file_new(char * name) {
 	t->atime = now();
 	t->mtime = t->atime;
 	t->ctime = t->atime;
-	t->blocks = malloc(t->pointers * sizeof(char *));
+	t->blocks = malloc(t->pointers * sizeof(uint32_t *));
 	for (size_t i = 0; i < t->pointers; ++i) {
 		t->blocks[i] = NULL;
 	}
@@ -123,20 +132,32 @@ static struct tmpfs_dir * tmpfs_dir_new(char * name, struct tmpfs_dir * parent)
 	return d;
 }
 
+static uint32_t tmpfs_block_lookup(struct tmpfs_file * t, size_t blockid) {
+	return t->blocks[blockid / TMPFS_PTRS_PER_GROUP][blockid % TMPFS_PTRS_PER_GROUP];
+}
+
 static void tmpfs_file_free(struct tmpfs_file * t) {
 	if (t->type == TMPFS_TYPE_LINK) {
 		debug_print(ERROR, "uh, what");
 		free(t->target);
 	}
 	for (size_t i = 0; i < t->block_count; ++i) {
-		clear_frame((uintptr_t)t->blocks[i] * 0x1000);
+		free_frames((uintptr_t)tmpfs_block_lookup(t, i) * 0x1000, 1);
 	}
+	for (size_t i = 0; i < t->pointers; ++i) {
+		free(t->blocks[i]);
+	}
+	free(t->blocks);
 }
 
 static void tmpfs_file_blocks_embiggen(struct tmpfs_file * t) {
+	size_t old = t->pointers;
 	t->pointers *= 2;
-	debug_print(INFO, "Embiggening file %s to %d blocks", t->name, t->pointers);
-	t->blocks = realloc(t->blocks, sizeof(char *) * t->pointers);
+	debug_print(INFO, "Embiggening file %s to %d block groups", t->name, t->pointers);
+	t->blocks = realloc(t->blocks, sizeof(uint32_t *) * t->pointers);
+	for (size_t i = old; i < t->pointers; ++i) {
+		t->blocks[i] = NULL;
+	}
 }
 
 static char * tmpfs_file_getset_block(struct tmpfs_file * t, size_t blockid, int create) {
@@ -146,14 +167,17 @@ static char * tmpfs_file_getset_block(struct tmpfs_file * t, size_t blockid, int
 
 	if (create) {
 		spin_lock(tmpfs_lock);
-		while (blockid >= t->pointers) {
+		while (blockid / TMPFS_PTRS_PER_GROUP >= t->pointers) {
 			tmpfs_file_blocks_embiggen(t);
 		}
 		while (blockid >= t->block_count) {
 			debug_print(INFO, "Allocating block %d for file %s", blockid, t->name);
-			uintptr_t index = first_frame();
-			set_frame(index * 0x1000);
-			t->blocks[t->block_count] = (char*)index;
+			size_t group = t->block_count / TMPFS_PTRS_PER_GROUP;
+			if (!t->blocks[group]) {
+				t->blocks[group] = malloc(sizeof(uint32_t) * TMPFS_PTRS_PER_GROUP);
+			}
+			uintptr_t phys = alloc_frames(1);
+			t->blocks[group][t->block_count % TMPFS_PTRS_PER_GROUP] = phys / 0x1000;
 			t->block_count += 1;
 		}
 		spin_unlock(tmpfs_lock);
@@ -163,12 +187,12 @@ static char * tmpfs_file_getset_block(struct tmpfs_file * t, size_t blockid, int
 			return NULL;
 		}
 	}
-	debug_print(INFO, "Using block %d->0x%x (of %d) on file %s", blockid, t->blocks[blockid], t->block_count, t->name);
+	debug_print(INFO, "Using block %d->0x%x (of %d) on file %s", blockid, tmpfs_block_lookup(t, blockid), t->block_count, t->name);
 
 	page_t * page = get_page((uintptr_t)buf_space,0,current_directory);
 	page->rw = 1;
 	page->user = 0;
-	page->frame = (uintptr_t)t->blocks[blockid];
+	page->frame = tmpfs_block_lookup(t, blockid);
 	page->present = 1;
 	invalidate_tables_at((uintptr_t)buf_space);
 
@@ -288,9 +312,10 @@ static void truncate_tmpfs(fs_node_t * node) {
 	struct tmpfs_file * t = (struct tmpfs_file *)(node->device);
 	debug_print(INFO, "Truncating file %s", t->name);
 	for (size_t i = 0; i < t->block_count; ++i) {
-		clear_frame((uintptr_t)t->blocks[i] * 0x1000);
-		t->blocks[i] = 0;
+		free_frames((uintptr_t)tmpfs_block_lookup(t, i) * 0x1000, 1);
 	}
+	/* The group tables stay allocated; the file is likely to be
+	 * rewritten and will fill them right back up. */
 	t->block_count = 0;
 	t->length = 0;
 	t->mtime = node->atime;
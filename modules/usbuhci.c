@@ -2,49 +2,738 @@
  * This file is part of ToaruOS and is released under the terms
  * of the NCSA / University of Illinois License - see LICENSE.md
  * Copyright (C) 2014-2018 K. Lange
+ *
+ * UHCI host controller driver with HID boot-protocol input.
+ *
+ * Runs a periodic frame schedule so interrupt endpoints are polled
+ * at the interval the device asked for, and feeds boot-protocol
+ * keyboards and mice into the same /dev/kbd, /dev/kbdev and
+ * /dev/mouse pipes the PS/2 drivers use, so userspace does not care
+ * which bus its input came from. Each endpoint owns one transfer
+ * descriptor that is re-armed in place from the interrupt handler;
+ * nothing in the steady-state input path allocates.
  */
+#include <kernel/system.h>
 #include <kernel/module.h>
-#include <kernel/pci.h>
-#include <kernel/printf.h>
 #include <kernel/logging.h>
+#include <kernel/printf.h>
+#include <kernel/pci.h>
+#include <kernel/fs.h>
+#include <kernel/pipe.h>
+#include <kernel/mouse.h>
+#include <kernel/workqueue.h>
 #include <kernel/mod/shell.h>
 
-static uint32_t hub_device = 0;
+#include <toaru/kbd.h>
+
+/* I/O register offsets */
+#define UHCI_USBCMD    0x00
+#define UHCI_USBSTS    0x02
+#define UHCI_USBINTR   0x04
+#define UHCI_FRNUM     0x06
+#define UHCI_FLBASEADD 0x08
+#define UHCI_SOFMOD    0x0C
+#define UHCI_PORTSC1   0x10
+
+#define UHCI_CMD_RS      0x0001
+#define UHCI_CMD_HCRESET 0x0002
+#define UHCI_CMD_GRESET  0x0004
+#define UHCI_CMD_CF      0x0040
+#define UHCI_CMD_MAXP    0x0080
+
+#define UHCI_STS_USBINT  0x0001
+#define UHCI_STS_ERRINT  0x0002
+#define UHCI_STS_ALL     0x003F
+
+#define UHCI_PORT_CONNECT        0x0001
+#define UHCI_PORT_CONNECT_CHANGE 0x0002
+#define UHCI_PORT_ENABLE         0x0004
+#define UHCI_PORT_ENABLE_CHANGE  0x0008
+#define UHCI_PORT_LOW_SPEED      0x0100
+#define UHCI_PORT_RESET          0x0200
+
+/* Link pointer bits (frame list entries, QH links, TD links) */
+#define UHCI_PTR_TERM  0x1
+#define UHCI_PTR_QH    0x2
+#define UHCI_PTR_DEPTH 0x4
+
+/* TD control/status word */
+#define TD_CTRL_SPD      (1 << 29)
+#define TD_CTRL_CERR(n)  ((n) << 27)
+#define TD_CTRL_LS       (1 << 26)
+#define TD_CTRL_IOC      (1 << 24)
+#define TD_CTRL_ACTIVE   (1 << 23)
+#define TD_CTRL_STALLED  (1 << 22)
+#define TD_CTRL_DBUFERR  (1 << 21)
+#define TD_CTRL_BABBLE   (1 << 20)
+#define TD_CTRL_NAK      (1 << 19)
+#define TD_CTRL_CRCTO    (1 << 18)
+#define TD_CTRL_BITSTUFF (1 << 17)
+#define TD_CTRL_ANYERROR (TD_CTRL_STALLED | TD_CTRL_DBUFERR | TD_CTRL_BABBLE | TD_CTRL_CRCTO | TD_CTRL_BITSTUFF)
+#define TD_ACTLEN(cs)    (((cs) + 1) & 0x7FF)
+
+#define UHCI_PID_SETUP 0x2D
+#define UHCI_PID_IN    0x69
+#define UHCI_PID_OUT   0xE1
+
+/* maxlen field encodes length - 1; 0x7FF means zero bytes */
+#define UHCI_TOKEN(len, toggle, endpt, addr, pid) \
+	(((((uint32_t)(len) - 1) & 0x7FF) << 21) | ((toggle) << 19) | ((endpt) << 15) | ((addr) << 8) | (pid))
+
+struct uhci_td {
+	volatile uint32_t link;
+	volatile uint32_t cs;
+	volatile uint32_t token;
+	volatile uint32_t buffer;
+} __attribute__((aligned(16)));
+
+struct uhci_qh {
+	volatile uint32_t head;    /* horizontal: next QH in this frame */
+	volatile uint32_t element; /* vertical: first TD of this queue */
+} __attribute__((aligned(16)));
+
+/*
+ * The periodic skeleton: skel[i] is entered once every 2^i frames.
+ * Each skeleton QH links horizontally to the next-faster one, so a
+ * frame that enters at skel[5] also walks 4, 3, ... 0; an endpoint
+ * polled every 2^i ms is spliced in right after skel[i]. The control
+ * queue hangs off the end and so runs every frame, which is only
+ * used during enumeration.
+ */
+#define UHCI_SKEL_COUNT 8
+#define UHCI_CTRL_TDS   40     /* setup + 256/8 data + status, with slack */
+#define UHCI_MAX_INPUTS 4
+
+struct uhci_input_hw {
+	struct uhci_qh qh;
+	struct uhci_td td;
+	uint8_t report[8];
+	uint8_t pad[8];
+};
+
+struct uhci_sched {
+	struct uhci_qh skel[UHCI_SKEL_COUNT];
+	struct uhci_qh ctrl_qh;
+	struct uhci_td ctrl_td[UHCI_CTRL_TDS];
+	struct uhci_input_hw ep[UHCI_MAX_INPUTS];
+	uint8_t ctrl_setup[8];
+	uint8_t ctrl_data[256];
+};
+
+static uint32_t uhci_device_pci = 0;
+static int uhci_irq = 0;
+static uint32_t uhci_io = 0;
+
+static uint32_t * frame_list = NULL;
+static uintptr_t frame_list_phys = 0;
+static struct uhci_sched * sched = NULL;
+static uintptr_t sched_phys = 0;
+
+#define SCHED_PHYS(x) ((uint32_t)(sched_phys + ((uintptr_t)(x) - (uintptr_t)sched)))
+
+/* Software state for one polled interrupt endpoint */
+struct uhci_input {
+	int active;
+	int is_keyboard;
+	int port;
+	int addr;
+	int endpoint;
+	int maxp;
+	int low_speed;
+	int level;        /* skeleton index: polled every 2^level ms */
+	int toggle;
+	int errors;
+	struct uhci_input_hw * hw;
+	uint8_t last_report[8];
+	key_event_state_t kbd_state;
+};
+
+static struct uhci_input inputs[UHCI_MAX_INPUTS];
+static int num_inputs = 0;
+
+/*
+ * Completed reports land here in interrupt context and are turned
+ * into pipe writes by the work queue, same split as ps2kbd; the
+ * interrupt timestamp rides along so events carry arrival time.
+ */
+#define UHCI_RING_SIZE 64
+struct uhci_ring_entry {
+	uint8_t  ep;
+	uint8_t  len;
+	uint8_t  data[8];
+	uint32_t timestamp;
+};
+static struct uhci_ring_entry uhci_ring[UHCI_RING_SIZE];
+static volatile unsigned int uhci_produced = 0;
+static volatile unsigned int uhci_drained = 0;
+
+/* Input pipes; borrowed from the PS/2 drivers when they are loaded,
+ * created here when they are not (PS/2-less hardware). */
+static fs_node_t * kbd_pipe = NULL;
+static fs_node_t * kbd_event_pipe = NULL;
+static fs_node_t * mouse_pipe = NULL;
+
+#define EVENTS_IN_PIPE 128
+#define EVENT_DISCARD_POINT 32
+#define PACKETS_IN_PIPE 1024
+#define PACKET_DISCARD_POINT 32
+
+static void uhci_delay(int ms) {
+	unsigned long target = timer_ticks * 1000 + timer_subticks + ms;
+	while (timer_ticks * 1000 + timer_subticks < target) {
+		switch_task(1);
+	}
+}
+
+/*
+ * HID boot keyboard usage -> set 1 scancode. 0xE0-prefixed codes are
+ * stored as 0xE0xx. The raw pipe speaks set 1 because that is what
+ * the PS/2 keyboard produces and what every reader already parses.
+ */
+static const uint16_t hid_to_set1[] = {
+	[0x04] = 0x1E, [0x05] = 0x30, [0x06] = 0x2E, [0x07] = 0x20, /* a b c d */
+	[0x08] = 0x12, [0x09] = 0x21, [0x0A] = 0x22, [0x0B] = 0x23, /* e f g h */
+	[0x0C] = 0x17, [0x0D] = 0x24, [0x0E] = 0x25, [0x0F] = 0x26, /* i j k l */
+	[0x10] = 0x32, [0x11] = 0x31, [0x12] = 0x18, [0x13] = 0x19, /* m n o p */
+	[0x14] = 0x10, [0x15] = 0x13, [0x16] = 0x1F, [0x17] = 0x14, /* q r s t */
+	[0x18] = 0x16, [0x19] = 0x2F, [0x1A] = 0x11, [0x1B] = 0x2D, /* u v w x */
+	[0x1C] = 0x15, [0x1D] = 0x2C,                               /* y z */
+	[0x1E] = 0x02, [0x1F] = 0x03, [0x20] = 0x04, [0x21] = 0x05, /* 1 2 3 4 */
+	[0x22] = 0x06, [0x23] = 0x07, [0x24] = 0x08, [0x25] = 0x09, /* 5 6 7 8 */
+	[0x26] = 0x0A, [0x27] = 0x0B,                               /* 9 0 */
+	[0x28] = 0x1C, [0x29] = 0x01, [0x2A] = 0x0E, [0x2B] = 0x0F, /* enter esc bksp tab */
+	[0x2C] = 0x39, [0x2D] = 0x0C, [0x2E] = 0x0D, [0x2F] = 0x1A, /* space - = [ */
+	[0x30] = 0x1B, [0x31] = 0x2B, [0x32] = 0x2B, [0x33] = 0x27, /* ] \ # ; */
+	[0x34] = 0x28, [0x35] = 0x29, [0x36] = 0x33, [0x37] = 0x34, /* ' ` , . */
+	[0x38] = 0x35, [0x39] = 0x3A,                               /* / caps */
+	[0x3A] = 0x3B, [0x3B] = 0x3C, [0x3C] = 0x3D, [0x3D] = 0x3E, /* F1-F4 */
+	[0x3E] = 0x3F, [0x3F] = 0x40, [0x40] = 0x41, [0x41] = 0x42, /* F5-F8 */
+	[0x42] = 0x43, [0x43] = 0x44, [0x44] = 0x57, [0x45] = 0x58, /* F9-F12 */
+	[0x46] = 0xE037, [0x47] = 0x46,                             /* prtsc scroll */
+	[0x49] = 0xE052, [0x4A] = 0xE047, [0x4B] = 0xE049,          /* ins home pgup */
+	[0x4C] = 0xE053, [0x4D] = 0xE04F, [0x4E] = 0xE051,          /* del end pgdn */
+	[0x4F] = 0xE04D, [0x50] = 0xE04B, [0x51] = 0xE050, [0x52] = 0xE048, /* arrows */
+	[0x53] = 0x45, [0x54] = 0xE035, [0x55] = 0x37, [0x56] = 0x4A, /* num kp/ kp* kp- */
+	[0x57] = 0x4E, [0x58] = 0xE01C,                             /* kp+ kpenter */
+	[0x59] = 0x4F, [0x5A] = 0x50, [0x5B] = 0x51, [0x5C] = 0x4B, /* kp1-4 */
+	[0x5D] = 0x4C, [0x5E] = 0x4D, [0x5F] = 0x47, [0x60] = 0x48, /* kp5-8 */
+	[0x61] = 0x49, [0x62] = 0x52, [0x63] = 0x53,                /* kp9 kp0 kp. */
+};
+#define HID_USAGE_MAX (sizeof(hid_to_set1) / sizeof(hid_to_set1[0]))
+
+/* Modifier byte, bit 0 to 7: LCtrl LShift LAlt LGui RCtrl RShift RAlt RGui */
+static const uint16_t hid_modifiers[8] = {
+	0x1D, 0x2A, 0x38, 0xE05B, 0xE01D, 0x36, 0xE038, 0xE05C,
+};
+
+/*
+ * Emit one key as a set 1 make or break sequence into the raw pipe,
+ * and run it through the shared scancode state machine for the
+ * translated event pipe, mirroring keyboard_bottom_half in ps2kbd.
+ */
+static void uhci_kbd_emit(struct uhci_input * in, uint16_t sc, int release, uint32_t timestamp) {
+	uint8_t bytes[2];
+	int n = 0;
+	if (sc & 0xFF00) bytes[n++] = 0xE0;
+	bytes[n++] = (sc & 0xFF) | (release ? 0x80 : 0);
+
+	for (int i = 0; i < n; ++i) {
+		write_fs(kbd_pipe, 0, 1, &bytes[i]);
+
+		key_event_t event;
+		kbd_scancode(&in->kbd_state, bytes[i], &event);
+		if (event.action) {
+			event.timestamp = timestamp;
+			key_event_t bitbucket;
+			while (pipe_size(kbd_event_pipe) > (int)(EVENT_DISCARD_POINT * sizeof(event))) {
+				read_fs(kbd_event_pipe, 0, sizeof(event), (uint8_t *)&bitbucket);
+			}
+			write_fs(kbd_event_pipe, 0, sizeof(event), (uint8_t *)&event);
+		}
+	}
+}
+
+static int report_has_usage(uint8_t * report, uint8_t usage) {
+	for (int i = 2; i < 8; ++i) {
+		if (report[i] == usage) return 1;
+	}
+	return 0;
+}
+
+static void uhci_process_keyboard(struct uhci_input * in, uint8_t * report, uint32_t timestamp) {
+	/* ErrorRollOver: too many keys held, report is garbage */
+	if (report[2] == 0x01) return;
+
+	/* Modifier changes */
+	uint8_t changed = report[0] ^ in->last_report[0];
+	for (int bit = 0; bit < 8; ++bit) {
+		if (changed & (1 << bit)) {
+			uhci_kbd_emit(in, hid_modifiers[bit], !(report[0] & (1 << bit)), timestamp);
+		}
+	}
+
+	/* Releases: usages in the previous report but not this one */
+	for (int i = 2; i < 8; ++i) {
+		uint8_t usage = in->last_report[i];
+		if (!usage || report_has_usage(report, usage)) continue;
+		if (usage < HID_USAGE_MAX && hid_to_set1[usage]) {
+			uhci_kbd_emit(in, hid_to_set1[usage], 1, timestamp);
+		}
+	}
+
+	/* Presses: usages in this report but not the previous one */
+	for (int i = 2; i < 8; ++i) {
+		uint8_t usage = report[i];
+		if (!usage || report_has_usage(in->last_report, usage)) continue;
+		if (usage < HID_USAGE_MAX && hid_to_set1[usage]) {
+			uhci_kbd_emit(in, hid_to_set1[usage], 0, timestamp);
+		}
+	}
 
-static void find_usb_device(uint32_t device, uint16_t vendorid, uint16_t deviceid, void * extra) {
+	memcpy(in->last_report, report, 8);
+}
+
+static void uhci_process_mouse(struct uhci_input * in, uint8_t * report, int len, uint32_t timestamp) {
+	mouse_device_packet_t packet;
+	packet.magic = MOUSE_MAGIC;
+	packet.x_difference = (int8_t)report[1];
+	/* HID y grows downward, the mouse pipe speaks PS/2 (y grows up) */
+	packet.y_difference = -(int8_t)report[2];
+	packet.buttons = 0;
+	packet.timestamp = timestamp;
+	if (report[0] & 0x01) packet.buttons |= LEFT_CLICK;
+	if (report[0] & 0x02) packet.buttons |= RIGHT_CLICK;
+	if (report[0] & 0x04) packet.buttons |= MIDDLE_CLICK;
+	if (len > 3) {
+		if ((int8_t)report[3] > 0) packet.buttons |= MOUSE_SCROLL_UP;
+		else if ((int8_t)report[3] < 0) packet.buttons |= MOUSE_SCROLL_DOWN;
+	}
+
+	mouse_device_packet_t bitbucket;
+	while (pipe_size(mouse_pipe) > (int)(PACKET_DISCARD_POINT * sizeof(packet))) {
+		read_fs(mouse_pipe, 0, sizeof(packet), (uint8_t *)&bitbucket);
+	}
+	write_fs(mouse_pipe, 0, sizeof(packet), (uint8_t *)&packet);
+}
+
+/*
+ * Bottom half: turn buffered reports into pipe traffic.
+ */
+static void uhci_bottom_half(void * arg) {
+	while (uhci_drained != uhci_produced) {
+		struct uhci_ring_entry entry = uhci_ring[uhci_drained % UHCI_RING_SIZE];
+		uhci_drained++;
+		struct uhci_input * in = &inputs[entry.ep];
+		if (in->is_keyboard) {
+			uhci_process_keyboard(in, entry.data, entry.timestamp);
+		} else {
+			uhci_process_mouse(in, entry.data, entry.len, entry.timestamp);
+		}
+	}
+}
+
+/*
+ * Re-arm an endpoint's single TD in place. The descriptor, its QH
+ * and the report buffer were all carved out of the schedule page at
+ * setup; polling costs no allocations, just this rewrite.
+ */
+static void uhci_input_arm(struct uhci_input * in) {
+	struct uhci_td * td = &in->hw->td;
+	td->link = UHCI_PTR_TERM;
+	td->buffer = SCHED_PHYS(in->hw->report);
+	td->token = UHCI_TOKEN(in->maxp, in->toggle, in->endpoint, in->addr, UHCI_PID_IN);
+	td->cs = TD_CTRL_ACTIVE | TD_CTRL_IOC | TD_CTRL_CERR(3) | (in->low_speed ? TD_CTRL_LS : 0);
+	in->hw->qh.element = SCHED_PHYS(td);
+}
+
+static int uhci_irq_handler(struct regs * r) {
+	uint16_t sts = inports(uhci_io + UHCI_USBSTS);
+	if (!(sts & UHCI_STS_ALL)) return 0; /* shared line, not us */
+	outports(uhci_io + UHCI_USBSTS, sts);
+
+	for (int i = 0; i < num_inputs; ++i) {
+		struct uhci_input * in = &inputs[i];
+		if (!in->active) continue;
+		uint32_t cs = in->hw->td.cs;
+		if (cs & TD_CTRL_ACTIVE) continue;
+
+		if (cs & TD_CTRL_ANYERROR) {
+			/* Retry with the same toggle; give up on a wedged device */
+			if (++in->errors > 8) {
+				in->active = 0;
+				continue;
+			}
+			uhci_input_arm(in);
+			continue;
+		}
+
+		in->errors = 0;
+		int len = TD_ACTLEN(cs);
+		if (len > 8) len = 8;
+		if (len > 0 && uhci_produced - uhci_drained < UHCI_RING_SIZE) {
+			struct uhci_ring_entry * entry = &uhci_ring[uhci_produced % UHCI_RING_SIZE];
+			entry->ep = i;
+			entry->len = len;
+			memcpy(entry->data, (void *)in->hw->report, 8);
+			entry->timestamp = timer_ticks * 1000 + timer_subticks;
+			uhci_produced++;
+			random_feed_entropy(entry->data[0] ^ (entry->data[1] << 8) ^ (entry->data[2] << 16));
+		}
+
+		in->toggle ^= 1;
+		uhci_input_arm(in);
+	}
+
+	workqueue_schedule_prio(uhci_bottom_half, NULL, WORKQUEUE_PRIORITY_HIGH);
+	irq_ack(uhci_irq);
+	return 1;
+}
+
+/*
+ * Polled control transfer on the default pipe; only used during
+ * enumeration, before the interrupt path matters. We always request
+ * exact lengths (reading the header first where the full length is
+ * not known), so no short-packet handling is needed.
+ */
+static int uhci_control(int addr, int low_speed, int maxp, uint8_t rt, uint8_t request,
+		uint16_t value, uint16_t index, uint16_t length, void * data) {
+	uint32_t lsbit = low_speed ? TD_CTRL_LS : 0;
+	int in_dir = rt & 0x80;
+
+	uint8_t * setup = sched->ctrl_setup;
+	setup[0] = rt;
+	setup[1] = request;
+	setup[2] = value & 0xFF;
+	setup[3] = value >> 8;
+	setup[4] = index & 0xFF;
+	setup[5] = index >> 8;
+	setup[6] = length & 0xFF;
+	setup[7] = length >> 8;
+
+	if (length && !in_dir) {
+		memcpy(sched->ctrl_data, data, length);
+	}
+
+	int nt = 0;
+	struct uhci_td * td = &sched->ctrl_td[nt++];
+	td->cs = TD_CTRL_ACTIVE | TD_CTRL_CERR(3) | lsbit;
+	td->token = UHCI_TOKEN(8, 0, 0, addr, UHCI_PID_SETUP);
+	td->buffer = SCHED_PHYS(setup);
+
+	int toggle = 1;
+	int offset = 0;
+	while (offset < length) {
+		int chunk = length - offset;
+		if (chunk > maxp) chunk = maxp;
+		td = &sched->ctrl_td[nt++];
+		td->cs = TD_CTRL_ACTIVE | TD_CTRL_CERR(3) | lsbit;
+		td->token = UHCI_TOKEN(chunk, toggle, 0, addr, in_dir ? UHCI_PID_IN : UHCI_PID_OUT);
+		td->buffer = SCHED_PHYS(sched->ctrl_data) + offset;
+		toggle ^= 1;
+		offset += chunk;
+	}
+
+	/* Status stage: opposite direction, always DATA1 */
+	td = &sched->ctrl_td[nt++];
+	td->cs = TD_CTRL_ACTIVE | TD_CTRL_CERR(3) | lsbit | TD_CTRL_IOC;
+	td->token = UHCI_TOKEN(0, 1, 0, addr, in_dir ? UHCI_PID_OUT : UHCI_PID_IN);
+	td->buffer = 0;
+
+	for (int i = 0; i < nt - 1; ++i) {
+		sched->ctrl_td[i].link = SCHED_PHYS(&sched->ctrl_td[i + 1]) | UHCI_PTR_DEPTH;
+	}
+	sched->ctrl_td[nt - 1].link = UHCI_PTR_TERM;
+
+	sched->ctrl_qh.element = SCHED_PHYS(&sched->ctrl_td[0]);
+
+	unsigned long timeout = timer_ticks * 1000 + timer_subticks + 500;
+	while ((sched->ctrl_td[nt - 1].cs & TD_CTRL_ACTIVE) &&
+	       timer_ticks * 1000 + timer_subticks < timeout) {
+		switch_task(1);
+	}
+	sched->ctrl_qh.element = UHCI_PTR_TERM;
+
+	for (int i = 0; i < nt; ++i) {
+		uint32_t cs = sched->ctrl_td[i].cs;
+		if (cs & (TD_CTRL_ACTIVE | TD_CTRL_ANYERROR)) {
+			debug_print(WARNING, "uhci: control transfer failed (td %d cs=0x%x)", i, (unsigned int)cs);
+			return -1;
+		}
+	}
+
+	if (length && in_dir) {
+		memcpy(data, sched->ctrl_data, length);
+	}
+	return length;
+}
+
+/*
+ * Splice an interrupt endpoint into the skeleton at the requested
+ * interval, rounded down to a power of two milliseconds.
+ */
+static void uhci_input_attach(struct uhci_input * in, int interval) {
+	int level = 0;
+	while (level < UHCI_SKEL_COUNT - 1 && (2 << level) <= interval) level++;
+	in->level = level;
+	in->toggle = 0;
+	in->errors = 0;
+	in->active = 1;
+	memset(in->last_report, 0, 8);
+	memset(&in->kbd_state, 0, sizeof(in->kbd_state));
+
+	uhci_input_arm(in);
+
+	IRQ_OFF;
+	in->hw->qh.head = sched->skel[level].head;
+	sched->skel[level].head = SCHED_PHYS(&in->hw->qh) | UHCI_PTR_QH;
+	IRQ_RES;
+
+	debug_print(NOTICE, "uhci: %s on port %d, address %d, polled every %d ms",
+			in->is_keyboard ? "keyboard" : "mouse", in->port + 1, in->addr, 1 << level);
+}
+
+static int uhci_next_address = 1;
+
+/*
+ * Reset and enable a root port, then walk the attached device's
+ * descriptors looking for HID boot interfaces.
+ */
+static void uhci_setup_port(int port) {
+	uint32_t reg = uhci_io + UHCI_PORTSC1 + port * 2;
+
+	if (!(inports(reg) & UHCI_PORT_CONNECT)) return;
+
+	outports(reg, UHCI_PORT_RESET);
+	uhci_delay(60);
+	outports(reg, 0);
+	uhci_delay(10);
+
+	for (int i = 0; i < 10; ++i) {
+		uint16_t st = inports(reg);
+		if (!(st & UHCI_PORT_CONNECT)) return;
+		if (st & (UHCI_PORT_CONNECT_CHANGE | UHCI_PORT_ENABLE_CHANGE)) {
+			/* Change bits are write-one-to-clear */
+			outports(reg, st & (UHCI_PORT_CONNECT_CHANGE | UHCI_PORT_ENABLE_CHANGE));
+			continue;
+		}
+		if (st & UHCI_PORT_ENABLE) break;
+		outports(reg, UHCI_PORT_ENABLE);
+		uhci_delay(10);
+	}
+	if (!(inports(reg) & UHCI_PORT_ENABLE)) {
+		debug_print(WARNING, "uhci: port %d would not enable", port + 1);
+		return;
+	}
+
+	int low_speed = !!(inports(reg) & UHCI_PORT_LOW_SPEED);
+
+	/* First 8 bytes of the device descriptor tell us the real
+	 * max packet size for the default pipe. */
+	uint8_t dd[18];
+	if (uhci_control(0, low_speed, 8, 0x80, 6, 0x0100, 0, 8, dd) < 0) return;
+	int maxp = dd[7];
+	if (!maxp) return;
+
+	int addr = uhci_next_address++;
+	if (uhci_control(0, low_speed, maxp, 0x00, 5, addr, 0, 0, NULL) < 0) return;
+	uhci_delay(5);
+
+	if (uhci_control(addr, low_speed, maxp, 0x80, 6, 0x0100, 0, 18, dd) < 0) return;
+
+	uint8_t cfg[256];
+	if (uhci_control(addr, low_speed, maxp, 0x80, 6, 0x0200, 0, 9, cfg) < 0) return;
+	uint16_t total = cfg[2] | (cfg[3] << 8);
+	if (total > sizeof(cfg)) total = sizeof(cfg);
+	if (uhci_control(addr, low_speed, maxp, 0x80, 6, 0x0200, 0, total, cfg) < 0) return;
+
+	int config_value = cfg[5];
+	int configured = 0;
+
+	/* Walk interface and endpoint descriptors; claim HID boot
+	 * keyboards (protocol 1) and mice (protocol 2). */
+	int iface = -1, protocol = 0;
+	for (int off = 0; off + 2 <= total && cfg[off];) {
+		uint8_t dlen = cfg[off];
+		uint8_t dtype = cfg[off + 1];
+		if (off + dlen > total) break;
+
+		if (dtype == 4) { /* interface */
+			iface = cfg[off + 2];
+			protocol = 0;
+			if (cfg[off + 5] == 3 && cfg[off + 6] == 1) { /* HID, boot subclass */
+				protocol = cfg[off + 7];
+			}
+		} else if (dtype == 5 && protocol && num_inputs < UHCI_MAX_INPUTS) { /* endpoint */
+			uint8_t ep_addr = cfg[off + 2];
+			uint8_t attr = cfg[off + 3];
+			if ((ep_addr & 0x80) && (attr & 0x03) == 3) { /* interrupt IN */
+				if (!configured) {
+					if (uhci_control(addr, low_speed, maxp, 0x00, 9, config_value, 0, 0, NULL) < 0) return;
+					configured = 1;
+				}
+				/* Boot protocol, no idle reports (only on change) */
+				uhci_control(addr, low_speed, maxp, 0x21, 0x0B, 0, iface, 0, NULL);
+				uhci_control(addr, low_speed, maxp, 0x21, 0x0A, 0, iface, 0, NULL);
+
+				struct uhci_input * in = &inputs[num_inputs];
+				in->hw = &sched->ep[num_inputs];
+				in->is_keyboard = (protocol == 1);
+				in->port = port;
+				in->addr = addr;
+				in->endpoint = ep_addr & 0x0F;
+				in->maxp = cfg[off + 4] | (cfg[off + 5] << 8);
+				if (in->maxp > 8) in->maxp = 8;
+				in->low_speed = low_speed;
+				num_inputs++;
+				uhci_input_attach(in, cfg[off + 6]);
+				protocol = 0; /* one endpoint per interface */
+			}
+		}
+		off += dlen;
+	}
+}
+
+/*
+ * Borrow the PS/2 drivers' pipes if they exist so both buses feed
+ * the same streams; create them ourselves on PS/2-less hardware.
+ */
+static fs_node_t * input_pipe(char * path, size_t size) {
+	fs_node_t * node = kopen(path, 0);
+	if (node) return node;
+	node = make_pipe(size);
+	node->flags = FS_CHARDEVICE;
+	vfs_mount(path, node);
+	return node;
+}
+
+static void find_uhci_device(uint32_t device, uint16_t vendorid, uint16_t deviceid, void * extra) {
 	if (pci_find_type(device) == 0xc03) {
 		int prog_if = (int)pci_read_field(device, PCI_PROG_IF, 1);
 		if (prog_if == 0) {
-			*((uint32_t *)extra)= device;
+			*((uint32_t *)extra) = device;
 		}
 	}
 }
 
-DEFINE_SHELL_FUNCTION(usb, "Enumerate USB devices (UHCI)") {
-
-	pci_scan(&find_usb_device, -1, &hub_device);
-
-	if (!hub_device) {
-		fprintf(tty, "Failed to locate a UHCI controller.\n");
+DEFINE_SHELL_FUNCTION(usb, "Show USB devices (UHCI)") {
+	if (!uhci_device_pci) {
+		fprintf(tty, "No UHCI controller present.\n");
 		return 1;
 	}
 
-	fprintf(tty, "Located UHCI controller: %2x:%2x.%d\n",
-			(int)pci_extract_bus (hub_device),
-			(int)pci_extract_slot(hub_device),
-			(int)pci_extract_func(hub_device));
+	fprintf(tty, "UHCI controller at %2x:%2x.%d, I/O 0x%x, IRQ %d\n",
+			(int)pci_extract_bus (uhci_device_pci),
+			(int)pci_extract_slot(uhci_device_pci),
+			(int)pci_extract_func(uhci_device_pci),
+			(unsigned int)uhci_io, uhci_irq);
+
+	for (int port = 0; port < 2; ++port) {
+		uint16_t st = inports(uhci_io + UHCI_PORTSC1 + port * 2);
+		fprintf(tty, "Port %d: %s%s\n", port + 1,
+				(st & UHCI_PORT_CONNECT) ? "connected" : "empty",
+				(st & UHCI_PORT_LOW_SPEED) ? ", low speed" : "");
+	}
+	for (int i = 0; i < num_inputs; ++i) {
+		struct uhci_input * in = &inputs[i];
+		fprintf(tty, "Input %d: %s, address %d endpoint %d, every %d ms%s\n",
+				i, in->is_keyboard ? "boot keyboard" : "boot mouse",
+				in->addr, in->endpoint, 1 << in->level,
+				in->active ? "" : " (disabled after errors)");
+	}
 
 	return 0;
 }
 
-static int install(void) {
+static int uhci_install(void) {
 	BIND_SHELL_FUNCTION(usb);
+
+	pci_scan(&find_uhci_device, -1, &uhci_device_pci);
+	if (!uhci_device_pci) {
+		debug_print(WARNING, "uhci: no UHCI controller found");
+		return 0;
+	}
+
+	uhci_io = pci_read_field(uhci_device_pci, PCI_BAR4, 4) & 0xFFFFFFFC;
+	uhci_irq = pci_get_interrupt(uhci_device_pci);
+
+	/* Bus mastering + I/O space; kill the legacy keyboard/mouse
+	 * emulation SMI traps while we're in config space. */
+	uint16_t command_reg = pci_read_field(uhci_device_pci, PCI_COMMAND, 2);
+	command_reg |= 0x5;
+	pci_write_field(uhci_device_pci, PCI_COMMAND, 2, command_reg);
+	pci_write_field(uhci_device_pci, 0xC0, 2, 0x8F00);
+
+	debug_print(NOTICE, "uhci: controller at %2x:%2x.%d, I/O 0x%x, IRQ %d",
+			(int)pci_extract_bus (uhci_device_pci),
+			(int)pci_extract_slot(uhci_device_pci),
+			(int)pci_extract_func(uhci_device_pci),
+			(unsigned int)uhci_io, uhci_irq);
+
+	/* Reset the controller */
+	outports(uhci_io + UHCI_USBCMD, UHCI_CMD_GRESET);
+	uhci_delay(20);
+	outports(uhci_io + UHCI_USBCMD, 0);
+	uhci_delay(10);
+	outports(uhci_io + UHCI_USBCMD, UHCI_CMD_HCRESET);
+	for (int i = 0; i < 50 && (inports(uhci_io + UHCI_USBCMD) & UHCI_CMD_HCRESET); ++i) {
+		uhci_delay(1);
+	}
+
+	/* Frame list wants 4K alignment, which a fresh page gives us;
+	 * every QH, TD and buffer lives in one more page. */
+	uintptr_t phys;
+	frame_list = (uint32_t *)kvmalloc_p(0x1000, &phys);
+	frame_list_phys = phys;
+	sched = (struct uhci_sched *)kvmalloc_p(sizeof(struct uhci_sched), &phys);
+	sched_phys = phys;
+	memset(sched, 0, sizeof(struct uhci_sched));
+
+	for (int i = 0; i < UHCI_SKEL_COUNT; ++i) {
+		sched->skel[i].element = UHCI_PTR_TERM;
+		sched->skel[i].head = i ? (SCHED_PHYS(&sched->skel[i - 1]) | UHCI_PTR_QH)
+		                        : (SCHED_PHYS(&sched->ctrl_qh) | UHCI_PTR_QH);
+	}
+	sched->ctrl_qh.head = UHCI_PTR_TERM;
+	sched->ctrl_qh.element = UHCI_PTR_TERM;
+
+	for (int n = 0; n < 1024; ++n) {
+		int level = 0;
+		for (int j = UHCI_SKEL_COUNT - 1; j > 0; --j) {
+			if (!(n & ((1 << j) - 1))) { level = j; break; }
+		}
+		frame_list[n] = SCHED_PHYS(&sched->skel[level]) | UHCI_PTR_QH;
+	}
+
+	kbd_pipe = input_pipe("/dev/kbd", 128);
+	kbd_event_pipe = input_pipe("/dev/kbdev", sizeof(key_event_t) * EVENTS_IN_PIPE);
+	mouse_pipe = input_pipe("/dev/mouse", sizeof(mouse_device_packet_t) * PACKETS_IN_PIPE);
+
+	irq_install_handler(uhci_irq, uhci_irq_handler, "uhci");
+
+	outportl(uhci_io + UHCI_FLBASEADD, frame_list_phys);
+	outports(uhci_io + UHCI_FRNUM, 0);
+	outportb(uhci_io + UHCI_SOFMOD, 64);
+	outports(uhci_io + UHCI_USBSTS, UHCI_STS_ALL);
+	outports(uhci_io + UHCI_USBINTR, 0x000D); /* IOC, error, host error */
+	outports(uhci_io + UHCI_USBCMD, UHCI_CMD_RS | UHCI_CMD_CF | UHCI_CMD_MAXP);
+
+	uhci_setup_port(0);
+	uhci_setup_port(1);
+
+	if (!num_inputs) {
+		debug_print(NOTICE, "uhci: no boot-protocol input devices found");
+	}
+
 	return 0;
 }
 
-static int uninstall(void) {
+static int uhci_uninstall(void) {
+	if (uhci_device_pci) {
+		outports(uhci_io + UHCI_USBCMD, 0);
+		outports(uhci_io + UHCI_USBINTR, 0);
+	}
 	return 0;
 }
 
-MODULE_DEF(usbuhci, install, uninstall);
+MODULE_DEF(usbuhci, uhci_install, uhci_uninstall);
 MODULE_DEPENDS(debugshell);
@@ -40,6 +40,11 @@ static void vbox_scan_pci(uint32_t device, uint16_t v, uint16_t d, void * extra)
 #define VMMCAP_HostWindows (1 << 1)
 #define VMMCAP_Graphics (1 << 2)
 
+/* Host event bits, so the IRQ handler only issues the VMMDev requests
+ * that actually have fresh data behind them. */
+#define VMME_DisplayChange (1 << 2)
+#define VMME_MousePosition (1 << 9)
+
 #define VMMDEV_VERSION 0x00010003
 #define VBOX_REQUEST_HEADER_VERSION 0x10001
 struct vbox_header {
@@ -119,6 +124,12 @@ static uint32_t vbox_device = 0;
 static uint32_t vbox_port = 0x0;
 static int vbox_irq = 0;
 
+/* All of the small VMMDev request structures fit comfortably in one
+ * page, so they are carved out of a single allocation instead of
+ * burning a page on each. */
+static uint8_t * vbox_requests;
+static uint32_t vbox_phys_requests;
+
 static struct vbox_ack_events * vbox_irq_ack;
 static uint32_t vbox_phys_ack;
 static struct vbox_display_change * vbox_disp;
@@ -144,40 +155,46 @@ static int mouse_state;
 #define DISCARD_POINT 32
 
 static int vbox_irq_handler(struct regs *r) {
-	if (!vbox_vmmdev[2]) return 0;
+	uint32_t events = vbox_vmmdev[2];
+	if (!events) return 0;
 
-	vbox_irq_ack->events = vbox_vmmdev[2];
+	vbox_irq_ack->events = events;
 	outportl(vbox_port, vbox_phys_ack);
 	irq_ack(vbox_irq);
 
-	outportl(vbox_port, vbox_phys_mouse_get);
+	if (events & VMME_MousePosition) {
+		outportl(vbox_port, vbox_phys_mouse_get);
 
-	unsigned int x, y;
+		unsigned int x, y;
 
-	if (lfb_vid_memory && lfb_resolution_x && lfb_resolution_y && vbox_mg->x && vbox_mg->y) {
-		x = ((unsigned int)vbox_mg->x * lfb_resolution_x) / 0xFFFF;
-		y = ((unsigned int)vbox_mg->y * lfb_resolution_y) / 0xFFFF;
-	} else {
-		x = vbox_mg->x;
-		y = vbox_mg->y;
-	}
+		if (lfb_vid_memory && lfb_resolution_x && lfb_resolution_y && vbox_mg->x && vbox_mg->y) {
+			x = ((unsigned int)vbox_mg->x * lfb_resolution_x) / 0xFFFF;
+			y = ((unsigned int)vbox_mg->y * lfb_resolution_y) / 0xFFFF;
+		} else {
+			x = vbox_mg->x;
+			y = vbox_mg->y;
+		}
 
-	mouse_device_packet_t packet;
-	packet.magic = MOUSE_MAGIC;
-	packet.x_difference = x;
-	packet.y_difference = y;
-	packet.buttons = 0;
+		mouse_device_packet_t packet;
+		packet.magic = MOUSE_MAGIC;
+		packet.x_difference = x;
+		packet.y_difference = y;
+		packet.buttons = 0;
+		packet.timestamp = timer_ticks * 1000 + timer_subticks;
 
-	mouse_device_packet_t bitbucket;
-	while (pipe_size(mouse_pipe) > (int)(DISCARD_POINT * sizeof(packet))) {
-		read_fs(mouse_pipe, 0, sizeof(packet), (uint8_t *)&bitbucket);
+		mouse_device_packet_t bitbucket;
+		while (pipe_size(mouse_pipe) > (int)(DISCARD_POINT * sizeof(packet))) {
+			read_fs(mouse_pipe, 0, sizeof(packet), (uint8_t *)&bitbucket);
+		}
+		write_fs(mouse_pipe, 0, sizeof(packet), (uint8_t *)&packet);
 	}
-	write_fs(mouse_pipe, 0, sizeof(packet), (uint8_t *)&packet);
 
-	outportl(vbox_port, vbox_phys_disp);
-	if (lfb_resolution_x && vbox_disp->xres && (vbox_disp->xres != lfb_resolution_x  || vbox_disp->yres != lfb_resolution_y)) {
+	if (events & VMME_DisplayChange) {
+		outportl(vbox_port, vbox_phys_disp);
+		if (lfb_resolution_x && vbox_disp->xres && (vbox_disp->xres != lfb_resolution_x  || vbox_disp->yres != lfb_resolution_y)) {
 
-		lfb_set_resolution(vbox_disp->xres, vbox_disp->yres);
+			lfb_set_resolution(vbox_disp->xres, vbox_disp->yres);
+		}
 	}
 
 	return 1;
@@ -190,15 +207,25 @@ void vbox_set_log(void) {
 #define VBOX_MOUSE_ON (1 << 0) | (1 << 4)
 #define VBOX_MOUSE_OFF (0)
 
+static void vbox_fill_header(struct vbox_header * header, uint32_t size, uint32_t requestType) {
+	header->size = size;
+	header->version = VBOX_REQUEST_HEADER_VERSION;
+	header->requestType = requestType;
+	header->rc = 0;
+	header->reserved1 = 0;
+	header->reserved2 = 0;
+}
+
+/* Hand out a slot from the shared request page. */
+static void * vbox_request_slot(uint32_t offset, uint32_t * phys) {
+	*phys = vbox_phys_requests + offset;
+	return vbox_requests + offset;
+}
+
 static void mouse_on_off(unsigned int status) {
 	mouse_state = status;
 
-	vbox_m->header.size = sizeof(struct vbox_mouse);
-	vbox_m->header.version = VBOX_REQUEST_HEADER_VERSION;
-	vbox_m->header.requestType = VMM_SetMouseState;
-	vbox_m->header.rc = 0;
-	vbox_m->header.reserved1 = 0;
-	vbox_m->header.reserved2 = 0;
+	vbox_fill_header(&vbox_m->header, sizeof(struct vbox_mouse), VMM_SetMouseState);
 	vbox_m->features = status;
 	vbox_m->x = 0;
 	vbox_m->y = 0;
@@ -222,6 +249,33 @@ static int ioctl_mouse(fs_node_t * node, int request, void * argp) {
 	return -1;
 }
 
+static int vbox_cursor_image(struct vid_cursor * cursor) {
+	if (!mouse_state || !vbox_pointershape) {
+		return -EINVAL;
+	}
+	if (!cursor->bitmap || cursor->width > 48 || cursor->height > 48) {
+		return -EINVAL;
+	}
+	validate(cursor->bitmap);
+
+	vbox_pointershape->xHot = cursor->hot_x;
+	vbox_pointershape->yHot = cursor->hot_y;
+	vbox_pointershape->width = cursor->width;
+	vbox_pointershape->height = cursor->height;
+
+	unsigned int mask_bytes = ((cursor->width + 7) / 8) * cursor->height;
+	memset(vbox_pointershape->data, 0x00, mask_bytes);
+	while (mask_bytes & 3) {
+		mask_bytes++;
+	}
+	memcpy(&vbox_pointershape->data[mask_bytes], cursor->bitmap, cursor->width * cursor->height * 4);
+	vbox_pointershape->header.size = sizeof(struct vbox_pointershape) + cursor->width * cursor->height * 4 + mask_bytes;
+	outportl(vbox_port, vbox_phys_pointershape);
+
+	/* The host tracks the position itself, so there is no move hook. */
+	return (vbox_pointershape->header.rc < 0) ? -EINVAL : 0;
+}
+
 uint32_t write_pointer(fs_node_t * node, uint64_t offset, uint32_t size, uint8_t *buffer) {
 
 	if (!mouse_state) {
@@ -306,62 +360,38 @@ static int vbox_check(void) {
 		fprintf(&vb, "irq line is %d\n", vbox_irq);
 		irq_install_handler(vbox_irq, vbox_irq_handler, "vbox");
 
+		vbox_requests = (void*)kvmalloc_p(0x1000, &vbox_phys_requests);
+
 		uint32_t vbox_phys = 0;
-		struct vbox_guest_info * packet = (void*)kvmalloc_p(0x1000, &vbox_phys);
-		packet->header.size = sizeof(struct vbox_guest_info);
-		packet->header.version = VBOX_REQUEST_HEADER_VERSION;
-		packet->header.requestType = VMM_ReportGuestInfo;
-		packet->header.rc = 0;
-		packet->header.reserved1 = 0;
-		packet->header.reserved2 = 0;
+		struct vbox_guest_info * packet = vbox_request_slot(0x000, &vbox_phys);
+		vbox_fill_header(&packet->header, sizeof(struct vbox_guest_info), VMM_ReportGuestInfo);
 		packet->version = VMMDEV_VERSION;
 		packet->ostype = 0;
 
 		outportl(vbox_port, vbox_phys);
 
-		struct vbox_guest_caps * caps = (void*)kvmalloc_p(0x1000, &vbox_phys);
-		caps->header.size = sizeof(struct vbox_guest_caps);
-		caps->header.version = VBOX_REQUEST_HEADER_VERSION;
-		caps->header.requestType = VMM_ReportGuestCapabilities;
-		caps->header.rc = 0;
-		caps->header.reserved1 = 0;
-		caps->header.reserved2 = 0;
+		struct vbox_guest_caps * caps = vbox_request_slot(0x100, &vbox_phys);
+		vbox_fill_header(&caps->header, sizeof(struct vbox_guest_caps), VMM_ReportGuestCapabilities);
 		caps->caps = VMMCAP_Graphics | (args_present("novboxseamless") ? 0 : VMMCAP_SeamlessMode);
 		outportl(vbox_port, vbox_phys);
 
-		vbox_irq_ack = (void*)kvmalloc_p(0x1000, &vbox_phys_ack);
-		vbox_irq_ack->header.size = sizeof(struct vbox_ack_events);
-		vbox_irq_ack->header.version = VBOX_REQUEST_HEADER_VERSION;
-		vbox_irq_ack->header.requestType = VMM_AcknowledgeEvents;
-		vbox_irq_ack->header.rc = 0;
-		vbox_irq_ack->header.reserved1 = 0;
-		vbox_irq_ack->header.reserved2 = 0;
+		vbox_irq_ack = vbox_request_slot(0x200, &vbox_phys_ack);
+		vbox_fill_header(&vbox_irq_ack->header, sizeof(struct vbox_ack_events), VMM_AcknowledgeEvents);
 		vbox_irq_ack->events = 0;
 
-
-		vbox_disp = (void*)kvmalloc_p(0x1000, &vbox_phys_disp);
-		vbox_disp->header.size = sizeof(struct vbox_display_change);
-		vbox_disp->header.version = VBOX_REQUEST_HEADER_VERSION;
-		vbox_disp->header.requestType = VMM_GetDisplayChangeRequest;
-		vbox_disp->header.rc = 0;
-		vbox_disp->header.reserved1 = 0;
-		vbox_disp->header.reserved2 = 0;
+		vbox_disp = vbox_request_slot(0x300, &vbox_phys_disp);
+		vbox_fill_header(&vbox_disp->header, sizeof(struct vbox_display_change), VMM_GetDisplayChangeRequest);
 		vbox_disp->xres = 0;
 		vbox_disp->yres = 0;
 		vbox_disp->bpp = 0;
 		vbox_disp->eventack = 1;
 
-		vbox_m = (void*)kvmalloc_p(0x1000, &vbox_phys_mouse);
+		vbox_m = vbox_request_slot(0x400, &vbox_phys_mouse);
 		mouse_on_off(VBOX_MOUSE_ON);
 
 		/* For use with later receives */
-		vbox_mg = (void*)kvmalloc_p(0x1000, &vbox_phys_mouse_get);
-		vbox_mg->header.size = sizeof(struct vbox_mouse);
-		vbox_mg->header.version = VBOX_REQUEST_HEADER_VERSION;
-		vbox_mg->header.requestType = VMM_GetMouseState;
-		vbox_mg->header.rc = 0;
-		vbox_mg->header.reserved1 = 0;
-		vbox_mg->header.reserved2 = 0;
+		vbox_mg = vbox_request_slot(0x500, &vbox_phys_mouse_get);
+		vbox_fill_header(&vbox_mg->header, sizeof(struct vbox_mouse), VMM_GetMouseState);
 
 		if (!args_present("novboxpointer")) {
 			vbox_pointershape = (void*)kvmalloc_p(0x4000, &vbox_phys_pointershape);
@@ -413,6 +443,9 @@ static int vbox_check(void) {
 					pointer_pipe->write = write_pointer;
 
 					vfs_mount("/dev/vboxpointer", pointer_pipe);
+
+					/* And expose it as the cursor plane on /dev/fb0 */
+					lfb_cursor_image_impl = vbox_cursor_image;
 				}
 			}
 		}
@@ -20,7 +20,10 @@ DEFINE_SHELL_FUNCTION(set_mode, "Set display mode") {
 	int x = atoi(argv[1]);
 	int y = atoi(argv[2]);
 	fprintf(tty, "Setting mode to %dx%d.\n", x, y);
-	lfb_set_resolution(x,y);
+	if (lfb_set_resolution(x,y) < 0) {
+		fprintf(tty, "Mode set rejected.\n");
+		return 1;
+	}
 	return 0;
 }
 
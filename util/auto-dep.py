@@ -15,8 +15,10 @@ class Classifier(object):
         '<toaru/kbd.h>':         (None, '-ltoaru_kbd',         []),
         '<toaru/list.h>':        (None, '-ltoaru_list',        []),
         '<toaru/hashmap.h>':     (None, '-ltoaru_hashmap',     ['<toaru/list.h>']),
+        '<toaru/intmap.h>':      (None, '-ltoaru_intmap',      ['<toaru/list.h>']),
         '<toaru/tree.h>':        (None, '-ltoaru_tree',        ['<toaru/list.h>']),
         '<toaru/pex.h>':         (None, '-ltoaru_pex',         []),
+        '<toaru/crc32.h>':       (None, '-ltoaru_crc32',       []),
         '<toaru/auth.h>':        (None, '-ltoaru_auth',        []),
         '<toaru/graphics.h>':    (None, '-ltoaru_graphics',    []),
         '<toaru/inflate.h>':     (None, '-ltoaru_inflate',     []),
@@ -28,7 +30,7 @@ class Classifier(object):
         '<toaru/confreader.h>':  (None, '-ltoaru_confreader',  ['<toaru/hashmap.h>']),
         '<toaru/markup.h>':      (None, '-ltoaru_markup',      ['<toaru/hashmap.h>']),
         '<toaru/json.h>':        (None, '-ltoaru_json',        ['<toaru/hashmap.h>']),
-        '<toaru/yutani.h>':      (None, '-ltoaru_yutani',      ['<toaru/kbd.h>', '<toaru/list.h>', '<toaru/pex.h>', '<toaru/graphics.h>', '<toaru/hashmap.h>']),
+        '<toaru/yutani.h>':      (None, '-ltoaru_yutani',      ['<toaru/kbd.h>', '<toaru/list.h>', '<toaru/pex.h>', '<toaru/graphics.h>', '<toaru/hashmap.h>', '<toaru/intmap.h>']),
         '<toaru/decorations.h>': (None, '-ltoaru_decorations', ['<toaru/menu.h>', '<toaru/sdf.h>', '<toaru/graphics.h>', '<toaru/yutani.h>']),
         '<toaru/termemu.h>':     (None, '-ltoaru_termemu',     ['<toaru/graphics.h>']),
         '<toaru/sdf.h>':         (None, '-ltoaru_sdf',         ['<toaru/graphics.h>', '<toaru/hashmap.h>']),
@@ -0,0 +1,116 @@
+#!/usr/bin/python3
+"""
+Compiles PNG sprites into a sprite pack: a single mmap-able file of
+pre-decoded, premultiplied ARGB pixel data consumed by
+libtoaru_spritepack at runtime without any image decoding.
+
+    make-spritepack.py output.pack a.png b.png ...
+
+Sprites appear in the pack in argument order. Only 8-bit RGB/RGBA
+non-interlaced PNGs are supported, which covers everything under
+base/usr/share/ttk/.
+"""
+
+import struct
+import sys
+import zlib
+
+SPRITEPACK_MAGIC   = 0x4b415054  # 'TPAK'
+SPRITEPACK_VERSION = 1
+
+ALPHA_OPAQUE   = 0
+ALPHA_EMBEDDED = 2
+
+def paeth(a, b, c):
+    p = a + b - c
+    pa, pb, pc = abs(p - a), abs(p - b), abs(p - c)
+    if pa <= pb and pa <= pc: return a
+    if pb <= pc: return b
+    return c
+
+def decode_png(path):
+    """Returns (width, height, alpha, pixels) with pixels as rows of RGBA tuples."""
+    with open(path, 'rb') as f:
+        data = f.read()
+    if data[:8] != b'\x89PNG\r\n\x1a\n':
+        raise ValueError(f"{path}: not a PNG")
+
+    width = height = None
+    color_type = None
+    idat = b''
+
+    offset = 8
+    while offset < len(data):
+        size, = struct.unpack('>I', data[offset:offset+4])
+        chunk_type = data[offset+4:offset+8]
+        chunk = data[offset+8:offset+8+size]
+        offset += 12 + size
+        if chunk_type == b'IHDR':
+            width, height, depth, color_type, _, _, interlace = struct.unpack('>IIBBBBB', chunk)
+            if depth != 8 or color_type not in (2, 6) or interlace:
+                raise ValueError(f"{path}: only 8-bit RGB/RGBA non-interlaced PNGs are supported")
+        elif chunk_type == b'IDAT':
+            idat += chunk
+        elif chunk_type == b'IEND':
+            break
+
+    bpp = 4 if color_type == 6 else 3
+    raw = zlib.decompress(idat)
+    stride = width * bpp
+
+    rows = []
+    prev = bytearray(stride)
+    for y in range(height):
+        filter_type = raw[y * (stride + 1)]
+        line = bytearray(raw[y * (stride + 1) + 1:(y + 1) * (stride + 1)])
+        for x in range(stride):
+            a = line[x - bpp] if x >= bpp else 0
+            b = prev[x]
+            c = prev[x - bpp] if x >= bpp else 0
+            if   filter_type == 1: line[x] = (line[x] + a) & 0xFF
+            elif filter_type == 2: line[x] = (line[x] + b) & 0xFF
+            elif filter_type == 3: line[x] = (line[x] + (a + b) // 2) & 0xFF
+            elif filter_type == 4: line[x] = (line[x] + paeth(a, b, c)) & 0xFF
+        prev = line
+        if bpp == 4:
+            rows.append([tuple(line[x*4:x*4+4]) for x in range(width)])
+        else:
+            rows.append([(line[x*3], line[x*3+1], line[x*3+2], 255) for x in range(width)])
+
+    alpha = ALPHA_EMBEDDED if color_type == 6 else ALPHA_OPAQUE
+    return width, height, alpha, rows
+
+def main():
+    if len(sys.argv) < 3:
+        print(f"usage: {sys.argv[0]} output.pack sprite.png ...", file=sys.stderr)
+        return 1
+
+    output = sys.argv[1]
+    sources = sys.argv[2:]
+
+    sprites = [decode_png(path) for path in sources]
+
+    header_size = 16
+    entry_size = 16
+    offset = header_size + entry_size * len(sprites)
+
+    entries = b''
+    pixels = b''
+    for width, height, alpha, rows in sprites:
+        entries += struct.pack('<IHHII', offset, width, height, alpha, 0)
+        for row in rows:
+            for r, g, b, a in row:
+                # Sprites store premultiplied alpha; see lib/png.c
+                pixels += struct.pack('<I',
+                    (a << 24) | ((r * a // 255) << 16) | ((g * a // 255) << 8) | (b * a // 255))
+        offset += width * height * 4
+
+    with open(output, 'wb') as f:
+        f.write(struct.pack('<IIII', SPRITEPACK_MAGIC, SPRITEPACK_VERSION, len(sprites), 0))
+        f.write(entries)
+        f.write(pixels)
+
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main())
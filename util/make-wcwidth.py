@@ -0,0 +1,223 @@
+#!/usr/bin/python3
+"""
+Generates libc/wchar/wcwidth.c: an O(1) wcwidth using a two-level
+lookup table (page index + deduplicated 256-entry pages) covering
+planes 0-2, with a short range scan for the nearly-empty planes
+above. The range data below is the same table the old linear scan
+implementation encoded as an if-chain; edit it here and regenerate
+rather than editing the C file.
+
+    make-wcwidth.py > libc/wchar/wcwidth.c
+"""
+
+# (upper_bound_exclusive, width): each width applies from the previous
+# entry's bound. Codepoints past the last entry are width -1.
+RANGES = [
+    (0x20,-1),(0x7f,1),(0xa0,-1),(0x300,1),(0x370,0),(0x378,1),(0x37a,-1),(0x37f,1),
+    (0x384,-1),(0x38b,1),(0x38c,-1),(0x38d,1),(0x38e,-1),(0x3a2,1),(0x3a3,-1),(0x483,1),
+    (0x487,0),(0x488,-1),(0x48a,0),(0x524,1),(0x531,-1),(0x557,1),(0x559,-1),(0x560,1),
+    (0x561,-1),(0x588,1),(0x589,-1),(0x58b,1),(0x591,-1),(0x5be,0),(0x5bf,1),(0x5c0,0),
+    (0x5c1,1),(0x5c3,0),(0x5c4,1),(0x5c6,0),(0x5c7,1),(0x5c8,0),(0x5d0,-1),(0x5eb,1),
+    (0x5f0,-1),(0x5f5,1),(0x600,-1),(0x604,0),(0x606,-1),(0x610,1),(0x616,0),(0x61c,1),
+    (0x61e,-1),(0x620,1),(0x621,-1),(0x64b,1),(0x65f,0),(0x660,-1),(0x670,1),(0x671,0),
+    (0x6d6,1),(0x6e5,0),(0x6e7,1),(0x6e9,0),(0x6ea,1),(0x6ee,0),(0x70e,1),(0x70f,-1),
+    (0x710,0),(0x711,1),(0x712,0),(0x730,1),(0x74b,0),(0x74d,-1),(0x7a6,1),(0x7b1,0),
+    (0x7b2,1),(0x7c0,-1),(0x7eb,1),(0x7f4,0),(0x7fb,1),(0x901,-1),(0x903,0),(0x93a,1),
+    (0x93c,-1),(0x93d,0),(0x941,1),(0x949,0),(0x94d,1),(0x94e,0),(0x950,-1),(0x951,1),
+    (0x955,0),(0x958,-1),(0x962,1),(0x964,0),(0x973,1),(0x97b,-1),(0x980,1),(0x981,-1),
+    (0x982,0),(0x984,1),(0x985,-1),(0x98d,1),(0x98f,-1),(0x991,1),(0x993,-1),(0x9a9,1),
+    (0x9aa,-1),(0x9b1,1),(0x9b2,-1),(0x9b3,1),(0x9b6,-1),(0x9ba,1),(0x9bc,-1),(0x9bd,0),
+    (0x9c1,1),(0x9c5,0),(0x9c7,-1),(0x9c9,1),(0x9cb,-1),(0x9cd,1),(0x9ce,0),(0x9cf,1),
+    (0x9d7,-1),(0x9d8,1),(0x9dc,-1),(0x9de,1),(0x9df,-1),(0x9e2,1),(0x9e4,0),(0x9e6,-1),
+    (0x9fb,1),(0xa01,-1),(0xa03,0),(0xa04,1),(0xa05,-1),(0xa0b,1),(0xa0f,-1),(0xa11,1),
+    (0xa13,-1),(0xa29,1),(0xa2a,-1),(0xa31,1),(0xa32,-1),(0xa34,1),(0xa35,-1),(0xa37,1),
+    (0xa38,-1),(0xa3a,1),(0xa3c,-1),(0xa3d,0),(0xa3e,-1),(0xa41,1),(0xa43,0),(0xa47,-1),
+    (0xa49,0),(0xa4b,-1),(0xa4e,0),(0xa51,-1),(0xa52,1),(0xa59,-1),(0xa5d,1),(0xa5e,-1),
+    (0xa5f,1),(0xa66,-1),(0xa70,1),(0xa72,0),(0xa76,1),(0xa81,-1),(0xa83,0),(0xa84,1),
+    (0xa85,-1),(0xa8e,1),(0xa8f,-1),(0xa92,1),(0xa93,-1),(0xaa9,1),(0xaaa,-1),(0xab1,1),
+    (0xab2,-1),(0xab4,1),(0xab5,-1),(0xaba,1),(0xabc,-1),(0xabd,0),(0xac1,1),(0xac6,0),
+    (0xac7,-1),(0xac9,0),(0xaca,1),(0xacb,-1),(0xacd,1),(0xace,0),(0xad0,-1),(0xad1,1),
+    (0xae0,-1),(0xae2,1),(0xae4,0),(0xae6,-1),(0xaf0,1),(0xaf1,-1),(0xaf2,1),(0xb01,-1),
+    (0xb02,0),(0xb04,1),(0xb05,-1),(0xb0d,1),(0xb0f,-1),(0xb11,1),(0xb13,-1),(0xb29,1),
+    (0xb2a,-1),(0xb31,1),(0xb32,-1),(0xb34,1),(0xb35,-1),(0xb3a,1),(0xb3c,-1),(0xb3d,0),
+    (0xb3f,1),(0xb40,0),(0xb41,1),(0xb44,0),(0xb45,1),(0xb47,-1),(0xb49,1),(0xb4b,-1),
+    (0xb4d,1),(0xb4e,0),(0xb56,-1),(0xb57,0),(0xb58,1),(0xb5c,-1),(0xb5e,1),(0xb5f,-1),
+    (0xb64,1),(0xb66,-1),(0xb72,1),(0xb82,-1),(0xb83,0),(0xb84,1),(0xb85,-1),(0xb8b,1),
+    (0xb8e,-1),(0xb91,1),(0xb92,-1),(0xb96,1),(0xb99,-1),(0xb9b,1),(0xb9c,-1),(0xb9d,1),
+    (0xb9e,-1),(0xba0,1),(0xba3,-1),(0xba5,1),(0xba8,-1),(0xbab,1),(0xbae,-1),(0xbba,1),
+    (0xbbe,-1),(0xbc0,1),(0xbc1,0),(0xbc3,1),(0xbc6,-1),(0xbc9,1),(0xbca,-1),(0xbcd,1),
+    (0xbce,0),(0xbd0,-1),(0xbd1,1),(0xbd7,-1),(0xbd8,1),(0xbe6,-1),(0xbfb,1),(0xc01,-1),
+    (0xc04,1),(0xc05,-1),(0xc0d,1),(0xc0e,-1),(0xc11,1),(0xc12,-1),(0xc29,1),(0xc2a,-1),
+    (0xc34,1),(0xc35,-1),(0xc3a,1),(0xc3d,-1),(0xc3e,1),(0xc41,0),(0xc45,1),(0xc46,-1),
+    (0xc49,0),(0xc4a,-1),(0xc4e,0),(0xc55,-1),(0xc57,0),(0xc58,-1),(0xc5a,1),(0xc60,-1),
+    (0xc64,1),(0xc66,-1),(0xc70,1),(0xc78,-1),(0xc80,1),(0xc82,-1),(0xc84,1),(0xc85,-1),
+    (0xc8d,1),(0xc8e,-1),(0xc91,1),(0xc92,-1),(0xca9,1),(0xcaa,-1),(0xcb4,1),(0xcb5,-1),
+    (0xcba,1),(0xcbc,-1),(0xcbd,0),(0xcc5,1),(0xcc6,-1),(0xcc9,1),(0xcca,-1),(0xccc,1),
+    (0xcce,0),(0xcd5,-1),(0xcd7,1),(0xcde,-1),(0xcdf,1),(0xce0,-1),(0xce2,1),(0xce4,0),
+    (0xce6,-1),(0xcf0,1),(0xcf1,-1),(0xcf3,1),(0xd02,-1),(0xd04,1),(0xd05,-1),(0xd0d,1),
+    (0xd0e,-1),(0xd11,1),(0xd12,-1),(0xd29,1),(0xd2a,-1),(0xd3a,1),(0xd3d,-1),(0xd41,1),
+    (0xd44,0),(0xd45,1),(0xd46,-1),(0xd49,1),(0xd4a,-1),(0xd4d,1),(0xd4e,0),(0xd57,-1),
+    (0xd58,1),(0xd60,-1),(0xd64,1),(0xd66,-1),(0xd76,1),(0xd79,-1),(0xd80,1),(0xd82,-1),
+    (0xd84,1),(0xd85,-1),(0xd97,1),(0xd9a,-1),(0xdb2,1),(0xdb3,-1),(0xdbc,1),(0xdbd,-1),
+    (0xdbe,1),(0xdc0,-1),(0xdc7,1),(0xdca,-1),(0xdcb,0),(0xdcf,-1),(0xdd2,1),(0xdd5,0),
+    (0xdd6,-1),(0xdd7,0),(0xdd8,-1),(0xde0,1),(0xdf2,-1),(0xdf5,1),(0xe01,-1),(0xe31,1),
+    (0xe32,0),(0xe34,1),(0xe3b,0),(0xe3f,-1),(0xe47,1),(0xe4f,0),(0xe5c,1),(0xe81,-1),
+    (0xe83,1),(0xe84,-1),(0xe85,1),(0xe87,-1),(0xe89,1),(0xe8a,-1),(0xe8b,1),(0xe8d,-1),
+    (0xe8e,1),(0xe94,-1),(0xe98,1),(0xe99,-1),(0xea0,1),(0xea1,-1),(0xea4,1),(0xea5,-1),
+    (0xea6,1),(0xea7,-1),(0xea8,1),(0xeaa,-1),(0xeac,1),(0xead,-1),(0xeb1,1),(0xeb2,0),
+    (0xeb4,1),(0xeba,0),(0xebb,-1),(0xebd,0),(0xebe,1),(0xec0,-1),(0xec5,1),(0xec6,-1),
+    (0xec7,1),(0xec8,-1),(0xece,0),(0xed0,-1),(0xeda,1),(0xedc,-1),(0xede,1),(0xf00,-1),
+    (0xf18,1),(0xf1a,0),(0xf35,1),(0xf36,0),(0xf37,1),(0xf38,0),(0xf39,1),(0xf3a,0),
+    (0xf48,1),(0xf49,-1),(0xf6d,1),(0xf71,-1),(0xf7f,0),(0xf80,1),(0xf85,0),(0xf86,1),
+    (0xf88,0),(0xf8c,1),(0xf90,-1),(0xf98,0),(0xf99,-1),(0xfbd,0),(0xfbe,-1),(0xfc6,1),
+    (0xfc7,0),(0xfcd,1),(0xfce,-1),(0xfd5,1),(0x1000,-1),(0x102d,1),(0x1031,0),(0x1032,1),
+    (0x1033,0),(0x1036,1),(0x1038,0),(0x1039,1),(0x103a,0),(0x1058,1),(0x105a,0),(0x109a,1),
+    (0x109e,-1),(0x10c6,1),(0x10d0,-1),(0x10fd,1),(0x1100,-1),(0x115a,2),(0x115f,-1),(0x1160,2),
+    (0x11a3,0),(0x11a8,-1),(0x11fa,0),(0x1200,-1),(0x1249,1),(0x124a,-1),(0x124e,1),(0x1250,-1),
+    (0x1257,1),(0x1258,-1),(0x1259,1),(0x125a,-1),(0x125e,1),(0x1260,-1),(0x1289,1),(0x128a,-1),
+    (0x128e,1),(0x1290,-1),(0x12b1,1),(0x12b2,-1),(0x12b6,1),(0x12b8,-1),(0x12bf,1),(0x12c0,-1),
+    (0x12c1,1),(0x12c2,-1),(0x12c6,1),(0x12c8,-1),(0x12d7,1),(0x12d8,-1),(0x1311,1),(0x1312,-1),
+    (0x1316,1),(0x1318,-1),(0x135b,1),(0x135f,-1),(0x1360,0),(0x137d,1),(0x1380,-1),(0x139a,1),
+    (0x13a0,-1),(0x13f5,1),(0x1401,-1),(0x1677,1),(0x1680,-1),(0x169d,1),(0x16a0,-1),(0x16f1,1),
+    (0x1700,-1),(0x170d,1),(0x170e,-1),(0x1712,1),(0x1715,0),(0x1720,-1),(0x1732,1),(0x1735,0),
+    (0x1737,1),(0x1740,-1),(0x1752,1),(0x1754,0),(0x1760,-1),(0x176d,1),(0x176e,-1),(0x1771,1),
+    (0x1772,-1),(0x1774,0),(0x1780,-1),(0x17b4,1),(0x17b6,0),(0x17b7,1),(0x17be,0),(0x17c6,1),
+    (0x17c7,0),(0x17c9,1),(0x17d4,0),(0x17dd,1),(0x17de,0),(0x17e0,-1),(0x17ea,1),(0x17f0,-1),
+    (0x17fa,1),(0x1800,-1),(0x180b,1),(0x180e,0),(0x180f,1),(0x1810,-1),(0x181a,1),(0x1820,-1),
+    (0x1878,1),(0x1880,-1),(0x18a9,1),(0x18aa,0),(0x18ab,1),(0x1900,-1),(0x191d,1),(0x1920,-1),
+    (0x1923,0),(0x1927,1),(0x192c,0),(0x1930,-1),(0x1932,1),(0x1933,0),(0x1939,1),(0x193c,0),
+    (0x1940,-1),(0x1941,1),(0x1944,-1),(0x196e,1),(0x1970,-1),(0x1975,1),(0x1980,-1),(0x19aa,1),
+    (0x19b0,-1),(0x19ca,1),(0x19d0,-1),(0x19da,1),(0x19de,-1),(0x1a17,1),(0x1a19,0),(0x1a1c,1),
+    (0x1a1e,-1),(0x1a20,1),(0x1b00,-1),(0x1b04,0),(0x1b34,1),(0x1b35,0),(0x1b36,1),(0x1b3b,0),
+    (0x1b3c,1),(0x1b3d,0),(0x1b42,1),(0x1b43,0),(0x1b4c,1),(0x1b50,-1),(0x1b6b,1),(0x1b74,0),
+    (0x1b7d,1),(0x1b80,-1),(0x1bab,1),(0x1bae,-1),(0x1bba,1),(0x1c00,-1),(0x1c38,1),(0x1c3b,-1),
+    (0x1c4a,1),(0x1c4d,-1),(0x1c80,1),(0x1d00,-1),(0x1dc0,1),(0x1dcb,0),(0x1de7,1),(0x1dfe,-1),
+    (0x1e00,0),(0x1f16,1),(0x1f18,-1),(0x1f1e,1),(0x1f20,-1),(0x1f46,1),(0x1f48,-1),(0x1f4e,1),
+    (0x1f50,-1),(0x1f58,1),(0x1f59,-1),(0x1f5a,1),(0x1f5b,-1),(0x1f5c,1),(0x1f5d,-1),(0x1f5e,1),
+    (0x1f5f,-1),(0x1f7e,1),(0x1f80,-1),(0x1fb5,1),(0x1fb6,-1),(0x1fc5,1),(0x1fc6,-1),(0x1fd4,1),
+    (0x1fd6,-1),(0x1fdc,1),(0x1fdd,-1),(0x1ff0,1),(0x1ff2,-1),(0x1ff5,1),(0x1ff6,-1),(0x1fff,1),
+    (0x2000,-1),(0x200b,1),(0x2010,0),(0x2028,1),(0x202a,-1),(0x202f,0),(0x2060,1),(0x2064,0),
+    (0x2065,1),(0x206a,-1),(0x2070,0),(0x2072,1),(0x2074,-1),(0x208f,1),(0x2090,-1),(0x2095,1),
+    (0x20a0,-1),(0x20b6,1),(0x20d0,-1),(0x20f0,0),(0x20f1,1),(0x2100,-1),(0x2150,1),(0x2153,-1),
+    (0x2189,1),(0x2190,-1),(0x2329,1),(0x232b,2),(0x23e8,1),(0x2400,-1),(0x2427,1),(0x2440,-1),
+    (0x244b,1),(0x2460,-1),(0x269e,1),(0x26a0,-1),(0x26c4,1),(0x2701,-1),(0x2705,1),(0x2706,-1),
+    (0x270a,1),(0x270c,-1),(0x2728,1),(0x2729,-1),(0x274c,1),(0x274d,-1),(0x274e,1),(0x274f,-1),
+    (0x2753,1),(0x2756,-1),(0x2757,1),(0x2758,-1),(0x275f,1),(0x2761,-1),(0x2795,1),(0x2798,-1),
+    (0x27b0,1),(0x27b1,-1),(0x27bf,1),(0x27c0,-1),(0x27cb,1),(0x27cc,-1),(0x27cd,1),(0x27d0,-1),
+    (0x2b4d,1),(0x2b50,-1),(0x2b55,1),(0x2c00,-1),(0x2c2f,1),(0x2c30,-1),(0x2c5f,1),(0x2c60,-1),
+    (0x2c70,1),(0x2c71,-1),(0x2c7e,1),(0x2c80,-1),(0x2ceb,1),(0x2cf9,-1),(0x2d26,1),(0x2d30,-1),
+    (0x2d66,1),(0x2d6f,-1),(0x2d70,1),(0x2d80,-1),(0x2d97,1),(0x2da0,-1),(0x2da7,1),(0x2da8,-1),
+    (0x2daf,1),(0x2db0,-1),(0x2db7,1),(0x2db8,-1),(0x2dbf,1),(0x2dc0,-1),(0x2dc7,1),(0x2dc8,-1),
+    (0x2dcf,1),(0x2dd0,-1),(0x2dd7,1),(0x2dd8,-1),(0x2ddf,1),(0x2de0,-1),(0x2e31,1),(0x2e80,-1),
+    (0x2e9a,2),(0x2e9b,-1),(0x2ef4,2),(0x2f00,-1),(0x2fd6,2),(0x2ff0,-1),(0x2ffc,2),(0x3000,-1),
+    (0x302a,2),(0x3030,0),(0x303f,2),(0x3040,1),(0x3041,-1),(0x3097,2),(0x3099,-1),(0x309b,0),
+    (0x3100,2),(0x3105,-1),(0x312e,2),(0x3131,-1),(0x318f,2),(0x3190,-1),(0x31b8,2),(0x31c0,-1),
+    (0x31d0,2),(0x31f0,-1),(0x321f,2),(0x3220,-1),(0x3244,2),(0x3250,-1),(0x32ff,2),(0x3300,-1),
+    (0x4db6,2),(0x4dc0,-1),(0x9fbc,2),(0xa000,-1),(0xa48d,2),(0xa490,-1),(0xa4c7,2),(0xa500,-1),
+    (0xa62c,1),(0xa640,-1),(0xa660,1),(0xa662,-1),(0xa674,1),(0xa67c,-1),(0xa698,1),(0xa700,-1),
+    (0xa78d,1),(0xa7fb,-1),(0xa802,1),(0xa803,0),(0xa806,1),(0xa807,0),(0xa80b,1),(0xa80c,0),
+    (0xa825,1),(0xa827,0),(0xa82c,1),(0xa840,-1),(0xa878,1),(0xa880,-1),(0xa8c5,1),(0xa8ce,-1),
+    (0xa8da,1),(0xa900,-1),(0xa954,1),(0xa95f,-1),(0xa960,1),(0xaa00,-1),(0xaa37,1),(0xaa40,-1),
+    (0xaa4e,1),(0xaa50,-1),(0xaa5a,1),(0xaa5c,-1),(0xaa60,1),(0xac00,-1),(0xd7a4,2),(0xe000,-1),
+    (0xf8f0,1),(0xf900,0),(0xfa2e,2),(0xfa30,-1),(0xfa6b,2),(0xfa70,-1),(0xfada,2),(0xfb00,-1),
+    (0xfb07,1),(0xfb13,-1),(0xfb18,1),(0xfb1d,-1),(0xfb1e,1),(0xfb1f,0),(0xfb37,1),(0xfb38,-1),
+    (0xfb3d,1),(0xfb3e,-1),(0xfb3f,1),(0xfb40,-1),(0xfb42,1),(0xfb43,-1),(0xfb45,1),(0xfb46,-1),
+    (0xfbb2,1),(0xfbd3,-1),(0xfd40,1),(0xfd50,-1),(0xfd90,1),(0xfd92,-1),(0xfdc8,1),(0xfdf0,-1),
+    (0xfdfe,1),(0xfe00,-1),(0xfe10,0),(0xfe1a,2),(0xfe20,-1),(0xfe24,0),(0xfe27,1),(0xfe30,-1),
+    (0xfe53,2),(0xfe54,-1),(0xfe67,2),(0xfe68,-1),(0xfe6c,2),(0xfe70,-1),(0xfe75,1),(0xfe76,-1),
+    (0xfefd,1),(0xfeff,-1),(0xff00,0),(0xff01,-1),(0xff61,2),(0xffbf,1),(0xffc2,-1),(0xffc8,1),
+    (0xffca,-1),(0xffd0,1),(0xffd2,-1),(0xffd8,1),(0xffda,-1),(0xffdd,1),(0xffe0,-1),(0xffe7,2),
+    (0xffe8,-1),(0xffef,1),(0xfff9,-1),(0xfffc,0),(0xfffe,1),(0x10000,-1),(0x1000c,1),(0x1000d,-1),
+    (0x10027,1),(0x10028,-1),(0x1003b,1),(0x1003c,-1),(0x1003e,1),(0x1003f,-1),(0x1004e,1),(0x10050,-1),
+    (0x1005e,1),(0x10080,-1),(0x100fb,1),(0x10100,-1),(0x10103,1),(0x10107,-1),(0x10134,1),(0x10137,-1),
+    (0x1018b,1),(0x10190,-1),(0x1019c,1),(0x101d0,-1),(0x101fe,1),(0x10280,-1),(0x1029d,1),(0x102a0,-1),
+    (0x102d1,1),(0x10300,-1),(0x1031f,1),(0x10320,-1),(0x10324,1),(0x10330,-1),(0x1034b,1),(0x10380,-1),
+    (0x1039e,1),(0x1039f,-1),(0x103c4,1),(0x103c8,-1),(0x103d6,1),(0x10400,-1),(0x1049e,1),(0x104a0,-1),
+    (0x104aa,1),(0x10800,-1),(0x10806,1),(0x10808,-1),(0x10809,1),(0x1080a,-1),(0x10836,1),(0x10837,-1),
+    (0x10839,1),(0x1083c,-1),(0x1083d,1),(0x1083f,-1),(0x10840,1),(0x10900,-1),(0x1091a,1),(0x1091f,-1),
+    (0x10920,1),(0x10a00,-1),(0x10a01,1),(0x10a04,0),(0x10a05,-1),(0x10a07,0),(0x10a0c,-1),(0x10a10,0),
+    (0x10a14,1),(0x10a15,-1),(0x10a18,1),(0x10a19,-1),(0x10a34,1),(0x10a38,-1),(0x10a3b,0),(0x10a3f,-1),
+    (0x10a40,0),(0x10a48,1),(0x10a50,-1),(0x10a59,1),(0x12000,-1),(0x1236f,1),(0x12400,-1),(0x12463,1),
+    (0x12470,-1),(0x12474,1),(0x1d000,-1),(0x1d0f6,1),(0x1d100,-1),(0x1d127,1),(0x1d129,-1),(0x1d167,1),
+    (0x1d16a,0),(0x1d173,1),(0x1d183,0),(0x1d185,1),(0x1d18c,0),(0x1d1aa,1),(0x1d1ae,0),(0x1d1de,1),
+    (0x1d200,-1),(0x1d242,1),(0x1d245,0),(0x1d246,1),(0x1d300,-1),(0x1d357,1),(0x1d360,-1),(0x1d372,1),
+    (0x1d400,-1),(0x1d455,1),(0x1d456,-1),(0x1d49d,1),(0x1d49e,-1),(0x1d4a0,1),(0x1d4a2,-1),(0x1d4a3,1),
+    (0x1d4a5,-1),(0x1d4a7,1),(0x1d4a9,-1),(0x1d4ad,1),(0x1d4ae,-1),(0x1d4ba,1),(0x1d4bb,-1),(0x1d4bc,1),
+    (0x1d4bd,-1),(0x1d4c4,1),(0x1d4c5,-1),(0x1d506,1),(0x1d507,-1),(0x1d50b,1),(0x1d50d,-1),(0x1d515,1),
+    (0x1d516,-1),(0x1d51d,1),(0x1d51e,-1),(0x1d53a,1),(0x1d53b,-1),(0x1d53f,1),(0x1d540,-1),(0x1d545,1),
+    (0x1d546,-1),(0x1d547,1),(0x1d54a,-1),(0x1d551,1),(0x1d552,-1),(0x1d6a6,1),(0x1d6a8,-1),(0x1d7cc,1),
+    (0x1d7ce,-1),(0x1d800,1),(0x1f000,-1),(0x1f02c,1),(0x1f030,-1),(0x1f094,1),(0x20000,-1),(0x2a6d7,2),
+    (0x2f800,-1),(0x2fa1e,2),(0xe0001,-1),(0xe0002,0),(0xe0020,-1),(0xe0080,0),(0xe0100,-1),(0xe01f0,0),
+    (0xf0000,-1),(0xffffe,1),(0x100000,-1),(0x10fffe,1),(0x110000,-1),
+]
+
+TABLE_LIMIT = 0x30000
+PAGE_SIZE = 256
+
+def main():
+    widths = [-1] * 0x110000
+    start = 0
+    for limit, width in RANGES:
+        for cp in range(start, limit):
+            widths[cp] = width
+        start = limit
+
+    pages = []
+    page_for = {}
+    index = []
+    for base in range(0, TABLE_LIMIT, PAGE_SIZE):
+        page = tuple(widths[base:base + PAGE_SIZE])
+        if page not in page_for:
+            page_for[page] = len(pages)
+            pages.append(page)
+        index.append(page_for[page])
+
+    print('/*')
+    print(' * wcwidth with O(1) two-level table lookup.')
+    print(' *')
+    print(' * This file is generated by util/make-wcwidth.py; edit the')
+    print(' * range data there and regenerate rather than editing this.')
+    print(' */')
+    print('#include <stddef.h>')
+    print('#include <wchar.h>')
+    print()
+    print(f'static const signed char wcwidth_pages[{len(pages)}][{PAGE_SIZE}] = {{')
+    for page in pages:
+        print('\t{')
+        for row in range(0, PAGE_SIZE, 16):
+            print('\t\t' + ','.join(f'{v:2}' for v in page[row:row + 16]) + ',')
+        print('\t},')
+    print('};')
+    print()
+    print(f'static const unsigned short wcwidth_index[{TABLE_LIMIT // PAGE_SIZE}] = {{')
+    for row in range(0, len(index), 16):
+        print('\t' + ','.join(f'{v:3}' for v in index[row:row + 16]) + ',')
+    print('};')
+    print()
+    print('int wcwidth(wchar_t wc) {')
+    print('\tif (wc == 0) return 0;')
+    print(f'\tif ((unsigned int)wc < 0x{TABLE_LIMIT:x}) {{')
+    print('\t\treturn wcwidth_pages[wcwidth_index[wc >> 8]][wc & 0xFF];')
+    print('\t}')
+    print('\t/* The planes above 2 are nearly empty; a short scan covers them */')
+    first = True
+    for limit, width in RANGES:
+        if limit <= TABLE_LIMIT: continue
+        kw = 'if' if first else 'else if'
+        print(f'\t{kw} (wc < 0x{limit:x}) return {width};')
+        first = False
+    print('\treturn -1;')
+    print('}')
+    print()
+    print('int wcswidth_n(const wchar_t * s, size_t n) {')
+    print('\tint out = 0;')
+    print('\twhile (n-- && *s) {')
+    print('\t\tint width = wcwidth(*s++);')
+    print('\t\tif (width < 0) return -1;')
+    print('\t\tout += width;')
+    print('\t}')
+    print('\treturn out;')
+    print('}')
+
+if __name__ == '__main__':
+    main()
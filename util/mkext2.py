@@ -0,0 +1,341 @@
+#!/usr/bin/python3
+"""
+Builds an ext2 image from a directory tree, laying file data out in
+boot order so that cold-boot I/O becomes one long sequential read.
+
+The optional manifest is a list of absolute (in-image) paths, one per
+line, in the order the system opens them at startup; /proc/bootopens
+on a running system produces exactly this. Directory data is placed
+first (lookups happen before any file read), then manifest files in
+manifest order, then everything else. Within one file, data blocks
+and their indirect blocks are strictly sequential.
+
+    util/mkext2.py -o toaruos-disk.img -m boot-order.txt base
+"""
+
+import argparse
+import os
+import stat
+import struct
+import sys
+import time
+
+BLOCK_SIZE       = 1024
+BLOCKS_PER_GROUP = 8192
+INODES_PER_GROUP = 2048
+INODE_SIZE       = 128
+INODES_PER_BLOCK = BLOCK_SIZE // INODE_SIZE
+POINTERS         = BLOCK_SIZE // 4
+DIRECT_BLOCKS    = 12
+
+EXT2_S_IFREG = 0x8000
+EXT2_S_IFDIR = 0x4000
+EXT2_S_IFLNK = 0xA000
+
+# Ownership conventions shared with createramdisk.py
+users = {
+    'root': 0,
+    'local': 1000,
+}
+
+restricted_files = {
+    'etc/master.passwd': 0o600,
+    'etc/sudoers': 0o600,
+    'tmp': 0o777,
+    'var': 0o755,
+    'bin/sudo': 0o4555,
+    'bin/gsudo': 0o4555,
+}
+
+class Node:
+    def __init__(self, rel, full):
+        self.rel      = rel   # in-image path, '' for the root
+        self.full     = full  # host path
+        self.children = []
+        self.inode    = 0
+        self.blocks   = []    # all blocks, indirects included, in order
+        self.data     = b''
+        st = os.lstat(full)
+        self.is_dir  = stat.S_ISDIR(st.st_mode)
+        self.is_link = stat.S_ISLNK(st.st_mode)
+        self.size    = 0 if self.is_dir else st.st_size
+        if self.is_link:
+            self.link_target = os.readlink(full)
+            self.size = len(self.link_target)
+        self.uid = 0
+        if rel.startswith('home/'):
+            self.uid = users.get(rel.split('/')[1], 0)
+        elif rel.startswith('src'):
+            self.uid = users.get('local', 0)
+        if rel in restricted_files:
+            self.mode = restricted_files[rel]
+        elif self.is_link:
+            self.mode = 0o777
+        else:
+            self.mode = stat.S_IMODE(st.st_mode)
+
+def scan_tree(root_dir):
+    """Collect the tree breadth-first; returns (root, all nodes, by path)."""
+    root = Node('', root_dir)
+    nodes = [root]
+    by_path = {'/': root}
+    queue = [root]
+    while queue:
+        d = queue.pop(0)
+        for name in sorted(os.listdir(d.full)):
+            rel = name if not d.rel else d.rel + '/' + name
+            n = Node(rel, os.path.join(d.full, name))
+            d.children.append((name, n))
+            nodes.append(n)
+            by_path['/' + rel] = n
+            if n.is_dir:
+                queue.append(n)
+    return root, nodes, by_path
+
+def data_block_count(size):
+    """Blocks a file of `size` needs, indirect blocks included."""
+    blocks = (size + BLOCK_SIZE - 1) // BLOCK_SIZE
+    total = blocks
+    if blocks > DIRECT_BLOCKS:
+        total += 1  # singly indirect
+    if blocks > DIRECT_BLOCKS + POINTERS:
+        over = blocks - DIRECT_BLOCKS - POINTERS
+        total += 1 + (over + POINTERS - 1) // POINTERS  # doubly + its tables
+    if blocks > DIRECT_BLOCKS + POINTERS + POINTERS * POINTERS:
+        raise ValueError('file too large for this tool (triply indirect)')
+    return total
+
+def stretch_last_entry(block, off):
+    """The final entry of every directory block spans to its end."""
+    return block[:off + 4] + struct.pack('<H', BLOCK_SIZE - off) + block[off + 6:]
+
+def serialize_directory(node):
+    """Pack dirents into blocks; entries never straddle a block."""
+    entries = [('.', node.inode), ('..', node.parent_inode)]
+    entries += [(name, child.inode) for name, child in node.children]
+    out = b''
+    block = b''
+    last_off = 0
+    for name, ino in entries:
+        nb = name.encode('utf-8')
+        rec = (8 + len(nb) + 3) & ~3
+        if len(block) + rec > BLOCK_SIZE:
+            out += stretch_last_entry(block, last_off).ljust(BLOCK_SIZE, b'\0')
+            block = b''
+        last_off = len(block)
+        block += struct.pack('<IHBB', ino, rec, len(nb), 0) + nb.ljust(rec - 8, b'\0')
+    if block:
+        out += stretch_last_entry(block, last_off).ljust(BLOCK_SIZE, b'\0')
+    return out
+
+def main():
+    parser = argparse.ArgumentParser(description='Build a boot-order-optimized ext2 image')
+    parser.add_argument('-o', '--output', required=True, help='Output image path')
+    parser.add_argument('-m', '--manifest', help='Boot-order manifest (see /proc/bootopens)')
+    parser.add_argument('source', help='Directory to image')
+    args = parser.parse_args()
+
+    root, nodes, by_path = scan_tree(args.source)
+
+    # Assign inodes: root is 2, the rest follow from 11 in scan order
+    root.inode = 2
+    root.parent_inode = 2
+    next_ino = 11
+    for n in nodes[1:]:
+        n.inode = next_ino
+        next_ino += 1
+    for n in nodes:
+        if n.is_dir:
+            for name, child in n.children:
+                child.parent_inode = n.inode
+
+    # Pre-serialize directories so their sizes are known
+    for n in nodes:
+        if n.is_dir:
+            n.data = serialize_directory(n)
+            n.size = len(n.data)
+
+    # Data placement order: directories, then the manifest, then the rest
+    manifest_nodes = []
+    if args.manifest:
+        with open(args.manifest) as f:
+            for line in f:
+                path = line.strip()
+                if not path or path.startswith('#'):
+                    continue
+                n = by_path.get(path)
+                if n is None:
+                    print('mkext2: manifest path not in tree: %s' % path, file=sys.stderr)
+                elif not n.is_dir and n not in manifest_nodes:
+                    manifest_nodes.append(n)
+    ordered = [n for n in nodes if n.is_dir]
+    ordered += manifest_nodes
+    ordered += [n for n in nodes if not n.is_dir and n not in manifest_nodes]
+
+    # Size the image: iterate because the descriptor table depends on it
+    need = sum(data_block_count(n.size) for n in nodes
+               if not (n.is_link and n.size < 60))
+    groups = 1
+    while True:
+        bgd_blocks = (groups * 32 + BLOCK_SIZE - 1) // BLOCK_SIZE
+        itable_blocks = INODES_PER_GROUP // INODES_PER_BLOCK
+        overhead = 1 + bgd_blocks + 2 + itable_blocks
+        data_per_group = BLOCKS_PER_GROUP - overhead
+        if groups * data_per_group >= need + need // 10 + 16 and \
+           groups * INODES_PER_GROUP >= next_ino + 16:
+            break
+        groups += 1
+    total_blocks = 1 + groups * BLOCKS_PER_GROUP
+    image = bytearray(total_blocks * BLOCK_SIZE)
+
+    # Per-group metadata positions and the data-block free list
+    group_meta = []
+    free_blocks = []
+    for g in range(groups):
+        base = 1 + g * BLOCKS_PER_GROUP
+        bbitmap = base + 1 + bgd_blocks
+        ibitmap = bbitmap + 1
+        itable  = ibitmap + 1
+        data    = itable + itable_blocks
+        group_meta.append((base, bbitmap, ibitmap, itable))
+        free_blocks.extend(range(data, base + BLOCKS_PER_GROUP))
+    free_blocks = iter(free_blocks)
+    used = set()
+
+    def alloc():
+        b = next(free_blocks)
+        used.add(b)
+        return b
+
+    def write_block(bno, data):
+        image[bno * BLOCK_SIZE:bno * BLOCK_SIZE + len(data)] = data
+
+    # Lay out data in access order
+    for n in ordered:
+        if n.is_link and n.size < 60:
+            continue  # fast symlink, no data blocks
+        if n.is_dir or n.is_link:
+            content = n.data if n.is_dir else n.link_target.encode('utf-8')
+        else:
+            with open(n.full, 'rb') as f:
+                content = f.read()
+        blocks = (len(content) + BLOCK_SIZE - 1) // BLOCK_SIZE
+        direct = []
+        ind = dind = 0
+        dind_tables = []
+        for i in range(blocks):
+            if i == DIRECT_BLOCKS:
+                ind = alloc()
+            if i == DIRECT_BLOCKS + POINTERS:
+                dind = alloc()
+            if i >= DIRECT_BLOCKS + POINTERS and \
+               (i - DIRECT_BLOCKS - POINTERS) % POINTERS == 0:
+                dind_tables.append(alloc())
+            direct.append(alloc())
+        for i, b in enumerate(direct):
+            write_block(b, content[i * BLOCK_SIZE:(i + 1) * BLOCK_SIZE])
+        if ind:
+            write_block(ind, struct.pack('<%dI' % min(POINTERS, blocks - DIRECT_BLOCKS),
+                                         *direct[DIRECT_BLOCKS:DIRECT_BLOCKS + POINTERS]))
+        if dind:
+            write_block(dind, struct.pack('<%dI' % len(dind_tables), *dind_tables))
+            for t, table in enumerate(dind_tables):
+                lo = DIRECT_BLOCKS + POINTERS + t * POINTERS
+                chunk = direct[lo:lo + POINTERS]
+                write_block(table, struct.pack('<%dI' % len(chunk), *chunk))
+        n.blocks = direct + ([ind] if ind else []) + ([dind] if dind else []) + dind_tables
+        n.block_list = direct[:DIRECT_BLOCKS] + [0] * (DIRECT_BLOCKS - min(DIRECT_BLOCKS, len(direct))) + [ind, dind, 0]
+
+    now = int(time.time())
+
+    # Inode tables
+    for n in nodes:
+        if n.is_dir:
+            mode = EXT2_S_IFDIR | n.mode
+            links = 2 + sum(1 for _, c in n.children if c.is_dir)
+        elif n.is_link:
+            mode = EXT2_S_IFLNK | n.mode
+            links = 1
+        else:
+            mode = EXT2_S_IFREG | n.mode
+            links = 1
+        if n.is_link and n.size < 60:
+            block_field = n.link_target.encode('utf-8').ljust(60, b'\0')
+            sectors = 0
+        else:
+            bl = n.block_list if n.blocks else [0] * 15
+            block_field = struct.pack('<15I', *bl)
+            sectors = len(n.blocks) * (BLOCK_SIZE // 512)
+        inode = struct.pack('<HHIIIIIHHII4x60sI24x',
+            mode, n.uid, n.size, now, now, now, 0,
+            n.uid, links, sectors, 0, block_field, 0)
+        g, idx = divmod(n.inode - 1, INODES_PER_GROUP)
+        itable = group_meta[g][3]
+        off = (itable * BLOCK_SIZE) + idx * INODE_SIZE
+        image[off:off + len(inode)] = inode
+
+    # Bitmaps and group descriptors
+    used_inodes = set(range(1, 11)) | set(n.inode for n in nodes)
+    descriptors = b''
+    total_free_blocks = 0
+    total_free_inodes = 0
+    for g, (base, bbitmap, ibitmap, itable) in enumerate(group_meta):
+        bmap = bytearray(BLOCK_SIZE)
+        free_b = 0
+        for i in range(BLOCKS_PER_GROUP):
+            bno = base + i
+            in_use = bno >= total_blocks or bno < itable + itable_blocks or bno in used
+            if in_use:
+                bmap[i // 8] |= 1 << (i % 8)
+            else:
+                free_b += 1
+        write_block(bbitmap, bmap)
+        imap = bytearray(BLOCK_SIZE)
+        free_i = 0
+        for i in range(INODES_PER_GROUP):
+            ino = g * INODES_PER_GROUP + i + 1
+            if ino in used_inodes:
+                imap[i // 8] |= 1 << (i % 8)
+            else:
+                free_i += 1
+        # Tail of the bitmap block past the last inode stays set
+        for i in range(INODES_PER_GROUP, BLOCK_SIZE * 8):
+            imap[i // 8] |= 1 << (i % 8)
+        write_block(ibitmap, imap)
+        dirs = sum(1 for n in nodes if n.is_dir and (n.inode - 1) // INODES_PER_GROUP == g)
+        descriptors += struct.pack('<IIIHHHH12x', bbitmap, ibitmap, itable,
+                                   free_b, free_i, dirs, 0)
+        total_free_blocks += free_b
+        total_free_inodes += free_i
+
+    # Superblock (rev 1, 128-byte inodes, no optional features)
+    superblock = struct.pack('<13I6H4I2HIHH3I16s16s64sI2BH',
+        groups * INODES_PER_GROUP, total_blocks, 0,
+        total_free_blocks, total_free_inodes, 1,
+        0, 0, BLOCKS_PER_GROUP, BLOCKS_PER_GROUP, INODES_PER_GROUP,
+        now, now,
+        0, 20, 0xEF53, 1, 1, 0,
+        now, 0, 0, 1,
+        0, 0,
+        11, INODE_SIZE, 0, 0, 0, 0,
+        b'', b'toaru-boot-opt', b'',
+        0, 0, 0, 0)
+
+    for g, (base, bbitmap, ibitmap, itable) in enumerate(group_meta):
+        if g == 0:
+            image[1024:1024 + len(superblock)] = superblock
+        else:
+            sb = bytearray(superblock)
+            sb[90:92] = struct.pack('<H', g)  # block_group_nr
+            write_block(base, sb)
+        for b in range((len(descriptors) + BLOCK_SIZE - 1) // BLOCK_SIZE):
+            write_block(base + 1 + b, descriptors[b * BLOCK_SIZE:(b + 1) * BLOCK_SIZE])
+
+    with open(args.output, 'wb') as f:
+        f.write(image)
+    print('mkext2: %d groups, %d/%d blocks used, %d files (%d boot-ordered)' % (
+        groups, total_blocks - total_free_blocks, total_blocks,
+        sum(1 for n in nodes if not n.is_dir), len(manifest_nodes)))
+
+if __name__ == '__main__':
+    main()
@@ -44,12 +44,7 @@ struct http_req {
 	int ssl;
 };
 
-struct {
-	int show_headers;
-	const char * output_file;
-	const char * cookie;
-	FILE * out;
-} fetch_options = {0};
+static struct http_req my_req;
 
 #define TRACE(msg,...) do { \
 	char tmp[512]; \
@@ -109,19 +104,17 @@ static void write_char(int x, int y, int val, uint32_t color) {
 }
 
 #define BUF_SIZE 255
-static void read_http_line(char * buf, FILE * f) {
+/* Read one CRLF-terminated header line with byte reads, so none of the
+ * body ends up buffered away where the bulk reads can't see it. */
+static void read_http_line(char * buf, int fd) {
 	memset(buf, 0x00, BUF_SIZE);
-
-	fgets(buf, BUF_SIZE, f);
-	char * _r = strchr(buf, '\r');
-	if (_r) {
-		*_r = '\0';
-	}
-	if (!_r) {
-		_r = strchr(buf, '\n'); /* that's not right, but, whatever */
-		if (_r) {
-			*_r = '\0';
-		}
+	size_t at = 0;
+	while (at < BUF_SIZE - 1) {
+		char c;
+		if (read(fd, &c, 1) <= 0) break;
+		if (c == '\n') break;
+		if (c == '\r') continue;
+		buf[at++] = c;
 	}
 }
 
@@ -409,6 +402,189 @@ static unsigned int crctab[256] = {
 	0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d
 };
 
+static uint32_t gf2_matrix_times(uint32_t * mat, uint32_t vec) {
+	uint32_t sum = 0;
+	while (vec) {
+		if (vec & 1) sum ^= *mat;
+		vec >>= 1;
+		mat++;
+	}
+	return sum;
+}
+
+static void gf2_matrix_square(uint32_t * square, uint32_t * mat) {
+	for (int n = 0; n < 32; n++) {
+		square[n] = gf2_matrix_times(mat, mat[n]);
+	}
+}
+
+/**
+ * Combine the CRCs of two concatenated byte ranges (zlib's algorithm):
+ * advance crc1 through len2 zero bytes by GF(2) matrix squaring, then
+ * fold in crc2. This is what lets each segment checksum its own bytes
+ * as they arrive and still produce the whole-image CRC at the end.
+ */
+static uint32_t crc32_combine(uint32_t crc1, uint32_t crc2, size_t len2) {
+	uint32_t even[32];
+	uint32_t odd[32];
+
+	if (len2 == 0) return crc1;
+
+	odd[0] = 0xedb88320; /* CRC-32 polynomial, reflected */
+	uint32_t row = 1;
+	for (int n = 1; n < 32; n++) {
+		odd[n] = row;
+		row <<= 1;
+	}
+	gf2_matrix_square(even, odd);
+	gf2_matrix_square(odd, even);
+
+	do {
+		gf2_matrix_square(even, odd);
+		if (len2 & 1) crc1 = gf2_matrix_times(even, crc1);
+		len2 >>= 1;
+		if (len2 == 0) break;
+		gf2_matrix_square(odd, even);
+		if (len2 & 1) crc1 = gf2_matrix_times(odd, crc1);
+		len2 >>= 1;
+	} while (len2);
+
+	return crc1 ^ crc2;
+}
+
+#define NUM_SEGMENTS    4
+#define SEGMENT_RETRIES 5
+#define CHUNK_SIZE      32768
+
+struct segment {
+	size_t   start;  /* First byte of the range */
+	size_t   end;    /* Last byte of the range, inclusive */
+	size_t   got;    /* Bytes received so far; resume point on retry */
+	uint32_t crc;    /* Finalized CRC of the segment's bytes */
+	volatile int done;
+	int      failed;
+};
+
+static struct segment segments[NUM_SEGMENTS];
+static volatile size_t total_progress = 0;
+
+static int open_connection(void) {
+	char file[100];
+	sprintf(file, "/dev/net/%s:%d", my_req.domain, my_req.port);
+	return open(file, O_RDWR);
+}
+
+/**
+ * Send a ranged GET and consume the response headers. Returns the HTTP
+ * status code (or -1 on a mangled response); *content_length gets the
+ * body length of this response and *total_size the full size of the
+ * resource from Content-Range, when the server provides them.
+ */
+static int http_get_range(int fd, size_t range_start, size_t range_end, size_t * content_length, size_t * total_size) {
+	char buf[BUF_SIZE];
+
+	sprintf(buf,
+		"GET /%s HTTP/1.0\r\n"
+		"User-Agent: curl/7.35.0\r\n"
+		"Host: %s\r\n"
+		"Accept: */*\r\n"
+		"Range: bytes=%lu-%lu\r\n"
+		"\r\n", my_req.path, my_req.domain,
+		(unsigned long)range_start, (unsigned long)range_end);
+	write(fd, buf, strlen(buf));
+
+	read_http_line(buf, fd);
+	char * code = strchr(buf, ' ');
+	if (!code) return -1;
+	int status = atoi(code + 1);
+
+	while (1) {
+		read_http_line(buf, fd);
+		if (!*buf) break;
+
+		char * value = strstr(buf, ": ");
+		if (!value) return -1;
+		*value = '\0';
+		value += 2;
+
+		if (content_length && !strcmp(buf, "Content-Length")) {
+			*content_length = atoi(value);
+		} else if (total_size && !strcmp(buf, "Content-Range")) {
+			/* bytes <first>-<last>/<total> */
+			char * slash = strchr(value, '/');
+			if (slash) *total_size = atoi(slash + 1);
+		}
+	}
+
+	return status;
+}
+
+/**
+ * Download one byte range of the image, writing straight to its final
+ * offset in the destination file and checksumming as it arrives. Short
+ * reads or dropped connections reconnect and resume from the last byte
+ * received rather than restarting the segment.
+ */
+static void * segment_func(void * arg) {
+	struct segment * seg = arg;
+	size_t length = seg->end - seg->start + 1;
+	int tries = 0;
+
+	char * buf = malloc(CHUNK_SIZE);
+	int out = open(img, O_WRONLY);
+	uint32_t crc = 0xffffffff;
+
+	while (seg->got < length) {
+		if (tries >= SEGMENT_RETRIES) {
+			seg->failed = 1;
+			break;
+		}
+
+		int fd = open_connection();
+		if (fd < 0) {
+			tries++;
+			continue;
+		}
+
+		size_t clen = 0;
+		int status = http_get_range(fd, seg->start + seg->got, seg->end, &clen, NULL);
+		if (status != 206) {
+			close(fd);
+			tries++;
+			continue;
+		}
+
+		size_t remaining = length - seg->got;
+		if (clen && clen < remaining) remaining = clen;
+
+		while (remaining) {
+			size_t want = remaining < CHUNK_SIZE ? remaining : CHUNK_SIZE;
+			ssize_t r = read(fd, buf, want);
+			if (r <= 0) break;
+			lseek(out, seg->start + seg->got, SEEK_SET);
+			write(out, buf, r);
+			/* Checksum this run while the other segments are still on
+			 * the wire. */
+			for (ssize_t i = 0; i < r; ++i) {
+				int ind = (crc ^ buf[i]) & 0xFF;
+				crc = (crc >> 8) ^ (crctab[ind]);
+			}
+			seg->got += r;
+			remaining -= r;
+			__sync_fetch_and_add(&total_progress, r);
+		}
+
+		close(fd);
+		if (seg->got < length) tries++;
+	}
+
+	free(buf);
+	close(out);
+	seg->crc = crc ^ 0xffffffff;
+	seg->done = 1;
+	return NULL;
+}
+
 /* This is taken from the kernel/sys/version.c */
 #if (defined(__GNUC__) || defined(__GNUG__)) && !(defined(__clang__) || defined(__INTEL_COMPILER))
 # define COMPILER_VERSION "gcc " __VERSION__
@@ -511,7 +687,6 @@ int main(int argc, char * argv[]) {
 	fclose(f);
 
 
-	struct http_req my_req;
 	/* TODO: Extract URL from kcmdline */
 	if (argc < 2) {
 		parse_url(DEFAULT_URL, &my_req);
@@ -519,157 +694,123 @@ int main(int argc, char * argv[]) {
 		parse_url(argv[1], &my_req);
 	}
 
-	char file[100];
-	sprintf(file, "/dev/net/%s:%d", my_req.domain, my_req.port);
-
 	TRACE("Fetching from %s... ", my_req.domain);
 
-	fetch_options.out = fopen(img,"w+");
+	/* Create the destination; segment writers open it by name and
+	 * write their ranges in place. */
+	FILE * pre = fopen(img, "w+");
+	if (!pre) {
+		TRACE("Unable to create %s\n", img);
+		return 1;
+	}
+	fclose(pre);
 
 	pthread_t watchdog;
 
 	pthread_create(&watchdog, NULL, watchdog_func, NULL);
 
-	f = fopen(file,"r+");
-	if (!f) {
+	/* Probe with a one-byte ranged request: a 206 tells us the server
+	 * honors ranges (and how big the image is), so the rest can come
+	 * down in parallel; a 200 means it's already sending everything. */
+	int probe = open_connection();
+	if (probe < 0) {
 		network_error(0);
 	}
 
-#if 0
-	char * vbuf = malloc(10240);
-	setvbuf(f,vbuf,_IOLBF,10240);
-#endif
-
 	watchdog_success = 1;
 
 	TRACE("Connection established.\n");
 
-	fprintf(f,
-		"GET /%s HTTP/1.0\r\n"
-		"User-Agent: curl/7.35.0\r\n"
-		"Host: %s\r\n"
-		"Accept: */*\r\n"
-		"\r\n", my_req.path, my_req.domain);
+	size_t clen = 0;
+	size_t total = 0;
+	int status = http_get_range(probe, 0, 0, &clen, &total);
 
 	gettimeofday(&start, NULL);
 
-	hashmap_t * headers = hashmap_create(10);
+	uint32_t crc32 = 0xffffffff;
 
-	/* Parse response */
-	{
-		char buf[BUF_SIZE];
-		read_http_line(buf, f);
-		TRACE("[%s]\n", buf);
-
-		char * elements[3];
-
-		elements[0] = buf;
-		elements[1] = strchr(elements[0], ' ');
-		if (!elements[1]) bad_response();
-		*elements[1] = '\0';
-		elements[1]++;
-
-		elements[2] = strchr(elements[1], ' ');
-		if (!elements[2]) bad_response();
-		*elements[2] = '\0';
-		elements[2]++;
-
-		if (strcmp(elements[1], "200")) {
-			TRACE("Bad response code: %s\n", elements[1]);
-			return 1;
+	if (status == 206 && total > 0) {
+		/* Throw away the probe byte and fan out. */
+		char c;
+		read(probe, &c, 1);
+		close(probe);
+
+		TRACE("Image is %lukB; downloading %d segments.\n", (unsigned long)total / 1024, NUM_SEGMENTS);
+
+		size_t seg_size = (total + NUM_SEGMENTS - 1) / NUM_SEGMENTS;
+		pthread_t seg_threads[NUM_SEGMENTS];
+		for (int i = 0; i < NUM_SEGMENTS; ++i) {
+			segments[i].start = i * seg_size;
+			segments[i].end   = segments[i].start + seg_size - 1;
+			if (segments[i].end >= total) segments[i].end = total - 1;
+			segments[i].got    = 0;
+			segments[i].done   = 0;
+			segments[i].failed = 0;
+			pthread_create(&seg_threads[i], NULL, segment_func, &segments[i]);
 		}
-	}
 
-	while (1) {
-		char buf[BUF_SIZE];
-		read_http_line(buf, f);
-
-		if (!*buf) {
-			TRACE("(done with headers)\n");
-			break;
+		while (1) {
+			int running = 0;
+			for (int i = 0; i < NUM_SEGMENTS; ++i) {
+				if (!segments[i].done) running = 1;
+			}
+			draw_progress(total, total_progress);
+			if (!running) break;
+			usleep(200000);
 		}
 
-		/* Split */
-		char * name = buf;
-		char * value = strstr(buf, ": ");
-		if (!value) bad_response();
-		*value = '\0';
-		value += 2;
-
-		hashmap_set(headers, name, strdup(value));
-	}
-
-#if 1
-	TRACE("Dumping headers.\n");
-	list_t * hash_keys = hashmap_keys(headers);
-	foreach(_key, hash_keys) {
-		char * key = (char *)_key->value;
-		TRACE("[%s] = %s\n", key, (char*)hashmap_get(headers, key));
-	}
-	list_free(hash_keys);
-	free(hash_keys);
-#endif
+		for (int i = 0; i < NUM_SEGMENTS; ++i) {
+			if (segments[i].failed) {
+				TRACE("\nSegment %d failed after %d attempts.\n", i, SEGMENT_RETRIES);
+				network_error(0);
+			}
+		}
 
-	/* determine how many bytes we should read now */
-	if (!hashmap_has(headers, "Content-Length")) {
-		TRACE("Don't know how much to read.\n");
-		return 1;
-	}
+		/* Each segment checksummed its own bytes as they arrived; fold
+		 * them into the whole-image CRC. */
+		crc32 = segments[0].crc;
+		for (int i = 1; i < NUM_SEGMENTS; ++i) {
+			crc32 = crc32_combine(crc32, segments[i].crc, segments[i].end - segments[i].start + 1);
+		}
+	} else if (status == 200 && clen > 0) {
+		/* No range support; stream the whole body on this connection. */
+		TRACE("Server doesn't do ranges; using one stream.\n");
+
+		total = clen;
+		int out = open(img, O_WRONLY);
+		char * buf = malloc(CHUNK_SIZE);
+		size_t bytes_read = 0;
+
+		while (bytes_read < total) {
+			size_t want = total - bytes_read;
+			if (want > CHUNK_SIZE) want = CHUNK_SIZE;
+			ssize_t r = read(probe, buf, want);
+			if (r <= 0) break;
+			write(out, buf, r);
+			for (ssize_t i = 0; i < r; ++i) {
+				int ind = (crc32 ^ buf[i]) & 0xFF;
+				crc32 = (crc32 >> 8) ^ (crctab[ind]);
+			}
+			bytes_read += r;
+			draw_progress(total, bytes_read);
+		}
 
-	int bytes_to_read = atoi(hashmap_get(headers, "Content-Length"));
-	size_t bytes_total = (size_t)bytes_to_read;
-	size_t bytes_read = 0;
+		free(buf);
+		close(out);
+		close(probe);
 
-#define RBUF_SIZE 10240
-	char * buf = malloc(RBUF_SIZE);
-	uint32_t crc32 = 0xffffffff;
-	while (bytes_to_read > 0) {
-		size_t r = fread(buf, 1, bytes_to_read < RBUF_SIZE ? bytes_to_read : RBUF_SIZE, f);
-		fwrite(buf, 1, r, fetch_options.out);
-		for (size_t i = 0; i < r; ++i) {
-			int ind = (crc32 ^ buf[i]) & 0xFF;
-			crc32 = (crc32 >> 8) ^ (crctab[ind]);
+		if (bytes_read < total) {
+			TRACE("\nConnection dropped %lu bytes short.\n", (unsigned long)(total - bytes_read));
+			network_error(0);
 		}
-		bytes_to_read -= r;
-		bytes_read += r;
-		draw_progress(bytes_total, bytes_read);
+
+		crc32 ^= 0xffffffff;
+	} else {
+		bad_response();
 	}
-	crc32 ^= 0xffffffff;
-	free(buf);
 
 	TRACE("\nDone: 0x%x\n", (unsigned int)crc32);
 
-	fflush(fetch_options.out);
-	fclose(fetch_options.out);
-
-#if 0
-	FILE * xtmp = fopen(img, "r");
-	crc32 = 0xffffffff;
-	int tab = 0;
-	size_t bytesread = 0;
-	while (!feof(xtmp)) {
-		uint8_t buf[1024];
-		size_t r = fread(buf, 1, 1024, xtmp);
-		for (size_t i = 0; i < r; ++i) {
-			if (tab & 0x01) {
-				TRACE("%2x ", (unsigned char)buf[i]);
-			} else {
-				TRACE("%2x", (unsigned char)buf[i]);
-			}
-			tab++;
-			if (tab == 32){
-				tab = 0;
-				TRACE("\n");
-			}
-			int ind = (crc32 ^ buf[i]) & 0xFF;
-			crc32 = (crc32 >> 8) ^ (crctab[ind]);
-		}
-		bytesread += r;
-	}
-	crc32 ^= 0xffffffff;
-	TRACE("\nDisk crc32: 0x%x (%d)\n", (unsigned int)crc32, bytesread);
-#endif
-
 	TRACE("Mounting filesystem... ");
 	int err = 0;
 	if ((err = mount(img, "/", "ext2", 0, NULL))) {